@@ -48,6 +48,7 @@
 #include "kvm-cpus.h"
 #include "sysemu/dirtylimit.h"
 #include "qemu/range.h"
+#include "block/thread-pool.h"
 
 #include "hw/boards.h"
 #include "sysemu/stats.h"
@@ -618,7 +619,11 @@ static bool kvm_slot_get_dirty_log(KVMState *s, KVMSlot *slot)
     return ret == 0;
 }
 
-/* Should be with all slots_lock held for the address spaces. */
+/*
+ * Should be with all slots_lock held for the address spaces.  The rings
+ * of different vcpus can be reaped in parallel, so the bit is set
+ * atomically.
+ */
 static void kvm_dirty_ring_mark_page(KVMState *s, uint32_t as_id,
                                      uint32_t slot_id, uint64_t offset)
 {
@@ -637,7 +642,7 @@ static void kvm_dirty_ring_mark_page(KVMState *s, uint32_t as_id,
         return;
     }
 
-    set_bit(offset, mem->dirty_bmap);
+    set_bit_atomic(offset, mem->dirty_bmap);
 }
 
 static bool dirty_gfn_is_dirtied(struct kvm_dirty_gfn *gfn)
@@ -710,22 +715,79 @@ static uint32_t kvm_dirty_ring_reap_one(KVMState *s, CPUState *cpu)
     return count;
 }
 
+typedef struct KVMDirtyRingReapJob {
+    KVMState *s;
+    CPUState *cpu;
+    uint32_t count;
+} KVMDirtyRingReapJob;
+
+static int kvm_dirty_ring_reap_job(void *opaque)
+{
+    KVMDirtyRingReapJob *job = opaque;
+
+    job->count = kvm_dirty_ring_reap_one(job->s, job->cpu);
+    return 0;
+}
+
+/*
+ * Reap the rings of all the vcpus with the reaper worker threads.  The
+ * caller keeps holding the slots_lock on behalf of the workers until
+ * they are all done.
+ */
+static uint64_t kvm_dirty_ring_reap_parallel(KVMState *s, uint32_t *max_fill)
+{
+    g_autofree KVMDirtyRingReapJob *jobs = NULL;
+    uint64_t total = 0;
+    CPUState *cpu;
+    int n = 0, i;
+
+    CPU_FOREACH(cpu) {
+        n++;
+    }
+    jobs = g_new(KVMDirtyRingReapJob, n);
+
+    i = 0;
+    CPU_FOREACH(cpu) {
+        if (i == n) {
+            break;
+        }
+        jobs[i] = (KVMDirtyRingReapJob) { .s = s, .cpu = cpu };
+        thread_pool_submit_work(s->kvm_dirty_ring_reap_pool,
+                                kvm_dirty_ring_reap_job, &jobs[i], NULL);
+        i++;
+    }
+    thread_pool_wait(s->kvm_dirty_ring_reap_pool);
+
+    while (i--) {
+        total += jobs[i].count;
+        *max_fill = MAX(*max_fill, jobs[i].count);
+    }
+
+    return total;
+}
+
 /* Must be with slots_lock held */
 static uint64_t kvm_dirty_ring_reap_locked(KVMState *s, CPUState* cpu)
 {
     int ret;
     uint64_t total = 0;
+    uint32_t count, max_fill = 0;
     int64_t stamp;
 
     stamp = get_clock();
 
     if (cpu) {
-        total = kvm_dirty_ring_reap_one(s, cpu);
+        total = max_fill = kvm_dirty_ring_reap_one(s, cpu);
+    } else if (s->kvm_dirty_ring_reap_pool) {
+        total = kvm_dirty_ring_reap_parallel(s, &max_fill);
     } else {
         CPU_FOREACH(cpu) {
-            total += kvm_dirty_ring_reap_one(s, cpu);
+            count = kvm_dirty_ring_reap_one(s, cpu);
+            total += count;
+            max_fill = MAX(max_fill, count);
         }
     }
+    s->reaper.max_fill = MAX(s->reaper.max_fill, max_fill);
 
     if (total) {
         ret = kvm_vm_ioctl(s, KVM_RESET_DIRTY_RINGS);
@@ -1376,6 +1438,34 @@ static void kvm_set_phys_mem(KVMMemoryListener *kml,
     } while (size);
 }
 
+/* Bounds of the time the reaper sleeps between two reaps */
+#define KVM_DIRTY_RING_REAPER_MIN_INTERVAL_US   (10 * 1000)
+#define KVM_DIRTY_RING_REAPER_MAX_INTERVAL_US   (1000 * 1000)
+
+/*
+ * The ring size is fixed when the VM is created, so adapt how often the
+ * rings are reaped instead: reap more often when a ring got more than half
+ * full since the last iteration, and back off when all of them stayed
+ * mostly empty.  This keeps vcpus from exiting with full rings when the
+ * guest dirties memory quickly, without waking up needlessly when it is
+ * idle.  Must be called with the BQL held.
+ */
+static void kvm_dirty_ring_reaper_adapt(KVMState *s)
+{
+    struct KVMDirtyRingReaper *r = &s->reaper;
+    uint32_t fill = r->max_fill;
+
+    r->max_fill = 0;
+    if (fill > s->kvm_dirty_ring_size / 2) {
+        r->reaper_interval_us = MAX(r->reaper_interval_us / 2,
+                                    KVM_DIRTY_RING_REAPER_MIN_INTERVAL_US);
+    } else if (fill < s->kvm_dirty_ring_size / 8) {
+        r->reaper_interval_us = MIN(r->reaper_interval_us * 2,
+                                    KVM_DIRTY_RING_REAPER_MAX_INTERVAL_US);
+    }
+    trace_kvm_dirty_ring_reaper_interval(fill, r->reaper_interval_us);
+}
+
 static void *kvm_dirty_ring_reaper_thread(void *data)
 {
     KVMState *s = data;
@@ -1388,10 +1478,7 @@ static void *kvm_dirty_ring_reaper_thread(void *data)
     while (true) {
         r->reaper_state = KVM_DIRTY_RING_REAPER_WAIT;
         trace_kvm_dirty_ring_reaper("wait");
-        /*
-         * TODO: provide a smarter timeout rather than a constant?
-         */
-        sleep(1);
+        g_usleep(r->reaper_interval_us);
 
         /* keep sleeping so that dirtylimit not be interfered by reaper */
         if (dirtylimit_in_service()) {
@@ -1403,6 +1490,7 @@ static void *kvm_dirty_ring_reaper_thread(void *data)
 
         bql_lock();
         kvm_dirty_ring_reap(s, NULL);
+        kvm_dirty_ring_reaper_adapt(s);
         bql_unlock();
 
         r->reaper_iteration++;
@@ -1419,6 +1507,7 @@ static void kvm_dirty_ring_reaper_init(KVMState *s)
 {
     struct KVMDirtyRingReaper *r = &s->reaper;
 
+    r->reaper_interval_us = KVM_DIRTY_RING_REAPER_MAX_INTERVAL_US;
     qemu_thread_create(&r->reaper_thr, "kvm-reaper",
                        kvm_dirty_ring_reaper_thread,
                        s, QEMU_THREAD_JOINABLE);
@@ -1484,6 +1573,12 @@ static int kvm_dirty_ring_init(KVMState *s)
     s->kvm_dirty_ring_size = ring_size;
     s->kvm_dirty_ring_bytes = ring_bytes;
 
+    if (s->kvm_dirty_ring_reap_threads) {
+        s->kvm_dirty_ring_reap_pool = thread_pool_new();
+        thread_pool_set_max_threads(s->kvm_dirty_ring_reap_pool,
+                                    s->kvm_dirty_ring_reap_threads);
+    }
+
     return 0;
 }
 
@@ -2662,6 +2757,7 @@ static int kvm_handle_internal_error(CPUState *cpu, struct kvm_run *run)
 void kvm_flush_coalesced_mmio_buffer(void)
 {
     KVMState *s = kvm_state;
+    unsigned int n = 0;
 
     if (!s || s->coalesced_flush_in_progress) {
         return;
@@ -2685,8 +2781,12 @@ void kvm_flush_coalesced_mmio_buffer(void)
             }
             smp_wmb();
             ring->first = (ring->first + 1) % KVM_COALESCED_MMIO_MAX;
+            n++;
         }
     }
+    if (n) {
+        trace_kvm_flush_coalesced_mmio(n);
+    }
 
     s->coalesced_flush_in_progress = false;
 }
@@ -2938,6 +3038,8 @@ int kvm_cpu_exec(CPUState *cpu)
              */
             trace_kvm_dirty_ring_full(cpu->cpu_index);
             bql_lock();
+            /* The reaper did not keep up, have it run more often */
+            kvm_state->reaper.max_fill = kvm_state->kvm_dirty_ring_size;
             /*
              * We throttle vCPU by making it sleep once it exit from kernel
              * due to dirty ring full. In the dirtylimit scenario, reaping
@@ -3595,6 +3697,39 @@ static void kvm_set_dirty_ring_size(Object *obj, Visitor *v,
     s->kvm_dirty_ring_size = value;
 }
 
+static void kvm_get_dirty_ring_reap_threads(Object *obj, Visitor *v,
+                                            const char *name, void *opaque,
+                                            Error **errp)
+{
+    KVMState *s = KVM_STATE(obj);
+    uint32_t value = s->kvm_dirty_ring_reap_threads;
+
+    visit_type_uint32(v, name, &value, errp);
+}
+
+static void kvm_set_dirty_ring_reap_threads(Object *obj, Visitor *v,
+                                            const char *name, void *opaque,
+                                            Error **errp)
+{
+    KVMState *s = KVM_STATE(obj);
+    uint32_t value;
+
+    if (s->fd != -1) {
+        error_setg(errp, "Cannot set properties after the accelerator has been initialized");
+        return;
+    }
+
+    if (!visit_type_uint32(v, name, &value, errp)) {
+        return;
+    }
+    if (value > 64) {
+        error_setg(errp, "dirty-ring-reap-threads must be at most 64.");
+        return;
+    }
+
+    s->kvm_dirty_ring_reap_threads = value;
+}
+
 static char *kvm_get_device(Object *obj,
                             Error **errp G_GNUC_UNUSED)
 {
@@ -3625,6 +3760,8 @@ static void kvm_accel_instance_init(Object *obj)
     /* KVM dirty ring is by default off */
     s->kvm_dirty_ring_size = 0;
     s->kvm_dirty_ring_with_bitmap = false;
+    s->kvm_dirty_ring_reap_threads = 0;
+    s->kvm_dirty_ring_reap_pool = NULL;
     s->kvm_eager_split_size = 0;
     s->notify_vmexit = NOTIFY_VMEXIT_OPTION_RUN;
     s->notify_window = 0;
@@ -3672,6 +3809,13 @@ static void kvm_accel_class_init(ObjectClass *oc, void *data)
     object_class_property_set_description(oc, "dirty-ring-size",
         "Size of KVM dirty page ring buffer (default: 0, i.e. use bitmap)");
 
+    object_class_property_add(oc, "dirty-ring-reap-threads", "uint32",
+        kvm_get_dirty_ring_reap_threads, kvm_set_dirty_ring_reap_threads,
+        NULL, NULL);
+    object_class_property_set_description(oc, "dirty-ring-reap-threads",
+        "Number of threads reaping the KVM dirty rings of the vcpus "
+        "(default: 0, i.e. reap them in the caller)");
+
     object_class_property_add_str(oc, "device", kvm_get_device, kvm_set_device);
     object_class_property_set_description(oc, "device",
         "Path to the device node to use (default: /dev/kvm)");
@@ -39,6 +39,7 @@
 #include "tb-jmp-cache.h"
 #include "tb-hash.h"
 #include "tb-context.h"
+#include "tb-profile.h"
 #include "internal-common.h"
 #include "internal-target.h"
 
@@ -162,6 +163,9 @@ uint32_t curr_cflags(CPUState *cpu)
     } else if (qemu_loglevel_mask(CPU_LOG_TB_NOCHAIN)) {
         cflags |= CF_NO_GOTO_TB;
     }
+    if (unlikely(qatomic_read(&tb_profile_enabled))) {
+        cflags |= CF_PROFILE;
+    }
 
     return cflags;
 }
@@ -243,6 +247,7 @@ static inline TranslationBlock *tb_lookup(CPUState *cpu, vaddr pc,
     TranslationBlock *tb;
     CPUJumpCache *jc;
     uint32_t hash;
+    int way;
 
     /* we should never be trying to look up an INVALID tb */
     tcg_debug_assert(!(cflags & CF_INVALID));
@@ -250,13 +255,18 @@ static inline TranslationBlock *tb_lookup(CPUState *cpu, vaddr pc,
     hash = tb_jmp_cache_hash_func(pc);
     jc = cpu->tb_jmp_cache;
 
-    tb = qatomic_read(&jc->array[hash].tb);
-    if (likely(tb &&
-               jc->array[hash].pc == pc &&
-               tb->cs_base == cs_base &&
-               tb->flags == flags &&
-               tb_cflags(tb) == cflags)) {
-        goto hit;
+    for (way = 0; way < TB_JMP_CACHE_WAYS; way++) {
+        tb = qatomic_read(&jc->array[hash][way].tb);
+        if (likely(tb &&
+                   jc->array[hash][way].pc == pc &&
+                   tb->cs_base == cs_base &&
+                   tb->flags == flags &&
+                   tb_cflags(tb) == cflags)) {
+            if (way) {
+                tb_jmp_cache_set_mru(jc, hash, way, pc, tb);
+            }
+            goto hit;
+        }
     }
 
     tb = tb_htable_lookup(cpu, pc, cs_base, flags, cflags);
@@ -264,8 +274,7 @@ static inline TranslationBlock *tb_lookup(CPUState *cpu, vaddr pc,
         return NULL;
     }
 
-    jc->array[hash].pc = pc;
-    qatomic_set(&jc->array[hash].tb, tb);
+    tb_jmp_cache_insert(jc, hash, pc, tb);
 
 hit:
     /*
@@ -460,6 +469,7 @@ cpu_tb_exec(CPUState *cpu, TranslationBlock *itb, int *tb_exit)
     *tb_exit = ret & TB_EXIT_MASK;
 
     trace_exec_tb_exit(last_tb, *tb_exit);
+    tb_profile_exit(last_tb, *tb_exit);
 
     if (*tb_exit > TB_EXIT_IDX1) {
         /* We didn't start executing this TB (eg because the instruction
@@ -995,8 +1005,7 @@ cpu_exec_loop(CPUState *cpu, SyncClocks *sc)
                  */
                 h = tb_jmp_cache_hash_func(pc);
                 jc = cpu->tb_jmp_cache;
-                jc->array[h].pc = pc;
-                qatomic_set(&jc->array[h].tb, tb);
+                tb_jmp_cache_insert(jc, h, pc, tb);
             }
 
 #ifndef CONFIG_USER_ONLY
@@ -105,7 +105,7 @@ static void tlb_window_reset(CPUTLBDesc *desc, int64_t ns,
 static void tb_jmp_cache_clear_page(CPUState *cpu, vaddr page_addr)
 {
     CPUJumpCache *jc = cpu->tb_jmp_cache;
-    int i, i0;
+    int i, i0, way;
 
     if (unlikely(!jc)) {
         return;
@@ -113,7 +113,9 @@ static void tb_jmp_cache_clear_page(CPUState *cpu, vaddr page_addr)
 
     i0 = tb_jmp_cache_hash_page(page_addr);
     for (i = 0; i < TB_JMP_PAGE_SIZE; i++) {
-        qatomic_set(&jc->array[i0 + i].tb, NULL);
+        for (way = 0; way < TB_JMP_CACHE_WAYS; way++) {
+            qatomic_set(&jc->array[i0 + i][way].tb, NULL);
+        }
     }
 }
 
@@ -237,7 +239,7 @@ static void tlb_mmu_flush_locked(CPUTLBDesc *desc, CPUTLBDescFast *fast)
     desc->n_used_entries = 0;
     desc->large_page_addr = -1;
     desc->large_page_mask = -1;
-    desc->vindex = 0;
+    memset(desc->vindex, 0, sizeof(desc->vindex));
     memset(fast->table, -1, sizeof_tlb(fast));
     memset(desc->vtable, -1, sizeof(desc->vtable));
 }
@@ -280,6 +282,7 @@ void tlb_init(CPUState *cpu)
     int i;
 
     qemu_spin_init(&cpu->neg.tlb.c.lock);
+    qemu_spin_init(&cpu->neg.tlb.c.pending_lock);
 
     /* All tlbs are initialized flushed. */
     cpu->neg.tlb.c.dirty = 0;
@@ -294,6 +297,7 @@ void tlb_destroy(CPUState *cpu)
     int i;
 
     qemu_spin_destroy(&cpu->neg.tlb.c.lock);
+    qemu_spin_destroy(&cpu->neg.tlb.c.pending_lock);
     for (i = 0; i < NB_MMU_MODES; i++) {
         CPUTLBDesc *desc = &cpu->neg.tlb.d[i];
         CPUTLBDescFast *fast = &cpu->neg.tlb.f[i];
@@ -451,16 +455,34 @@ static inline bool tlb_flush_entry_locked(CPUTLBEntry *tlb_entry, vaddr page)
     return tlb_flush_entry_mask_locked(tlb_entry, page, -1);
 }
 
+/*
+ * The first entry of the victim tlb set that can hold @page.  The main
+ * tlb has at least as many entries as there are sets, so an entry that
+ * is evicted from the main tlb, or swapped back into it, stays in the
+ * set of its page.
+ */
+static inline size_t vtlb_set_first(vaddr page)
+{
+    QEMU_BUILD_BUG_ON(CPU_VTLB_SETS > (1 << CPU_TLB_DYN_MIN_BITS));
+    return ((page >> TARGET_PAGE_BITS) & (CPU_VTLB_SETS - 1)) * CPU_VTLB_WAYS;
+}
+
 /* Called with tlb_c.lock held */
 static void tlb_flush_vtlb_page_mask_locked(CPUState *cpu, int mmu_idx,
                                             vaddr page,
                                             vaddr mask)
 {
     CPUTLBDesc *d = &cpu->neg.tlb.d[mmu_idx];
-    int k;
+    size_t k = 0, end = CPU_VTLB_SIZE;
 
     assert_cpu_is_self(cpu);
-    for (k = 0; k < CPU_VTLB_SIZE; k++) {
+
+    /* Unless @mask ignores some of the set index bits, scan just one set */
+    if (((~mask >> TARGET_PAGE_BITS) & (CPU_VTLB_SETS - 1)) == 0) {
+        k = vtlb_set_first(page);
+        end = k + CPU_VTLB_WAYS;
+    }
+    for (; k < end; k++) {
         if (tlb_flush_entry_mask_locked(&d->vtable[k], page, mask)) {
             tlb_n_used_entries_dec(cpu, mmu_idx);
         }
@@ -473,6 +495,40 @@ static inline void tlb_flush_vtlb_page_locked(CPUState *cpu, int mmu_idx,
     tlb_flush_vtlb_page_mask_locked(cpu, mmu_idx, page, -1);
 }
 
+/*
+ * Flush the region covering all the large pages of @midx.  Unless the
+ * region has more pages than the tlb has entries, flush it page by page
+ * to keep the rest of the tlb.  Either way no large page is left.
+ * Returns true if the whole tlb was flushed.
+ */
+static bool tlb_flush_large_pages_locked(CPUState *cpu, int midx)
+{
+    CPUTLBDesc *d = &cpu->neg.tlb.d[midx];
+    vaddr lp_addr = d->large_page_addr;
+    vaddr lp_len = -d->large_page_mask;
+
+    if (lp_len == 0 ||
+        (lp_len >> TARGET_PAGE_BITS) > tlb_n_entries(&cpu->neg.tlb.f[midx])) {
+        tlb_debug("forcing full flush midx %d (%016"
+                  VADDR_PRIx "/%016" VADDR_PRIx ")\n",
+                  midx, lp_addr, d->large_page_mask);
+        tlb_flush_one_mmuidx_locked(cpu, midx, get_clock_realtime());
+        return true;
+    }
+
+    for (vaddr i = 0; i < lp_len; i += TARGET_PAGE_SIZE) {
+        vaddr page = lp_addr + i;
+
+        if (tlb_flush_entry_locked(tlb_entry(cpu, midx, page), page)) {
+            tlb_n_used_entries_dec(cpu, midx);
+        }
+        tlb_flush_vtlb_page_locked(cpu, midx, page);
+    }
+    d->large_page_addr = -1;
+    d->large_page_mask = -1;
+    return false;
+}
+
 static void tlb_flush_page_locked(CPUState *cpu, int midx, vaddr page)
 {
     vaddr lp_addr = cpu->neg.tlb.d[midx].large_page_addr;
@@ -480,10 +536,7 @@ static void tlb_flush_page_locked(CPUState *cpu, int midx, vaddr page)
 
     /* Check if we need to flush due to large pages.  */
     if ((page & lp_mask) == lp_addr) {
-        tlb_debug("forcing full flush midx %d (%016"
-                  VADDR_PRIx "/%016" VADDR_PRIx ")\n",
-                  midx, lp_addr, lp_mask);
-        tlb_flush_one_mmuidx_locked(cpu, midx, get_clock_realtime());
+        tlb_flush_large_pages_locked(cpu, midx);
     } else {
         if (tlb_flush_entry_locked(tlb_entry(cpu, midx, page), page)) {
             tlb_n_used_entries_dec(cpu, midx);
@@ -571,6 +624,104 @@ static void tlb_flush_page_by_mmuidx_async_2(CPUState *cpu,
     g_free(d);
 }
 
+static void tlb_flush_range_by_mmuidx_async_0(CPUState *cpu,
+                                              TLBFlushRangeData d);
+
+/*
+ * Do the page and range flushes that other cpus queued for @cpu
+ * with tlb_queue_flush().
+ */
+static void tlb_flush_pending_async_work(CPUState *cpu, run_on_cpu_data data)
+{
+    CPUTLBCommon *c = &cpu->neg.tlb.c;
+    TLBFlushRangeData pending[CPU_TLB_PENDING_FLUSHES];
+    unsigned int i, n;
+    uint16_t full;
+
+    assert_cpu_is_self(cpu);
+
+    qemu_spin_lock(&c->pending_lock);
+    n = c->n_pending;
+    memcpy(pending, c->pending, n * sizeof(pending[0]));
+    full = c->pending_full;
+    c->n_pending = 0;
+    c->pending_full = 0;
+    c->pending_scheduled = false;
+    qemu_spin_unlock(&c->pending_lock);
+
+    if (full) {
+        tlb_flush_by_mmuidx_async_work(cpu, RUN_ON_CPU_HOST_INT(full));
+    }
+    for (i = 0; i < n; i++) {
+        TLBFlushRangeData *d = &pending[i];
+
+        d->idxmap &= ~full;
+        if (!d->idxmap) {
+            continue;
+        }
+        if (d->bits >= TARGET_LONG_BITS && d->len <= TARGET_PAGE_SIZE) {
+            tlb_flush_page_by_mmuidx_async_0(cpu, d->addr, d->idxmap);
+        } else {
+            tlb_flush_range_by_mmuidx_async_0(cpu, *d);
+        }
+    }
+}
+
+/*
+ * Queue a page or range flush for @cpu, which is not the current cpu.
+ *
+ * All the flushes that are queued before @cpu gets to them are done by
+ * a single work item.  A flush that is contiguous with, or contained in,
+ * the last one queued is merged into it, and a flush that does not fit
+ * in the queue promotes all of them to a flush of their mmu indexes.
+ * This keeps a guest that invalidates many pages on all cpus, one TLBI
+ * at a time, from flooding the work queues.
+ */
+static void tlb_queue_flush(CPUState *cpu, vaddr addr, vaddr len,
+                            uint16_t idxmap, unsigned bits)
+{
+    CPUTLBCommon *c = &cpu->neg.tlb.c;
+    TLBFlushRangeData *last;
+    bool schedule;
+
+    qemu_spin_lock(&c->pending_lock);
+    last = c->n_pending ? &c->pending[c->n_pending - 1] : NULL;
+
+    if (!(idxmap & ~c->pending_full)) {
+        /* Subsumed by a queued flush of the whole mmu indexes */
+        qatomic_set(&c->merge_flush_count, c->merge_flush_count + 1);
+    } else if (last && last->idxmap == idxmap && last->bits == bits &&
+               addr >= last->addr && addr <= last->addr + last->len) {
+        last->len = MAX(last->len, addr + len - last->addr);
+        qatomic_set(&c->merge_flush_count, c->merge_flush_count + 1);
+    } else if (c->n_pending == CPU_TLB_PENDING_FLUSHES) {
+        uint16_t full = idxmap;
+        unsigned int i;
+
+        for (i = 0; i < c->n_pending; i++) {
+            full |= c->pending[i].idxmap;
+        }
+        c->pending_full |= full;
+        c->n_pending = 0;
+        qatomic_set(&c->promote_flush_count, c->promote_flush_count + 1);
+    } else {
+        c->pending[c->n_pending++] = (TLBFlushRangeData) {
+            .addr = addr,
+            .len = len,
+            .idxmap = idxmap,
+            .bits = bits,
+        };
+    }
+
+    schedule = !c->pending_scheduled;
+    c->pending_scheduled = true;
+    qemu_spin_unlock(&c->pending_lock);
+
+    if (schedule) {
+        async_run_on_cpu(cpu, tlb_flush_pending_async_work, RUN_ON_CPU_NULL);
+    }
+}
+
 void tlb_flush_page_by_mmuidx(CPUState *cpu, vaddr addr, uint16_t idxmap)
 {
     tlb_debug("addr: %016" VADDR_PRIx " mmu_idx:%" PRIx16 "\n", addr, idxmap);
@@ -580,22 +731,8 @@ void tlb_flush_page_by_mmuidx(CPUState *cpu, vaddr addr, uint16_t idxmap)
 
     if (qemu_cpu_is_self(cpu)) {
         tlb_flush_page_by_mmuidx_async_0(cpu, addr, idxmap);
-    } else if (idxmap < TARGET_PAGE_SIZE) {
-        /*
-         * Most targets have only a few mmu_idx.  In the case where
-         * we can stuff idxmap into the low TARGET_PAGE_BITS, avoid
-         * allocating memory for this operation.
-         */
-        async_run_on_cpu(cpu, tlb_flush_page_by_mmuidx_async_1,
-                         RUN_ON_CPU_TARGET_PTR(addr | idxmap));
     } else {
-        TLBFlushPageByMMUIdxData *d = g_new(TLBFlushPageByMMUIdxData, 1);
-
-        /* Otherwise allocate a structure, freed by the worker.  */
-        d->addr = addr;
-        d->idxmap = idxmap;
-        async_run_on_cpu(cpu, tlb_flush_page_by_mmuidx_async_2,
-                         RUN_ON_CPU_HOST_PTR(d));
+        tlb_queue_flush(cpu, addr, TARGET_PAGE_SIZE, idxmap, TARGET_LONG_BITS);
     }
 }
 
@@ -607,32 +744,17 @@ void tlb_flush_page(CPUState *cpu, vaddr addr)
 void tlb_flush_page_by_mmuidx_all_cpus(CPUState *src_cpu, vaddr addr,
                                        uint16_t idxmap)
 {
+    CPUState *dst_cpu;
+
     tlb_debug("addr: %016" VADDR_PRIx " mmu_idx:%"PRIx16"\n", addr, idxmap);
 
     /* This should already be page aligned */
     addr &= TARGET_PAGE_MASK;
 
-    /*
-     * Allocate memory to hold addr+idxmap only when needed.
-     * See tlb_flush_page_by_mmuidx for details.
-     */
-    if (idxmap < TARGET_PAGE_SIZE) {
-        flush_all_helper(src_cpu, tlb_flush_page_by_mmuidx_async_1,
-                         RUN_ON_CPU_TARGET_PTR(addr | idxmap));
-    } else {
-        CPUState *dst_cpu;
-
-        /* Allocate a separate data block for each destination cpu.  */
-        CPU_FOREACH(dst_cpu) {
-            if (dst_cpu != src_cpu) {
-                TLBFlushPageByMMUIdxData *d
-                    = g_new(TLBFlushPageByMMUIdxData, 1);
-
-                d->addr = addr;
-                d->idxmap = idxmap;
-                async_run_on_cpu(dst_cpu, tlb_flush_page_by_mmuidx_async_2,
-                                 RUN_ON_CPU_HOST_PTR(d));
-            }
+    CPU_FOREACH(dst_cpu) {
+        if (dst_cpu != src_cpu) {
+            tlb_queue_flush(dst_cpu, addr, TARGET_PAGE_SIZE, idxmap,
+                            TARGET_LONG_BITS);
         }
     }
 
@@ -648,36 +770,30 @@ void tlb_flush_page_by_mmuidx_all_cpus_synced(CPUState *src_cpu,
                                               vaddr addr,
                                               uint16_t idxmap)
 {
+    CPUState *dst_cpu;
+
     tlb_debug("addr: %016" VADDR_PRIx " mmu_idx:%"PRIx16"\n", addr, idxmap);
 
     /* This should already be page aligned */
     addr &= TARGET_PAGE_MASK;
 
+    CPU_FOREACH(dst_cpu) {
+        if (dst_cpu != src_cpu) {
+            tlb_queue_flush(dst_cpu, addr, TARGET_PAGE_SIZE, idxmap,
+                            TARGET_LONG_BITS);
+        }
+    }
+
     /*
-     * Allocate memory to hold addr+idxmap only when needed.
-     * See tlb_flush_page_by_mmuidx for details.
+     * Allocate memory to hold addr+idxmap only when needed, in the case
+     * where we cannot stuff idxmap into the low TARGET_PAGE_BITS.
      */
     if (idxmap < TARGET_PAGE_SIZE) {
-        flush_all_helper(src_cpu, tlb_flush_page_by_mmuidx_async_1,
-                         RUN_ON_CPU_TARGET_PTR(addr | idxmap));
         async_safe_run_on_cpu(src_cpu, tlb_flush_page_by_mmuidx_async_1,
                               RUN_ON_CPU_TARGET_PTR(addr | idxmap));
     } else {
-        CPUState *dst_cpu;
-        TLBFlushPageByMMUIdxData *d;
-
-        /* Allocate a separate data block for each destination cpu.  */
-        CPU_FOREACH(dst_cpu) {
-            if (dst_cpu != src_cpu) {
-                d = g_new(TLBFlushPageByMMUIdxData, 1);
-                d->addr = addr;
-                d->idxmap = idxmap;
-                async_run_on_cpu(dst_cpu, tlb_flush_page_by_mmuidx_async_2,
-                                 RUN_ON_CPU_HOST_PTR(d));
-            }
-        }
+        TLBFlushPageByMMUIdxData *d = g_new(TLBFlushPageByMMUIdxData, 1);
 
-        d = g_new(TLBFlushPageByMMUIdxData, 1);
         d->addr = addr;
         d->idxmap = idxmap;
         async_safe_run_on_cpu(src_cpu, tlb_flush_page_by_mmuidx_async_2,
@@ -721,11 +837,8 @@ static void tlb_flush_range_locked(CPUState *cpu, int midx,
      * Because large_page_mask contains all 1's from the msb,
      * we only need to test the end of the range.
      */
-    if (((addr + len - 1) & d->large_page_mask) == d->large_page_addr) {
-        tlb_debug("forcing full flush midx %d ("
-                  "%016" VADDR_PRIx "/%016" VADDR_PRIx ")\n",
-                  midx, d->large_page_addr, d->large_page_mask);
-        tlb_flush_one_mmuidx_locked(cpu, midx, get_clock_realtime());
+    if (((addr + len - 1) & d->large_page_mask) == d->large_page_addr &&
+        tlb_flush_large_pages_locked(cpu, midx)) {
         return;
     }
 
@@ -740,13 +853,6 @@ static void tlb_flush_range_locked(CPUState *cpu, int midx,
     }
 }
 
-typedef struct {
-    vaddr addr;
-    vaddr len;
-    uint16_t idxmap;
-    uint16_t bits;
-} TLBFlushRangeData;
-
 static void tlb_flush_range_by_mmuidx_async_0(CPUState *cpu,
                                               TLBFlushRangeData d)
 {
@@ -822,10 +928,7 @@ void tlb_flush_range_by_mmuidx(CPUState *cpu, vaddr addr,
     if (qemu_cpu_is_self(cpu)) {
         tlb_flush_range_by_mmuidx_async_0(cpu, d);
     } else {
-        /* Otherwise allocate a structure, freed by the worker.  */
-        TLBFlushRangeData *p = g_memdup(&d, sizeof(d));
-        async_run_on_cpu(cpu, tlb_flush_range_by_mmuidx_async_1,
-                         RUN_ON_CPU_HOST_PTR(p));
+        tlb_queue_flush(cpu, d.addr, d.len, d.idxmap, d.bits);
     }
 }
 
@@ -862,13 +965,9 @@ void tlb_flush_range_by_mmuidx_all_cpus(CPUState *src_cpu,
     d.idxmap = idxmap;
     d.bits = bits;
 
-    /* Allocate a separate data block for each destination cpu.  */
     CPU_FOREACH(dst_cpu) {
         if (dst_cpu != src_cpu) {
-            TLBFlushRangeData *p = g_memdup(&d, sizeof(d));
-            async_run_on_cpu(dst_cpu,
-                             tlb_flush_range_by_mmuidx_async_1,
-                             RUN_ON_CPU_HOST_PTR(p));
+            tlb_queue_flush(dst_cpu, d.addr, d.len, d.idxmap, d.bits);
         }
     }
 
@@ -912,12 +1011,9 @@ void tlb_flush_range_by_mmuidx_all_cpus_synced(CPUState *src_cpu,
     d.idxmap = idxmap;
     d.bits = bits;
 
-    /* Allocate a separate data block for each destination cpu.  */
     CPU_FOREACH(dst_cpu) {
         if (dst_cpu != src_cpu) {
-            p = g_memdup(&d, sizeof(d));
-            async_run_on_cpu(dst_cpu, tlb_flush_range_by_mmuidx_async_1,
-                             RUN_ON_CPU_HOST_PTR(p));
+            tlb_queue_flush(dst_cpu, d.addr, d.len, d.idxmap, d.bits);
         }
     }
 
@@ -1052,8 +1148,10 @@ void tlb_set_dirty(CPUState *cpu, vaddr addr)
     }
 
     for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
-        int k;
-        for (k = 0; k < CPU_VTLB_SIZE; k++) {
+        size_t k = vtlb_set_first(addr);
+        size_t end = k + CPU_VTLB_WAYS;
+
+        for (; k < end; k++) {
             tlb_set_dirty1_locked(&cpu->neg.tlb.d[mmu_idx].vtable[k], addr);
         }
     }
@@ -1217,7 +1315,8 @@ void tlb_set_page_full(CPUState *cpu, int mmu_idx,
      * different page; otherwise just overwrite the stale data.
      */
     if (!tlb_hit_page_anyprot(te, addr_page) && !tlb_entry_is_empty(te)) {
-        unsigned vidx = desc->vindex++ % CPU_VTLB_SIZE;
+        size_t set = vtlb_set_first(addr_page);
+        size_t vidx = set + desc->vindex[set / CPU_VTLB_WAYS]++ % CPU_VTLB_WAYS;
         CPUTLBEntry *tv = &desc->vtable[vidx];
 
         /* Evict the old entry into the victim tlb.  */
@@ -1359,10 +1458,11 @@ static void io_failed(CPUState *cpu, CPUTLBEntryFull *full, vaddr addr,
 static bool victim_tlb_hit(CPUState *cpu, size_t mmu_idx, size_t index,
                            MMUAccessType access_type, vaddr page)
 {
-    size_t vidx;
+    size_t vidx = vtlb_set_first(page);
+    size_t end = vidx + CPU_VTLB_WAYS;
 
     assert_cpu_is_self(cpu);
-    for (vidx = 0; vidx < CPU_VTLB_SIZE; ++vidx) {
+    for (; vidx < end; ++vidx) {
         CPUTLBEntry *vtlb = &cpu->neg.tlb.d[mmu_idx].vtable[vidx];
         uint64_t cmp = tlb_read_idx(vtlb, access_type);
 
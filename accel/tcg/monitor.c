@@ -9,9 +9,12 @@
 #include "qemu/osdep.h"
 #include "qemu/accel.h"
 #include "qemu/qht.h"
+#include "qemu/timer.h"
 #include "qapi/error.h"
 #include "qapi/type-helpers.h"
 #include "qapi/qapi-commands-machine.h"
+#include "qapi/qmp/qdict.h"
+#include "monitor/hmp.h"
 #include "monitor/monitor.h"
 #include "sysemu/cpus.h"
 #include "sysemu/cpu-timers.h"
@@ -19,6 +22,7 @@
 #include "tcg/tcg.h"
 #include "internal-common.h"
 #include "tb-context.h"
+#include "tb-profile.h"
 
 
 static void dump_drift_info(GString *buf)
@@ -66,6 +70,8 @@ static void print_qht_statistics(struct qht_stats hst, GString *buf)
                            hst.used_head_buckets, hst.head_buckets,
                            (double)hst.used_head_buckets /
                            hst.head_buckets * 100);
+    g_string_append_printf(buf, "TB hash resizes     %zu%s\n",
+                           hst.resizes, hst.resizing ? " (resizing)" : "");
 
     hgram_opts =  QDIST_PR_BORDER | QDIST_PR_LABELS;
     hgram_opts |= QDIST_PR_100X   | QDIST_PR_PERCENT;
@@ -126,19 +132,24 @@ static gboolean tb_tree_stats_iter(gpointer key, gpointer value, gpointer data)
     return false;
 }
 
-static void tlb_flush_counts(size_t *pfull, size_t *ppart, size_t *pelide)
+static void tlb_flush_counts(size_t *pfull, size_t *ppart, size_t *pelide,
+                             size_t *pmerge, size_t *ppromote)
 {
     CPUState *cpu;
-    size_t full = 0, part = 0, elide = 0;
+    size_t full = 0, part = 0, elide = 0, merge = 0, promote = 0;
 
     CPU_FOREACH(cpu) {
         full += qatomic_read(&cpu->neg.tlb.c.full_flush_count);
         part += qatomic_read(&cpu->neg.tlb.c.part_flush_count);
         elide += qatomic_read(&cpu->neg.tlb.c.elide_flush_count);
+        merge += qatomic_read(&cpu->neg.tlb.c.merge_flush_count);
+        promote += qatomic_read(&cpu->neg.tlb.c.promote_flush_count);
     }
     *pfull = full;
     *ppart = part;
     *pelide = elide;
+    *pmerge = merge;
+    *ppromote = promote;
 }
 
 static void tcg_dump_info(GString *buf)
@@ -150,7 +161,8 @@ static void dump_exec_info(GString *buf)
 {
     struct tb_tree_stats tst = {};
     struct qht_stats hst;
-    size_t nb_tbs, flush_full, flush_part, flush_elide;
+    size_t nb_tbs, flush_full, flush_part, flush_elide, flush_merge;
+    size_t flush_promote;
 
     tcg_tb_foreach(tb_tree_stats_iter, &tst);
     nb_tbs = tst.nb_tbs;
@@ -189,13 +201,18 @@ static void dump_exec_info(GString *buf)
     g_string_append_printf(buf, "\nStatistics:\n");
     g_string_append_printf(buf, "TB flush count      %u\n",
                            qatomic_read(&tb_ctx.tb_flush_count));
+    g_string_append_printf(buf, "TB reclaim count    %u\n",
+                           qatomic_read(&tb_ctx.tb_reclaim_count));
     g_string_append_printf(buf, "TB invalidate count %u\n",
                            qatomic_read(&tb_ctx.tb_phys_invalidate_count));
 
-    tlb_flush_counts(&flush_full, &flush_part, &flush_elide);
+    tlb_flush_counts(&flush_full, &flush_part, &flush_elide,
+                     &flush_merge, &flush_promote);
     g_string_append_printf(buf, "TLB full flushes    %zu\n", flush_full);
     g_string_append_printf(buf, "TLB partial flushes %zu\n", flush_part);
     g_string_append_printf(buf, "TLB elided flushes  %zu\n", flush_elide);
+    g_string_append_printf(buf, "TLB merged flushes  %zu\n", flush_merge);
+    g_string_append_printf(buf, "TLB promoted queues %zu\n", flush_promote);
     tcg_dump_info(buf);
 }
 
@@ -235,10 +252,160 @@ HumanReadableText *qmp_x_query_opcount(Error **errp)
     return human_readable_text_from_str(buf);
 }
 
+#define TB_PROFILE_MAX_TBS      30
+#define TB_PROFILE_MAX_HELPERS  20
+
+void qmp_x_tcg_profile_set(bool enable, bool has_reset, bool reset,
+                           Error **errp)
+{
+    if (!tcg_enabled()) {
+        error_setg(errp, "TB profiling is only available with accel=tcg");
+        return;
+    }
+
+    object_property_set_bool(OBJECT(current_accel()), "profile", enable,
+                             &error_abort);
+    if (has_reset && reset) {
+        tb_profile_reset();
+        tcg_profile_reset_helpers();
+    }
+}
+
+void hmp_tb_profile(Monitor *mon, const QDict *qdict)
+{
+    const char *op = qdict_get_str(qdict, "op");
+    Error *err = NULL;
+
+    if (!strcmp(op, "on")) {
+        qmp_x_tcg_profile_set(true, false, false, &err);
+    } else if (!strcmp(op, "off")) {
+        qmp_x_tcg_profile_set(false, false, false, &err);
+    } else if (!strcmp(op, "reset")) {
+        qmp_x_tcg_profile_set(qatomic_read(&tb_profile_enabled), true, true,
+                              &err);
+    } else {
+        monitor_printf(mon, "unexpected option %s\n", op);
+        return;
+    }
+    hmp_handle_error(mon, err);
+}
+
+static void tb_profile_copy(const TBProfile *prof, void *opaque)
+{
+    GArray *profiles = opaque;
+
+    if (qatomic_read_u64(&prof->exec_count)) {
+        g_array_append_val(profiles, *prof);
+    }
+}
+
+static gint tb_profile_cmp(gconstpointer ap, gconstpointer bp)
+{
+    const TBProfile *a = ap;
+    const TBProfile *b = bp;
+
+    /* Hottest first */
+    return (a->exec_count < b->exec_count) - (a->exec_count > b->exec_count);
+}
+
+static void tcg_profile_helper_copy(const TCGProfileHelper *h, void *opaque)
+{
+    GArray *helpers = opaque;
+    TCGProfileHelper copy = {
+        .name = h->name,
+        .calls = qatomic_read_u64(&h->calls),
+    };
+
+    if (copy.calls) {
+        g_array_append_val(helpers, copy);
+    }
+}
+
+static gint tcg_profile_helper_cmp(gconstpointer ap, gconstpointer bp)
+{
+    const TCGProfileHelper *a = ap;
+    const TCGProfileHelper *b = bp;
+
+    return (a->calls < b->calls) - (a->calls > b->calls);
+}
+
+static void dump_tb_profile(GString *buf)
+{
+    g_autoptr(GArray) profiles = g_array_new(false, false, sizeof(TBProfile));
+    g_autoptr(GArray) helpers = g_array_new(false, false,
+                                            sizeof(TCGProfileHelper));
+    uint64_t execs = 0, calls = 0;
+    guint i;
+
+    tb_profile_foreach(tb_profile_copy, profiles);
+    g_array_sort(profiles, tb_profile_cmp);
+    for (i = 0; i < profiles->len; i++) {
+        execs += g_array_index(profiles, TBProfile, i).exec_count;
+    }
+
+    tcg_profile_foreach_helper(tcg_profile_helper_copy, helpers);
+    g_array_sort(helpers, tcg_profile_helper_cmp);
+    for (i = 0; i < helpers->len; i++) {
+        calls += g_array_index(helpers, TCGProfileHelper, i).calls;
+    }
+
+    g_string_append_printf(buf, "TB profiling        %s\n",
+                           qatomic_read(&tb_profile_enabled) ? "on" : "off");
+    g_string_append_printf(buf, "TB executions       %" PRIu64 "\n", execs);
+    g_string_append_printf(buf, "Unchained exits     %" PRIu64 "\n",
+                           qatomic_read_u64(&tb_profile_indirect_exits));
+    g_string_append_printf(buf, "Helper calls        %" PRIu64 "\n", calls);
+
+    g_string_append_printf(buf, "\nHottest translation blocks:\n");
+    g_string_append_printf(buf, "%16s %6s %18s %8s %5s %6s %6s %12s %12s "
+                           "%12s %10s\n", "execs", "%", "pc", "flags",
+                           "insns", "host", "xlat", "exit0", "exit1",
+                           "requested", "xlat-us");
+    for (i = 0; i < MIN(profiles->len, TB_PROFILE_MAX_TBS); i++) {
+        const TBProfile *p = &g_array_index(profiles, TBProfile, i);
+
+        g_string_append_printf(buf, "%16" PRIu64 " %6.2f 0x%016" VADDR_PRIx
+                               " %08x %5u %6u %6" PRIu64 " %12" PRIu64
+                               " %12" PRIu64 " %12" PRIu64 " %10" PRIu64
+                               "\n", p->exec_count,
+                               100.0 * p->exec_count / execs, p->pc,
+                               p->flags, p->icount, p->host_size,
+                               p->translations,
+                               p->exits[TB_PROFILE_EXIT_IDX0],
+                               p->exits[TB_PROFILE_EXIT_IDX1],
+                               p->exits[TB_PROFILE_EXIT_REQUESTED],
+                               p->translate_ns / SCALE_US);
+    }
+
+    g_string_append_printf(buf, "\nMost called helpers:\n");
+    for (i = 0; i < MIN(helpers->len, TB_PROFILE_MAX_HELPERS); i++) {
+        const TCGProfileHelper *h = &g_array_index(helpers,
+                                                   TCGProfileHelper, i);
+
+        g_string_append_printf(buf, "%16" PRIu64 " %6.2f %s\n", h->calls,
+                               100.0 * h->calls / calls, h->name);
+    }
+}
+
+HumanReadableText *qmp_x_query_tb_profile(Error **errp)
+{
+    g_autoptr(GString) buf = g_string_new("");
+
+    if (!tcg_enabled()) {
+        error_setg(errp, "TB profiling is only available with accel=tcg");
+        return NULL;
+    }
+
+    dump_tb_profile(buf);
+
+    return human_readable_text_from_str(buf);
+}
+
 static void hmp_tcg_register(void)
 {
     monitor_register_hmp_info_hrt("jit", qmp_x_query_jit);
     monitor_register_hmp_info_hrt("opcount", qmp_x_query_opcount);
+    monitor_register_hmp_info_hrt("tb-profile", qmp_x_query_tb_profile);
 }
 
 type_init(hmp_tcg_register);
@@ -12,19 +12,58 @@
 #define TB_JMP_CACHE_BITS 12
 #define TB_JMP_CACHE_SIZE (1 << TB_JMP_CACHE_BITS)
 
+/*
+ * Each hash value selects a set of TB_JMP_CACHE_WAYS entries, ordered
+ * from the most to the least recently used, so that a few hot blocks
+ * whose pc collide (as in the dispatch loop of an interpreter) do not
+ * keep evicting each other.
+ */
+#define TB_JMP_CACHE_WAYS 2
+
 /*
  * Invalidated in parallel; all accesses to 'tb' must be atomic.
  * A valid entry is read/written by a single CPU, therefore there is
  * no need for qatomic_rcu_read() and pc is always consistent with a
  * non-NULL value of 'tb'.  Strictly speaking pc is only needed for
  * CF_PCREL, but it's used always for simplicity.
+ *
+ * Entries are moved within a set by their CPU without synchronizing
+ * with invalidation, so a stale TB can survive in the cache; it is
+ * never used because invalidation also sets CF_INVALID in its cflags.
  */
+typedef struct CPUJumpCacheEntry {
+    TranslationBlock *tb;
+    vaddr pc;
+} CPUJumpCacheEntry;
+
 struct CPUJumpCache {
     struct rcu_head rcu;
-    struct {
-        TranslationBlock *tb;
-        vaddr pc;
-    } array[TB_JMP_CACHE_SIZE];
+    CPUJumpCacheEntry array[TB_JMP_CACHE_SIZE][TB_JMP_CACHE_WAYS];
 };
 
+/*
+ * Make @tb the most recently used entry of set @hash, moving the first
+ * @way entries down by one.  @way is the entry that held @tb, or the
+ * last one of the set to insert a new block.
+ */
+static inline void tb_jmp_cache_set_mru(CPUJumpCache *jc, uint32_t hash,
+                                        int way, vaddr pc,
+                                        TranslationBlock *tb)
+{
+    CPUJumpCacheEntry *set = jc->array[hash];
+
+    for (; way > 0; way--) {
+        set[way].pc = set[way - 1].pc;
+        qatomic_set(&set[way].tb, qatomic_read(&set[way - 1].tb));
+    }
+    set[0].pc = pc;
+    qatomic_set(&set[0].tb, tb);
+}
+
+static inline void tb_jmp_cache_insert(CPUJumpCache *jc, uint32_t hash,
+                                       vaddr pc, TranslationBlock *tb)
+{
+    tb_jmp_cache_set_mru(jc, hash, TB_JMP_CACHE_WAYS - 1, pc, tb);
+}
+
 #endif /* ACCEL_TCG_TB_JMP_CACHE_H */
@@ -18,6 +18,7 @@
  */
 
 #include "qemu/osdep.h"
+#include "qemu/counters.h"
 #include "qemu/interval-tree.h"
 #include "qemu/qtree.h"
 #include "exec/cputlb.h"
@@ -754,6 +755,8 @@ static void tb_remove(TranslationBlock *tb)
 }
 #endif /* CONFIG_USER_ONLY */
 
+QEMU_COUNTER_DEFINE(tb_flushes, "tb-flushes")
+
 /* flush all the translation blocks */
 static void do_tb_flush(CPUState *cpu, run_on_cpu_data tb_flush_count)
 {
@@ -776,6 +779,7 @@ static void do_tb_flush(CPUState *cpu, run_on_cpu_data tb_flush_count)
     tcg_region_reset_all();
     /* XXX: flush processor icache at this point if cache flush is expensive */
     qatomic_inc(&tb_ctx.tb_flush_count);
+    qemu_counter_inc(&tb_flushes);
 
 done:
     mmap_unlock();
@@ -889,8 +893,10 @@ static void tb_jmp_cache_inval_tb(TranslationBlock *tb)
         CPU_FOREACH(cpu) {
             CPUJumpCache *jc = cpu->tb_jmp_cache;
 
-            if (qatomic_read(&jc->array[h].tb) == tb) {
-                qatomic_set(&jc->array[h].tb, NULL);
+            for (int way = 0; way < TB_JMP_CACHE_WAYS; way++) {
+                if (qatomic_read(&jc->array[h][way].tb) == tb) {
+                    qatomic_set(&jc->array[h][way].tb, NULL);
+                }
             }
         }
     }
@@ -900,8 +906,11 @@ static void tb_jmp_cache_inval_tb(TranslationBlock *tb)
  * In user-mode, call with mmap_lock held.
  * In !user-mode, if @rm_from_page_list is set, call with the TB's pages'
  * locks held.
+ * If @evict is set, the TB's region is being reclaimed: the caller flushes
+ * the jump caches and the TB does not count as invalidated.
  */
-static void do_tb_phys_invalidate(TranslationBlock *tb, bool rm_from_page_list)
+static void do_tb_phys_invalidate(TranslationBlock *tb, bool rm_from_page_list,
+                                  bool evict)
 {
     uint32_t h;
     tb_page_addr_t phys_pc;
@@ -928,7 +937,9 @@ static void do_tb_phys_invalidate(TranslationBlock *tb, bool rm_from_page_list)
     }
 
     /* remove the TB from the hash list */
-    tb_jmp_cache_inval_tb(tb);
+    if (!evict) {
+        tb_jmp_cache_inval_tb(tb);
+    }
 
     /* suppress this TB from the two jump lists */
     tb_remove_from_jmp_list(tb, 0);
@@ -937,14 +948,16 @@ static void do_tb_phys_invalidate(TranslationBlock *tb, bool rm_from_page_list)
     /* suppress any remaining jumps to this TB */
     tb_jmp_unlink(tb);
 
-    qatomic_set(&tb_ctx.tb_phys_invalidate_count,
-                tb_ctx.tb_phys_invalidate_count + 1);
+    if (!evict) {
+        qatomic_set(&tb_ctx.tb_phys_invalidate_count,
+                    tb_ctx.tb_phys_invalidate_count + 1);
+    }
 }
 
 static void tb_phys_invalidate__locked(TranslationBlock *tb)
 {
     qemu_thread_jit_write();
-    do_tb_phys_invalidate(tb, true);
+    do_tb_phys_invalidate(tb, true, false);
     qemu_thread_jit_execute();
 }
 
@@ -956,10 +969,67 @@ void tb_phys_invalidate(TranslationBlock *tb, tb_page_addr_t page_addr)
 {
     if (page_addr == -1 && tb_page_addr0(tb) != -1) {
         tb_lock_pages(tb);
-        do_tb_phys_invalidate(tb, true);
+        do_tb_phys_invalidate(tb, true, false);
+        tb_unlock_pages(tb);
+    } else {
+        do_tb_phys_invalidate(tb, false, false);
+    }
+}
+
+/* Drop a TB whose code is about to be overwritten, see tb_reclaim() */
+static void tb_evict(TranslationBlock *tb)
+{
+    if (tb_page_addr0(tb) != -1) {
+        tb_lock_pages(tb);
+        do_tb_phys_invalidate(tb, true, true);
         tb_unlock_pages(tb);
     } else {
-        do_tb_phys_invalidate(tb, false);
+        do_tb_phys_invalidate(tb, false, true);
+    }
+}
+
+static void do_tb_reclaim(CPUState *cpu, run_on_cpu_data tb_reclaim_count)
+{
+    CPUState *other;
+    bool reclaimed;
+
+    mmap_lock();
+    /* If it is already been done on request of another CPU, just retry. */
+    if (tb_ctx.tb_reclaim_count != tb_reclaim_count.host_int) {
+        mmap_unlock();
+        return;
+    }
+
+    qemu_thread_jit_write();
+    reclaimed = tcg_region_reclaim(tb_evict);
+    qemu_thread_jit_execute();
+    if (reclaimed) {
+        CPU_FOREACH(other) {
+            tcg_flush_jmp_cache(other);
+        }
+        qatomic_inc(&tb_ctx.tb_reclaim_count);
+    }
+    mmap_unlock();
+
+    if (!reclaimed) {
+        tb_flush(cpu);
+    }
+}
+
+/*
+ * Make room in the code buffer once it is full.  Unlike tb_flush(), only
+ * the code that was translated first is thrown away, unless the buffer is
+ * made of a single region.
+ */
+void tb_reclaim(CPUState *cpu)
+{
+    unsigned tb_reclaim_count = qatomic_read(&tb_ctx.tb_reclaim_count);
+
+    if (cpu_in_serial_context(cpu)) {
+        do_tb_reclaim(cpu, RUN_ON_CPU_HOST_INT(tb_reclaim_count));
+    } else {
+        async_safe_run_on_cpu(cpu, do_tb_reclaim,
+                              RUN_ON_CPU_HOST_INT(tb_reclaim_count));
     }
 }
 
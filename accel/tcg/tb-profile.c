@@ -0,0 +1,101 @@
+/*
+ * TCG translation block profiling
+ *
+ * Copyright (c) 2024 The QEMU Project Developers
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/lockable.h"
+#include "qemu/xxhash.h"
+#include "tb-profile.h"
+
+bool tb_profile_enabled;
+uint64_t tb_profile_indirect_exits;
+
+/* Protects profiles and the translation statistics of every profile */
+static QemuMutex tb_profile_lock;
+static GHashTable *profiles;
+
+static guint tb_profile_hash(gconstpointer p)
+{
+    const TBProfile *prof = p;
+
+    return qemu_xxhash5(prof->pc, prof->cs_base, prof->flags);
+}
+
+static gboolean tb_profile_equal(gconstpointer ap, gconstpointer bp)
+{
+    const TBProfile *a = ap;
+    const TBProfile *b = bp;
+
+    return a->pc == b->pc && a->cs_base == b->cs_base && a->flags == b->flags;
+}
+
+static void __attribute__((constructor)) tb_profile_init(void)
+{
+    qemu_mutex_init(&tb_profile_lock);
+    profiles = g_hash_table_new(tb_profile_hash, tb_profile_equal);
+}
+
+TBProfile *tb_profile_get(vaddr pc, uint64_t cs_base, uint32_t flags)
+{
+    TBProfile key = { .pc = pc, .cs_base = cs_base, .flags = flags };
+    TBProfile *prof;
+
+    QEMU_LOCK_GUARD(&tb_profile_lock);
+    prof = g_hash_table_lookup(profiles, &key);
+    if (!prof) {
+        prof = g_new0(TBProfile, 1);
+        *prof = key;
+        g_hash_table_add(profiles, prof);
+    }
+    return prof;
+}
+
+void tb_profile_translated(TranslationBlock *tb, int64_t translate_ns)
+{
+    TBProfile *prof = tb->profile;
+
+    QEMU_LOCK_GUARD(&tb_profile_lock);
+    prof->size = tb->size;
+    prof->icount = tb->icount;
+    prof->host_size = tb->tc.size;
+    prof->translations++;
+    prof->translate_ns += translate_ns;
+}
+
+void tb_profile_foreach(void (*fn)(const TBProfile *p, void *opaque),
+                        void *opaque)
+{
+    GHashTableIter iter;
+    gpointer prof;
+
+    QEMU_LOCK_GUARD(&tb_profile_lock);
+    g_hash_table_iter_init(&iter, profiles);
+    while (g_hash_table_iter_next(&iter, &prof, NULL)) {
+        fn(prof, opaque);
+    }
+}
+
+void tb_profile_reset(void)
+{
+    GHashTableIter iter;
+    gpointer p;
+
+    QEMU_LOCK_GUARD(&tb_profile_lock);
+    g_hash_table_iter_init(&iter, profiles);
+    while (g_hash_table_iter_next(&iter, &p, NULL)) {
+        TBProfile *prof = p;
+        int i;
+
+        prof->translations = 0;
+        prof->translate_ns = 0;
+        qatomic_set_u64(&prof->exec_count, 0);
+        for (i = 0; i < TB_PROFILE_EXIT__MAX; i++) {
+            qatomic_set_u64(&prof->exits[i], 0);
+        }
+    }
+    qatomic_set_u64(&tb_profile_indirect_exits, 0);
+}
@@ -0,0 +1,77 @@
+/*
+ * TCG translation block profiling
+ *
+ * Copyright (c) 2024 The QEMU Project Developers
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#ifndef ACCEL_TCG_TB_PROFILE_H
+#define ACCEL_TCG_TB_PROFILE_H
+
+#include "exec/translation-block.h"
+#include "tcg/tcg.h"
+
+typedef enum TBProfileExit {
+    /* Left through a goto_tb slot that was not chained */
+    TB_PROFILE_EXIT_IDX0,
+    TB_PROFILE_EXIT_IDX1,
+    /* Did not run because an interrupt or exit was requested */
+    TB_PROFILE_EXIT_REQUESTED,
+    TB_PROFILE_EXIT__MAX,
+} TBProfileExit;
+
+/*
+ * The profile of a guest block, which survives retranslations and flushes
+ * of the code generation buffer.  Profiles are never freed, because the
+ * generated code of live TBs points to them.
+ */
+typedef struct TBProfile {
+    vaddr pc;
+    uint64_t cs_base;
+    uint32_t flags;
+
+    /* The last translation */
+    uint16_t size;
+    uint16_t icount;
+    uint32_t host_size;
+
+    uint64_t translations;
+    uint64_t translate_ns;
+    /* Incremented by the generated code */
+    uint64_t exec_count;
+    uint64_t exits[TB_PROFILE_EXIT__MAX];
+} TBProfile;
+
+/* Whether curr_cflags() asks for CF_PROFILE */
+extern bool tb_profile_enabled;
+
+/* Exits to the main loop that did not come from a goto_tb slot */
+extern uint64_t tb_profile_indirect_exits;
+
+TBProfile *tb_profile_get(vaddr pc, uint64_t cs_base, uint32_t flags);
+void tb_profile_translated(TranslationBlock *tb, int64_t translate_ns);
+
+/* Like the generated code, lose some counts rather than use atomics */
+static inline void tb_profile_count(uint64_t *counter)
+{
+    qatomic_set_u64(counter, qatomic_read_u64(counter) + 1);
+}
+
+static inline void tb_profile_exit(TranslationBlock *last_tb, int tb_exit)
+{
+    if (last_tb && last_tb->profile) {
+        if (tb_exit > TB_EXIT_IDX1) {
+            tb_exit = TB_PROFILE_EXIT_REQUESTED;
+        }
+        tb_profile_count(&last_tb->profile->exits[tb_exit]);
+    } else if (!last_tb && unlikely(qatomic_read(&tb_profile_enabled))) {
+        tb_profile_count(&tb_profile_indirect_exits);
+    }
+}
+
+void tb_profile_foreach(void (*fn)(const TBProfile *p, void *opaque),
+                        void *opaque);
+void tb_profile_reset(void);
+
+#endif /* ACCEL_TCG_TB_PROFILE_H */
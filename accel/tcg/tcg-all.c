@@ -35,10 +35,13 @@
 #include "qemu/atomic.h"
 #include "qapi/qapi-builtin-visit.h"
 #include "qemu/units.h"
+#include "hw/core/cpu.h"
+#include "exec/tb-flush.h"
 #if !defined(CONFIG_USER_ONLY)
 #include "hw/boards.h"
 #endif
 #include "internal-target.h"
+#include "tb-profile.h"
 
 struct TCGState {
     AccelState parent_obj;
@@ -207,6 +210,26 @@ static void tcg_set_one_insn_per_tb(Object *obj, bool value, Error **errp)
     qatomic_set(&one_insn_per_tb, value);
 }
 
+static bool tcg_get_profile(Object *obj, Error **errp)
+{
+    return qatomic_read(&tb_profile_enabled);
+}
+
+static void tcg_set_profile(Object *obj, bool value, Error **errp)
+{
+    if (value == qatomic_read(&tb_profile_enabled)) {
+        return;
+    }
+    qatomic_set(&tb_profile_enabled, value);
+    /*
+     * TBs are looked up with CF_PROFILE, but chained TBs jump to each other
+     * without a lookup: flush them so that the change applies to all code.
+     */
+    if (first_cpu) {
+        tb_flush(first_cpu);
+    }
+}
+
 static int tcg_gdbstub_supported_sstep_flags(void)
 {
     /*
@@ -252,6 +275,11 @@ static void tcg_accel_class_init(ObjectClass *oc, void *data)
                                    tcg_set_one_insn_per_tb);
     object_class_property_set_description(oc, "one-insn-per-tb",
         "Only put one guest insn in each translation block");
+
+    object_class_property_add_bool(oc, "profile",
+                                   tcg_get_profile, tcg_set_profile);
+    object_class_property_set_description(oc, "profile",
+        "Count translation block executions, exits and helper calls");
 }
 
 static const TypeInfo tcg_accel_type = {
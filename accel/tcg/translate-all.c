@@ -51,6 +51,7 @@
 #include "qemu/qemu-print.h"
 #include "qemu/main-loop.h"
 #include "qemu/cacheinfo.h"
+#include "qemu/counters.h"
 #include "qemu/timer.h"
 #include "exec/log.h"
 #include "sysemu/cpus.h"
@@ -61,6 +62,7 @@
 #include "tb-jmp-cache.h"
 #include "tb-hash.h"
 #include "tb-context.h"
+#include "tb-profile.h"
 #include "internal-common.h"
 #include "internal-target.h"
 #include "tcg/perf.h"
@@ -283,6 +285,8 @@ static int setjmp_gen_code(CPUArchState *env, TranslationBlock *tb,
     return tcg_gen_code(tcg_ctx, tb, pc);
 }
 
+QEMU_COUNTER_DEFINE(tb_translations, "tb-translations")
+
 /* Called with mmap_lock held for user mode emulation.  */
 TranslationBlock *tb_gen_code(CPUState *cpu,
                               vaddr pc, uint64_t cs_base,
@@ -293,7 +297,7 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     tb_page_addr_t phys_pc, phys_p2;
     tcg_insn_unit *gen_code_buf;
     int gen_code_size, search_size, max_insns;
-    int64_t ti;
+    int64_t ti, profile_start = 0;
     void *host_pc;
 
     assert_memory_lock();
@@ -317,7 +321,7 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     tb = tcg_tb_alloc(tcg_ctx);
     if (unlikely(!tb)) {
         /* flush must be done */
-        tb_flush(cpu);
+        tb_reclaim(cpu);
         mmap_unlock();
         /* Make the execution loop process the flush as soon as possible.  */
         cpu->exception_index = EXCP_INTERRUPT;
@@ -337,6 +341,11 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     if (phys_pc != -1) {
         tb_lock_page0(phys_pc);
     }
+    tb->profile = NULL;
+    if (unlikely(cflags & CF_PROFILE)) {
+        tb->profile = tb_profile_get(pc, cs_base, flags);
+        profile_start = get_clock();
+    }
 
     tcg_ctx->gen_tb = tb;
     tcg_ctx->addr_type = TARGET_LONG_BITS == 32 ? TCG_TYPE_I32 : TCG_TYPE_I64;
@@ -511,6 +520,11 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
         ROUND_UP((uintptr_t)gen_code_buf + gen_code_size + search_size,
                  CODE_GEN_ALIGN));
 
+    qemu_counter_inc(&tb_translations);
+    if (tb->profile) {
+        tb_profile_translated(tb, get_clock() - profile_start);
+    }
+
     /* init jump list */
     qemu_spin_init(&tb->jmp_lock);
     tb->jmp_list_head = (uintptr_t)NULL;
@@ -669,6 +683,8 @@ void tcg_flush_jmp_cache(CPUState *cpu)
     }
 
     for (int i = 0; i < TB_JMP_CACHE_SIZE; i++) {
-        qatomic_set(&jc->array[i].tb, NULL);
+        for (int way = 0; way < TB_JMP_CACHE_WAYS; way++) {
+            qatomic_set(&jc->array[i][way].tb, NULL);
+        }
     }
 }
@@ -297,13 +297,18 @@ static void conv_natural_float_to_mono(struct st_sample *dst, const void *src,
 static void conv_natural_float_to_stereo(struct st_sample *dst, const void *src,
                                          int samples)
 {
+#ifdef FLOAT_MIXENG
+    /* The mixing engine uses the same format */
+    memcpy(dst, src, samples * sizeof(*dst));
+#else
+    typeof(dst->l) *out = &dst->l;
     float *in = (float *)src;
+    int i;
 
-    while (samples--) {
-        dst->l = CONV_NATURAL_FLOAT(*in++);
-        dst->r = CONV_NATURAL_FLOAT(*in++);
-        dst++;
+    for (i = 0; i < samples * 2; i++) {
+        out[i] = CONV_NATURAL_FLOAT(in[i]);
     }
+#endif
 }
 
 t_sample *mixeng_conv_float[2] = {
@@ -325,13 +330,17 @@ static void clip_natural_float_from_mono(void *dst, const struct st_sample *src,
 static void clip_natural_float_from_stereo(
     void *dst, const struct st_sample *src, int samples)
 {
+#ifdef FLOAT_MIXENG
+    memcpy(dst, src, samples * sizeof(*src));
+#else
+    const typeof(src->l) *in = &src->l;
     float *out = (float *)dst;
+    int i;
 
-    while (samples--) {
-        *out++ = CLIP_NATURAL_FLOAT(src->l);
-        *out++ = CLIP_NATURAL_FLOAT(src->r);
-        src++;
+    for (i = 0; i < samples * 2; i++) {
+        out[i] = CLIP_NATURAL_FLOAT(in[i]);
     }
+#endif
 }
 
 f_sample *mixeng_clip_float[2] = {
@@ -532,6 +541,17 @@ void mixeng_volume (struct st_sample *buf, int len, struct mixeng_volume *vol)
         return;
     }
 
+    /* Nominal volume, which is the common case */
+#ifdef FLOAT_MIXENG
+    if (vol->l == 1.f && vol->r == 1.f) {
+        return;
+    }
+#else
+    if (vol->l == 1LL << 32 && vol->r == 1LL << 32) {
+        return;
+    }
+#endif
+
     while (len--) {
 #ifdef FLOAT_MIXENG
         buf->l = buf->l * vol->l;
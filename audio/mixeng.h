@@ -34,6 +34,8 @@ struct mixeng_volume { int mute; int64_t r; int64_t l; };
 struct st_sample { int64_t l; int64_t r; };
 #endif
 typedef struct st_sample st_sample;
+/* st_sample is also accessed as an array of channel samples */
+QEMU_BUILD_BUG_ON(sizeof(struct st_sample) != 2 * sizeof(((st_sample *)0)->l));
 
 typedef void (t_sample) (struct st_sample *dst, const void *src, int samples);
 typedef void (f_sample) (void *dst, const struct st_sample *src, int samples);
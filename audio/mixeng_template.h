@@ -97,16 +97,19 @@ static inline IN_T glue (clip_, ET) (int64_t v)
 }
 #endif
 
+/*
+ * Stereo frames are handled as a flat array of channel samples, which the
+ * compiler can vectorize.
+ */
 static void glue (glue (conv_, ET), _to_stereo)
     (struct st_sample *dst, const void *src, int samples)
 {
-    struct st_sample *out = dst;
+    typeof(dst->l) *out = &dst->l;
     IN_T *in = (IN_T *) src;
+    int i;
 
-    while (samples--) {
-        out->l = glue (conv_, ET) (*in++);
-        out->r = glue (conv_, ET) (*in++);
-        out += 1;
+    for (i = 0; i < samples * 2; i++) {
+        out[i] = glue (conv_, ET) (in[i]);
     }
 }
 
@@ -127,12 +130,12 @@ static void glue (glue (conv_, ET), _to_mono)
 static void glue (glue (clip_, ET), _from_stereo)
     (void *dst, const struct st_sample *src, int samples)
 {
-    const struct st_sample *in = src;
+    const typeof(src->l) *in = &src->l;
     IN_T *out = (IN_T *) dst;
-    while (samples--) {
-        *out++ = glue (clip_, ET) (in->l);
-        *out++ = glue (clip_, ET) (in->r);
-        in += 1;
+    int i;
+
+    for (i = 0; i < samples * 2; i++) {
+        out[i] = glue (clip_, ET) (in[i]);
     }
 }
 
@@ -48,9 +48,11 @@ void NAME (void *opaque, struct st_sample *ibuf, struct st_sample *obuf,
 
     if (rate->opos_inc == (1ULL + UINT_MAX)) {
         int i, n = *isamp > *osamp ? *osamp : *isamp;
-        for (i = 0; i < n; i++) {
-            OP (obuf[i].l, ibuf[i].l);
-            OP (obuf[i].r, ibuf[i].r);
+        typeof(obuf->l) *o = &obuf->l, *in = &ibuf->l;
+
+        /* Same rate, process channel samples as a flat array */
+        for (i = 0; i < n * 2; i++) {
+            OP (o[i], in[i]);
         }
         *isamp = n;
         *osamp = n;
@@ -27,6 +27,9 @@
 #include "standard-headers/linux/virtio_crypto.h"
 #include "crypto/cipher.h"
 #include "crypto/akcipher.h"
+#include "block/thread-pool.h"
+#include "qemu/error-report.h"
+#include "qemu/main-loop.h"
 #include "qom/object.h"
 
 
@@ -45,6 +48,16 @@ typedef struct CryptoDevBackendBuiltinSession {
     uint8_t type; /* cipher? hash? aead? */
     QCryptoAkCipher *akcipher;
     QTAILQ_ENTRY(CryptoDevBackendBuiltinSession) next;
+
+    /*
+     * The operations run in the thread pool.  They are serialized per
+     * session, because they share the IV and the state of the cipher.
+     */
+    QemuMutex lock;
+
+    /* Operations in flight, the session is freed once they are done */
+    unsigned int inflight;
+    bool closed;
 } CryptoDevBackendBuiltinSession;
 
 /* Max number of symmetric/asymmetric sessions */
@@ -53,10 +66,36 @@ typedef struct CryptoDevBackendBuiltinSession {
 #define CRYPTODEV_BUITLIN_MAX_AUTH_KEY_LEN    512
 #define CRYPTODEV_BUITLIN_MAX_CIPHER_KEY_LEN  64
 
+/*
+ * Symmetric operations smaller than this are batched, so that a trip to
+ * the thread pool does not cost more than the operation itself.  Batches
+ * are kept short to still spread the requests over the worker threads.
+ */
+#define CRYPTODEV_BUILTIN_BATCH_LEN  4096
+#define CRYPTODEV_BUILTIN_BATCH_MAX  16
+
+typedef struct CryptoDevBackendBuiltinTask {
+    CryptoDevBackendBuiltinSession *sess;
+    CryptoDevBackendOpInfo *op_info;
+    int status;
+    Error *err;
+    QSIMPLEQ_ENTRY(CryptoDevBackendBuiltinTask) next;
+} CryptoDevBackendBuiltinTask;
+
+typedef struct CryptoDevBackendBuiltinBatch {
+    CryptoDevBackendBuiltin *builtin;
+    QSIMPLEQ_HEAD(, CryptoDevBackendBuiltinTask) tasks;
+    unsigned int len;
+} CryptoDevBackendBuiltinBatch;
+
 struct CryptoDevBackendBuiltin {
     CryptoDevBackend parent_obj;
 
     CryptoDevBackendBuiltinSession *sessions[MAX_NUM_SESSIONS];
+
+    /* Small operations waiting for batch_bh */
+    CryptoDevBackendBuiltinBatch *batch;
+    QEMUBH *batch_bh;
 };
 
 static void cryptodev_builtin_init_akcipher(CryptoDevBackend *backend)
@@ -72,24 +111,36 @@ static void cryptodev_builtin_init_akcipher(CryptoDevBackend *backend)
     }
 }
 
+static void cryptodev_builtin_batch_bh(void *opaque);
+
 static void cryptodev_builtin_init(
              CryptoDevBackend *backend, Error **errp)
 {
-    /* Only support one queue */
+    CryptoDevBackendBuiltin *builtin =
+                      CRYPTODEV_BACKEND_BUILTIN(backend);
     int queues = backend->conf.peers.queues;
     CryptoDevBackendClient *cc;
+    int i;
 
-    if (queues != 1) {
-        error_setg(errp,
-                  "Only support one queue in cryptdov-builtin backend");
+    if (queues < 1 || queues > MAX_CRYPTO_QUEUE_NUM) {
+        error_setg(errp, "cryptodev-builtin supports 1 to %d queues",
+                   MAX_CRYPTO_QUEUE_NUM);
         return;
     }
 
-    cc = cryptodev_backend_new_client();
-    cc->info_str = g_strdup_printf("cryptodev-builtin0");
-    cc->queue_index = 0;
-    cc->type = QCRYPTODEV_BACKEND_TYPE_BUILTIN;
-    backend->conf.peers.ccs[0] = cc;
+    /*
+     * The sessions are shared by all queues; the operations of all queues
+     * run in the thread pool.
+     */
+    for (i = 0; i < queues; i++) {
+        cc = cryptodev_backend_new_client();
+        cc->info_str = g_strdup_printf("cryptodev-builtin%d", i);
+        cc->queue_index = i;
+        cc->type = QCRYPTODEV_BACKEND_TYPE_BUILTIN;
+        backend->conf.peers.ccs[i] = cc;
+    }
+
+    builtin->batch_bh = qemu_bh_new(cryptodev_builtin_batch_bh, builtin);
 
     backend->conf.crypto_services =
                          1u << QCRYPTODEV_BACKEND_SERVICE_CIPHER |
@@ -295,6 +346,7 @@ static int cryptodev_builtin_create_cipher_session(
     }
 
     sess = g_new0(CryptoDevBackendBuiltinSession, 1);
+    qemu_mutex_init(&sess->lock);
     sess->cipher = cipher;
     sess->direction = sess_info->direction;
     sess->type = sess_info->op_type;
@@ -359,6 +411,7 @@ static int cryptodev_builtin_create_akcipher_session(
     }
 
     sess = g_new0(CryptoDevBackendBuiltinSession, 1);
+    qemu_mutex_init(&sess->lock);
     sess->akcipher = akcipher;
 
     builtin->sessions[index] = sess;
@@ -416,6 +469,19 @@ static int cryptodev_builtin_create_session(
     return 0;
 }
 
+static void cryptodev_builtin_free_session(
+                 CryptoDevBackendBuiltinSession *session)
+{
+    if (session->cipher) {
+        qcrypto_cipher_free(session->cipher);
+    } else if (session->akcipher) {
+        qcrypto_akcipher_free(session->akcipher);
+    }
+
+    qemu_mutex_destroy(&session->lock);
+    g_free(session);
+}
+
 static int cryptodev_builtin_close_session(
            CryptoDevBackend *backend,
            uint64_t session_id,
@@ -430,13 +496,10 @@ static int cryptodev_builtin_close_session(
     assert(session_id < MAX_NUM_SESSIONS && builtin->sessions[session_id]);
 
     session = builtin->sessions[session_id];
-    if (session->cipher) {
-        qcrypto_cipher_free(session->cipher);
-    } else if (session->akcipher) {
-        qcrypto_akcipher_free(session->akcipher);
+    session->closed = true;
+    if (!session->inflight) {
+        cryptodev_builtin_free_session(session);
     }
-
-    g_free(session);
     builtin->sessions[session_id] = NULL;
     if (cb) {
         cb(opaque, VIRTIO_CRYPTO_OK);
@@ -537,6 +600,89 @@ static int cryptodev_builtin_asym_operation(
     return VIRTIO_CRYPTO_OK;
 }
 
+/* Runs in the thread pool */
+static int cryptodev_builtin_batch_work(void *opaque)
+{
+    CryptoDevBackendBuiltinBatch *batch = opaque;
+    CryptoDevBackendBuiltinTask *task;
+    CryptoDevBackendOpInfo *op_info;
+
+    QSIMPLEQ_FOREACH(task, &batch->tasks, next) {
+        op_info = task->op_info;
+
+        qemu_mutex_lock(&task->sess->lock);
+        if (op_info->algtype == QCRYPTODEV_BACKEND_ALG_SYM) {
+            task->status = cryptodev_builtin_sym_operation(task->sess,
+                                                op_info->u.sym_op_info,
+                                                &task->err);
+        } else {
+            task->status = cryptodev_builtin_asym_operation(task->sess,
+                                                op_info->op_code,
+                                                op_info->u.asym_op_info,
+                                                &task->err);
+        }
+        qemu_mutex_unlock(&task->sess->lock);
+    }
+
+    return 0;
+}
+
+static void cryptodev_builtin_batch_complete(void *opaque, int ret)
+{
+    CryptoDevBackendBuiltinBatch *batch = opaque;
+    CryptoDevBackendBuiltinTask *task, *next;
+    CryptoDevBackendOpInfo *op_info;
+
+    QSIMPLEQ_FOREACH_SAFE(task, &batch->tasks, next, next) {
+        op_info = task->op_info;
+
+        if (task->err) {
+            error_report_err(task->err);
+        }
+        if (op_info->cb) {
+            op_info->cb(op_info->opaque, task->status);
+        }
+
+        if (!--task->sess->inflight && task->sess->closed) {
+            cryptodev_builtin_free_session(task->sess);
+        }
+        g_free(task);
+    }
+
+    object_unref(OBJECT(batch->builtin));
+    g_free(batch);
+}
+
+static CryptoDevBackendBuiltinBatch *
+cryptodev_builtin_batch_new(CryptoDevBackendBuiltin *builtin)
+{
+    CryptoDevBackendBuiltinBatch *batch = g_new0(CryptoDevBackendBuiltinBatch,
+                                                 1);
+
+    /* Keep the backend around until the batch completes */
+    batch->builtin = builtin;
+    object_ref(OBJECT(builtin));
+    QSIMPLEQ_INIT(&batch->tasks);
+    return batch;
+}
+
+static void cryptodev_builtin_batch_submit(CryptoDevBackendBuiltinBatch *batch)
+{
+    thread_pool_submit_aio(cryptodev_builtin_batch_work, batch,
+                           cryptodev_builtin_batch_complete, batch);
+}
+
+static void cryptodev_builtin_batch_bh(void *opaque)
+{
+    CryptoDevBackendBuiltin *builtin = opaque;
+    CryptoDevBackendBuiltinBatch *batch = builtin->batch;
+
+    if (batch) {
+        builtin->batch = NULL;
+        cryptodev_builtin_batch_submit(batch);
+    }
+}
+
 static int cryptodev_builtin_operation(
                  CryptoDevBackend *backend,
                  CryptoDevBackendOpInfo *op_info)
@@ -544,35 +690,53 @@ static int cryptodev_builtin_operation(
     CryptoDevBackendBuiltin *builtin =
                       CRYPTODEV_BACKEND_BUILTIN(backend);
     CryptoDevBackendBuiltinSession *sess;
-    CryptoDevBackendSymOpInfo *sym_op_info;
-    CryptoDevBackendAsymOpInfo *asym_op_info;
+    CryptoDevBackendBuiltinTask *task;
+    CryptoDevBackendBuiltinBatch *batch;
     QCryptodevBackendAlgType algtype = op_info->algtype;
-    int status = -VIRTIO_CRYPTO_ERR;
-    Error *local_error = NULL;
 
     if (op_info->session_id >= MAX_NUM_SESSIONS ||
               builtin->sessions[op_info->session_id] == NULL) {
-        error_setg(&local_error, "Cannot find a valid session id: %" PRIu64 "",
-                   op_info->session_id);
+        error_report("Cannot find a valid session id: %" PRIu64 "",
+                     op_info->session_id);
         return -VIRTIO_CRYPTO_INVSESS;
     }
 
-    sess = builtin->sessions[op_info->session_id];
-    if (algtype == QCRYPTODEV_BACKEND_ALG_SYM) {
-        sym_op_info = op_info->u.sym_op_info;
-        status = cryptodev_builtin_sym_operation(sess, sym_op_info,
-                                                 &local_error);
-    } else if (algtype == QCRYPTODEV_BACKEND_ALG_ASYM) {
-        asym_op_info = op_info->u.asym_op_info;
-        status = cryptodev_builtin_asym_operation(sess, op_info->op_code,
-                                                  asym_op_info, &local_error);
+    if (algtype != QCRYPTODEV_BACKEND_ALG_SYM &&
+        algtype != QCRYPTODEV_BACKEND_ALG_ASYM) {
+        if (op_info->cb) {
+            op_info->cb(op_info->opaque, -VIRTIO_CRYPTO_ERR);
+        }
+        return 0;
     }
 
-    if (local_error) {
-        error_report_err(local_error);
-    }
-    if (op_info->cb) {
-        op_info->cb(op_info->opaque, status);
+    sess = builtin->sessions[op_info->session_id];
+    sess->inflight++;
+
+    task = g_new0(CryptoDevBackendBuiltinTask, 1);
+    task->sess = sess;
+    task->op_info = op_info;
+
+    /*
+     * Small requests are gathered until the virtqueue handler returns to
+     * the main loop; the rest get a worker thread of their own.
+     */
+    if (algtype == QCRYPTODEV_BACKEND_ALG_SYM &&
+        op_info->u.sym_op_info->src_len < CRYPTODEV_BUILTIN_BATCH_LEN) {
+        if (!builtin->batch) {
+            builtin->batch = cryptodev_builtin_batch_new(builtin);
+            qemu_bh_schedule(builtin->batch_bh);
+        }
+        batch = builtin->batch;
+        QSIMPLEQ_INSERT_TAIL(&batch->tasks, task, next);
+        if (++batch->len == CRYPTODEV_BUILTIN_BATCH_MAX) {
+            builtin->batch = NULL;
+            cryptodev_builtin_batch_submit(batch);
+        }
+    } else {
+        batch = cryptodev_builtin_batch_new(builtin);
+        QSIMPLEQ_INSERT_TAIL(&batch->tasks, task, next);
+        batch->len = 1;
+        cryptodev_builtin_batch_submit(batch);
     }
     return 0;
 }
@@ -601,6 +765,13 @@ static void cryptodev_builtin_cleanup(
         }
     }
 
+    /* Pending operations hold a reference, so there are none left here */
+    assert(!builtin->batch);
+    if (builtin->batch_bh) {
+        qemu_bh_delete(builtin->batch_bh);
+        builtin->batch_bh = NULL;
+    }
+
     cryptodev_backend_set_ready(backend, false);
 }
 
@@ -20,6 +20,7 @@
 #include "qom/object_interfaces.h"
 #include "qemu/mmap-alloc.h"
 #include "qemu/madvise.h"
+#include "qemu/error-report.h"
 #include "hw/qdev-core.h"
 
 #ifdef CONFIG_NUMA
@@ -158,6 +159,60 @@ host_memory_backend_set_policy(Object *obj, int policy, Error **errp)
 #endif
 }
 
+static void
+host_memory_backend_get_interleave_granularity(Object *obj, Visitor *v,
+                                               const char *name, void *opaque,
+                                               Error **errp)
+{
+    HostMemoryBackend *backend = MEMORY_BACKEND(obj);
+
+    visit_type_size(v, name, &backend->interleave_granularity, errp);
+}
+
+static void
+host_memory_backend_set_interleave_granularity(Object *obj, Visitor *v,
+                                               const char *name, void *opaque,
+                                               Error **errp)
+{
+    HostMemoryBackend *backend = MEMORY_BACKEND(obj);
+    uint64_t value;
+
+    if (host_memory_backend_mr_inited(backend)) {
+        error_setg(errp, "cannot change property value");
+        return;
+    }
+    if (!visit_type_size(v, name, &value, errp)) {
+        return;
+    }
+#ifndef CONFIG_NUMA
+    if (value) {
+        error_setg(errp, "NUMA policies are not supported by this QEMU");
+        return;
+    }
+#endif
+    backend->interleave_granularity = value;
+}
+
+static int
+host_memory_backend_get_thp(Object *obj, Error **errp G_GNUC_UNUSED)
+{
+    HostMemoryBackend *backend = MEMORY_BACKEND(obj);
+
+    return backend->thp;
+}
+
+static void
+host_memory_backend_set_thp(Object *obj, int thp, Error **errp)
+{
+    HostMemoryBackend *backend = MEMORY_BACKEND(obj);
+
+    if (host_memory_backend_mr_inited(backend)) {
+        error_setg(errp, "cannot change property value");
+        return;
+    }
+    backend->thp = thp;
+}
+
 static bool host_memory_backend_get_merge(Object *obj, Error **errp)
 {
     HostMemoryBackend *backend = MEMORY_BACKEND(obj);
@@ -310,6 +365,17 @@ bool host_memory_backend_is_mapped(HostMemoryBackend *backend)
     return backend->is_mapped;
 }
 
+bool host_memory_backend_has_default_settings(HostMemoryBackend *backend)
+{
+    MachineState *machine = MACHINE(qdev_get_machine());
+
+    return backend->merge == machine_mem_merge(machine) &&
+           backend->dump == machine_dump_guest_core(machine) &&
+           !backend->prealloc && !backend->prealloc_node_local &&
+           backend->policy == HOST_MEM_POLICY_DEFAULT &&
+           backend->thp == HOST_MEM_THP_MODE_DEFER;
+}
+
 size_t host_memory_backend_pagesize(HostMemoryBackend *memdev)
 {
     size_t pagesize = qemu_ram_pagesize(memdev->mr.ram_block);
@@ -317,6 +383,157 @@ size_t host_memory_backend_pagesize(HostMemoryBackend *memdev)
     return pagesize;
 }
 
+static bool host_memory_backend_get_prealloc_node_local(Object *obj,
+                                                        Error **errp)
+{
+    HostMemoryBackend *backend = MEMORY_BACKEND(obj);
+
+    return backend->prealloc_node_local;
+}
+
+static void host_memory_backend_set_prealloc_node_local(Object *obj,
+                                                        bool value,
+                                                        Error **errp)
+{
+    HostMemoryBackend *backend = MEMORY_BACKEND(obj);
+
+    if (host_memory_backend_mr_inited(backend)) {
+        error_setg(errp, "cannot change property value");
+        return;
+    }
+#ifndef CONFIG_NUMA
+    if (value) {
+        error_setg(errp, "NUMA node binding are not supported by this QEMU");
+        return;
+    }
+#endif
+    backend->prealloc_node_local = value;
+}
+
+#ifdef CONFIG_NUMA
+/* The host node that the chunk at @index of @backend is interleaved to */
+static unsigned long host_memory_backend_chunk_node(HostMemoryBackend *backend,
+                                                    uint64_t index)
+{
+    unsigned long nr_nodes = bitmap_count_one(backend->host_nodes, MAX_NODES);
+    unsigned long node = find_first_bit(backend->host_nodes, MAX_NODES);
+    uint64_t i;
+
+    for (i = index % nr_nodes; i; i--) {
+        node = find_next_bit(backend->host_nodes, MAX_NODES, node + 1);
+    }
+    return node;
+}
+
+/*
+ * Interleave the memory across the host nodes in chunks of
+ * interleave-granularity bytes.  Like with MPOL_INTERLEAVE, allocations
+ * fall back to other nodes when the node of a chunk is full.
+ */
+static bool host_memory_backend_interleave(HostMemoryBackend *backend,
+                                           char *ptr, uint64_t sz,
+                                           unsigned flags, Error **errp)
+{
+    const uint64_t gran = backend->interleave_granularity;
+    DECLARE_BITMAP(nodes, MAX_NODES + 1);
+    unsigned long node;
+    uint64_t offset;
+
+    if (!QEMU_IS_ALIGNED(gran, host_memory_backend_pagesize(backend))) {
+        error_setg(errp, "interleave-granularity must be a multiple of the"
+                   " page size (0x%zx)", host_memory_backend_pagesize(backend));
+        return false;
+    }
+
+    for (offset = 0; offset < sz; offset += gran) {
+        node = host_memory_backend_chunk_node(backend, offset / gran);
+        bitmap_zero(nodes, MAX_NODES + 1);
+        set_bit(node, nodes);
+        if (mbind(ptr + offset, MIN(gran, sz - offset), MPOL_PREFERRED,
+                  nodes, node + 2, flags)) {
+            error_setg_errno(errp, errno,
+                             "cannot bind memory to host NUMA node %lu", node);
+            return false;
+        }
+    }
+    return true;
+}
+
+static ThreadContext *host_memory_backend_node_context(const char *nodes,
+                                                       Error **errp)
+{
+    Object *obj = object_new(TYPE_THREAD_CONTEXT);
+
+    if (!object_property_parse(obj, "node-affinity", nodes, errp) ||
+        !user_creatable_complete(USER_CREATABLE(obj), errp)) {
+        object_unref(obj);
+        return NULL;
+    }
+    return THREAD_CONTEXT(obj);
+}
+
+/*
+ * Preallocate the memory bound to each host node with threads running on
+ * that node, so that the pages are not zeroed through the interconnect.
+ * Without an interleave granularity, the kernel picks the node of each page
+ * and the threads run on any of the host nodes.
+ */
+static bool host_memory_backend_prealloc_node_local(HostMemoryBackend *backend,
+                                                    char *ptr, uint64_t sz,
+                                                    Error **errp)
+{
+    const int fd = memory_region_get_fd(&backend->mr);
+    const uint64_t gran = backend->interleave_granularity;
+    unsigned long nr_nodes = bitmap_count_one(backend->host_nodes, MAX_NODES);
+    g_autoptr(GString) nodes = g_string_new(NULL);
+    unsigned long node, i;
+    ThreadContext *tc;
+    uint64_t offset;
+    bool ret = true;
+
+    if (!gran) {
+        for (node = find_first_bit(backend->host_nodes, MAX_NODES);
+             node < MAX_NODES;
+             node = find_next_bit(backend->host_nodes, MAX_NODES, node + 1)) {
+            g_string_append_printf(nodes, "%s%lu", nodes->len ? "," : "",
+                                   node);
+        }
+        tc = host_memory_backend_node_context(nodes->str, errp);
+        if (!tc) {
+            return false;
+        }
+        ret = qemu_prealloc_mem(fd, ptr, sz, backend->prealloc_threads, tc,
+                                false, errp);
+        object_unref(OBJECT(tc));
+        return ret;
+    }
+
+    for (i = 0; i < nr_nodes && ret; i++) {
+        node = host_memory_backend_chunk_node(backend, i);
+        g_string_printf(nodes, "%lu", node);
+        tc = host_memory_backend_node_context(nodes->str, errp);
+        if (!tc) {
+            return false;
+        }
+        for (offset = i * gran; offset < sz && ret;
+             offset += nr_nodes * gran) {
+            ret = qemu_prealloc_mem(fd, ptr + offset, MIN(gran, sz - offset),
+                                    backend->prealloc_threads, tc, false,
+                                    errp);
+        }
+        object_unref(OBJECT(tc));
+    }
+    return ret;
+}
+#else
+static bool host_memory_backend_prealloc_node_local(HostMemoryBackend *backend,
+                                                    char *ptr, uint64_t sz,
+                                                    Error **errp)
+{
+    g_assert_not_reached();
+}
+#endif
+
 static void
 host_memory_backend_memory_complete(UserCreatable *uc, Error **errp)
 {
@@ -325,6 +542,7 @@ host_memory_backend_memory_complete(UserCreatable *uc, Error **errp)
     void *ptr;
     uint64_t sz;
     bool async = !phase_check(PHASE_LATE_BACKENDS_CREATED);
+    bool node_local = false;
 
     if (!bc->alloc) {
         return;
@@ -342,6 +560,18 @@ host_memory_backend_memory_complete(UserCreatable *uc, Error **errp)
     if (!backend->dump) {
         qemu_madvise(ptr, sz, QEMU_MADV_DONTDUMP);
     }
+    if (backend->thp != HOST_MEM_THP_MODE_DEFER &&
+        host_memory_backend_pagesize(backend) != qemu_real_host_page_size()) {
+        error_setg(errp, "thp=%s is not supported with huge pages",
+                   HostMemThpMode_str(backend->thp));
+        return;
+    }
+    if (backend->thp == HOST_MEM_THP_MODE_NEVER &&
+        qemu_madvise(ptr, sz, QEMU_MADV_NOHUGEPAGE)) {
+        error_setg_errno(errp, errno,
+                         "cannot disable transparent huge pages");
+        return;
+    }
 #ifdef CONFIG_NUMA
     unsigned long lastbit = find_last_bit(backend->host_nodes, MAX_NODES);
     /* lastbit == MAX_NODES means maxnode = 0 */
@@ -365,6 +595,15 @@ host_memory_backend_memory_complete(UserCreatable *uc, Error **errp)
         error_setg(errp, "host-nodes must be set for policy %s",
                    HostMemPolicy_str(backend->policy));
         return;
+    } else if (backend->interleave_granularity &&
+               backend->policy != MPOL_INTERLEAVE) {
+        error_setg(errp, "interleave-granularity requires policy interleave");
+        return;
+    } else if (backend->prealloc_node_local &&
+               (maxnode == 0 || backend->prealloc_context)) {
+        error_setg(errp, "prealloc-node-local requires host-nodes, and"
+                   " cannot be combined with prealloc-context");
+        return;
     }
 
     /*
@@ -387,7 +626,11 @@ host_memory_backend_memory_complete(UserCreatable *uc, Error **errp)
     }
 #endif
 
-    if (maxnode &&
+    if (backend->interleave_granularity) {
+        if (!host_memory_backend_interleave(backend, ptr, sz, flags, errp)) {
+            return;
+        }
+    } else if (maxnode &&
         mbind(ptr, sz, mode, backend->host_nodes, maxnode + 1, flags)) {
         if (backend->policy != MPOL_DEFAULT || errno != ENOSYS) {
             error_setg_errno(errp, errno,
@@ -395,18 +638,42 @@ host_memory_backend_memory_complete(UserCreatable *uc, Error **errp)
             return;
         }
     }
+    node_local = backend->prealloc_node_local;
 #endif
+    /* Both need the memory to be populated when it returns */
+    if (backend->thp == HOST_MEM_THP_MODE_COLLAPSE || node_local) {
+        async = false;
+    }
+
     /*
      * Preallocate memory after the NUMA policy has been instantiated.
      * This is necessary to guarantee memory is allocated with
      * specified NUMA policy in place.
      */
-    if (backend->prealloc && !qemu_prealloc_mem(memory_region_get_fd(&backend->mr),
-                                                ptr, sz,
-                                                backend->prealloc_threads,
-                                                backend->prealloc_context,
-                                                async, errp)) {
-        return;
+    if (backend->prealloc) {
+        if (node_local) {
+            if (!host_memory_backend_prealloc_node_local(backend, ptr, sz,
+                                                         errp)) {
+                return;
+            }
+        } else if (!qemu_prealloc_mem(memory_region_get_fd(&backend->mr),
+                                      ptr, sz, backend->prealloc_threads,
+                                      backend->prealloc_context, async,
+                                      errp)) {
+            return;
+        }
+
+        /*
+         * Faults may have fallen back to small pages when no huge page was
+         * readily available, collapse them now rather than in the
+         * background while the guest runs.
+         */
+        if (backend->thp == HOST_MEM_THP_MODE_COLLAPSE &&
+            qemu_madvise(ptr, sz, QEMU_MADV_COLLAPSE)) {
+            warn_report("%s: cannot collapse memory into transparent huge"
+                        " pages: %s", object_get_canonical_path_component(
+                            OBJECT(backend)), strerror(errno));
+        }
     }
 }
 
@@ -513,6 +780,11 @@ host_memory_backend_class_init(ObjectClass *oc, void *data)
         object_property_allow_set_link, OBJ_PROP_LINK_STRONG);
     object_class_property_set_description(oc, "prealloc-context",
         "Context to use for creating CPU threads for preallocation");
+    object_class_property_add_bool(oc, "prealloc-node-local",
+        host_memory_backend_get_prealloc_node_local,
+        host_memory_backend_set_prealloc_node_local);
+    object_class_property_set_description(oc, "prealloc-node-local",
+        "Preallocate the memory of each host node from that node");
     object_class_property_add(oc, "size", "int",
         host_memory_backend_get_size,
         host_memory_backend_set_size,
@@ -531,6 +803,18 @@ host_memory_backend_class_init(ObjectClass *oc, void *data)
         host_memory_backend_set_policy);
     object_class_property_set_description(oc, "policy",
         "Set the NUMA policy");
+    object_class_property_add(oc, "interleave-granularity", "size",
+        host_memory_backend_get_interleave_granularity,
+        host_memory_backend_set_interleave_granularity,
+        NULL, NULL);
+    object_class_property_set_description(oc, "interleave-granularity",
+        "Size of the chunks interleaved with policy interleave");
+    object_class_property_add_enum(oc, "thp", "HostMemThpMode",
+        &HostMemThpMode_lookup,
+        host_memory_backend_get_thp,
+        host_memory_backend_set_thp);
+    object_class_property_set_description(oc, "thp",
+        "Use of transparent huge pages (defer, never, collapse)");
     object_class_property_add_bool(oc, "share",
         host_memory_backend_get_share, host_memory_backend_set_share);
     object_class_property_set_description(oc, "share",
@@ -212,6 +212,102 @@ int iommufd_backend_unmap_dma(IOMMUFDBackend *be, uint32_t ioas_id,
     return ret;
 }
 
+int iommufd_backend_get_device_caps(IOMMUFDBackend *be, uint32_t devid,
+                                    uint64_t *caps, Error **errp)
+{
+    int ret, fd = be->fd;
+    struct iommu_hw_info info = {
+        .size = sizeof(info),
+        .dev_id = devid,
+    };
+
+    ret = ioctl(fd, IOMMU_GET_HW_INFO, &info);
+    trace_iommufd_backend_get_device_caps(fd, devid, info.out_capabilities,
+                                          ret);
+    if (ret) {
+        error_setg_errno(errp, errno, "Failed to get hardware info");
+        return ret;
+    }
+
+    *caps = info.out_capabilities;
+    return 0;
+}
+
+int iommufd_backend_alloc_hwpt(IOMMUFDBackend *be, uint32_t devid,
+                               uint32_t pt_id, uint32_t flags,
+                               uint32_t *out_hwpt, Error **errp)
+{
+    int ret, fd = be->fd;
+    struct iommu_hwpt_alloc alloc_hwpt = {
+        .size = sizeof(alloc_hwpt),
+        .flags = flags,
+        .dev_id = devid,
+        .pt_id = pt_id,
+        .data_type = IOMMU_HWPT_DATA_NONE,
+    };
+
+    ret = ioctl(fd, IOMMU_HWPT_ALLOC, &alloc_hwpt);
+    trace_iommufd_backend_alloc_hwpt(fd, devid, pt_id, flags,
+                                     alloc_hwpt.out_hwpt_id, ret);
+    if (ret) {
+        error_setg_errno(errp, errno, "Failed to allocate hwpt");
+        return ret;
+    }
+
+    *out_hwpt = alloc_hwpt.out_hwpt_id;
+    return 0;
+}
+
+int iommufd_backend_set_dirty_tracking(IOMMUFDBackend *be, uint32_t hwpt_id,
+                                       bool start)
+{
+    int ret, fd = be->fd;
+    struct iommu_hwpt_set_dirty_tracking set_dirty = {
+        .size = sizeof(set_dirty),
+        .hwpt_id = hwpt_id,
+        .flags = start ? IOMMU_HWPT_DIRTY_TRACKING_ENABLE : 0,
+    };
+
+    ret = ioctl(fd, IOMMU_HWPT_SET_DIRTY_TRACKING, &set_dirty);
+    trace_iommufd_backend_set_dirty(fd, hwpt_id, start, ret);
+    if (ret) {
+        ret = -errno;
+        error_report("IOMMU_HWPT_SET_DIRTY_TRACKING(hwpt_id %u) failed: %m",
+                     hwpt_id);
+    }
+    return ret;
+}
+
+/*
+ * Report the pages of [@iova, @iova + @size) that were written since the
+ * previous call, as a bitmap with one bit per @page_size page, and clear
+ * their dirty state in the IOMMU.  The bits of @data are only ever set.
+ */
+int iommufd_backend_get_dirty_bitmap(IOMMUFDBackend *be, uint32_t hwpt_id,
+                                     uint64_t iova, ram_addr_t size,
+                                     uint64_t page_size, uint64_t *data)
+{
+    int ret, fd = be->fd;
+    struct iommu_hwpt_get_dirty_bitmap get_dirty_bitmap = {
+        .size = sizeof(get_dirty_bitmap),
+        .hwpt_id = hwpt_id,
+        .iova = iova,
+        .length = size,
+        .page_size = page_size,
+        .data = (uintptr_t)data,
+    };
+
+    ret = ioctl(fd, IOMMU_HWPT_GET_DIRTY_BITMAP, &get_dirty_bitmap);
+    trace_iommufd_backend_get_dirty_bitmap(fd, hwpt_id, iova, size,
+                                           page_size, ret);
+    if (ret) {
+        ret = -errno;
+        error_report("IOMMU_HWPT_GET_DIRTY_BITMAP (iova: 0x%"HWADDR_PRIx
+                     " size: 0x"RAM_ADDR_FMT") failed: %m", iova, size);
+    }
+    return ret;
+}
+
 static const TypeInfo iommufd_backend_info = {
     .name = TYPE_IOMMUFD_BACKEND,
     .parent = TYPE_OBJECT,
@@ -105,6 +105,10 @@ static void bdrv_reopen_abort(BDRVReopenState *reopen_state);
 
 static bool bdrv_backing_overridden(BlockDriverState *bs);
 
+static BdrvChainStatusCache *bdrv_csc_new(void);
+static void bdrv_csc_free(BdrvChainStatusCache *csc);
+static void bdrv_csc_clear(BlockDriverState *bs);
+
 static bool bdrv_change_aio_context(BlockDriverState *bs, AioContext *ctx,
                                     GHashTable *visited, Transaction *tran,
                                     Error **errp);
@@ -1826,6 +1830,12 @@ QemuOptsList bdrv_runtime_opts = {
             .type = QEMU_OPT_BOOL,
             .help = "always accept other writers (default: off)",
         },
+        {
+            .name = BDRV_OPT_BACKING_STATUS_CACHE,
+            .type = QEMU_OPT_BOOL,
+            .help = "cache the block status of the backing chain "
+                    "(default: off)",
+        },
         { /* end of list */ }
     },
 };
@@ -1972,6 +1982,10 @@ static int bdrv_open_common(BlockDriverState *bs, BlockBackend *file,
         goto fail_opts;
     }
 
+    if (qemu_opt_get_bool(opts, BDRV_OPT_BACKING_STATUS_CACHE, false)) {
+        bs->chain_status_cache = bdrv_csc_new();
+    }
+
     if (filename != NULL) {
         pstrcpy(bs->filename, sizeof(bs->filename), filename);
     } else {
@@ -2966,6 +2980,11 @@ bdrv_replace_child_noperm(BdrvChild *child, BlockDriverState *new_bs)
 
     child->bs = new_bs;
 
+    if (child->klass == &child_of_bds &&
+        (child->role & (BDRV_CHILD_COW | BDRV_CHILD_FILTERED))) {
+        bdrv_csc_clear(child->opaque);
+    }
+
     if (new_bs) {
         QLIST_INSERT_HEAD(&new_bs->parents, child, next_parent);
         if (child->klass->attach) {
@@ -5139,6 +5158,8 @@ static void bdrv_close(BlockDriverState *bs)
     bs->full_open_options = NULL;
     g_free(bs->block_status_cache);
     bs->block_status_cache = NULL;
+    bdrv_csc_free(bs->chain_status_cache);
+    bs->chain_status_cache = NULL;
 
     bdrv_release_named_dirty_bitmaps(bs);
     assert(QLIST_EMPTY(&bs->dirty_bitmaps));
@@ -8409,3 +8430,151 @@ void bdrv_bsc_fill(BlockDriverState *bs, int64_t offset, int64_t bytes)
         g_free_rcu(old_bsc, rcu);
     }
 }
+
+/* Upper limit for the number of extents in a chain status cache */
+#define BDRV_CSC_MAX_EXTENTS 4096
+
+typedef struct BdrvChainStatusExtent {
+    IntervalTreeNode node;
+    BlockDriverState *bs;
+} BdrvChainStatusExtent;
+
+static BdrvChainStatusCache *bdrv_csc_new(void)
+{
+    BdrvChainStatusCache *csc = g_new0(BdrvChainStatusCache, 1);
+
+    qemu_mutex_init(&csc->lock);
+    return csc;
+}
+
+static void bdrv_csc_drop_range_locked(BdrvChainStatusCache *csc,
+                                       uint64_t start, uint64_t last)
+{
+    IntervalTreeNode *n;
+
+    while ((n = interval_tree_iter_first(&csc->extents, start, last))) {
+        interval_tree_remove(n, &csc->extents);
+        g_free(container_of(n, BdrvChainStatusExtent, node));
+        csc->nr_extents--;
+    }
+}
+
+static void bdrv_csc_free(BdrvChainStatusCache *csc)
+{
+    if (!csc) {
+        return;
+    }
+    bdrv_csc_drop_range_locked(csc, 0, UINT64_MAX);
+    qemu_mutex_destroy(&csc->lock);
+    g_free(csc);
+}
+
+/*
+ * Call @fn for the nodes whose chain status cache may refer to @bs, i.e.
+ * the nodes above @bs in filter and backing chains.
+ */
+static void bdrv_csc_foreach_above(BlockDriverState *bs,
+                                   void (*fn)(BdrvChainStatusCache *csc,
+                                              uint64_t start, uint64_t last),
+                                   uint64_t start, uint64_t last)
+{
+    BdrvChild *c;
+
+    QLIST_FOREACH(c, &bs->parents, next_parent) {
+        BlockDriverState *parent;
+
+        if (c->klass != &child_of_bds ||
+            !(c->role & (BDRV_CHILD_COW | BDRV_CHILD_FILTERED))) {
+            continue;
+        }
+        parent = c->opaque;
+        if (parent->chain_status_cache) {
+            fn(parent->chain_status_cache, start, last);
+        }
+        bdrv_csc_foreach_above(parent, fn, start, last);
+    }
+}
+
+static void bdrv_csc_drop_range(BdrvChainStatusCache *csc,
+                                uint64_t start, uint64_t last)
+{
+    QEMU_LOCK_GUARD(&csc->lock);
+    bdrv_csc_drop_range_locked(csc, start, last);
+    csc->gen++;
+}
+
+/* The backing chain of @bs changed, forget all about it */
+static void bdrv_csc_clear(BlockDriverState *bs)
+{
+    if (bs->chain_status_cache) {
+        bdrv_csc_drop_range(bs->chain_status_cache, 0, UINT64_MAX);
+    }
+    bdrv_csc_foreach_above(bs, bdrv_csc_drop_range, 0, UINT64_MAX);
+}
+
+/**
+ * See block_int.h for this function's documentation.
+ */
+bool bdrv_csc_lookup(BlockDriverState *bs, int64_t offset, int64_t *bytes,
+                     BlockDriverState **node, uint64_t *gen)
+{
+    BdrvChainStatusCache *csc = bs->chain_status_cache;
+    BdrvChainStatusExtent *ext;
+    IntervalTreeNode *n;
+    IO_CODE();
+
+    QEMU_LOCK_GUARD(&csc->lock);
+    *gen = csc->gen;
+    n = interval_tree_iter_first(&csc->extents, offset, offset);
+    if (!n) {
+        return false;
+    }
+    ext = container_of(n, BdrvChainStatusExtent, node);
+    *bytes = MIN(*bytes, n->last + 1 - offset);
+    *node = ext->bs;
+    return true;
+}
+
+/**
+ * See block_int.h for this function's documentation.
+ */
+void bdrv_csc_fill(BlockDriverState *bs, uint64_t gen, int64_t offset,
+                   int64_t bytes, BlockDriverState *node)
+{
+    BdrvChainStatusCache *csc = bs->chain_status_cache;
+    BdrvChainStatusExtent *ext;
+    IO_CODE();
+
+    QEMU_LOCK_GUARD(&csc->lock);
+    if (csc->gen != gen) {
+        return;
+    }
+    if (csc->nr_extents >= BDRV_CSC_MAX_EXTENTS) {
+        bdrv_csc_drop_range_locked(csc, 0, UINT64_MAX);
+    } else {
+        /* Another walk may have filled part of the range meanwhile */
+        bdrv_csc_drop_range_locked(csc, offset, offset + bytes - 1);
+    }
+
+    ext = g_new(BdrvChainStatusExtent, 1);
+    ext->node.start = offset;
+    ext->node.last = offset + bytes - 1;
+    ext->bs = node;
+    interval_tree_insert(&ext->node, &csc->extents);
+    csc->nr_extents++;
+}
+
+/**
+ * See block_int.h for this function's documentation.
+ */
+void bdrv_csc_invalidate_range(BlockDriverState *bs,
+                               int64_t offset, int64_t bytes)
+{
+    IO_CODE();
+
+    if (!bytes) {
+        return;
+    }
+    bdrv_csc_foreach_above(bs, bdrv_csc_drop_range,
+                           offset, offset + bytes - 1);
+}
@@ -26,6 +26,7 @@
 #include "qemu/osdep.h"
 #include "block/accounting.h"
 #include "block/block_int.h"
+#include "qemu/host-utils.h"
 #include "qemu/timer.h"
 #include "sysemu/qtest.h"
 
@@ -188,6 +189,39 @@ int block_latency_histogram_set(BlockAcctStats *stats, enum BlockAcctType type,
     return 0;
 }
 
+static void block_latency_log2_account(uint64_t *buckets, int64_t latency_ns)
+{
+    int i = latency_ns > 0 ? 64 - clz64(latency_ns) : 0;
+
+    buckets[MIN(i, BLOCK_ACCT_LATENCY_LOG2_BUCKETS - 1)]++;
+}
+
+/*
+ * Return the log2 latency distribution of the requests of @type, see
+ * BLOCK_ACCT_LATENCY_LOG2_BUCKETS.  Trailing empty buckets are left out.
+ */
+uint64List *block_acct_latency_log2(BlockAcctStats *stats,
+                                    enum BlockAcctType type)
+{
+    uint64_t buckets[BLOCK_ACCT_LATENCY_LOG2_BUCKETS];
+    uint64List *list = NULL;
+    int n = BLOCK_ACCT_LATENCY_LOG2_BUCKETS;
+
+    assert(type < BLOCK_MAX_IOTYPE);
+
+    WITH_QEMU_LOCK_GUARD(&stats->lock) {
+        memcpy(buckets, stats->latency_log2[type], sizeof(buckets));
+    }
+
+    while (n > 0 && !buckets[n - 1]) {
+        n--;
+    }
+    while (n > 0) {
+        QAPI_LIST_PREPEND(list, buckets[--n]);
+    }
+    return list;
+}
+
 void block_latency_histograms_clear(BlockAcctStats *stats)
 {
     int i;
@@ -227,6 +261,8 @@ static void block_account_one_io(BlockAcctStats *stats, BlockAcctCookie *cookie,
 
         block_latency_histogram_account(&stats->latency_histogram[cookie->type],
                                         latency_ns);
+        block_latency_log2_account(stats->latency_log2[cookie->type],
+                                   latency_ns);
 
         if (!failed || stats->account_failed) {
             stats->total_time_ns[cookie->type] += latency_ns;
@@ -26,6 +26,7 @@
 #include "qemu/coroutine.h"
 #include "qemu/ratelimit.h"
 #include "block/aio_task.h"
+#include "block/copy-adapt.h"
 #include "qemu/error-report.h"
 #include "qemu/memalign.h"
 
@@ -54,6 +55,8 @@ typedef struct BlockCopyCallState {
     int max_workers;
     int64_t max_chunk;
     bool ignore_ratelimit;
+    /* Started by block_copy_async(), yields to block_copy() calls */
+    bool background;
     BlockCopyAsyncCallbackFunc cb;
     void *cb_opaque;
     /* Coroutine where async block-copy is running */
@@ -97,6 +100,8 @@ typedef struct BlockCopyTask {
      * iteration.
      */
     BlockCopyMethod method;
+    /* Set when the copy starts in block_copy_task_entry() */
+    int64_t start_ns;
 
     /*
      * Generally, req is protected by lock in BlockCopyState, Still req.offset
@@ -139,6 +144,8 @@ typedef struct BlockCopyState {
     BlockCopyMethod method;
     BlockReqList reqs;
     QLIST_HEAD(, BlockCopyCallState) calls;
+    /* Chunk size and parallelism from the observed latency and throughput */
+    CopyAdapt adapt;
     /*
      * skip_unallocated:
      *
@@ -154,6 +161,12 @@ typedef struct BlockCopyState {
      * block_copy_reset_unallocated() every time it does.
      */
     bool skip_unallocated; /* atomic */
+    /*
+     * Number of running block_copy() calls, which copy-before-write makes for
+     * guest writes.  Background calls use a single worker while there are
+     * any, so that the guest waits as little as possible.
+     */
+    int sync_calls; /* atomic */
     /* State fields that use a thread-safe API */
     BdrvDirtyBitmap *copy_bitmap;
     ProgressMeter *progress;
@@ -192,7 +205,8 @@ block_copy_task_create(BlockCopyState *s, BlockCopyCallState *call_state,
     int64_t max_chunk;
 
     QEMU_LOCK_GUARD(&s->lock);
-    max_chunk = MIN_NON_ZERO(block_copy_chunk_size(s), call_state->max_chunk);
+    max_chunk = MIN(block_copy_chunk_size(s), s->adapt.chunk);
+    max_chunk = MIN_NON_ZERO(max_chunk, call_state->max_chunk);
     if (!bdrv_dirty_bitmap_next_dirty_area(s->copy_bitmap,
                                            offset, offset + bytes,
                                            max_chunk, &offset, &bytes))
@@ -284,6 +298,8 @@ static uint32_t block_copy_max_transfer(BdrvChild *source, BdrvChild *target)
 void block_copy_set_copy_opts(BlockCopyState *s, bool use_copy_range,
                               bool compress)
 {
+    int64_t max_chunk;
+
     /* Keep BDRV_REQ_SERIALISING set (or not set) in block_copy_state_new() */
     s->write_flags = (s->write_flags & BDRV_REQ_SERIALISING) |
         (compress ? BDRV_REQ_WRITE_COMPRESSED : 0);
@@ -306,6 +322,16 @@ void block_copy_set_copy_opts(BlockCopyState *s, bool use_copy_range,
          */
         s->method = use_copy_range ? COPY_RANGE_SMALL : COPY_READ_WRITE;
     }
+
+    /* Let the chunk size grow as large as the method may ever allow */
+    if (s->method == COPY_RANGE_SMALL) {
+        max_chunk = MIN(MAX(s->cluster_size, BLOCK_COPY_MAX_COPY_RANGE),
+                        s->max_transfer);
+    } else {
+        max_chunk = block_copy_chunk_size(s);
+    }
+    copy_adapt_init(&s->adapt, s->cluster_size, max_chunk,
+                    BLOCK_COPY_MAX_WORKERS);
 }
 
 static int64_t block_copy_calculate_cluster_size(BlockDriverState *target,
@@ -421,7 +447,7 @@ BlockCopyState *block_copy_state_new(BdrvChild *source, BdrvChild *target,
 
     ratelimit_init(&s->rate_limit);
     qemu_co_mutex_init(&s->lock);
-    QLIST_INIT(&s->reqs);
+    reqlist_init(&s->reqs);
     QLIST_INIT(&s->calls);
 
     return s;
@@ -566,6 +592,7 @@ static coroutine_fn int block_copy_task_entry(AioTask *task)
     BlockCopyMethod method = t->method;
     int ret;
 
+    t->start_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
     WITH_GRAPH_RDLOCK_GUARD() {
         ret = block_copy_do_copy(s, t->req.offset, t->req.bytes, &method,
                                  &error_is_read);
@@ -581,8 +608,16 @@ static coroutine_fn int block_copy_task_entry(AioTask *task)
                 t->call_state->ret = ret;
                 t->call_state->error_is_read = error_is_read;
             }
-        } else if (s->progress) {
-            progress_work_done(s->progress, t->req.bytes);
+        } else {
+            if (s->progress) {
+                progress_work_done(s->progress, t->req.bytes);
+            }
+            /* Zeroes take no bandwidth, they would skew the measurements */
+            if (method != COPY_WRITE_ZEROES) {
+                copy_adapt_account(&s->adapt, t->req.bytes,
+                                   qemu_clock_get_ns(QEMU_CLOCK_REALTIME) -
+                                   t->start_ns);
+            }
         }
     }
     co_put_to_shres(s->mem, t->req.bytes);
@@ -680,6 +715,15 @@ void block_copy_reset(BlockCopyState *s, int64_t offset, int64_t bytes)
     }
 }
 
+bool coroutine_fn block_copy_is_clean(BlockCopyState *s, int64_t offset,
+                                      int64_t bytes)
+{
+    QEMU_LOCK_GUARD(&s->lock);
+
+    return bdrv_dirty_bitmap_next_dirty(s->copy_bitmap, offset, bytes) == -1 &&
+        !reqlist_find_conflict(&s->reqs, offset, bytes);
+}
+
 /*
  * Reset bits in copy_bitmap starting at offset if they represent unallocated
  * data in the image. May reset subsequent contiguous bits.
@@ -708,6 +752,22 @@ int64_t coroutine_fn block_copy_reset_unallocated(BlockCopyState *s,
     return ret;
 }
 
+/* Number of tasks that @call_state may currently run in parallel */
+static int coroutine_fn block_copy_max_workers(BlockCopyCallState *call_state)
+{
+    BlockCopyState *s = call_state->s;
+    int workers;
+
+    if (call_state->background && qatomic_read(&s->sync_calls)) {
+        return 1;
+    }
+
+    WITH_QEMU_LOCK_GUARD(&s->lock) {
+        workers = s->adapt.workers;
+    }
+    return MIN(workers, call_state->max_workers);
+}
+
 /*
  * block_copy_dirty_clusters
  *
@@ -794,7 +854,10 @@ block_copy_dirty_clusters(BlockCopyCallState *call_state)
         bytes = end - offset;
 
         if (!aio && bytes) {
-            aio = aio_task_pool_new(call_state->max_workers);
+            aio = aio_task_pool_new(block_copy_max_workers(call_state));
+        } else if (aio) {
+            aio_task_pool_set_max_busy_tasks(aio,
+                                             block_copy_max_workers(call_state));
         }
 
         ret = block_copy_task_run(aio, task);
@@ -926,8 +989,10 @@ int coroutine_fn block_copy(BlockCopyState *s, int64_t start, int64_t bytes,
         .cb_opaque = cb_opaque,
     };
 
+    qatomic_inc(&s->sync_calls);
     ret = qemu_co_timeout(block_copy_async_co_entry, call_state, timeout_ns,
                           g_free);
+    qatomic_dec(&s->sync_calls);
     if (ret < 0) {
         assert(ret == -ETIMEDOUT);
         block_copy_call_cancel(call_state);
@@ -955,6 +1020,7 @@ BlockCopyCallState *block_copy_async(BlockCopyState *s,
         .bytes = bytes,
         .max_workers = max_workers,
         .max_chunk = max_chunk,
+        .background = true,
         .cb = cb,
         .cb_opaque = cb_opaque,
 
@@ -172,13 +172,33 @@ static int coroutine_fn commit_run(Job *job, Error **errp)
         copy = (ret > 0);
         trace_commit_one_iteration(s, offset, n, ret);
         if (copy) {
+            int64_t pnum;
+            int status;
+
             assert(n < SIZE_MAX);
 
-            ret = blk_co_pread(s->top, offset, n, buf, 0);
-            if (ret >= 0) {
-                ret = blk_co_pwrite(s->base, offset, n, buf, 0);
-                if (ret < 0) {
-                    error_in_source = false;
+            /* Zeroes need neither be read nor allocated in the base */
+            status = blk_co_block_status_above(s->top, NULL, offset, n,
+                                               &pnum, NULL, NULL);
+            if (status >= 0 && (status & BDRV_BLOCK_ZERO)) {
+                n = pnum;
+                trace_commit_zero_detected(s, offset, n, false);
+                ret = blk_co_pwrite_zeroes(s->base, offset, n,
+                                           BDRV_REQ_MAY_UNMAP);
+                error_in_source = false;
+            } else {
+                ret = blk_co_pread(s->top, offset, n, buf, 0);
+                if (ret >= 0) {
+                    if (buffer_is_zero(buf, n)) {
+                        trace_commit_zero_detected(s, offset, n, true);
+                        ret = blk_co_pwrite_zeroes(s->base, offset, n,
+                                                   BDRV_REQ_MAY_UNMAP);
+                    } else {
+                        ret = blk_co_pwrite(s->base, offset, n, buf, 0);
+                    }
+                    if (ret < 0) {
+                        error_in_source = false;
+                    }
                 }
             }
         }
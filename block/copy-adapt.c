@@ -0,0 +1,107 @@
+/*
+ * Adaptive chunk size and parallelism for block jobs copying data
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/timer.h"
+#include "block/copy-adapt.h"
+#include "trace.h"
+
+/* Length of a measurement window */
+#define COPY_ADAPT_INTERVAL_NS (100 * SCALE_MS)
+/* A window longer than this had idle time in it and is dropped */
+#define COPY_ADAPT_MAX_INTERVAL_NS (10 * COPY_ADAPT_INTERVAL_NS)
+/* Requests needed in a window for its measurements to be meaningful */
+#define COPY_ADAPT_MIN_REQUESTS 4
+/* Average request latency above which the chunk size is reduced */
+#define COPY_ADAPT_TARGET_LATENCY_NS (50 * SCALE_MS)
+
+void copy_adapt_init(CopyAdapt *a, int64_t min_chunk, int64_t max_chunk,
+                     int max_workers)
+{
+    assert(min_chunk > 0 && max_workers > 0);
+
+    max_chunk = MAX(QEMU_ALIGN_DOWN(max_chunk, min_chunk), min_chunk);
+    *a = (CopyAdapt) {
+        .chunk = max_chunk,
+        .workers = max_workers,
+        .min_chunk = min_chunk,
+        .max_chunk = max_chunk,
+        .max_workers = max_workers,
+        .window_start_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME),
+        .direction = -1,
+    };
+}
+
+static void copy_adapt_reset_window(CopyAdapt *a, int64_t now)
+{
+    a->window_start_ns = now;
+    a->window_bytes = 0;
+    a->window_requests = 0;
+    a->window_latency_ns = 0;
+}
+
+bool copy_adapt_account_at(CopyAdapt *a, uint64_t bytes, int64_t latency_ns,
+                           int64_t now)
+{
+    int64_t elapsed = now - a->window_start_ns;
+    int64_t old_chunk = a->chunk;
+    int old_workers = a->workers;
+    int64_t latency;
+    uint64_t rate;
+    int step;
+
+    a->window_bytes += bytes;
+    a->window_requests++;
+    a->window_latency_ns += latency_ns;
+
+    if (elapsed < COPY_ADAPT_INTERVAL_NS) {
+        return false;
+    }
+    if (elapsed > COPY_ADAPT_MAX_INTERVAL_NS ||
+        a->window_requests < COPY_ADAPT_MIN_REQUESTS) {
+        copy_adapt_reset_window(a, now);
+        return false;
+    }
+
+    latency = a->window_latency_ns / a->window_requests;
+    rate = a->window_bytes * NANOSECONDS_PER_SECOND / elapsed;
+
+    if (latency > COPY_ADAPT_TARGET_LATENCY_NS) {
+        a->chunk = MAX(QEMU_ALIGN_DOWN(a->chunk / 2, a->min_chunk),
+                       a->min_chunk);
+    } else if (latency < COPY_ADAPT_TARGET_LATENCY_NS / 4) {
+        a->chunk = MIN(a->chunk * 2, a->max_chunk);
+    }
+
+    /*
+     * Only compare throughput with the same chunk size, a change in chunk
+     * size says nothing about the number of workers.
+     */
+    if (a->chunk == old_chunk) {
+        if (a->last_rate && rate < a->last_rate - a->last_rate / 8) {
+            a->direction = -a->direction;
+        }
+        if ((a->direction < 0 && a->workers == 1) ||
+            (a->direction > 0 && a->workers == a->max_workers)) {
+            a->direction = -a->direction;
+        }
+        step = MAX(a->workers / 4, 1);
+        a->workers = MIN(MAX(a->workers + a->direction * step, 1),
+                         a->max_workers);
+    }
+    a->last_rate = rate;
+
+    trace_copy_adapt(a, rate, latency, a->chunk, a->workers);
+    copy_adapt_reset_window(a, now);
+    return a->chunk != old_chunk || a->workers != old_workers;
+}
+
+bool copy_adapt_account(CopyAdapt *a, uint64_t bytes, int64_t latency_ns)
+{
+    return copy_adapt_account_at(a, bytes, latency_ns,
+                                 qemu_clock_get_ns(QEMU_CLOCK_REALTIME));
+}
@@ -120,18 +120,27 @@ static coroutine_fn int cbw_do_copy_before_write(BlockDriverState *bs,
     off = QEMU_ALIGN_DOWN(offset, cluster_size);
     end = QEMU_ALIGN_UP(offset + bytes, cluster_size);
 
-    /*
-     * Increase in_flight, so that in case of timed-out block-copy, the
-     * remaining background block_copy() request (which can't be immediately
-     * cancelled by timeout) is presented in bs->in_flight. This way we are
-     * sure that on bs close() we'll previously wait for all timed-out but yet
-     * running block_copy calls.
-     */
-    bdrv_inc_in_flight(bs);
-    ret = block_copy(s->bcs, off, end - off, true, s->cbw_timeout_ns,
-                     block_copy_cb, bs);
-    if (ret < 0 && s->on_cbw_error == ON_CBW_ERROR_BREAK_GUEST_WRITE) {
-        return ret;
+    if (block_copy_is_clean(s->bcs, off, end - off)) {
+        /*
+         * Busy guests mostly rewrite clusters that were already copied.
+         * Skip block_copy() for them, which would allocate a call state
+         * and, with cbw-timeout, start a coroutine and a timer.
+         */
+        ret = 0;
+    } else {
+        /*
+         * Increase in_flight, so that in case of timed-out block-copy, the
+         * remaining background block_copy() request (which can't be
+         * immediately cancelled by timeout) is presented in bs->in_flight.
+         * This way we are sure that on bs close() we'll previously wait for
+         * all timed-out but yet running block_copy calls.
+         */
+        bdrv_inc_in_flight(bs);
+        ret = block_copy(s->bcs, off, end - off, true, s->cbw_timeout_ns,
+                         block_copy_cb, bs);
+        if (ret < 0 && s->on_cbw_error == ON_CBW_ERROR_BREAK_GUEST_WRITE) {
+            return ret;
+        }
     }
 
     WITH_QEMU_LOCK_GUARD(&s->lock) {
@@ -479,7 +488,7 @@ static int cbw_open(BlockDriverState *bs, QDict *options, int flags,
                                      true);
 
     qemu_co_mutex_init(&s->lock);
-    QLIST_INIT(&s->frozen_read_reqs);
+    reqlist_init(&s->frozen_read_reqs);
     return 0;
 }
 
@@ -22,6 +22,7 @@
 
 #include "block/block_int.h"
 #include "block/qdict.h"
+#include "block/thread-pool.h"
 #include "sysemu/block-backend.h"
 #include "crypto/block.h"
 #include "qapi/opts-visitor.h"
@@ -32,14 +33,32 @@
 #include "qemu/option.h"
 #include "qemu/cutils.h"
 #include "qemu/memalign.h"
+#include "qemu/units.h"
 #include "crypto.h"
 
 typedef struct BlockCrypto BlockCrypto;
 
+/*
+ * Maximum number of worker threads that encrypt or decrypt for one image;
+ * each of them needs its own cipher.
+ */
+#define BLOCK_CRYPTO_MAX_THREADS 4
+
+/*
+ * Chunks smaller than this are processed in place, because handing them
+ * to a worker thread costs more than the cipher itself.
+ */
+#define BLOCK_CRYPTO_MIN_THREAD_SIZE (16 * KiB)
+
 struct BlockCrypto {
     QCryptoBlock *block;
     bool updating_keys;
     BdrvChild *header;  /* Reference to the detached LUKS header */
+
+    /* Requests using a cipher, at most BLOCK_CRYPTO_MAX_THREADS */
+    CoMutex thread_lock;
+    CoQueue thread_task_queue;
+    int nb_threads;
 };
 
 
@@ -321,6 +340,9 @@ static int block_crypto_open_generic(QCryptoBlockFormat format,
 
     GLOBAL_STATE_CODE();
 
+    qemu_co_mutex_init(&crypto->thread_lock);
+    qemu_co_queue_init(&crypto->thread_task_queue);
+
     ret = bdrv_open_file_child(NULL, options, "file", bs, errp);
     if (ret < 0) {
         return ret;
@@ -363,7 +385,7 @@ static int block_crypto_open_generic(QCryptoBlockFormat format,
                                        block_crypto_read_func,
                                        bs,
                                        cflags,
-                                       1,
+                                       BLOCK_CRYPTO_MAX_THREADS,
                                        errp);
 
     if (!crypto->block) {
@@ -467,6 +489,55 @@ static int block_crypto_reopen_prepare(BDRVReopenState *state,
  */
 #define BLOCK_CRYPTO_MAX_IO_SIZE (1024 * 1024)
 
+int block_crypto_encdec_pool_func(void *opaque)
+{
+    BlockCryptoEncDecData *data = opaque;
+
+    return data->func(data->block, data->offset, data->buf, data->len, NULL);
+}
+
+/*
+ * Encrypt or decrypt @buf in a worker thread, so that the AioContext keeps
+ * serving other requests and several requests use several host cores.
+ */
+static int coroutine_fn
+block_crypto_co_encdec(BlockCrypto *crypto, uint64_t offset, uint8_t *buf,
+                       size_t len, BlockCryptoEncDecFunc func)
+{
+    BlockCryptoEncDecData arg = {
+        .block = crypto->block,
+        .offset = offset,
+        .buf = buf,
+        .len = len,
+        .func = func,
+    };
+    int ret;
+
+    /*
+     * One cipher per thread was allocated when opening the image, and the
+     * requests that are processed in place need one too.
+     */
+    qemu_co_mutex_lock(&crypto->thread_lock);
+    while (crypto->nb_threads >= BLOCK_CRYPTO_MAX_THREADS) {
+        qemu_co_queue_wait(&crypto->thread_task_queue, &crypto->thread_lock);
+    }
+    crypto->nb_threads++;
+    qemu_co_mutex_unlock(&crypto->thread_lock);
+
+    if (len < BLOCK_CRYPTO_MIN_THREAD_SIZE) {
+        ret = block_crypto_encdec_pool_func(&arg);
+    } else {
+        ret = thread_pool_submit_co(block_crypto_encdec_pool_func, &arg);
+    }
+
+    qemu_co_mutex_lock(&crypto->thread_lock);
+    crypto->nb_threads--;
+    qemu_co_queue_next(&crypto->thread_task_queue);
+    qemu_co_mutex_unlock(&crypto->thread_lock);
+
+    return ret;
+}
+
 static int coroutine_fn GRAPH_RDLOCK
 block_crypto_co_preadv(BlockDriverState *bs, int64_t offset, int64_t bytes,
                        QEMUIOVector *qiov, BdrvRequestFlags flags)
@@ -509,8 +580,8 @@ block_crypto_co_preadv(BlockDriverState *bs, int64_t offset, int64_t bytes,
             goto cleanup;
         }
 
-        if (qcrypto_block_decrypt(crypto->block, offset + bytes_done,
-                                  cipher_data, cur_bytes, NULL) < 0) {
+        if (block_crypto_co_encdec(crypto, offset + bytes_done, cipher_data,
+                                   cur_bytes, qcrypto_block_decrypt) < 0) {
             ret = -EIO;
             goto cleanup;
         }
@@ -566,8 +637,8 @@ block_crypto_co_pwritev(BlockDriverState *bs, int64_t offset, int64_t bytes,
 
         qemu_iovec_to_buf(qiov, bytes_done, cipher_data, cur_bytes);
 
-        if (qcrypto_block_encrypt(crypto->block, offset + bytes_done,
-                                  cipher_data, cur_bytes, NULL) < 0) {
+        if (block_crypto_co_encdec(crypto, offset + bytes_done, cipher_data,
+                                   cur_bytes, qcrypto_block_encrypt) < 0) {
             ret = -EIO;
             goto cleanup;
         }
@@ -139,4 +139,27 @@ block_crypto_amend_opts_init(QDict *opts, Error **errp);
 QCryptoBlockOpenOptions *
 block_crypto_open_opts_init(QDict *opts, Error **errp);
 
+/*
+ * BlockCryptoEncDecFunc: common prototype of qcrypto_block_encrypt() and
+ * qcrypto_block_decrypt() functions.
+ */
+typedef int (*BlockCryptoEncDecFunc)(QCryptoBlock *block, uint64_t offset,
+                                     uint8_t *buf, size_t len, Error **errp);
+
+typedef struct BlockCryptoEncDecData {
+    QCryptoBlock *block;
+    uint64_t offset;
+    uint8_t *buf;
+    size_t len;
+
+    BlockCryptoEncDecFunc func;
+} BlockCryptoEncDecData;
+
+/*
+ * ThreadPoolFunc that runs the encryption or decryption described by the
+ * BlockCryptoEncDecData @opaque.  Drivers submit it to the thread pool with
+ * their own limit on the number of busy threads.
+ */
+int block_crypto_encdec_pool_func(void *opaque);
+
 #endif /* BLOCK_CRYPTO_H */
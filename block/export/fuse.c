@@ -16,10 +16,26 @@
  * along with this program; if not, see <http://www.gnu.org/licenses/>.
  */
 
+/*
+ * On Linux, libfuse is only used to create and mount the FUSE session.
+ * Requests are read from /dev/fuse and answered here, so that each of them
+ * can run in its own coroutine and so that the data of WRITE requests can
+ * be read directly into aligned buffers.  With several IOThreads, each of
+ * them reads requests from its own clone of the session's file descriptor.
+ *
+ * Elsewhere, libfuse reads the requests and dispatches them to fuse_ops,
+ * one at a time.
+ */
+
 #define FUSE_USE_VERSION 31
 
 #include "qemu/osdep.h"
+#include "qemu/coroutine.h"
+#include "qemu/error-report.h"
+#include "qemu/iov.h"
+#include "qemu/lockable.h"
 #include "qemu/memalign.h"
+#include "qemu/units.h"
 #include "block/aio.h"
 #include "block/block_int-common.h"
 #include "block/export.h"
@@ -29,9 +45,12 @@
 #include "qapi/qapi-commands-block.h"
 #include "qemu/main-loop.h"
 #include "sysemu/block-backend.h"
+#include "sysemu/iothread.h"
 
-#include <fuse.h>
 #include <fuse_lowlevel.h>
+#ifdef CONFIG_LINUX
+#include <linux/fuse.h>
+#endif
 
 #if defined(CONFIG_FALLOCATE_ZERO_RANGE)
 #include <linux/falloc.h>
@@ -44,14 +63,63 @@
 /* Prevent overly long bounce buffer allocations */
 #define FUSE_MAX_BOUNCE_BYTES (MIN(BDRV_REQUEST_MAX_BYTES, 64 * 1024 * 1024))
 
+#ifdef CONFIG_LINUX
+/*
+ * Largest write we accept.  Kernels without FUSE_MAX_PAGES still limit
+ * requests to 32 pages.
+ */
+#define FUSE_MAX_WRITE_BYTES (1 * MiB)
+
+/* Just the headers of a WRITE request, its data goes to the spillover buffer */
+#define FUSE_IN_PLACE_BYTES \
+    (sizeof(struct fuse_in_header) + sizeof(struct fuse_write_in))
 
-typedef struct FuseExport {
+/* The kernel does not read requests into smaller buffers */
+#define FUSE_SPILLOVER_BUF_SIZE \
+    MAX(FUSE_MAX_WRITE_BYTES, FUSE_MIN_READ_BUFFER - FUSE_IN_PLACE_BYTES)
+
+/* Oldest protocol version with the current layout of all requests we use */
+#define FUSE_MIN_MINOR_VERSION 9
+#endif
+
+typedef struct FuseExport FuseExport;
+
+/*
+ * A file descriptor for /dev/fuse and the thread reading requests from it.
+ * The kernel hands every request to whichever clone of the session's file
+ * descriptor reads it first, and expects its reply on that same one.
+ */
+typedef struct FuseQueue {
+    FuseExport *exp;
+    /* NULL if requests are processed in the export's AioContext */
+    IOThread *iothread;
+    int fuse_fd;
+
+#ifdef CONFIG_LINUX
+    /*
+     * A request is read into these two buffers.  Coroutines processing it
+     * copy its headers before they yield, and WRITE requests take over the
+     * spillover buffer with their data.
+     */
+    char request_buf[FUSE_IN_PLACE_BYTES];
+    void *spillover_buf;
+    size_t request_len;
+#endif
+} FuseQueue;
+
+struct FuseExport {
     BlockExport common;
 
     struct fuse_session *fuse_session;
+#ifndef CONFIG_LINUX
     struct fuse_buf fuse_buf;
+#endif
+    FuseQueue *queues;
+    int num_queues;
     unsigned int in_flight; /* atomic */
     bool mounted, fd_handler_set_up;
+    /* Set when no more requests must be read (atomic) */
+    bool halted;
 
     char *mountpoint;
     bool writable;
@@ -59,10 +127,15 @@ typedef struct FuseExport {
     /* Whether allow_other was used as a mount option or not */
     bool allow_other;
 
+#ifdef CONFIG_LINUX
+    /* Serializes requests that change the image length */
+    CoMutex resize_lock;
+#endif
+
     mode_t st_mode;
     uid_t st_uid;
     gid_t st_gid;
-} FuseExport;
+};
 
 static GHashTable *exports;
 static const struct fuse_lowlevel_ops fuse_ops;
@@ -74,19 +147,54 @@ static void init_exports_table(void);
 
 static int setup_fuse_export(FuseExport *exp, const char *mountpoint,
                              bool allow_other, Error **errp);
-static void read_from_fuse_export(void *opaque);
+static void read_from_fuse_fd(void *opaque);
 
 static bool is_regular_file(const char *path, Error **errp);
 
 
+static AioContext *fuse_queue_ctx(FuseQueue *q)
+{
+    return q->iothread ? iothread_get_aio_context(q->iothread)
+                       : q->exp->common.ctx;
+}
+
+static void fuse_export_attach_handlers(FuseExport *exp)
+{
+    int i;
+
+    if (qatomic_read(&exp->halted)) {
+        return;
+    }
+
+    for (i = 0; i < exp->num_queues; i++) {
+        FuseQueue *q = &exp->queues[i];
+
+        aio_set_fd_handler(fuse_queue_ctx(q), q->fuse_fd,
+                           read_from_fuse_fd, NULL, NULL, NULL, q);
+    }
+    exp->fd_handler_set_up = true;
+}
+
+static void fuse_export_detach_handlers(FuseExport *exp)
+{
+    int i;
+
+    for (i = 0; i < exp->num_queues; i++) {
+        FuseQueue *q = &exp->queues[i];
+
+        if (q->fuse_fd >= 0) {
+            aio_set_fd_handler(fuse_queue_ctx(q), q->fuse_fd,
+                               NULL, NULL, NULL, NULL, NULL);
+        }
+    }
+    exp->fd_handler_set_up = false;
+}
+
 static void fuse_export_drained_begin(void *opaque)
 {
     FuseExport *exp = opaque;
 
-    aio_set_fd_handler(exp->common.ctx,
-                       fuse_session_fd(exp->fuse_session),
-                       NULL, NULL, NULL, NULL, NULL);
-    exp->fd_handler_set_up = false;
+    fuse_export_detach_handlers(exp);
 }
 
 static void fuse_export_drained_end(void *opaque)
@@ -96,10 +204,7 @@ static void fuse_export_drained_end(void *opaque)
     /* Refresh AioContext in case it changed */
     exp->common.ctx = blk_get_aio_context(exp->common.blk);
 
-    aio_set_fd_handler(exp->common.ctx,
-                       fuse_session_fd(exp->fuse_session),
-                       read_from_fuse_export, NULL, NULL, NULL, exp);
-    exp->fd_handler_set_up = true;
+    fuse_export_attach_handlers(exp);
 }
 
 static bool fuse_export_drained_poll(void *opaque)
@@ -115,6 +220,87 @@ static const BlockDevOps fuse_export_blk_dev_ops = {
     .drained_poll  = fuse_export_drained_poll,
 };
 
+/**
+ * Allocate one queue per IOThread in @iothreads, or a single one for the
+ * export's AioContext if there are none.
+ */
+static int fuse_export_init_queues(FuseExport *exp, strList *iothreads,
+                                   Error **errp)
+{
+    strList *e;
+    int i;
+
+    exp->num_queues = iothreads ? QAPI_LIST_LENGTH(iothreads) : 1;
+    exp->queues = g_new0(FuseQueue, exp->num_queues);
+    for (i = 0; i < exp->num_queues; i++) {
+        exp->queues[i].exp = exp;
+        exp->queues[i].fuse_fd = -1;
+    }
+
+    for (e = iothreads, i = 0; e; e = e->next, i++) {
+        IOThread *iothread = iothread_by_id(e->value);
+
+        if (!iothread) {
+            error_setg(errp, "IOThread \"%s\" object does not exist",
+                       e->value);
+            return -EINVAL;
+        }
+        object_ref(OBJECT(iothread));
+        exp->queues[i].iothread = iothread;
+    }
+
+    return 0;
+}
+
+#ifdef CONFIG_LINUX
+/**
+ * Give every queue its file descriptor: the session's own for the first
+ * one, clones of it for the others.  They are made non-blocking because
+ * all of them become readable when a request arrives, and only one of
+ * the queues gets it.
+ */
+static int fuse_export_open_queues(FuseExport *exp, Error **errp)
+{
+    uint32_t session_fd = fuse_session_fd(exp->fuse_session);
+    int i;
+
+    for (i = 0; i < exp->num_queues; i++) {
+        FuseQueue *q = &exp->queues[i];
+
+        if (i == 0) {
+            q->fuse_fd = session_fd;
+        } else {
+            q->fuse_fd = qemu_open("/dev/fuse", O_RDWR, errp);
+            if (q->fuse_fd < 0) {
+                return -EIO;
+            }
+            if (ioctl(q->fuse_fd, FUSE_DEV_IOC_CLONE, &session_fd) < 0) {
+                error_setg_errno(errp, errno, "Failed to clone FUSE session");
+                return -EIO;
+            }
+        }
+
+        if (!g_unix_set_fd_nonblocking(q->fuse_fd, true, NULL)) {
+            error_setg_errno(errp, errno,
+                             "Failed to make FUSE FD non-blocking");
+            return -EIO;
+        }
+    }
+
+    return 0;
+}
+#else
+/**
+ * libfuse reads the requests, and only from the session's file descriptor.
+ */
+static int fuse_export_open_queues(FuseExport *exp, Error **errp)
+{
+    assert(exp->num_queues == 1);
+    exp->queues[0].fuse_fd = fuse_session_fd(exp->fuse_session);
+    return 0;
+}
+#endif
+
 static int fuse_export_create(BlockExport *blk_exp,
                               BlockExportOptions *blk_exp_args,
                               Error **errp)
@@ -175,9 +361,25 @@ static int fuse_export_create(BlockExport *blk_exp,
         goto fail;
     }
 
+#ifndef CONFIG_LINUX
+    if (args->iothreads) {
+        error_setg(errp, "FUSE exports support iothreads only on Linux");
+        ret = -EINVAL;
+        goto fail;
+    }
+#endif
+
+    ret = fuse_export_init_queues(exp, args->iothreads, errp);
+    if (ret < 0) {
+        goto fail;
+    }
+
     exp->mountpoint = g_strdup(args->mountpoint);
     exp->writable = blk_exp_args->writable;
     exp->growable = args->growable;
+#ifdef CONFIG_LINUX
+    qemu_co_mutex_init(&exp->resize_lock);
+#endif
 
     /* set default */
     if (!args->has_allow_other) {
@@ -206,6 +408,13 @@ static int fuse_export_create(BlockExport *blk_exp,
         goto fail;
     }
 
+    ret = fuse_export_open_queues(exp, errp);
+    if (ret < 0) {
+        goto fail;
+    }
+
+    fuse_export_attach_handlers(exp);
+
     return 0;
 
 fail:
@@ -237,8 +446,8 @@ static int setup_fuse_export(FuseExport *exp, const char *mountpoint,
     int ret;
 
     /*
-     * max_read needs to match what fuse_init() sets.
-     * max_write need not be supplied.
+     * max_read is only ever passed as a mount option, and the FUSE_INIT
+     * handler must agree with it.  max_write is negotiated there.
      */
     mount_opts = g_strdup_printf("max_read=%zu,default_permissions%s",
                                  FUSE_MAX_BOUNCE_BYTES,
@@ -269,11 +478,6 @@ static int setup_fuse_export(FuseExport *exp, const char *mountpoint,
 
     g_hash_table_insert(exports, g_strdup(mountpoint), NULL);
 
-    aio_set_fd_handler(exp->common.ctx,
-                       fuse_session_fd(exp->fuse_session),
-                       read_from_fuse_export, NULL, NULL, NULL, exp);
-    exp->fd_handler_set_up = true;
-
     return 0;
 
 fail:
@@ -281,13 +485,63 @@ fail:
     return ret;
 }
 
+#ifdef CONFIG_LINUX
+static void coroutine_fn fuse_co_process_request(void *opaque);
+
+/**
+ * Callback to be invoked when a queue's FD can be read from.
+ * (This is basically the FUSE event loop.)
+ */
+static void read_from_fuse_fd(void *opaque)
+{
+    FuseQueue *q = opaque;
+    FuseExport *exp = q->exp;
+    struct iovec iov[2];
+    Coroutine *co;
+    ssize_t ret;
+
+    if (!q->spillover_buf) {
+        q->spillover_buf = qemu_memalign(qemu_real_host_page_size(),
+                                         FUSE_SPILLOVER_BUF_SIZE);
+    }
+
+    iov[0] = (struct iovec) { q->request_buf, sizeof(q->request_buf) };
+    iov[1] = (struct iovec) { q->spillover_buf, FUSE_SPILLOVER_BUF_SIZE };
+
+    do {
+        ret = readv(q->fuse_fd, iov, ARRAY_SIZE(iov));
+    } while (ret < 0 && errno == EINTR);
+
+    if (ret < 0) {
+        if (errno == ENODEV) {
+            /* Unmounted, no more requests will come */
+            qatomic_set(&exp->halted, true);
+            aio_set_fd_handler(fuse_queue_ctx(q), q->fuse_fd,
+                               NULL, NULL, NULL, NULL, NULL);
+        }
+        /* EAGAIN: another queue got the request first */
+        return;
+    }
+    if (ret < sizeof(struct fuse_in_header)) {
+        return;
+    }
+    q->request_len = ret;
+
+    blk_exp_ref(&exp->common);
+    qatomic_inc(&exp->in_flight);
+
+    co = qemu_coroutine_create(fuse_co_process_request, q);
+    qemu_coroutine_enter(co);
+}
+#else
 /**
  * Callback to be invoked when the FUSE session FD can be read from.
  * (This is basically the FUSE event loop.)
  */
-static void read_from_fuse_export(void *opaque)
+static void read_from_fuse_fd(void *opaque)
 {
-    FuseExport *exp = opaque;
+    FuseQueue *q = opaque;
+    FuseExport *exp = q->exp;
     int ret;
 
     blk_exp_ref(&exp->common);
@@ -310,6 +564,7 @@ out:
 
     blk_exp_unref(&exp->common);
 }
+#endif
 
 static void fuse_export_shutdown(BlockExport *blk_exp)
 {
@@ -318,11 +573,9 @@ static void fuse_export_shutdown(BlockExport *blk_exp)
     if (exp->fuse_session) {
         fuse_session_exit(exp->fuse_session);
 
+        qatomic_set(&exp->halted, true);
         if (exp->fd_handler_set_up) {
-            aio_set_fd_handler(exp->common.ctx,
-                               fuse_session_fd(exp->fuse_session),
-                               NULL, NULL, NULL, NULL, NULL);
-            exp->fd_handler_set_up = false;
+            fuse_export_detach_handlers(exp);
         }
     }
 
@@ -338,6 +591,23 @@ static void fuse_export_shutdown(BlockExport *blk_exp)
 static void fuse_export_delete(BlockExport *blk_exp)
 {
     FuseExport *exp = container_of(blk_exp, FuseExport, common);
+    int i;
+
+    for (i = 0; i < exp->num_queues; i++) {
+        FuseQueue *q = &exp->queues[i];
+
+        /* The session's own FD is closed by fuse_session_destroy() */
+        if (i > 0 && q->fuse_fd >= 0) {
+            close(q->fuse_fd);
+        }
+#ifdef CONFIG_LINUX
+        qemu_vfree(q->spillover_buf);
+#endif
+        if (q->iothread) {
+            object_unref(OBJECT(q->iothread));
+        }
+    }
+    g_free(exp->queues);
 
     if (exp->fuse_session) {
         if (exp->mounted) {
@@ -347,7 +617,9 @@ static void fuse_export_delete(BlockExport *blk_exp)
         fuse_session_destroy(exp->fuse_session);
     }
 
+#ifndef CONFIG_LINUX
     free(exp->fuse_buf.mem);
+#endif
     g_free(exp->mountpoint);
 }
 
@@ -374,6 +646,691 @@ static bool is_regular_file(const char *path, Error **errp)
     return true;
 }
 
+#ifdef CONFIG_LINUX
+/**
+ * Negotiate the protocol version and parameters with the kernel.
+ * Returns the length of the reply in @out.
+ */
+static ssize_t coroutine_fn fuse_co_init(FuseExport *exp,
+                                         struct fuse_init_out *out,
+                                         const struct fuse_init_in *in)
+{
+    /* What libfuse asks for by default, plus larger requests */
+    uint32_t flags = FUSE_ASYNC_READ | FUSE_ATOMIC_O_TRUNC | FUSE_BIG_WRITES |
+                     FUSE_AUTO_INVAL_DATA | FUSE_ASYNC_DIO;
+
+#if FUSE_KERNEL_MINOR_VERSION >= 28
+    flags |= FUSE_MAX_PAGES;
+#endif
+
+    if (in->major != FUSE_KERNEL_VERSION ||
+        in->minor < FUSE_MIN_MINOR_VERSION) {
+        error_report("FUSE export: unsupported protocol version %u.%u",
+                     in->major, in->minor);
+        return -EPROTO;
+    }
+
+    *out = (struct fuse_init_out) {
+        .major = FUSE_KERNEL_VERSION,
+        .minor = MIN(in->minor, FUSE_KERNEL_MINOR_VERSION),
+        .max_readahead = in->max_readahead,
+        .flags = in->flags & flags,
+        .max_background = 64,
+        .congestion_threshold = 48,
+        .max_write = FUSE_MAX_WRITE_BYTES,
+#if FUSE_KERNEL_MINOR_VERSION >= 28
+        .max_pages = FUSE_MAX_WRITE_BYTES / qemu_real_host_page_size(),
+#endif
+    };
+
+    /* Older kernels reject replies longer than what they know */
+    return in->minor < 23 ? FUSE_COMPAT_22_INIT_OUT_SIZE : sizeof(*out);
+}
+
+/**
+ * Let clients get file attributes (i.e., stat() the file).
+ */
+static ssize_t coroutine_fn fuse_co_getattr(FuseExport *exp,
+                                            struct fuse_attr_out *out,
+                                            uint64_t inode)
+{
+    int64_t length, allocated_blocks;
+    time_t now = time(NULL);
+
+    length = blk_co_getlength(exp->common.blk);
+    if (length < 0) {
+        return length;
+    }
+
+    WITH_GRAPH_RDLOCK_GUARD() {
+        allocated_blocks =
+            bdrv_co_get_allocated_file_size(blk_bs(exp->common.blk));
+    }
+    if (allocated_blocks <= 0) {
+        allocated_blocks = DIV_ROUND_UP(length, 512);
+    } else {
+        allocated_blocks = DIV_ROUND_UP(allocated_blocks, 512);
+    }
+
+    *out = (struct fuse_attr_out) {
+        .attr_valid = 1,
+        .attr = {
+            .ino     = inode,
+            .mode    = exp->st_mode,
+            .nlink   = 1,
+            .uid     = exp->st_uid,
+            .gid     = exp->st_gid,
+            .size    = length,
+            .blksize = blk_bs(exp->common.blk)->bl.request_alignment,
+            .blocks  = allocated_blocks,
+            .atime   = now,
+            .mtime   = now,
+            .ctime   = now,
+        },
+    };
+
+    return sizeof(*out);
+}
+
+/**
+ * Resize the image to @size, or, with @grow_only, make sure it is at
+ * least that long.  Requests run concurrently, so the length must only
+ * be checked under the lock: it could have been grown past @size by
+ * another request in the meantime.
+ */
+static int coroutine_fn fuse_co_do_truncate(FuseExport *exp, int64_t size,
+                                            bool grow_only,
+                                            bool req_zero_write,
+                                            PreallocMode prealloc)
+{
+    BdrvRequestFlags truncate_flags = 0;
+    int64_t length;
+
+    /* Writable exports have the RESIZE permission, see fuse_export_create() */
+    assert(exp->writable);
+
+    if (req_zero_write) {
+        truncate_flags |= BDRV_REQ_ZERO_WRITE;
+    }
+
+    QEMU_LOCK_GUARD(&exp->resize_lock);
+
+    if (grow_only) {
+        length = blk_co_getlength(exp->common.blk);
+        if (length < 0) {
+            return length;
+        }
+        if (length >= size) {
+            return 0;
+        }
+    }
+
+    return blk_co_truncate(exp->common.blk, size, true, prealloc,
+                           truncate_flags, NULL);
+}
+
+/**
+ * Let clients set file attributes.  Only resizing and changing
+ * permissions (st_mode, st_uid, st_gid) is allowed.
+ * Changing permissions is only allowed as far as it will actually
+ * permit access: Read-only exports cannot be given +w, and exports
+ * without allow_other cannot be given a different UID or GID, and
+ * they cannot be given non-owner access.
+ */
+static ssize_t coroutine_fn fuse_co_setattr(FuseExport *exp,
+                                            struct fuse_attr_out *out,
+                                            uint64_t inode,
+                                            const struct fuse_setattr_in *in)
+{
+    /* File handle and lock owner only tell who is asking, ignore them */
+    uint32_t to_set = in->valid & ~(FATTR_FH | FATTR_LOCKOWNER);
+    uint32_t supported_attrs;
+    int ret;
+
+    supported_attrs = FATTR_SIZE | FATTR_MODE;
+    if (exp->allow_other) {
+        supported_attrs |= FATTR_UID | FATTR_GID;
+    }
+
+    if (to_set & ~supported_attrs) {
+        return -ENOTSUP;
+    }
+
+    /* Do some argument checks first before committing to anything */
+    if (to_set & FATTR_MODE) {
+        /*
+         * Without allow_other, non-owners can never access the export, so do
+         * not allow setting permissions for them
+         */
+        if (!exp->allow_other && (in->mode & (S_IRWXG | S_IRWXO)) != 0) {
+            return -EPERM;
+        }
+
+        /* +w for read-only exports makes no sense, disallow it */
+        if (!exp->writable &&
+            (in->mode & (S_IWUSR | S_IWGRP | S_IWOTH)) != 0)
+        {
+            return -EROFS;
+        }
+    }
+
+    if (to_set & FATTR_SIZE) {
+        if (!exp->writable) {
+            return -EACCES;
+        }
+
+        ret = fuse_co_do_truncate(exp, in->size, false, true,
+                                  PREALLOC_MODE_OFF);
+        if (ret < 0) {
+            return ret;
+        }
+    }
+
+    if (to_set & FATTR_MODE) {
+        /* Ignore FUSE-supplied file type, only change the mode */
+        exp->st_mode = (in->mode & 07777) | S_IFREG;
+    }
+
+    if (to_set & FATTR_UID) {
+        exp->st_uid = in->uid;
+    }
+
+    if (to_set & FATTR_GID) {
+        exp->st_gid = in->gid;
+    }
+
+    return fuse_co_getattr(exp, out, inode);
+}
+
+/**
+ * Let clients open a file (i.e., the exported image).
+ */
+static ssize_t coroutine_fn fuse_co_open(FuseExport *exp,
+                                         struct fuse_open_out *out)
+{
+    *out = (struct fuse_open_out) {
+#ifdef FOPEN_PARALLEL_DIRECT_WRITES
+        /* Requests are independent, do not serialize them in the kernel */
+        .open_flags = FOPEN_PARALLEL_DIRECT_WRITES,
+#endif
+    };
+    return sizeof(*out);
+}
+
+/**
+ * Handle client reads from the exported image.  On success, @bufptr
+ * is set to a buffer holding the data, which the caller frees.
+ */
+static ssize_t coroutine_fn fuse_co_read(FuseExport *exp, void **bufptr,
+                                         uint64_t offset, uint32_t size)
+{
+    int64_t length;
+    void *buf;
+    int ret;
+
+    /* Limited by max_read, should not happen */
+    if (size > FUSE_MAX_BOUNCE_BYTES) {
+        return -EINVAL;
+    }
+
+    /**
+     * Clients will expect short reads at EOF, so we have to limit
+     * offset+size to the image length.
+     */
+    length = blk_co_getlength(exp->common.blk);
+    if (length < 0) {
+        return length;
+    }
+
+    if (offset >= length) {
+        return 0;
+    }
+    if (offset + size > length) {
+        size = length - offset;
+    }
+
+    buf = qemu_try_blockalign(blk_bs(exp->common.blk), size);
+    if (!buf) {
+        return -ENOMEM;
+    }
+
+    ret = blk_co_pread(exp->common.blk, offset, size, buf, 0);
+    if (ret < 0) {
+        qemu_vfree(buf);
+        return ret;
+    }
+
+    *bufptr = buf;
+    return size;
+}
+
+/**
+ * Handle client writes to the exported image.  @buf is the spillover
+ * buffer the data was read into.
+ */
+static ssize_t coroutine_fn fuse_co_write(FuseExport *exp,
+                                          struct fuse_write_out *out,
+                                          uint64_t offset, uint32_t size,
+                                          const void *buf)
+{
+    int64_t length;
+    int ret;
+
+    /* Limited by max_write, should not happen */
+    if (size > FUSE_MAX_WRITE_BYTES) {
+        return -EINVAL;
+    }
+
+    if (!exp->writable) {
+        return -EACCES;
+    }
+
+    /**
+     * Clients will expect short writes at EOF, so we have to limit
+     * offset+size to the image length.
+     */
+    length = blk_co_getlength(exp->common.blk);
+    if (length < 0) {
+        return length;
+    }
+
+    if (offset + size > length) {
+        if (exp->growable) {
+            ret = fuse_co_do_truncate(exp, offset + size, true, true,
+                                      PREALLOC_MODE_OFF);
+            if (ret < 0) {
+                return ret;
+            }
+        } else {
+            size = offset < length ? length - offset : 0;
+        }
+    }
+
+    ret = blk_co_pwrite(exp->common.blk, offset, size, buf, 0);
+    if (ret < 0) {
+        return ret;
+    }
+
+    *out = (struct fuse_write_out) {
+        .size = size,
+    };
+    return sizeof(*out);
+}
+
+/**
+ * Let clients perform various fallocate() operations.
+ */
+static ssize_t coroutine_fn
+fuse_co_fallocate(FuseExport *exp, const struct fuse_fallocate_in *in)
+{
+    uint32_t mode = in->mode;
+    int64_t offset = in->offset;
+    int64_t length = in->length;
+    int64_t blk_len;
+    int ret;
+
+    if (!exp->writable) {
+        return -EACCES;
+    }
+
+    blk_len = blk_co_getlength(exp->common.blk);
+    if (blk_len < 0) {
+        return blk_len;
+    }
+
+#ifdef CONFIG_FALLOCATE_PUNCH_HOLE
+    if (mode & FALLOC_FL_KEEP_SIZE) {
+        length = MIN(length, blk_len - offset);
+    }
+#endif /* CONFIG_FALLOCATE_PUNCH_HOLE */
+
+    if (!mode) {
+        /* We can only fallocate at the EOF with a truncate */
+        if (offset < blk_len) {
+            return -EOPNOTSUPP;
+        }
+
+        if (offset > blk_len) {
+            /* No preallocation needed here */
+            ret = fuse_co_do_truncate(exp, offset, true, true,
+                                      PREALLOC_MODE_OFF);
+            if (ret < 0) {
+                return ret;
+            }
+        }
+
+        ret = fuse_co_do_truncate(exp, offset + length, true, true,
+                                  PREALLOC_MODE_FALLOC);
+    }
+#ifdef CONFIG_FALLOCATE_PUNCH_HOLE
+    else if (mode & FALLOC_FL_PUNCH_HOLE) {
+        if (!(mode & FALLOC_FL_KEEP_SIZE)) {
+            return -EINVAL;
+        }
+
+        do {
+            int size = MIN(length, BDRV_REQUEST_MAX_BYTES);
+
+            ret = blk_co_pwrite_zeroes(exp->common.blk, offset, size,
+                                       BDRV_REQ_MAY_UNMAP |
+                                       BDRV_REQ_NO_FALLBACK);
+            if (ret == -ENOTSUP) {
+                /*
+                 * fallocate() specifies to return EOPNOTSUPP for unsupported
+                 * operations
+                 */
+                ret = -EOPNOTSUPP;
+            }
+
+            offset += size;
+            length -= size;
+        } while (ret == 0 && length > 0);
+    }
+#endif /* CONFIG_FALLOCATE_PUNCH_HOLE */
+#ifdef CONFIG_FALLOCATE_ZERO_RANGE
+    else if (mode & FALLOC_FL_ZERO_RANGE) {
+        if (!(mode & FALLOC_FL_KEEP_SIZE) && offset + length > blk_len) {
+            /* No need for zeroes, we are going to write them ourselves */
+            ret = fuse_co_do_truncate(exp, offset + length, true, false,
+                                      PREALLOC_MODE_OFF);
+            if (ret < 0) {
+                return ret;
+            }
+        }
+
+        do {
+            int size = MIN(length, BDRV_REQUEST_MAX_BYTES);
+
+            ret = blk_co_pwrite_zeroes(exp->common.blk,
+                                       offset, size, 0);
+            offset += size;
+            length -= size;
+        } while (ret == 0 && length > 0);
+    }
+#endif /* CONFIG_FALLOCATE_ZERO_RANGE */
+    else {
+        ret = -EOPNOTSUPP;
+    }
+
+    return ret < 0 ? ret : 0;
+}
+
+/**
+ * Let clients fsync the exported image.  Also used for FLUSH, which is
+ * sent before an FD to the exported image is closed, as a way to return
+ * last-minute errors.
+ */
+static ssize_t coroutine_fn fuse_co_fsync(FuseExport *exp)
+{
+    return blk_co_flush(exp->common.blk);
+}
+
+/**
+ * Report the same file system statistics as libfuse does by default.
+ */
+static ssize_t coroutine_fn fuse_co_statfs(FuseExport *exp,
+                                           struct fuse_statfs_out *out)
+{
+    *out = (struct fuse_statfs_out) {
+        .st = {
+            .bsize = 512,
+            .namelen = 255,
+        },
+    };
+    return sizeof(*out);
+}
+
+#ifdef CONFIG_FUSE_LSEEK
+/**
+ * Let clients inquire allocation status.
+ */
+static ssize_t coroutine_fn fuse_co_lseek(FuseExport *exp,
+                                          struct fuse_lseek_out *out,
+                                          uint64_t offset, uint32_t whence)
+{
+    if (whence != SEEK_HOLE && whence != SEEK_DATA) {
+        return -EINVAL;
+    }
+
+    while (true) {
+        int64_t pnum;
+        int ret;
+
+        WITH_GRAPH_RDLOCK_GUARD() {
+            ret = bdrv_co_block_status_above(blk_bs(exp->common.blk), NULL,
+                                             offset, INT64_MAX, &pnum,
+                                             NULL, NULL);
+        }
+        if (ret < 0) {
+            return ret;
+        }
+
+        if (!pnum && (ret & BDRV_BLOCK_EOF)) {
+            int64_t blk_len;
+
+            /*
+             * If blk_getlength() rounds (e.g. by sectors), then the
+             * export length will be rounded, too.  However,
+             * bdrv_block_status_above() may return EOF at unaligned
+             * offsets.  We must not let this become visible and thus
+             * always simulate a hole between @offset (the real EOF)
+             * and @blk_len (the client-visible EOF).
+             */
+
+            blk_len = blk_co_getlength(exp->common.blk);
+            if (blk_len < 0) {
+                return blk_len;
+            }
+
+            if (offset > blk_len || whence == SEEK_DATA) {
+                return -ENXIO;
+            }
+            break;
+        }
+
+        if (ret & BDRV_BLOCK_DATA) {
+            if (whence == SEEK_DATA) {
+                break;
+            }
+        } else {
+            if (whence == SEEK_HOLE) {
+                break;
+            }
+        }
+
+        /* Safety check against infinite loops */
+        if (!pnum) {
+            return -ENXIO;
+        }
+
+        offset += pnum;
+    }
+
+    *out = (struct fuse_lseek_out) {
+        .offset = offset,
+    };
+    return sizeof(*out);
+}
+#endif
+
+/**
+ * Send the reply to a request: @ret is a negative errno, or the length
+ * of @out, which @data_len bytes of @data follow.
+ */
+static void fuse_write_reply(FuseQueue *q, uint64_t unique, ssize_t ret,
+                             const void *out, const void *data,
+                             size_t data_len)
+{
+    struct fuse_out_header out_hdr = {
+        .error = ret < 0 ? ret : 0,
+        .unique = unique,
+    };
+    struct iovec iov[3] = {
+        { &out_hdr, sizeof(out_hdr) },
+    };
+    int iovcnt = 1;
+    ssize_t len;
+
+    if (ret > 0) {
+        iov[iovcnt++] = (struct iovec) { (void *)out, ret };
+    }
+    if (ret >= 0 && data_len) {
+        iov[iovcnt++] = (struct iovec) { (void *)data, data_len };
+    }
+    out_hdr.len = iov_size(iov, iovcnt);
+
+    do {
+        len = writev(q->fuse_fd, iov, iovcnt);
+    } while (len < 0 && errno == EINTR);
+
+    /* ENOENT means the request was interrupted, nobody waits for it */
+    if (len < 0 && errno != ENOENT) {
+        error_report("FUSE export: failed to send reply: %s",
+                     strerror(errno));
+    }
+}
+
+/**
+ * Process the request that was just read into the buffers of the queue
+ * passed as @opaque.
+ */
+static void coroutine_fn fuse_co_process_request(void *opaque)
+{
+    FuseQueue *q = opaque;
+    FuseExport *exp = q->exp;
+    struct fuse_in_header in_hdr;
+    union {
+        struct fuse_init_in init;
+        struct fuse_setattr_in setattr;
+        struct fuse_read_in read;
+        struct fuse_write_in write;
+        struct fuse_fallocate_in fallocate;
+        struct fuse_lseek_in lseek;
+    } in = { };
+    union {
+        struct fuse_init_out init;
+        struct fuse_attr_out attr;
+        struct fuse_open_out open;
+        struct fuse_write_out write;
+        struct fuse_statfs_out statfs;
+        struct fuse_lseek_out lseek;
+    } out;
+    size_t args_len, in_place_len;
+    void *spillover_buf = NULL;
+    void *data = NULL;
+    size_t data_len = 0;
+    ssize_t ret;
+
+    /*
+     * Take everything from the queue before the first yield, it reads
+     * the next request into the same buffers.  The arguments continue
+     * into the spillover buffer if they do not fit.
+     */
+    memcpy(&in_hdr, q->request_buf, sizeof(in_hdr));
+    args_len = q->request_len - sizeof(in_hdr);
+    in_place_len = MIN(args_len, sizeof(q->request_buf) - sizeof(in_hdr));
+    memcpy(&in, q->request_buf + sizeof(in_hdr), in_place_len);
+    if (args_len > in_place_len) {
+        memcpy((char *)&in + in_place_len, q->spillover_buf,
+               MIN(args_len, sizeof(in)) - in_place_len);
+    }
+    if (in_hdr.opcode == FUSE_WRITE) {
+        spillover_buf = q->spillover_buf;
+        q->spillover_buf = NULL;
+    }
+
+    switch (in_hdr.opcode) {
+    case FUSE_INIT:
+        ret = fuse_co_init(exp, &out.init, &in.init);
+        break;
+
+    case FUSE_DESTROY:
+    case FUSE_RELEASE:
+        ret = 0;
+        break;
+
+    case FUSE_LOOKUP:
+        /* We only care about the mountpoint itself */
+        ret = -ENOENT;
+        break;
+
+    case FUSE_GETATTR:
+        ret = fuse_co_getattr(exp, &out.attr, in_hdr.nodeid);
+        break;
+
+    case FUSE_SETATTR:
+        ret = fuse_co_setattr(exp, &out.attr, in_hdr.nodeid, &in.setattr);
+        break;
+
+    case FUSE_OPEN:
+        ret = fuse_co_open(exp, &out.open);
+        break;
+
+    case FUSE_READ:
+        ret = fuse_co_read(exp, &data, in.read.offset, in.read.size);
+        if (ret >= 0) {
+            data_len = ret;
+            ret = 0;
+        }
+        break;
+
+    case FUSE_WRITE:
+        if (args_len != sizeof(in.write) + in.write.size) {
+            ret = -EINVAL;
+            break;
+        }
+        ret = fuse_co_write(exp, &out.write, in.write.offset, in.write.size,
+                            spillover_buf);
+        break;
+
+    case FUSE_FALLOCATE:
+        ret = fuse_co_fallocate(exp, &in.fallocate);
+        break;
+
+    case FUSE_FLUSH:
+    case FUSE_FSYNC:
+        ret = fuse_co_fsync(exp);
+        break;
+
+    case FUSE_STATFS:
+        ret = fuse_co_statfs(exp, &out.statfs);
+        break;
+
+#ifdef CONFIG_FUSE_LSEEK
+    case FUSE_LSEEK:
+        ret = fuse_co_lseek(exp, &out.lseek, in.lseek.offset,
+                            in.lseek.whence);
+        break;
+#endif
+
+    case FUSE_FORGET:
+    case FUSE_BATCH_FORGET:
+    case FUSE_INTERRUPT:
+        /* No reply */
+        goto out;
+
+    default:
+        ret = -ENOSYS;
+        break;
+    }
+
+    fuse_write_reply(q, in_hdr.unique, ret, &out, data, data_len);
+
+out:
+    qemu_vfree(data);
+    qemu_vfree(spillover_buf);
+
+    if (qatomic_fetch_dec(&exp->in_flight) == 1) {
+        aio_wait_kick(); /* wake AIO_WAIT_WHILE() */
+    }
+
+    blk_exp_unref(&exp->common);
+}
+
+/* Requests are not dispatched by libfuse, the session is only mounted */
+static const struct fuse_lowlevel_ops fuse_ops = {
+};
+#else
 /**
  * A chance to set change some parameters supplied to FUSE_INIT.
  */
@@ -881,6 +1838,7 @@ static const struct fuse_lowlevel_ops fuse_ops = {
     .lseek      = fuse_lseek,
 #endif
 };
+#endif
 
 const BlockExportDriver blk_exp_fuse = {
     .type               = BLOCK_EXPORT_TYPE_FUSE,
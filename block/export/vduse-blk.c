@@ -13,7 +13,10 @@
 #include "qemu/osdep.h"
 #include <sys/eventfd.h>
 
+#include "hw/virtio/iothread-vq-mapping.h"
+#include "qapi/clone-visitor.h"
 #include "qapi/error.h"
+#include "qapi/qapi-visit-block-export.h"
 #include "block/export.h"
 #include "qemu/error-report.h"
 #include "util/block-helpers.h"
@@ -33,13 +36,56 @@ typedef struct VduseBlkExport {
     char *recon_file;
     unsigned int inflight; /* atomic */
     bool vqs_started;
+
+    /*
+     * AioContext of each virtqueue from iothread-vq-mapping, or NULL if the
+     * virtqueues are processed in export.ctx.  The virtqueues are then
+     * used by several threads, and vq_locks keep vduse_dev_handler() from
+     * changing a virtqueue while it is in use.
+     */
+    IOThreadVirtQueueMappingList *iothread_vq_mapping_list;
+    AioContext **vq_ctx;
+    QemuRecMutex *vq_locks;
 } VduseBlkExport;
 
 typedef struct VduseBlkReq {
     VduseVirtqElement elem;
     VduseVirtq *vq;
+    int vq_index;
 } VduseBlkReq;
 
+static int vduse_blk_vq_index(VduseBlkExport *vblk_exp, VduseVirtq *vq)
+{
+    for (int i = 0; i < vblk_exp->num_queues; i++) {
+        if (vduse_dev_get_queue(vblk_exp->dev, i) == vq) {
+            return i;
+        }
+    }
+    g_assert_not_reached();
+}
+
+static AioContext *vduse_blk_vq_ctx(VduseBlkExport *vblk_exp, int index)
+{
+    if (vblk_exp->vq_ctx) {
+        return vblk_exp->vq_ctx[index];
+    }
+    return vblk_exp->export.ctx;
+}
+
+static void vduse_blk_vq_lock(VduseBlkExport *vblk_exp, int index)
+{
+    if (vblk_exp->vq_locks) {
+        qemu_rec_mutex_lock(&vblk_exp->vq_locks[index]);
+    }
+}
+
+static void vduse_blk_vq_unlock(VduseBlkExport *vblk_exp, int index)
+{
+    if (vblk_exp->vq_locks) {
+        qemu_rec_mutex_unlock(&vblk_exp->vq_locks[index]);
+    }
+}
+
 static void vduse_blk_inflight_inc(VduseBlkExport *vblk_exp)
 {
     if (qatomic_fetch_inc(&vblk_exp->inflight) == 0) {
@@ -59,10 +105,13 @@ static void vduse_blk_inflight_dec(VduseBlkExport *vblk_exp)
     }
 }
 
-static void vduse_blk_req_complete(VduseBlkReq *req, size_t in_len)
+static void vduse_blk_req_complete(VduseBlkExport *vblk_exp, VduseBlkReq *req,
+                                   size_t in_len)
 {
+    vduse_blk_vq_lock(vblk_exp, req->vq_index);
     vduse_queue_push(req->vq, &req->elem, in_len);
     vduse_queue_notify(req->vq);
+    vduse_blk_vq_unlock(vblk_exp, req->vq_index);
 
     free(req);
 }
@@ -88,11 +137,12 @@ static void coroutine_fn vduse_blk_virtio_process_req(void *opaque)
         return;
     }
 
-    vduse_blk_req_complete(req, in_len);
+    vduse_blk_req_complete(vblk_exp, req, in_len);
     vduse_blk_inflight_dec(vblk_exp);
 }
 
-static void vduse_blk_vq_handler(VduseDev *dev, VduseVirtq *vq)
+/* Called with the lock of the virtqueue held */
+static void vduse_blk_vq_handler(VduseDev *dev, VduseVirtq *vq, int index)
 {
     VduseBlkExport *vblk_exp = vduse_dev_get_priv(dev);
 
@@ -104,6 +154,7 @@ static void vduse_blk_vq_handler(VduseDev *dev, VduseVirtq *vq)
             break;
         }
         req->vq = vq;
+        req->vq_index = index;
 
         Coroutine *co =
             qemu_coroutine_create(vduse_blk_virtio_process_req, req);
@@ -117,26 +168,40 @@ static void on_vduse_vq_kick(void *opaque)
 {
     VduseVirtq *vq = opaque;
     VduseDev *dev = vduse_queue_get_dev(vq);
-    int fd = vduse_queue_get_fd(vq);
+    VduseBlkExport *vblk_exp = vduse_dev_get_priv(dev);
+    int index = vduse_blk_vq_index(vblk_exp, vq);
     eventfd_t kick_data;
+    int fd;
+
+    vduse_blk_vq_lock(vblk_exp, index);
+
+    /* With IOThreads, the queue may have been disabled in the meantime */
+    fd = vduse_queue_get_fd(vq);
+    if (fd < 0) {
+        goto out;
+    }
 
     if (eventfd_read(fd, &kick_data) == -1) {
         error_report("failed to read data from eventfd");
-        return;
+        goto out;
     }
 
-    vduse_blk_vq_handler(dev, vq);
+    vduse_blk_vq_handler(dev, vq, index);
+out:
+    vduse_blk_vq_unlock(vblk_exp, index);
 }
 
 static void vduse_blk_enable_queue(VduseDev *dev, VduseVirtq *vq)
 {
     VduseBlkExport *vblk_exp = vduse_dev_get_priv(dev);
+    int index = vduse_blk_vq_index(vblk_exp, vq);
 
     if (!vblk_exp->vqs_started) {
         return; /* vduse_blk_drained_end() will start vqs later */
     }
 
-    aio_set_fd_handler(vblk_exp->export.ctx, vduse_queue_get_fd(vq),
+    aio_set_fd_handler(vduse_blk_vq_ctx(vblk_exp, index),
+                       vduse_queue_get_fd(vq),
                        on_vduse_vq_kick, NULL, NULL, NULL, vq);
     /* Make sure we don't miss any kick after reconnecting */
     eventfd_write(vduse_queue_get_fd(vq), 1);
@@ -145,13 +210,14 @@ static void vduse_blk_enable_queue(VduseDev *dev, VduseVirtq *vq)
 static void vduse_blk_disable_queue(VduseDev *dev, VduseVirtq *vq)
 {
     VduseBlkExport *vblk_exp = vduse_dev_get_priv(dev);
+    int index = vduse_blk_vq_index(vblk_exp, vq);
     int fd = vduse_queue_get_fd(vq);
 
     if (fd < 0) {
         return;
     }
 
-    aio_set_fd_handler(vblk_exp->export.ctx, fd,
+    aio_set_fd_handler(vduse_blk_vq_ctx(vblk_exp, index), fd,
                        NULL, NULL, NULL, NULL, NULL);
 }
 
@@ -163,8 +229,18 @@ static const VduseOps vduse_blk_ops = {
 static void on_vduse_dev_kick(void *opaque)
 {
     VduseDev *dev = opaque;
+    VduseBlkExport *vblk_exp = vduse_dev_get_priv(dev);
+    int i;
+
+    for (i = 0; i < vblk_exp->num_queues; i++) {
+        vduse_blk_vq_lock(vblk_exp, i);
+    }
 
     vduse_dev_handler(dev);
+
+    for (i = vblk_exp->num_queues - 1; i >= 0; i--) {
+        vduse_blk_vq_unlock(vblk_exp, i);
+    }
 }
 
 static void vduse_blk_attach_ctx(VduseBlkExport *vblk_exp, AioContext *ctx)
@@ -265,6 +341,25 @@ static const BlockDevOps vduse_block_ops = {
     .drained_poll  = vduse_blk_drained_poll,
 };
 
+static void vduse_blk_free_vq_iothreads(VduseBlkExport *vblk_exp)
+{
+    if (vblk_exp->vq_locks) {
+        for (int i = 0; i < vblk_exp->num_queues; i++) {
+            qemu_rec_mutex_destroy(&vblk_exp->vq_locks[i]);
+        }
+        g_free(vblk_exp->vq_locks);
+        vblk_exp->vq_locks = NULL;
+    }
+    g_free(vblk_exp->vq_ctx);
+    vblk_exp->vq_ctx = NULL;
+    if (vblk_exp->iothread_vq_mapping_list) {
+        iothread_vq_mapping_cleanup(vblk_exp->iothread_vq_mapping_list);
+        qapi_free_IOThreadVirtQueueMappingList(
+            vblk_exp->iothread_vq_mapping_list);
+        vblk_exp->iothread_vq_mapping_list = NULL;
+    }
+}
+
 static int vduse_blk_exp_create(BlockExport *exp, BlockExportOptions *opts,
                                 Error **errp)
 {
@@ -304,6 +399,24 @@ static int vduse_blk_exp_create(BlockExport *exp, BlockExportOptions *opts,
             return -EINVAL;
         }
     }
+    if (vblk_opts->iothread_vq_mapping) {
+        vblk_exp->vq_ctx = g_new(AioContext *, num_queues);
+        if (!iothread_vq_mapping_apply(vblk_opts->iothread_vq_mapping,
+                                       vblk_exp->vq_ctx, num_queues, errp)) {
+            g_free(vblk_exp->vq_ctx);
+            vblk_exp->vq_ctx = NULL;
+            return -EINVAL;
+        }
+        /* Kept for iothread_vq_mapping_cleanup() */
+        vblk_exp->iothread_vq_mapping_list =
+            QAPI_CLONE(IOThreadVirtQueueMappingList,
+                       vblk_opts->iothread_vq_mapping);
+        vblk_exp->vq_locks = g_new(QemuRecMutex, num_queues);
+        for (i = 0; i < num_queues; i++) {
+            qemu_rec_mutex_init(&vblk_exp->vq_locks[i]);
+        }
+    }
+
     vblk_exp->num_queues = num_queues;
     vblk_exp->handler.blk = exp->blk;
     vblk_exp->handler.serial = g_strdup(vblk_opts->serial ?: "");
@@ -384,6 +497,7 @@ err:
     g_free(vblk_exp->recon_file);
 err_dev:
     g_free(vblk_exp->handler.serial);
+    vduse_blk_free_vq_iothreads(vblk_exp);
     return ret;
 }
 
@@ -403,6 +517,7 @@ static void vduse_blk_exp_delete(BlockExport *exp)
     }
     g_free(vblk_exp->recon_file);
     g_free(vblk_exp->handler.serial);
+    vduse_blk_free_vq_iothreads(vblk_exp);
 }
 
 /* Called with exp->ctx acquired */
@@ -16,7 +16,10 @@
 #include "standard-headers/linux/virtio_blk.h"
 #include "qemu/vhost-user-server.h"
 #include "vhost-user-blk-server.h"
+#include "hw/virtio/iothread-vq-mapping.h"
+#include "qapi/clone-visitor.h"
 #include "qapi/error.h"
+#include "qapi/qapi-visit-block-export.h"
 #include "qom/object_interfaces.h"
 #include "util/block-helpers.h"
 #include "virtio-blk-handler.h"
@@ -29,6 +32,7 @@ typedef struct VuBlkReq {
     VuVirtqElement elem;
     VuServer *server;
     struct VuVirtq *vq;
+    int vq_idx;
 } VuBlkReq;
 
 /* vhost user block device */
@@ -38,14 +42,22 @@ typedef struct {
     VirtioBlkHandler handler;
     QIOChannelSocket *sioc;
     struct virtio_blk_config blkcfg;
+    uint16_t num_queues;
+
+    /* From iothread-vq-mapping, NULL if the virtqueues use export.ctx */
+    IOThreadVirtQueueMappingList *iothread_vq_mapping_list;
+    AioContext **vq_ctx;
 } VuBlkExport;
 
 static void vu_blk_req_complete(VuBlkReq *req, size_t in_len)
 {
-    VuDev *vu_dev = &req->server->vu_dev;
+    VuServer *server = req->server;
+    VuDev *vu_dev = &server->vu_dev;
 
+    vhost_user_server_lock_vq(server, req->vq_idx);
     vu_queue_push(vu_dev, req->vq, &req->elem, in_len);
     vu_queue_notify(vu_dev, req->vq);
+    vhost_user_server_unlock_vq(server, req->vq_idx);
 
     free(req);
 }
@@ -94,6 +106,7 @@ static void vu_blk_process_vq(VuDev *vu_dev, int idx)
 
         req->server = server;
         req->vq = vq;
+        req->vq_idx = idx;
 
         Coroutine *co =
             qemu_coroutine_create(vu_blk_virtio_process_req, req);
@@ -314,6 +327,17 @@ static const BlockDevOps vu_blk_dev_ops = {
     .resize_cb = vu_blk_exp_resize,
 };
 
+static void vu_blk_free_vq_iothreads(VuBlkExport *vexp)
+{
+    g_free(vexp->vq_ctx);
+    vexp->vq_ctx = NULL;
+    if (vexp->iothread_vq_mapping_list) {
+        iothread_vq_mapping_cleanup(vexp->iothread_vq_mapping_list);
+        qapi_free_IOThreadVirtQueueMappingList(vexp->iothread_vq_mapping_list);
+        vexp->iothread_vq_mapping_list = NULL;
+    }
+}
+
 static int vu_blk_exp_create(BlockExport *exp, BlockExportOptions *opts,
                              Error **errp)
 {
@@ -344,6 +368,22 @@ static int vu_blk_exp_create(BlockExport *exp, BlockExportOptions *opts,
         error_setg(errp, "num-queues must be greater than 0");
         return -EINVAL;
     }
+    vexp->num_queues = num_queues;
+
+    if (vu_opts->iothread_vq_mapping) {
+        vexp->vq_ctx = g_new(AioContext *, num_queues);
+        if (!iothread_vq_mapping_apply(vu_opts->iothread_vq_mapping,
+                                       vexp->vq_ctx, num_queues, errp)) {
+            g_free(vexp->vq_ctx);
+            vexp->vq_ctx = NULL;
+            return -EINVAL;
+        }
+        /* Kept for iothread_vq_mapping_cleanup() */
+        vexp->iothread_vq_mapping_list =
+            QAPI_CLONE(IOThreadVirtQueueMappingList,
+                       vu_opts->iothread_vq_mapping);
+    }
+
     vexp->handler.blk = exp->blk;
     vexp->handler.serial = g_strdup("vhost_user_blk");
     vexp->handler.logical_block_size = logical_block_size;
@@ -362,9 +402,14 @@ static int vu_blk_exp_create(BlockExport *exp, BlockExportOptions *opts,
         blk_remove_aio_context_notifier(exp->blk, blk_aio_attached,
                                         blk_aio_detach, vexp);
         g_free(vexp->handler.serial);
+        vu_blk_free_vq_iothreads(vexp);
         return -EADDRNOTAVAIL;
     }
 
+    if (vexp->vq_ctx) {
+        vhost_user_server_set_vq_aio_contexts(&vexp->vu_server, vexp->vq_ctx);
+    }
+
     return 0;
 }
 
@@ -375,6 +420,7 @@ static void vu_blk_exp_delete(BlockExport *exp)
     blk_remove_aio_context_notifier(exp->blk, blk_aio_attached, blk_aio_detach,
                                     vexp);
     g_free(vexp->handler.serial);
+    vu_blk_free_vq_iothreads(vexp);
 }
 
 const BlockExportDriver blk_exp_vhost_user_blk = {
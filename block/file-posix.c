@@ -77,6 +77,11 @@
 #include <linux/hdreg.h>
 #include <linux/magic.h>
 #include <scsi/sg.h>
+#ifdef CONFIG_LINUX_IO_URING_CMD
+#include <linux/nvme_ioctl.h>
+#include "qemu/bswap.h"
+#include "block/nvme.h"
+#endif
 #ifdef __s390__
 #include <asm/dasd.h>
 #endif
@@ -134,6 +139,21 @@
 #define RAW_LOCK_PERM_BASE             100
 #define RAW_LOCK_SHARED_BASE           200
 
+#if defined(__linux__)
+typedef struct RawSgAsyncRequest {
+    Coroutine *co;
+    struct sg_io_hdr *io_hdr;
+    int ret;
+    QLIST_ENTRY(RawSgAsyncRequest) next;
+} RawSgAsyncRequest;
+
+/*
+ * The sg driver has SG_MAX_QUEUE slots per file descriptor, leave some of
+ * them to the synchronous SG_IO of the thread pool and the pr-manager.
+ */
+#define RAW_SG_ASYNC_MAX_INFLIGHT (SG_MAX_QUEUE / 2)
+#endif
+
 typedef struct BDRVRawState {
     int fd;
     bool use_lock;
@@ -160,6 +180,26 @@ typedef struct BDRVRawState {
     bool has_write_zeroes:1;
     bool use_linux_aio:1;
     bool use_linux_io_uring:1;
+    bool use_fixed_buffers:1;
+    bool use_iopoll:1;
+#ifdef CONFIG_LINUX_IO_URING_CMD
+    /* NVMe generic character device, driven with passthrough commands */
+    bool use_nvme_cmd:1;
+    bool nvme_supports_write_zeroes:1;
+    bool nvme_supports_discard:1;
+    bool nvme_supports_deallocate:1;
+    uint32_t nvme_nsid;
+    int nvme_blkshift;
+    uint64_t nvme_nsze;
+    uint32_t nvme_max_transfer;
+#endif
+#if defined(__linux__)
+    /* SCSI generic device, SG_IO is submitted with write() and read() */
+    bool use_sg_async:1;
+    unsigned int sg_async_inflight;
+    AioContext *sg_async_ctx;
+    QLIST_HEAD(, RawSgAsyncRequest) sg_async_reqs;
+#endif
     int page_cache_inconsistent; /* errno from fdatasync failure */
     bool has_fallocate;
     bool needs_alignment;
@@ -560,6 +600,18 @@ static QemuOptsList raw_runtime_opts = {
             .type = QEMU_OPT_NUMBER,
             .help = "AIO max batch size (0 = auto handled by AIO backend, default: 0)",
         },
+        {
+            .name = "aio-fixed-buffers",
+            .type = QEMU_OPT_BOOL,
+            .help = "register guest RAM with the io_uring AIO backend "
+                    "(default: off)",
+        },
+        {
+            .name = "aio-iopoll",
+            .type = QEMU_OPT_BOOL,
+            .help = "poll for the completion of io_uring reads and writes "
+                    "(default: off)",
+        },
         {
             .name = "locking",
             .type = QEMU_OPT_STRING,
@@ -640,6 +692,8 @@ static int raw_open_common(BlockDriverState *bs, QDict *options,
 #endif
 
     s->aio_max_batch = qemu_opt_get_number(opts, "aio-max-batch", 0);
+    s->use_fixed_buffers = qemu_opt_get_bool(opts, "aio-fixed-buffers", false);
+    s->use_iopoll = qemu_opt_get_bool(opts, "aio-iopoll", false);
 
     locking = qapi_enum_parse(&OnOffAuto_lookup,
                               qemu_opt_get(opts, "locking"),
@@ -736,6 +790,20 @@ static int raw_open_common(BlockDriverState *bs, QDict *options,
     }
 #endif /* !defined(CONFIG_LINUX_IO_URING) */
 
+    if (s->use_fixed_buffers && !s->use_linux_io_uring) {
+        error_setg(errp, "aio-fixed-buffers requires aio=io_uring");
+        ret = -EINVAL;
+        goto fail;
+    }
+
+    if (s->use_iopoll &&
+        (!s->use_linux_io_uring || !(s->open_flags & O_DIRECT))) {
+        error_setg(errp, "aio-iopoll requires aio=io_uring and "
+                         "cache.direct=on");
+        ret = -EINVAL;
+        goto fail;
+    }
+
     s->has_discard = true;
     s->has_write_zeroes = true;
 
@@ -1474,11 +1542,54 @@ static void raw_refresh_zoned_limits(BlockDriverState *bs, struct stat *st,
 }
 #endif /* !defined(CONFIG_BLKZONED) */
 
+#ifdef CONFIG_LINUX_IO_URING_CMD
+/*
+ * NVMe generic character devices (/dev/ngXnY) only take passthrough
+ * commands.  Issuing them with io_uring keeps the kernel driver, and
+ * sharing the device with the host, but skips the block layer of the
+ * kernel.
+ */
+
+/* Maximum number of data segments of a command, from Linux nvme-pci */
+#define RAW_NVME_MAX_SEGMENTS 127
+/* Passthrough commands are not split, stay below the driver limits */
+#define RAW_NVME_MAX_TRANSFER (1 * MiB)
+/* NLB fields of read, write and write zeroes commands */
+#define RAW_NVME_MAX_BLOCKS 0x10000
+/* Deallocate bit of the write zeroes command */
+#define RAW_NVME_WRITE_ZEROES_DEAC (1 << 25)
+
+static void raw_nvme_refresh_limits(BlockDriverState *bs)
+{
+    BDRVRawState *s = bs->opaque;
+    uint32_t block_size = 1 << s->nvme_blkshift;
+
+    s->needs_alignment = false;
+    bs->bl.request_alignment = block_size;
+    /* The kernel bounces buffers that the device cannot access */
+    bs->bl.min_mem_alignment = 4;
+    bs->bl.opt_mem_alignment = qemu_real_host_page_size();
+    bs->bl.max_hw_transfer = s->nvme_max_transfer;
+    bs->bl.max_hw_iov = RAW_NVME_MAX_SEGMENTS;
+    bs->bl.max_pwrite_zeroes = RAW_NVME_MAX_BLOCKS * block_size;
+    bs->bl.pwrite_zeroes_alignment = block_size;
+    bs->bl.max_pdiscard = QEMU_ALIGN_DOWN(INT32_MAX, block_size);
+    bs->bl.pdiscard_alignment = block_size;
+}
+#endif
+
 static void raw_refresh_limits(BlockDriverState *bs, Error **errp)
 {
     BDRVRawState *s = bs->opaque;
     struct stat st;
 
+#ifdef CONFIG_LINUX_IO_URING_CMD
+    if (s->use_nvme_cmd) {
+        raw_nvme_refresh_limits(bs);
+        return;
+    }
+#endif
+
     s->needs_alignment = raw_needs_alignment(bs);
     raw_probe_alignment(bs, s->fd, errp);
 
@@ -2448,8 +2559,39 @@ static inline bool raw_check_linux_io_uring(BDRVRawState *s)
         s->use_linux_io_uring = false;
         return false;
     }
+    if (s->use_fixed_buffers) {
+        luring_enable_fixed_bufs(aio_get_linux_io_uring(ctx));
+    }
     return true;
 }
+
+static int coroutine_fn raw_co_iopoll(BlockDriverState *bs, uint64_t offset,
+                                      QEMUIOVector *qiov, int type)
+{
+    BDRVRawState *s = bs->opaque;
+    AioContext *ctx = qemu_get_current_aio_context();
+    Error *local_err = NULL;
+    int ret;
+
+    if (unlikely(!aio_setup_linux_io_uring_iopoll(ctx, &local_err))) {
+        error_reportf_err(local_err, "Unable to poll io_uring completions, "
+                                     "falling back to interrupts: ");
+        s->use_iopoll = false;
+        return luring_co_submit(bs, s->fd, offset, qiov, type);
+    }
+    if (s->use_fixed_buffers) {
+        luring_enable_fixed_bufs(aio_get_linux_io_uring_iopoll(ctx));
+    }
+
+    ret = luring_co_submit_iopoll(bs, s->fd, offset, qiov, type);
+    if (ret == -EOPNOTSUPP) {
+        warn_report_once("%s does not support polled I/O, "
+                         "falling back to interrupts", bs->filename);
+        s->use_iopoll = false;
+        return luring_co_submit(bs, s->fd, offset, qiov, type);
+    }
+    return ret;
+}
 #endif
 
 #ifdef CONFIG_LINUX_AIO
@@ -2473,6 +2615,162 @@ static inline bool raw_check_linux_aio(BDRVRawState *s)
 }
 #endif
 
+#ifdef CONFIG_LINUX_IO_URING_CMD
+static int coroutine_fn raw_nvme_co_cmd(BlockDriverState *bs,
+                                        struct nvme_uring_cmd *cmd,
+                                        QEMUIOVector *qiov)
+{
+    BDRVRawState *s = bs->opaque;
+    AioContext *ctx = qemu_get_current_aio_context();
+    uint32_t cmd_op = NVME_URING_CMD_IO;
+    Error *local_err = NULL;
+    int ret;
+
+    /*
+     * The thread pool cannot issue these, there is nothing to fall back to.
+     * The ring is only missing after moving to another AioContext.
+     */
+    if (unlikely(!aio_setup_linux_io_uring_cmd(ctx, &local_err))) {
+        error_report_err(local_err);
+        return -EIO;
+    }
+    if (s->use_fixed_buffers) {
+        luring_enable_fixed_bufs(aio_get_linux_io_uring_cmd(ctx));
+    }
+
+    cmd->nsid = s->nvme_nsid;
+    if (qiov && qiov->niov == 1) {
+        cmd->addr = (uintptr_t)qiov->iov[0].iov_base;
+        cmd->data_len = qiov->iov[0].iov_len;
+    } else if (qiov) {
+        cmd_op = NVME_URING_CMD_IO_VEC;
+        cmd->addr = (uintptr_t)qiov->iov;
+        cmd->data_len = qiov->niov;
+    }
+
+    ret = luring_co_submit_cmd(bs, s->fd, cmd_op, cmd, sizeof(*cmd), qiov);
+    if (ret > 0) {
+        /* NVMe status, without the phase tag */
+        trace_file_nvme_cmd_status(bs, cmd->opcode, ret);
+        switch (ret & 0x7ff) {
+        case NVME_INVALID_OPCODE:
+        case NVME_INVALID_FIELD:
+            return -ENOTSUP;
+        default:
+            return -EIO;
+        }
+    }
+    return ret;
+}
+
+static int coroutine_fn raw_nvme_co_rw(BlockDriverState *bs, uint64_t offset,
+                                       uint64_t bytes, QEMUIOVector *qiov,
+                                       int type)
+{
+    BDRVRawState *s = bs->opaque;
+    uint64_t slba = offset >> s->nvme_blkshift;
+    uint32_t nlb = bytes >> s->nvme_blkshift;
+    struct nvme_uring_cmd cmd = {
+        .opcode = type == QEMU_AIO_READ ? NVME_CMD_READ : NVME_CMD_WRITE,
+        .cdw10 = slba,
+        .cdw11 = slba >> 32,
+        .cdw12 = nlb - 1,
+    };
+    QEMUIOVector bounce_qiov;
+    void *bounce_buf;
+    int ret;
+
+    assert(type == QEMU_AIO_READ || type == QEMU_AIO_WRITE);
+    assert(QEMU_IS_ALIGNED(offset | bytes, 1 << s->nvme_blkshift));
+    assert(nlb && nlb <= RAW_NVME_MAX_BLOCKS);
+
+    if (qiov->niov <= RAW_NVME_MAX_SEGMENTS) {
+        return raw_nvme_co_cmd(bs, &cmd, qiov);
+    }
+
+    /* The kernel would refuse the command, go through a linear buffer */
+    bounce_buf = qemu_try_blockalign(bs, bytes);
+    if (!bounce_buf) {
+        return -ENOMEM;
+    }
+    qemu_iovec_init_buf(&bounce_qiov, bounce_buf, bytes);
+    if (type == QEMU_AIO_WRITE) {
+        qemu_iovec_to_buf(qiov, 0, bounce_buf, bytes);
+    }
+    ret = raw_nvme_co_cmd(bs, &cmd, &bounce_qiov);
+    if (ret == 0 && type == QEMU_AIO_READ) {
+        qemu_iovec_from_buf(qiov, 0, bounce_buf, bytes);
+    }
+    qemu_vfree(bounce_buf);
+    return ret;
+}
+
+static int coroutine_fn raw_nvme_co_flush(BlockDriverState *bs)
+{
+    struct nvme_uring_cmd cmd = {
+        .opcode = NVME_CMD_FLUSH,
+    };
+
+    return raw_nvme_co_cmd(bs, &cmd, NULL);
+}
+
+static int coroutine_fn raw_nvme_co_pwrite_zeroes(BlockDriverState *bs,
+                                                  int64_t offset,
+                                                  int64_t bytes,
+                                                  BdrvRequestFlags flags)
+{
+    BDRVRawState *s = bs->opaque;
+    uint64_t slba = offset >> s->nvme_blkshift;
+    uint32_t nlb = bytes >> s->nvme_blkshift;
+    struct nvme_uring_cmd cmd = {
+        .opcode = NVME_CMD_WRITE_ZEROES,
+        .cdw10 = slba,
+        .cdw11 = slba >> 32,
+        .cdw12 = nlb - 1,
+    };
+
+    if (!s->nvme_supports_write_zeroes) {
+        return -ENOTSUP;
+    }
+
+    assert(QEMU_IS_ALIGNED(offset | bytes, 1 << s->nvme_blkshift));
+    assert(nlb && nlb <= RAW_NVME_MAX_BLOCKS);
+
+    if ((flags & BDRV_REQ_MAY_UNMAP) && s->nvme_supports_deallocate) {
+        cmd.cdw12 |= RAW_NVME_WRITE_ZEROES_DEAC;
+    }
+    return raw_nvme_co_cmd(bs, &cmd, NULL);
+}
+
+static int coroutine_fn raw_nvme_co_pdiscard(BlockDriverState *bs,
+                                             int64_t offset, int64_t bytes)
+{
+    BDRVRawState *s = bs->opaque;
+    NvmeDsmRange range = {
+        .nlb = cpu_to_le32(bytes >> s->nvme_blkshift),
+        .slba = cpu_to_le64(offset >> s->nvme_blkshift),
+    };
+    struct nvme_uring_cmd cmd = {
+        .opcode = NVME_CMD_DSM,
+        .cdw11 = NVME_DSMGMT_AD,
+    };
+    QEMUIOVector qiov;
+    int ret;
+
+    if (!s->nvme_supports_discard) {
+        ret = -ENOTSUP;
+    } else if (!QEMU_IS_ALIGNED(offset | bytes, 1 << s->nvme_blkshift)) {
+        /* Discards are advisory, partial blocks are simply not discarded */
+        ret = -ENOTSUP;
+    } else {
+        qemu_iovec_init_buf(&qiov, &range, sizeof(range));
+        ret = raw_nvme_co_cmd(bs, &cmd, &qiov);
+    }
+    raw_account_discard(s, bytes, ret);
+    return ret;
+}
+#endif /* CONFIG_LINUX_IO_URING_CMD */
+
 static int coroutine_fn raw_co_prw(BlockDriverState *bs, int64_t *offset_ptr,
                                    uint64_t bytes, QEMUIOVector *qiov, int type)
 {
@@ -2494,6 +2792,14 @@ static int coroutine_fn raw_co_prw(BlockDriverState *bs, int64_t *offset_ptr,
     }
 #endif
 
+#ifdef CONFIG_LINUX_IO_URING_CMD
+    if (s->use_nvme_cmd) {
+        assert(qiov->size == bytes);
+        ret = raw_nvme_co_rw(bs, offset, bytes, qiov, type);
+        goto out;
+    }
+#endif
+
     /*
      * When using O_DIRECT, the request must be aligned to be able to use
      * either libaio or io_uring interface. If not fail back to regular thread
@@ -2505,7 +2811,11 @@ static int coroutine_fn raw_co_prw(BlockDriverState *bs, int64_t *offset_ptr,
 #ifdef CONFIG_LINUX_IO_URING
     } else if (raw_check_linux_io_uring(s)) {
         assert(qiov->size == bytes);
-        ret = luring_co_submit(bs, s->fd, offset, qiov, type);
+        if (s->use_iopoll && type != QEMU_AIO_ZONE_APPEND) {
+            ret = raw_co_iopoll(bs, offset, qiov, type);
+        } else {
+            ret = luring_co_submit(bs, s->fd, offset, qiov, type);
+        }
         goto out;
 #endif
 #ifdef CONFIG_LINUX_AIO
@@ -2589,6 +2899,12 @@ static int coroutine_fn raw_co_flush_to_disk(BlockDriverState *bs)
         return ret;
     }
 
+#ifdef CONFIG_LINUX_IO_URING_CMD
+    if (s->use_nvme_cmd) {
+        return raw_nvme_co_flush(bs);
+    }
+#endif
+
     acb = (RawPosixAIOData) {
         .bs             = bs,
         .aio_fildes     = s->fd,
@@ -2603,6 +2919,33 @@ static int coroutine_fn raw_co_flush_to_disk(BlockDriverState *bs)
     return raw_thread_pool_submit(handle_aiocb_flush, &acb);
 }
 
+#ifdef CONFIG_LINUX_IO_URING
+/*
+ * Registered buffers stay pinned for as long as they are registered, and RAM
+ * discard is disabled in the meantime, which is why this is opt-in.  Failing
+ * to register only loses the fast path, so never fail the caller.
+ */
+static bool raw_register_buf(BlockDriverState *bs, void *host, size_t size,
+                             Error **errp)
+{
+    BDRVRawState *s = bs->opaque;
+
+    if (s->use_fixed_buffers) {
+        luring_register_buf(host, size);
+    }
+    return true;
+}
+
+static void raw_unregister_buf(BlockDriverState *bs, void *host, size_t size)
+{
+    BDRVRawState *s = bs->opaque;
+
+    if (s->use_fixed_buffers) {
+        luring_unregister_buf(host, size);
+    }
+}
+#endif
+
 static void raw_close(BlockDriverState *bs)
 {
     BDRVRawState *s = bs->opaque;
@@ -2844,6 +3187,12 @@ static int64_t raw_getlength(BlockDriverState *bs)
         return ret;
     }
 
+#ifdef CONFIG_LINUX_IO_URING_CMD
+    if (s->use_nvme_cmd) {
+        return s->nvme_nsze << s->nvme_blkshift;
+    }
+#endif
+
     size = lseek(s->fd, 0, SEEK_END);
     if (size < 0) {
         return -errno;
@@ -3899,6 +4248,10 @@ BlockDriver bdrv_file = {
     .bdrv_co_copy_range_from = raw_co_copy_range_from,
     .bdrv_co_copy_range_to  = raw_co_copy_range_to,
     .bdrv_refresh_limits = raw_refresh_limits,
+#ifdef CONFIG_LINUX_IO_URING
+    .bdrv_register_buf      = raw_register_buf,
+    .bdrv_unregister_buf    = raw_unregister_buf,
+#endif
 
     .bdrv_co_truncate                   = raw_co_truncate,
     .bdrv_co_getlength                  = raw_co_getlength,
@@ -4091,6 +4444,124 @@ static bool hdev_is_sg(BlockDriverState *bs)
     return false;
 }
 
+#ifdef CONFIG_LINUX_IO_URING_CMD
+static int hdev_nvme_identify(BlockDriverState *bs, uint32_t nsid,
+                              uint32_t cns, void *buf, Error **errp)
+{
+    BDRVRawState *s = bs->opaque;
+    struct nvme_admin_cmd cmd = {
+        .opcode = NVME_ADM_CMD_IDENTIFY,
+        .nsid = nsid,
+        .addr = (uintptr_t)buf,
+        .data_len = sizeof(NvmeIdCtrl),
+        .cdw10 = cns,
+    };
+    int ret;
+
+    ret = ioctl(s->fd, NVME_IOCTL_ADMIN_CMD, &cmd);
+    if (ret < 0) {
+        error_setg_errno(errp, errno, "Could not identify NVMe %s",
+                         cns == NVME_ID_CNS_CTRL ? "controller" : "namespace");
+        return -errno;
+    } else if (ret > 0) {
+        error_setg(errp, "Could not identify NVMe %s: status 0x%x",
+                   cns == NVME_ID_CNS_CTRL ? "controller" : "namespace", ret);
+        return -EIO;
+    }
+    return 0;
+}
+
+/*
+ * Set up passthrough commands if @bs is an NVMe generic character device.
+ * Their namespace can only be accessed with NVMe commands, so they need
+ * io_uring.
+ */
+static int hdev_open_nvme_generic(BlockDriverState *bs, Error **errp)
+{
+    BDRVRawState *s = bs->opaque;
+    union {
+        NvmeIdCtrl ctrl;
+        NvmeIdNs ns;
+    } *id;
+    NvmeLBAF *lbaf;
+    struct stat st;
+    uint32_t max_transfer;
+    uint16_t oncs;
+    int nsid;
+    int ret;
+
+    if (fstat(s->fd, &st) < 0 || !S_ISCHR(st.st_mode)) {
+        return 0;
+    }
+    nsid = ioctl(s->fd, NVME_IOCTL_ID);
+    if (nsid <= 0) {
+        return 0;
+    }
+
+    if (!s->use_linux_io_uring) {
+        error_setg(errp, "NVMe generic character devices require aio=io_uring");
+        return -EINVAL;
+    }
+    if (!aio_setup_linux_io_uring_cmd(bdrv_get_aio_context(bs), errp)) {
+        error_prepend(errp, "io_uring passthrough commands are not supported "
+                      "by the host kernel: ");
+        return -ENOTSUP;
+    }
+
+    id = qemu_try_memalign(qemu_real_host_page_size(), sizeof(*id));
+    if (!id) {
+        error_setg(errp, "Cannot allocate buffer for identify response");
+        return -ENOMEM;
+    }
+
+    ret = hdev_nvme_identify(bs, 0, NVME_ID_CNS_CTRL, id, errp);
+    if (ret < 0) {
+        goto out;
+    }
+    oncs = le16_to_cpu(id->ctrl.oncs);
+    s->nvme_supports_write_zeroes = !!(oncs & NVME_ONCS_WRITE_ZEROES);
+    s->nvme_supports_discard = !!(oncs & NVME_ONCS_DSM);
+    /* Linux always uses 4k controller pages */
+    max_transfer = id->ctrl.mdts ? (4 * KiB) << MIN(id->ctrl.mdts, 8) : 0;
+
+    ret = hdev_nvme_identify(bs, nsid, NVME_ID_CNS_NS, id, errp);
+    if (ret < 0) {
+        goto out;
+    }
+    lbaf = &id->ns.lbaf[NVME_ID_NS_FLBAS_INDEX(id->ns.flbas)];
+    if (lbaf->ms) {
+        error_setg(errp, "Namespaces with metadata are not supported");
+        ret = -ENOTSUP;
+        goto out;
+    }
+    if (lbaf->ds < BDRV_SECTOR_BITS || lbaf->ds > 12) {
+        error_setg(errp, "Namespace has unsupported block size (2^%d)",
+                   lbaf->ds);
+        ret = -ENOTSUP;
+        goto out;
+    }
+
+    s->nvme_supports_deallocate =
+        NVME_ID_NS_DLFEAT_WRITE_ZEROES(id->ns.dlfeat) &&
+        NVME_ID_NS_DLFEAT_READ_BEHAVIOR(id->ns.dlfeat) ==
+            NVME_ID_NS_DLFEAT_READ_BEHAVIOR_ZEROES;
+    s->nvme_nsid = nsid;
+    s->nvme_nsze = le64_to_cpu(id->ns.nsze);
+    s->nvme_blkshift = lbaf->ds;
+    s->nvme_max_transfer = MIN_NON_ZERO(max_transfer, RAW_NVME_MAX_TRANSFER);
+    s->nvme_max_transfer = MIN(s->nvme_max_transfer,
+                               RAW_NVME_MAX_BLOCKS << s->nvme_blkshift);
+    s->use_nvme_cmd = true;
+    trace_file_hdev_nvme_generic(bs, nsid, s->nvme_nsze, s->nvme_blkshift,
+                                 s->nvme_max_transfer);
+    ret = 0;
+
+out:
+    qemu_vfree(id);
+    return ret;
+}
+#endif
+
 static int hdev_open(BlockDriverState *bs, QDict *options, int flags,
                      Error **errp)
 {
@@ -4175,11 +4646,129 @@ hdev_open_Mac_error:
 
     /* Since this does ioctl the device must be already opened */
     bs->sg = hdev_is_sg(bs);
+#if defined(__linux__)
+    s->use_sg_async = bs->sg;
+#endif
+
+#ifdef CONFIG_LINUX_IO_URING_CMD
+    if (!bs->sg) {
+        ret = hdev_open_nvme_generic(bs, errp);
+        if (ret < 0) {
+            raw_close(bs);
+        }
+    }
+#endif
 
     return ret;
 }
 
 #if defined(__linux__)
+/* Complete the SG_IO requests that the sg driver has ready for read() */
+static void raw_sg_async_read(void *opaque)
+{
+    BlockDriverState *bs = opaque;
+    BDRVRawState *s = bs->opaque;
+    RawSgAsyncRequest *req;
+    struct sg_io_hdr hdr;
+    int waiting, ret;
+    ssize_t len;
+
+    while (s->sg_async_inflight) {
+        if (ioctl(s->fd, SG_GET_NUM_WAITING, &waiting) < 0) {
+            goto fail;
+        }
+        if (!waiting) {
+            return;
+        }
+
+        len = RETRY_ON_EINTR(read(s->fd, &hdr, sizeof(hdr)));
+        if (len < 0) {
+            goto fail;
+        }
+
+        req = hdr.usr_ptr;
+        req->io_hdr->status = hdr.status;
+        req->io_hdr->masked_status = hdr.masked_status;
+        req->io_hdr->msg_status = hdr.msg_status;
+        req->io_hdr->sb_len_wr = hdr.sb_len_wr;
+        req->io_hdr->host_status = hdr.host_status;
+        req->io_hdr->driver_status = hdr.driver_status;
+        req->io_hdr->resid = hdr.resid;
+        req->io_hdr->duration = hdr.duration;
+        req->io_hdr->info = hdr.info;
+        req->ret = 0;
+        QLIST_REMOVE(req, next);
+        aio_co_wake(req->co);
+    }
+    return;
+
+fail:
+    /* The device is gone, nothing is going to complete anymore */
+    ret = -errno;
+    trace_file_sg_async_read_failed(bs, ret);
+    while ((req = QLIST_FIRST(&s->sg_async_reqs))) {
+        req->ret = ret;
+        QLIST_REMOVE(req, next);
+        aio_co_wake(req->co);
+    }
+}
+
+/*
+ * Issue SG_IO through the asynchronous interface of the sg driver, which
+ * saves the round trip through the thread pool: write() queues the
+ * request and read(), once the file descriptor polls readable, returns it
+ * completed.
+ *
+ * Returns -EAGAIN if the request was not submitted, in which case it is
+ * up to the caller to issue the ioctl.
+ */
+static int coroutine_fn raw_sg_co_async(BlockDriverState *bs,
+                                        struct sg_io_hdr *io_hdr)
+{
+    BDRVRawState *s = bs->opaque;
+    AioContext *ctx = qemu_get_current_aio_context();
+    RawSgAsyncRequest req = {
+        .co = qemu_coroutine_self(),
+        .io_hdr = io_hdr,
+        .ret = -EINPROGRESS,
+    };
+    struct sg_io_hdr hdr = *io_hdr;
+    ssize_t len;
+
+    if (s->sg_async_inflight >= RAW_SG_ASYNC_MAX_INFLIGHT ||
+        (s->sg_async_ctx && s->sg_async_ctx != ctx)) {
+        return -EAGAIN;
+    }
+
+    hdr.usr_ptr = &req;
+    len = RETRY_ON_EINTR(write(s->fd, &hdr, sizeof(hdr)));
+    if (len < 0) {
+        trace_file_sg_async_write_failed(bs, -errno);
+        if (errno == EBADF) {
+            /* Opened read-only */
+            s->use_sg_async = false;
+        }
+        return -EAGAIN;
+    }
+
+    QLIST_INSERT_HEAD(&s->sg_async_reqs, &req, next);
+    if (s->sg_async_inflight++ == 0) {
+        s->sg_async_ctx = ctx;
+        aio_set_fd_handler(ctx, s->fd, raw_sg_async_read, NULL, NULL, NULL,
+                           bs);
+    }
+
+    while (req.ret == -EINPROGRESS) {
+        qemu_coroutine_yield();
+    }
+
+    if (--s->sg_async_inflight == 0) {
+        aio_set_fd_handler(ctx, s->fd, NULL, NULL, NULL, NULL, NULL);
+        s->sg_async_ctx = NULL;
+    }
+    return req.ret;
+}
+
 static int coroutine_fn
 hdev_co_ioctl(BlockDriverState *bs, unsigned long int req, void *buf)
 {
@@ -4201,6 +4790,13 @@ hdev_co_ioctl(BlockDriverState *bs, unsigned long int req, void *buf)
         }
     }
 
+    if (req == SG_IO && s->use_sg_async) {
+        ret = raw_sg_co_async(bs, buf);
+        if (ret != -EAGAIN) {
+            return ret;
+        }
+    }
+
     acb = (RawPosixAIOData) {
         .bs         = bs,
         .aio_type   = QEMU_AIO_IOCTL,
@@ -4227,12 +4823,20 @@ hdev_co_pdiscard(BlockDriverState *bs, int64_t offset, int64_t bytes)
         raw_account_discard(s, bytes, ret);
         return ret;
     }
+#ifdef CONFIG_LINUX_IO_URING_CMD
+    if (s->use_nvme_cmd) {
+        return raw_nvme_co_pdiscard(bs, offset, bytes);
+    }
+#endif
     return raw_do_pdiscard(bs, offset, bytes, true);
 }
 
 static coroutine_fn int hdev_co_pwrite_zeroes(BlockDriverState *bs,
     int64_t offset, int64_t bytes, BdrvRequestFlags flags)
 {
+#ifdef CONFIG_LINUX_IO_URING_CMD
+    BDRVRawState *s = bs->opaque;
+#endif
     int rc;
 
     rc = fd_open(bs);
@@ -4240,6 +4844,12 @@ static coroutine_fn int hdev_co_pwrite_zeroes(BlockDriverState *bs,
         return rc;
     }
 
+#ifdef CONFIG_LINUX_IO_URING_CMD
+    if (s->use_nvme_cmd) {
+        return raw_nvme_co_pwrite_zeroes(bs, offset, bytes, flags);
+    }
+#endif
+
     return raw_do_pwrite_zeroes(bs, offset, bytes, flags, true);
 }
 
@@ -4268,6 +4878,10 @@ static BlockDriver bdrv_host_device = {
     .bdrv_co_copy_range_from = raw_co_copy_range_from,
     .bdrv_co_copy_range_to  = raw_co_copy_range_to,
     .bdrv_refresh_limits = raw_refresh_limits,
+#ifdef CONFIG_LINUX_IO_URING
+    .bdrv_register_buf      = raw_register_buf,
+    .bdrv_unregister_buf    = raw_unregister_buf,
+#endif
 
     .bdrv_co_truncate                   = raw_co_truncate,
     .bdrv_co_getlength                  = raw_co_getlength,
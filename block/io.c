@@ -1157,6 +1157,21 @@ bdrv_driver_pwritev_compressed(BlockDriverState *bs, int64_t offset,
     return ret;
 }
 
+/*
+ * Whether [offset, offset + bytes) reads as zeroes from the backing chain of
+ * @bs, so that copy-on-read can write zeroes instead of reading the data.
+ */
+static bool coroutine_fn GRAPH_RDLOCK
+bdrv_co_cor_reads_zeroes(BlockDriverState *bs, int64_t offset, int64_t bytes)
+{
+    int64_t pnum;
+    int ret;
+
+    ret = bdrv_co_block_status_above(bs, NULL, offset, bytes, &pnum,
+                                     NULL, NULL);
+    return ret >= 0 && (ret & BDRV_BLOCK_ZERO) && pnum == bytes;
+}
+
 static int coroutine_fn GRAPH_RDLOCK
 bdrv_co_do_copy_on_readv(BdrvChild *child, int64_t offset, int64_t bytes,
                          QEMUIOVector *qiov, size_t qiov_offset, int flags)
@@ -1239,7 +1254,21 @@ bdrv_co_do_copy_on_readv(BdrvChild *child, int64_t offset, int64_t bytes,
             assert(skip_bytes < pnum);
         }
 
-        if (ret <= 0) {
+        if (ret == 0 && (flags & BDRV_REQ_PREFETCH) &&
+            drv->bdrv_co_pwrite_zeroes &&
+            bdrv_co_cor_reads_zeroes(bs, align_offset, pnum)) {
+            /*
+             * Prefetching only populates the image, so zeroes that the
+             * backing chain already knows about need not be read at all.
+             */
+            bdrv_co_debug_event(bs, BLKDBG_COR_WRITE);
+            ret = bdrv_co_do_pwrite_zeroes(bs, align_offset, pnum,
+                                           BDRV_REQ_WRITE_UNCHANGED |
+                                           BDRV_REQ_MAY_UNMAP);
+            if (ret < 0) {
+                goto err;
+            }
+        } else if (ret <= 0) {
             QEMUIOVector local_qiov;
 
             /* Must copy-on-read; use the bounce buffer */
@@ -1266,11 +1295,14 @@ bdrv_co_do_copy_on_readv(BdrvChild *child, int64_t offset, int64_t bytes,
             bdrv_co_debug_event(bs, BLKDBG_COR_WRITE);
             if (drv->bdrv_co_pwrite_zeroes &&
                 buffer_is_zero(bounce_buffer, pnum)) {
-                /* FIXME: Should we (perhaps conditionally) be setting
-                 * BDRV_REQ_MAY_UNMAP, if it will allow for a sparser copy
-                 * that still correctly reads as zero? */
+                /* FIXME: Should guest copy-on-read be setting
+                 * BDRV_REQ_MAY_UNMAP as well, if it will allow for a sparser
+                 * copy that still correctly reads as zero?  Block jobs
+                 * prefetching data want the sparsest copy possible. */
                 ret = bdrv_co_do_pwrite_zeroes(bs, align_offset, pnum,
-                                               BDRV_REQ_WRITE_UNCHANGED);
+                                               BDRV_REQ_WRITE_UNCHANGED |
+                                               (flags & BDRV_REQ_PREFETCH ?
+                                                BDRV_REQ_MAY_UNMAP : 0));
             } else {
                 /* This does not change the data on the disk, it is not
                  * necessary to flush even in cache=writethrough mode.
@@ -2017,6 +2049,14 @@ bdrv_co_write_req_finish(BdrvChild *child, int64_t offset, int64_t bytes,
 
     qatomic_inc(&bs->write_gen);
 
+    /*
+     * Nodes above caching where the status of this range comes from may now
+     * find it somewhere else, even if the request failed half-way.
+     */
+    bdrv_csc_invalidate_range(bs, offset,
+                              req->type == BDRV_TRACKED_TRUNCATE ?
+                              INT64_MAX - offset : bytes);
+
     /*
      * Discard cannot extend the image, but in error handling cases, such as
      * when reverting a qcow2 cluster allocation, the discarded range can pass
@@ -2618,6 +2658,65 @@ early_out:
     return ret;
 }
 
+/*
+ * Block status of [offset, offset + bytes) in the backing chain of @bs when
+ * its chain status cache says that @node provides it.  @bs itself has
+ * already been found not to allocate the range.
+ *
+ * Returns -EAGAIN if the chain must be walked after all.
+ */
+static int coroutine_fn GRAPH_RDLOCK
+bdrv_co_cached_block_status_above(BlockDriverState *bs, BlockDriverState *base,
+                                  bool include_base, bool want_zero,
+                                  BlockDriverState *node,
+                                  int64_t offset, int64_t bytes,
+                                  int64_t *pnum, int64_t *map,
+                                  BlockDriverState **file, int *depth)
+{
+    BlockDriverState *p;
+    int ret;
+
+    /* Whatever is between @bs and @node is unallocated, but stop at @base */
+    for (p = bdrv_filter_or_cow_bs(bs); p != node;
+         p = bdrv_filter_or_cow_bs(p))
+    {
+        if (!p) {
+            return -EAGAIN;
+        }
+        ++*depth;
+        if (p == base) {
+            if (include_base) {
+                return -EAGAIN;
+            }
+            *pnum = bytes;
+            return 0;
+        }
+    }
+    if (node == base && !include_base) {
+        *pnum = bytes;
+        return 0;
+    }
+
+    ret = bdrv_co_do_block_status(node, want_zero, offset, bytes, pnum,
+                                  map, file);
+    ++*depth;
+    if (ret < 0) {
+        return ret;
+    }
+    if (*pnum == 0) {
+        /* Zeroes beyond the end of a short node, leave them to the caller */
+        return -EAGAIN;
+    }
+    if (ret & BDRV_BLOCK_ALLOCATED) {
+        /* As in bdrv_co_common_block_status_above(), EOF is added later */
+        ret &= ~BDRV_BLOCK_EOF;
+    } else if (bdrv_filter_or_cow_bs(node)) {
+        /* Stale entry, the status is provided further down the chain */
+        return -EAGAIN;
+    }
+    return ret;
+}
+
 int coroutine_fn
 bdrv_co_common_block_status_above(BlockDriverState *bs,
                                   BlockDriverState *base,
@@ -2632,6 +2731,8 @@ bdrv_co_common_block_status_above(BlockDriverState *bs,
 {
     int ret;
     BlockDriverState *p;
+    BlockDriverState *csc_node = NULL;
+    uint64_t csc_gen = 0;
     int64_t eof = 0;
     int dummy;
     IO_CODE();
@@ -2663,6 +2764,18 @@ bdrv_co_common_block_status_above(BlockDriverState *bs,
     assert(*pnum <= bytes);
     bytes = *pnum;
 
+    if (bs->chain_status_cache &&
+        bdrv_csc_lookup(bs, offset, &bytes, &csc_node, &csc_gen)) {
+        ret = bdrv_co_cached_block_status_above(bs, base, include_base,
+                                                want_zero, csc_node, offset,
+                                                bytes, pnum, map, file, depth);
+        if (ret != -EAGAIN) {
+            goto out;
+        }
+        *depth = 1;
+    }
+    csc_node = NULL;
+
     for (p = bdrv_filter_or_cow_bs(bs); include_base || p != base;
          p = bdrv_filter_or_cow_bs(p))
     {
@@ -2699,6 +2812,7 @@ bdrv_co_common_block_status_above(BlockDriverState *bs,
              * below.
              */
             ret &= ~BDRV_BLOCK_EOF;
+            csc_node = p;
             break;
         }
 
@@ -2707,6 +2821,11 @@ bdrv_co_common_block_status_above(BlockDriverState *bs,
             break;
         }
 
+        /* The bottom of the chain provides the status of unallocated areas */
+        if (!bdrv_filter_or_cow_bs(p)) {
+            csc_node = p;
+        }
+
         /*
          * OK, [offset, offset + *pnum) region is unallocated on this layer,
          * let's continue the diving.
@@ -2715,6 +2834,11 @@ bdrv_co_common_block_status_above(BlockDriverState *bs,
         bytes = *pnum;
     }
 
+    if (bs->chain_status_cache && csc_node) {
+        bdrv_csc_fill(bs, csc_gen, offset, *pnum, csc_node);
+    }
+
+out:
     if (offset + *pnum == eof) {
         ret |= BDRV_BLOCK_EOF;
     }
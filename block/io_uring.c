@@ -14,10 +14,14 @@
 #include "qemu/queue.h"
 #include "block/block.h"
 #include "block/raw-aio.h"
+#include "qemu/bitmap.h"
 #include "qemu/coroutine.h"
 #include "qemu/defer-call.h"
+#include "qemu/rcu.h"
+#include "qemu/units.h"
 #include "qapi/error.h"
 #include "sysemu/block-backend.h"
+#include "exec/memory.h" /* for ram_block_discard_disable() */
 #include "trace.h"
 
 /* Only used for assertions.  */
@@ -26,9 +30,27 @@
 /* io_uring ring size */
 #define MAX_ENTRIES 128
 
+/* Number of slots in the registered buffer table of each ring */
+#define MAX_FIXED_BUFS 1024
+/* Kernel limit for the size of one registered buffer */
+#define MAX_FIXED_BUF_SIZE (1 * GiB)
+
+/* Size of the entries of rings set up with IORING_SETUP_SQE128 */
+#define SQE128_SIZE (2 * sizeof(struct io_uring_sqe))
+
+#ifdef CONFIG_LINUX_IO_URING_CMD
+#define URING_CMD_SETUP_FLAGS (IORING_SETUP_SQE128 | IORING_SETUP_CQE32)
+#else
+#define URING_CMD_SETUP_FLAGS 0
+#endif
+
 typedef struct LuringAIOCB {
     Coroutine *co;
-    struct io_uring_sqe sqeq;
+    union {
+        struct io_uring_sqe sqeq;
+        /* IORING_OP_URING_CMD commands continue past the first entry */
+        uint8_t sqe128[SQE128_SIZE];
+    };
     ssize_t ret;
     QEMUIOVector *qiov;
     bool is_read;
@@ -58,8 +80,321 @@ struct LuringState {
     LuringQueue io_q;
 
     QEMUBH *completion_bh;
+
+    /*
+     * The ring has all the buffers of luring_fixed.table, set by
+     * luring_enable_fixed_bufs() the first time it is called
+     */
+    bool fixed_bufs;
+    bool fixed_bufs_tried;
+    /* Set up with 128-byte entries, which IORING_OP_URING_CMD needs */
+    bool sqe128;
+    /*
+     * Set up with IORING_SETUP_IOPOLL: completions are polled from the
+     * device instead of being signalled, see luring_iopoll_reap().
+     */
+    bool iopoll;
+    QLIST_ENTRY(LuringState) next;
 };
 
+/*
+ * Memory registered with luring_register_buf() is registered as fixed
+ * buffers with the rings that nodes using fixed buffers submit to (see
+ * luring_enable_fixed_bufs()), so that reads and writes to it skip the
+ * per-request page pinning.  A range is split into slots of at most
+ * MAX_FIXED_BUF_SIZE bytes, and the slots have the same index in all
+ * the rings.  Every ring pins the pages and charges them against
+ * RLIMIT_MEMLOCK on its own, which is why rings of AioContexts where no
+ * such node does I/O are left alone.
+ */
+typedef struct LuringBufRegistration {
+    struct rcu_head rcu;
+    void *host;
+    size_t size;
+    unsigned int refcnt;
+    unsigned int first_slot;
+    unsigned int nb_slots;
+    QLIST_ENTRY(LuringBufRegistration) next;
+} LuringBufRegistration;
+
+typedef struct {
+    struct rcu_head rcu;
+    unsigned int nb;
+    /* Sorted by address */
+    LuringBufRegistration *regs[];
+} LuringFixedTable;
+
+static struct {
+    /* Protects everything but the contents of @table, which is RCU */
+    QemuMutex lock;
+    QLIST_HEAD(, LuringState) rings;
+    QLIST_HEAD(, LuringBufRegistration) regs;
+    DECLARE_BITMAP(used_slots, MAX_FIXED_BUFS);
+    LuringFixedTable *table;
+} luring_fixed;
+
+static void __attribute__((__constructor__)) luring_fixed_init(void)
+{
+    qemu_mutex_init(&luring_fixed.lock);
+}
+
+/*
+ * Point the slots of @reg at its memory in the table of @s, or clear
+ * them if @clear is true.
+ */
+static int luring_fixed_update(LuringState *s, LuringBufRegistration *reg,
+                               bool clear)
+{
+    for (unsigned int i = 0; i < reg->nb_slots; i++) {
+        size_t offset = i * MAX_FIXED_BUF_SIZE;
+        struct iovec iov = {
+            .iov_base = clear ? NULL : reg->host + offset,
+            .iov_len = clear ? 0 : MIN(reg->size - offset, MAX_FIXED_BUF_SIZE),
+        };
+        __u64 tag = 0;
+        int ret;
+
+        ret = io_uring_register_buffers_update_tag(&s->ring,
+                                                   reg->first_slot + i,
+                                                   &iov, &tag, 1);
+        if (ret < 0) {
+            return ret;
+        }
+    }
+    return 0;
+}
+
+static gint luring_fixed_compare(gconstpointer a, gconstpointer b)
+{
+    const LuringBufRegistration *ra = *(LuringBufRegistration **)a;
+    const LuringBufRegistration *rb = *(LuringBufRegistration **)b;
+
+    return ra->host < rb->host ? -1 : ra->host > rb->host;
+}
+
+/* Called with luring_fixed.lock held */
+static void luring_fixed_publish(void)
+{
+    LuringFixedTable *old = luring_fixed.table;
+    LuringFixedTable *table;
+    LuringBufRegistration *reg;
+    unsigned int nb = 0;
+
+    QLIST_FOREACH(reg, &luring_fixed.regs, next) {
+        nb++;
+    }
+
+    table = g_malloc(sizeof(*table) + nb * sizeof(table->regs[0]));
+    table->nb = 0;
+    QLIST_FOREACH(reg, &luring_fixed.regs, next) {
+        table->regs[table->nb++] = reg;
+    }
+    qsort(table->regs, nb, sizeof(table->regs[0]), luring_fixed_compare);
+
+    qatomic_rcu_set(&luring_fixed.table, table);
+    if (old) {
+        g_free_rcu(old, rcu);
+    }
+}
+
+/*
+ * Returns the slot of the fixed buffer that contains @qiov, or -1 if
+ * there is none.  Only requests for a single buffer can use one.
+ */
+static int luring_fixed_lookup(LuringState *s, QEMUIOVector *qiov)
+{
+    LuringFixedTable *table;
+    LuringBufRegistration *reg;
+    unsigned int lo = 0, hi;
+    void *buf;
+    size_t len, offset;
+
+    if (!s->fixed_bufs || qiov->niov != 1 || !qiov->iov[0].iov_len) {
+        return -1;
+    }
+    buf = qiov->iov[0].iov_base;
+    len = qiov->iov[0].iov_len;
+
+    RCU_READ_LOCK_GUARD();
+
+    table = qatomic_rcu_read(&luring_fixed.table);
+    if (!table || !table->nb) {
+        return -1;
+    }
+
+    /* Find the last registration that starts at or before @buf */
+    hi = table->nb;
+    while (hi - lo > 1) {
+        unsigned int mid = lo + (hi - lo) / 2;
+        if (table->regs[mid]->host <= buf) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+
+    reg = table->regs[lo];
+    if (buf < reg->host || buf + len > reg->host + reg->size) {
+        return -1;
+    }
+
+    /* The request must not cross the boundary of a slot */
+    offset = buf - reg->host;
+    if (offset / MAX_FIXED_BUF_SIZE != (offset + len - 1) / MAX_FIXED_BUF_SIZE) {
+        return -1;
+    }
+    return reg->first_slot + offset / MAX_FIXED_BUF_SIZE;
+}
+
+/**
+ * luring_enable_fixed_bufs:
+ *
+ * Give @s the buffers registered so far, and those registered later.
+ * Only called for the rings that nodes using fixed buffers submit to,
+ * from the home thread of @s.  Failing to register only loses the fast
+ * path, and is not retried.
+ */
+void luring_enable_fixed_bufs(LuringState *s)
+{
+    LuringBufRegistration *reg;
+    int ret;
+
+    if (likely(s->fixed_bufs_tried)) {
+        return;
+    }
+    s->fixed_bufs_tried = true;
+
+    QEMU_LOCK_GUARD(&luring_fixed.lock);
+
+    ret = io_uring_register_buffers_sparse(&s->ring, MAX_FIXED_BUFS);
+    if (ret == 0) {
+        s->fixed_bufs = true;
+        QLIST_FOREACH(reg, &luring_fixed.regs, next) {
+            ret = luring_fixed_update(s, reg, false);
+            if (ret < 0) {
+                io_uring_unregister_buffers(&s->ring);
+                s->fixed_bufs = false;
+                break;
+            }
+        }
+    }
+    trace_luring_enable_fixed_bufs(s, ret);
+}
+
+/**
+ * luring_register_buf:
+ *
+ * Register @host with the rings that use fixed buffers, present and
+ * future, so that I/O requests for single buffers within it use fixed
+ * buffer operations.  Registrations are reference counted.  Buffers that
+ * cannot be registered are simply accessed as usual.
+ *
+ * The pages stay pinned by the kernel for as long as they are registered,
+ * so discarding RAM (balloon, virtio-mem) is disabled in the meantime:
+ * after a discard, the rings would keep doing I/O to the old pages.
+ */
+void luring_register_buf(void *host, size_t size)
+{
+    LuringBufRegistration *reg;
+    LuringState *s, *failed = NULL;
+    unsigned long first;
+    unsigned int nb_slots = DIV_ROUND_UP(size, MAX_FIXED_BUF_SIZE);
+    int ret = 0;
+
+    QEMU_LOCK_GUARD(&luring_fixed.lock);
+
+    QLIST_FOREACH(reg, &luring_fixed.regs, next) {
+        if (reg->host == host && reg->size == size) {
+            reg->refcnt++;
+            return;
+        }
+    }
+
+    first = bitmap_find_next_zero_area(luring_fixed.used_slots,
+                                       MAX_FIXED_BUFS, 0, nb_slots, 0);
+    if (first >= MAX_FIXED_BUFS) {
+        trace_luring_register_buf(host, size, -ENOSPC);
+        return;
+    }
+
+    ret = ram_block_discard_disable(true);
+    if (ret < 0) {
+        trace_luring_register_buf(host, size, ret);
+        return;
+    }
+
+    reg = g_new(LuringBufRegistration, 1);
+    *reg = (LuringBufRegistration) {
+        .host = host,
+        .size = size,
+        .refcnt = 1,
+        .first_slot = first,
+        .nb_slots = nb_slots,
+    };
+
+    QLIST_FOREACH(s, &luring_fixed.rings, next) {
+        if (!s->fixed_bufs) {
+            continue;
+        }
+        ret = luring_fixed_update(s, reg, false);
+        if (ret < 0) {
+            failed = s;
+            break;
+        }
+    }
+    trace_luring_register_buf(host, size, ret);
+
+    if (failed) {
+        /* Undo the rings that were updated, up to @failed included */
+        QLIST_FOREACH(s, &luring_fixed.rings, next) {
+            if (s->fixed_bufs) {
+                luring_fixed_update(s, reg, true);
+            }
+            if (s == failed) {
+                break;
+            }
+        }
+        g_free(reg);
+        ram_block_discard_disable(false);
+        return;
+    }
+
+    bitmap_set(luring_fixed.used_slots, first, nb_slots);
+    QLIST_INSERT_HEAD(&luring_fixed.regs, reg, next);
+    luring_fixed_publish();
+}
+
+void luring_unregister_buf(void *host, size_t size)
+{
+    LuringBufRegistration *reg;
+    LuringState *s;
+
+    QEMU_LOCK_GUARD(&luring_fixed.lock);
+
+    QLIST_FOREACH(reg, &luring_fixed.regs, next) {
+        if (reg->host == host && reg->size == size) {
+            break;
+        }
+    }
+    if (!reg || --reg->refcnt) {
+        return;
+    }
+
+    QLIST_REMOVE(reg, next);
+    luring_fixed_publish();
+
+    QLIST_FOREACH(s, &luring_fixed.rings, next) {
+        if (s->fixed_bufs) {
+            luring_fixed_update(s, reg, true);
+        }
+    }
+    bitmap_clear(luring_fixed.used_slots, reg->first_slot, reg->nb_slots);
+    ram_block_discard_disable(false);
+
+    /* Lookups may still be walking the old table */
+    g_free_rcu(reg, rcu);
+}
+
 /**
  * luring_resubmit:
  *
@@ -90,6 +425,15 @@ static void luring_resubmit_short_read(LuringState *s, LuringAIOCB *luringcb,
     luringcb->total_read += nread;
     remaining = luringcb->qiov->size - luringcb->total_read;
 
+    /* A fixed buffer read covers a single buffer, just move into it */
+    if (luringcb->sqeq.opcode == IORING_OP_READ_FIXED) {
+        luringcb->sqeq.off += nread;
+        luringcb->sqeq.addr += nread;
+        luringcb->sqeq.len = remaining;
+        luring_resubmit(s, luringcb);
+        return;
+    }
+
     /* Shorten qiov */
     resubmit_qiov = &luringcb->resubmit_qiov;
     if (resubmit_qiov->iov == NULL) {
@@ -108,6 +452,18 @@ static void luring_resubmit_short_read(LuringState *s, LuringAIOCB *luringcb,
     luring_resubmit(s, luringcb);
 }
 
+/*
+ * Nothing signals the completions of a ring set up with IORING_SETUP_IOPOLL,
+ * they only appear in the completion queue when io_uring_enter() is asked
+ * for events.  Do one non-blocking pass over the devices.
+ */
+static void luring_iopoll_reap(LuringState *s)
+{
+    if (s->iopoll && s->io_q.in_flight && !io_uring_cq_ready(&s->ring)) {
+        io_uring_enter(s->ring.ring_fd, 0, 0, IORING_ENTER_GETEVENTS, NULL);
+    }
+}
+
 /**
  * luring_process_completions:
  * @s: AIO state
@@ -145,6 +501,8 @@ static void luring_process_completions(LuringState *s)
      */
     qemu_bh_schedule(s->completion_bh);
 
+    luring_iopoll_reap(s);
+
     while (io_uring_peek_cqe(&s->ring, &cqes) == 0) {
         LuringAIOCB *luringcb;
         int ret;
@@ -184,6 +542,9 @@ static void luring_process_completions(LuringState *s)
                 luring_resubmit(s, luringcb);
                 continue;
             }
+        } else if (luringcb->sqeq.opcode == IORING_OP_URING_CMD) {
+            /* The meaning of the result is up to the command */
+            goto end;
         } else if (!luringcb->qiov) {
             goto end;
         } else if (total_bytes == luringcb->qiov->size) {
@@ -221,7 +582,13 @@ end:
         }
     }
 
-    qemu_bh_cancel(s->completion_bh);
+    /*
+     * With IOPOLL, keep the BH scheduled as long as requests are in flight
+     * so that the event loop does not block and goes on reaping them.
+     */
+    if (!s->iopoll || !s->io_q.in_flight) {
+        qemu_bh_cancel(s->completion_bh);
+    }
 
     defer_call_end();
 }
@@ -243,7 +610,8 @@ static int ioq_submit(LuringState *s)
                 break;
             }
             /* Prep sqe for submission */
-            *sqes = luringcb->sqeq;
+            memcpy(sqes, &luringcb->sqeq,
+                   s->sqe128 ? SQE128_SIZE : sizeof(*sqes));
             QSIMPLEQ_REMOVE_HEAD(&s->io_q.submit_queue, next);
         }
         ret = io_uring_submit(&s->ring);
@@ -295,6 +663,7 @@ static bool qemu_luring_poll_cb(void *opaque)
 {
     LuringState *s = opaque;
 
+    luring_iopoll_reap(s);
     return io_uring_cq_ready(&s->ring);
 }
 
@@ -323,6 +692,32 @@ static void luring_deferred_fn(void *opaque)
     }
 }
 
+/*
+ * Queue the request prepared in @luringcb, and submit the queue when it
+ * is full or else at the end of the batch.
+ */
+static int luring_enqueue(LuringState *s, LuringAIOCB *luringcb)
+{
+    int ret;
+
+    io_uring_sqe_set_data(&luringcb->sqeq, luringcb);
+
+    QSIMPLEQ_INSERT_TAIL(&s->io_q.submit_queue, luringcb, next);
+    s->io_q.in_queue++;
+    trace_luring_do_submit(s, s->io_q.blocked, s->io_q.in_queue,
+                           s->io_q.in_flight);
+    if (!s->io_q.blocked) {
+        if (s->io_q.in_flight + s->io_q.in_queue >= MAX_ENTRIES) {
+            ret = ioq_submit(s);
+            trace_luring_do_submit_done(s, ret);
+            return ret;
+        }
+
+        defer_call(luring_deferred_fn, s);
+    }
+    return 0;
+}
+
 /**
  * luring_do_submit:
  * @fd: file descriptor for I/O
@@ -337,11 +732,18 @@ static void luring_deferred_fn(void *opaque)
 static int luring_do_submit(int fd, LuringAIOCB *luringcb, LuringState *s,
                             uint64_t offset, int type)
 {
-    int ret;
+    int buf_index;
     struct io_uring_sqe *sqes = &luringcb->sqeq;
 
     switch (type) {
     case QEMU_AIO_WRITE:
+        buf_index = luring_fixed_lookup(s, luringcb->qiov);
+        if (buf_index >= 0) {
+            io_uring_prep_write_fixed(sqes, fd, luringcb->qiov->iov[0].iov_base,
+                                      luringcb->qiov->iov[0].iov_len,
+                                      offset, buf_index);
+            break;
+        }
         io_uring_prep_writev(sqes, fd, luringcb->qiov->iov,
                              luringcb->qiov->niov, offset);
         break;
@@ -350,6 +752,13 @@ static int luring_do_submit(int fd, LuringAIOCB *luringcb, LuringState *s,
                              luringcb->qiov->niov, offset);
         break;
     case QEMU_AIO_READ:
+        buf_index = luring_fixed_lookup(s, luringcb->qiov);
+        if (buf_index >= 0) {
+            io_uring_prep_read_fixed(sqes, fd, luringcb->qiov->iov[0].iov_base,
+                                     luringcb->qiov->iov[0].iov_len,
+                                     offset, buf_index);
+            break;
+        }
         io_uring_prep_readv(sqes, fd, luringcb->qiov->iov,
                             luringcb->qiov->niov, offset);
         break;
@@ -361,30 +770,16 @@ static int luring_do_submit(int fd, LuringAIOCB *luringcb, LuringState *s,
                         __func__, type);
         abort();
     }
-    io_uring_sqe_set_data(sqes, luringcb);
 
-    QSIMPLEQ_INSERT_TAIL(&s->io_q.submit_queue, luringcb, next);
-    s->io_q.in_queue++;
-    trace_luring_do_submit(s, s->io_q.blocked, s->io_q.in_queue,
-                           s->io_q.in_flight);
-    if (!s->io_q.blocked) {
-        if (s->io_q.in_flight + s->io_q.in_queue >= MAX_ENTRIES) {
-            ret = ioq_submit(s);
-            trace_luring_do_submit_done(s, ret);
-            return ret;
-        }
-
-        defer_call(luring_deferred_fn, s);
-    }
-    return 0;
+    return luring_enqueue(s, luringcb);
 }
 
-int coroutine_fn luring_co_submit(BlockDriverState *bs, int fd, uint64_t offset,
-                                  QEMUIOVector *qiov, int type)
+static int coroutine_fn luring_co_submit_to(LuringState *s,
+                                           BlockDriverState *bs, int fd,
+                                           uint64_t offset, QEMUIOVector *qiov,
+                                           int type)
 {
     int ret;
-    AioContext *ctx = qemu_get_current_aio_context();
-    LuringState *s = aio_get_linux_io_uring(ctx);
     LuringAIOCB luringcb = {
         .co         = qemu_coroutine_self(),
         .ret        = -EINPROGRESS,
@@ -405,6 +800,96 @@ int coroutine_fn luring_co_submit(BlockDriverState *bs, int fd, uint64_t offset,
     return luringcb.ret;
 }
 
+int coroutine_fn luring_co_submit(BlockDriverState *bs, int fd, uint64_t offset,
+                                  QEMUIOVector *qiov, int type)
+{
+    AioContext *ctx = qemu_get_current_aio_context();
+
+    return luring_co_submit_to(aio_get_linux_io_uring(ctx), bs, fd, offset,
+                               qiov, type);
+}
+
+/**
+ * luring_co_submit_iopoll:
+ *
+ * Like luring_co_submit(), but on the IOPOLL ring of the current
+ * AioContext.  Only reads and writes of files opened with O_DIRECT can be
+ * polled; -EOPNOTSUPP is returned if the file does not support polling.
+ */
+int coroutine_fn luring_co_submit_iopoll(BlockDriverState *bs, int fd,
+                                         uint64_t offset, QEMUIOVector *qiov,
+                                         int type)
+{
+    AioContext *ctx = qemu_get_current_aio_context();
+
+    assert(type == QEMU_AIO_READ || type == QEMU_AIO_WRITE);
+    return luring_co_submit_to(aio_get_linux_io_uring_iopoll(ctx), bs, fd,
+                               offset, qiov, type);
+}
+
+#ifdef CONFIG_LINUX_IO_URING_CMD
+/**
+ * luring_co_submit_cmd:
+ * @fd: file descriptor of the device
+ * @cmd_op: command to pass to the driver of @fd
+ * @cmd: driver specific payload of the command, at most 80 bytes
+ * @cmd_len: size of @cmd
+ * @qiov: the data buffers that @cmd refers to, or NULL
+ *
+ * Issue an IORING_OP_URING_CMD command on the command ring of the current
+ * AioContext, which must have been set up with
+ * aio_setup_linux_io_uring_cmd().  @qiov is only used to pass a single
+ * registered buffer as one, the command itself refers to the data.
+ *
+ * Returns: -errno on failure, or else the result of the command as
+ * defined by the driver.
+ */
+int coroutine_fn luring_co_submit_cmd(BlockDriverState *bs, int fd,
+                                      uint32_t cmd_op, const void *cmd,
+                                      size_t cmd_len, QEMUIOVector *qiov)
+{
+    int ret;
+    AioContext *ctx = qemu_get_current_aio_context();
+    LuringState *s = aio_get_linux_io_uring_cmd(ctx);
+    LuringAIOCB luringcb = {
+        .co         = qemu_coroutine_self(),
+        .ret        = -EINPROGRESS,
+    };
+    struct io_uring_sqe *sqe = &luringcb.sqeq;
+
+    assert(s->sqe128);
+    assert(cmd_len <= SQE128_SIZE - offsetof(struct io_uring_sqe, cmd));
+
+    trace_luring_co_submit_cmd(bs, s, &luringcb, fd, cmd_op,
+                               qiov ? qiov->size : 0);
+
+    io_uring_prep_rw(IORING_OP_URING_CMD, sqe, fd, NULL, 0, 0);
+    sqe->cmd_op = cmd_op;
+    memcpy(sqe->cmd, cmd, cmd_len);
+
+#ifdef IORING_URING_CMD_FIXED
+    if (qiov) {
+        int buf_index = luring_fixed_lookup(s, qiov);
+
+        if (buf_index >= 0) {
+            sqe->uring_cmd_flags = IORING_URING_CMD_FIXED;
+            sqe->buf_index = buf_index;
+        }
+    }
+#endif
+
+    ret = luring_enqueue(s, &luringcb);
+    if (ret < 0) {
+        return ret;
+    }
+
+    if (luringcb.ret == -EINPROGRESS) {
+        qemu_coroutine_yield();
+    }
+    return luringcb.ret;
+}
+#endif
+
 void luring_detach_aio_context(LuringState *s, AioContext *old_context)
 {
     aio_set_fd_handler(old_context, s->ring.ring_fd,
@@ -422,15 +907,59 @@ void luring_attach_aio_context(LuringState *s, AioContext *new_context)
                        qemu_luring_poll_cb, qemu_luring_poll_ready, s);
 }
 
-LuringState *luring_init(Error **errp)
+/**
+ * luring_init:
+ * @sqpoll_idle: milliseconds after which the submission queue polling
+ *               thread goes idle, or 0 not to use one
+ * @iopoll: set up a ring for polled reads and writes
+ * @cmd: set up a ring with the 128-byte entries of IORING_OP_URING_CMD
+ *
+ * Bigger entries make every submission and completion more expensive, so
+ * only rings that carry passthrough commands use them.
+ */
+LuringState *luring_init(int64_t sqpoll_idle, bool iopoll, bool cmd,
+                         Error **errp)
 {
-    int rc;
+    int rc = -EINVAL;
     LuringState *s = g_new0(LuringState, 1);
     struct io_uring *ring = &s->ring;
 
     trace_luring_init_state(s, sizeof(*s));
 
-    rc = io_uring_queue_init(MAX_ENTRIES, ring, 0);
+    assert(!(iopoll && cmd));
+    assert(!cmd || URING_CMD_SETUP_FLAGS);
+    if (iopoll) {
+        /* Only reads and writes go to a polled ring, keep it simple */
+        rc = io_uring_queue_init(MAX_ENTRIES, ring, IORING_SETUP_IOPOLL);
+        trace_luring_init_iopoll(s, rc);
+        s->iopoll = true;
+    }
+
+    /*
+     * With a kernel thread polling the submission queue, submitting is
+     * just writing to the ring as long as the thread is busy.  Older
+     * kernels only let privileged users do that.
+     */
+    for (int i = 0; i < 2 && rc < 0 && !iopoll; i++) {
+        bool sqpoll = i == 0;
+        struct io_uring_params params = {
+            .flags = cmd ? URING_CMD_SETUP_FLAGS : 0,
+        };
+
+        if (sqpoll && !sqpoll_idle) {
+            continue;
+        }
+        if (sqpoll) {
+            params.flags |= IORING_SETUP_SQPOLL;
+            params.sq_thread_idle = MIN(sqpoll_idle, UINT32_MAX);
+        }
+
+        rc = io_uring_queue_init_params(MAX_ENTRIES, ring, &params);
+        if (sqpoll) {
+            trace_luring_init_sqpoll(s, sqpoll_idle, rc);
+        }
+    }
+    s->sqe128 = cmd;
     if (rc < 0) {
         error_setg_errno(errp, -rc, "failed to init linux io_uring ring");
         g_free(s);
@@ -438,12 +967,18 @@ LuringState *luring_init(Error **errp)
     }
 
     ioq_init(&s->io_q);
+    WITH_QEMU_LOCK_GUARD(&luring_fixed.lock) {
+        QLIST_INSERT_HEAD(&luring_fixed.rings, s, next);
+    }
     return s;
 
 }
 
 void luring_cleanup(LuringState *s)
 {
+    WITH_QEMU_LOCK_GUARD(&luring_fixed.lock) {
+        QLIST_REMOVE(s, next);
+    }
     io_uring_queue_exit(&s->ring);
     trace_luring_cleanup_state(s);
     g_free(s);
@@ -24,18 +24,25 @@
 #include <libaio.h>
 
 /*
- * Queue size (per-device).
+ * Size of each io_context.
  *
- * XXX: eventually we need to communicate this to the guest and/or make it
- *      tunable by the guest.  If we get more outstanding requests at a time
- *      than this we will get EAGAIN from io_submit which is communicated to
- *      the guest as an I/O error.
+ * One io_context is created up front.  When all of them are full, another
+ * one is created, up to MAX_RINGS.  The requests that do not fit then wait
+ * in the pending queue until earlier ones complete.
  */
 #define MAX_EVENTS 1024
+#define MAX_RINGS 8
 
 /* Maximum number of requests in a batch. (default value) */
 #define DEFAULT_MAX_BATCH 32
 
+typedef struct {
+    io_context_t ctx;
+    unsigned int in_flight;
+    int event_idx;
+    int event_max;
+} LaioRing;
+
 struct qemu_laiocb {
     Coroutine *co;
     LinuxAioState *ctx;
@@ -57,14 +64,16 @@ typedef struct {
 struct LinuxAioState {
     AioContext *aio_context;
 
-    io_context_t ctx;
+    /* All the io_contexts complete to the same eventfd */
     EventNotifier e;
 
     /* No locking required, only accessed from AioContext home thread */
+    LaioRing rings[MAX_RINGS];
+    int nr_rings;
+    /* Lowered if io_setup() fails, e.g. because of fs.aio-max-nr */
+    int max_rings;
     LaioQueue io_q;
     QEMUBH *completion_bh;
-    int event_idx;
-    int event_max;
 };
 
 static void ioq_submit(LinuxAioState *s);
@@ -197,43 +206,50 @@ io_getevents_advance_and_peek(io_context_t ctx,
  *
  * The function is somewhat tricky because it supports nested event loops, for
  * example when a request callback invokes aio_poll().  In order to do this,
- * indices are kept in LinuxAioState.  Function schedules BH completion so it
+ * indices are kept in LaioRing.  Function schedules BH completion so it
  * can be called again in a nested event loop.  When there are no events left
  * to complete the BH is being canceled.
  */
 static void qemu_laio_process_completions(LinuxAioState *s)
 {
     struct io_event *events;
+    int i;
 
     defer_call_begin();
 
     /* Reschedule so nested event loops see currently pending completions */
     qemu_bh_schedule(s->completion_bh);
 
-    while ((s->event_max = io_getevents_advance_and_peek(s->ctx, &events,
-                                                         s->event_idx))) {
-        for (s->event_idx = 0; s->event_idx < s->event_max; ) {
-            struct iocb *iocb = events[s->event_idx].obj;
-            struct qemu_laiocb *laiocb =
-                container_of(iocb, struct qemu_laiocb, iocb);
+    for (i = 0; i < s->nr_rings; i++) {
+        LaioRing *r = &s->rings[i];
+
+        while ((r->event_max = io_getevents_advance_and_peek(r->ctx, &events,
+                                                             r->event_idx))) {
+            for (r->event_idx = 0; r->event_idx < r->event_max; ) {
+                struct iocb *iocb = events[r->event_idx].obj;
+                struct qemu_laiocb *laiocb =
+                    container_of(iocb, struct qemu_laiocb, iocb);
 
-            laiocb->ret = io_event_ret(&events[s->event_idx]);
+                laiocb->ret = io_event_ret(&events[r->event_idx]);
 
-            /* Change counters one-by-one because we can be nested. */
-            s->io_q.in_flight--;
-            s->event_idx++;
-            qemu_laio_process_completion(laiocb);
+                /* Change counters one-by-one because we can be nested. */
+                r->in_flight--;
+                s->io_q.in_flight--;
+                r->event_idx++;
+                qemu_laio_process_completion(laiocb);
+            }
         }
+
+        /* If we are nested we have to notify the level above that we are
+         * done by setting event_max to zero, upper level will then jump out
+         * of it's own `for` loop.  The events up to event_idx have been
+         * committed already. */
+        r->event_max = 0;
+        r->event_idx = 0;
     }
 
     qemu_bh_cancel(s->completion_bh);
 
-    /* If we are nested we have to notify the level above that we are done
-     * by setting event_max to zero, upper level will then jump out of it's
-     * own `for` loop.  If we are the last all counters dropped to zero. */
-    s->event_max = 0;
-    s->event_idx = 0;
-
     defer_call_end();
 }
 
@@ -267,8 +283,14 @@ static bool qemu_laio_poll_cb(void *opaque)
     EventNotifier *e = opaque;
     LinuxAioState *s = container_of(e, LinuxAioState, e);
     struct io_event *events;
+    int i;
 
-    return io_getevents_peek(s->ctx, &events);
+    for (i = 0; i < s->nr_rings; i++) {
+        if (io_getevents_peek(s->rings[i].ctx, &events)) {
+            return true;
+        }
+    }
+    return false;
 }
 
 static void qemu_laio_poll_ready(EventNotifier *opaque)
@@ -287,26 +309,55 @@ static void ioq_init(LaioQueue *io_q)
     io_q->blocked = false;
 }
 
+static int laio_ring_init(LaioRing *r)
+{
+    *r = (LaioRing) { 0 };
+    return io_setup(MAX_EVENTS, &r->ctx);
+}
+
+/* Return an io_context with free events, creating one if needed */
+static LaioRing *laio_get_ring(LinuxAioState *s)
+{
+    int i;
+
+    for (i = 0; i < s->nr_rings; i++) {
+        if (s->rings[i].in_flight < MAX_EVENTS) {
+            return &s->rings[i];
+        }
+    }
+
+    if (s->nr_rings == s->max_rings) {
+        return NULL;
+    }
+    if (laio_ring_init(&s->rings[s->nr_rings]) < 0) {
+        s->max_rings = s->nr_rings;
+        return NULL;
+    }
+    return &s->rings[s->nr_rings++];
+}
+
 static void ioq_submit(LinuxAioState *s)
 {
     int ret, len;
     struct qemu_laiocb *aiocb;
     struct iocb *iocbs[MAX_EVENTS];
     QSIMPLEQ_HEAD(, qemu_laiocb) completed;
+    LaioRing *r;
 
     do {
-        if (s->io_q.in_flight >= MAX_EVENTS) {
+        r = laio_get_ring(s);
+        if (!r) {
             break;
         }
         len = 0;
         QSIMPLEQ_FOREACH(aiocb, &s->io_q.pending, next) {
             iocbs[len++] = &aiocb->iocb;
-            if (s->io_q.in_flight + len >= MAX_EVENTS) {
+            if (r->in_flight + len >= MAX_EVENTS) {
                 break;
             }
         }
 
-        ret = io_submit(s->ctx, len, iocbs);
+        ret = io_submit(r->ctx, len, iocbs);
         if (ret == -EAGAIN) {
             break;
         }
@@ -320,6 +371,7 @@ static void ioq_submit(LinuxAioState *s)
             continue;
         }
 
+        r->in_flight += ret;
         s->io_q.in_flight += ret;
         s->io_q.in_queue  -= ret;
         aiocb = container_of(iocbs[ret - 1], struct qemu_laiocb, iocb);
@@ -353,7 +405,8 @@ static uint64_t laio_max_batch(LinuxAioState *s, uint64_t dev_max_batch)
     max_batch = MIN_NON_ZERO(dev_max_batch, max_batch);
 
     /* limit the batch with the number of available events */
-    max_batch = MIN_NON_ZERO(MAX_EVENTS - s->io_q.in_flight, max_batch);
+    max_batch = MIN_NON_ZERO(s->max_rings * MAX_EVENTS - s->io_q.in_flight,
+                             max_batch);
 
     return max_batch;
 }
@@ -459,11 +512,13 @@ LinuxAioState *laio_init(Error **errp)
         goto out_free_state;
     }
 
-    rc = io_setup(MAX_EVENTS, &s->ctx);
+    rc = laio_ring_init(&s->rings[0]);
     if (rc < 0) {
         error_setg_errno(errp, -rc, "failed to create linux AIO context");
         goto out_close_efd;
     }
+    s->nr_rings = 1;
+    s->max_rings = MAX_RINGS;
 
     ioq_init(&s->io_q);
 
@@ -478,11 +533,15 @@ out_free_state:
 
 void laio_cleanup(LinuxAioState *s)
 {
+    int i;
+
     event_notifier_cleanup(&s->e);
 
-    if (io_destroy(s->ctx) != 0) {
-        fprintf(stderr, "%s: destroy AIO context %p failed\n",
-                        __func__, &s->ctx);
+    for (i = 0; i < s->nr_rings; i++) {
+        if (io_destroy(s->rings[i].ctx) != 0) {
+            fprintf(stderr, "%s: destroy AIO context %p failed\n",
+                            __func__, &s->rings[i].ctx);
+        }
     }
     g_free(s);
 }
@@ -0,0 +1,485 @@
+/*
+ * Request merging filter driver
+ *
+ * Requests that come in at most a few hundred microseconds apart and that
+ * are adjacent to each other are submitted to the child as one request.
+ * This cuts the per-request overhead of storage for which it is high, like
+ * rotating disks or network protocols, also for devices that do not merge
+ * requests themselves or only merge the requests of one notification.
+ *
+ * The first request of a batch waits for the merge window to expire, the
+ * requests joining it during the window wait for it to complete.  Reads
+ * that lie entirely within a pending read batch are served from its data.
+ * Overlapping writes are never merged, they are submitted separately.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "block/block-io.h"
+#include "block/block_int.h"
+#include "qapi/error.h"
+#include "qapi/qapi-types-block-core.h"
+#include "qemu/coroutine.h"
+#include "qemu/module.h"
+#include "qemu/option.h"
+#include "qemu/stats64.h"
+#include "qemu/units.h"
+#include "trace.h"
+
+#define MERGE_OPT_WINDOW "window"
+#define MERGE_OPT_MAX_BYTES "max-bytes"
+
+#define MERGE_DEFAULT_WINDOW_US 100
+#define MERGE_DEFAULT_MAX_BYTES (1 * MiB)
+
+typedef struct MergeReq {
+    int64_t offset;
+    int64_t bytes;
+    QEMUIOVector *qiov;
+    size_t qiov_offset;
+
+    bool done;
+    int ret;
+
+    QTAILQ_ENTRY(MergeReq) next;
+} MergeReq;
+
+typedef struct MergeBatch {
+    bool write;
+    BdrvRequestFlags flags;
+    int64_t offset;
+    int64_t bytes;
+    int niov;
+
+    /* Requests making up the batch, sorted by offset */
+    QTAILQ_HEAD(, MergeReq) reqs;
+    /* Reads that are contained in the batch and only need a copy of it */
+    QTAILQ_HEAD(, MergeReq) dups;
+
+    /* Requests other than the first one wait here for completion */
+    CoQueue waiters;
+
+    QLIST_ENTRY(MergeBatch) next;
+} MergeBatch;
+
+typedef struct BDRVMergeState {
+    int64_t window_ns;
+    int64_t max_bytes;
+
+    /* Protects @batches and the requests and waiters of its batches */
+    QemuMutex lock;
+    /* Batches that are still open for new requests */
+    QLIST_HEAD(, MergeBatch) batches;
+
+    Stat64 requests;
+    Stat64 merged_requests;
+    Stat64 merged_batches;
+} BDRVMergeState;
+
+static QemuOptsList merge_runtime_opts = {
+    .name = "merge",
+    .head = QTAILQ_HEAD_INITIALIZER(merge_runtime_opts.head),
+    .desc = {
+        {
+            .name = MERGE_OPT_WINDOW,
+            .type = QEMU_OPT_NUMBER,
+            .help = "time to wait for requests to merge, in microseconds "
+                    "(default: 100)",
+        },
+        {
+            .name = MERGE_OPT_MAX_BYTES,
+            .type = QEMU_OPT_SIZE,
+            .help = "maximum size of a merged request (default: 1M)",
+        },
+        { /* end of list */ }
+    },
+};
+
+static int merge_parse_options(QDict *options, int64_t *window_ns,
+                               int64_t *max_bytes, Error **errp)
+{
+    QemuOpts *opts = qemu_opts_create(&merge_runtime_opts, NULL, 0,
+                                      &error_abort);
+    uint64_t window_us;
+    uint64_t max;
+    int ret = -EINVAL;
+
+    if (!qemu_opts_absorb_qdict(opts, options, errp)) {
+        goto out;
+    }
+
+    window_us = qemu_opt_get_number(opts, MERGE_OPT_WINDOW,
+                                    MERGE_DEFAULT_WINDOW_US);
+    if (window_us > 1000 * 1000) {
+        error_setg(errp, "'" MERGE_OPT_WINDOW "' must be at most 1000000");
+        goto out;
+    }
+
+    max = qemu_opt_get_size(opts, MERGE_OPT_MAX_BYTES,
+                            MERGE_DEFAULT_MAX_BYTES);
+    if (max < BDRV_SECTOR_SIZE || max > BDRV_REQUEST_MAX_BYTES) {
+        error_setg(errp, "'" MERGE_OPT_MAX_BYTES "' must be between %llu "
+                   "and %" PRIu64, BDRV_SECTOR_SIZE,
+                   (uint64_t)BDRV_REQUEST_MAX_BYTES);
+        goto out;
+    }
+
+    *window_ns = window_us * SCALE_US;
+    *max_bytes = max;
+    ret = 0;
+out:
+    qemu_opts_del(opts);
+    return ret;
+}
+
+static int merge_open(BlockDriverState *bs, QDict *options, int flags,
+                      Error **errp)
+{
+    BDRVMergeState *s = bs->opaque;
+    int ret;
+
+    ret = bdrv_open_file_child(NULL, options, "file", bs, errp);
+    if (ret < 0) {
+        return ret;
+    }
+
+    ret = merge_parse_options(options, &s->window_ns, &s->max_bytes, errp);
+    if (ret < 0) {
+        return ret;
+    }
+
+    GRAPH_RDLOCK_GUARD_MAINLOOP();
+
+    bs->supported_write_flags = bs->file->bs->supported_write_flags |
+                                BDRV_REQ_WRITE_UNCHANGED;
+    bs->supported_zero_flags = bs->file->bs->supported_zero_flags |
+                               BDRV_REQ_WRITE_UNCHANGED;
+
+    qemu_mutex_init(&s->lock);
+    QLIST_INIT(&s->batches);
+
+    return 0;
+}
+
+static void merge_close(BlockDriverState *bs)
+{
+    BDRVMergeState *s = bs->opaque;
+
+    assert(QLIST_EMPTY(&s->batches));
+    qemu_mutex_destroy(&s->lock);
+}
+
+/*
+ * Try to add @req to an open batch.  Returns the batch, or NULL if @req
+ * cannot be merged with any.  Called with s->lock held.
+ */
+static MergeBatch *merge_join_batch(BDRVMergeState *s, bool write,
+                                    BdrvRequestFlags flags, MergeReq *req)
+{
+    int64_t end = req->offset + req->bytes;
+    int niov = req->qiov->niov;
+    MergeBatch *b;
+
+    QLIST_FOREACH(b, &s->batches, next) {
+        int64_t b_end = b->offset + b->bytes;
+
+        if (b->write != write || b->flags != flags) {
+            continue;
+        }
+
+        if (!write && req->offset >= b->offset && end <= b_end) {
+            QTAILQ_INSERT_TAIL(&b->dups, req, next);
+            return b;
+        }
+
+        if (b->bytes + req->bytes > s->max_bytes ||
+            b->niov + niov > IOV_MAX) {
+            continue;
+        }
+
+        if (req->offset == b_end) {
+            QTAILQ_INSERT_TAIL(&b->reqs, req, next);
+        } else if (end == b->offset) {
+            QTAILQ_INSERT_HEAD(&b->reqs, req, next);
+            b->offset = req->offset;
+        } else {
+            continue;
+        }
+        b->bytes += req->bytes;
+        b->niov += niov;
+        return b;
+    }
+
+    return NULL;
+}
+
+/* Submit the batch @b, which the caller already removed from s->batches */
+static int coroutine_fn GRAPH_RDLOCK
+merge_submit_batch(BlockDriverState *bs, MergeBatch *b)
+{
+    BDRVMergeState *s = bs->opaque;
+    MergeReq *req = QTAILQ_FIRST(&b->reqs);
+    QEMUIOVector qiov;
+    unsigned nr_reqs = 0;
+    int ret;
+
+    if (!QTAILQ_NEXT(req, next)) {
+        qemu_iovec_init_slice(&qiov, req->qiov, req->qiov_offset, req->bytes);
+        nr_reqs = 1;
+    } else {
+        qemu_iovec_init(&qiov, b->niov);
+        QTAILQ_FOREACH(req, &b->reqs, next) {
+            qemu_iovec_concat(&qiov, req->qiov, req->qiov_offset, req->bytes);
+            nr_reqs++;
+        }
+        stat64_inc(&s->merged_batches);
+    }
+
+    trace_merge_submit(bs, b->write, b->offset, b->bytes, nr_reqs);
+
+    if (b->write) {
+        ret = bdrv_co_pwritev(bs->file, b->offset, b->bytes, &qiov, b->flags);
+    } else {
+        ret = bdrv_co_preadv(bs->file, b->offset, b->bytes, &qiov, b->flags);
+    }
+
+    if (ret >= 0 && !QTAILQ_EMPTY(&b->dups)) {
+        /* Nothing can join the batch any more, no need for the lock */
+        QTAILQ_FOREACH(req, &b->dups, next) {
+            g_autofree void *buf = g_malloc(req->bytes);
+
+            qemu_iovec_to_buf(&qiov, req->offset - b->offset, buf, req->bytes);
+            qemu_iovec_from_buf(req->qiov, req->qiov_offset, buf, req->bytes);
+        }
+    }
+
+    qemu_iovec_destroy(&qiov);
+    return ret;
+}
+
+static int coroutine_fn GRAPH_RDLOCK
+merge_co_rw(BlockDriverState *bs, bool write, int64_t offset, int64_t bytes,
+            QEMUIOVector *qiov, size_t qiov_offset, BdrvRequestFlags flags)
+{
+    BDRVMergeState *s = bs->opaque;
+    MergeReq req = {
+        .offset = offset,
+        .bytes = bytes,
+        .qiov = qiov,
+        .qiov_offset = qiov_offset,
+    };
+    MergeReq *r;
+    MergeBatch *b;
+    int ret;
+
+    stat64_inc(&s->requests);
+
+    if (!s->window_ns || bytes >= s->max_bytes || qiov->niov > IOV_MAX / 2) {
+        goto direct;
+    }
+
+    qemu_mutex_lock(&s->lock);
+    b = merge_join_batch(s, write, flags, &req);
+    if (b) {
+        while (!req.done) {
+            qemu_co_queue_wait(&b->waiters, &s->lock);
+        }
+        qemu_mutex_unlock(&s->lock);
+        stat64_inc(&s->merged_requests);
+        return req.ret;
+    }
+
+    b = g_new(MergeBatch, 1);
+    *b = (MergeBatch) {
+        .write = write,
+        .flags = flags,
+        .offset = offset,
+        .bytes = bytes,
+        .niov = qiov->niov,
+    };
+    QTAILQ_INIT(&b->reqs);
+    QTAILQ_INIT(&b->dups);
+    QTAILQ_INSERT_TAIL(&b->reqs, &req, next);
+    qemu_co_queue_init(&b->waiters);
+    QLIST_INSERT_HEAD(&s->batches, b, next);
+    qemu_mutex_unlock(&s->lock);
+
+    qemu_co_sleep_ns(QEMU_CLOCK_REALTIME, s->window_ns);
+
+    qemu_mutex_lock(&s->lock);
+    QLIST_REMOVE(b, next);
+    qemu_mutex_unlock(&s->lock);
+
+    ret = merge_submit_batch(bs, b);
+
+    qemu_mutex_lock(&s->lock);
+    QTAILQ_FOREACH(r, &b->reqs, next) {
+        r->ret = ret;
+        r->done = true;
+    }
+    QTAILQ_FOREACH(r, &b->dups, next) {
+        r->ret = ret;
+        r->done = true;
+    }
+    qemu_co_queue_restart_all(&b->waiters);
+    qemu_mutex_unlock(&s->lock);
+
+    g_free(b);
+    return ret;
+
+direct:
+    if (write) {
+        return bdrv_co_pwritev_part(bs->file, offset, bytes, qiov, qiov_offset,
+                                    flags);
+    } else {
+        return bdrv_co_preadv_part(bs->file, offset, bytes, qiov, qiov_offset,
+                                   flags);
+    }
+}
+
+static int64_t coroutine_fn GRAPH_RDLOCK
+merge_co_getlength(BlockDriverState *bs)
+{
+    return bdrv_co_getlength(bs->file->bs);
+}
+
+static int coroutine_fn GRAPH_RDLOCK
+merge_co_preadv_part(BlockDriverState *bs, int64_t offset, int64_t bytes,
+                     QEMUIOVector *qiov, size_t qiov_offset,
+                     BdrvRequestFlags flags)
+{
+    return merge_co_rw(bs, false, offset, bytes, qiov, qiov_offset, flags);
+}
+
+static int coroutine_fn GRAPH_RDLOCK
+merge_co_pwritev_part(BlockDriverState *bs, int64_t offset, int64_t bytes,
+                      QEMUIOVector *qiov, size_t qiov_offset,
+                      BdrvRequestFlags flags)
+{
+    return merge_co_rw(bs, true, offset, bytes, qiov, qiov_offset, flags);
+}
+
+static int coroutine_fn GRAPH_RDLOCK
+merge_co_pwrite_zeroes(BlockDriverState *bs, int64_t offset, int64_t bytes,
+                       BdrvRequestFlags flags)
+{
+    return bdrv_co_pwrite_zeroes(bs->file, offset, bytes, flags);
+}
+
+static int coroutine_fn GRAPH_RDLOCK
+merge_co_pdiscard(BlockDriverState *bs, int64_t offset, int64_t bytes)
+{
+    return bdrv_co_pdiscard(bs->file, offset, bytes);
+}
+
+static int coroutine_fn GRAPH_RDLOCK
+merge_co_pwritev_compressed(BlockDriverState *bs, int64_t offset,
+                            int64_t bytes, QEMUIOVector *qiov)
+{
+    return bdrv_co_pwritev(bs->file, offset, bytes, qiov,
+                           BDRV_REQ_WRITE_COMPRESSED);
+}
+
+static int coroutine_fn GRAPH_RDLOCK merge_co_flush(BlockDriverState *bs)
+{
+    return bdrv_co_flush(bs->file->bs);
+}
+
+static BlockStatsSpecific *merge_get_specific_stats(BlockDriverState *bs)
+{
+    BlockStatsSpecific *stats = g_new(BlockStatsSpecific, 1);
+    BDRVMergeState *s = bs->opaque;
+
+    stats->driver = BLOCKDEV_DRIVER_MERGE;
+    stats->u.merge = (BlockStatsSpecificMerge) {
+        .requests = stat64_get(&s->requests),
+        .merged_requests = stat64_get(&s->merged_requests),
+        .merged_batches = stat64_get(&s->merged_batches),
+    };
+
+    return stats;
+}
+
+typedef struct MergeReopenState {
+    int64_t window_ns;
+    int64_t max_bytes;
+} MergeReopenState;
+
+static int merge_reopen_prepare(BDRVReopenState *reopen_state,
+                                BlockReopenQueue *queue, Error **errp)
+{
+    MergeReopenState *rs = g_new(MergeReopenState, 1);
+    int ret;
+
+    ret = merge_parse_options(reopen_state->options, &rs->window_ns,
+                              &rs->max_bytes, errp);
+    if (ret < 0) {
+        g_free(rs);
+        return ret;
+    }
+    reopen_state->opaque = rs;
+    return 0;
+}
+
+static void merge_reopen_commit(BDRVReopenState *reopen_state)
+{
+    BDRVMergeState *s = reopen_state->bs->opaque;
+    MergeReopenState *rs = reopen_state->opaque;
+
+    /* The node is drained, there are no batches */
+    s->window_ns = rs->window_ns;
+    s->max_bytes = rs->max_bytes;
+
+    g_free(reopen_state->opaque);
+    reopen_state->opaque = NULL;
+}
+
+static void merge_reopen_abort(BDRVReopenState *reopen_state)
+{
+    g_free(reopen_state->opaque);
+    reopen_state->opaque = NULL;
+}
+
+static const char *const merge_strong_runtime_opts[] = {
+    MERGE_OPT_WINDOW,
+    MERGE_OPT_MAX_BYTES,
+
+    NULL
+};
+
+static BlockDriver bdrv_merge = {
+    .format_name                        = "merge",
+    .instance_size                      = sizeof(BDRVMergeState),
+
+    .bdrv_open                          = merge_open,
+    .bdrv_close                         = merge_close,
+    .bdrv_co_flush                      = merge_co_flush,
+
+    .bdrv_child_perm                    = bdrv_default_perms,
+
+    .bdrv_co_getlength                  = merge_co_getlength,
+
+    .bdrv_co_preadv_part                = merge_co_preadv_part,
+    .bdrv_co_pwritev_part               = merge_co_pwritev_part,
+    .bdrv_co_pwrite_zeroes              = merge_co_pwrite_zeroes,
+    .bdrv_co_pdiscard                   = merge_co_pdiscard,
+    .bdrv_co_pwritev_compressed         = merge_co_pwritev_compressed,
+
+    .bdrv_get_specific_stats            = merge_get_specific_stats,
+
+    .bdrv_reopen_prepare                = merge_reopen_prepare,
+    .bdrv_reopen_commit                 = merge_reopen_commit,
+    .bdrv_reopen_abort                  = merge_reopen_abort,
+
+    .is_filter                          = true,
+    .strong_runtime_opts                = merge_strong_runtime_opts,
+};
+
+static void bdrv_merge_init(void)
+{
+    bdrv_register(&bdrv_merge);
+}
+
+block_init(bdrv_merge_init);
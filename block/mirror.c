@@ -18,6 +18,7 @@
 #include "trace.h"
 #include "block/blockjob_int.h"
 #include "block/block_int.h"
+#include "block/copy-adapt.h"
 #include "block/dirty-bitmap.h"
 #include "sysemu/block-backend.h"
 #include "qapi/error.h"
@@ -44,6 +45,8 @@ typedef struct MirrorBlockJob {
     BlockDriverState *mirror_top_bs;
     BlockDriverState *base;
     BlockDriverState *base_overlay;
+    /* If set, only the data that is dirty in this bitmap of the source */
+    BdrvDirtyBitmap *sync_bitmap;
 
     /* The name of the graph node to replace */
     char *replaces;
@@ -91,6 +94,13 @@ typedef struct MirrorBlockJob {
     bool initial_zeroing_ongoing;
     int in_active_write_counter;
     int64_t active_write_bytes_in_flight;
+    /* Size and number of background copies from their latency and speed */
+    CopyAdapt adapt;
+    /*
+     * Offload background copies to the storage (x-perf.use-copy-range)
+     * until that fails once
+     */
+    bool use_copy_range;
     bool prepared;
     bool in_drain;
 } MirrorBlockJob;
@@ -114,6 +124,8 @@ struct MirrorOp {
     bool is_pseudo_op;
     bool is_active_write;
     bool is_in_flight;
+    /* Set by mirror_co_read() when the copy starts */
+    int64_t start_ns;
     CoQueue waiting_requests;
     Coroutine *co;
     MirrorOp *waiting_for_op;
@@ -217,6 +229,11 @@ static void coroutine_fn mirror_iteration_done(MirrorOp *op, int ret)
     bitmap_clear(s->in_flight_bitmap, chunk_num, nb_chunks);
     QTAILQ_REMOVE(&s->ops_in_flight, op, next);
     if (ret >= 0) {
+        if (op->start_ns) {
+            copy_adapt_account(&s->adapt, op->bytes,
+                               qemu_clock_get_ns(QEMU_CLOCK_REALTIME) -
+                               op->start_ns);
+        }
         if (s->cow_bitmap) {
             bitmap_set(s->cow_bitmap, chunk_num, nb_chunks);
         }
@@ -264,6 +281,18 @@ static void coroutine_fn mirror_read_complete(MirrorOp *op, int ret)
         return;
     }
 
+    /*
+     * Block status does not catch data that merely happens to be zero, do
+     * not make the target allocate it.
+     */
+    if (qemu_iovec_is_zero(&op->qiov, 0, op->qiov.size)) {
+        trace_mirror_zero_detected(s, op->offset, op->qiov.size);
+        ret = blk_co_pwrite_zeroes(s->target, op->offset, op->qiov.size,
+                                   s->unmap ? BDRV_REQ_MAY_UNMAP : 0);
+        mirror_write_complete(op, ret);
+        return;
+    }
+
     ret = blk_co_pwritev(s->target, op->offset, op->qiov.size, &op->qiov, 0);
     mirror_write_complete(op, ret);
 }
@@ -312,6 +341,19 @@ static int coroutine_fn mirror_cow_align(MirrorBlockJob *s, int64_t *offset,
     return ret;
 }
 
+/* Number of background operations that may be in flight */
+static unsigned mirror_max_in_flight(MirrorBlockJob *s)
+{
+    /*
+     * In write-blocking mode guest writes wait for their copy to the target
+     * to complete, leave them most of the bandwidth.
+     */
+    if (s->in_active_write_counter) {
+        return MAX(s->adapt.workers / 4, 1);
+    }
+    return s->adapt.workers;
+}
+
 static inline void coroutine_fn
 mirror_wait_for_free_in_flight_slot(MirrorBlockJob *s)
 {
@@ -335,6 +377,45 @@ mirror_wait_for_free_in_flight_slot(MirrorBlockJob *s)
     abort();
 }
 
+/*
+ * Let the storage copy the data of @op instead of reading and writing it.
+ * Unlike with a read, the data is not checked for zeroes: only block status
+ * tells zero areas apart, in mirror_iteration().
+ *
+ * Returns false if the copy could not be offloaded.  Offloading is not
+ * tried again then, and @op must be copied with a read and a write.
+ */
+static bool coroutine_fn mirror_co_copy_range(MirrorOp *op)
+{
+    MirrorBlockJob *s = op->s;
+    int ret;
+
+    s->in_flight++;
+    s->bytes_in_flight += op->bytes;
+    op->is_in_flight = true;
+    op->start_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    trace_mirror_one_iteration(s, op->offset, op->bytes);
+
+    WITH_GRAPH_RDLOCK_GUARD() {
+        ret = blk_co_copy_range_from_child(s->mirror_top_bs->backing,
+                                           op->offset, s->target, op->offset,
+                                           op->bytes, 0, 0);
+    }
+    if (ret < 0) {
+        /* Unsupported, or a real error that the read or write reports */
+        trace_mirror_copy_range_fail(s, op->offset, ret);
+        s->use_copy_range = false;
+        s->in_flight--;
+        s->bytes_in_flight -= op->bytes;
+        op->is_in_flight = false;
+        op->start_ns = 0;
+        return false;
+    }
+
+    mirror_write_complete(op, ret);
+    return true;
+}
+
 /* Perform a mirror copy operation.
  *
  * *op->bytes_handled is set to the number of bytes copied after and
@@ -373,6 +454,10 @@ static void coroutine_fn mirror_co_read(void *opaque)
     assert(QEMU_IS_ALIGNED(op->bytes, BDRV_SECTOR_SIZE));
     nb_chunks = DIV_ROUND_UP(op->bytes, s->granularity);
 
+    if (s->use_copy_range && mirror_co_copy_range(op)) {
+        return;
+    }
+
     while (s->buf_free_count < nb_chunks) {
         trace_mirror_yield_in_flight(s, op->offset, s->in_flight);
         mirror_wait_for_free_in_flight_slot(s);
@@ -395,6 +480,7 @@ static void coroutine_fn mirror_co_read(void *opaque)
     s->in_flight++;
     s->bytes_in_flight += op->bytes;
     op->is_in_flight = true;
+    op->start_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
     trace_mirror_one_iteration(s, op->offset, op->bytes);
 
     WITH_GRAPH_RDLOCK_GUARD() {
@@ -487,7 +573,8 @@ static void coroutine_fn GRAPH_UNLOCKED mirror_iteration(MirrorBlockJob *s)
     /* At least the first dirty chunk is mirrored in one iteration. */
     int nb_chunks = 1;
     bool write_zeroes_ok = bdrv_can_write_zeroes_with_unmap(blk_bs(s->target));
-    int max_io_bytes = MAX(s->buf_size / MAX_IN_FLIGHT, MAX_IO_BYTES);
+    int max_io_bytes = MIN(MAX(s->buf_size / MAX_IN_FLIGHT, MAX_IO_BYTES),
+                           s->adapt.chunk);
 
     bdrv_graph_co_rdlock();
     source = s->mirror_top_bs->backing->bs;
@@ -599,7 +686,7 @@ static void coroutine_fn GRAPH_UNLOCKED mirror_iteration(MirrorBlockJob *s)
             }
         }
 
-        while (s->in_flight >= MAX_IN_FLIGHT) {
+        while (s->in_flight >= mirror_max_in_flight(s)) {
             trace_mirror_yield_in_flight(s, offset, s->in_flight);
             mirror_wait_for_free_in_flight_slot(s);
         }
@@ -692,6 +779,9 @@ static int mirror_exit_common(Job *job)
     }
 
     bdrv_release_dirty_bitmap(s->dirty_bitmap);
+    if (s->sync_bitmap) {
+        bdrv_dirty_bitmap_set_busy(s->sync_bitmap, false);
+    }
 
     /* Make sure that the source BDS doesn't go away during bdrv_replace_node,
      * before we can call bdrv_drained_end */
@@ -897,7 +987,19 @@ static int coroutine_fn GRAPH_UNLOCKED mirror_dirty_init(MirrorBlockJob *s)
         }
 
         assert(count);
-        if (ret > 0) {
+        if (ret > 0 && s->sync_bitmap) {
+            int64_t dirty_start = offset, dirty_count;
+
+            while (bdrv_dirty_bitmap_next_dirty_area(s->sync_bitmap,
+                                                     dirty_start,
+                                                     offset + count, INT64_MAX,
+                                                     &dirty_start,
+                                                     &dirty_count)) {
+                bdrv_set_dirty_bitmap(s->dirty_bitmap, dirty_start,
+                                      dirty_count);
+                dirty_start += dirty_count;
+            }
+        } else if (ret > 0) {
             bdrv_set_dirty_bitmap(s->dirty_bitmap, offset, count);
         }
         offset += count;
@@ -1006,6 +1108,10 @@ static int coroutine_fn mirror_run(Job *job, Error **errp)
     s->max_iov = MIN(bs->bl.max_iov, target_bs->bl.max_iov);
     bdrv_graph_co_rdunlock();
 
+    copy_adapt_init(&s->adapt, s->granularity,
+                    MAX(s->buf_size / MAX_IN_FLIGHT, MAX_IO_BYTES),
+                    MAX_IN_FLIGHT);
+
     s->buf = qemu_try_blockalign(bs, s->buf_size);
     if (s->buf == NULL) {
         ret = -ENOMEM;
@@ -1064,7 +1170,8 @@ static int coroutine_fn mirror_run(Job *job, Error **errp)
         }
         if (delta < BLOCK_JOB_SLICE_TIME &&
             iostatus == BLOCK_DEVICE_IO_STATUS_OK) {
-            if (s->in_flight >= MAX_IN_FLIGHT || s->buf_free_count == 0 ||
+            if (s->in_flight >= mirror_max_in_flight(s) ||
+                s->buf_free_count == 0 ||
                 (cnt == 0 && s->in_flight > 0)) {
                 trace_mirror_yield(s, cnt, s->buf_free_count, s->in_flight);
                 mirror_wait_for_free_in_flight_slot(s);
@@ -1715,9 +1822,10 @@ static BlockJob *mirror_start_job(
                              void *opaque,
                              const BlockJobDriver *driver,
                              bool is_none_mode, BlockDriverState *base,
+                             BdrvDirtyBitmap *sync_bitmap,
                              bool auto_complete, const char *filter_node_name,
                              bool is_mirror, MirrorCopyMode copy_mode,
-                             Error **errp)
+                             bool use_copy_range, Error **errp)
 {
     MirrorBlockJob *s;
     MirrorBDSOpaque *bs_opaque;
@@ -1877,9 +1985,11 @@ static BlockJob *mirror_start_job(
     qatomic_set(&s->copy_mode, copy_mode);
     s->base = base;
     s->base_overlay = bdrv_find_overlay(bs, base);
+    s->sync_bitmap = sync_bitmap;
     s->granularity = granularity;
     s->buf_size = ROUND_UP(buf_size, granularity);
     s->unmap = unmap;
+    s->use_copy_range = use_copy_range;
     if (auto_complete) {
         s->should_complete = true;
     }
@@ -1961,6 +2071,9 @@ static BlockJob *mirror_start_job(
     bdrv_graph_wrunlock();
 
     QTAILQ_INIT(&s->ops_in_flight);
+    if (sync_bitmap) {
+        bdrv_dirty_bitmap_set_busy(sync_bitmap, true);
+    }
 
     trace_mirror_start(bs, s, opaque);
     job_start(&s->common.job);
@@ -2006,7 +2119,8 @@ void mirror_start(const char *job_id, BlockDriverState *bs,
                   BlockdevOnError on_source_error,
                   BlockdevOnError on_target_error,
                   bool unmap, const char *filter_node_name,
-                  MirrorCopyMode copy_mode, Error **errp)
+                  MirrorCopyMode copy_mode, const MirrorPerf *perf,
+                  Error **errp)
 {
     bool is_none_mode;
     BlockDriverState *base;
@@ -2028,14 +2142,16 @@ void mirror_start(const char *job_id, BlockDriverState *bs,
     mirror_start_job(job_id, bs, creation_flags, target, replaces,
                      speed, granularity, buf_size, backing_mode, zero_target,
                      on_source_error, on_target_error, unmap, NULL, NULL,
-                     &mirror_job_driver, is_none_mode, base, false,
-                     filter_node_name, true, copy_mode, errp);
+                     &mirror_job_driver, is_none_mode, base, NULL, false,
+                     filter_node_name, true, copy_mode, perf->use_copy_range,
+                     errp);
 }
 
 BlockJob *commit_active_start(const char *job_id, BlockDriverState *bs,
                               BlockDriverState *base, int creation_flags,
                               int64_t speed, BlockdevOnError on_error,
                               const char *filter_node_name,
+                              BdrvDirtyBitmap *bitmap,
                               BlockCompletionFunc *cb, void *opaque,
                               bool auto_complete, Error **errp)
 {
@@ -2056,9 +2172,10 @@ BlockJob *commit_active_start(const char *job_id, BlockDriverState *bs,
                      job_id, bs, creation_flags, base, NULL, speed, 0, 0,
                      MIRROR_LEAVE_BACKING_CHAIN, false,
                      on_error, on_error, true, cb, opaque,
-                     &commit_active_job_driver, false, base, auto_complete,
+                     &commit_active_job_driver, false, base, bitmap,
+                     auto_complete,
                      filter_node_name, false, MIRROR_COPY_MODE_BACKGROUND,
-                     errp);
+                     false, errp);
     if (!job) {
         goto error_restore_flags;
     }
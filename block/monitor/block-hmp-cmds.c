@@ -402,7 +402,7 @@ void hmp_nbd_server_start(Monitor *mon, const QDict *qdict)
         goto exit;
     }
 
-    nbd_server_start(addr, NULL, NULL, 0, &local_err);
+    nbd_server_start(addr, NULL, NULL, 0, false, &local_err);
     qapi_free_SocketAddress(addr);
     if (local_err != NULL) {
         goto exit;
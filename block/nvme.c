@@ -23,6 +23,7 @@
 #include "qemu/cutils.h"
 #include "qemu/option.h"
 #include "qemu/memalign.h"
+#include "qemu/stats64.h"
 #include "qemu/vfio-helpers.h"
 #include "block/block-io.h"
 #include "block/block_int.h"
@@ -49,12 +50,19 @@ typedef struct BDRVNVMeState BDRVNVMeState;
 #define INDEX_ADMIN     0
 #define INDEX_IO(n)     (1 + n)
 
-/* This driver shares a single MSIX IRQ for the admin and I/O queues */
+/*
+ * The admin queue uses a shared MSIX IRQ.  With more than one I/O queue,
+ * each of them gets an IRQ of its own as long as the device has enough of
+ * them, and the remaining ones share the IRQ of the admin queue.
+ */
 enum {
     MSIX_SHARED_IRQ_IDX = 0,
     MSIX_IRQ_COUNT = 1
 };
 
+/* Upper limit for the "queues" option */
+#define NVME_MAX_IO_QUEUES 256
+
 typedef struct {
     int32_t  head, tail;
     uint8_t  *queue;
@@ -72,12 +80,23 @@ typedef struct {
     int free_req_next; /* q->reqs[] index of next free req */
 } NVMeRequest;
 
+typedef struct NVMeQueueIrq NVMeQueueIrq;
+
 typedef struct {
     QemuMutex   lock;
 
     /* Read from I/O code path, initialized under BQL */
     BDRVNVMeState   *s;
     int             index;
+    /* IRQ of the queue pair, NULL if it uses MSIX_SHARED_IRQ_IDX */
+    NVMeQueueIrq    *irq;
+
+    /*
+     * Where completions are processed.  Queue pairs with an IRQ of their
+     * own start unbound (NULL) until nvme_get_io_queue() binds them to the
+     * first AioContext that submits requests.
+     */
+    AioContext      *aio_context;
 
     /* Fields protected by BQL */
     uint8_t     *prp_list_pages;
@@ -95,6 +114,11 @@ typedef struct {
     QEMUBH      *completion_bh;
 } NVMeQueuePair;
 
+struct NVMeQueueIrq {
+    EventNotifier notifier;
+    NVMeQueuePair *q;
+};
+
 struct BDRVNVMeState {
     AioContext *aio_context;
     QEMUVFIOState *vfio;
@@ -110,6 +134,13 @@ struct BDRVNVMeState {
      */
     NVMeQueuePair **queues;
     unsigned queue_count;
+    /* IRQs of the I/O queues that have one, queue_irqs[n] is for INDEX_IO(n) */
+    NVMeQueueIrq *queue_irqs;
+    unsigned queue_irq_count;
+    /* Protects binding queue pairs to AioContexts */
+    QemuMutex queue_bind_lock;
+    /* I/O queue pairs with an IRQ of their own that are still unbound */
+    unsigned unbound_queues;
     size_t page_size;
     /* How many uint32_t elements does each doorbell entry take. */
     size_t doorbell_scale;
@@ -135,14 +166,15 @@ struct BDRVNVMeState {
     char *device;
 
     struct {
-        uint64_t completion_errors;
-        uint64_t aligned_accesses;
-        uint64_t unaligned_accesses;
+        Stat64 completion_errors;
+        Stat64 aligned_accesses;
+        Stat64 unaligned_accesses;
     } stats;
 };
 
 #define NVME_BLOCK_OPT_DEVICE "device"
 #define NVME_BLOCK_OPT_NAMESPACE "namespace"
+#define NVME_BLOCK_OPT_QUEUES "queues"
 
 static void nvme_process_completion_bh(void *opaque);
 
@@ -160,6 +192,11 @@ static QemuOptsList runtime_opts = {
             .type = QEMU_OPT_NUMBER,
             .help = "NVMe namespace",
         },
+        {
+            .name = NVME_BLOCK_OPT_QUEUES,
+            .type = QEMU_OPT_NUMBER,
+            .help = "Number of I/O queue pairs (default: 1)",
+        },
         { /* end of list */ }
     },
 };
@@ -246,8 +283,12 @@ static NVMeQueuePair *nvme_create_queue_pair(BDRVNVMeState *s,
     qemu_mutex_init(&q->lock);
     q->s = s;
     q->index = idx;
+    q->aio_context = aio_context;
     qemu_co_queue_init(&q->free_req_queue);
-    q->completion_bh = aio_bh_new(aio_context, nvme_process_completion_bh, q);
+    if (aio_context) {
+        q->completion_bh = aio_bh_new(aio_context, nvme_process_completion_bh,
+                                      q);
+    }
     r = qemu_vfio_dma_map(s->vfio, q->prp_list_pages, bytes,
                           false, &prp_list_iova, errp);
     if (r) {
@@ -344,7 +385,7 @@ static void nvme_put_free_req_locked(NVMeQueuePair *q, NVMeRequest *req)
 static void nvme_wake_free_req_locked(NVMeQueuePair *q)
 {
     if (!qemu_co_queue_empty(&q->free_req_queue)) {
-        replay_bh_schedule_oneshot_event(q->s->aio_context,
+        replay_bh_schedule_oneshot_event(q->aio_context,
                 nvme_free_req_queue_cb, q);
     }
 }
@@ -412,7 +453,7 @@ static bool nvme_process_completion(NVMeQueuePair *q)
         }
         ret = nvme_translate_error(c);
         if (ret) {
-            s->stats.completion_errors++;
+            stat64_inc(&s->stats.completion_errors);
         }
         q->cq.head = (q->cq.head + 1) % NVME_QUEUE_SIZE;
         if (!q->cq.head) {
@@ -647,12 +688,15 @@ static void nvme_poll_queue(NVMeQueuePair *q)
     qemu_mutex_unlock(&q->lock);
 }
 
+/* Poll the queue pairs that use the shared IRQ */
 static void nvme_poll_queues(BDRVNVMeState *s)
 {
     int i;
 
     for (i = 0; i < s->queue_count; i++) {
-        nvme_poll_queue(s->queues[i]);
+        if (!s->queues[i]->irq) {
+            nvme_poll_queue(s->queues[i]);
+        }
     }
 }
 
@@ -670,12 +714,18 @@ static bool nvme_add_io_queue(BlockDriverState *bs, Error **errp)
 {
     BDRVNVMeState *s = bs->opaque;
     unsigned n = s->queue_count;
+    NVMeQueueIrq *irq = NULL;
+    unsigned vector = MSIX_SHARED_IRQ_IDX;
     NVMeQueuePair *q;
     NvmeCmd cmd;
     unsigned queue_size = NVME_QUEUE_SIZE;
 
     assert(n <= UINT16_MAX);
-    q = nvme_create_queue_pair(s, bdrv_get_aio_context(bs),
+    if (n - 1 < s->queue_irq_count) {
+        irq = &s->queue_irqs[n - 1];
+        vector = n;
+    }
+    q = nvme_create_queue_pair(s, irq ? NULL : bdrv_get_aio_context(bs),
                                n, queue_size, errp);
     if (!q) {
         return false;
@@ -684,7 +734,7 @@ static bool nvme_add_io_queue(BlockDriverState *bs, Error **errp)
         .opcode = NVME_ADM_CMD_CREATE_CQ,
         .dptr.prp1 = cpu_to_le64(q->cq.iova),
         .cdw10 = cpu_to_le32(((queue_size - 1) << 16) | n),
-        .cdw11 = cpu_to_le32(NVME_CQ_IEN | NVME_CQ_PC),
+        .cdw11 = cpu_to_le32(NVME_CQ_IEN | NVME_CQ_PC | (vector << 16)),
     };
     if (nvme_admin_cmd_sync(bs, &cmd)) {
         error_setg(errp, "Failed to create CQ io queue [%u]", n);
@@ -703,12 +753,138 @@ static bool nvme_add_io_queue(BlockDriverState *bs, Error **errp)
     s->queues = g_renew(NVMeQueuePair *, s->queues, n + 1);
     s->queues[n] = q;
     s->queue_count++;
+    if (irq) {
+        q->irq = irq;
+        irq->q = q;
+        s->unbound_queues++;
+    }
     return true;
 out_error:
     nvme_free_queue_pair(q);
     return false;
 }
 
+/* Ask for @n I/O queues, the controller may allocate fewer */
+static void nvme_set_queue_count(BlockDriverState *bs, unsigned n)
+{
+    NvmeCmd cmd = {
+        .opcode = NVME_ADM_CMD_SET_FEATURES,
+        .cdw10 = cpu_to_le32(NVME_NUMBER_OF_QUEUES),
+        .cdw11 = cpu_to_le32(((n - 1) << 16) | (n - 1)),
+    };
+
+    if (nvme_admin_cmd_sync(bs, &cmd)) {
+        trace_nvme_set_queue_count_failed(bs->opaque, n);
+    }
+}
+
+static bool nvme_queue_has_completions(NVMeQueuePair *q)
+{
+    const size_t cqe_offset = q->cq.head * NVME_CQ_ENTRY_BYTES;
+    NvmeCqe *cqe = (NvmeCqe *)&q->cq.queue[cqe_offset];
+
+    /*
+     * q->lock isn't needed because nvme_process_completion() only runs in
+     * the event loop thread and cannot race with itself.
+     */
+    return (le16_to_cpu(cqe->status) & 0x1) != q->cq_phase;
+}
+
+static void nvme_handle_queue_event(EventNotifier *n)
+{
+    NVMeQueueIrq *irq = container_of(n, NVMeQueueIrq, notifier);
+
+    event_notifier_test_and_clear(n);
+    nvme_poll_queue(irq->q);
+}
+
+static bool nvme_queue_poll_cb(void *opaque)
+{
+    NVMeQueueIrq *irq = container_of(opaque, NVMeQueueIrq, notifier);
+
+    return nvme_queue_has_completions(irq->q);
+}
+
+static void nvme_queue_poll_ready(EventNotifier *n)
+{
+    NVMeQueueIrq *irq = container_of(n, NVMeQueueIrq, notifier);
+
+    nvme_poll_queue(irq->q);
+}
+
+/* Process the completions of @q in @ctx, called with s->queue_bind_lock */
+static void nvme_bind_io_queue(NVMeQueuePair *q, AioContext *ctx)
+{
+    trace_nvme_bind_io_queue(q->s, q->index, ctx);
+    q->completion_bh = aio_bh_new(ctx, nvme_process_completion_bh, q);
+    aio_set_event_notifier(ctx, &q->irq->notifier, nvme_handle_queue_event,
+                           nvme_queue_poll_cb, nvme_queue_poll_ready);
+    qatomic_dec(&q->s->unbound_queues);
+    qatomic_store_release(&q->aio_context, ctx);
+}
+
+static void nvme_unbind_io_queue(NVMeQueuePair *q)
+{
+    if (!q->aio_context) {
+        return;
+    }
+    aio_set_event_notifier(q->aio_context, &q->irq->notifier,
+                           NULL, NULL, NULL);
+    qemu_bh_delete(q->completion_bh);
+    q->completion_bh = NULL;
+    q->aio_context = NULL;
+    qatomic_inc(&q->s->unbound_queues);
+}
+
+/*
+ * Return the I/O queue pair for requests from the current AioContext.
+ *
+ * Queue pairs with an IRQ of their own are handed out to the AioContexts
+ * that submit requests, so that with one of them per IOThread, requests
+ * are submitted and completed in the same thread.  AioContexts that come
+ * after them share the other queue pairs, or all of them if there are
+ * none, and their requests complete wherever the queue pair does.
+ */
+static NVMeQueuePair *nvme_get_io_queue(BDRVNVMeState *s)
+{
+    AioContext *ctx = qemu_get_current_aio_context();
+    unsigned nr_io_queues = s->queue_count - 1;
+    unsigned first_shared = MIN(s->queue_irq_count, nr_io_queues);
+    unsigned i;
+
+    if (nr_io_queues == 1) {
+        return s->queues[INDEX_IO(0)];
+    }
+
+    for (i = 0; i < first_shared; i++) {
+        if (qatomic_load_acquire(&s->queues[INDEX_IO(i)]->aio_context) == ctx) {
+            return s->queues[INDEX_IO(i)];
+        }
+    }
+
+    if (qatomic_read(&s->unbound_queues)) {
+        QEMU_LOCK_GUARD(&s->queue_bind_lock);
+
+        for (i = 0; i < first_shared; i++) {
+            NVMeQueuePair *q = s->queues[INDEX_IO(i)];
+
+            if (q->aio_context == ctx) {
+                return q;
+            }
+            if (!q->aio_context) {
+                nvme_bind_io_queue(q, ctx);
+                return q;
+            }
+        }
+    }
+
+    if (first_shared == nr_io_queues) {
+        first_shared = 0;
+    }
+    i = first_shared + ((uintptr_t)ctx >> 6) % (nr_io_queues - first_shared);
+    return s->queues[INDEX_IO(i)];
+}
+
 static bool nvme_poll_cb(void *opaque)
 {
     EventNotifier *e = opaque;
@@ -718,14 +894,8 @@ static bool nvme_poll_cb(void *opaque)
 
     for (i = 0; i < s->queue_count; i++) {
         NVMeQueuePair *q = s->queues[i];
-        const size_t cqe_offset = q->cq.head * NVME_CQ_ENTRY_BYTES;
-        NvmeCqe *cqe = (NvmeCqe *)&q->cq.queue[cqe_offset];
-
-        /*
-         * q->lock isn't needed because nvme_process_completion() only runs in
-         * the event loop thread and cannot race with itself.
-         */
-        if ((le16_to_cpu(cqe->status) & 0x1) != q->cq_phase) {
+
+        if (!q->irq && nvme_queue_has_completions(q)) {
             return true;
         }
     }
@@ -740,12 +910,58 @@ static void nvme_poll_ready(EventNotifier *e)
     nvme_poll_queues(s);
 }
 
+/*
+ * Route MSIX IRQs to the shared notifier and to one notifier for each of
+ * the @nr_io_queues I/O queues, as far as the device has IRQs for them.
+ */
+static int nvme_init_irqs(BlockDriverState *bs, unsigned nr_io_queues,
+                          Error **errp)
+{
+    BDRVNVMeState *s = bs->opaque;
+    g_autofree EventNotifier **notifiers = NULL;
+    unsigned count = 1;
+    unsigned i;
+    int ret;
+
+    /* A single I/O queue keeps sharing the IRQ of the admin queue */
+    if (nr_io_queues > 1) {
+        s->queue_irqs = g_new0(NVMeQueueIrq, nr_io_queues);
+        for (i = 0; i < nr_io_queues; i++) {
+            ret = event_notifier_init(&s->queue_irqs[i].notifier, 0);
+            if (ret) {
+                break;
+            }
+        }
+        s->queue_irq_count = i;
+        count += i;
+    }
+
+    notifiers = g_new(EventNotifier *, count);
+    notifiers[0] = &s->irq_notifier[MSIX_SHARED_IRQ_IDX];
+    for (i = 1; i < count; i++) {
+        notifiers[i] = &s->queue_irqs[i - 1].notifier;
+    }
+    ret = qemu_vfio_pci_init_irqs(s->vfio, notifiers, &count,
+                                  VFIO_PCI_MSIX_IRQ_INDEX, errp);
+    if (ret) {
+        return ret;
+    }
+
+    /* Drop the notifiers that the device has no IRQ for */
+    while (s->queue_irq_count >= count) {
+        event_notifier_cleanup(&s->queue_irqs[--s->queue_irq_count].notifier);
+    }
+    trace_nvme_init_irqs(s, nr_io_queues, s->queue_irq_count);
+    return 0;
+}
+
 static int nvme_init(BlockDriverState *bs, const char *device, int namespace,
-                     Error **errp)
+                     unsigned nr_io_queues, Error **errp)
 {
     BDRVNVMeState *s = bs->opaque;
     NVMeQueuePair *q;
     AioContext *aio_context = bdrv_get_aio_context(bs);
+    Error *local_err = NULL;
     int ret;
     uint64_t cap;
     uint32_t ver;
@@ -755,6 +971,7 @@ static int nvme_init(BlockDriverState *bs, const char *device, int namespace,
 
     qemu_co_mutex_init(&s->dma_map_lock);
     qemu_co_queue_init(&s->dma_flush_queue);
+    qemu_mutex_init(&s->queue_bind_lock);
     s->device = g_strdup(device);
     s->nsid = namespace;
     s->aio_context = bdrv_get_aio_context(bs);
@@ -865,8 +1082,7 @@ static int nvme_init(BlockDriverState *bs, const char *device, int namespace,
         }
     }
 
-    ret = qemu_vfio_pci_init_irq(s->vfio, s->irq_notifier,
-                                 VFIO_PCI_MSIX_IRQ_INDEX, errp);
+    ret = nvme_init_irqs(bs, nr_io_queues, errp);
     if (ret) {
         goto out;
     }
@@ -881,8 +1097,19 @@ static int nvme_init(BlockDriverState *bs, const char *device, int namespace,
     }
 
     /* Set up command queues. */
-    if (!nvme_add_io_queue(bs, errp)) {
-        ret = -EIO;
+    if (nr_io_queues > 1) {
+        nvme_set_queue_count(bs, nr_io_queues);
+    }
+    for (unsigned i = 0; i < nr_io_queues; i++) {
+        if (!nvme_add_io_queue(bs, i ? &local_err : errp)) {
+            if (!i) {
+                ret = -EIO;
+            } else {
+                warn_reportf_err(local_err, "Using %u I/O queues instead of "
+                                 "%u: ", i, nr_io_queues);
+            }
+            break;
+        }
     }
 out:
     if (regs) {
@@ -953,9 +1180,17 @@ static void nvme_close(BlockDriverState *bs)
     BDRVNVMeState *s = bs->opaque;
 
     for (unsigned i = 0; i < s->queue_count; ++i) {
+        if (s->queues[i]->irq) {
+            nvme_unbind_io_queue(s->queues[i]);
+        }
         nvme_free_queue_pair(s->queues[i]);
     }
     g_free(s->queues);
+    for (unsigned i = 0; i < s->queue_irq_count; i++) {
+        event_notifier_cleanup(&s->queue_irqs[i].notifier);
+    }
+    g_free(s->queue_irqs);
+    qemu_mutex_destroy(&s->queue_bind_lock);
     aio_set_event_notifier(bdrv_get_aio_context(bs),
                            &s->irq_notifier[MSIX_SHARED_IRQ_IDX],
                            NULL, NULL, NULL);
@@ -973,6 +1208,7 @@ static int nvme_file_open(BlockDriverState *bs, QDict *options, int flags,
     const char *device;
     QemuOpts *opts;
     int namespace;
+    uint64_t nr_io_queues;
     int ret;
     BDRVNVMeState *s = bs->opaque;
 
@@ -988,7 +1224,14 @@ static int nvme_file_open(BlockDriverState *bs, QDict *options, int flags,
     }
 
     namespace = qemu_opt_get_number(opts, NVME_BLOCK_OPT_NAMESPACE, 1);
-    ret = nvme_init(bs, device, namespace, errp);
+    nr_io_queues = qemu_opt_get_number(opts, NVME_BLOCK_OPT_QUEUES, 1);
+    if (nr_io_queues < 1 || nr_io_queues > NVME_MAX_IO_QUEUES) {
+        error_setg(errp, "'" NVME_BLOCK_OPT_QUEUES "' must be between 1 and %d",
+                   NVME_MAX_IO_QUEUES);
+        qemu_opts_del(opts);
+        return -EINVAL;
+    }
+    ret = nvme_init(bs, device, namespace, nr_io_queues, errp);
     qemu_opts_del(opts);
     if (ret) {
         goto fail;
@@ -1188,7 +1431,7 @@ static coroutine_fn int nvme_co_prw_aligned(BlockDriverState *bs,
 {
     int r;
     BDRVNVMeState *s = bs->opaque;
-    NVMeQueuePair *ioq = s->queues[INDEX_IO(0)];
+    NVMeQueuePair *ioq = nvme_get_io_queue(s);
     NVMeRequest *req;
 
     uint32_t cdw12 = (((bytes >> s->blkshift) - 1) & 0xFFFF) |
@@ -1201,7 +1444,7 @@ static coroutine_fn int nvme_co_prw_aligned(BlockDriverState *bs,
         .cdw12 = cpu_to_le32(cdw12),
     };
     NVMeCoData data = {
-        .ctx = bdrv_get_aio_context(bs),
+        .ctx = qemu_get_current_aio_context(),
         .ret = -EINPROGRESS,
     };
 
@@ -1267,10 +1510,10 @@ static coroutine_fn int nvme_co_prw(BlockDriverState *bs,
     assert(QEMU_IS_ALIGNED(bytes, s->page_size));
     assert(bytes <= s->max_transfer);
     if (nvme_qiov_aligned(bs, qiov)) {
-        s->stats.aligned_accesses++;
+        stat64_inc(&s->stats.aligned_accesses);
         return nvme_co_prw_aligned(bs, offset, bytes, qiov, is_write, flags);
     }
-    s->stats.unaligned_accesses++;
+    stat64_inc(&s->stats.unaligned_accesses);
     trace_nvme_prw_buffered(s, offset, bytes, qiov->niov, is_write);
     buf = qemu_try_memalign(qemu_real_host_page_size(), len);
 
@@ -1309,14 +1552,14 @@ static coroutine_fn int nvme_co_pwritev(BlockDriverState *bs,
 static coroutine_fn int nvme_co_flush(BlockDriverState *bs)
 {
     BDRVNVMeState *s = bs->opaque;
-    NVMeQueuePair *ioq = s->queues[INDEX_IO(0)];
+    NVMeQueuePair *ioq = nvme_get_io_queue(s);
     NVMeRequest *req;
     NvmeCmd cmd = {
         .opcode = NVME_CMD_FLUSH,
         .nsid = cpu_to_le32(s->nsid),
     };
     NVMeCoData data = {
-        .ctx = bdrv_get_aio_context(bs),
+        .ctx = qemu_get_current_aio_context(),
         .ret = -EINPROGRESS,
     };
 
@@ -1340,7 +1583,7 @@ static coroutine_fn int nvme_co_pwrite_zeroes(BlockDriverState *bs,
                                               BdrvRequestFlags flags)
 {
     BDRVNVMeState *s = bs->opaque;
-    NVMeQueuePair *ioq = s->queues[INDEX_IO(0)];
+    NVMeQueuePair *ioq = nvme_get_io_queue(s);
     NVMeRequest *req;
     uint32_t cdw12;
 
@@ -1367,7 +1610,7 @@ static coroutine_fn int nvme_co_pwrite_zeroes(BlockDriverState *bs,
     };
 
     NVMeCoData data = {
-        .ctx = bdrv_get_aio_context(bs),
+        .ctx = qemu_get_current_aio_context(),
         .ret = -EINPROGRESS,
     };
 
@@ -1403,7 +1646,7 @@ static int coroutine_fn nvme_co_pdiscard(BlockDriverState *bs,
                                          int64_t bytes)
 {
     BDRVNVMeState *s = bs->opaque;
-    NVMeQueuePair *ioq = s->queues[INDEX_IO(0)];
+    NVMeQueuePair *ioq = nvme_get_io_queue(s);
     NVMeRequest *req;
     QEMU_AUTO_VFREE NvmeDsmRange *buf = NULL;
     QEMUIOVector local_qiov;
@@ -1417,7 +1660,7 @@ static int coroutine_fn nvme_co_pdiscard(BlockDriverState *bs,
     };
 
     NVMeCoData data = {
-        .ctx = bdrv_get_aio_context(bs),
+        .ctx = qemu_get_current_aio_context(),
         .ret = -EINPROGRESS,
     };
 
@@ -1550,6 +1793,11 @@ static void nvme_detach_aio_context(BlockDriverState *bs)
     for (unsigned i = 0; i < s->queue_count; i++) {
         NVMeQueuePair *q = s->queues[i];
 
+        /* Rebind I/O queues when requests come from the new AioContexts */
+        if (q->irq) {
+            nvme_unbind_io_queue(q);
+            continue;
+        }
         qemu_bh_delete(q->completion_bh);
         q->completion_bh = NULL;
     }
@@ -1572,6 +1820,10 @@ static void nvme_attach_aio_context(BlockDriverState *bs,
     for (unsigned i = 0; i < s->queue_count; i++) {
         NVMeQueuePair *q = s->queues[i];
 
+        if (q->irq) {
+            continue;
+        }
+        q->aio_context = new_context;
         q->completion_bh =
             aio_bh_new(new_context, nvme_process_completion_bh, q);
     }
@@ -1606,9 +1858,9 @@ static BlockStatsSpecific *nvme_get_specific_stats(BlockDriverState *bs)
 
     stats->driver = BLOCKDEV_DRIVER_NVME;
     stats->u.nvme = (BlockStatsSpecificNvme) {
-        .completion_errors = s->stats.completion_errors,
-        .aligned_accesses = s->stats.aligned_accesses,
-        .unaligned_accesses = s->stats.unaligned_accesses,
+        .completion_errors = stat64_get(&s->stats.completion_errors),
+        .aligned_accesses = stat64_get(&s->stats.aligned_accesses),
+        .unaligned_accesses = stat64_get(&s->stats.unaligned_accesses),
     };
 
     return stats;
@@ -1617,6 +1869,7 @@ static BlockStatsSpecific *nvme_get_specific_stats(BlockDriverState *bs)
 static const char *const nvme_strong_runtime_opts[] = {
     NVME_BLOCK_OPT_DEVICE,
     NVME_BLOCK_OPT_NAMESPACE,
+    NVME_BLOCK_OPT_QUEUES,
 
     NULL
 };
@@ -36,8 +36,10 @@
 #include "qapi/error.h"
 #include "qapi/qapi-commands-block.h"
 #include "qapi/qmp/qdict.h"
+#include "qemu/module.h"
 #include "sysemu/block-backend.h"
 #include "sysemu/blockdev.h"
+#include "sysemu/stats.h"
 
 static BlockBackend *qmp_get_blk(const char *blk_name, const char *qdev_id,
                                  Error **errp)
@@ -572,3 +574,85 @@ void qmp_block_latency_histogram_set(
         }
     }
 }
+
+static const char *const block_stats_latency_names[BLOCK_MAX_IOTYPE] = {
+    [BLOCK_ACCT_READ] = "rd-latency",
+    [BLOCK_ACCT_WRITE] = "wr-latency",
+    [BLOCK_ACCT_FLUSH] = "flush-latency",
+    [BLOCK_ACCT_ZONE_APPEND] = "zone-append-latency",
+    [BLOCK_ACCT_UNMAP] = "unmap-latency",
+};
+
+static void block_stats_cb(StatsResultList **result, StatsTarget target,
+                           strList *names, strList *targets, Error **errp)
+{
+    BlockBackend *blk;
+
+    if (target != STATS_TARGET_BLOCK) {
+        return;
+    }
+
+    /* Backends are identified by the QOM path of the device they are on */
+    for (blk = blk_all_next(NULL); blk; blk = blk_all_next(blk)) {
+        DeviceState *dev = blk_get_attached_dev(blk);
+        g_autofree char *path = NULL;
+        StatsList *stats_list = NULL;
+        int type;
+
+        if (!dev) {
+            continue;
+        }
+        path = object_get_canonical_path(OBJECT(dev));
+        if (!apply_str_list_filter(path, targets)) {
+            continue;
+        }
+
+        for (type = BLOCK_MAX_IOTYPE - 1; type > BLOCK_ACCT_NONE; type--) {
+            const char *name = block_stats_latency_names[type];
+            Stats *stats;
+
+            if (!apply_str_list_filter(name, names)) {
+                continue;
+            }
+            stats = g_new0(Stats, 1);
+            stats->name = g_strdup(name);
+            stats->value = g_new0(StatsValue, 1);
+            stats->value->type = QTYPE_QLIST;
+            stats->value->u.list = block_acct_latency_log2(blk_get_stats(blk),
+                                                           type);
+            QAPI_LIST_PREPEND(stats_list, stats);
+        }
+
+        add_stats_entry(result, STATS_PROVIDER_BLOCK, path, stats_list);
+    }
+}
+
+static void block_stats_schemas_cb(StatsSchemaList **result, Error **errp)
+{
+    StatsSchemaValueList *stats_list = NULL;
+    int type;
+
+    for (type = BLOCK_MAX_IOTYPE - 1; type > BLOCK_ACCT_NONE; type--) {
+        StatsSchemaValue *value = g_new0(StatsSchemaValue, 1);
+
+        value->name = g_strdup(block_stats_latency_names[type]);
+        value->type = STATS_TYPE_LOG2_HISTOGRAM;
+        value->has_unit = true;
+        value->unit = STATS_UNIT_SECONDS;
+        value->has_base = true;
+        value->base = 10;
+        value->exponent = -9;
+        QAPI_LIST_PREPEND(stats_list, value);
+    }
+
+    add_stats_schema(result, STATS_PROVIDER_BLOCK, STATS_TARGET_BLOCK,
+                     stats_list);
+}
+
+static void block_stats_init(void)
+{
+    add_stats_callbacks(STATS_PROVIDER_BLOCK, block_stats_cb,
+                        block_stats_schemas_cb);
+}
+
+block_init(block_stats_init);
@@ -586,6 +586,14 @@ static void bdrv_query_blk_stats(BlockDeviceStats *ds, BlockBackend *blk)
         = bdrv_latency_histogram_stats(&hgram[BLOCK_ACCT_ZONE_APPEND]);
     ds->flush_latency_histogram
         = bdrv_latency_histogram_stats(&hgram[BLOCK_ACCT_FLUSH]);
+
+    ds->latency_log2 = g_new0(BlockLatencyLog2Info, 1);
+    ds->latency_log2->rd = block_acct_latency_log2(stats, BLOCK_ACCT_READ);
+    ds->latency_log2->wr = block_acct_latency_log2(stats, BLOCK_ACCT_WRITE);
+    ds->latency_log2->zone_append =
+        block_acct_latency_log2(stats, BLOCK_ACCT_ZONE_APPEND);
+    ds->latency_log2->flush = block_acct_latency_log2(stats, BLOCK_ACCT_FLUSH);
+    ds->latency_log2->unmap = block_acct_latency_log2(stats, BLOCK_ACCT_UNMAP);
 }
 
 static BlockStats * GRAPH_RDLOCK
@@ -25,16 +25,55 @@
 #include "qemu/osdep.h"
 #include "block/block-io.h"
 #include "qemu/memalign.h"
+#include "qemu/host-utils.h"
+#include "qemu/thread.h"
 #include "qcow2.h"
 #include "trace.h"
 
+/*
+ * The cache is split into shards, each one owning a contiguous range of
+ * the tables.  A table can only be cached in the shard its offset hashes
+ * to, so that looking it up only involves the hash chains and the lock
+ * of that shard.
+ *
+ * The shard lock protects the offset, reference count and LRU position
+ * of the tables of the shard, as well as its hash chains: taking and
+ * dropping references to cached tables is therefore safe without
+ * s->lock.  Loading, writing back and modifying tables still requires
+ * s->lock.
+ */
+
+/* Number of tables below which a cache is not split any further */
+#define QCOW2_CACHE_SHARD_MIN_TABLES 16
+#define QCOW2_CACHE_MAX_SHARDS 16
+
 typedef struct Qcow2CachedTable {
     int64_t  offset;
     uint64_t lru_counter;
     int      ref;
     bool     dirty;
+    /* The table contents are complete, see qcow2_cache_get_cached() */
+    bool     valid;
+    /* Index of the next table in the same hash chain, -1 for none */
+    int      next;
+    int      shard;
+    /* Unreferenced tables, least recently used first */
+    QTAILQ_ENTRY(Qcow2CachedTable) lru_entry;
 } Qcow2CachedTable;
 
+typedef struct Qcow2CacheShard {
+    QemuMutex               lock;
+    /* Index of the first table of the shard, and number of tables */
+    int                     first;
+    int                     size;
+    /* Heads of the hash chains, -1 for empty */
+    int                    *buckets;
+    unsigned                bucket_mask;
+    QTAILQ_HEAD(, Qcow2CachedTable) lru;
+    uint64_t                lru_counter;
+    uint64_t                cache_clean_lru_counter;
+} Qcow2CacheShard;
+
 struct Qcow2Cache {
     Qcow2CachedTable       *entries;
     struct Qcow2Cache      *depends;
@@ -42,8 +81,9 @@ struct Qcow2Cache {
     int                     table_size;
     bool                    depends_on_flush;
     void                   *table_array;
-    uint64_t                lru_counter;
-    uint64_t                cache_clean_lru_counter;
+    Qcow2CacheShard        *shards;
+    int                     nb_shards;
+    int                     shard_bits;
 };
 
 static inline void *qcow2_cache_get_table_addr(Qcow2Cache *c, int table)
@@ -71,6 +111,100 @@ static inline const char *qcow2_cache_get_name(BDRVQcow2State *s, Qcow2Cache *c)
     }
 }
 
+static inline uint32_t qcow2_cache_hash(Qcow2Cache *c, uint64_t offset)
+{
+    return (offset / c->table_size * 0x9e3779b97f4a7c15ULL) >> 32;
+}
+
+static inline Qcow2CacheShard *qcow2_cache_get_shard(Qcow2Cache *c,
+                                                     uint64_t offset)
+{
+    return &c->shards[qcow2_cache_hash(c, offset) & (c->nb_shards - 1)];
+}
+
+static inline int *qcow2_cache_get_bucket(Qcow2Cache *c,
+                                          Qcow2CacheShard *shard,
+                                          uint64_t offset)
+{
+    uint32_t hash = qcow2_cache_hash(c, offset) >> c->shard_bits;
+    return &shard->buckets[hash & shard->bucket_mask];
+}
+
+/* Called with the shard lock held */
+static int qcow2_cache_lookup(Qcow2Cache *c, Qcow2CacheShard *shard,
+                              uint64_t offset)
+{
+    int i = *qcow2_cache_get_bucket(c, shard, offset);
+
+    while (i >= 0 && c->entries[i].offset != offset) {
+        i = c->entries[i].next;
+    }
+    return i;
+}
+
+/* Called with the shard lock held */
+static void qcow2_cache_hash_insert(Qcow2Cache *c, Qcow2CacheShard *shard,
+                                    int i)
+{
+    int *bucket = qcow2_cache_get_bucket(c, shard, c->entries[i].offset);
+
+    c->entries[i].next = *bucket;
+    *bucket = i;
+}
+
+/* Called with the shard lock held */
+static void qcow2_cache_hash_remove(Qcow2Cache *c, Qcow2CacheShard *shard,
+                                    int i)
+{
+    int *p = qcow2_cache_get_bucket(c, shard, c->entries[i].offset);
+
+    while (*p != i) {
+        assert(*p >= 0);
+        p = &c->entries[*p].next;
+    }
+    *p = c->entries[i].next;
+    c->entries[i].next = -1;
+}
+
+/*
+ * Forget the contents of an unreferenced table, its slot becomes the
+ * first one to be reused.  Called with the shard lock held.
+ */
+static void qcow2_cache_entry_clear(Qcow2Cache *c, Qcow2CacheShard *shard,
+                                    int i)
+{
+    Qcow2CachedTable *t = &c->entries[i];
+
+    assert(t->ref == 0);
+    if (t->offset) {
+        qcow2_cache_hash_remove(c, shard, i);
+    }
+    t->offset = 0;
+    t->lru_counter = 0;
+    t->valid = false;
+    QTAILQ_REMOVE(&shard->lru, t, lru_entry);
+    QTAILQ_INSERT_HEAD(&shard->lru, t, lru_entry);
+}
+
+/* Called with the shard lock held */
+static void qcow2_cache_entry_ref(Qcow2CacheShard *shard, Qcow2CachedTable *t)
+{
+    if (t->ref++ == 0) {
+        QTAILQ_REMOVE(&shard->lru, t, lru_entry);
+    }
+}
+
+/* Called with the shard lock held */
+static void qcow2_cache_entry_unref(Qcow2CacheShard *shard,
+                                    Qcow2CachedTable *t)
+{
+    assert(t->ref > 0);
+    if (--t->ref == 0) {
+        t->lru_counter = ++shard->lru_counter;
+        QTAILQ_INSERT_TAIL(&shard->lru, t, lru_entry);
+    }
+}
+
 static void qcow2_cache_table_release(Qcow2Cache *c, int i, int num_tables)
 {
 /* Using MADV_DONTNEED to discard memory is a Linux-specific feature */
@@ -86,38 +220,47 @@ static void qcow2_cache_table_release(Qcow2Cache *c, int i, int num_tables)
 #endif
 }
 
-static inline bool can_clean_entry(Qcow2Cache *c, int i)
+static inline bool can_clean_entry(Qcow2Cache *c, Qcow2CacheShard *shard,
+                                   int i)
 {
     Qcow2CachedTable *t = &c->entries[i];
     return t->ref == 0 && !t->dirty && t->offset != 0 &&
-        t->lru_counter <= c->cache_clean_lru_counter;
+        t->lru_counter <= shard->cache_clean_lru_counter;
 }
 
 void qcow2_cache_clean_unused(Qcow2Cache *c)
 {
-    int i = 0;
-    while (i < c->size) {
-        int to_clean = 0;
-
-        /* Skip the entries that we don't need to clean */
-        while (i < c->size && !can_clean_entry(c, i)) {
-            i++;
-        }
-
-        /* And count how many we can clean in a row */
-        while (i < c->size && can_clean_entry(c, i)) {
-            c->entries[i].offset = 0;
-            c->entries[i].lru_counter = 0;
-            i++;
-            to_clean++;
+    int s;
+
+    for (s = 0; s < c->nb_shards; s++) {
+        Qcow2CacheShard *shard = &c->shards[s];
+        int end = shard->first + shard->size;
+        int i = shard->first;
+
+        qemu_mutex_lock(&shard->lock);
+        while (i < end) {
+            int to_clean = 0;
+
+            /* Skip the entries that we don't need to clean */
+            while (i < end && !can_clean_entry(c, shard, i)) {
+                i++;
+            }
+
+            /* And count how many we can clean in a row */
+            while (i < end && can_clean_entry(c, shard, i)) {
+                qcow2_cache_entry_clear(c, shard, i);
+                i++;
+                to_clean++;
+            }
+
+            if (to_clean > 0) {
+                qcow2_cache_table_release(c, i - to_clean, to_clean);
+            }
         }
 
-        if (to_clean > 0) {
-            qcow2_cache_table_release(c, i - to_clean, to_clean);
-        }
+        shard->cache_clean_lru_counter = shard->lru_counter;
+        qemu_mutex_unlock(&shard->lock);
     }
-
-    c->cache_clean_lru_counter = c->lru_counter;
 }
 
 Qcow2Cache *qcow2_cache_create(BlockDriverState *bs, int num_tables,
@@ -125,6 +268,9 @@ Qcow2Cache *qcow2_cache_create(BlockDriverState *bs, int num_tables,
 {
     BDRVQcow2State *s = bs->opaque;
     Qcow2Cache *c;
+    int *buckets = NULL;
+    size_t nb_buckets = 0;
+    int i, j;
 
     assert(num_tables > 0);
     assert(is_power_of_2(table_size));
@@ -134,15 +280,50 @@ Qcow2Cache *qcow2_cache_create(BlockDriverState *bs, int num_tables,
     c = g_new0(Qcow2Cache, 1);
     c->size = num_tables;
     c->table_size = table_size;
+    c->nb_shards = pow2floor(MAX(num_tables / QCOW2_CACHE_SHARD_MIN_TABLES, 1));
+    c->nb_shards = MIN(c->nb_shards, QCOW2_CACHE_MAX_SHARDS);
+    c->shard_bits = ctz32(c->nb_shards);
+    c->shards = g_new0(Qcow2CacheShard, c->nb_shards);
     c->entries = g_try_new0(Qcow2CachedTable, num_tables);
     c->table_array = qemu_try_blockalign(bs->file->bs,
                                          (size_t) num_tables * c->table_size);
 
-    if (!c->entries || !c->table_array) {
+    /* Spread the tables evenly, with about one hash chain per table */
+    for (i = 0; i < c->nb_shards; i++) {
+        Qcow2CacheShard *shard = &c->shards[i];
+
+        shard->first = (int64_t) i * num_tables / c->nb_shards;
+        shard->size = (int64_t) (i + 1) * num_tables / c->nb_shards -
+                      shard->first;
+        shard->bucket_mask = pow2ceil(shard->size) - 1;
+        nb_buckets += shard->bucket_mask + 1;
+    }
+    buckets = g_try_new(int, nb_buckets);
+
+    if (!c->entries || !c->table_array || !buckets) {
         qemu_vfree(c->table_array);
+        g_free(buckets);
         g_free(c->entries);
+        g_free(c->shards);
         g_free(c);
-        c = NULL;
+        return NULL;
+    }
+
+    for (i = 0; i < c->nb_shards; i++) {
+        Qcow2CacheShard *shard = &c->shards[i];
+
+        qemu_mutex_init(&shard->lock);
+        QTAILQ_INIT(&shard->lru);
+        shard->buckets = buckets;
+        buckets += shard->bucket_mask + 1;
+        for (j = 0; j <= shard->bucket_mask; j++) {
+            shard->buckets[j] = -1;
+        }
+        for (j = shard->first; j < shard->first + shard->size; j++) {
+            c->entries[j].next = -1;
+            c->entries[j].shard = i;
+            QTAILQ_INSERT_TAIL(&shard->lru, &c->entries[j], lru_entry);
+        }
     }
 
     return c;
@@ -156,7 +337,14 @@ int qcow2_cache_destroy(Qcow2Cache *c)
         assert(c->entries[i].ref == 0);
     }
 
+    for (i = 0; i < c->nb_shards; i++) {
+        qemu_mutex_destroy(&c->shards[i].lock);
+    }
+
     qemu_vfree(c->table_array);
+    /* The hash chains of all the shards share one allocation */
+    g_free(c->shards[0].buckets);
+    g_free(c->shards);
     g_free(c->entries);
     g_free(c);
 
@@ -300,23 +488,27 @@ void qcow2_cache_depends_on_flush(Qcow2Cache *c)
 
 int qcow2_cache_empty(BlockDriverState *bs, Qcow2Cache *c)
 {
-    int ret, i;
+    int ret, i, s;
 
     ret = qcow2_cache_flush(bs, c);
     if (ret < 0) {
         return ret;
     }
 
-    for (i = 0; i < c->size; i++) {
-        assert(c->entries[i].ref == 0);
-        c->entries[i].offset = 0;
-        c->entries[i].lru_counter = 0;
+    for (s = 0; s < c->nb_shards; s++) {
+        Qcow2CacheShard *shard = &c->shards[s];
+
+        qemu_mutex_lock(&shard->lock);
+        for (i = shard->first; i < shard->first + shard->size; i++) {
+            qcow2_cache_entry_clear(c, shard, i);
+        }
+        shard->lru_counter = 0;
+        shard->cache_clean_lru_counter = 0;
+        qemu_mutex_unlock(&shard->lock);
     }
 
     qcow2_cache_table_release(c, 0, c->size);
 
-    c->lru_counter = 0;
-
     return 0;
 }
 
@@ -325,11 +517,10 @@ qcow2_cache_do_get(BlockDriverState *bs, Qcow2Cache *c, uint64_t offset,
                    void **table, bool read_from_disk)
 {
     BDRVQcow2State *s = bs->opaque;
+    Qcow2CacheShard *shard;
+    Qcow2CachedTable *t;
     int i;
     int ret;
-    int lookup_index;
-    uint64_t min_lru_counter = UINT64_MAX;
-    int min_lru_index = -1;
 
     assert(offset != 0);
 
@@ -344,40 +535,54 @@ qcow2_cache_do_get(BlockDriverState *bs, Qcow2Cache *c, uint64_t offset,
     }
 
     /* Check if the table is already cached */
-    i = lookup_index = (offset / c->table_size * 4) % c->size;
-    do {
-        const Qcow2CachedTable *t = &c->entries[i];
-        if (t->offset == offset) {
-            goto found;
-        }
-        if (t->ref == 0 && t->lru_counter < min_lru_counter) {
-            min_lru_counter = t->lru_counter;
-            min_lru_index = i;
-        }
-        if (++i == c->size) {
-            i = 0;
-        }
-    } while (i != lookup_index);
+    shard = qcow2_cache_get_shard(c, offset);
+    qemu_mutex_lock(&shard->lock);
+    i = qcow2_cache_lookup(c, shard, offset);
+    if (i >= 0) {
+        qcow2_cache_entry_ref(shard, &c->entries[i]);
+        qemu_mutex_unlock(&shard->lock);
+        goto found;
+    }
 
-    if (min_lru_index == -1) {
+    t = QTAILQ_FIRST(&shard->lru);
+    if (!t) {
         /* This can't happen in current synchronous code, but leave the check
          * here as a reminder for whoever starts using AIO with the cache */
         abort();
     }
 
-    /* Cache miss: write a table back and replace it */
-    i = min_lru_index;
+    /*
+     * Cache miss: write a table back and replace it.  Keep a reference
+     * so that nobody else picks the same table, and take it out of the
+     * hash chains so that lockless lookups don't see it change.
+     */
+    i = t - c->entries;
+    qcow2_cache_entry_ref(shard, t);
+    if (t->offset) {
+        qcow2_cache_hash_remove(c, shard, i);
+    }
+    t->valid = false;
+    qemu_mutex_unlock(&shard->lock);
+
     trace_qcow2_cache_get_replace_entry(qemu_coroutine_self(),
                                         c == s->l2_table_cache, i);
 
     ret = qcow2_cache_entry_flush(bs, c, i);
     if (ret < 0) {
+        /* The old table is still there, and still dirty */
+        qemu_mutex_lock(&shard->lock);
+        if (t->offset) {
+            qcow2_cache_hash_insert(c, shard, i);
+            t->valid = true;
+        }
+        qcow2_cache_entry_unref(shard, t);
+        qemu_mutex_unlock(&shard->lock);
         return ret;
     }
 
     trace_qcow2_cache_get_read(qemu_coroutine_self(),
                                c == s->l2_table_cache, i);
-    c->entries[i].offset = 0;
+    t->offset = 0;
     if (read_from_disk) {
         if (c == s->l2_table_cache) {
             BLKDBG_EVENT(bs->file, BLKDBG_L2_LOAD);
@@ -386,15 +591,23 @@ qcow2_cache_do_get(BlockDriverState *bs, Qcow2Cache *c, uint64_t offset,
         ret = bdrv_pread(bs->file, offset, c->table_size,
                          qcow2_cache_get_table_addr(c, i), 0);
         if (ret < 0) {
+            qemu_mutex_lock(&shard->lock);
+            qcow2_cache_entry_unref(shard, t);
+            qcow2_cache_entry_clear(c, shard, i);
+            qemu_mutex_unlock(&shard->lock);
             return ret;
         }
     }
 
-    c->entries[i].offset = offset;
+    qemu_mutex_lock(&shard->lock);
+    t->offset = offset;
+    /* An empty table only becomes valid once the caller filled it */
+    t->valid = read_from_disk;
+    qcow2_cache_hash_insert(c, shard, i);
+    qemu_mutex_unlock(&shard->lock);
 
     /* And return the right table */
 found:
-    c->entries[i].ref++;
     *table = qcow2_cache_get_table_addr(c, i);
 
     trace_qcow2_cache_get_done(qemu_coroutine_self(),
@@ -418,15 +631,17 @@ int qcow2_cache_get_empty(BlockDriverState *bs, Qcow2Cache *c, uint64_t offset,
 void qcow2_cache_put(Qcow2Cache *c, void **table)
 {
     int i = qcow2_cache_get_table_idx(c, *table);
+    Qcow2CachedTable *t = &c->entries[i];
+    Qcow2CacheShard *shard = &c->shards[t->shard];
 
-    c->entries[i].ref--;
     *table = NULL;
 
-    if (c->entries[i].ref == 0) {
-        c->entries[i].lru_counter = ++c->lru_counter;
+    qemu_mutex_lock(&shard->lock);
+    qcow2_cache_entry_unref(shard, t);
+    if (t->ref == 0 && t->offset) {
+        t->valid = true;
     }
-
-    assert(c->entries[i].ref >= 0);
+    qemu_mutex_unlock(&shard->lock);
 }
 
 void qcow2_cache_entry_mark_dirty(Qcow2Cache *c, void *table)
@@ -438,25 +653,53 @@ void qcow2_cache_entry_mark_dirty(Qcow2Cache *c, void *table)
 
 void *qcow2_cache_is_table_offset(Qcow2Cache *c, uint64_t offset)
 {
+    Qcow2CacheShard *shard = qcow2_cache_get_shard(c, offset);
     int i;
 
-    for (i = 0; i < c->size; i++) {
-        if (c->entries[i].offset == offset) {
-            return qcow2_cache_get_table_addr(c, i);
-        }
+    qemu_mutex_lock(&shard->lock);
+    i = qcow2_cache_lookup(c, shard, offset);
+    qemu_mutex_unlock(&shard->lock);
+
+    return i >= 0 ? qcow2_cache_get_table_addr(c, i) : NULL;
+}
+
+/*
+ * Read the 64-bit word at @index of the table at @offset if the table is
+ * in the cache, without loading it.  Unlike the other functions, this
+ * can be called without s->lock: the word is read with the shard lock
+ * held, so the table cannot be replaced meanwhile.
+ *
+ * The value is returned as stored in the table, i.e. big endian.
+ * Returns true if the table was cached, false otherwise.
+ */
+bool qcow2_cache_get_cached_entry(Qcow2Cache *c, uint64_t offset,
+                                  unsigned index, uint64_t *value)
+{
+    Qcow2CacheShard *shard = qcow2_cache_get_shard(c, offset);
+    int i;
+
+    assert(index < c->table_size / sizeof(uint64_t));
+
+    qemu_mutex_lock(&shard->lock);
+    i = qcow2_cache_lookup(c, shard, offset);
+    if (i >= 0 && c->entries[i].valid) {
+        uint64_t *table = qcow2_cache_get_table_addr(c, i);
+        *value = table[index];
     }
-    return NULL;
+    qemu_mutex_unlock(&shard->lock);
+
+    return i >= 0 && c->entries[i].valid;
 }
 
 void qcow2_cache_discard(Qcow2Cache *c, void *table)
 {
     int i = qcow2_cache_get_table_idx(c, table);
+    Qcow2CacheShard *shard = &c->shards[c->entries[i].shard];
 
-    assert(c->entries[i].ref == 0);
-
-    c->entries[i].offset = 0;
-    c->entries[i].lru_counter = 0;
+    qemu_mutex_lock(&shard->lock);
+    qcow2_cache_entry_clear(c, shard, i);
     c->entries[i].dirty = false;
+    qemu_mutex_unlock(&shard->lock);
 
     qcow2_cache_table_release(c, i, 1);
 }
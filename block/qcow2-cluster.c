@@ -30,8 +30,24 @@
 #include "qcow2.h"
 #include "qemu/bswap.h"
 #include "qemu/memalign.h"
+#include "qemu/rcu.h"
 #include "trace.h"
 
+/*
+ * qcow2_get_host_offset_cached() may still be reading an L1 table that
+ * has been replaced, so free it after a grace period.
+ */
+typedef struct Qcow2L1TableRcu {
+    struct rcu_head rcu;
+    uint64_t *l1_table;
+} Qcow2L1TableRcu;
+
+static void qcow2_l1_table_free_rcu(Qcow2L1TableRcu *r)
+{
+    qemu_vfree(r->l1_table);
+    g_free(r);
+}
+
 int coroutine_fn qcow2_shrink_l1_table(BlockDriverState *bs,
                                        uint64_t exact_size)
 {
@@ -89,6 +105,7 @@ int qcow2_grow_l1_table(BlockDriverState *bs, uint64_t min_size,
     BDRVQcow2State *s = bs->opaque;
     int new_l1_size2, ret, i;
     uint64_t *new_l1_table;
+    Qcow2L1TableRcu *old_l1;
     int64_t old_l1_table_offset, old_l1_size;
     int64_t new_l1_table_offset, new_l1_size;
     uint8_t data[12];
@@ -177,12 +194,15 @@ int qcow2_grow_l1_table(BlockDriverState *bs, uint64_t min_size,
     if (ret < 0) {
         goto fail;
     }
-    qemu_vfree(s->l1_table);
+    old_l1 = g_new(Qcow2L1TableRcu, 1);
+    old_l1->l1_table = s->l1_table;
     old_l1_table_offset = s->l1_table_offset;
     s->l1_table_offset = new_l1_table_offset;
-    s->l1_table = new_l1_table;
+    qatomic_rcu_set(&s->l1_table, new_l1_table);
     old_l1_size = s->l1_size;
-    s->l1_size = new_l1_size;
+    /* Lockless readers must not see the new size with the old table */
+    qatomic_store_release(&s->l1_size, new_l1_size);
+    call_rcu(old_l1, qcow2_l1_table_free_rcu, rcu);
     qcow2_free_clusters(bs, old_l1_table_offset, old_l1_size * L1E_SIZE,
                         QCOW2_DISCARD_OTHER);
     return 0;
@@ -742,6 +762,96 @@ fail:
     return ret;
 }
 
+/*
+ * qcow2_get_host_offset_cached
+ *
+ * Lockless variant of qcow2_get_host_offset() for the read path: resolve
+ * @offset without s->lock if it maps to normal clusters whose L2 slice
+ * is already in the cache, which is the common case when reading from
+ * an allocated image.  On success, *host_offset is set and *bytes is
+ * reduced to the number of bytes that are contiguous in the image file.
+ *
+ * Images with subclusters and anything else than normal clusters are
+ * left to the locked path, as is any entry that would need it to
+ * signal corruption.
+ *
+ * Returns true on success, false if the caller must fall back to
+ * qcow2_get_host_offset().
+ */
+bool qcow2_get_host_offset_cached(BlockDriverState *bs, uint64_t offset,
+                                  unsigned int *bytes, uint64_t *host_offset)
+{
+    BDRVQcow2State *s = bs->opaque;
+    unsigned int offset_in_cluster = offset_into_cluster(s, offset);
+    unsigned int l2_index = offset_to_l2_slice_index(s, offset);
+    uint64_t l1_index = offset_to_l1_index(s, offset);
+    uint64_t l2_offset, slice_offset, l2_entry, host_cluster_offset = 0;
+    uint64_t bytes_needed, bytes_available, *l1_table;
+    int i, nb_clusters;
+
+    /*
+     * L1 and L2 entries can be updated while we read them, which is only
+     * fine if they cannot be torn.
+     */
+    if (has_subclusters(s) || sizeof(void *) < sizeof(uint64_t)) {
+        return false;
+    }
+
+    bytes_needed = (uint64_t) *bytes + offset_in_cluster;
+    bytes_available =
+        ((uint64_t) (s->l2_slice_size - l2_index)) << s->cluster_bits;
+    bytes_needed = MIN(bytes_needed, bytes_available);
+    nb_clusters = size_to_clusters(s, bytes_needed);
+
+    RCU_READ_LOCK_GUARD();
+
+    /* Pairs with qatomic_store_release() in qcow2_grow_l1_table() */
+    if (l1_index >= qatomic_load_acquire(&s->l1_size)) {
+        return false;
+    }
+    l1_table = qatomic_rcu_read(&s->l1_table);
+    l2_offset = l1_table[l1_index] & L1E_OFFSET_MASK;
+    if (!l2_offset || offset_into_cluster(s, l2_offset)) {
+        return false;
+    }
+
+    slice_offset = l2_offset + l2_entry_size(s) *
+        (offset_to_l2_index(s, offset) - l2_index);
+
+    for (i = 0; i < nb_clusters; i++) {
+        if (!qcow2_cache_get_cached_entry(s->l2_table_cache, slice_offset,
+                                          l2_index + i, &l2_entry)) {
+            break;
+        }
+        l2_entry = be64_to_cpu(l2_entry);
+        if (qcow2_get_cluster_type(bs, l2_entry) != QCOW2_CLUSTER_NORMAL) {
+            break;
+        }
+        if (i == 0) {
+            host_cluster_offset = l2_entry & L2E_OFFSET_MASK;
+            if (offset_into_cluster(s, host_cluster_offset) ||
+                (has_data_file(bs) &&
+                 host_cluster_offset != offset - offset_in_cluster)) {
+                return false;
+            }
+        } else if ((l2_entry & L2E_OFFSET_MASK) !=
+                   host_cluster_offset + ((uint64_t) i << s->cluster_bits)) {
+            break;
+        }
+    }
+
+    /* The L2 table may have been replaced while we were reading it */
+    if (i == 0 || (l1_table[l1_index] & L1E_OFFSET_MASK) != l2_offset) {
+        return false;
+    }
+
+    bytes_available = MIN((uint64_t) i << s->cluster_bits, bytes_needed);
+    *bytes = bytes_available - offset_in_cluster;
+    *host_offset = host_cluster_offset + offset_in_cluster;
+
+    return true;
+}
+
 /*
  * get_cluster_table
  *
@@ -1606,6 +1716,7 @@ do_alloc_cluster_offset(BlockDriverState *bs, uint64_t guest_offset,
                         uint64_t *host_offset, uint64_t *nb_clusters)
 {
     BDRVQcow2State *s = bs->opaque;
+    int ret;
 
     trace_qcow2_do_alloc_clusters_offset(qemu_coroutine_self(), guest_offset,
                                          *host_offset, *nb_clusters);
@@ -1619,6 +1730,11 @@ do_alloc_cluster_offset(BlockDriverState *bs, uint64_t guest_offset,
 
     /* Allocate new clusters */
     trace_qcow2_cluster_alloc_phys(qemu_coroutine_self());
+    ret = qcow2_cluster_pool_alloc(bs, host_offset, nb_clusters);
+    if (ret != 0) {
+        return ret < 0 ? ret : 0;
+    }
+
     if (*host_offset == INV_OFFSET) {
         int64_t cluster_offset =
             qcow2_alloc_clusters(bs, *nb_clusters * s->cluster_size);
@@ -1628,11 +1744,12 @@ do_alloc_cluster_offset(BlockDriverState *bs, uint64_t guest_offset,
         *host_offset = cluster_offset;
         return 0;
     } else {
-        int64_t ret = qcow2_alloc_clusters_at(bs, *host_offset, *nb_clusters);
-        if (ret < 0) {
-            return ret;
+        int64_t allocated = qcow2_alloc_clusters_at(bs, *host_offset,
+                                                    *nb_clusters);
+        if (allocated < 0) {
+            return allocated;
         }
-        *nb_clusters = ret;
+        *nb_clusters = allocated;
         return 0;
     }
 }
@@ -23,6 +23,7 @@
  */
 
 #include "qemu/osdep.h"
+#include "block/aio_task.h"
 #include "block/block-io.h"
 #include "qapi/error.h"
 #include "qcow2.h"
@@ -1065,6 +1066,104 @@ int64_t coroutine_fn qcow2_alloc_clusters_at(BlockDriverState *bs, uint64_t offs
     return i;
 }
 
+static Qcow2ClusterPool *qcow2_get_cluster_pool(BDRVQcow2State *s)
+{
+    AioContext *ctx = qemu_get_current_aio_context();
+    Qcow2ClusterPool *pool;
+
+    QLIST_FOREACH(pool, &s->cluster_pools, next) {
+        if (pool->ctx == ctx) {
+            return pool;
+        }
+    }
+
+    pool = g_new0(Qcow2ClusterPool, 1);
+    pool->ctx = ctx;
+    QLIST_INSERT_HEAD(&s->cluster_pools, pool, next);
+    return pool;
+}
+
+/*
+ * Allocate data clusters from the pool of the current AioContext.  The
+ * pool is refilled with s->cluster_pool_size clusters at once, so that
+ * the allocating writes of a queue only update the refcounts once per
+ * refill and stay contiguous in the image file, whatever the other
+ * queues are doing.
+ *
+ * If *host_offset is not INV_OFFSET, the allocation has to start there
+ * and is only done from the pool if the pool can extend it.  Otherwise
+ * *host_offset is set to the start of the allocated clusters.  In both
+ * cases, *nb_clusters may be reduced.
+ *
+ * Until they are used, the clusters of the pools are leaked in the image
+ * file; qcow2_cluster_pool_release() gives them back.
+ *
+ * Returns 1 if the clusters were taken from the pool, 0 if the caller
+ * must allocate them itself, and -errno on failure.
+ */
+int qcow2_cluster_pool_alloc(BlockDriverState *bs, uint64_t *host_offset,
+                             uint64_t *nb_clusters)
+{
+    BDRVQcow2State *s = bs->opaque;
+    Qcow2ClusterPool *pool;
+    uint64_t n;
+
+    if (!s->cluster_pool_size) {
+        return 0;
+    }
+
+    pool = qcow2_get_cluster_pool(s);
+    if (*host_offset != INV_OFFSET) {
+        if (!pool->nb_clusters || pool->offset != *host_offset) {
+            return 0;
+        }
+    } else if (!pool->nb_clusters) {
+        int64_t offset;
+
+        /* Large allocations are contiguous anyway */
+        if (*nb_clusters >= s->cluster_pool_size) {
+            return 0;
+        }
+
+        offset = qcow2_alloc_clusters(bs, (uint64_t) s->cluster_pool_size *
+                                          s->cluster_size);
+        if (offset < 0) {
+            return offset;
+        }
+        pool->offset = offset;
+        pool->nb_clusters = s->cluster_pool_size;
+        s->alloc_stats.pool_refills++;
+    }
+
+    n = MIN(*nb_clusters, pool->nb_clusters);
+    trace_qcow2_cluster_pool_alloc(qemu_coroutine_self(), pool->ctx,
+                                   pool->offset, n);
+
+    *host_offset = pool->offset;
+    *nb_clusters = n;
+    pool->offset += n << s->cluster_bits;
+    pool->nb_clusters -= n;
+
+    return 1;
+}
+
+/* Free the clusters that are left in the pools */
+void qcow2_cluster_pool_release(BlockDriverState *bs)
+{
+    BDRVQcow2State *s = bs->opaque;
+    Qcow2ClusterPool *pool, *next;
+
+    QLIST_FOREACH_SAFE(pool, &s->cluster_pools, next, next) {
+        if (pool->nb_clusters) {
+            qcow2_free_clusters(bs, pool->offset,
+                                pool->nb_clusters << s->cluster_bits,
+                                QCOW2_DISCARD_NEVER);
+        }
+        QLIST_REMOVE(pool, next);
+        g_free(pool);
+    }
+}
+
 /* only used to allocate compressed sectors. We try to allocate
    contiguous sectors. size must be <= cluster_size */
 int64_t coroutine_fn GRAPH_RDLOCK qcow2_alloc_bytes(BlockDriverState *bs, int size)
@@ -1851,11 +1950,43 @@ check_refcounts_l2(BlockDriverState *bs, BdrvCheckResult *res,
     return 0;
 }
 
+typedef struct CheckL2Task {
+    AioTask task;
+
+    BlockDriverState *bs;
+    BdrvCheckResult *res;
+    void **refcount_table;
+    int64_t *refcount_table_size;
+    int64_t l2_offset;
+    int flags;
+    BdrvCheckMode fix;
+    bool active;
+} CheckL2Task;
+
+/*
+ * This function can count as GRAPH_RDLOCK because check_refcounts_l1() holds
+ * the graph lock and keeps it until this coroutine has terminated.
+ */
+static int coroutine_fn GRAPH_RDLOCK
+check_refcounts_l2_task_entry(AioTask *task)
+{
+    CheckL2Task *t = container_of(task, CheckL2Task, task);
+
+    return check_refcounts_l2(t->bs, t->res, t->refcount_table,
+                              t->refcount_table_size, t->l2_offset, t->flags,
+                              t->fix, t->active);
+}
+
 /*
  * Increases the refcount for the L1 table, its L2 tables and all referenced
  * clusters in the given refcount table. While doing so, performs some checks
  * on L1 and L2 entries.
  *
+ * The L2 tables are read and checked by up to QCOW2_MAX_WORKERS coroutines
+ * at once, so that scanning large images is not bound by the latency of
+ * reading one table after the other.  They only share the refcount table
+ * and @res, which are never updated across a yield.
+ *
  * Returns the number of errors found by the checks or -errno if an internal
  * error occurred.
  */
@@ -1868,6 +1999,7 @@ check_refcounts_l1(BlockDriverState *bs, BdrvCheckResult *res,
     BDRVQcow2State *s = bs->opaque;
     size_t l1_size_bytes = l1_size * L1E_SIZE;
     g_autofree uint64_t *l1_table = NULL;
+    AioTaskPool *aio;
     uint64_t l2_offset;
     int i, ret;
 
@@ -1900,8 +2032,12 @@ check_refcounts_l1(BlockDriverState *bs, BdrvCheckResult *res,
         be64_to_cpus(&l1_table[i]);
     }
 
+    aio = aio_task_pool_new(QCOW2_MAX_WORKERS);
+
     /* Do the actual checks */
-    for (i = 0; i < l1_size; i++) {
+    for (i = 0; i < l1_size && aio_task_pool_status(aio) == 0; i++) {
+        CheckL2Task *task;
+
         if (!l1_table[i]) {
             continue;
         }
@@ -1919,7 +2055,7 @@ check_refcounts_l1(BlockDriverState *bs, BdrvCheckResult *res,
                                        refcount_table, refcount_table_size,
                                        l2_offset, s->cluster_size);
         if (ret < 0) {
-            return ret;
+            goto out;
         }
 
         /* L2 tables are cluster aligned */
@@ -1930,15 +2066,31 @@ check_refcounts_l1(BlockDriverState *bs, BdrvCheckResult *res,
         }
 
         /* Process and check L2 entries */
-        ret = check_refcounts_l2(bs, res, refcount_table,
-                                 refcount_table_size, l2_offset, flags,
-                                 fix, active);
-        if (ret < 0) {
-            return ret;
-        }
+        task = g_new(CheckL2Task, 1);
+        *task = (CheckL2Task) {
+            .task.func = check_refcounts_l2_task_entry,
+            .bs = bs,
+            .res = res,
+            .refcount_table = refcount_table,
+            .refcount_table_size = refcount_table_size,
+            .l2_offset = l2_offset,
+            .flags = flags,
+            .fix = fix,
+            .active = active,
+        };
+        aio_task_pool_start_task(aio, &task->task);
     }
 
-    return 0;
+    ret = 0;
+
+out:
+    aio_task_pool_wait_all(aio);
+    if (ret == 0) {
+        ret = aio_task_pool_status(aio);
+    }
+    aio_task_pool_free(aio);
+
+    return ret;
 }
 
 /*
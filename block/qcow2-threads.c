@@ -38,14 +38,20 @@
 #include "block/thread-pool.h"
 #include "crypto.h"
 
+/*
+ * Run @func in a worker thread once less than @max_threads threads are busy
+ * for @bs.  Compression and encryption have different limits, so all the
+ * waiters are woken up when a thread becomes free.
+ */
 static int coroutine_fn
-qcow2_co_process(BlockDriverState *bs, ThreadPoolFunc *func, void *arg)
+qcow2_co_process(BlockDriverState *bs, ThreadPoolFunc *func, void *arg,
+                 int max_threads)
 {
     int ret;
     BDRVQcow2State *s = bs->opaque;
 
     qemu_co_mutex_lock(&s->lock);
-    while (s->nb_threads >= QCOW2_MAX_THREADS) {
+    while (s->nb_threads >= max_threads) {
         qemu_co_queue_wait(&s->thread_task_queue, &s->lock);
     }
     s->nb_threads++;
@@ -55,7 +61,7 @@ qcow2_co_process(BlockDriverState *bs, ThreadPoolFunc *func, void *arg)
 
     qemu_co_mutex_lock(&s->lock);
     s->nb_threads--;
-    qemu_co_queue_next(&s->thread_task_queue);
+    qemu_co_queue_restart_all(&s->thread_task_queue);
     qemu_co_mutex_unlock(&s->lock);
 
     return ret;
@@ -339,6 +345,7 @@ static ssize_t coroutine_fn
 qcow2_co_do_compress(BlockDriverState *bs, void *dest, size_t dest_size,
                      const void *src, size_t src_size, Qcow2CompressFunc func)
 {
+    BDRVQcow2State *s = bs->opaque;
     Qcow2CompressData arg = {
         .dest = dest,
         .dest_size = dest_size,
@@ -347,7 +354,7 @@ qcow2_co_do_compress(BlockDriverState *bs, void *dest, size_t dest_size,
         .func = func,
     };
 
-    qcow2_co_process(bs, qcow2_compress_pool_func, &arg);
+    qcow2_co_process(bs, qcow2_compress_pool_func, &arg, s->compress_threads);
 
     return arg.ret;
 }
@@ -430,36 +437,13 @@ qcow2_co_decompress(BlockDriverState *bs, void *dest, size_t dest_size,
  * Cryptography
  */
 
-/*
- * Qcow2EncDecFunc: common prototype of qcrypto_block_encrypt() and
- * qcrypto_block_decrypt() functions.
- */
-typedef int (*Qcow2EncDecFunc)(QCryptoBlock *block, uint64_t offset,
-                               uint8_t *buf, size_t len, Error **errp);
-
-typedef struct Qcow2EncDecData {
-    QCryptoBlock *block;
-    uint64_t offset;
-    uint8_t *buf;
-    size_t len;
-
-    Qcow2EncDecFunc func;
-} Qcow2EncDecData;
-
-static int qcow2_encdec_pool_func(void *opaque)
-{
-    Qcow2EncDecData *data = opaque;
-
-    return data->func(data->block, data->offset, data->buf, data->len, NULL);
-}
-
 static int coroutine_fn
 qcow2_co_encdec(BlockDriverState *bs, uint64_t host_offset,
                 uint64_t guest_offset, void *buf, size_t len,
-                Qcow2EncDecFunc func)
+                BlockCryptoEncDecFunc func)
 {
     BDRVQcow2State *s = bs->opaque;
-    Qcow2EncDecData arg = {
+    BlockCryptoEncDecData arg = {
         .block = s->crypto,
         .offset = s->crypt_physical_offset ? host_offset : guest_offset,
         .buf = buf,
@@ -475,7 +459,9 @@ qcow2_co_encdec(BlockDriverState *bs, uint64_t host_offset,
     assert(QEMU_IS_ALIGNED(host_offset, sector_size));
     assert(QEMU_IS_ALIGNED(len, sector_size));
 
-    return len == 0 ? 0 : qcow2_co_process(bs, qcow2_encdec_pool_func, &arg);
+    /* One cipher per thread was allocated when opening the image */
+    return len == 0 ? 0 : qcow2_co_process(bs, block_crypto_encdec_pool_func,
+                                           &arg, QCOW2_MAX_THREADS);
 }
 
 /*
@@ -614,6 +614,9 @@ qcow2_co_check_locked(BlockDriverState *bs, BdrvCheckResult *result,
 
     memset(result, 0, sizeof(*result));
 
+    /* Reserved clusters would be reported as leaks */
+    qcow2_cluster_pool_release(bs);
+
     ret = qcow2_check_read_snapshot_table(bs, &snapshot_res, fix);
     if (ret < 0) {
         qcow2_add_check_result(result, &snapshot_res, false);
@@ -817,6 +820,18 @@ static QemuOptsList qcow2_runtime_opts = {
             .type = QEMU_OPT_NUMBER,
             .help = "Clean unused cache entries after this time (in seconds)",
         },
+        {
+            .name = QCOW2_OPT_CLUSTER_POOL_SIZE,
+            .type = QEMU_OPT_NUMBER,
+            .help = "Number of data clusters reserved at once for the "
+                    "allocating writes of each AioContext",
+        },
+        {
+            .name = QCOW2_OPT_COMPRESS_THREADS,
+            .type = QEMU_OPT_NUMBER,
+            .help = "Maximum number of threads compressing or decompressing "
+                    "clusters at once",
+        },
         BLOCK_CRYPTO_OPT_DEF_KEY_SECRET("encrypt.",
             "ID of secret providing qcow2 AES key or LUKS passphrase"),
         { /* end of list */ }
@@ -979,6 +994,8 @@ typedef struct Qcow2ReopenState {
     bool discard_passthrough[QCOW2_DISCARD_MAX];
     bool discard_no_unref;
     uint64_t cache_clean_interval;
+    uint64_t cluster_pool_size;
+    uint64_t compress_threads;
     QCryptoBlockOpenOptions *crypto_opts; /* Disk encryption runtime options */
 } Qcow2ReopenState;
 
@@ -1079,6 +1096,26 @@ qcow2_update_options_prepare(BlockDriverState *bs, Qcow2ReopenState *r,
         goto fail;
     }
 
+    r->cluster_pool_size =
+        qemu_opt_get_number(opts, QCOW2_OPT_CLUSTER_POOL_SIZE, 0);
+    if (r->cluster_pool_size > QCOW2_MAX_CLUSTER_POOL_SIZE) {
+        error_setg(errp, QCOW2_OPT_CLUSTER_POOL_SIZE " must not exceed %d",
+                   QCOW2_MAX_CLUSTER_POOL_SIZE);
+        ret = -EINVAL;
+        goto fail;
+    }
+
+    r->compress_threads =
+        qemu_opt_get_number(opts, QCOW2_OPT_COMPRESS_THREADS,
+                            QCOW2_MAX_THREADS);
+    if (r->compress_threads < 1 ||
+        r->compress_threads > QCOW2_MAX_COMPRESS_THREADS) {
+        error_setg(errp, QCOW2_OPT_COMPRESS_THREADS " must be between 1 "
+                   "and %d", QCOW2_MAX_COMPRESS_THREADS);
+        ret = -EINVAL;
+        goto fail;
+    }
+
     /* lazy-refcounts; flush if going from enabled to disabled */
     r->use_lazy_refcounts = qemu_opt_get_bool(opts, QCOW2_OPT_LAZY_REFCOUNTS,
         (s->compatible_features & QCOW2_COMPAT_LAZY_REFCOUNTS));
@@ -1238,6 +1275,8 @@ static void qcow2_update_options_commit(BlockDriverState *bs,
     }
 
     s->discard_no_unref = r->discard_no_unref;
+    s->cluster_pool_size = r->cluster_pool_size;
+    s->compress_threads = r->compress_threads;
 
     if (s->cache_clean_interval != r->cache_clean_interval) {
         cache_clean_timer_del(bs);
@@ -1874,6 +1913,7 @@ qcow2_do_open(BlockDriverState *bs, QDict *options, int flags,
 #endif
 
     qemu_co_queue_init(&s->thread_task_queue);
+    qemu_mutex_init(&s->decompressed_lock);
 
     return ret;
 
@@ -1997,6 +2037,8 @@ qcow2_reopen_prepare(BDRVReopenState *state,BlockReopenQueue *queue,
             goto fail;
         }
 
+        qcow2_cluster_pool_release(state->bs);
+
         ret = bdrv_flush(state->bs);
         if (ret < 0) {
             goto fail;
@@ -2389,12 +2431,17 @@ qcow2_co_preadv_part(BlockDriverState *bs, int64_t offset, int64_t bytes,
                             QCOW_MAX_CRYPT_CLUSTERS * s->cluster_size);
         }
 
-        qemu_co_mutex_lock(&s->lock);
-        ret = qcow2_get_host_offset(bs, offset, &cur_bytes,
-                                    &host_offset, &type);
-        qemu_co_mutex_unlock(&s->lock);
-        if (ret < 0) {
-            goto out;
+        if (qcow2_get_host_offset_cached(bs, offset, &cur_bytes,
+                                         &host_offset)) {
+            type = QCOW2_SUBCLUSTER_NORMAL;
+        } else {
+            qemu_co_mutex_lock(&s->lock);
+            ret = qcow2_get_host_offset(bs, offset, &cur_bytes,
+                                        &host_offset, &type);
+            qemu_co_mutex_unlock(&s->lock);
+            if (ret < 0) {
+                goto out;
+            }
         }
 
         if (type == QCOW2_SUBCLUSTER_ZERO_PLAIN ||
@@ -2659,6 +2706,14 @@ static coroutine_fn GRAPH_RDLOCK int qcow2_co_pwritev_task_entry(AioTask *task)
                                  t->l2meta);
 }
 
+/* Called with s->lock held */
+static void qcow2_account_alloc(BDRVQcow2State *s, int64_t ns)
+{
+    s->alloc_stats.nb_allocs++;
+    s->alloc_stats.total_time_ns += ns;
+    s->alloc_stats.max_time_ns = MAX(s->alloc_stats.max_time_ns, ns);
+}
+
 static int coroutine_fn GRAPH_RDLOCK
 qcow2_co_pwritev_part(BlockDriverState *bs, int64_t offset, int64_t bytes,
                       QEMUIOVector *qiov, size_t qiov_offset,
@@ -2671,6 +2726,7 @@ qcow2_co_pwritev_part(BlockDriverState *bs, int64_t offset, int64_t bytes,
     uint64_t host_offset;
     QCowL2Meta *l2meta = NULL;
     AioTaskPool *aio = NULL;
+    int64_t start_ns;
 
     trace_qcow2_writev_start_req(qemu_coroutine_self(), offset, bytes);
 
@@ -2687,6 +2743,7 @@ qcow2_co_pwritev_part(BlockDriverState *bs, int64_t offset, int64_t bytes,
                             - offset_in_cluster);
         }
 
+        start_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
         qemu_co_mutex_lock(&s->lock);
 
         ret = qcow2_alloc_host_offset(bs, offset, &cur_bytes,
@@ -2695,6 +2752,11 @@ qcow2_co_pwritev_part(BlockDriverState *bs, int64_t offset, int64_t bytes,
             goto out_locked;
         }
 
+        if (l2meta) {
+            qcow2_account_alloc(s, qemu_clock_get_ns(QEMU_CLOCK_REALTIME) -
+                                   start_ns);
+        }
+
         ret = qcow2_pre_write_overlap_check(bs, 0, host_offset,
                                             cur_bytes, true);
         if (ret < 0) {
@@ -2756,6 +2818,8 @@ static int GRAPH_RDLOCK qcow2_inactivate(BlockDriverState *bs)
                           bdrv_get_device_or_node_name(bs));
     }
 
+    qcow2_cluster_pool_release(bs);
+
     ret = qcow2_cache_flush(bs, s->l2_table_cache);
     if (ret) {
         result = ret;
@@ -2777,6 +2841,118 @@ static int GRAPH_RDLOCK qcow2_inactivate(BlockDriverState *bs)
     return result;
 }
 
+/* Called with decompressed_lock held */
+static Qcow2DecompressedCluster *
+qcow2_decompressed_cache_find(BDRVQcow2State *s, uint64_t coffset)
+{
+    int i;
+
+    for (i = 0; i < s->nb_decompressed; i++) {
+        if (s->decompressed[i].coffset == coffset) {
+            return &s->decompressed[i];
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * Copy @bytes at @offset_in_cluster of the decompressed cluster whose data is
+ * at @coffset to @qiov.  Return false if the cluster is not in the cache.
+ */
+static bool qcow2_decompressed_cache_read(BDRVQcow2State *s, uint64_t coffset,
+                                          int offset_in_cluster,
+                                          uint64_t bytes, QEMUIOVector *qiov,
+                                          size_t qiov_offset)
+{
+    QEMU_LOCK_GUARD(&s->decompressed_lock);
+    Qcow2DecompressedCluster *c = qcow2_decompressed_cache_find(s, coffset);
+
+    if (!c) {
+        return false;
+    }
+
+    c->lru_counter = ++s->decompressed_lru_counter;
+    qemu_iovec_from_buf(qiov, qiov_offset, c->buf + offset_in_cluster, bytes);
+    return true;
+}
+
+/*
+ * Add the decompressed cluster @buf to the cache, unless compressed data was
+ * allocated since @generation was read: the data at @coffset may have been
+ * freed and replaced while @buf was being decompressed.
+ */
+static void qcow2_decompressed_cache_add(BDRVQcow2State *s, uint64_t coffset,
+                                         int csize, unsigned generation,
+                                         const uint8_t *buf)
+{
+    QEMU_LOCK_GUARD(&s->decompressed_lock);
+    Qcow2DecompressedCluster *c = NULL;
+    int i;
+
+    if (generation != s->decompressed_generation) {
+        return;
+    }
+
+    if (!s->decompressed) {
+        s->nb_decompressed = MAX(QCOW2_DECOMPRESSED_CACHE_SIZE / s->cluster_size,
+                                 2);
+        s->decompressed = g_new0(Qcow2DecompressedCluster, s->nb_decompressed);
+    }
+
+    if (qcow2_decompressed_cache_find(s, coffset)) {
+        /* Read by a concurrent request */
+        return;
+    }
+
+    for (i = 0; i < s->nb_decompressed; i++) {
+        Qcow2DecompressedCluster *e = &s->decompressed[i];
+
+        if (!c || e->lru_counter < c->lru_counter) {
+            c = e;
+        }
+    }
+
+    if (!c->buf) {
+        c->buf = g_malloc(s->cluster_size);
+    }
+    memcpy(c->buf, buf, s->cluster_size);
+    c->coffset = coffset;
+    c->csize = csize;
+    c->lru_counter = ++s->decompressed_lru_counter;
+}
+
+/* Drop the decompressed clusters whose data overlaps @offset..@offset+@bytes */
+static void qcow2_decompressed_cache_discard(BDRVQcow2State *s,
+                                             uint64_t offset, uint64_t bytes)
+{
+    QEMU_LOCK_GUARD(&s->decompressed_lock);
+    int i;
+
+    qatomic_inc(&s->decompressed_generation);
+    for (i = 0; i < s->nb_decompressed; i++) {
+        Qcow2DecompressedCluster *c = &s->decompressed[i];
+
+        if (c->coffset && c->coffset < offset + bytes &&
+            offset < c->coffset + c->csize) {
+            c->coffset = 0;
+            c->lru_counter = 0;
+        }
+    }
+}
+
+static void qcow2_decompressed_cache_free(BDRVQcow2State *s)
+{
+    int i;
+
+    for (i = 0; i < s->nb_decompressed; i++) {
+        g_free(s->decompressed[i].buf);
+    }
+    g_free(s->decompressed);
+    s->decompressed = NULL;
+    s->nb_decompressed = 0;
+}
+
 static void coroutine_mixed_fn GRAPH_RDLOCK
 qcow2_do_close(BlockDriverState *bs, bool close_data_file)
 {
@@ -2814,6 +2990,9 @@ qcow2_do_close(BlockDriverState *bs, bool close_data_file)
         bdrv_graph_rdlock_main_loop();
     }
 
+    qcow2_decompressed_cache_free(s);
+    qemu_mutex_destroy(&s->decompressed_lock);
+
     qcow2_refcount_close(bs);
     qcow2_free_snapshots(bs);
 }
@@ -4307,6 +4486,9 @@ qcow2_co_truncate(BlockDriverState *bs, int64_t offset, bool exact,
 
     qemu_co_mutex_lock(&s->lock);
 
+    /* Don't keep clusters past the end of a shrunk image */
+    qcow2_cluster_pool_release(bs);
+
     /*
      * Even though we store snapshot size for all images, it was not
      * required until v3, so it is not safe to proceed for v2.
@@ -4708,6 +4890,8 @@ qcow2_co_pwritev_compressed_task(BlockDriverState *bs,
         goto fail;
     }
 
+    qcow2_decompressed_cache_discard(s, cluster_offset, out_len);
+
     BLKDBG_CO_EVENT(s->data_file, BLKDBG_WRITE_COMPRESSED);
     ret = bdrv_co_pwrite(s->data_file, cluster_offset, out_len, out_buf, 0);
     if (ret < 0) {
@@ -4780,7 +4964,8 @@ qcow2_co_pwritev_compressed_part(BlockDriverState *bs,
         uint64_t chunk_size = MIN(bytes, s->cluster_size);
 
         if (!aio && chunk_size != bytes) {
-            aio = aio_task_pool_new(QCOW2_MAX_WORKERS);
+            aio = aio_task_pool_new(MAX(QCOW2_MAX_WORKERS,
+                                        s->compress_threads));
         }
 
         ret = qcow2_add_task(bs, aio, qcow2_co_pwritev_compressed_task_entry,
@@ -4804,6 +4989,167 @@ qcow2_co_pwritev_compressed_part(BlockDriverState *bs,
     return ret;
 }
 
+/* Read and decompress the @csize bytes of compressed data at @coffset */
+static int coroutine_fn GRAPH_RDLOCK
+qcow2_co_read_compressed_cluster(BlockDriverState *bs, uint64_t coffset,
+                                 int csize, uint8_t *out_buf)
+{
+    BDRVQcow2State *s = bs->opaque;
+    g_autofree uint8_t *buf = NULL;
+    int ret;
+
+    buf = g_try_malloc(csize);
+    if (!buf) {
+        return -ENOMEM;
+    }
+
+    BLKDBG_CO_EVENT(bs->file, BLKDBG_READ_COMPRESSED);
+    ret = bdrv_co_pread(bs->file, coffset, csize, buf, 0);
+    if (ret < 0) {
+        return ret;
+    }
+
+    if (qcow2_co_decompress(bs, out_buf, s->cluster_size, buf, csize) < 0) {
+        return -EIO;
+    }
+
+    return 0;
+}
+
+typedef struct Qcow2ReadaheadTask {
+    AioTask task;
+    BlockDriverState *bs;
+    uint64_t coffset;
+    int csize;
+} Qcow2ReadaheadTask;
+
+/*
+ * This function can count as GRAPH_RDLOCK because qcow2_co_readahead() holds
+ * the graph lock and keeps it until this coroutine has terminated.
+ */
+static int coroutine_fn GRAPH_RDLOCK
+qcow2_co_readahead_task_entry(AioTask *task)
+{
+    Qcow2ReadaheadTask *t = container_of(task, Qcow2ReadaheadTask, task);
+    BDRVQcow2State *s = t->bs->opaque;
+    unsigned generation = qatomic_read(&s->decompressed_generation);
+    uint8_t *buf = qemu_blockalign(t->bs, s->cluster_size);
+    int ret;
+
+    ret = qcow2_co_read_compressed_cluster(t->bs, t->coffset, t->csize, buf);
+    if (ret == 0) {
+        qcow2_decompressed_cache_add(s, t->coffset, t->csize, generation, buf);
+    }
+    qemu_vfree(buf);
+
+    return ret;
+}
+
+/*
+ * Read and decompress the compressed clusters that follow a sequential read,
+ * in parallel, into the decompressed cluster cache.
+ */
+static void coroutine_fn qcow2_co_readahead(void *opaque)
+{
+    BlockDriverState *bs = opaque;
+    BDRVQcow2State *s = bs->opaque;
+    uint64_t disk_size = bs->total_sectors << BDRV_SECTOR_BITS;
+    AioTaskPool *aio = aio_task_pool_new(QCOW2_MAX_WORKERS);
+    uint64_t offset;
+    int nb_clusters, i;
+
+    WITH_QEMU_LOCK_GUARD(&s->decompressed_lock) {
+        offset = s->readahead_end;
+        nb_clusters = MIN(s->nb_decompressed / 2, QCOW2_MAX_WORKERS);
+    }
+
+    bdrv_graph_co_rdlock();
+
+    trace_qcow2_readahead(qemu_coroutine_self(), bs, offset, nb_clusters);
+
+    for (i = 0; i < nb_clusters && offset < disk_size &&
+         aio_task_pool_status(aio) == 0; i++) {
+        Qcow2ReadaheadTask *task;
+        unsigned int bytes = s->cluster_size;
+        QCow2SubclusterType type;
+        uint64_t l2_entry, coffset;
+        bool cached;
+        int csize, ret;
+
+        qemu_co_mutex_lock(&s->lock);
+        ret = qcow2_get_host_offset(bs, offset, &bytes, &l2_entry, &type);
+        qemu_co_mutex_unlock(&s->lock);
+        if (ret < 0 || type != QCOW2_SUBCLUSTER_COMPRESSED) {
+            break;
+        }
+        offset += s->cluster_size;
+
+        qcow2_parse_compressed_l2_entry(bs, l2_entry, &coffset, &csize);
+        WITH_QEMU_LOCK_GUARD(&s->decompressed_lock) {
+            cached = qcow2_decompressed_cache_find(s, coffset) != NULL;
+        }
+        if (cached) {
+            continue;
+        }
+
+        task = g_new(Qcow2ReadaheadTask, 1);
+        *task = (Qcow2ReadaheadTask) {
+            .task.func = qcow2_co_readahead_task_entry,
+            .bs = bs,
+            .coffset = coffset,
+            .csize = csize,
+        };
+        aio_task_pool_start_task(aio, &task->task);
+    }
+
+    aio_task_pool_wait_all(aio);
+    g_free(aio);
+
+    WITH_QEMU_LOCK_GUARD(&s->decompressed_lock) {
+        /* Do not try again if the next cluster is not compressed */
+        s->readahead_end = offset + (i < nb_clusters ? s->cluster_size : 0);
+        s->readahead_in_flight = false;
+    }
+
+    bdrv_graph_co_rdunlock();
+    bdrv_dec_in_flight(bs);
+}
+
+/*
+ * Start reading ahead if the compressed cluster at @offset was read right
+ * after the previous one, and fewer than half of the clusters that are read
+ * ahead at once are left.
+ */
+static void coroutine_fn GRAPH_RDLOCK
+qcow2_co_readahead_check(BlockDriverState *bs, uint64_t offset)
+{
+    BDRVQcow2State *s = bs->opaque;
+    uint64_t cluster = start_of_cluster(s, offset);
+
+    WITH_QEMU_LOCK_GUARD(&s->decompressed_lock) {
+        bool sequential = cluster == s->readahead_last ||
+                          cluster == s->readahead_last + s->cluster_size;
+        uint64_t ahead = MIN(s->nb_decompressed / 2, QCOW2_MAX_WORKERS);
+
+        s->readahead_last = cluster;
+        if (!sequential || s->readahead_in_flight || ahead < 2) {
+            return;
+        }
+        if (s->readahead_end <= cluster ||
+            s->readahead_end > cluster + (ahead + 1) * s->cluster_size) {
+            /* Left over from reading elsewhere */
+            s->readahead_end = cluster + s->cluster_size;
+        } else if (s->readahead_end > cluster + ahead / 2 * s->cluster_size) {
+            return;
+        }
+        s->readahead_in_flight = true;
+    }
+
+    bdrv_inc_in_flight(bs);
+    aio_co_enter(bdrv_get_aio_context(bs),
+                 qemu_coroutine_create(qcow2_co_readahead, bs));
+}
+
 static int coroutine_fn GRAPH_RDLOCK
 qcow2_co_preadv_compressed(BlockDriverState *bs,
                            uint64_t l2_entry,
@@ -4815,34 +5161,32 @@ qcow2_co_preadv_compressed(BlockDriverState *bs,
     BDRVQcow2State *s = bs->opaque;
     int ret = 0, csize;
     uint64_t coffset;
-    uint8_t *buf, *out_buf;
+    unsigned generation;
+    uint8_t *out_buf;
     int offset_in_cluster = offset_into_cluster(s, offset);
 
     qcow2_parse_compressed_l2_entry(bs, l2_entry, &coffset, &csize);
 
-    buf = g_try_malloc(csize);
-    if (!buf) {
-        return -ENOMEM;
+    if (qcow2_decompressed_cache_read(s, coffset, offset_in_cluster, bytes,
+                                      qiov, qiov_offset)) {
+        qcow2_co_readahead_check(bs, offset);
+        return 0;
     }
 
+    generation = qatomic_read(&s->decompressed_generation);
     out_buf = qemu_blockalign(bs, s->cluster_size);
 
-    BLKDBG_CO_EVENT(bs->file, BLKDBG_READ_COMPRESSED);
-    ret = bdrv_co_pread(bs->file, coffset, csize, buf, 0);
+    ret = qcow2_co_read_compressed_cluster(bs, coffset, csize, out_buf);
     if (ret < 0) {
         goto fail;
     }
 
-    if (qcow2_co_decompress(bs, out_buf, s->cluster_size, buf, csize) < 0) {
-        ret = -EIO;
-        goto fail;
-    }
-
     qemu_iovec_from_buf(qiov, qiov_offset, out_buf + offset_in_cluster, bytes);
+    qcow2_decompressed_cache_add(s, coffset, csize, generation, out_buf);
+    qcow2_co_readahead_check(bs, offset);
 
 fail:
     qemu_vfree(out_buf);
-    g_free(buf);
 
     return ret;
 }
@@ -4861,6 +5205,9 @@ static int GRAPH_RDLOCK make_completely_empty(BlockDriverState *bs)
         uint32_t reftable_clusters;
     } QEMU_PACKED l1_ofs_rt_ofs_cls;
 
+    /* The refcount structures are recreated from scratch below */
+    qcow2_cluster_pool_release(bs);
+
     ret = qcow2_cache_empty(bs, s->l2_table_cache);
     if (ret < 0) {
         goto fail;
@@ -5313,6 +5660,22 @@ qcow2_get_specific_info(BlockDriverState *bs, Error **errp)
     return spec_info;
 }
 
+static BlockStatsSpecific *qcow2_get_specific_stats(BlockDriverState *bs)
+{
+    BlockStatsSpecific *stats = g_new(BlockStatsSpecific, 1);
+    BDRVQcow2State *s = bs->opaque;
+
+    stats->driver = BLOCKDEV_DRIVER_QCOW2;
+    stats->u.qcow2 = (BlockStatsSpecificQcow2) {
+        .alloc_nb = s->alloc_stats.nb_allocs,
+        .alloc_total_time_ns = s->alloc_stats.total_time_ns,
+        .alloc_max_time_ns = s->alloc_stats.max_time_ns,
+        .cluster_pool_refills = s->alloc_stats.pool_refills,
+    };
+
+    return stats;
+}
+
 static int coroutine_mixed_fn GRAPH_RDLOCK
 qcow2_has_zero_init(BlockDriverState *bs)
 {
@@ -6162,6 +6525,7 @@ BlockDriver bdrv_qcow2 = {
     .bdrv_measure                       = qcow2_measure,
     .bdrv_co_get_info                   = qcow2_co_get_info,
     .bdrv_get_specific_info             = qcow2_get_specific_info,
+    .bdrv_get_specific_stats            = qcow2_get_specific_stats,
 
     .bdrv_co_save_vmstate               = qcow2_co_save_vmstate,
     .bdrv_co_load_vmstate               = qcow2_co_load_vmstate,
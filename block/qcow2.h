@@ -150,6 +150,8 @@
 #define QCOW2_OPT_L2_CACHE_ENTRY_SIZE "l2-cache-entry-size"
 #define QCOW2_OPT_REFCOUNT_CACHE_SIZE "refcount-cache-size"
 #define QCOW2_OPT_CACHE_CLEAN_INTERVAL "cache-clean-interval"
+#define QCOW2_OPT_CLUSTER_POOL_SIZE "cluster-pool-size"
+#define QCOW2_OPT_COMPRESS_THREADS "compress-threads"
 
 typedef struct QCowHeader {
     uint32_t magic;
@@ -322,7 +324,35 @@ typedef struct Qcow2BitmapHeaderExt {
     uint64_t bitmap_directory_offset;
 } QEMU_PACKED Qcow2BitmapHeaderExt;
 
+/*
+ * Data clusters reserved with a single refcount update for the allocating
+ * writes of one AioContext, see qcow2_cluster_pool_alloc()
+ */
+typedef struct Qcow2ClusterPool {
+    AioContext *ctx;
+    uint64_t offset;
+    uint64_t nb_clusters;
+    QLIST_ENTRY(Qcow2ClusterPool) next;
+} Qcow2ClusterPool;
+
+#define QCOW2_MAX_CLUSTER_POOL_SIZE 65536
+
 #define QCOW2_MAX_THREADS 4
+#define QCOW2_MAX_COMPRESS_THREADS 64
+
+/* Memory for decompressed clusters, at least two clusters are kept */
+#define QCOW2_DECOMPRESSED_CACHE_SIZE (1 * MiB)
+
+/*
+ * A decompressed cluster.  Compressed clusters are never written in place,
+ * so the host offset of the compressed data identifies the contents.
+ */
+typedef struct Qcow2DecompressedCluster {
+    uint64_t coffset; /* 0 if the entry is unused */
+    int csize;
+    uint64_t lru_counter;
+    uint8_t *buf;
+} Qcow2DecompressedCluster;
 
 typedef struct BDRVQcow2State {
     int cluster_bits;
@@ -350,6 +380,18 @@ typedef struct BDRVQcow2State {
 
     QLIST_HEAD(, QCowL2Meta) cluster_allocs;
 
+    /* Number of clusters reserved at once, 0 disables the pools */
+    int cluster_pool_size;
+    QLIST_HEAD(, Qcow2ClusterPool) cluster_pools;
+
+    /* Allocating writes, for query-blockstats */
+    struct {
+        uint64_t nb_allocs;
+        uint64_t total_time_ns;
+        uint64_t max_time_ns;
+        uint64_t pool_refills;
+    } alloc_stats;
+
     uint64_t *refcount_table;
     uint64_t refcount_table_offset;
     uint32_t refcount_table_size;
@@ -410,6 +452,21 @@ typedef struct BDRVQcow2State {
 
     CoQueue thread_task_queue;
     int nb_threads;
+    /* Maximum number of threads (de)compressing clusters at once */
+    int compress_threads;
+
+    /* Protects the decompressed cluster cache and the readahead state */
+    QemuMutex decompressed_lock;
+    Qcow2DecompressedCluster *decompressed;
+    int nb_decompressed;
+    uint64_t decompressed_lru_counter;
+    /* Incremented when compressed data is allocated */
+    unsigned decompressed_generation;
+    /* Guest offset of the last compressed cluster that was read */
+    uint64_t readahead_last;
+    /* Guest offset up to which compressed clusters have been read ahead */
+    uint64_t readahead_end;
+    bool readahead_in_flight;
 
     BdrvChild *data_file;
 
@@ -873,6 +930,11 @@ int64_t GRAPH_RDLOCK coroutine_fn
 qcow2_alloc_clusters_at(BlockDriverState *bs, uint64_t offset,
                         int64_t nb_clusters);
 
+int GRAPH_RDLOCK
+qcow2_cluster_pool_alloc(BlockDriverState *bs, uint64_t *host_offset,
+                         uint64_t *nb_clusters);
+void GRAPH_RDLOCK qcow2_cluster_pool_release(BlockDriverState *bs);
+
 int64_t coroutine_fn GRAPH_RDLOCK qcow2_alloc_bytes(BlockDriverState *bs, int size);
 void GRAPH_RDLOCK qcow2_free_clusters(BlockDriverState *bs,
                                       int64_t offset, int64_t size,
@@ -931,6 +993,9 @@ int GRAPH_RDLOCK
 qcow2_get_host_offset(BlockDriverState *bs, uint64_t offset,
                       unsigned int *bytes, uint64_t *host_offset,
                       QCow2SubclusterType *subcluster_type);
+bool GRAPH_RDLOCK
+qcow2_get_host_offset_cached(BlockDriverState *bs, uint64_t offset,
+                             unsigned int *bytes, uint64_t *host_offset);
 
 int coroutine_fn GRAPH_RDLOCK
 qcow2_alloc_host_offset(BlockDriverState *bs, uint64_t offset,
@@ -1021,6 +1086,8 @@ qcow2_cache_get_empty(BlockDriverState *bs, Qcow2Cache *c, uint64_t offset,
 void qcow2_cache_put(Qcow2Cache *c, void **table);
 void *qcow2_cache_is_table_offset(Qcow2Cache *c, uint64_t offset);
 void qcow2_cache_discard(Qcow2Cache *c, void *table);
+bool qcow2_cache_get_cached_entry(Qcow2Cache *c, uint64_t offset,
+                                  unsigned index, uint64_t *value);
 
 /* qcow2-bitmap.c functions */
 int coroutine_fn GRAPH_RDLOCK
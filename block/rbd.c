@@ -23,6 +23,7 @@
 #include "block/qdict.h"
 #include "crypto/secret.h"
 #include "qemu/cutils.h"
+#include "qemu/rcu_queue.h"
 #include "sysemu/replay.h"
 #include "qapi/qmp/qstring.h"
 #include "qapi/qmp/qdict.h"
@@ -90,6 +91,21 @@ typedef enum {
     RBD_AIO_WRITE_ZEROES
 } RBDAIOCmd;
 
+typedef struct RBDTask RBDTask;
+
+/*
+ * Requests that librbd completed, waiting to be completed in the AioContext
+ * that submitted them.  With multiqueue, every AioContext that submits
+ * requests has its own queue, so that completions do not go through the
+ * AioContext of the node first.
+ */
+typedef struct RBDCompletionQueue {
+    AioContext *ctx;
+    /* A BH is scheduled whenever the list is not empty */
+    QSLIST_HEAD(, RBDTask) tasks;
+    QLIST_ENTRY(RBDCompletionQueue) next;
+} RBDCompletionQueue;
+
 typedef struct BDRVRBDState {
     rados_t cluster;
     rados_ioctx_t io_ctx;
@@ -99,14 +115,20 @@ typedef struct BDRVRBDState {
     char *namespace;
     uint64_t image_size;
     uint64_t object_size;
+
+    /* Queues are only freed on close, so lookups need no lock */
+    QemuMutex queues_lock;
+    QLIST_HEAD(, RBDCompletionQueue) queues;
 } BDRVRBDState;
 
-typedef struct RBDTask {
+struct RBDTask {
     BlockDriverState *bs;
     Coroutine *co;
+    RBDCompletionQueue *queue;
+    QSLIST_ENTRY(RBDTask) next;
     bool complete;
     int64_t ret;
-} RBDTask;
+};
 
 typedef struct RBDDiffIterateReq {
     uint64_t offs;
@@ -1183,6 +1205,9 @@ static int qemu_rbd_open(BlockDriverState *bs, QDict *options, int flags,
     /* When extending regular files, we get zeros from the OS */
     bs->supported_truncate_flags = BDRV_REQ_ZERO_WRITE;
 
+    qemu_mutex_init(&s->queues_lock);
+    QLIST_INIT(&s->queues);
+
     r = 0;
     goto out;
 
@@ -1225,6 +1250,14 @@ static int qemu_rbd_reopen_prepare(BDRVReopenState *state,
 static void qemu_rbd_close(BlockDriverState *bs)
 {
     BDRVRBDState *s = bs->opaque;
+    RBDCompletionQueue *q, *next;
+
+    QLIST_FOREACH_SAFE(q, &s->queues, next, next) {
+        assert(QSLIST_EMPTY(&q->tasks));
+        QLIST_REMOVE(q, next);
+        g_free(q);
+    }
+    qemu_mutex_destroy(&s->queues_lock);
 
     rbd_close(s->image);
     rados_ioctx_destroy(s->io_ctx);
@@ -1249,11 +1282,48 @@ static int qemu_rbd_resize(BlockDriverState *bs, uint64_t size)
     return 0;
 }
 
+/* Return the completion queue of the current AioContext */
+static RBDCompletionQueue *qemu_rbd_get_queue(BDRVRBDState *s)
+{
+    AioContext *ctx = qemu_get_current_aio_context();
+    RBDCompletionQueue *q;
+
+    WITH_RCU_READ_LOCK_GUARD() {
+        QLIST_FOREACH_RCU(q, &s->queues, next) {
+            if (q->ctx == ctx) {
+                return q;
+            }
+        }
+    }
+
+    QEMU_LOCK_GUARD(&s->queues_lock);
+    QLIST_FOREACH(q, &s->queues, next) {
+        if (q->ctx == ctx) {
+            return q;
+        }
+    }
+
+    q = g_new0(RBDCompletionQueue, 1);
+    q->ctx = ctx;
+    QSLIST_INIT(&q->tasks);
+    QLIST_INSERT_HEAD_RCU(&s->queues, q, next);
+    return q;
+}
+
+/* Complete all the requests that librbd completed since the last run */
 static void qemu_rbd_finish_bh(void *opaque)
 {
-    RBDTask *task = opaque;
-    task->complete = true;
-    aio_co_wake(task->co);
+    RBDCompletionQueue *q = opaque;
+    QSLIST_HEAD(, RBDTask) tasks;
+    RBDTask *task, *next;
+
+    /* Tasks completed from now on schedule the next run */
+    QSLIST_MOVE_ATOMIC(&tasks, &q->tasks);
+
+    QSLIST_FOREACH_SAFE(task, &tasks, next, next) {
+        task->complete = true;
+        aio_co_wake(task->co);
+    }
 }
 
 /*
@@ -1262,15 +1332,27 @@ static void qemu_rbd_finish_bh(void *opaque)
  *
  * Note: this function is being called from a non qemu thread so
  * we need to be careful about what we do here. Generally we only
- * schedule a BH, and do the rest of the io completion handling
- * from qemu_rbd_finish_bh() which runs in a qemu context.
+ * queue the request and schedule a BH, and do the rest of the io
+ * completion handling from qemu_rbd_finish_bh() which runs in a
+ * qemu context.  Requests that complete while the BH is pending
+ * are completed by the same run.
  */
 static void qemu_rbd_completion_cb(rbd_completion_t c, RBDTask *task)
 {
+    RBDCompletionQueue *q = task->queue;
+    RBDTask *old;
+
     task->ret = rbd_aio_get_return_value(c);
     rbd_aio_release(c);
-    aio_bh_schedule_oneshot(bdrv_get_aio_context(task->bs),
-                            qemu_rbd_finish_bh, task);
+
+    do {
+        old = qatomic_read(&q->tasks.slh_first);
+        task->next.sle_next = old;
+    } while (qatomic_cmpxchg(&q->tasks.slh_first, old, task) != old);
+
+    if (!old) {
+        aio_bh_schedule_oneshot(q->ctx, qemu_rbd_finish_bh, q);
+    }
 }
 
 static int coroutine_fn qemu_rbd_start_co(BlockDriverState *bs,
@@ -1281,7 +1363,11 @@ static int coroutine_fn qemu_rbd_start_co(BlockDriverState *bs,
                                           RBDAIOCmd cmd)
 {
     BDRVRBDState *s = bs->opaque;
-    RBDTask task = { .bs = bs, .co = qemu_coroutine_self() };
+    RBDTask task = {
+        .bs = bs,
+        .co = qemu_coroutine_self(),
+        .queue = qemu_rbd_get_queue(s),
+    };
     rbd_completion_t c;
     int r;
 
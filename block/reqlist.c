@@ -17,31 +17,41 @@
 
 #include "block/reqlist.h"
 
+void reqlist_init(BlockReqList *reqs)
+{
+    *reqs = (BlockReqList) {};
+}
+
 void reqlist_init_req(BlockReqList *reqs, BlockReq *req, int64_t offset,
                       int64_t bytes)
 {
+    assert(bytes > 0);
     assert(!reqlist_find_conflict(reqs, offset, bytes));
 
     *req = (BlockReq) {
         .offset = offset,
         .bytes = bytes,
+        .node.start = offset,
+        .node.last = range_get_last(offset, bytes),
+        .reqs = reqs,
     };
     qemu_co_queue_init(&req->wait_queue);
-    QLIST_INSERT_HEAD(reqs, req, list);
+    interval_tree_insert(&req->node, reqs);
 }
 
 BlockReq *reqlist_find_conflict(BlockReqList *reqs, int64_t offset,
                                 int64_t bytes)
 {
-    BlockReq *r;
+    IntervalTreeNode *node;
 
-    QLIST_FOREACH(r, reqs, list) {
-        if (ranges_overlap(offset, bytes, r->offset, r->bytes)) {
-            return r;
-        }
+    if (bytes <= 0) {
+        return NULL;
     }
 
-    return NULL;
+    node = interval_tree_iter_first(reqs, offset,
+                                    range_get_last(offset, bytes));
+
+    return node ? container_of(node, BlockReq, node) : NULL;
 }
 
 bool coroutine_fn reqlist_wait_one(BlockReqList *reqs, int64_t offset,
@@ -74,12 +84,15 @@ void coroutine_fn reqlist_shrink_req(BlockReq *req, int64_t new_bytes)
 
     assert(new_bytes > 0 && new_bytes < req->bytes);
 
+    interval_tree_remove(&req->node, req->reqs);
     req->bytes = new_bytes;
+    req->node.last = range_get_last(req->offset, new_bytes);
+    interval_tree_insert(&req->node, req->reqs);
     qemu_co_queue_restart_all(&req->wait_queue);
 }
 
 void coroutine_fn reqlist_remove_req(BlockReq *req)
 {
-    QLIST_REMOVE(req, list);
+    interval_tree_remove(&req->node, req->reqs);
     qemu_co_queue_restart_all(&req->wait_queue);
 }
@@ -73,7 +73,13 @@ struct ThrottleGroup {
     QemuMutex lock; /* This lock protects the following four fields */
     ThrottleState ts;
     QLIST_HEAD(, ThrottleGroupMember) head;
-    ThrottleGroupMember *tokens[THROTTLE_MAX];
+    /*
+     * Members with pending requests, in the order in which they get their
+     * turn.  A member goes to the back of the queue when it gets the token,
+     * so this behaves like a round robin among the members that have I/O
+     * queued, but it does not have to walk past the idle ones.
+     */
+    QTAILQ_HEAD(, ThrottleGroupMember) pending[THROTTLE_MAX];
     bool any_timer_armed[THROTTLE_MAX];
     QEMUClockType clock_type;
 
@@ -170,40 +176,66 @@ const char *throttle_group_get_name(ThrottleGroupMember *tgm)
     return tg->name;
 }
 
-/* Return the next ThrottleGroupMember in the round-robin sequence, simulating
- * a circular list.
+/*
+ * Return whether a ThrottleGroupMember has pending requests.
  *
  * This assumes that tg->lock is held.
  *
- * @tgm: the current ThrottleGroupMember
- * @ret: the next ThrottleGroupMember in the sequence
+ * @tgm:        the ThrottleGroupMember
+ * @direction:  the ThrottleDirection
+ * @ret:        whether the ThrottleGroupMember has pending requests.
  */
-static ThrottleGroupMember *throttle_group_next_tgm(ThrottleGroupMember *tgm)
+static inline bool tgm_has_pending_reqs(ThrottleGroupMember *tgm,
+                                        ThrottleDirection direction)
 {
-    ThrottleState *ts = tgm->throttle_state;
-    ThrottleGroup *tg = container_of(ts, ThrottleGroup, ts);
-    ThrottleGroupMember *next = QLIST_NEXT(tgm, round_robin);
+    return tgm->pending_reqs[direction];
+}
 
-    if (!next) {
-        next = QLIST_FIRST(&tg->head);
+/*
+ * Add or remove a pending request of a ThrottleGroupMember, queueing it
+ * for its turn when it gets its first one.
+ *
+ * This assumes that tg->lock is held.
+ */
+static void tgm_add_pending_req(ThrottleGroupMember *tgm,
+                                ThrottleDirection direction)
+{
+    ThrottleGroup *tg = container_of(tgm->throttle_state, ThrottleGroup, ts);
+
+    if (tgm->pending_reqs[direction]++ == 0) {
+        QTAILQ_INSERT_TAIL(&tg->pending[direction], tgm,
+                           pending_entry[direction]);
     }
+}
+
+static void tgm_del_pending_req(ThrottleGroupMember *tgm,
+                                ThrottleDirection direction)
+{
+    ThrottleGroup *tg = container_of(tgm->throttle_state, ThrottleGroup, ts);
 
-    return next;
+    assert(tgm->pending_reqs[direction] > 0);
+    if (--tgm->pending_reqs[direction] == 0) {
+        QTAILQ_REMOVE(&tg->pending[direction], tgm, pending_entry[direction]);
+    }
 }
 
 /*
- * Return whether a ThrottleGroupMember has pending requests.
+ * Give the token to a ThrottleGroupMember, which then waits for the other
+ * members with pending requests before it gets another turn.
  *
  * This assumes that tg->lock is held.
- *
- * @tgm:        the ThrottleGroupMember
- * @direction:  the ThrottleDirection
- * @ret:        whether the ThrottleGroupMember has pending requests.
  */
-static inline bool tgm_has_pending_reqs(ThrottleGroupMember *tgm,
-                                        ThrottleDirection direction)
+static void throttle_group_take_token(ThrottleGroupMember *tgm,
+                                      ThrottleDirection direction)
 {
-    return tgm->pending_reqs[direction];
+    ThrottleGroup *tg = container_of(tgm->throttle_state, ThrottleGroup, ts);
+
+    if (tgm_has_pending_reqs(tgm, direction) &&
+        QTAILQ_NEXT(tgm, pending_entry[direction])) {
+        QTAILQ_REMOVE(&tg->pending[direction], tgm, pending_entry[direction]);
+        QTAILQ_INSERT_TAIL(&tg->pending[direction], tgm,
+                           pending_entry[direction]);
+    }
 }
 
 /* Return the next ThrottleGroupMember in the round-robin sequence with pending
@@ -221,7 +253,7 @@ static ThrottleGroupMember *next_throttle_token(ThrottleGroupMember *tgm,
 {
     ThrottleState *ts = tgm->throttle_state;
     ThrottleGroup *tg = container_of(ts, ThrottleGroup, ts);
-    ThrottleGroupMember *token, *start;
+    ThrottleGroupMember *token;
 
     /* If this member has its I/O limits disabled then it means that
      * it's being drained. Skip the round-robin search and return tgm
@@ -232,19 +264,14 @@ static ThrottleGroupMember *next_throttle_token(ThrottleGroupMember *tgm,
         return tgm;
     }
 
-    start = token = tg->tokens[direction];
+    /* The member that has waited longest for its turn goes first */
+    token = QTAILQ_FIRST(&tg->pending[direction]);
 
-    /* get next bs round in round robin style */
-    token = throttle_group_next_tgm(token);
-    while (token != start && !tgm_has_pending_reqs(token, direction)) {
-        token = throttle_group_next_tgm(token);
-    }
-
-    /* If no IO are queued for scheduling on the next round robin token
-     * then decide the token is the current tgm because chances are
-     * the current tgm got the current request queued.
+    /* If no IO are queued for scheduling then decide the token is the
+     * current tgm because chances are the current tgm got the current
+     * request queued.
      */
-    if (token == start && !tgm_has_pending_reqs(token, direction)) {
+    if (!token) {
         token = tgm;
     }
 
@@ -285,7 +312,7 @@ static bool throttle_group_schedule_timer(ThrottleGroupMember *tgm,
 
     /* If a timer just got armed, set tgm as the current token */
     if (must_wait) {
-        tg->tokens[direction] = tgm;
+        throttle_group_take_token(tgm, direction);
         tg->any_timer_armed[direction] = true;
     }
 
@@ -346,7 +373,7 @@ static void coroutine_mixed_fn schedule_next_request(ThrottleGroupMember *tgm,
             timer_mod(tt->timers[direction], now);
             tg->any_timer_armed[direction] = true;
         }
-        tg->tokens[direction] = token;
+        throttle_group_take_token(token, direction);
     }
 }
 
@@ -377,14 +404,14 @@ void coroutine_fn throttle_group_co_io_limits_intercept(ThrottleGroupMember *tgm
 
     /* Wait if there's a timer set or queued requests of this type */
     if (must_wait || tgm->pending_reqs[direction]) {
-        tgm->pending_reqs[direction]++;
+        tgm_add_pending_req(tgm, direction);
         qemu_mutex_unlock(&tg->lock);
         qemu_co_mutex_lock(&tgm->throttled_reqs_lock);
         qemu_co_queue_wait(&tgm->throttled_reqs[direction],
                            &tgm->throttled_reqs_lock);
         qemu_co_mutex_unlock(&tgm->throttled_reqs_lock);
         qemu_mutex_lock(&tg->lock);
-        tgm->pending_reqs[direction]--;
+        tgm_del_pending_req(tgm, direction);
     }
 
     /* The I/O will be executed, so do the accounting */
@@ -553,15 +580,11 @@ void throttle_group_register_tgm(ThrottleGroupMember *tgm,
     qatomic_set(&tgm->restart_pending, 0);
 
     QEMU_LOCK_GUARD(&tg->lock);
-    /* If the ThrottleGroup is new set this ThrottleGroupMember as the token */
     for (dir = THROTTLE_READ; dir < THROTTLE_MAX; dir++) {
-        if (!tg->tokens[dir]) {
-            tg->tokens[dir] = tgm;
-        }
         qemu_co_queue_init(&tgm->throttled_reqs[dir]);
     }
 
-    QLIST_INSERT_HEAD(&tg->head, tgm, round_robin);
+    QLIST_INSERT_HEAD(&tg->head, tgm, next);
 
     throttle_timers_init(&tgm->throttle_timers,
                          tgm->aio_context,
@@ -586,7 +609,6 @@ void throttle_group_unregister_tgm(ThrottleGroupMember *tgm)
 {
     ThrottleState *ts = tgm->throttle_state;
     ThrottleGroup *tg = container_of(ts, ThrottleGroup, ts);
-    ThrottleGroupMember *token;
     ThrottleDirection dir;
 
     if (!ts) {
@@ -602,18 +624,10 @@ void throttle_group_unregister_tgm(ThrottleGroupMember *tgm)
             assert(tgm->pending_reqs[dir] == 0);
             assert(qemu_co_queue_empty(&tgm->throttled_reqs[dir]));
             assert(!timer_pending(tgm->throttle_timers.timers[dir]));
-            if (tg->tokens[dir] == tgm) {
-                token = throttle_group_next_tgm(tgm);
-                /* Take care of the case where this is the last tgm in the group */
-                if (token == tgm) {
-                    token = NULL;
-                }
-                tg->tokens[dir] = token;
-            }
         }
 
         /* remove the current tgm from the list */
-        QLIST_REMOVE(tgm, round_robin);
+        QLIST_REMOVE(tgm, next);
         throttle_timers_destroy(&tgm->throttle_timers);
     }
 
@@ -754,6 +768,7 @@ static ThrottleParamInfo properties[] = {
 static void throttle_group_obj_init(Object *obj)
 {
     ThrottleGroup *tg = THROTTLE_GROUP(obj);
+    ThrottleDirection dir;
 
     tg->clock_type = QEMU_CLOCK_REALTIME;
     if (qtest_enabled()) {
@@ -764,6 +779,9 @@ static void throttle_group_obj_init(Object *obj)
     qemu_mutex_init(&tg->lock);
     throttle_init(&tg->ts);
     QLIST_INIT(&tg->head);
+    for (dir = THROTTLE_READ; dir < THROTTLE_MAX; dir++) {
+        QTAILQ_INIT(&tg->pending[dir]);
+    }
 }
 
 /* This function edits throttle_groups and must be called under the global
@@ -2595,7 +2595,8 @@ void qmp_block_commit(const char *job_id, const char *device,
             job_id = bdrv_get_device_name(bs);
         }
         commit_active_start(job_id, top_bs, base_bs, job_flags, speed, on_error,
-                            filter_node_name, NULL, NULL, false, &local_err);
+                            filter_node_name, NULL, NULL, NULL, false,
+                            &local_err);
     } else {
         BlockDriverState *overlay_bs = bdrv_find_overlay(bs, top_bs);
         if (bdrv_op_is_blocked(overlay_bs, BLOCK_OP_TYPE_COMMIT_TARGET, errp)) {
@@ -2790,10 +2791,12 @@ static void blockdev_mirror_common(const char *job_id, BlockDriverState *bs,
                                    bool has_copy_mode, MirrorCopyMode copy_mode,
                                    bool has_auto_finalize, bool auto_finalize,
                                    bool has_auto_dismiss, bool auto_dismiss,
+                                   MirrorPerf *x_perf,
                                    Error **errp)
 {
     BlockDriverState *unfiltered_bs;
     int job_flags = JOB_DEFAULT;
+    MirrorPerf perf = { .use_copy_range = false };
 
     GLOBAL_STATE_CODE();
     GRAPH_RDLOCK_GUARD_MAINLOOP();
@@ -2888,11 +2891,15 @@ static void blockdev_mirror_common(const char *job_id, BlockDriverState *bs,
     /* pass the node name to replace to mirror start since it's loose coupling
      * and will allow to check whether the node still exist at mirror completion
      */
+    if (x_perf && x_perf->has_use_copy_range) {
+        perf.use_copy_range = x_perf->use_copy_range;
+    }
+
     mirror_start(job_id, bs, target,
                  replaces, job_flags,
                  speed, granularity, buf_size, sync, backing_mode, zero_target,
                  on_source_error, on_target_error, unmap, filter_node_name,
-                 copy_mode, errp);
+                 copy_mode, &perf, errp);
 }
 
 void qmp_drive_mirror(DriveMirror *arg, Error **errp)
@@ -3045,7 +3052,7 @@ void qmp_drive_mirror(DriveMirror *arg, Error **errp)
                            arg->has_copy_mode, arg->copy_mode,
                            arg->has_auto_finalize, arg->auto_finalize,
                            arg->has_auto_dismiss, arg->auto_dismiss,
-                           errp);
+                           arg->x_perf, errp);
     bdrv_unref(target_bs);
 }
 
@@ -3064,6 +3071,7 @@ void qmp_blockdev_mirror(const char *job_id,
                          bool has_copy_mode, MirrorCopyMode copy_mode,
                          bool has_auto_finalize, bool auto_finalize,
                          bool has_auto_dismiss, bool auto_dismiss,
+                         MirrorPerf *x_perf,
                          Error **errp)
 {
     BlockDriverState *bs;
@@ -3103,7 +3111,7 @@ void qmp_blockdev_mirror(const char *job_id,
                            has_copy_mode, copy_mode,
                            has_auto_finalize, auto_finalize,
                            has_auto_dismiss, auto_dismiss,
-                           errp);
+                           x_perf, errp);
 }
 
 /*
@@ -200,6 +200,7 @@ fail2:
 void unlock_iovec(struct iovec *vec, abi_ulong target_addr,
         int count, int copy)
 {
+#ifdef DEBUG_REMAP
     struct target_iovec *target_vec;
 
     target_vec = lock_user(VERIFY_READ, target_addr,
@@ -207,7 +208,11 @@ void unlock_iovec(struct iovec *vec, abi_ulong target_addr,
     if (target_vec) {
         helper_unlock_iovec(target_vec, target_addr, vec, count, copy);
     }
-
+#endif
+    /*
+     * Without DEBUG_REMAP, lock_user() returns pointers into guest memory
+     * and unlock_user() does nothing, so there is nothing to walk.
+     */
     g_free(vec);
 }
 
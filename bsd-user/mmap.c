@@ -167,11 +167,32 @@ static int mmap_frag(abi_ulong real_start,
     }
 
     if (prot1 == 0) {
-        /* no page was there, so we allocate one. See also above. */
-        void *p = mmap(host_start, qemu_host_page_size, prot,
-                       flags | ((fd != -1) ? MAP_ANON : 0), -1, 0);
+        abi_ulong frag_ofs = start - real_start;
+        void *p;
+
+        /*
+         * No page was there, so nothing needs to be preserved.  If the file
+         * offset of the host page is representable, map it directly as for
+         * the middle of the mapping; a fresh anonymous page needs no zeroing.
+         * Shared file mappings are excluded, because a later fragment in the
+         * same host page is filled with pread(), which must not write through
+         * to the file.
+         */
+        if (fd != -1 && (flags & MAP_PRIVATE) && offset >= frag_ofs &&
+            !((offset - frag_ofs) & ~qemu_host_page_mask)) {
+            p = mmap(host_start, qemu_host_page_size, prot, flags, fd,
+                     offset - frag_ofs);
+            return p == MAP_FAILED ? -1 : 0;
+        }
+
+        /* Otherwise we allocate one. See also above. */
+        p = mmap(host_start, qemu_host_page_size, prot,
+                 flags | ((fd != -1) ? MAP_ANON : 0), -1, 0);
         if (p == MAP_FAILED)
             return -1;
+        if (fd == -1) {
+            return 0;
+        }
         prot1 = prot;
     }
     prot1 &= PAGE_BITS;
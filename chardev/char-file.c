@@ -24,14 +24,163 @@
 
 #include "qemu/osdep.h"
 #include "qapi/error.h"
+#include "qemu/error-report.h"
 #include "qemu/module.h"
 #include "qemu/option.h"
+#include "qemu/thread.h"
+#include "qemu/units.h"
 #include "chardev/char.h"
 
 #ifdef _WIN32
 #include "chardev/char-win.h"
 #else
 #include "chardev/char-fd.h"
+
+/* Output buffered in memory with async=on */
+#define CHAR_FILE_ASYNC_BUF_SIZE (4 * MiB)
+
+struct FileChardev {
+    FDChardev parent;
+
+    /* The fields below are only used with async=on */
+    bool async;
+    int fd;
+    char *path;
+    int flags;
+    uint64_t max_size;
+    uint64_t size;
+
+    QemuThread thread;
+    QemuMutex lock;
+    QemuCond cond;
+    /* Protected by lock */
+    GByteArray *buf;
+    bool exiting;
+};
+typedef struct FileChardev FileChardev;
+
+DECLARE_INSTANCE_CHECKER(FileChardev, FILE_CHARDEV, TYPE_CHARDEV_FILE)
+
+static int (*fd_chr_write)(Chardev *chr, const uint8_t *buf, int len);
+
+/* Called with chr_write_lock held.  */
+static int file_chr_write(Chardev *chr, const uint8_t *buf, int len)
+{
+    FileChardev *s = FILE_CHARDEV(chr);
+    size_t n;
+
+    if (!s->async) {
+        return fd_chr_write(chr, buf, len);
+    }
+
+    qemu_mutex_lock(&s->lock);
+    n = MIN(len, CHAR_FILE_ASYNC_BUF_SIZE - s->buf->len);
+    g_byte_array_append(s->buf, buf, n);
+    qemu_cond_signal(&s->cond);
+    qemu_mutex_unlock(&s->lock);
+
+    /* Never hold the guest back, what doesn't fit is lost */
+    return len;
+}
+
+static void file_chr_rotate(FileChardev *s)
+{
+    g_autofree char *old = g_strdup_printf("%s.1", s->path);
+    int fd;
+
+    if (rename(s->path, old) < 0) {
+        error_report_once("chardev: failed to rotate %s: %s", s->path,
+                          strerror(errno));
+        return;
+    }
+    fd = qemu_open_old(s->path, (s->flags & ~O_APPEND) | O_TRUNC, 0666);
+    if (fd < 0) {
+        error_report_once("chardev: failed to reopen %s: %s", s->path,
+                          strerror(errno));
+        return;
+    }
+    qemu_close(s->fd);
+    s->fd = fd;
+    s->size = 0;
+}
+
+static void *file_chr_thread(void *opaque)
+{
+    FileChardev *s = opaque;
+    GByteArray *out = g_byte_array_sized_new(CHAR_FILE_ASYNC_BUF_SIZE);
+    GByteArray *tmp;
+
+    qemu_mutex_lock(&s->lock);
+    for (;;) {
+        while (!s->buf->len && !s->exiting) {
+            qemu_cond_wait(&s->cond, &s->lock);
+        }
+        if (!s->buf->len) {
+            break;
+        }
+        /* Swap the buffers so that writers are not blocked by the file */
+        tmp = s->buf;
+        s->buf = out;
+        out = tmp;
+        qemu_mutex_unlock(&s->lock);
+
+        if (s->max_size && s->size >= s->max_size) {
+            file_chr_rotate(s);
+        }
+        if (qemu_write_full(s->fd, out->data, out->len) != out->len) {
+            error_report_once("chardev: failed to write to %s: %s", s->path,
+                              strerror(errno));
+        }
+        s->size += out->len;
+        g_byte_array_set_size(out, 0);
+
+        qemu_mutex_lock(&s->lock);
+    }
+    qemu_mutex_unlock(&s->lock);
+
+    g_byte_array_free(out, true);
+    return NULL;
+}
+
+static void file_chr_start_async(FileChardev *s, ChardevFile *file, int fd,
+                                 int flags)
+{
+    struct stat st;
+
+    s->async = true;
+    s->fd = fd;
+    s->path = g_strdup(file->out);
+    s->flags = flags;
+    s->max_size = file->has_max_size ? file->max_size : 0;
+    s->size = fstat(fd, &st) == 0 ? st.st_size : 0;
+    s->buf = g_byte_array_sized_new(CHAR_FILE_ASYNC_BUF_SIZE);
+    qemu_mutex_init(&s->lock);
+    qemu_cond_init(&s->cond);
+    qemu_thread_create(&s->thread, "chardev-file", file_chr_thread, s,
+                       QEMU_THREAD_JOINABLE);
+}
+
+static void char_file_finalize(Object *obj)
+{
+    FileChardev *s = FILE_CHARDEV(obj);
+
+    if (!s->async) {
+        return;
+    }
+
+    /* Write everything that is left before closing */
+    qemu_mutex_lock(&s->lock);
+    s->exiting = true;
+    qemu_cond_signal(&s->cond);
+    qemu_mutex_unlock(&s->lock);
+    qemu_thread_join(&s->thread);
+
+    g_byte_array_free(s->buf, true);
+    qemu_cond_destroy(&s->cond);
+    qemu_mutex_destroy(&s->lock);
+    qemu_close(s->fd);
+    g_free(s->path);
+}
 #endif
 
 static void qmp_chardev_open_file(Chardev *chr,
@@ -50,6 +199,16 @@ static void qmp_chardev_open_file(Chardev *chr,
         return;
     }
 
+    if (file->has_async && file->async) {
+        error_setg(errp, "asynchronous output not supported");
+        return;
+    }
+
+    if (file->has_max_size && file->max_size) {
+        error_setg(errp, "'max-size' not supported");
+        return;
+    }
+
     if (file->has_append && file->append) {
         /* Append to file if it already exists. */
         accessmode = FILE_GENERIC_WRITE & ~FILE_WRITE_DATA;
@@ -69,7 +228,13 @@ static void qmp_chardev_open_file(Chardev *chr,
 
     win_chr_set_file(chr, out, false);
 #else
-    int flags, in = -1, out;
+    int flags, out_flags, in = -1, out;
+    bool async = file->has_async && file->async;
+
+    if (file->has_max_size && file->max_size && !async) {
+        error_setg(errp, "'max-size' requires 'async'");
+        return;
+    }
 
     flags = O_WRONLY | O_CREAT | O_BINARY;
     if (file->has_append && file->append) {
@@ -82,6 +247,7 @@ static void qmp_chardev_open_file(Chardev *chr,
     if (out < 0) {
         return;
     }
+    out_flags = flags;
 
     if (file->in) {
         flags = O_RDONLY;
@@ -92,6 +258,12 @@ static void qmp_chardev_open_file(Chardev *chr,
         }
     }
 
+    if (async) {
+        qemu_chr_open_fd(chr, in, -1);
+        file_chr_start_async(FILE_CHARDEV(chr), file, out, out_flags);
+        return;
+    }
+
     qemu_chr_open_fd(chr, in, out);
 #endif
 }
@@ -121,6 +293,14 @@ static void qemu_chr_parse_file_out(QemuOpts *opts, ChardevBackend *backend,
 
     file->has_append = true;
     file->append = qemu_opt_get_bool(opts, "append", false);
+    if (qemu_opt_get(opts, "async")) {
+        file->has_async = true;
+        file->async = qemu_opt_get_bool(opts, "async", false);
+    }
+    if (qemu_opt_get(opts, "max-size")) {
+        file->has_max_size = true;
+        file->max_size = qemu_opt_get_size(opts, "max-size", 0);
+    }
 }
 
 static void char_file_class_init(ObjectClass *oc, void *data)
@@ -129,6 +309,10 @@ static void char_file_class_init(ObjectClass *oc, void *data)
 
     cc->parse = qemu_chr_parse_file_out;
     cc->open = qmp_chardev_open_file;
+#ifndef _WIN32
+    fd_chr_write = cc->chr_write;
+    cc->chr_write = file_chr_write;
+#endif
 }
 
 static const TypeInfo char_file_type_info = {
@@ -137,6 +321,8 @@ static const TypeInfo char_file_type_info = {
     .parent = TYPE_CHARDEV_WIN,
 #else
     .parent = TYPE_CHARDEV_FD,
+    .instance_size = sizeof(FileChardev),
+    .instance_finalize = char_file_finalize,
 #endif
     .class_init = char_file_class_init,
 };
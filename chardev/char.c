@@ -907,6 +907,12 @@ QemuOptsList qemu_chardev_opts = {
         },{
             .name = "append",
             .type = QEMU_OPT_BOOL,
+        },{
+            .name = "async",
+            .type = QEMU_OPT_BOOL,
+        },{
+            .name = "max-size",
+            .type = QEMU_OPT_SIZE,
         },{
             .name = "logfile",
             .type = QEMU_OPT_STRING,
@@ -38,9 +38,11 @@ enum EvictionPolicy policy;
  * put in any of the blocks inside the set. The number of block per set is
  * called the associativity (assoc).
  *
- * Each block contains the stored tag and a valid bit. Since this is not
- * a functional simulator, the data itself is not stored. We only identify
- * whether a block is in the cache or not by searching for its tag.
+ * Each block contains the stored tag, or INVALID_TAG if the block is
+ * invalid. Since this is not a functional simulator, the data itself is not
+ * stored. We only identify whether a block is in the cache or not by
+ * searching for its tag.  The tags of a set are contiguous, so that the
+ * search is a single compare per block over one array.
  *
  * In order to search for memory data in the cache, the set identifier and tag
  * are extracted from the address and the set is probed to see whether a tag
@@ -56,13 +58,11 @@ enum EvictionPolicy policy;
  * The CacheSet also contains bookkeaping information about eviction details.
  */
 
-typedef struct {
-    uint64_t tag;
-    bool valid;
-} CacheBlock;
+/* Tags have the block offset bits cleared, so this is never a valid tag */
+#define INVALID_TAG UINT64_MAX
 
 typedef struct {
-    CacheBlock *blocks;
+    uint64_t *tags;
     uint64_t *lru_priorities;
     uint64_t lru_gen_counter;
     GQueue *fifo_queue;
@@ -101,6 +101,10 @@ static Cache **l1_dcaches, **l1_icaches;
 static bool use_l2;
 static Cache **l2_ucaches;
 
+/* Deliver data accesses in batches of this size, 0 to disable */
+static size_t batch_size;
+static struct qemu_plugin_mem_batch *mem_batch;
+
 static GMutex *l1_dcache_locks;
 static GMutex *l1_icache_locks;
 static GMutex *l2_ucache_locks;
@@ -232,7 +236,9 @@ static inline uint64_t extract_set(Cache *cache, uint64_t addr)
 
 static const char *cache_config_error(int blksize, int assoc, int cachesize)
 {
-    if (cachesize % blksize != 0) {
+    if (blksize < 2) {
+        return "block size must be at least 2 bytes";
+    } else if (cachesize % blksize != 0) {
         return "cache size must be divisible by block size";
     } else if (cachesize % (blksize * assoc) != 0) {
         return "cache size must be divisible by set size (assoc * block size)";
@@ -243,7 +249,8 @@ static const char *cache_config_error(int blksize, int assoc, int cachesize)
 
 static bool bad_cache_params(int blksize, int assoc, int cachesize)
 {
-    return (cachesize % blksize) != 0 || (cachesize % (blksize * assoc) != 0);
+    return blksize < 2 ||
+           (cachesize % blksize) != 0 || (cachesize % (blksize * assoc) != 0);
 }
 
 static Cache *cache_init(int blksize, int assoc, int cachesize)
@@ -268,7 +275,10 @@ static Cache *cache_init(int blksize, int assoc, int cachesize)
     cache->misses = 0;
 
     for (i = 0; i < cache->num_sets; i++) {
-        cache->sets[i].blocks = g_new0(CacheBlock, assoc);
+        cache->sets[i].tags = g_new(uint64_t, assoc);
+        for (int j = 0; j < assoc; j++) {
+            cache->sets[i].tags[j] = INVALID_TAG;
+        }
     }
 
     blk_mask = blksize - 1;
@@ -305,7 +315,7 @@ static int get_invalid_block(Cache *cache, uint64_t set)
     int i;
 
     for (i = 0; i < cache->assoc; i++) {
-        if (!cache->sets[set].blocks[i].valid) {
+        if (cache->sets[set].tags[i] == INVALID_TAG) {
             return i;
         }
     }
@@ -331,13 +341,14 @@ static int in_cache(Cache *cache, uint64_t addr)
 {
     int i;
     uint64_t tag, set;
+    const uint64_t *tags;
 
     tag = extract_tag(cache, addr);
     set = extract_set(cache, addr);
+    tags = cache->sets[set].tags;
 
     for (i = 0; i < cache->assoc; i++) {
-        if (cache->sets[set].blocks[i].tag == tag &&
-                cache->sets[set].blocks[i].valid) {
+        if (tags[i] == tag) {
             return i;
         }
     }
@@ -379,20 +390,43 @@ static bool access_cache(Cache *cache, uint64_t addr)
         update_miss(cache, set, replaced_blk);
     }
 
-    cache->sets[set].blocks[replaced_blk].tag = tag;
-    cache->sets[set].blocks[replaced_blk].valid = true;
+    cache->sets[set].tags[replaced_blk] = tag;
 
     return false;
 }
 
+/* Returns true if the access missed in L1 and has to go to L2 */
+static bool l1_data_access_locked(int cache_idx, uint64_t effective_addr,
+                                  InsnData *insn)
+{
+    bool hit_in_l1 = access_cache(l1_dcaches[cache_idx], effective_addr);
+
+    if (!hit_in_l1) {
+        __atomic_fetch_add(&insn->l1_dmisses, 1, __ATOMIC_RELAXED);
+        l1_dcaches[cache_idx]->misses++;
+    }
+    l1_dcaches[cache_idx]->accesses++;
+
+    return !hit_in_l1 && use_l2;
+}
+
+static void l2_data_access_locked(int cache_idx, uint64_t effective_addr,
+                                  InsnData *insn)
+{
+    if (!access_cache(l2_ucaches[cache_idx], effective_addr)) {
+        __atomic_fetch_add(&insn->l2_misses, 1, __ATOMIC_RELAXED);
+        l2_ucaches[cache_idx]->misses++;
+    }
+    l2_ucaches[cache_idx]->accesses++;
+}
+
 static void vcpu_mem_access(unsigned int vcpu_index, qemu_plugin_meminfo_t info,
                             uint64_t vaddr, void *userdata)
 {
     uint64_t effective_addr;
     struct qemu_plugin_hwaddr *hwaddr;
     int cache_idx;
-    InsnData *insn;
-    bool hit_in_l1;
+    bool miss_in_l1;
 
     hwaddr = qemu_plugin_get_hwaddr(info, vaddr);
     if (hwaddr && qemu_plugin_hwaddr_is_io(hwaddr)) {
@@ -403,30 +437,49 @@ static void vcpu_mem_access(unsigned int vcpu_index, qemu_plugin_meminfo_t info,
     cache_idx = vcpu_index % cores;
 
     g_mutex_lock(&l1_dcache_locks[cache_idx]);
-    hit_in_l1 = access_cache(l1_dcaches[cache_idx], effective_addr);
-    if (!hit_in_l1) {
-        insn = userdata;
-        __atomic_fetch_add(&insn->l1_dmisses, 1, __ATOMIC_SEQ_CST);
-        l1_dcaches[cache_idx]->misses++;
-    }
-    l1_dcaches[cache_idx]->accesses++;
+    miss_in_l1 = l1_data_access_locked(cache_idx, effective_addr, userdata);
     g_mutex_unlock(&l1_dcache_locks[cache_idx]);
 
-    if (hit_in_l1 || !use_l2) {
+    if (!miss_in_l1) {
         /* No need to access L2 */
         return;
     }
 
     g_mutex_lock(&l2_ucache_locks[cache_idx]);
-    if (!access_cache(l2_ucaches[cache_idx], effective_addr)) {
-        insn = userdata;
-        __atomic_fetch_add(&insn->l2_misses, 1, __ATOMIC_SEQ_CST);
-        l2_ucaches[cache_idx]->misses++;
-    }
-    l2_ucaches[cache_idx]->accesses++;
+    l2_data_access_locked(cache_idx, effective_addr, userdata);
     g_mutex_unlock(&l2_ucache_locks[cache_idx]);
 }
 
+/*
+ * Batched version of vcpu_mem_access: the locks are taken once for all
+ * the accesses of the batch.
+ */
+static void vcpu_mem_access_batch(unsigned int vcpu_index,
+                                  const qemu_plugin_mem_access *accesses,
+                                  size_t n, void *userdata)
+{
+    int cache_idx = vcpu_index % cores;
+
+    g_mutex_lock(&l1_dcache_locks[cache_idx]);
+    if (use_l2) {
+        g_mutex_lock(&l2_ucache_locks[cache_idx]);
+    }
+    for (size_t i = 0; i < n; i++) {
+        const qemu_plugin_mem_access *a = &accesses[i];
+
+        if (a->is_io) {
+            continue;
+        }
+        if (l1_data_access_locked(cache_idx, a->paddr, a->userdata)) {
+            l2_data_access_locked(cache_idx, a->paddr, a->userdata);
+        }
+    }
+    if (use_l2) {
+        g_mutex_unlock(&l2_ucache_locks[cache_idx]);
+    }
+    g_mutex_unlock(&l1_dcache_locks[cache_idx]);
+}
+
 static void vcpu_insn_exec(unsigned int vcpu_index, void *userdata)
 {
     uint64_t insn_addr;
@@ -441,7 +494,7 @@ static void vcpu_insn_exec(unsigned int vcpu_index, void *userdata)
     hit_in_l1 = access_cache(l1_icaches[cache_idx], insn_addr);
     if (!hit_in_l1) {
         insn = userdata;
-        __atomic_fetch_add(&insn->l1_imisses, 1, __ATOMIC_SEQ_CST);
+        __atomic_fetch_add(&insn->l1_imisses, 1, __ATOMIC_RELAXED);
         l1_icaches[cache_idx]->misses++;
     }
     l1_icaches[cache_idx]->accesses++;
@@ -455,7 +508,7 @@ static void vcpu_insn_exec(unsigned int vcpu_index, void *userdata)
     g_mutex_lock(&l2_ucache_locks[cache_idx]);
     if (!access_cache(l2_ucaches[cache_idx], insn_addr)) {
         insn = userdata;
-        __atomic_fetch_add(&insn->l2_misses, 1, __ATOMIC_SEQ_CST);
+        __atomic_fetch_add(&insn->l2_misses, 1, __ATOMIC_RELAXED);
         l2_ucaches[cache_idx]->misses++;
     }
     l2_ucaches[cache_idx]->accesses++;
@@ -496,9 +549,13 @@ static void vcpu_tb_trans(qemu_plugin_id_t id, struct qemu_plugin_tb *tb)
         }
         g_mutex_unlock(&hashtable_lock);
 
-        qemu_plugin_register_vcpu_mem_cb(insn, vcpu_mem_access,
-                                         QEMU_PLUGIN_CB_NO_REGS,
-                                         rw, data);
+        if (mem_batch) {
+            qemu_plugin_register_vcpu_mem_batch(insn, rw, mem_batch, data);
+        } else {
+            qemu_plugin_register_vcpu_mem_cb(insn, vcpu_mem_access,
+                                             QEMU_PLUGIN_CB_NO_REGS,
+                                             rw, data);
+        }
 
         qemu_plugin_register_vcpu_insn_exec_cb(insn, vcpu_insn_exec,
                                                QEMU_PLUGIN_CB_NO_REGS, data);
@@ -515,7 +572,7 @@ static void insn_free(gpointer data)
 static void cache_free(Cache *cache)
 {
     for (int i = 0; i < cache->num_sets; i++) {
-        g_free(cache->sets[i].blocks);
+        g_free(cache->sets[i].tags);
     }
 
     if (metadata_destroy) {
@@ -702,6 +759,13 @@ finish:
 
 static void plugin_exit(qemu_plugin_id_t id, void *p)
 {
+    if (mem_batch) {
+        for (int i = 0; i < qemu_plugin_num_vcpus(); i++) {
+            qemu_plugin_mem_batch_flush(mem_batch, i);
+        }
+        qemu_plugin_mem_batch_free(mem_batch);
+    }
+
     log_stats();
     log_top_insns();
 
@@ -789,6 +853,8 @@ int qemu_plugin_install(qemu_plugin_id_t id, const qemu_info_t *info,
             limit = STRTOLL(tokens[1]);
         } else if (g_strcmp0(tokens[0], "cores") == 0) {
             cores = STRTOLL(tokens[1]);
+        } else if (g_strcmp0(tokens[0], "batch") == 0) {
+            batch_size = STRTOLL(tokens[1]);
         } else if (g_strcmp0(tokens[0], "l2cachesize") == 0) {
             use_l2 = true;
             l2_cachesize = STRTOLL(tokens[1]);
@@ -850,6 +916,11 @@ int qemu_plugin_install(qemu_plugin_id_t id, const qemu_info_t *info,
     l1_icache_locks = g_new0(GMutex, cores);
     l2_ucache_locks = use_l2 ? g_new0(GMutex, cores) : NULL;
 
+    if (batch_size) {
+        mem_batch = qemu_plugin_mem_batch_new(batch_size,
+                                              vcpu_mem_access_batch, NULL);
+    }
+
     qemu_plugin_register_vcpu_tb_trans_cb(id, vcpu_tb_trans);
     qemu_plugin_register_atexit_cb(id, plugin_exit, NULL);
 
@@ -0,0 +1,160 @@
+/*
+ * PC sampling - statistical profile of where the guest spends its time.
+ *
+ * Every translation block counts the instructions it executes with an
+ * inline op on a per-vCPU budget.  Once a vCPU has executed "period"
+ * instructions, a conditional callback takes a sample of the block that
+ * is about to run.  The condition is still checked by a helper call on
+ * every block execution, but the plugin itself only runs for samples, so
+ * this is cheaper than an unconditional callback, not free.
+ *
+ * Samples are aggregated per block start address: blocks translated
+ * again at the same pc with a different length share one entry.
+ *
+ * License: GNU GPL, version 2 or later.
+ *   See the COPYING file in the top-level directory.
+ */
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <glib.h>
+
+#include <qemu-plugin.h>
+
+QEMU_PLUGIN_EXPORT int qemu_plugin_version = QEMU_PLUGIN_VERSION;
+
+static uint64_t period = 10000;
+static int limit = 30;
+
+/* Instructions executed by each vCPU since its last sample */
+static struct qemu_plugin_scoreboard *budget;
+static qemu_plugin_u64 budget_u64;
+
+/* Protects blocks, which is only used at translation time */
+static GMutex lock;
+static GHashTable *blocks;
+static uint64_t total_samples;
+
+typedef struct {
+    uint64_t pc;
+    const char *symbol;
+    size_t insns;
+    uint64_t samples;
+} Block;
+
+static gint cmp_samples(gconstpointer a, gconstpointer b)
+{
+    const Block *ba = a;
+    const Block *bb = b;
+
+    return ba->samples > bb->samples ? -1 : ba->samples < bb->samples;
+}
+
+static void plugin_exit(qemu_plugin_id_t id, void *p)
+{
+    g_autoptr(GString) report = g_string_new(NULL);
+    GList *sorted, *it;
+    int i;
+
+    g_string_append_printf(report,
+                           "# Samples: %" PRIu64 " (1 every %" PRIu64
+                           " instructions)\n"
+                           "# Overhead  Samples  PC                  "
+                           "Insns  Symbol\n", total_samples, period);
+
+    sorted = g_list_sort(g_hash_table_get_values(blocks), cmp_samples);
+    for (i = 0, it = sorted; i < limit && it; i++, it = it->next) {
+        Block *b = it->data;
+
+        if (!b->samples) {
+            break;
+        }
+        g_string_append_printf(report,
+                               "%9.2f%%  %7" PRIu64 "  0x%016" PRIx64
+                               "  %5zu  %s\n",
+                               100.0 * b->samples / total_samples,
+                               b->samples, b->pc, b->insns,
+                               b->symbol ? b->symbol : "[unknown]");
+    }
+    g_list_free(sorted);
+
+    qemu_plugin_outs(report->str);
+
+    g_hash_table_destroy(blocks);
+    qemu_plugin_scoreboard_free(budget);
+}
+
+static void vcpu_sample(unsigned int cpu_index, void *udata)
+{
+    Block *b = udata;
+
+    /* Keep the excess, so that long blocks do not skew the period */
+    qemu_plugin_u64_set(budget_u64, cpu_index,
+                        qemu_plugin_u64_get(budget_u64, cpu_index) - period);
+    __atomic_fetch_add(&b->samples, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&total_samples, 1, __ATOMIC_RELAXED);
+}
+
+static void vcpu_tb_trans(qemu_plugin_id_t id, struct qemu_plugin_tb *tb)
+{
+    uint64_t pc = qemu_plugin_tb_vaddr(tb);
+    size_t insns = qemu_plugin_tb_n_insns(tb);
+    Block *b;
+
+    g_mutex_lock(&lock);
+    b = g_hash_table_lookup(blocks, &pc);
+    if (!b) {
+        b = g_new0(Block, 1);
+        b->pc = pc;
+        b->symbol = qemu_plugin_insn_symbol(qemu_plugin_tb_get_insn(tb, 0));
+        g_hash_table_insert(blocks, &b->pc, b);
+    }
+    /* Report the longest translation seen at this pc */
+    b->insns = MAX(b->insns, insns);
+    g_mutex_unlock(&lock);
+
+    /* The callback runs before the inline op of the same block */
+    qemu_plugin_register_vcpu_tb_exec_cond_cb(tb, vcpu_sample,
+                                              QEMU_PLUGIN_CB_NO_REGS,
+                                              QEMU_PLUGIN_COND_GE,
+                                              budget_u64, period, b);
+    qemu_plugin_register_vcpu_tb_exec_inline_per_vcpu(
+        tb, QEMU_PLUGIN_INLINE_ADD_U64, budget_u64, insns);
+}
+
+QEMU_PLUGIN_EXPORT
+int qemu_plugin_install(qemu_plugin_id_t id, const qemu_info_t *info,
+                        int argc, char **argv)
+{
+    for (int i = 0; i < argc; i++) {
+        char *opt = argv[i];
+        g_auto(GStrv) tokens = g_strsplit(opt, "=", 2);
+
+        if (!tokens[1]) {
+            fprintf(stderr, "option parsing failed: %s\n", opt);
+            return -1;
+        }
+        if (g_strcmp0(tokens[0], "period") == 0) {
+            period = g_ascii_strtoull(tokens[1], NULL, 10);
+            if (!period) {
+                fprintf(stderr, "period must be a positive integer: %s\n",
+                        opt);
+                return -1;
+            }
+        } else if (g_strcmp0(tokens[0], "limit") == 0) {
+            limit = g_ascii_strtoull(tokens[1], NULL, 10);
+        } else {
+            fprintf(stderr, "option parsing failed: %s\n", opt);
+            return -1;
+        }
+    }
+
+    blocks = g_hash_table_new_full(g_int64_hash, g_int64_equal, NULL, g_free);
+    budget = qemu_plugin_scoreboard_new(sizeof(uint64_t));
+    budget_u64 = qemu_plugin_scoreboard_u64(budget);
+
+    qemu_plugin_register_vcpu_tb_trans_cb(id, vcpu_tb_trans);
+    qemu_plugin_register_atexit_cb(id, plugin_exit, NULL);
+    return 0;
+}
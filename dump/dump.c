@@ -26,6 +26,7 @@
 #include "qapi/qmp/qerror.h"
 #include "qemu/error-report.h"
 #include "qemu/main-loop.h"
+#include "qemu/thread.h"
 #include "hw/misc/vmcoreinfo.h"
 #include "migration/blocker.h"
 #include "hw/core/cpu.h"
@@ -38,6 +39,9 @@
 #ifdef CONFIG_SNAPPY
 #include <snappy-c.h>
 #endif
+#ifdef CONFIG_ZSTD
+#include <zstd.h>
+#endif
 #ifndef ELF_MACHINE_UNAME
 #define ELF_MACHINE_UNAME "Unknown"
 #endif
@@ -999,6 +1003,11 @@ static void create_header32(DumpState *s, Error **errp)
     if (s->flag_compress & DUMP_DH_COMPRESSED_SNAPPY) {
         status |= DUMP_DH_COMPRESSED_SNAPPY;
     }
+#endif
+#ifdef CONFIG_ZSTD
+    if (s->flag_compress & DUMP_DH_COMPRESSED_ZSTD) {
+        status |= DUMP_DH_COMPRESSED_ZSTD;
+    }
 #endif
     dh->status = cpu_to_dump32(s, status);
 
@@ -1110,6 +1119,11 @@ static void create_header64(DumpState *s, Error **errp)
     if (s->flag_compress & DUMP_DH_COMPRESSED_SNAPPY) {
         status |= DUMP_DH_COMPRESSED_SNAPPY;
     }
+#endif
+#ifdef CONFIG_ZSTD
+    if (s->flag_compress & DUMP_DH_COMPRESSED_ZSTD) {
+        status |= DUMP_DH_COMPRESSED_ZSTD;
+    }
 #endif
     dh->status = cpu_to_dump32(s, status);
 
@@ -1462,25 +1476,380 @@ static size_t get_len_buf_out(size_t page_size, uint32_t flag_compress)
     case DUMP_DH_COMPRESSED_SNAPPY:
         return snappy_max_compressed_length(page_size);
 #endif
+
+#ifdef CONFIG_ZSTD
+    case DUMP_DH_COMPRESSED_ZSTD:
+        return ZSTD_compressBound(page_size);
+#endif
     }
     return 0;
 }
 
+/* Pages per compression thread in each batch */
+#define DUMP_BATCH_PAGES_PER_THREAD 32
+
+/* Per-thread state of the compression libraries */
+typedef struct DumpCompressCtx {
+#ifdef CONFIG_LZO
+    lzo_bytep wrkmem;
+#endif
+#ifdef CONFIG_ZSTD
+    ZSTD_CCtx *zstd;
+#endif
+} DumpCompressCtx;
+
+typedef struct DumpPage {
+    uint8_t *data;      /* page contents, either guest memory or @copy */
+    uint8_t *copy;      /* for pages that straddle guest memory blocks */
+    uint8_t *out;       /* compressed page */
+    size_t size;        /* size of the data to write */
+    uint32_t flags;     /* DUMP_DH_COMPRESSED_*, 0 if not compressed */
+    bool zero;
+} DumpPage;
+
+typedef struct DumpBatch {
+    DumpPage *pages;
+    unsigned int nr_pages;
+    /* Next page to compress and number of compressed pages */
+    unsigned int next;
+    unsigned int done;
+} DumpBatch;
+
+/*
+ * Pages are compressed one batch at a time by the worker threads, while
+ * the dump thread writes out the previous batch and fills the next one.
+ */
+typedef struct DumpCompressor {
+    DumpState *s;
+    size_t len_buf_out;
+    unsigned int batch_pages;
+    DumpBatch batches[2];
+    /* Used by the dump thread when there are no worker threads */
+    DumpCompressCtx ctx;
+
+    unsigned int nr_threads;
+    QemuThread *threads;
+    QemuMutex lock;
+    QemuCond work_cond;
+    QemuCond done_cond;
+    /* Protected by @lock */
+    DumpBatch *batch;
+    bool quit;
+} DumpCompressor;
+
+static void dump_compress_ctx_init(DumpCompressCtx *ctx, DumpState *s)
+{
+#ifdef CONFIG_LZO
+    ctx->wrkmem = g_malloc(LZO1X_1_MEM_COMPRESS);
+#endif
+#ifdef CONFIG_ZSTD
+    ctx->zstd = s->flag_compress & DUMP_DH_COMPRESSED_ZSTD ?
+        ZSTD_createCCtx() : NULL;
+#endif
+}
+
+static void dump_compress_ctx_cleanup(DumpCompressCtx *ctx)
+{
+#ifdef CONFIG_LZO
+    g_free(ctx->wrkmem);
+#endif
+#ifdef CONFIG_ZSTD
+    ZSTD_freeCCtx(ctx->zstd);
+#endif
+}
+
+#ifdef CONFIG_ZSTD
+static bool dump_zstd_compress(ZSTD_CCtx *cctx, uint8_t *out, size_t *size_out,
+                               const uint8_t *in, size_t len)
+{
+    size_t ret;
+
+    if (!cctx) {
+        return false;
+    }
+    /* Like Z_BEST_SPEED for zlib, favour speed over ratio */
+    ret = ZSTD_compressCCtx(cctx, out, *size_out, in, len, 1);
+    if (ZSTD_isError(ret)) {
+        return false;
+    }
+    *size_out = ret;
+    return true;
+}
+#endif
+
+/*
+ * Compress @p with the format in s->flag_compress.  Only one format is
+ * set, but if compression fails or does not help, the page is saved in
+ * plaintext.
+ */
+static void dump_compress_page(DumpState *s, DumpCompressCtx *ctx,
+                               DumpPage *p, size_t len_buf_out)
+{
+    size_t page_size = s->dump_info.page_size;
+    size_t size_out = len_buf_out;
+
+    p->zero = buffer_is_zero(p->data, page_size);
+    if (p->zero) {
+        return;
+    }
+
+    if ((s->flag_compress & DUMP_DH_COMPRESSED_ZLIB) &&
+        (compress2(p->out, (uLongf *)&size_out, p->data, page_size,
+                   Z_BEST_SPEED) == Z_OK) &&
+        (size_out < page_size)) {
+        p->flags = DUMP_DH_COMPRESSED_ZLIB;
+#ifdef CONFIG_LZO
+    } else if ((s->flag_compress & DUMP_DH_COMPRESSED_LZO) &&
+               (lzo1x_1_compress(p->data, page_size, p->out,
+                                 (lzo_uint *)&size_out,
+                                 ctx->wrkmem) == LZO_E_OK) &&
+               (size_out < page_size)) {
+        p->flags = DUMP_DH_COMPRESSED_LZO;
+#endif
+#ifdef CONFIG_SNAPPY
+    } else if ((s->flag_compress & DUMP_DH_COMPRESSED_SNAPPY) &&
+               (snappy_compress((char *)p->data, page_size,
+                                (char *)p->out, &size_out) == SNAPPY_OK) &&
+               (size_out < page_size)) {
+        p->flags = DUMP_DH_COMPRESSED_SNAPPY;
+#endif
+#ifdef CONFIG_ZSTD
+    } else if ((s->flag_compress & DUMP_DH_COMPRESSED_ZSTD) &&
+               dump_zstd_compress(ctx->zstd, p->out, &size_out, p->data,
+                                  page_size) &&
+               (size_out < page_size)) {
+        p->flags = DUMP_DH_COMPRESSED_ZSTD;
+#endif
+    } else {
+        p->flags = 0;
+        size_out = page_size;
+    }
+    p->size = size_out;
+}
+
+/* Called with c->lock held; returns the next page to compress, if any */
+static DumpPage *dump_batch_next_page(DumpCompressor *c)
+{
+    DumpBatch *b = c->batch;
+
+    if (!b || b->next == b->nr_pages) {
+        return NULL;
+    }
+    return &b->pages[b->next++];
+}
+
+static void *dump_compress_thread(void *opaque)
+{
+    DumpCompressor *c = opaque;
+    DumpCompressCtx ctx;
+    DumpBatch *b;
+    DumpPage *p;
+
+    dump_compress_ctx_init(&ctx, c->s);
+
+    qemu_mutex_lock(&c->lock);
+    while (!c->quit) {
+        b = c->batch;
+        p = dump_batch_next_page(c);
+        if (!p) {
+            qemu_cond_wait(&c->work_cond, &c->lock);
+            continue;
+        }
+
+        qemu_mutex_unlock(&c->lock);
+        dump_compress_page(c->s, &ctx, p, c->len_buf_out);
+        qemu_mutex_lock(&c->lock);
+
+        /* c->batch cannot change until all of its pages are done */
+        if (++b->done == b->nr_pages) {
+            c->batch = NULL;
+            qemu_cond_signal(&c->done_cond);
+        }
+    }
+    qemu_mutex_unlock(&c->lock);
+
+    dump_compress_ctx_cleanup(&ctx);
+    return NULL;
+}
+
+static void dump_compressor_init(DumpCompressor *c, DumpState *s)
+{
+    size_t page_size = s->dump_info.page_size;
+    unsigned int i, j;
+
+    c->s = s;
+    c->len_buf_out = get_len_buf_out(page_size, s->flag_compress);
+    assert(c->len_buf_out != 0);
+
+    /* Without worker threads, the dump thread compresses the pages */
+    c->nr_threads = s->compress_threads > 1 ? s->compress_threads : 0;
+    c->batch_pages = DUMP_BATCH_PAGES_PER_THREAD * MAX(c->nr_threads, 1);
+
+    for (i = 0; i < ARRAY_SIZE(c->batches); i++) {
+        DumpBatch *b = &c->batches[i];
+
+        b->pages = g_new0(DumpPage, c->batch_pages);
+        for (j = 0; j < c->batch_pages; j++) {
+            b->pages[j].copy = g_malloc(page_size);
+            b->pages[j].out = g_malloc(c->len_buf_out);
+        }
+    }
+
+    if (!c->nr_threads) {
+        dump_compress_ctx_init(&c->ctx, s);
+        return;
+    }
+
+    qemu_mutex_init(&c->lock);
+    qemu_cond_init(&c->work_cond);
+    qemu_cond_init(&c->done_cond);
+    c->threads = g_new(QemuThread, c->nr_threads);
+    for (i = 0; i < c->nr_threads; i++) {
+        qemu_thread_create(&c->threads[i], "dump-compress",
+                           dump_compress_thread, c, QEMU_THREAD_JOINABLE);
+    }
+}
+
+static void dump_compressor_cleanup(DumpCompressor *c)
+{
+    unsigned int i, j;
+
+    if (c->nr_threads) {
+        qemu_mutex_lock(&c->lock);
+        c->quit = true;
+        qemu_cond_broadcast(&c->work_cond);
+        qemu_mutex_unlock(&c->lock);
+
+        for (i = 0; i < c->nr_threads; i++) {
+            qemu_thread_join(&c->threads[i]);
+        }
+        g_free(c->threads);
+        qemu_cond_destroy(&c->done_cond);
+        qemu_cond_destroy(&c->work_cond);
+        qemu_mutex_destroy(&c->lock);
+    } else {
+        dump_compress_ctx_cleanup(&c->ctx);
+    }
+
+    for (i = 0; i < ARRAY_SIZE(c->batches); i++) {
+        for (j = 0; j < c->batch_pages; j++) {
+            g_free(c->batches[i].pages[j].copy);
+            g_free(c->batches[i].pages[j].out);
+        }
+        g_free(c->batches[i].pages);
+    }
+}
+
+/* Fill @b with the next pages of the guest; returns false at the end */
+static bool dump_batch_fill(DumpCompressor *c, DumpBatch *b,
+                            GuestPhysBlock **block_iter, uint64_t *pfn_iter,
+                            bool *more)
+{
+    b->nr_pages = 0;
+    b->next = 0;
+    b->done = 0;
+
+    while (*more && b->nr_pages < c->batch_pages) {
+        DumpPage *p = &b->pages[b->nr_pages];
+
+        p->data = p->copy;
+        *more = get_next_page(block_iter, pfn_iter, &p->data, c->s);
+        if (*more) {
+            b->nr_pages++;
+        }
+    }
+    return b->nr_pages != 0;
+}
+
+/* Compress @b, in the worker threads if there are any */
+static void dump_batch_compress(DumpCompressor *c, DumpBatch *b)
+{
+    unsigned int i;
+
+    if (c->nr_threads) {
+        qemu_mutex_lock(&c->lock);
+        assert(!c->batch);
+        c->batch = b;
+        qemu_cond_broadcast(&c->work_cond);
+        qemu_mutex_unlock(&c->lock);
+        return;
+    }
+
+    for (i = 0; i < b->nr_pages; i++) {
+        dump_compress_page(c->s, &c->ctx, &b->pages[i], c->len_buf_out);
+    }
+    b->done = b->nr_pages;
+}
+
+static void dump_batch_wait(DumpCompressor *c, DumpBatch *b)
+{
+    if (!c->nr_threads) {
+        return;
+    }
+
+    qemu_mutex_lock(&c->lock);
+    while (b->done < b->nr_pages) {
+        qemu_cond_wait(&c->done_cond, &c->lock);
+    }
+    qemu_mutex_unlock(&c->lock);
+}
+
+/* Write the compressed pages of @b in order */
+static bool dump_batch_write(DumpCompressor *c, DumpBatch *b,
+                             DataCache *page_desc, DataCache *page_data,
+                             PageDescriptor *pd_zero, off_t *offset_data,
+                             Error **errp)
+{
+    DumpState *s = c->s;
+    PageDescriptor pd;
+    unsigned int i;
+
+    for (i = 0; i < b->nr_pages; i++) {
+        DumpPage *p = &b->pages[i];
+
+        if (p->zero) {
+            /* zero pages all share the first page of the page section */
+            if (write_cache(page_desc, pd_zero, sizeof(PageDescriptor),
+                            false) < 0) {
+                error_setg(errp, "dump: failed to write page desc");
+                return false;
+            }
+        } else {
+            if (write_cache(page_data, p->flags ? p->out : p->data, p->size,
+                            false) < 0) {
+                error_setg(errp, "dump: failed to write page data");
+                return false;
+            }
+
+            pd.flags = cpu_to_dump32(s, p->flags);
+            pd.size = cpu_to_dump32(s, p->size);
+            pd.page_flags = cpu_to_dump64(s, 0);
+            pd.offset = cpu_to_dump64(s, *offset_data);
+            *offset_data += p->size;
+
+            if (write_cache(page_desc, &pd, sizeof(PageDescriptor),
+                            false) < 0) {
+                error_setg(errp, "dump: failed to write page desc");
+                return false;
+            }
+        }
+        s->written_size += s->dump_info.page_size;
+    }
+    return true;
+}
+
 static void write_dump_pages(DumpState *s, Error **errp)
 {
     int ret = 0;
     DataCache page_desc, page_data;
-    size_t len_buf_out, size_out;
-#ifdef CONFIG_LZO
-    lzo_bytep wrkmem = NULL;
-#endif
-    uint8_t *buf_out = NULL;
+    DumpCompressor c = { 0 };
+    DumpBatch *cur, *prev = NULL;
     off_t offset_desc, offset_data;
-    PageDescriptor pd, pd_zero;
+    PageDescriptor pd_zero;
     uint8_t *buf;
     GuestPhysBlock *block_iter = NULL;
     uint64_t pfn_iter;
-    g_autofree uint8_t *page = NULL;
+    bool more = true;
 
     /* get offset of page_desc and page_data in dump file */
     offset_desc = s->offset_page;
@@ -1489,16 +1858,6 @@ static void write_dump_pages(DumpState *s, Error **errp)
     prepare_data_cache(&page_desc, s, offset_desc);
     prepare_data_cache(&page_data, s, offset_data);
 
-    /* prepare buffer to store compressed data */
-    len_buf_out = get_len_buf_out(s->dump_info.page_size, s->flag_compress);
-    assert(len_buf_out != 0);
-
-#ifdef CONFIG_LZO
-    wrkmem = g_malloc(LZO1X_1_MEM_COMPRESS);
-#endif
-
-    buf_out = g_malloc(len_buf_out);
-
     /*
      * init zero page's page_desc and page_data, because every zero page
      * uses the same page_data
@@ -1516,125 +1875,50 @@ static void write_dump_pages(DumpState *s, Error **errp)
     }
 
     offset_data += s->dump_info.page_size;
-    page = g_malloc(s->dump_info.page_size);
 
     /*
-     * dump memory to vmcore page by page. zero page will all be resided in the
-     * first page of page section
+     * dump memory to vmcore page by page, in batches: while one batch is
+     * being compressed, the previous one is written out.
      */
-    for (buf = page; get_next_page(&block_iter, &pfn_iter, &buf, s); buf = page) {
-        /* check zero page */
-        if (buffer_is_zero(buf, s->dump_info.page_size)) {
-            ret = write_cache(&page_desc, &pd_zero, sizeof(PageDescriptor),
-                              false);
-            if (ret < 0) {
-                error_setg(errp, "dump: failed to write page desc");
-                goto out;
-            }
-        } else {
-            /*
-             * not zero page, then:
-             * 1. compress the page
-             * 2. write the compressed page into the cache of page_data
-             * 3. get page desc of the compressed page and write it into the
-             *    cache of page_desc
-             *
-             * only one compression format will be used here, for
-             * s->flag_compress is set. But when compression fails to work,
-             * we fall back to save in plaintext.
-             */
-             size_out = len_buf_out;
-             if ((s->flag_compress & DUMP_DH_COMPRESSED_ZLIB) &&
-                    (compress2(buf_out, (uLongf *)&size_out, buf,
-                               s->dump_info.page_size, Z_BEST_SPEED) == Z_OK) &&
-                    (size_out < s->dump_info.page_size)) {
-                pd.flags = cpu_to_dump32(s, DUMP_DH_COMPRESSED_ZLIB);
-                pd.size  = cpu_to_dump32(s, size_out);
-
-                ret = write_cache(&page_data, buf_out, size_out, false);
-                if (ret < 0) {
-                    error_setg(errp, "dump: failed to write page data");
-                    goto out;
-                }
-#ifdef CONFIG_LZO
-            } else if ((s->flag_compress & DUMP_DH_COMPRESSED_LZO) &&
-                    (lzo1x_1_compress(buf, s->dump_info.page_size, buf_out,
-                    (lzo_uint *)&size_out, wrkmem) == LZO_E_OK) &&
-                    (size_out < s->dump_info.page_size)) {
-                pd.flags = cpu_to_dump32(s, DUMP_DH_COMPRESSED_LZO);
-                pd.size  = cpu_to_dump32(s, size_out);
-
-                ret = write_cache(&page_data, buf_out, size_out, false);
-                if (ret < 0) {
-                    error_setg(errp, "dump: failed to write page data");
-                    goto out;
-                }
-#endif
-#ifdef CONFIG_SNAPPY
-            } else if ((s->flag_compress & DUMP_DH_COMPRESSED_SNAPPY) &&
-                    (snappy_compress((char *)buf, s->dump_info.page_size,
-                    (char *)buf_out, &size_out) == SNAPPY_OK) &&
-                    (size_out < s->dump_info.page_size)) {
-                pd.flags = cpu_to_dump32(s, DUMP_DH_COMPRESSED_SNAPPY);
-                pd.size  = cpu_to_dump32(s, size_out);
-
-                ret = write_cache(&page_data, buf_out, size_out, false);
-                if (ret < 0) {
-                    error_setg(errp, "dump: failed to write page data");
-                    goto out;
-                }
-#endif
-            } else {
-                /*
-                 * fall back to save in plaintext, size_out should be
-                 * assigned the target's page size
-                 */
-                pd.flags = cpu_to_dump32(s, 0);
-                size_out = s->dump_info.page_size;
-                pd.size = cpu_to_dump32(s, size_out);
-
-                ret = write_cache(&page_data, buf,
-                                  s->dump_info.page_size, false);
-                if (ret < 0) {
-                    error_setg(errp, "dump: failed to write page data");
-                    goto out;
-                }
-            }
-
-            /* get and write page desc here */
-            pd.page_flags = cpu_to_dump64(s, 0);
-            pd.offset = cpu_to_dump64(s, offset_data);
-            offset_data += size_out;
-
-            ret = write_cache(&page_desc, &pd, sizeof(PageDescriptor), false);
-            if (ret < 0) {
-                error_setg(errp, "dump: failed to write page desc");
-                goto out;
-            }
+    dump_compressor_init(&c, s);
+    for (cur = &c.batches[0];
+         dump_batch_fill(&c, cur, &block_iter, &pfn_iter, &more);
+         cur = &c.batches[cur == &c.batches[0]]) {
+        if (prev) {
+            dump_batch_wait(&c, prev);
+        }
+        dump_batch_compress(&c, cur);
+        if (prev && !dump_batch_write(&c, prev, &page_desc, &page_data,
+                                      &pd_zero, &offset_data, errp)) {
+            dump_batch_wait(&c, cur);
+            goto out_compressor;
+        }
+        prev = cur;
+    }
+    if (prev) {
+        dump_batch_wait(&c, prev);
+        if (!dump_batch_write(&c, prev, &page_desc, &page_data,
+                              &pd_zero, &offset_data, errp)) {
+            goto out_compressor;
         }
-        s->written_size += s->dump_info.page_size;
     }
 
     ret = write_cache(&page_desc, NULL, 0, true);
     if (ret < 0) {
         error_setg(errp, "dump: failed to sync cache for page_desc");
-        goto out;
+        goto out_compressor;
     }
     ret = write_cache(&page_data, NULL, 0, true);
     if (ret < 0) {
         error_setg(errp, "dump: failed to sync cache for page_data");
-        goto out;
+        goto out_compressor;
     }
 
+out_compressor:
+    dump_compressor_cleanup(&c);
 out:
     free_data_cache(&page_desc);
     free_data_cache(&page_data);
-
-#ifdef CONFIG_LZO
-    g_free(wrkmem);
-#endif
-
-    g_free(buf_out);
 }
 
 static void create_kdump_vmcore(DumpState *s, Error **errp)
@@ -1942,6 +2226,10 @@ static void dump_init(DumpState *s, int fd, bool has_format,
             s->flag_compress = DUMP_DH_COMPRESSED_SNAPPY;
             break;
 
+        case DUMP_GUEST_MEMORY_FORMAT_KDUMP_ZSTD:
+            s->flag_compress = DUMP_DH_COMPRESSED_ZSTD;
+            break;
+
         default:
             s->flag_compress = 0;
         }
@@ -2062,6 +2350,7 @@ void qmp_dump_guest_memory(bool paging, const char *protocol,
                            bool has_begin, int64_t begin,
                            bool has_length, int64_t length,
                            bool has_format, DumpGuestMemoryFormat format,
+                           bool has_compress_threads, uint8_t compress_threads,
                            Error **errp)
 {
     ERRP_GUARD();
@@ -2101,6 +2390,10 @@ void qmp_dump_guest_memory(bool paging, const char *protocol,
             format = DUMP_GUEST_MEMORY_FORMAT_KDUMP_SNAPPY;
             kdump_raw = true;
             break;
+        case DUMP_GUEST_MEMORY_FORMAT_KDUMP_RAW_ZSTD:
+            format = DUMP_GUEST_MEMORY_FORMAT_KDUMP_ZSTD;
+            kdump_raw = true;
+            break;
         default:
             break;
         }
@@ -2124,6 +2417,18 @@ void qmp_dump_guest_memory(bool paging, const char *protocol,
         error_setg(errp, QERR_MISSING_PARAMETER, "begin");
         return;
     }
+    if (has_compress_threads &&
+        (!has_format || format == DUMP_GUEST_MEMORY_FORMAT_ELF ||
+         format == DUMP_GUEST_MEMORY_FORMAT_WIN_DMP)) {
+        error_setg(errp, "compress-threads requires a kdump-compressed "
+                         "format");
+        return;
+    }
+    if (has_compress_threads && !compress_threads) {
+        error_setg(errp, QERR_INVALID_PARAMETER_VALUE, "compress-threads",
+                   "a value between 1 and 255");
+        return;
+    }
     if (has_detach) {
         detach_p = detach;
     }
@@ -2143,6 +2448,13 @@ void qmp_dump_guest_memory(bool paging, const char *protocol,
     }
 #endif
 
+#ifndef CONFIG_ZSTD
+    if (has_format && format == DUMP_GUEST_MEMORY_FORMAT_KDUMP_ZSTD) {
+        error_setg(errp, "kdump-zstd is not available now");
+        return;
+    }
+#endif
+
     if (has_format && format == DUMP_GUEST_MEMORY_FORMAT_WIN_DMP
         && !win_dump_available(errp)) {
         return;
@@ -2186,6 +2498,7 @@ void qmp_dump_guest_memory(bool paging, const char *protocol,
 
     s = &dump_state_global;
     dump_state_prepare(s);
+    s->compress_threads = has_compress_threads ? compress_threads : 1;
 
     dump_init(s, fd, has_format, format, paging, has_begin,
               begin, length, kdump_raw, errp);
@@ -2230,6 +2543,12 @@ DumpGuestMemoryCapability *qmp_query_dump_guest_memory_capability(Error **errp)
     QAPI_LIST_APPEND(tail, DUMP_GUEST_MEMORY_FORMAT_KDUMP_RAW_SNAPPY);
 #endif
 
+    /* add new item if kdump-zstd is available */
+#ifdef CONFIG_ZSTD
+    QAPI_LIST_APPEND(tail, DUMP_GUEST_MEMORY_FORMAT_KDUMP_ZSTD);
+    QAPI_LIST_APPEND(tail, DUMP_GUEST_MEMORY_FORMAT_KDUMP_RAW_ZSTD);
+#endif
+
     if (win_dump_available(NULL)) {
         QAPI_LIST_APPEND(tail, DUMP_GUEST_MEMORY_FORMAT_WIN_DMP);
     }
@@ -2829,6 +2829,24 @@ float32 float64_to_float32(float64 a, float_status *s)
 {
     FloatParts64 p;
 
+    if (!QEMU_NO_HARDFLOAT && likely(float64_is_zero_or_normal(a))) {
+        union_float64 ud = { .s = a };
+        union_float32 uf;
+
+        uf.h = ud.h;
+        /*
+         * An exact result is correct in any rounding mode and raises no
+         * flags.  An inexact one is only correct when the guest rounds
+         * like the host and has inexact set already; it must also stay
+         * clear of FLT_MIN, where the target's tininess detection would
+         * matter.  Overflow gives an infinity and takes the soft path.
+         */
+        if (likely(float32_is_zero_or_normal(uf.s)) &&
+            (uf.h == ud.h || (can_use_fpu(s) && fabsf(uf.h) > FLT_MIN))) {
+            return uf.s;
+        }
+    }
+
     float64_unpack_canonical(&p, a, s);
     parts_float_to_float(&p, s);
     return float32_round_pack_canonical(&p, s);
@@ -3358,13 +3376,40 @@ int16_t float32_to_int16_round_to_zero(float32 a, float_status *s)
     return float32_to_int16_scalbn(a, float_round_to_zero, 0, s);
 }
 
+/*
+ * Truncation by the host is exact for normal inputs whose integer part is
+ * in range, and only inexact needs to be computed; the rounding mode and
+ * flags of @s do not matter.
+ */
 int32_t float32_to_int32_round_to_zero(float32 a, float_status *s)
 {
+    union_float32 ua = { .s = a };
+
+    if (!QEMU_NO_HARDFLOAT && likely(float32_is_zero_or_normal(a)) &&
+        fabsf(ua.h) < 0x1p31f) {
+        int32_t r = ua.h;
+
+        if (unlikely(r != ua.h)) {
+            float_raise(float_flag_inexact, s);
+        }
+        return r;
+    }
     return float32_to_int32_scalbn(a, float_round_to_zero, 0, s);
 }
 
 int64_t float32_to_int64_round_to_zero(float32 a, float_status *s)
 {
+    union_float32 ua = { .s = a };
+
+    if (!QEMU_NO_HARDFLOAT && likely(float32_is_zero_or_normal(a)) &&
+        fabsf(ua.h) < 0x1p63f) {
+        int64_t r = ua.h;
+
+        if (unlikely(r != ua.h)) {
+            float_raise(float_flag_inexact, s);
+        }
+        return r;
+    }
     return float32_to_int64_scalbn(a, float_round_to_zero, 0, s);
 }
 
@@ -3375,11 +3420,33 @@ int16_t float64_to_int16_round_to_zero(float64 a, float_status *s)
 
 int32_t float64_to_int32_round_to_zero(float64 a, float_status *s)
 {
+    union_float64 ua = { .s = a };
+
+    if (!QEMU_NO_HARDFLOAT && likely(float64_is_zero_or_normal(a)) &&
+        fabs(ua.h) < 0x1p31) {
+        int32_t r = ua.h;
+
+        if (unlikely(r != ua.h)) {
+            float_raise(float_flag_inexact, s);
+        }
+        return r;
+    }
     return float64_to_int32_scalbn(a, float_round_to_zero, 0, s);
 }
 
 int64_t float64_to_int64_round_to_zero(float64 a, float_status *s)
 {
+    union_float64 ua = { .s = a };
+
+    if (!QEMU_NO_HARDFLOAT && likely(float64_is_zero_or_normal(a)) &&
+        fabs(ua.h) < 0x1p63) {
+        int64_t r = ua.h;
+
+        if (unlikely(r != ua.h)) {
+            float_raise(float_flag_inexact, s);
+        }
+        return r;
+    }
     return float64_to_int64_scalbn(a, float_round_to_zero, 0, s);
 }
 
@@ -3880,8 +3947,13 @@ float32 int64_to_float32_scalbn(int64_t a, int scale, float_status *status)
 {
     FloatParts64 p;
 
-    /* Without scaling, there are no overflow concerns. */
-    if (likely(scale == 0) && can_use_fpu(status)) {
+    /*
+     * Without scaling, there are no overflow concerns.  Small integers
+     * are exact, so they do not depend on the rounding mode either.
+     */
+    if (likely(scale == 0) &&
+        (can_use_fpu(status) ||
+         (!QEMU_NO_HARDFLOAT && a >= -(1 << 24) && a <= (1 << 24)))) {
         union_float32 ur;
         ur.h = a;
         return ur.s;
@@ -3920,8 +3992,13 @@ float64 int64_to_float64_scalbn(int64_t a, int scale, float_status *status)
 {
     FloatParts64 p;
 
-    /* Without scaling, there are no overflow concerns. */
-    if (likely(scale == 0) && can_use_fpu(status)) {
+    /*
+     * Without scaling, there are no overflow concerns.  Integers of up
+     * to 53 bits, including all int32_t, are exact in any rounding mode.
+     */
+    if (likely(scale == 0) &&
+        (can_use_fpu(status) ||
+         (!QEMU_NO_HARDFLOAT && a >= -(1LL << 53) && a <= (1LL << 53)))) {
         union_float64 ur;
         ur.h = a;
         return ur.s;
@@ -4101,7 +4178,8 @@ float32 uint64_to_float32_scalbn(uint64_t a, int scale, float_status *status)
     FloatParts64 p;
 
     /* Without scaling, there are no overflow concerns. */
-    if (likely(scale == 0) && can_use_fpu(status)) {
+    if (likely(scale == 0) &&
+        (can_use_fpu(status) || (!QEMU_NO_HARDFLOAT && a <= (1 << 24)))) {
         union_float32 ur;
         ur.h = a;
         return ur.s;
@@ -4141,7 +4219,8 @@ float64 uint64_to_float64_scalbn(uint64_t a, int scale, float_status *status)
     FloatParts64 p;
 
     /* Without scaling, there are no overflow concerns. */
-    if (likely(scale == 0) && can_use_fpu(status)) {
+    if (likely(scale == 0) &&
+        (can_use_fpu(status) || (!QEMU_NO_HARDFLOAT && a <= (1ULL << 53)))) {
         union_float64 ur;
         ur.h = a;
         return ur.s;
@@ -4279,9 +4358,35 @@ static bfloat16 bfloat16_minmax(bfloat16 a, bfloat16 b,
     return bfloat16_round_pack_canonical(pr, s);
 }
 
+/*
+ * For zero or normal operands that do not compare equal (-0 and +0 do),
+ * minimum and maximum are a plain comparison that raises no flags; the
+ * NaN handling selected by @flags does not come into play.
+ */
+static inline bool hard_minmax_ok(bool a_lt_b, bool b_lt_a, int flags,
+                                  bool *pick_a)
+{
+    if (a_lt_b == b_lt_a) {
+        return false;
+    }
+    *pick_a = (flags & minmax_ismin) ? a_lt_b : b_lt_a;
+    return true;
+}
+
 static float32 float32_minmax(float32 a, float32 b, float_status *s, int flags)
 {
     FloatParts64 pa, pb, *pr;
+    union_float32 ua = { .s = a }, ub = { .s = b };
+
+    if (!QEMU_NO_HARDFLOAT && likely(f32_is_zon2(ua, ub))) {
+        float fa = flags & minmax_ismag ? fabsf(ua.h) : ua.h;
+        float fb = flags & minmax_ismag ? fabsf(ub.h) : ub.h;
+        bool pick_a;
+
+        if (hard_minmax_ok(fa < fb, fb < fa, flags, &pick_a)) {
+            return pick_a ? a : b;
+        }
+    }
 
     float32_unpack_canonical(&pa, a, s);
     float32_unpack_canonical(&pb, b, s);
@@ -4293,6 +4398,17 @@ static float32 float32_minmax(float32 a, float32 b, float_status *s, int flags)
 static float64 float64_minmax(float64 a, float64 b, float_status *s, int flags)
 {
     FloatParts64 pa, pb, *pr;
+    union_float64 ua = { .s = a }, ub = { .s = b };
+
+    if (!QEMU_NO_HARDFLOAT && likely(f64_is_zon2(ua, ub))) {
+        double fa = flags & minmax_ismag ? fabs(ua.h) : ua.h;
+        double fb = flags & minmax_ismag ? fabs(ub.h) : ub.h;
+        bool pick_a;
+
+        if (hard_minmax_ok(fa < fb, fb < fa, flags, &pick_a)) {
+            return pick_a ? a : b;
+        }
+    }
 
     float64_unpack_canonical(&pa, a, s);
     float64_unpack_canonical(&pb, b, s);
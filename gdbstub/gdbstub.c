@@ -76,23 +76,29 @@ void gdb_init_gdbserver_state(void)
 /* writes 2*len+1 bytes in buf */
 void gdb_memtohex(GString *buf, const uint8_t *mem, int len)
 {
-    int i, c;
-    for(i = 0; i < len; i++) {
-        c = mem[i];
-        g_string_append_c(buf, tohex(c >> 4));
-        g_string_append_c(buf, tohex(c & 0xf));
+    static const char hex[] = "0123456789abcdef";
+    gsize pos = buf->len;
+    char *p;
+    int i;
+
+    /* Size the string once instead of appending a character at a time */
+    g_string_set_size(buf, pos + 2 * len + 1);
+    p = buf->str + pos;
+    for (i = 0; i < len; i++) {
+        p[2 * i] = hex[mem[i] >> 4];
+        p[2 * i + 1] = hex[mem[i] & 0xf];
     }
-    g_string_append_c(buf, '\0');
+    p[2 * len] = '\0';
 }
 
 void gdb_hextomem(GByteArray *mem, const char *buf, int len)
 {
+    guint pos = mem->len;
     int i;
 
-    for(i = 0; i < len; i++) {
-        guint8 byte = fromhex(buf[0]) << 4 | fromhex(buf[1]);
-        g_byte_array_append(mem, &byte, 1);
-        buf += 2;
+    g_byte_array_set_size(mem, pos + len);
+    for (i = 0; i < len; i++) {
+        mem->data[pos + i] = fromhex(buf[2 * i]) << 4 | fromhex(buf[2 * i + 1]);
     }
 }
 
@@ -177,21 +183,28 @@ void gdb_put_strbuf(void)
     gdb_put_packet(gdbserver_state.str_buf->str);
 }
 
+static inline bool gdb_needs_escape(char c)
+{
+    return c == '#' || c == '$' || c == '*' || c == '}';
+}
+
 /* Encode data using the encoding for 'x' packets.  */
 void gdb_memtox(GString *buf, const char *mem, int len)
 {
-    char c;
+    const char *end = mem + len;
 
-    while (len--) {
-        c = *(mem++);
-        switch (c) {
-        case '#': case '$': case '*': case '}':
+    while (mem < end) {
+        const char *run = mem;
+
+        while (mem < end && !gdb_needs_escape(*mem)) {
+            mem++;
+        }
+        g_string_append_len(buf, run, mem - run);
+
+        if (mem < end) {
             g_string_append_c(buf, '}');
-            g_string_append_c(buf, c ^ 0x20);
-            break;
-        default:
-            g_string_append_c(buf, c);
-            break;
+            g_string_append_c(buf, *mem ^ 0x20);
+            mem++;
         }
     }
 }
@@ -1310,6 +1323,87 @@ static void handle_read_mem(GArray *params, void *user_ctx)
     gdb_put_strbuf();
 }
 
+/*
+ * handle_write/read_mem_binary
+ *
+ * The 'X' and 'x' packets carry the memory contents as escaped binary
+ * rather than hex, which halves the size of bulk transfers such as
+ * loading an image or dumping guest memory.
+ */
+
+static void handle_write_mem_binary(GArray *params, void *user_ctx)
+{
+    const char *data;
+    uint64_t len;
+
+    if (params->len != 2) {
+        gdb_put_packet("E22");
+        return;
+    }
+
+    /* An empty write is how gdb probes for the packet */
+    len = get_param(params, 1)->val_ull;
+    if (!len) {
+        gdb_put_packet("OK");
+        return;
+    }
+
+    /*
+     * The escapes were undone as the packet was received, so the data
+     * may contain NULs; it runs to the end of the packet.
+     */
+    data = strchr(gdbserver_state.line_buf, ':');
+    if (!data ||
+        len != gdbserver_state.line_buf + gdbserver_state.line_buf_index -
+               (data + 1)) {
+        gdb_put_packet("E22");
+        return;
+    }
+
+    g_byte_array_append(gdbserver_state.mem_buf,
+                        (const uint8_t *)data + 1, len);
+    if (gdb_target_memory_rw_debug(gdbserver_state.g_cpu,
+                                   get_param(params, 0)->val_ull,
+                                   gdbserver_state.mem_buf->data,
+                                   gdbserver_state.mem_buf->len, true)) {
+        gdb_put_packet("E14");
+        return;
+    }
+
+    gdb_put_packet("OK");
+}
+
+static void handle_read_mem_binary(GArray *params, void *user_ctx)
+{
+    if (params->len != 2) {
+        gdb_put_packet("E22");
+        return;
+    }
+
+    if (get_param(params, 1)->val_ull > MAX_PACKET_LENGTH) {
+        gdb_put_packet("E22");
+        return;
+    }
+
+    g_byte_array_set_size(gdbserver_state.mem_buf,
+                          get_param(params, 1)->val_ull);
+
+    if (gdb_target_memory_rw_debug(gdbserver_state.g_cpu,
+                                   get_param(params, 0)->val_ull,
+                                   gdbserver_state.mem_buf->data,
+                                   gdbserver_state.mem_buf->len, false)) {
+        gdb_put_packet("E14");
+        return;
+    }
+
+    g_string_assign(gdbserver_state.str_buf, "b");
+    gdb_memtox(gdbserver_state.str_buf,
+               (const char *)gdbserver_state.mem_buf->data,
+               gdbserver_state.mem_buf->len);
+    gdb_put_packet_binary(gdbserver_state.str_buf->str,
+                          gdbserver_state.str_buf->len, true);
+}
+
 static void handle_write_all_regs(GArray *params, void *user_ctx)
 {
     int reg_id;
@@ -1681,7 +1775,8 @@ static void handle_query_supported(GArray *params, void *user_ctx)
 #endif
     }
 
-    g_string_append(gdbserver_state.str_buf, ";vContSupported+;multiprocess+");
+    g_string_append(gdbserver_state.str_buf,
+                    ";vContSupported+;multiprocess+;binary-upload+");
     gdb_put_strbuf();
 }
 
@@ -2087,6 +2182,28 @@ static int gdb_handle_packet(const char *line_buf)
             cmd_parser = &write_mem_cmd_desc;
         }
         break;
+    case 'x':
+        {
+            static const GdbCmdParseEntry read_mem_binary_cmd_desc = {
+                .handler = handle_read_mem_binary,
+                .cmd = "x",
+                .cmd_startswith = 1,
+                .schema = "L,L0"
+            };
+            cmd_parser = &read_mem_binary_cmd_desc;
+        }
+        break;
+    case 'X':
+        {
+            static const GdbCmdParseEntry write_mem_binary_cmd_desc = {
+                .handler = handle_write_mem_binary,
+                .cmd = "X",
+                .cmd_startswith = 1,
+                .schema = "L,L:"
+            };
+            cmd_parser = &write_mem_binary_cmd_desc;
+        }
+        break;
     case 'p':
         {
             static const GdbCmdParseEntry get_reg_cmd_desc = {
@@ -283,6 +283,20 @@ SRST
     Show dynamic compiler opcode counters
 ERST
 
+#if defined(CONFIG_TCG)
+    {
+        .name       = "tb-profile",
+        .args_type  = "",
+        .params     = "",
+        .help       = "show the hottest TCG translation blocks and helpers",
+    },
+#endif
+
+SRST
+  ``info tb-profile``
+    Show the hottest TCG translation blocks and helpers, see ``tb-profile``.
+ERST
+
     {
         .name       = "sync-profile",
         .args_type  = "mean:-m,no_coalesce:-n,max:i?",
@@ -899,7 +913,8 @@ ERST
         .name       = "stats",
         .args_type  = "target:s,names:s?,provider:s?",
         .params     = "target [names] [provider]",
-        .help       = "show statistics for the given target (vm or vcpu); optionally filter by"
+        .help       = "show statistics for the given target (vm, vcpu, "
+                      "cryptodev or block); optionally filter by "
                       "name (comma-separated list, or * for all) and provider",
         .cmd        = hmp_info_stats,
     },
@@ -1583,6 +1583,8 @@ static void coroutine_fn v9fs_getattr(void *opaque)
     V9fsFidState *fidp;
     uint64_t request_mask;
     V9fsStatDotl v9stat_dotl;
+    uint64_t st_gen = 0;
+    int st_gen_err = -EOPNOTSUPP;
     V9fsPDU *pdu = opaque;
 
     retval = pdu_unmarshal(pdu, offset, "dq", &fid, &request_mask);
@@ -1600,7 +1602,13 @@ static void coroutine_fn v9fs_getattr(void *opaque)
      * Currently we only support BASIC fields in stat, so there is no
      * need to look at request_mask.
      */
-    retval = v9fs_co_lstat(pdu, &fidp->path, &stbuf);
+    if (request_mask & P9_STATS_GEN) {
+        /* fetch st_gen in the same trip to the worker, if supported by fs */
+        retval = v9fs_co_lstat_gen(pdu, &fidp->path, &stbuf, &st_gen,
+                                   &st_gen_err);
+    } else {
+        retval = v9fs_co_lstat(pdu, &fidp->path, &stbuf);
+    }
     if (retval < 0) {
         goto out;
     }
@@ -1609,21 +1617,10 @@ static void coroutine_fn v9fs_getattr(void *opaque)
         goto out;
     }
 
-    /*  fill st_gen if requested and supported by underlying fs */
-    if (request_mask & P9_STATS_GEN) {
-        retval = v9fs_co_st_gen(pdu, &fidp->path, stbuf.st_mode, &v9stat_dotl);
-        switch (retval) {
-        case 0:
-            /* we have valid st_gen: update result mask */
-            v9stat_dotl.st_result_mask |= P9_STATS_GEN;
-            break;
-        case -EINTR:
-            /* request cancelled, e.g. by Tflush */
-            goto out;
-        default:
-            /* failed to get st_gen: not fatal, ignore */
-            break;
-        }
+    /* failing to get st_gen is not fatal, just leave it out of the mask */
+    if ((request_mask & P9_STATS_GEN) && !st_gen_err) {
+        v9stat_dotl.st_gen = st_gen;
+        v9stat_dotl.st_result_mask |= P9_STATS_GEN;
     }
     retval = pdu_marshal(pdu, offset, "A", &v9stat_dotl);
     if (retval < 0) {
@@ -2387,19 +2384,31 @@ static void coroutine_fn v9fs_read(void *opaque)
     } else if (fidp->fid_type == P9_FID_FILE) {
         QEMUIOVector qiov_full;
         QEMUIOVector qiov;
+        QEMUIOVector *cur;
         int32_t len;
 
+        /*
+         * qiov_full points straight at the guest buffers, so the data is
+         * read into guest memory with no intermediate copy.  Only a short
+         * read needs a second vector, for the part that is still missing.
+         */
         v9fs_init_qiov_from_pdu(&qiov_full, pdu, offset + 4, max_count, false);
         qemu_iovec_init(&qiov, qiov_full.niov);
         do {
-            qemu_iovec_reset(&qiov);
-            qemu_iovec_concat(&qiov, &qiov_full, count, qiov_full.size - count);
+            if (count) {
+                qemu_iovec_reset(&qiov);
+                qemu_iovec_concat(&qiov, &qiov_full, count,
+                                  qiov_full.size - count);
+                cur = &qiov;
+            } else {
+                cur = &qiov_full;
+            }
             if (0) {
-                print_sg(qiov.iov, qiov.niov);
+                print_sg(cur->iov, cur->niov);
             }
             /* Loop in case of EINTR */
             do {
-                len = v9fs_co_preadv(pdu, fidp, qiov.iov, qiov.niov, off);
+                len = v9fs_co_preadv(pdu, fidp, cur->iov, cur->niov, off);
                 if (len >= 0) {
                     off   += len;
                     count += len;
@@ -2671,6 +2680,7 @@ static void coroutine_fn v9fs_write(void *opaque)
     V9fsState *s = pdu->s;
     QEMUIOVector qiov_full;
     QEMUIOVector qiov;
+    QEMUIOVector *cur;
 
     err = pdu_unmarshal(pdu, offset, "dqd", &fid, &off, &count);
     if (err < 0) {
@@ -2702,16 +2712,23 @@ static void coroutine_fn v9fs_write(void *opaque)
         err = -EINVAL;
         goto out;
     }
+    /* As in v9fs_read(), the guest buffers are written from directly */
     qemu_iovec_init(&qiov, qiov_full.niov);
     do {
-        qemu_iovec_reset(&qiov);
-        qemu_iovec_concat(&qiov, &qiov_full, total, qiov_full.size - total);
+        if (total) {
+            qemu_iovec_reset(&qiov);
+            qemu_iovec_concat(&qiov, &qiov_full, total,
+                              qiov_full.size - total);
+            cur = &qiov;
+        } else {
+            cur = &qiov_full;
+        }
         if (0) {
-            print_sg(qiov.iov, qiov.niov);
+            print_sg(cur->iov, cur->niov);
         }
         /* Loop in case of EINTR */
         do {
-            len = v9fs_co_pwritev(pdu, fidp, qiov.iov, qiov.niov, off);
+            len = v9fs_co_pwritev(pdu, fidp, cur->iov, cur->niov, off);
             if (len >= 0) {
                 off   += len;
                 total += len;
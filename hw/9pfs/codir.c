@@ -96,10 +96,13 @@ do_readdir_many(V9fsPDU *pdu, V9fsFidState *fidp, struct V9fsDirEnt **entries,
      */
     v9fs_readdir_lock(&fidp->fs.dir);
 
-    /* seek directory to requested initial position */
+    /*
+     * seek directory to requested initial position, unless a sequential
+     * scan already left it there
+     */
     if (offset == 0) {
         s->ops->rewinddir(&s->ctx, &fidp->fs);
-    } else {
+    } else if (s->ops->telldir(&s->ctx, &fidp->fs) != offset) {
         s->ops->seekdir(&s->ctx, &fidp->fs, offset);
     }
 
@@ -129,10 +132,9 @@ do_readdir_many(V9fsPDU *pdu, V9fsFidState *fidp, struct V9fsDirEnt **entries,
          * because anything beyond that size would need to be discarded by
          * 9p controller (main thread / top half) anyway
          */
-        v9fs_string_init(&name);
-        v9fs_string_sprintf(&name, "%s", dent->d_name);
+        name.data = dent->d_name;
+        name.size = strlen(dent->d_name);
         len = v9fs_readdir_response_size(&name);
-        v9fs_string_free(&name);
         if (size + len > maxsize) {
             /* this is not an error case actually */
             break;
@@ -22,31 +22,34 @@
 #include "qemu/main-loop.h"
 #include "coth.h"
 
-int coroutine_fn v9fs_co_st_gen(V9fsPDU *pdu, V9fsPath *path, mode_t st_mode,
-                                V9fsStatDotl *v9stat)
+int coroutine_fn v9fs_co_lstat(V9fsPDU *pdu, V9fsPath *path, struct stat *stbuf)
 {
-    int err = 0;
+    int err;
     V9fsState *s = pdu->s;
 
     if (v9fs_request_cancelled(pdu)) {
         return -EINTR;
     }
-    if (s->ctx.exops.get_st_gen) {
-        v9fs_path_read_lock(s);
-        v9fs_co_run_in_worker(
-            {
-                err = s->ctx.exops.get_st_gen(&s->ctx, path, st_mode,
-                                              &v9stat->st_gen);
-                if (err < 0) {
-                    err = -errno;
-                }
-            });
-        v9fs_path_unlock(s);
-    }
+    v9fs_path_read_lock(s);
+    v9fs_co_run_in_worker(
+        {
+            err = s->ops->lstat(&s->ctx, path, stbuf);
+            if (err < 0) {
+                err = -errno;
+            }
+        });
+    v9fs_path_unlock(s);
     return err;
 }
 
-int coroutine_fn v9fs_co_lstat(V9fsPDU *pdu, V9fsPath *path, struct stat *stbuf)
+/*
+ * Same as v9fs_co_lstat() followed by v9fs_co_st_gen(), but in a single
+ * trip to the worker thread.  The result of get_st_gen goes to @st_gen_err,
+ * -EOPNOTSUPP if the fs driver doesn't have it.
+ */
+int coroutine_fn v9fs_co_lstat_gen(V9fsPDU *pdu, V9fsPath *path,
+                                   struct stat *stbuf, uint64_t *st_gen,
+                                   int *st_gen_err)
 {
     int err;
     V9fsState *s = pdu->s;
@@ -54,12 +57,19 @@ int coroutine_fn v9fs_co_lstat(V9fsPDU *pdu, V9fsPath *path, struct stat *stbuf)
     if (v9fs_request_cancelled(pdu)) {
         return -EINTR;
     }
+    *st_gen_err = -EOPNOTSUPP;
     v9fs_path_read_lock(s);
     v9fs_co_run_in_worker(
         {
             err = s->ops->lstat(&s->ctx, path, stbuf);
             if (err < 0) {
                 err = -errno;
+            } else if (s->ctx.exops.get_st_gen) {
+                *st_gen_err = s->ctx.exops.get_st_gen(&s->ctx, path,
+                                                      stbuf->st_mode, st_gen);
+                if (*st_gen_err < 0) {
+                    *st_gen_err = -errno;
+                }
             }
         });
     v9fs_path_unlock(s);
@@ -31,6 +31,8 @@
 #include "sysemu/iothread.h"
 #include "xen-block.h"
 
+typedef struct XenBlockRing XenBlockRing;
+
 typedef struct XenBlockRequest {
     blkif_request_t req;
     int16_t status;
@@ -42,17 +44,21 @@ typedef struct XenBlockRequest {
     int aio_inflight;
     int aio_errors;
     XenBlockDataPlane *dataplane;
+    XenBlockRing *ring;
     QLIST_ENTRY(XenBlockRequest) list;
     BlockAcctCookie acct;
 } XenBlockRequest;
 
-struct XenBlockDataPlane {
-    XenDevice *xendev;
+/*
+ * A request ring of the frontend.  Each ring is only ever processed in its
+ * own AioContext, so rings that are served by different IOThreads do not
+ * share any state apart from the BlockBackend.
+ */
+struct XenBlockRing {
+    XenBlockDataPlane *dataplane;
     XenEventChannel *event_channel;
     unsigned int *ring_ref;
-    unsigned int nr_ring_ref;
     void *sring;
-    int protocol;
     blkif_back_rings_t rings;
     int more_work;
     QLIST_HEAD(inflight_head, XenBlockRequest) inflight;
@@ -60,13 +66,23 @@ struct XenBlockDataPlane {
     int requests_total;
     int requests_inflight;
     unsigned int max_requests;
-    BlockBackend *blk;
-    unsigned int sector_size;
     QEMUBH *bh;
     IOThread *iothread;
     AioContext *ctx;
 };
 
+struct XenBlockDataPlane {
+    XenDevice *xendev;
+    unsigned int nr_ring_ref;
+    int protocol;
+    BlockBackend *blk;
+    unsigned int sector_size;
+    XenBlockRing *rings;
+    unsigned int max_rings;
+    /* Number of rings connected to the frontend */
+    unsigned int nr_rings;
+};
+
 static int xen_block_send_response(XenBlockRequest *request);
 
 static void reset_request(XenBlockRequest *request)
@@ -81,23 +97,25 @@ static void reset_request(XenBlockRequest *request)
     request->aio_errors = 0;
 
     request->dataplane = NULL;
+    request->ring = NULL;
     memset(&request->list, 0, sizeof(request->list));
     memset(&request->acct, 0, sizeof(request->acct));
 
     qemu_iovec_reset(&request->v);
 }
 
-static XenBlockRequest *xen_block_start_request(XenBlockDataPlane *dataplane)
+static XenBlockRequest *xen_block_start_request(XenBlockRing *ring)
 {
     XenBlockRequest *request = NULL;
 
-    if (QLIST_EMPTY(&dataplane->freelist)) {
-        if (dataplane->requests_total >= dataplane->max_requests) {
+    if (QLIST_EMPTY(&ring->freelist)) {
+        if (ring->requests_total >= ring->max_requests) {
             goto out;
         }
         /* allocate new struct */
         request = g_malloc0(sizeof(*request));
-        request->dataplane = dataplane;
+        request->dataplane = ring->dataplane;
+        request->ring = ring;
         /*
          * We cannot need more pages per requests than this, and since we
          * re-use requests, allocate the memory once here. It will be freed
@@ -106,15 +124,15 @@ static XenBlockRequest *xen_block_start_request(XenBlockDataPlane *dataplane)
         request->buf = qemu_memalign(XEN_PAGE_SIZE,
                                      BLKIF_MAX_SEGMENTS_PER_REQUEST *
                                      XEN_PAGE_SIZE);
-        dataplane->requests_total++;
+        ring->requests_total++;
         qemu_iovec_init(&request->v, 1);
     } else {
         /* get one from freelist */
-        request = QLIST_FIRST(&dataplane->freelist);
+        request = QLIST_FIRST(&ring->freelist);
         QLIST_REMOVE(request, list);
     }
-    QLIST_INSERT_HEAD(&dataplane->inflight, request, list);
-    dataplane->requests_inflight++;
+    QLIST_INSERT_HEAD(&ring->inflight, request, list);
+    ring->requests_inflight++;
 
 out:
     return request;
@@ -123,12 +141,13 @@ out:
 static void xen_block_complete_request(XenBlockRequest *request)
 {
     XenBlockDataPlane *dataplane = request->dataplane;
+    XenBlockRing *ring = request->ring;
 
     if (xen_block_send_response(request)) {
         Error *local_err = NULL;
 
         xen_device_notify_event_channel(dataplane->xendev,
-                                        dataplane->event_channel,
+                                        ring->event_channel,
                                         &local_err);
         if (local_err) {
             error_report_err(local_err);
@@ -136,10 +155,11 @@ static void xen_block_complete_request(XenBlockRequest *request)
     }
 
     QLIST_REMOVE(request, list);
-    dataplane->requests_inflight--;
+    ring->requests_inflight--;
     reset_request(request);
     request->dataplane = dataplane;
-    QLIST_INSERT_HEAD(&dataplane->freelist, request, list);
+    request->ring = ring;
+    QLIST_INSERT_HEAD(&ring->freelist, request, list);
 }
 
 /*
@@ -313,8 +333,8 @@ static void xen_block_complete_aio(void *opaque, int ret)
 
     xen_block_complete_request(request);
 
-    if (dataplane->more_work) {
-        qemu_bh_schedule(dataplane->bh);
+    if (request->ring->more_work) {
+        qemu_bh_schedule(request->ring->bh);
     }
 }
 
@@ -420,6 +440,7 @@ err:
 static int xen_block_send_response(XenBlockRequest *request)
 {
     XenBlockDataPlane *dataplane = request->dataplane;
+    XenBlockRing *ring = request->ring;
     int send_notify = 0;
     int have_requests = 0;
     blkif_response_t *resp;
@@ -428,18 +449,18 @@ static int xen_block_send_response(XenBlockRequest *request)
     switch (dataplane->protocol) {
     case BLKIF_PROTOCOL_NATIVE:
         resp = (blkif_response_t *)RING_GET_RESPONSE(
-            &dataplane->rings.native,
-            dataplane->rings.native.rsp_prod_pvt);
+            &ring->rings.native,
+            ring->rings.native.rsp_prod_pvt);
         break;
     case BLKIF_PROTOCOL_X86_32:
         resp = (blkif_response_t *)RING_GET_RESPONSE(
-            &dataplane->rings.x86_32_part,
-            dataplane->rings.x86_32_part.rsp_prod_pvt);
+            &ring->rings.x86_32_part,
+            ring->rings.x86_32_part.rsp_prod_pvt);
         break;
     case BLKIF_PROTOCOL_X86_64:
         resp = (blkif_response_t *)RING_GET_RESPONSE(
-            &dataplane->rings.x86_64_part,
-            dataplane->rings.x86_64_part.rsp_prod_pvt);
+            &ring->rings.x86_64_part,
+            ring->rings.x86_64_part.rsp_prod_pvt);
         break;
     default:
         return 0;
@@ -449,50 +470,52 @@ static int xen_block_send_response(XenBlockRequest *request)
     resp->operation = request->req.operation;
     resp->status = request->status;
 
-    dataplane->rings.common.rsp_prod_pvt++;
+    ring->rings.common.rsp_prod_pvt++;
 
-    RING_PUSH_RESPONSES_AND_CHECK_NOTIFY(&dataplane->rings.common,
+    RING_PUSH_RESPONSES_AND_CHECK_NOTIFY(&ring->rings.common,
                                          send_notify);
-    if (dataplane->rings.common.rsp_prod_pvt ==
-        dataplane->rings.common.req_cons) {
+    if (ring->rings.common.rsp_prod_pvt ==
+        ring->rings.common.req_cons) {
         /*
          * Tail check for pending requests. Allows frontend to avoid
          * notifications if requests are already in flight (lower
          * overheads and promotes batching).
          */
-        RING_FINAL_CHECK_FOR_REQUESTS(&dataplane->rings.common,
+        RING_FINAL_CHECK_FOR_REQUESTS(&ring->rings.common,
                                       have_requests);
-    } else if (RING_HAS_UNCONSUMED_REQUESTS(&dataplane->rings.common)) {
+    } else if (RING_HAS_UNCONSUMED_REQUESTS(&ring->rings.common)) {
         have_requests = 1;
     }
 
     if (have_requests) {
-        dataplane->more_work++;
+        ring->more_work++;
     }
     return send_notify;
 }
 
-static int xen_block_get_request(XenBlockDataPlane *dataplane,
+static int xen_block_get_request(XenBlockRing *ring,
                                  XenBlockRequest *request, RING_IDX rc)
 {
+    XenBlockDataPlane *dataplane = ring->dataplane;
+
     switch (dataplane->protocol) {
     case BLKIF_PROTOCOL_NATIVE: {
         blkif_request_t *req =
-            RING_GET_REQUEST(&dataplane->rings.native, rc);
+            RING_GET_REQUEST(&ring->rings.native, rc);
 
         memcpy(&request->req, req, sizeof(request->req));
         break;
     }
     case BLKIF_PROTOCOL_X86_32: {
         blkif_x86_32_request_t *req =
-            RING_GET_REQUEST(&dataplane->rings.x86_32_part, rc);
+            RING_GET_REQUEST(&ring->rings.x86_32_part, rc);
 
         blkif_get_x86_32_req(&request->req, req);
         break;
     }
     case BLKIF_PROTOCOL_X86_64: {
         blkif_x86_64_request_t *req =
-            RING_GET_REQUEST(&dataplane->rings.x86_64_part, rc);
+            RING_GET_REQUEST(&ring->rings.x86_64_part, rc);
 
         blkif_get_x86_64_req(&request->req, req);
         break;
@@ -509,18 +532,19 @@ static int xen_block_get_request(XenBlockDataPlane *dataplane,
  */
 #define IO_PLUG_THRESHOLD 1
 
-static bool xen_block_handle_requests(XenBlockDataPlane *dataplane)
+static bool xen_block_handle_requests(XenBlockRing *ring)
 {
+    XenBlockDataPlane *dataplane = ring->dataplane;
     RING_IDX rc, rp;
     XenBlockRequest *request;
-    int inflight_atstart = dataplane->requests_inflight;
+    int inflight_atstart = ring->requests_inflight;
     int batched = 0;
     bool done_something = false;
 
-    dataplane->more_work = 0;
+    ring->more_work = 0;
 
-    rc = dataplane->rings.common.req_cons;
-    rp = dataplane->rings.common.sring->req_prod;
+    rc = ring->rings.common.req_cons;
+    rp = ring->rings.common.sring->req_prod;
     xen_rmb(); /* Ensure we see queued requests up to 'rp'. */
 
     /*
@@ -537,16 +561,16 @@ static bool xen_block_handle_requests(XenBlockDataPlane *dataplane)
     }
     while (rc != rp) {
         /* pull request from ring */
-        if (RING_REQUEST_CONS_OVERFLOW(&dataplane->rings.common, rc)) {
+        if (RING_REQUEST_CONS_OVERFLOW(&ring->rings.common, rc)) {
             break;
         }
-        request = xen_block_start_request(dataplane);
+        request = xen_block_start_request(ring);
         if (request == NULL) {
-            dataplane->more_work++;
+            ring->more_work++;
             break;
         }
-        xen_block_get_request(dataplane, request, rc);
-        dataplane->rings.common.req_cons = ++rc;
+        xen_block_get_request(ring, request, rc);
+        ring->rings.common.req_cons = ++rc;
         done_something = true;
 
         /* parse them */
@@ -594,42 +618,55 @@ static bool xen_block_handle_requests(XenBlockDataPlane *dataplane)
 
 static void xen_block_dataplane_bh(void *opaque)
 {
-    XenBlockDataPlane *dataplane = opaque;
+    XenBlockRing *ring = opaque;
 
-    xen_block_handle_requests(dataplane);
+    xen_block_handle_requests(ring);
 }
 
 static bool xen_block_dataplane_event(void *opaque)
 {
-    XenBlockDataPlane *dataplane = opaque;
+    XenBlockRing *ring = opaque;
 
-    return xen_block_handle_requests(dataplane);
+    return xen_block_handle_requests(ring);
 }
 
 XenBlockDataPlane *xen_block_dataplane_create(XenDevice *xendev,
                                               BlockBackend *blk,
                                               unsigned int sector_size,
-                                              IOThread *iothread)
+                                              IOThread *const iothreads[],
+                                              unsigned int nr_iothreads,
+                                              unsigned int max_rings)
 {
     XenBlockDataPlane *dataplane = g_new0(XenBlockDataPlane, 1);
+    unsigned int i;
+
+    assert(max_rings > 0);
 
     dataplane->xendev = xendev;
     dataplane->blk = blk;
     dataplane->sector_size = sector_size;
+    dataplane->max_rings = max_rings;
+    dataplane->rings = g_new0(XenBlockRing, max_rings);
 
-    QLIST_INIT(&dataplane->inflight);
-    QLIST_INIT(&dataplane->freelist);
+    for (i = 0; i < max_rings; i++) {
+        XenBlockRing *ring = &dataplane->rings[i];
 
-    if (iothread) {
-        dataplane->iothread = iothread;
-        object_ref(OBJECT(dataplane->iothread));
-        dataplane->ctx = iothread_get_aio_context(dataplane->iothread);
-    } else {
-        dataplane->ctx = qemu_get_aio_context();
+        ring->dataplane = dataplane;
+        QLIST_INIT(&ring->inflight);
+        QLIST_INIT(&ring->freelist);
+
+        /* Spread the rings over the IOThreads */
+        if (nr_iothreads) {
+            ring->iothread = iothreads[i % nr_iothreads];
+            object_ref(OBJECT(ring->iothread));
+            ring->ctx = iothread_get_aio_context(ring->iothread);
+        } else {
+            ring->ctx = qemu_get_aio_context();
+        }
+        ring->bh = aio_bh_new_guarded(ring->ctx, xen_block_dataplane_bh,
+                                      ring,
+                                      &DEVICE(xendev)->mem_reentrancy_guard);
     }
-    dataplane->bh = aio_bh_new_guarded(dataplane->ctx, xen_block_dataplane_bh,
-                                       dataplane,
-                                       &DEVICE(xendev)->mem_reentrancy_guard);
 
     return dataplane;
 }
@@ -637,54 +674,81 @@ XenBlockDataPlane *xen_block_dataplane_create(XenDevice *xendev,
 void xen_block_dataplane_destroy(XenBlockDataPlane *dataplane)
 {
     XenBlockRequest *request;
+    unsigned int i;
 
     if (!dataplane) {
         return;
     }
 
-    while (!QLIST_EMPTY(&dataplane->freelist)) {
-        request = QLIST_FIRST(&dataplane->freelist);
-        QLIST_REMOVE(request, list);
-        qemu_iovec_destroy(&request->v);
-        qemu_vfree(request->buf);
-        g_free(request);
-    }
+    for (i = 0; i < dataplane->max_rings; i++) {
+        XenBlockRing *ring = &dataplane->rings[i];
+
+        while (!QLIST_EMPTY(&ring->freelist)) {
+            request = QLIST_FIRST(&ring->freelist);
+            QLIST_REMOVE(request, list);
+            qemu_iovec_destroy(&request->v);
+            qemu_vfree(request->buf);
+            g_free(request);
+        }
 
-    qemu_bh_delete(dataplane->bh);
-    if (dataplane->iothread) {
-        object_unref(OBJECT(dataplane->iothread));
+        qemu_bh_delete(ring->bh);
+        if (ring->iothread) {
+            object_unref(OBJECT(ring->iothread));
+        }
     }
 
+    g_free(dataplane->rings);
     g_free(dataplane);
 }
 
 void xen_block_dataplane_detach(XenBlockDataPlane *dataplane)
 {
-    if (!dataplane || !dataplane->event_channel) {
+    unsigned int i;
+
+    if (!dataplane) {
         return;
     }
 
-    /* Only reason for failure is a NULL channel */
-    xen_device_set_event_channel_context(dataplane->xendev,
-                                         dataplane->event_channel,
-                                         NULL, &error_abort);
+    for (i = 0; i < dataplane->nr_rings; i++) {
+        XenBlockRing *ring = &dataplane->rings[i];
+
+        if (!ring->event_channel) {
+            continue;
+        }
+
+        /* Only reason for failure is a NULL channel */
+        xen_device_set_event_channel_context(dataplane->xendev,
+                                             ring->event_channel,
+                                             NULL, &error_abort);
+    }
 }
 
 void xen_block_dataplane_attach(XenBlockDataPlane *dataplane)
 {
-    if (!dataplane || !dataplane->event_channel) {
+    unsigned int i;
+
+    if (!dataplane) {
         return;
     }
 
-    /* Only reason for failure is a NULL channel */
-    xen_device_set_event_channel_context(dataplane->xendev,
-                                         dataplane->event_channel,
-                                         dataplane->ctx, &error_abort);
+    for (i = 0; i < dataplane->nr_rings; i++) {
+        XenBlockRing *ring = &dataplane->rings[i];
+
+        if (!ring->event_channel) {
+            continue;
+        }
+
+        /* Only reason for failure is a NULL channel */
+        xen_device_set_event_channel_context(dataplane->xendev,
+                                             ring->event_channel,
+                                             ring->ctx, &error_abort);
+    }
 }
 
 void xen_block_dataplane_stop(XenBlockDataPlane *dataplane)
 {
     XenDevice *xendev;
+    unsigned int i;
 
     if (!dataplane) {
         return;
@@ -699,77 +763,73 @@ void xen_block_dataplane_stop(XenBlockDataPlane *dataplane)
     /* Xen doesn't have multiple users for nodes, so this can't fail */
     blk_set_aio_context(dataplane->blk, qemu_get_aio_context(), &error_abort);
 
-    /*
-     * Now that the context has been moved onto the main thread, cancel
-     * further processing.
-     */
-    qemu_bh_cancel(dataplane->bh);
+    for (i = 0; i < dataplane->nr_rings; i++) {
+        XenBlockRing *ring = &dataplane->rings[i];
 
-    if (dataplane->event_channel) {
-        Error *local_err = NULL;
+        /*
+         * Now that the context has been moved onto the main thread, cancel
+         * further processing.
+         */
+        qemu_bh_cancel(ring->bh);
 
-        xen_device_unbind_event_channel(xendev, dataplane->event_channel,
-                                        &local_err);
-        dataplane->event_channel = NULL;
+        if (ring->event_channel) {
+            Error *local_err = NULL;
 
-        if (local_err) {
-            error_report_err(local_err);
+            xen_device_unbind_event_channel(xendev, ring->event_channel,
+                                            &local_err);
+            ring->event_channel = NULL;
+
+            if (local_err) {
+                error_report_err(local_err);
+            }
         }
-    }
 
-    if (dataplane->sring) {
-        Error *local_err = NULL;
+        if (ring->sring) {
+            Error *local_err = NULL;
 
-        xen_device_unmap_grant_refs(xendev, dataplane->sring,
-                                    dataplane->ring_ref,
-                                    dataplane->nr_ring_ref, &local_err);
-        dataplane->sring = NULL;
+            xen_device_unmap_grant_refs(xendev, ring->sring, ring->ring_ref,
+                                        dataplane->nr_ring_ref, &local_err);
+            ring->sring = NULL;
 
-        if (local_err) {
-            error_report_err(local_err);
+            if (local_err) {
+                error_report_err(local_err);
+            }
         }
+
+        g_free(ring->ring_ref);
+        ring->ring_ref = NULL;
     }
 
-    g_free(dataplane->ring_ref);
-    dataplane->ring_ref = NULL;
+    dataplane->nr_rings = 0;
 }
 
-void xen_block_dataplane_start(XenBlockDataPlane *dataplane,
-                               const unsigned int ring_ref[],
-                               unsigned int nr_ring_ref,
-                               unsigned int event_channel,
-                               unsigned int protocol,
-                               Error **errp)
+static void xen_block_ring_start(XenBlockRing *ring,
+                                 const unsigned int ring_ref[],
+                                 unsigned int event_channel,
+                                 Error **errp)
 {
     ERRP_GUARD();
+    XenBlockDataPlane *dataplane = ring->dataplane;
     XenDevice *xendev = dataplane->xendev;
-    unsigned int ring_size;
-    unsigned int i;
+    unsigned int ring_size = XEN_PAGE_SIZE * dataplane->nr_ring_ref;
 
-    dataplane->nr_ring_ref = nr_ring_ref;
-    dataplane->ring_ref = g_new(unsigned int, nr_ring_ref);
+    ring->ring_ref = g_memdup2(ring_ref,
+                               dataplane->nr_ring_ref * sizeof(*ring_ref));
 
-    for (i = 0; i < nr_ring_ref; i++) {
-        dataplane->ring_ref[i] = ring_ref[i];
-    }
-
-    dataplane->protocol = protocol;
-
-    ring_size = XEN_PAGE_SIZE * dataplane->nr_ring_ref;
     switch (dataplane->protocol) {
     case BLKIF_PROTOCOL_NATIVE:
     {
-        dataplane->max_requests = __CONST_RING_SIZE(blkif, ring_size);
+        ring->max_requests = __CONST_RING_SIZE(blkif, ring_size);
         break;
     }
     case BLKIF_PROTOCOL_X86_32:
     {
-        dataplane->max_requests = __CONST_RING_SIZE(blkif_x86_32, ring_size);
+        ring->max_requests = __CONST_RING_SIZE(blkif_x86_32, ring_size);
         break;
     }
     case BLKIF_PROTOCOL_X86_64:
     {
-        dataplane->max_requests = __CONST_RING_SIZE(blkif_x86_64, ring_size);
+        ring->max_requests = __CONST_RING_SIZE(blkif_x86_64, ring_size);
         break;
     }
     default:
@@ -777,57 +837,87 @@ void xen_block_dataplane_start(XenBlockDataPlane *dataplane,
         return;
     }
 
-    xen_device_set_max_grant_refs(xendev, dataplane->nr_ring_ref,
-                                  errp);
-    if (*errp) {
-        goto stop;
-    }
-
-    dataplane->sring = xen_device_map_grant_refs(xendev,
-                                              dataplane->ring_ref,
-                                              dataplane->nr_ring_ref,
-                                              PROT_READ | PROT_WRITE,
-                                              errp);
+    ring->sring = xen_device_map_grant_refs(xendev, ring->ring_ref,
+                                            dataplane->nr_ring_ref,
+                                            PROT_READ | PROT_WRITE, errp);
     if (*errp) {
-        goto stop;
+        return;
     }
 
     switch (dataplane->protocol) {
     case BLKIF_PROTOCOL_NATIVE:
     {
-        blkif_sring_t *sring_native = dataplane->sring;
+        blkif_sring_t *sring_native = ring->sring;
 
-        BACK_RING_INIT(&dataplane->rings.native, sring_native, ring_size);
+        BACK_RING_INIT(&ring->rings.native, sring_native, ring_size);
         break;
     }
     case BLKIF_PROTOCOL_X86_32:
     {
-        blkif_x86_32_sring_t *sring_x86_32 = dataplane->sring;
+        blkif_x86_32_sring_t *sring_x86_32 = ring->sring;
 
-        BACK_RING_INIT(&dataplane->rings.x86_32_part, sring_x86_32,
-                       ring_size);
+        BACK_RING_INIT(&ring->rings.x86_32_part, sring_x86_32, ring_size);
         break;
     }
     case BLKIF_PROTOCOL_X86_64:
     {
-        blkif_x86_64_sring_t *sring_x86_64 = dataplane->sring;
+        blkif_x86_64_sring_t *sring_x86_64 = ring->sring;
 
-        BACK_RING_INIT(&dataplane->rings.x86_64_part, sring_x86_64,
-                       ring_size);
+        BACK_RING_INIT(&ring->rings.x86_64_part, sring_x86_64, ring_size);
         break;
     }
     }
 
-    dataplane->event_channel =
+    ring->event_channel =
         xen_device_bind_event_channel(xendev, event_channel,
-                                      xen_block_dataplane_event, dataplane,
+                                      xen_block_dataplane_event, ring,
                                       errp);
+}
+
+/*
+ * Connect @nr_rings rings of @nr_ring_ref pages each.  The grant references
+ * of ring i are at @ring_ref[i * @nr_ring_ref] and its event channel is
+ * @event_channel[i].
+ */
+void xen_block_dataplane_start(XenBlockDataPlane *dataplane,
+                               const unsigned int ring_ref[],
+                               unsigned int nr_ring_ref,
+                               const unsigned int event_channel[],
+                               unsigned int nr_rings,
+                               unsigned int protocol,
+                               Error **errp)
+{
+    ERRP_GUARD();
+    XenDevice *xendev = dataplane->xendev;
+    unsigned int i;
+
+    assert(nr_rings > 0 && nr_rings <= dataplane->max_rings);
+
+    dataplane->nr_ring_ref = nr_ring_ref;
+    dataplane->protocol = protocol;
+
+    xen_device_set_max_grant_refs(xendev, nr_rings * nr_ring_ref, errp);
     if (*errp) {
-        goto stop;
+        return;
+    }
+
+    for (i = 0; i < nr_rings; i++) {
+        dataplane->nr_rings = i + 1;
+        xen_block_ring_start(&dataplane->rings[i],
+                             &ring_ref[i * nr_ring_ref], event_channel[i],
+                             errp);
+        if (*errp) {
+            goto stop;
+        }
     }
 
-    /* If other users keep the BlockBackend in the iothread, that's ok */
-    blk_set_aio_context(dataplane->blk, dataplane->ctx, NULL);
+    /*
+     * The BlockBackend lives in the AioContext of the first ring, the other
+     * rings submit requests to it from their own AioContext.
+     *
+     * If other users keep the BlockBackend in the iothread, that's ok.
+     */
+    blk_set_aio_context(dataplane->blk, dataplane->rings[0].ctx, NULL);
 
     if (!blk_in_drain(dataplane->blk)) {
         xen_block_dataplane_attach(dataplane);
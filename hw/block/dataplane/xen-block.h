@@ -17,12 +17,15 @@ typedef struct XenBlockDataPlane XenBlockDataPlane;
 XenBlockDataPlane *xen_block_dataplane_create(XenDevice *xendev,
                                               BlockBackend *blk,
                                               unsigned int sector_size,
-                                              IOThread *iothread);
+                                              IOThread *const iothreads[],
+                                              unsigned int nr_iothreads,
+                                              unsigned int max_rings);
 void xen_block_dataplane_destroy(XenBlockDataPlane *dataplane);
 void xen_block_dataplane_start(XenBlockDataPlane *dataplane,
                                const unsigned int ring_ref[],
                                unsigned int nr_ring_ref,
-                               unsigned int event_channel,
+                               const unsigned int event_channel[],
+                               unsigned int nr_rings,
                                unsigned int protocol,
                                Error **errp);
 void xen_block_dataplane_stop(XenBlockDataPlane *dataplane);
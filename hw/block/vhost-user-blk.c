@@ -49,12 +49,21 @@ static const int user_feature_bits[] = {
     VIRTIO_RING_F_EVENT_IDX,
     VIRTIO_F_NOTIFY_ON_EMPTY,
     VIRTIO_F_RING_PACKED,
+    VIRTIO_F_IN_ORDER,
     VIRTIO_F_IOMMU_PLATFORM,
     VIRTIO_F_RING_RESET,
     VHOST_INVALID_FEATURE_BIT
 };
 
 static void vhost_user_blk_event(void *opaque, QEMUChrEvent event);
+static void vhost_user_blk_standby_event(void *opaque, QEMUChrEvent event);
+
+static IOEventHandler *vhost_user_blk_event_handler(VHostUserBlk *s,
+                                                    CharBackend *chr)
+{
+    return chr == &s->chardev ? vhost_user_blk_event :
+                                vhost_user_blk_standby_event;
+}
 
 static void vhost_user_blk_update_config(VirtIODevice *vdev, uint8_t *config)
 {
@@ -241,7 +250,7 @@ static void vhost_user_blk_set_status(VirtIODevice *vdev, uint8_t status)
         ret = vhost_user_blk_start(vdev, &local_err);
         if (ret < 0) {
             error_reportf_err(local_err, "vhost-user-blk: vhost start failed: ");
-            qemu_chr_fe_disconnect(&s->chardev);
+            qemu_chr_fe_disconnect(s->vhost_user.chr);
         }
     } else {
         vhost_user_blk_stop(vdev);
@@ -271,11 +280,27 @@ static uint64_t vhost_user_blk_get_features(VirtIODevice *vdev,
     return vhost_get_features(&s->dev, user_feature_bits, features);
 }
 
+/* Have the backend look at the requests that are already in the vrings */
+static void vhost_user_blk_kick(VHostUserBlk *s)
+{
+    VirtIODevice *vdev = VIRTIO_DEVICE(s);
+    int i;
+
+    for (i = 0; i < s->dev.nvqs; i++) {
+        VirtQueue *kick_vq = virtio_get_queue(vdev, i);
+
+        if (!virtio_queue_get_desc_addr(vdev, i)) {
+            continue;
+        }
+        event_notifier_set(virtio_queue_get_host_notifier(kick_vq));
+    }
+}
+
 static void vhost_user_blk_handle_output(VirtIODevice *vdev, VirtQueue *vq)
 {
     VHostUserBlk *s = VHOST_USER_BLK(vdev);
     Error *local_err = NULL;
-    int i, ret;
+    int ret;
 
     if (!vdev->start_on_kick) {
         return;
@@ -295,19 +320,12 @@ static void vhost_user_blk_handle_output(VirtIODevice *vdev, VirtQueue *vq)
     ret = vhost_user_blk_start(vdev, &local_err);
     if (ret < 0) {
         error_reportf_err(local_err, "vhost-user-blk: vhost start failed: ");
-        qemu_chr_fe_disconnect(&s->chardev);
+        qemu_chr_fe_disconnect(s->vhost_user.chr);
         return;
     }
 
     /* Kick right away to begin processing requests already in vring */
-    for (i = 0; i < s->dev.nvqs; i++) {
-        VirtQueue *kick_vq = virtio_get_queue(vdev, i);
-
-        if (!virtio_queue_get_desc_addr(vdev, i)) {
-            continue;
-        }
-        event_notifier_set(virtio_queue_get_host_notifier(kick_vq));
-    }
+    vhost_user_blk_kick(s);
 }
 
 static void vhost_user_blk_reset(VirtIODevice *vdev)
@@ -347,6 +365,17 @@ static int vhost_user_blk_connect(DeviceState *dev, Error **errp)
     /* restore vhost state */
     if (virtio_device_started(vdev, vdev->status)) {
         ret = vhost_user_blk_start(vdev, errp);
+        if (ret < 0) {
+            return ret;
+        }
+
+        /*
+         * Guest notifications that arrived while we were disconnected
+         * were dropped, and there is no guarantee that the new backend
+         * looks at the rings before it is kicked.  The inflight requests
+         * are resubmitted by the backend itself from the inflight region.
+         */
+        vhost_user_blk_kick(s);
     }
 
     return ret;
@@ -356,6 +385,10 @@ static void vhost_user_blk_disconnect(DeviceState *dev)
 {
     VirtIODevice *vdev = VIRTIO_DEVICE(dev);
     VHostUserBlk *s = VHOST_USER_BLK(vdev);
+    CharBackend *chr = s->vhost_user.chr;
+    CharBackend *other = chr == &s->chardev ? &s->standby_chardev :
+                                              &s->chardev;
+    Error *local_err = NULL;
 
     if (!s->connected) {
         return;
@@ -367,29 +400,52 @@ static void vhost_user_blk_disconnect(DeviceState *dev)
     vhost_dev_cleanup(&s->dev);
 
     /* Re-instate the event handler for new connections */
-    qemu_chr_fe_set_handlers(&s->chardev, NULL, NULL, vhost_user_blk_event,
+    qemu_chr_fe_set_handlers(chr, NULL, NULL,
+                             vhost_user_blk_event_handler(s, chr),
                              NULL, dev, NULL, true);
+
+    /*
+     * Fail over to the standby backend if it is already connected, instead
+     * of waiting for this one to come back.
+     */
+    if (qemu_chr_fe_backend_open(other)) {
+        s->vhost_user.chr = other;
+        if (vhost_user_blk_connect(dev, &local_err) < 0) {
+            error_reportf_err(local_err, "vhost-user-blk: failover failed: ");
+            qemu_chr_fe_disconnect(other);
+        }
+    }
 }
 
-static void vhost_user_blk_event(void *opaque, QEMUChrEvent event)
+static void vhost_user_blk_chr_event(VHostUserBlk *s, CharBackend *chr,
+                                     QEMUChrEvent event)
 {
-    DeviceState *dev = opaque;
-    VirtIODevice *vdev = VIRTIO_DEVICE(dev);
-    VHostUserBlk *s = VHOST_USER_BLK(vdev);
+    DeviceState *dev = DEVICE(s);
     Error *local_err = NULL;
 
     switch (event) {
     case CHR_EVENT_OPENED:
+        if (chr != s->vhost_user.chr) {
+            if (s->connected) {
+                /* Keep it as the standby backend */
+                return;
+            }
+            s->vhost_user.chr = chr;
+        }
         if (vhost_user_blk_connect(dev, &local_err) < 0) {
             error_report_err(local_err);
-            qemu_chr_fe_disconnect(&s->chardev);
+            qemu_chr_fe_disconnect(chr);
             return;
         }
         break;
     case CHR_EVENT_CLOSED:
+        if (chr != s->vhost_user.chr) {
+            /* The standby backend went away, nothing to clean up */
+            return;
+        }
         /* defer close until later to avoid circular close */
-        vhost_user_async_close(dev, &s->chardev, &s->dev,
-                               vhost_user_blk_disconnect, vhost_user_blk_event);
+        vhost_user_async_close(dev, chr, &s->dev, vhost_user_blk_disconnect,
+                               vhost_user_blk_event_handler(s, chr));
         break;
     case CHR_EVENT_BREAK:
     case CHR_EVENT_MUX_IN:
@@ -399,6 +455,20 @@ static void vhost_user_blk_event(void *opaque, QEMUChrEvent event)
     }
 }
 
+static void vhost_user_blk_event(void *opaque, QEMUChrEvent event)
+{
+    VHostUserBlk *s = VHOST_USER_BLK(opaque);
+
+    vhost_user_blk_chr_event(s, &s->chardev, event);
+}
+
+static void vhost_user_blk_standby_event(void *opaque, QEMUChrEvent event)
+{
+    VHostUserBlk *s = VHOST_USER_BLK(opaque);
+
+    vhost_user_blk_chr_event(s, &s->standby_chardev, event);
+}
+
 static int vhost_user_blk_realize_connect(VHostUserBlk *s, Error **errp)
 {
     DeviceState *dev = DEVICE(s);
@@ -497,6 +567,11 @@ static void vhost_user_blk_device_realize(DeviceState *dev, Error **errp)
     qemu_chr_fe_set_handlers(&s->chardev,  NULL, NULL,
                              vhost_user_blk_event, NULL, (void *)dev,
                              NULL, true);
+    if (s->standby_chardev.chr) {
+        qemu_chr_fe_set_handlers(&s->standby_chardev, NULL, NULL,
+                                 vhost_user_blk_standby_event, NULL,
+                                 (void *)dev, NULL, true);
+    }
     return;
 
 virtio_err:
@@ -521,6 +596,8 @@ static void vhost_user_blk_device_unrealize(DeviceState *dev)
     virtio_set_status(vdev, 0);
     qemu_chr_fe_set_handlers(&s->chardev,  NULL, NULL, NULL,
                              NULL, NULL, NULL, false);
+    qemu_chr_fe_set_handlers(&s->standby_chardev, NULL, NULL, NULL,
+                             NULL, NULL, NULL, false);
     vhost_dev_cleanup(&s->dev);
     vhost_dev_free_inflight(s->inflight);
     g_free(s->vhost_vqs);
@@ -562,6 +639,7 @@ static const VMStateDescription vmstate_vhost_user_blk = {
 
 static Property vhost_user_blk_properties[] = {
     DEFINE_PROP_CHR("chardev", VHostUserBlk, chardev),
+    DEFINE_PROP_CHR("standby-chardev", VHostUserBlk, standby_chardev),
     DEFINE_PROP_UINT16("num-queues", VHostUserBlk, num_queues,
                        VHOST_USER_BLK_AUTO_NUM_QUEUES),
     DEFINE_PROP_UINT32("queue-size", VHostUserBlk, queue_size, 128),
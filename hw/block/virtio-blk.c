@@ -35,6 +35,7 @@
 #include "migration/qemu-file-types.h"
 #include "hw/virtio/virtio-access.h"
 #include "hw/virtio/virtio-blk-common.h"
+#include "hw/virtio/iothread-vq-mapping.h"
 #include "qemu/coroutine.h"
 
 static void virtio_blk_ioeventfd_attach(VirtIOBlock *s);
@@ -52,7 +53,7 @@ static void virtio_blk_init_request(VirtIOBlock *s, VirtQueue *vq,
 
 static void virtio_blk_free_request(VirtIOBlockReq *req)
 {
-    g_free(req);
+    virtqueue_element_free(req->vq, &req->elem);
 }
 
 static void virtio_blk_req_complete(VirtIOBlockReq *req, unsigned char status)
@@ -223,16 +224,6 @@ out:
 
 #endif
 
-static VirtIOBlockReq *virtio_blk_get_request(VirtIOBlock *s, VirtQueue *vq)
-{
-    VirtIOBlockReq *req = virtqueue_pop(vq, sizeof(VirtIOBlockReq));
-
-    if (req) {
-        virtio_blk_init_request(s, vq, req);
-    }
-    return req;
-}
-
 static int virtio_blk_handle_scsi_req(VirtIOBlockReq *req)
 {
     int status = VIRTIO_BLK_S_OK;
@@ -591,6 +582,124 @@ err:
     return err_status;
 }
 
+typedef struct DiscardSegsData {
+    VirtIOBlockReq *req;
+    unsigned int pending;
+    int ret;
+} DiscardSegsData;
+
+typedef struct DiscardRange {
+    uint64_t offset;
+    uint64_t bytes;
+} DiscardRange;
+
+static void virtio_blk_discard_segs_complete(void *opaque, int ret)
+{
+    DiscardSegsData *data = opaque;
+    VirtIOBlockReq *req = data->req;
+
+    if (ret && !data->ret) {
+        data->ret = ret;
+    }
+    if (--data->pending) {
+        return;
+    }
+
+    ret = data->ret;
+    g_free(data);
+    virtio_blk_discard_write_zeroes_complete(req, ret);
+}
+
+static int discard_range_compare(const void *a, const void *b)
+{
+    const DiscardRange *ra = a;
+    const DiscardRange *rb = b;
+
+    return ra->offset < rb->offset ? -1 : ra->offset > rb->offset;
+}
+
+/*
+ * Handle a discard request with several segments.  Linux builds them by
+ * merging the discards of different bios, which are then sorted here so
+ * that adjacent and overlapping ranges make a single request to the block
+ * layer.
+ */
+static uint8_t virtio_blk_handle_discard_segs(VirtIOBlockReq *req,
+                                              struct iovec *iov,
+                                              unsigned int niov,
+                                              size_t out_len)
+{
+    VirtIOBlock *s = req->dev;
+    VirtIODevice *vdev = VIRTIO_DEVICE(s);
+    unsigned int nseg = out_len / sizeof(struct virtio_blk_discard_write_zeroes);
+    uint64_t max_bytes = (uint64_t)s->conf.max_discard_sectors <<
+                         BDRV_SECTOR_BITS;
+    g_autofree struct virtio_blk_discard_write_zeroes *segs =
+        g_new(struct virtio_blk_discard_write_zeroes, nseg);
+    g_autofree DiscardRange *ranges = g_new(DiscardRange, nseg);
+    DiscardSegsData *data;
+    unsigned int i, n = 0;
+
+    iov_to_buf(iov, niov, 0, segs, nseg * sizeof(segs[0]));
+
+    for (i = 0; i < nseg; i++) {
+        uint64_t sector = virtio_ldq_p(vdev, &segs[i].sector);
+        uint32_t num_sectors = virtio_ldl_p(vdev, &segs[i].num_sectors);
+        uint32_t flags = virtio_ldl_p(vdev, &segs[i].flags);
+        uint64_t bytes = (uint64_t)num_sectors << BDRV_SECTOR_BITS;
+
+        /* Same checks as virtio_blk_handle_discard_write_zeroes() */
+        if (unlikely(num_sectors > s->conf.max_discard_sectors) ||
+            unlikely(!virtio_blk_sect_range_ok(s, sector, bytes))) {
+            return VIRTIO_BLK_S_IOERR;
+        }
+        if (unlikely(flags)) {
+            return VIRTIO_BLK_S_UNSUPP;
+        }
+        if (!bytes) {
+            continue;
+        }
+        ranges[n++] = (DiscardRange) {
+            .offset = sector << BDRV_SECTOR_BITS,
+            .bytes = bytes,
+        };
+    }
+
+    if (n) {
+        unsigned int j = 0;
+
+        qsort(ranges, n, sizeof(ranges[0]), discard_range_compare);
+        for (i = 1; i < n; i++) {
+            DiscardRange *last = &ranges[j];
+            uint64_t end = MAX(last->offset + last->bytes,
+                               ranges[i].offset + ranges[i].bytes);
+
+            if (ranges[i].offset <= last->offset + last->bytes &&
+                end - last->offset <= max_bytes) {
+                last->bytes = end - last->offset;
+            } else {
+                ranges[++j] = ranges[i];
+            }
+        }
+        trace_virtio_blk_handle_discard_segs(vdev, req, nseg, j + 1);
+        n = j + 1;
+    }
+
+    data = g_new(DiscardSegsData, 1);
+    *data = (DiscardSegsData) {
+        .req = req,
+        /* Hold a reference until all the ranges are submitted */
+        .pending = n + 1,
+    };
+    for (i = 0; i < n; i++) {
+        blk_aio_pdiscard(s->blk, ranges[i].offset, ranges[i].bytes,
+                         virtio_blk_discard_segs_complete, data);
+    }
+    virtio_blk_discard_segs_complete(data, 0);
+
+    return VIRTIO_BLK_S_OK;
+}
+
 typedef struct ZoneCmdData {
     VirtIOBlockReq *req;
     struct iovec *in_iov;
@@ -1073,10 +1182,11 @@ static int virtio_blk_handle_request(VirtIOBlockReq *req, MultiReqBuffer *mrb)
 
         /*
          * Unsupported if VIRTIO_BLK_T_OUT is not set or the request contains
-         * more than one segment.
+         * more segments than advertised.
          */
         if (unlikely(!(type & VIRTIO_BLK_T_OUT) ||
-                     out_len > sizeof(dwz_hdr))) {
+                     out_len > (is_write_zeroes ? 1 : s->conf.max_discard_seg) *
+                               sizeof(dwz_hdr))) {
             virtio_blk_req_complete(req, VIRTIO_BLK_S_UNSUPP);
             virtio_blk_free_request(req);
             return 0;
@@ -1091,8 +1201,13 @@ static int virtio_blk_handle_request(VirtIOBlockReq *req, MultiReqBuffer *mrb)
             return -1;
         }
 
-        err_status = virtio_blk_handle_discard_write_zeroes(req, &dwz_hdr,
-                                                            is_write_zeroes);
+        if (!is_write_zeroes && out_len >= 2 * sizeof(dwz_hdr)) {
+            err_status = virtio_blk_handle_discard_segs(req, out_iov, out_num,
+                                                        out_len);
+        } else {
+            err_status = virtio_blk_handle_discard_write_zeroes(
+                    req, &dwz_hdr, is_write_zeroes);
+        }
         if (err_status != VIRTIO_BLK_S_OK) {
             virtio_blk_req_complete(req, err_status);
             virtio_blk_free_request(req);
@@ -1107,11 +1222,15 @@ static int virtio_blk_handle_request(VirtIOBlockReq *req, MultiReqBuffer *mrb)
     return 0;
 }
 
+/* Number of requests popped from the virtqueue at once */
+#define VIRTIO_BLK_POP_BATCH 16
+
 void virtio_blk_handle_vq(VirtIOBlock *s, VirtQueue *vq)
 {
-    VirtIOBlockReq *req;
+    VirtIOBlockReq *reqs[VIRTIO_BLK_POP_BATCH];
     MultiReqBuffer mrb = {};
     bool suppress_notifications = virtio_queue_get_notification(vq);
+    unsigned int i, n;
 
     defer_call_begin();
 
@@ -1120,10 +1239,22 @@ void virtio_blk_handle_vq(VirtIOBlock *s, VirtQueue *vq)
             virtio_queue_set_notification(vq, 0);
         }
 
-        while ((req = virtio_blk_get_request(s, vq))) {
-            if (virtio_blk_handle_request(req, &mrb)) {
-                virtqueue_detach_element(req->vq, &req->elem, 0);
-                virtio_blk_free_request(req);
+        while ((n = virtqueue_pop_batch(vq, (void **)reqs, ARRAY_SIZE(reqs),
+                                        sizeof(VirtIOBlockReq)))) {
+            for (i = 0; i < n; i++) {
+                virtio_blk_init_request(s, vq, reqs[i]);
+            }
+            for (i = 0; i < n; i++) {
+                if (virtio_blk_handle_request(reqs[i], &mrb)) {
+                    break;
+                }
+            }
+            if (i < n) {
+                /* The device is broken, give up on the rest of the batch */
+                for (; i < n; i++) {
+                    virtqueue_detach_element(vq, &reqs[i]->elem, 0);
+                    virtio_blk_free_request(reqs[i]);
+                }
                 break;
             }
         }
@@ -1316,12 +1447,7 @@ static void virtio_blk_update_config(VirtIODevice *vdev, uint8_t *config)
                      s->conf.max_discard_sectors);
         virtio_stl_p(vdev, &blkcfg.discard_sector_alignment,
                      discard_granularity >> BDRV_SECTOR_BITS);
-        /*
-         * We support only one segment per request since multiple segments
-         * are not widely used and there are no userspace APIs that allow
-         * applications to submit multiple segments in a single call.
-         */
-        virtio_stl_p(vdev, &blkcfg.max_discard_seg, 1);
+        virtio_stl_p(vdev, &blkcfg.max_discard_seg, s->conf.max_discard_seg);
     }
     if (virtio_has_feature(s->host_features, VIRTIO_BLK_F_WRITE_ZEROES)) {
         virtio_stl_p(vdev, &blkcfg.max_write_zeroes_sectors,
@@ -1557,128 +1683,6 @@ static const BlockDevOps virtio_block_ops = {
     .drained_end   = virtio_blk_drained_end,
 };
 
-static bool
-validate_iothread_vq_mapping_list(IOThreadVirtQueueMappingList *list,
-        uint16_t num_queues, Error **errp)
-{
-    g_autofree unsigned long *vqs = bitmap_new(num_queues);
-    g_autoptr(GHashTable) iothreads =
-        g_hash_table_new(g_str_hash, g_str_equal);
-
-    for (IOThreadVirtQueueMappingList *node = list; node; node = node->next) {
-        const char *name = node->value->iothread;
-        uint16List *vq;
-
-        if (!iothread_by_id(name)) {
-            error_setg(errp, "IOThread \"%s\" object does not exist", name);
-            return false;
-        }
-
-        if (!g_hash_table_add(iothreads, (gpointer)name)) {
-            error_setg(errp,
-                    "duplicate IOThread name \"%s\" in iothread-vq-mapping",
-                    name);
-            return false;
-        }
-
-        if (node != list) {
-            if (!!node->value->vqs != !!list->value->vqs) {
-                error_setg(errp, "either all items in iothread-vq-mapping "
-                                 "must have vqs or none of them must have it");
-                return false;
-            }
-        }
-
-        for (vq = node->value->vqs; vq; vq = vq->next) {
-            if (vq->value >= num_queues) {
-                error_setg(errp, "vq index %u for IOThread \"%s\" must be "
-                        "less than num_queues %u in iothread-vq-mapping",
-                        vq->value, name, num_queues);
-                return false;
-            }
-
-            if (test_and_set_bit(vq->value, vqs)) {
-                error_setg(errp, "cannot assign vq %u to IOThread \"%s\" "
-                        "because it is already assigned", vq->value, name);
-                return false;
-            }
-        }
-    }
-
-    if (list->value->vqs) {
-        for (uint16_t i = 0; i < num_queues; i++) {
-            if (!test_bit(i, vqs)) {
-                error_setg(errp,
-                        "missing vq %u IOThread assignment in iothread-vq-mapping",
-                        i);
-                return false;
-            }
-        }
-    }
-
-    return true;
-}
-
-/**
- * apply_iothread_vq_mapping:
- * @iothread_vq_mapping_list: The mapping of virtqueues to IOThreads.
- * @vq_aio_context: The array of AioContext pointers to fill in.
- * @num_queues: The length of @vq_aio_context.
- * @errp: If an error occurs, a pointer to the area to store the error.
- *
- * Fill in the AioContext for each virtqueue in the @vq_aio_context array given
- * the iothread-vq-mapping parameter in @iothread_vq_mapping_list.
- *
- * Returns: %true on success, %false on failure.
- **/
-static bool apply_iothread_vq_mapping(
-        IOThreadVirtQueueMappingList *iothread_vq_mapping_list,
-        AioContext **vq_aio_context,
-        uint16_t num_queues,
-        Error **errp)
-{
-    IOThreadVirtQueueMappingList *node;
-    size_t num_iothreads = 0;
-    size_t cur_iothread = 0;
-
-    if (!validate_iothread_vq_mapping_list(iothread_vq_mapping_list,
-                                           num_queues, errp)) {
-        return false;
-    }
-
-    for (node = iothread_vq_mapping_list; node; node = node->next) {
-        num_iothreads++;
-    }
-
-    for (node = iothread_vq_mapping_list; node; node = node->next) {
-        IOThread *iothread = iothread_by_id(node->value->iothread);
-        AioContext *ctx = iothread_get_aio_context(iothread);
-
-        /* Released in virtio_blk_vq_aio_context_cleanup() */
-        object_ref(OBJECT(iothread));
-
-        if (node->value->vqs) {
-            uint16List *vq;
-
-            /* Explicit vq:IOThread assignment */
-            for (vq = node->value->vqs; vq; vq = vq->next) {
-                assert(vq->value < num_queues);
-                vq_aio_context[vq->value] = ctx;
-            }
-        } else {
-            /* Round-robin vq:IOThread assignment */
-            for (unsigned i = cur_iothread; i < num_queues;
-                 i += num_iothreads) {
-                vq_aio_context[i] = ctx;
-            }
-        }
-
-        cur_iothread++;
-    }
-
-    return true;
-}
-
 /* Context: BQL held */
 static bool virtio_blk_vq_aio_context_init(VirtIOBlock *s, Error **errp)
 {
@@ -1720,7 +1724,7 @@ static bool virtio_blk_vq_aio_context_init(VirtIOBlock *s, Error **errp)
     s->vq_aio_context = g_new(AioContext *, conf->num_queues);
 
     if (conf->iothread_vq_mapping_list) {
-        if (!apply_iothread_vq_mapping(conf->iothread_vq_mapping_list,
+        if (!iothread_vq_mapping_apply(conf->iothread_vq_mapping_list,
                                        s->vq_aio_context,
                                        conf->num_queues,
                                        errp)) {
@@ -1754,12 +1758,7 @@ static void virtio_blk_vq_aio_context_cleanup(VirtIOBlock *s)
     assert(!s->ioeventfd_started);
 
     if (conf->iothread_vq_mapping_list) {
-        IOThreadVirtQueueMappingList *node;
-
-        for (node = conf->iothread_vq_mapping_list; node; node = node->next) {
-            IOThread *iothread = iothread_by_id(node->value->iothread);
-            object_unref(OBJECT(iothread));
-        }
+        iothread_vq_mapping_cleanup(conf->iothread_vq_mapping_list);
     }
 
     if (conf->iothread) {
@@ -2026,6 +2025,15 @@ static void virtio_blk_device_realize(DeviceState *dev, Error **errp)
         return;
     }
 
+    if (virtio_has_feature(s->host_features, VIRTIO_BLK_F_DISCARD) &&
+        (!conf->max_discard_seg ||
+         conf->max_discard_seg > VIRTIO_BLK_MAX_DISCARD_SEG)) {
+        error_setg(errp, "invalid max-discard-seg property (%" PRIu32 ")"
+                   ", must be between 1 and %d",
+                   conf->max_discard_seg, VIRTIO_BLK_MAX_DISCARD_SEG);
+        return;
+    }
+
     if (virtio_has_feature(s->host_features, VIRTIO_BLK_F_WRITE_ZEROES) &&
         (!conf->max_write_zeroes_sectors ||
          conf->max_write_zeroes_sectors > BDRV_REQUEST_MAX_SECTORS)) {
@@ -2047,7 +2055,10 @@ static void virtio_blk_device_realize(DeviceState *dev, Error **errp)
     s->sector_mask = (s->conf.conf.logical_block_size / BDRV_SECTOR_SIZE) - 1;
 
     for (i = 0; i < conf->num_queues; i++) {
-        virtio_add_queue(vdev, conf->queue_size, virtio_blk_handle_output);
+        VirtQueue *vq = virtio_add_queue(vdev, conf->queue_size,
+                                         virtio_blk_handle_output);
+
+        virtio_queue_enable_element_pool(vq, sizeof(VirtIOBlockReq));
     }
     qemu_coroutine_inc_pool_size(conf->num_queues * conf->queue_size / 2);
 
@@ -2153,6 +2164,13 @@ static Property virtio_blk_properties[] = {
                       VIRTIO_BLK_F_WRITE_ZEROES, true),
     DEFINE_PROP_UINT32("max-discard-sectors", VirtIOBlock,
                        conf.max_discard_sectors, BDRV_REQUEST_MAX_SECTORS),
+    /*
+     * The guest merges discards into one request only if it may have
+     * several segments, but few guests and no userspace APIs issue them
+     * otherwise: keep a single segment by default.
+     */
+    DEFINE_PROP_UINT32("max-discard-seg", VirtIOBlock, conf.max_discard_seg,
+                       1),
     DEFINE_PROP_UINT32("max-write-zeroes-sectors", VirtIOBlock,
                        conf.max_write_zeroes_sectors, BDRV_REQUEST_MAX_SECTORS),
     DEFINE_PROP_BOOL("x-enable-wce-if-config-wce", VirtIOBlock,
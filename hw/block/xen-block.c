@@ -172,6 +172,50 @@ static void xen_block_disconnect(XenDevice *xendev, Error **errp)
     xen_block_dataplane_stop(blockdev->dataplane);
 }
 
+/*
+ * Read the grant references and event channel of a ring from @path, which
+ * is either the frontend directory itself (NULL) or one of its "queue-N"
+ * subdirectories.  Frontends that do not advertise a ring-page-order use
+ * a single "ring-ref" key.
+ */
+static bool xen_block_read_ring(XenDevice *xendev, const char *path,
+                                bool multi_page, unsigned int nr_ring_ref,
+                                unsigned int ring_ref[],
+                                unsigned int *event_channel, Error **errp)
+{
+    g_autofree char *prefix = path ? g_strdup_printf("%s/", path) :
+                                     g_strdup("");
+    g_autofree char *key = NULL;
+    unsigned int i;
+
+    if (!multi_page) {
+        key = g_strdup_printf("%sring-ref", prefix);
+        if (xen_device_frontend_scanf(xendev, key, "%u", &ring_ref[0]) != 1) {
+            error_setg(errp, "failed to read %s", key);
+            return false;
+        }
+    } else {
+        for (i = 0; i < nr_ring_ref; i++) {
+            g_free(key);
+            key = g_strdup_printf("%sring-ref%u", prefix, i);
+            if (xen_device_frontend_scanf(xendev, key, "%u",
+                                          &ring_ref[i]) != 1) {
+                error_setg(errp, "failed to read %s", key);
+                return false;
+            }
+        }
+    }
+
+    g_free(key);
+    key = g_strdup_printf("%sevent-channel", prefix);
+    if (xen_device_frontend_scanf(xendev, key, "%u", event_channel) != 1) {
+        error_setg(errp, "failed to read %s", key);
+        return false;
+    }
+
+    return true;
+}
+
 static void xen_block_connect(XenDevice *xendev, Error **errp)
 {
     XenBlockDevice *blockdev = XEN_BLOCK_DEVICE(xendev);
@@ -179,7 +223,10 @@ static void xen_block_connect(XenDevice *xendev, Error **errp)
     XenBlockVdev *vdev = &blockdev->props.vdev;
     BlockConf *conf = &blockdev->props.conf;
     unsigned int feature_large_sector_size;
-    unsigned int order, nr_ring_ref, *ring_ref, event_channel, protocol;
+    unsigned int order, nr_ring_ref, nr_queues, nr_rings, protocol, i;
+    bool multi_page = true;
+    g_autofree unsigned int *ring_ref = NULL;
+    g_autofree unsigned int *event_channel = NULL;
     char *str;
 
     trace_xen_block_connect(type, vdev->disk, vdev->partition);
@@ -198,47 +245,42 @@ static void xen_block_connect(XenDevice *xendev, Error **errp)
 
     if (xen_device_frontend_scanf(xendev, "ring-page-order", "%u",
                                   &order) != 1) {
-        nr_ring_ref = 1;
-        ring_ref = g_new(unsigned int, nr_ring_ref);
-
-        if (xen_device_frontend_scanf(xendev, "ring-ref", "%u",
-                                      &ring_ref[0]) != 1) {
-            error_setg(errp, "failed to read ring-ref");
-            g_free(ring_ref);
-            return;
-        }
-    } else if (qemu_xen_gnttab_can_map_multi() &&
-               order <= blockdev->props.max_ring_page_order) {
-        unsigned int i;
-
-        nr_ring_ref = 1 << order;
-        ring_ref = g_new(unsigned int, nr_ring_ref);
-
-        for (i = 0; i < nr_ring_ref; i++) {
-            const char *key = g_strdup_printf("ring-ref%u", i);
-
-            if (xen_device_frontend_scanf(xendev, key, "%u",
-                                          &ring_ref[i]) != 1) {
-                error_setg(errp, "failed to read %s", key);
-                g_free((gpointer)key);
-                g_free(ring_ref);
-                return;
-            }
-
-            g_free((gpointer)key);
-        }
-    } else {
+        order = 0;
+        multi_page = false;
+    } else if (!qemu_xen_gnttab_can_map_multi() ||
+               order > blockdev->props.max_ring_page_order) {
         error_setg(errp, "invalid ring-page-order (%d)", order);
         return;
     }
+    nr_ring_ref = 1 << order;
 
-    if (xen_device_frontend_scanf(xendev, "event-channel", "%u",
-                                  &event_channel) != 1) {
-        error_setg(errp, "failed to read event-channel");
-        g_free(ring_ref);
+    if (xen_device_frontend_scanf(xendev, "multi-queue-num-queues", "%u",
+                                  &nr_queues) != 1) {
+        nr_queues = 0;
+    } else if (nr_queues == 0 || nr_queues > blockdev->props.max_queues) {
+        error_setg(errp, "invalid multi-queue-num-queues (%u)", nr_queues);
         return;
     }
 
+    /* Without multi-queue-num-queues, the only ring is at the top level */
+    nr_rings = MAX(nr_queues, 1);
+    ring_ref = g_new(unsigned int, nr_rings * nr_ring_ref);
+    event_channel = g_new(unsigned int, nr_rings);
+    if (!nr_queues &&
+        !xen_block_read_ring(xendev, NULL, multi_page, nr_ring_ref,
+                             ring_ref, &event_channel[0], errp)) {
+        return;
+    }
+    for (i = 0; i < nr_queues; i++) {
+        g_autofree char *path = g_strdup_printf("queue-%u", i);
+
+        if (!xen_block_read_ring(xendev, path, multi_page, nr_ring_ref,
+                                 &ring_ref[i * nr_ring_ref],
+                                 &event_channel[i], errp)) {
+            return;
+        }
+    }
+
     if (xen_device_frontend_scanf(xendev, "protocol", "%ms", &str) != 1) {
         /* x86 defaults to the 32-bit protocol even for 64-bit guests. */
         if (object_dynamic_cast(OBJECT(qdev_get_machine()), "x86-machine")) {
@@ -258,10 +300,11 @@ static void xen_block_connect(XenDevice *xendev, Error **errp)
         free(str);
     }
 
-    xen_block_dataplane_start(blockdev->dataplane, ring_ref, nr_ring_ref,
-                              event_channel, protocol, errp);
+    trace_xen_block_connect_rings(type, vdev->disk, vdev->partition,
+                                  nr_rings, nr_ring_ref);
 
-    g_free(ring_ref);
+    xen_block_dataplane_start(blockdev->dataplane, ring_ref, nr_ring_ref,
+                              event_channel, nr_rings, protocol, errp);
 }
 
 static void xen_block_unrealize(XenDevice *xendev)
@@ -349,6 +392,9 @@ static void xen_block_realize(XenDevice *xendev, Error **errp)
     XenBlockVdev *vdev = &blockdev->props.vdev;
     BlockConf *conf = &blockdev->props.conf;
     BlockBackend *blk = conf->blk;
+    g_autofree IOThread **iothreads = NULL;
+    unsigned int nr_iothreads = 0;
+    unsigned int i;
 
     if (vdev->type == XEN_BLOCK_VDEV_TYPE_INVALID) {
         error_setg(errp, "vdev property not set");
@@ -406,6 +452,17 @@ static void xen_block_realize(XenDevice *xendev, Error **errp)
                                   blockdev->props.max_ring_page_order);
     }
 
+    if (blockdev->props.max_queues == 0 ||
+        blockdev->props.max_queues > XEN_BLOCK_MAX_QUEUES) {
+        error_setg(errp, "max-queues must be between 1 and %u",
+                   XEN_BLOCK_MAX_QUEUES);
+        return;
+    }
+    if (blockdev->props.max_queues > 1) {
+        xen_device_backend_printf(xendev, "multi-queue-max-queues", "%u",
+                                  blockdev->props.max_queues);
+    }
+
     xen_device_backend_printf(xendev, "info", "%u", blockdev->info);
 
     xen_device_frontend_printf(xendev, "virtual-device", "%lu",
@@ -418,9 +475,32 @@ static void xen_block_realize(XenDevice *xendev, Error **errp)
 
     xen_block_set_size(blockdev);
 
+    if (blockdev->props.num_iothreads) {
+        if (blockdev->props.iothread) {
+            error_setg(errp, "iothread and iothreads cannot be used together");
+            return;
+        }
+
+        iothreads = g_new(IOThread *, blockdev->props.num_iothreads);
+        for (i = 0; i < blockdev->props.num_iothreads; i++) {
+            iothreads[i] = iothread_by_id(blockdev->props.iothreads[i]);
+            if (!iothreads[i]) {
+                error_setg(errp, "IOThread '%s' not found",
+                           blockdev->props.iothreads[i]);
+                return;
+            }
+        }
+        nr_iothreads = blockdev->props.num_iothreads;
+    } else if (blockdev->props.iothread) {
+        iothreads = g_new(IOThread *, 1);
+        iothreads[0] = blockdev->props.iothread;
+        nr_iothreads = 1;
+    }
+
     blockdev->dataplane =
         xen_block_dataplane_create(xendev, blk, conf->logical_block_size,
-                                   blockdev->props.iothread);
+                                   iothreads, nr_iothreads,
+                                   blockdev->props.max_queues);
 
     blk_set_dev_ops(blk, &xen_block_dev_ops, blockdev);
 }
@@ -674,6 +754,9 @@ static Property xen_block_props[] = {
                        props.max_ring_page_order, 4),
     DEFINE_PROP_LINK("iothread", XenBlockDevice, props.iothread,
                      TYPE_IOTHREAD, IOThread *),
+    DEFINE_PROP_ARRAY("iothreads", XenBlockDevice, props.num_iothreads,
+                      props.iothreads, qdev_prop_string, char *),
+    DEFINE_PROP_UINT32("max-queues", XenBlockDevice, props.max_queues, 1),
     DEFINE_PROP_END_OF_LIST()
 };
 
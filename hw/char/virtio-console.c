@@ -32,8 +32,27 @@ struct VirtConsole {
 
     CharBackend chr;
     guint watch;
+
+    /*
+     * Console output the backend did not accept yet, bounded by
+     * buffer_size.  Consoles can't be throttled, see flush_buf().
+     */
+    GByteArray *outbuf;
+    uint32_t buffer_size;
 };
 
+/* Queue console output for chr_write_unblocked(), drop what doesn't fit */
+static void virtconsole_queue(VirtConsole *vcon, const uint8_t *buf,
+                              size_t len)
+{
+    size_t room = vcon->buffer_size - vcon->outbuf->len;
+    size_t n = MIN(len, room);
+
+    g_byte_array_append(vcon->outbuf, buf, n);
+    trace_virtio_console_buffer(VIRTIO_SERIAL_PORT(vcon)->id,
+                                vcon->outbuf->len, len - n);
+}
+
 /*
  * Callback function that's called from chardevs when backend becomes
  * writable.
@@ -43,6 +62,23 @@ static gboolean chr_write_unblocked(void *do_not_use, GIOCondition cond,
 {
     VirtConsole *vcon = opaque;
 
+    if (vcon->outbuf && vcon->outbuf->len) {
+        int ret = 0;
+
+        if (!(cond & G_IO_HUP)) {
+            ret = qemu_chr_fe_write(&vcon->chr, vcon->outbuf->data,
+                                    vcon->outbuf->len);
+        }
+        if (ret > 0) {
+            g_byte_array_remove_range(vcon->outbuf, 0, ret);
+        } else if (cond & G_IO_HUP) {
+            g_byte_array_set_size(vcon->outbuf, 0);
+        }
+        if (vcon->outbuf->len) {
+            return G_SOURCE_CONTINUE;
+        }
+    }
+
     vcon->watch = 0;
     virtio_serial_throttle_port(VIRTIO_SERIAL_PORT(vcon), false);
     return G_SOURCE_REMOVE;
@@ -60,6 +96,12 @@ static ssize_t flush_buf(VirtIOSerialPort *port,
         return len;
     }
 
+    if (vcon->outbuf && vcon->outbuf->len) {
+        /* Keep the order, the watch writes everything in one go */
+        virtconsole_queue(vcon, buf, len);
+        return len;
+    }
+
     ret = qemu_chr_fe_write(&vcon->chr, buf, len);
     trace_virtio_console_flush_buf(port->id, len, ret);
 
@@ -102,6 +144,18 @@ static ssize_t flush_buf(VirtIOSerialPort *port,
                                                     G_IO_OUT|G_IO_HUP,
                                                     chr_write_unblocked, vcon);
             }
+        } else if (vcon->outbuf) {
+            /*
+             * Buffering a bounded amount of console output doesn't stall
+             * the guest, and doesn't let it use arbitrary memory.
+             */
+            virtconsole_queue(vcon, buf + ret, len - ret);
+            ret = len;
+            if (!vcon->watch) {
+                vcon->watch = qemu_chr_fe_add_watch(&vcon->chr,
+                                                    G_IO_OUT|G_IO_HUP,
+                                                    chr_write_unblocked, vcon);
+            }
         }
     }
     return ret;
@@ -229,6 +283,10 @@ static void virtconsole_realize(DeviceState *dev, Error **errp)
         return;
     }
 
+    if (k->is_console && vcon->buffer_size) {
+        vcon->outbuf = g_byte_array_sized_new(vcon->buffer_size);
+    }
+
     if (qemu_chr_fe_backend_connected(&vcon->chr)) {
         /*
          * For consoles we don't block guest data transfer just
@@ -259,13 +317,24 @@ static void virtconsole_unrealize(DeviceState *dev)
     if (vcon->watch) {
         g_source_remove(vcon->watch);
     }
+    if (vcon->outbuf) {
+        g_byte_array_free(vcon->outbuf, true);
+        vcon->outbuf = NULL;
+    }
 }
 
+static Property virtconsole_properties[] = {
+    DEFINE_PROP_UINT32("buffer-size", VirtConsole, buffer_size, 0),
+    DEFINE_PROP_END_OF_LIST(),
+};
+
 static void virtconsole_class_init(ObjectClass *klass, void *data)
 {
+    DeviceClass *dc = DEVICE_CLASS(klass);
     VirtIOSerialPortClass *k = VIRTIO_SERIAL_PORT_CLASS(klass);
 
     k->is_console = true;
+    device_class_set_props(dc, virtconsole_properties);
 }
 
 static const TypeInfo virtconsole_info = {
@@ -12,6 +12,10 @@
 
 #include "qemu/osdep.h"
 #include "qemu/accel.h"
+#include "block/block.h"
+#include "qemu/startup-profile.h"
+#include "qemu/thread.h"
+#include "qemu/units.h"
 #include "sysemu/replay.h"
 #include "hw/boards.h"
 #include "hw/loader.h"
@@ -24,6 +28,7 @@
 #include "sysemu/runstate.h"
 #include "sysemu/xen.h"
 #include "sysemu/qtest.h"
+#include "sysemu/hostmem.h"
 #include "hw/pci/pci_bridge.h"
 #include "hw/mem/nvdimm.h"
 #include "migration/global_state.h"
@@ -440,6 +445,20 @@ static void machine_set_mem_merge(Object *obj, bool value, Error **errp)
     ms->mem_merge = value;
 }
 
+static int machine_get_reset_ram(Object *obj, Error **errp)
+{
+    MachineState *ms = MACHINE(obj);
+
+    return ms->reset_ram;
+}
+
+static void machine_set_reset_ram(Object *obj, int value, Error **errp)
+{
+    MachineState *ms = MACHINE(obj);
+
+    ms->reset_ram = value;
+}
+
 static bool machine_get_usb(Object *obj, Error **errp)
 {
     MachineState *ms = MACHINE(obj);
@@ -1041,6 +1060,13 @@ static void machine_class_init(ObjectClass *oc, void *data)
     object_class_property_set_description(oc, "mem-merge",
         "Enable/disable memory merge support");
 
+    object_class_property_add_enum(oc, "reset-ram", "MachineResetRam",
+        &MachineResetRam_lookup,
+        machine_get_reset_ram, machine_set_reset_ram);
+    object_class_property_set_description(oc, "reset-ram",
+        "What to do with the content of guest RAM on reset "
+        "(keep, discard, zero)");
+
     object_class_property_add_bool(oc, "usb",
         machine_get_usb, machine_set_usb);
     object_class_property_set_description(oc, "usb",
@@ -1198,6 +1224,137 @@ bool machine_mem_merge(MachineState *machine)
     return machine->mem_merge;
 }
 
+/* Guest RAM is scrubbed in chunks of this size, spread over the threads */
+#define MACHINE_RESET_RAM_CHUNK (1 * GiB)
+#define MACHINE_RESET_RAM_MAX_THREADS 16
+
+typedef struct MachineResetRamChunk {
+    MemoryRegion *mr;
+    uint64_t offset;
+    uint64_t size;
+    bool discard;
+} MachineResetRamChunk;
+
+typedef struct MachineResetRamState {
+    GArray *chunks;
+    unsigned int next;
+    bool discard;
+} MachineResetRamState;
+
+static int machine_reset_ram_collect(Object *obj, void *opaque)
+{
+    MachineResetRamState *s = opaque;
+    HostMemoryBackend *backend;
+    MemoryRegion *mr;
+    uint64_t offset, size;
+    bool discard;
+
+    if (!object_dynamic_cast(obj, TYPE_MEMORY_BACKEND)) {
+        return 0;
+    }
+    backend = MEMORY_BACKEND(obj);
+    if (!host_memory_backend_is_mapped(backend)) {
+        return 0;
+    }
+    /* Shared files are not guest RAM only: they outlive the VM */
+    if (backend->share && object_dynamic_cast(obj, TYPE_MEMORY_BACKEND_FILE)) {
+        return 0;
+    }
+
+    mr = host_memory_backend_get_memory(backend);
+    /* virtio-mem unplugs all of its memory on reset already */
+    if (!memory_region_is_ram(mr) || mr->readonly ||
+        memory_region_has_ram_discard_manager(mr)) {
+        return 0;
+    }
+
+    /*
+     * Discarding a private file mapping brings back the file contents
+     * instead of zeroes, so such memory is always cleared by hand.
+     */
+    discard = s->discard && (qemu_ram_get_fd(mr->ram_block) == -1 ||
+                             qemu_ram_is_shared(mr->ram_block));
+
+    size = memory_region_size(mr);
+    for (offset = 0; offset < size; offset += MACHINE_RESET_RAM_CHUNK) {
+        MachineResetRamChunk chunk = {
+            .mr = mr,
+            .offset = offset,
+            .size = MIN(size - offset, MACHINE_RESET_RAM_CHUNK),
+            .discard = discard,
+        };
+        g_array_append_val(s->chunks, chunk);
+    }
+    return 0;
+}
+
+static void *machine_reset_ram_thread(void *opaque)
+{
+    MachineResetRamState *s = opaque;
+    MachineResetRamChunk *chunk;
+    unsigned int i;
+
+    while ((i = qatomic_fetch_inc(&s->next)) < s->chunks->len) {
+        chunk = &g_array_index(s->chunks, MachineResetRamChunk, i);
+        if (chunk->discard &&
+            !ram_block_discard_range(chunk->mr->ram_block, chunk->offset,
+                                     chunk->size)) {
+            continue;
+        }
+        memset(memory_region_get_ram_ptr(chunk->mr) + chunk->offset, 0,
+               chunk->size);
+    }
+    return NULL;
+}
+
+/*
+ * Scrub guest RAM as requested by the "reset-ram" property.  This must
+ * run before devices are reset, because resetting them loads firmware
+ * and ROM images into RAM again.
+ */
+void machine_reset_ram(MachineState *ms)
+{
+    MachineResetRamState s = {
+        .discard = ms->reset_ram == MACHINE_RESET_RAM_DISCARD &&
+                   !ram_block_discard_is_disabled(),
+    };
+    MachineResetRamChunk *chunk;
+    QemuThread *threads;
+    unsigned int i, nr_threads;
+
+    if (ms->reset_ram == MACHINE_RESET_RAM_KEEP) {
+        return;
+    }
+
+    s.chunks = g_array_new(false, false, sizeof(MachineResetRamChunk));
+    object_child_foreach_recursive(object_get_objects_root(),
+                                   machine_reset_ram_collect, &s);
+
+    /* In-flight block requests could still DMA into the memory */
+    bdrv_drain_all_begin();
+
+    nr_threads = MIN(MIN(s.chunks->len, ms->smp.cpus),
+                     MACHINE_RESET_RAM_MAX_THREADS);
+    threads = g_new(QemuThread, nr_threads);
+    for (i = 1; i < nr_threads; i++) {
+        qemu_thread_create(&threads[i], "reset-ram", machine_reset_ram_thread,
+                           &s, QEMU_THREAD_JOINABLE);
+    }
+    machine_reset_ram_thread(&s);
+    for (i = 1; i < nr_threads; i++) {
+        qemu_thread_join(&threads[i]);
+    }
+    g_free(threads);
+    bdrv_drain_all_end();
+
+    /* The host wrote to guest memory, make sure migration sends it again */
+    for (i = 0; i < s.chunks->len; i++) {
+        chunk = &g_array_index(s.chunks, MachineResetRamChunk, i);
+        memory_region_set_dirty(chunk->mr, chunk->offset, chunk->size);
+    }
+    g_array_free(s.chunks, true);
+}
+
 static char *cpu_slot_to_string(const CPUArchId *cpu)
 {
     GString *s = g_string_new(NULL);
@@ -1592,6 +1749,7 @@ void qdev_machine_creation_done(void)
     qemu_register_resettable(OBJECT(sysbus_get_default()));
 
     notifier_list_notify(&machine_init_done_notifiers, NULL);
+    startup_profile_phase("machine-init-done-notifiers");
 
     if (rom_check_and_register_reset() != 0) {
         exit(1);
@@ -1604,6 +1762,8 @@ void qdev_machine_creation_done(void)
        clock values from the log. */
     replay_checkpoint(CHECKPOINT_RESET);
     qemu_system_reset(SHUTDOWN_CAUSE_NONE);
+    /* Includes loading ROMs into guest memory */
+    startup_profile_phase("reset");
     register_global_state();
 }
 
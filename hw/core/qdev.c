@@ -33,6 +33,7 @@
 #include "qapi/visitor.h"
 #include "qemu/error-report.h"
 #include "qemu/option.h"
+#include "qemu/startup-profile.h"
 #include "hw/irq.h"
 #include "hw/qdev-properties.h"
 #include "hw/boards.h"
@@ -507,10 +508,22 @@ static void device_set_realized(Object *obj, bool value, Error **errp)
         }
 
         if (dc->realize) {
+            StartupProfileTime start = {};
+
+            if (startup_profile_active) {
+                start = startup_profile_now();
+            }
             dc->realize(dev, &local_err);
             if (local_err != NULL) {
                 goto fail;
             }
+            if (startup_profile_active) {
+                g_autofree char *path = object_get_canonical_path(obj);
+                g_autofree char *name =
+                    g_strdup_printf("%s (%s)", path, object_get_typename(obj));
+
+                startup_profile_realized(name, start);
+            }
         }
 
         DEVICE_LISTENER_CALL(realize, Forward, dev);
@@ -98,8 +98,18 @@ void cxl_fmws_link_targets(CXLState *cxl_state, Error **errp)
     }
 }
 
+/*
+ * The HPA range around an address that decodes to the same device, and
+ * whether any level of the decode interleaves it across devices.
+ */
+typedef struct CXLDecodeRange {
+    hwaddr start;
+    hwaddr end;
+    bool interleaved;
+} CXLDecodeRange;
+
 static bool cxl_hdm_find_target(uint32_t *cache_mem, hwaddr addr,
-                                uint8_t *target)
+                                uint8_t *target, CXLDecodeRange *range)
 {
     int hdm_inc = R_CXL_HDM_DECODER1_BASE_LO - R_CXL_HDM_DECODER0_BASE_LO;
     unsigned int hdm_count;
@@ -135,6 +145,10 @@ static bool cxl_hdm_find_target(uint32_t *cache_mem, hwaddr addr,
         iw_enc = FIELD_EX32(ctrl, CXL_HDM_DECODER0_CTRL, IW);
         target_idx = (addr / cxl_decode_ig(ig_enc)) % (1 << iw_enc);
 
+        range->start = MAX(range->start, base);
+        range->end = MIN(range->end, base + size);
+        range->interleaved |= iw_enc != 0;
+
         if (target_idx < 4) {
             uint32_t val = ldl_le_p(cache_mem +
                                     R_CXL_HDM_DECODER0_TARGET_LIST_LO +
@@ -152,7 +166,8 @@ static bool cxl_hdm_find_target(uint32_t *cache_mem, hwaddr addr,
     return found;
 }
 
-static PCIDevice *cxl_cfmws_find_device(CXLFixedWindow *fw, hwaddr addr)
+static PCIDevice *cxl_cfmws_find_device(CXLFixedWindow *fw, hwaddr addr,
+                                        CXLDecodeRange *range)
 {
     CXLComponentState *hb_cstate, *usp_cstate;
     PCIHostState *hb;
@@ -166,6 +181,10 @@ static PCIDevice *cxl_cfmws_find_device(CXLFixedWindow *fw, hwaddr addr)
     /* Address is relative to memory region. Convert to HPA */
     addr += fw->base;
 
+    range->start = fw->base;
+    range->end = fw->base + fw->size;
+    range->interleaved = fw->num_targets > 1;
+
     rb_index = (addr / cxl_decode_ig(fw->enc_int_gran)) % fw->num_targets;
     hb = PCI_HOST_BRIDGE(fw->target_hbs[rb_index]->cxl_host_bridge);
     if (!hb || !hb->bus || !pci_bus_is_cxl(hb->bus)) {
@@ -185,7 +204,7 @@ static PCIDevice *cxl_cfmws_find_device(CXLFixedWindow *fw, hwaddr addr)
 
         cache_mem = hb_cstate->crb.cache_mem_registers;
 
-        target_found = cxl_hdm_find_target(cache_mem, addr, &target);
+        target_found = cxl_hdm_find_target(cache_mem, addr, &target, range);
         if (!target_found) {
             return NULL;
         }
@@ -221,7 +240,7 @@ static PCIDevice *cxl_cfmws_find_device(CXLFixedWindow *fw, hwaddr addr)
 
     cache_mem = usp_cstate->crb.cache_mem_registers;
 
-    target_found = cxl_hdm_find_target(cache_mem, addr, &target);
+    target_found = cxl_hdm_find_target(cache_mem, addr, &target, range);
     if (!target_found) {
         return NULL;
     }
@@ -247,15 +266,21 @@ static MemTxResult cxl_read_cfmws(void *opaque, hwaddr addr, uint64_t *data,
                                   unsigned size, MemTxAttrs attrs)
 {
     CXLFixedWindow *fw = opaque;
+    CXLDecodeRange range;
     PCIDevice *d;
 
-    d = cxl_cfmws_find_device(fw, addr);
+    d = cxl_cfmws_find_device(fw, addr, &range);
     if (d == NULL) {
         *data = 0;
         /* Reads to invalid address return poison */
         return MEMTX_ERROR;
     }
 
+    if (!range.interleaved) {
+        cxl_type3_direct_map(d, &fw->mr, fw->base, range.start, range.end,
+                             addr + fw->base);
+    }
+
     return cxl_type3_read(d, addr + fw->base, data, size, attrs);
 }
 
@@ -264,14 +289,20 @@ static MemTxResult cxl_write_cfmws(void *opaque, hwaddr addr,
                                    MemTxAttrs attrs)
 {
     CXLFixedWindow *fw = opaque;
+    CXLDecodeRange range;
     PCIDevice *d;
 
-    d = cxl_cfmws_find_device(fw, addr);
+    d = cxl_cfmws_find_device(fw, addr, &range);
     if (d == NULL) {
         /* Writes to invalid address are silent */
         return MEMTX_OK;
     }
 
+    if (!range.interleaved) {
+        cxl_type3_direct_map(d, &fw->mr, fw->base, range.start, range.end,
+                             addr + fw->base);
+    }
+
     return cxl_type3_write(d, addr + fw->base, data, size, attrs);
 }
 
@@ -1000,6 +1000,7 @@ static CXLRetCode cmd_sanitize_overwrite(const struct cxl_cmd *cmd,
     *len_out = 0;
 
     cxl_dev_disable_media(&ct3d->cxl_dstate);
+    cxl_type3_direct_unmap(ct3d);
 
     /* sanitize when done */
     return CXL_MBOX_BG_STARTED;
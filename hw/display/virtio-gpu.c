@@ -668,9 +668,18 @@ static bool virtio_gpu_do_set_scanout(VirtIOGPU *g,
         data = (uint8_t *)pixman_image_get_data(res->image);
     }
 
-    /* create a surface for this scanout */
-    if ((res->blob && !console_has_gl(scanout->con)) ||
-        !scanout->ds ||
+    /*
+     * create a surface for this scanout
+     *
+     * The surface of a blob maps the guest memory directly, keep it when
+     * the guest sets the same framebuffer again: replacing it would make
+     * the display front-ends redraw the full frame instead of the flushed
+     * rectangles.
+     */
+    if (!scanout->ds ||
+        (res->blob && (scanout->resource_id != res->resource_id ||
+                       surface_format(scanout->ds) != fb->format ||
+                       surface_stride(scanout->ds) != fb->stride)) ||
         surface_data(scanout->ds) != data + fb->offset ||
         scanout->width != r->width ||
         scanout->height != r->height) {
@@ -2192,12 +2192,11 @@ static void vtd_iotlb_domain_invalidate(IntelIOMMUState *s, uint16_t domain_id)
 
 static void vtd_iotlb_page_invalidate_notify(IntelIOMMUState *s,
                                            uint16_t domain_id, hwaddr addr,
-                                             uint8_t am, uint32_t pasid)
+                                             hwaddr size, uint32_t pasid)
 {
     VTDAddressSpace *vtd_as;
     VTDContextEntry ce;
     int ret;
-    hwaddr size = (1 << am) * VTD_PAGE_SIZE;
 
     QLIST_FOREACH(vtd_as, &(s->vtd_as_with_notifiers), next) {
         if (pasid != PCI_NO_PASID && pasid != vtd_as->pasid) {
@@ -2235,8 +2234,9 @@ static void vtd_iotlb_page_invalidate_notify(IntelIOMMUState *s,
     }
 }
 
-static void vtd_iotlb_page_invalidate(IntelIOMMUState *s, uint16_t domain_id,
-                                      hwaddr addr, uint8_t am)
+static void vtd_iotlb_page_invalidate_cache(IntelIOMMUState *s,
+                                            uint16_t domain_id,
+                                            hwaddr addr, uint8_t am)
 {
     VTDIOTLBPageInvInfo info;
 
@@ -2249,7 +2249,60 @@ static void vtd_iotlb_page_invalidate(IntelIOMMUState *s, uint16_t domain_id,
     vtd_iommu_lock(s);
     g_hash_table_foreach_remove(s->iotlb, vtd_hash_remove_by_page, &info);
     vtd_iommu_unlock(s);
-    vtd_iotlb_page_invalidate_notify(s, domain_id, addr, am, PCI_NO_PASID);
+}
+
+static void vtd_iotlb_page_invalidate(IntelIOMMUState *s, uint16_t domain_id,
+                                      hwaddr addr, uint8_t am)
+{
+    vtd_iotlb_page_invalidate_cache(s, domain_id, addr, am);
+    vtd_iotlb_page_invalidate_notify(s, domain_id, addr,
+                                     (1 << am) * VTD_PAGE_SIZE, PCI_NO_PASID);
+}
+
+/* Deliver the notifications of the pending page-selective invalidations */
+static void vtd_iotlb_page_invalidate_flush(IntelIOMMUState *s)
+{
+    if (!s->psi_pending) {
+        return;
+    }
+
+    s->psi_pending = false;
+    trace_vtd_inv_desc_iotlb_pages_flush(s->psi_domain_id, s->psi_addr,
+                                         s->psi_size);
+    vtd_iotlb_page_invalidate_notify(s, s->psi_domain_id, s->psi_addr,
+                                     s->psi_size, PCI_NO_PASID);
+}
+
+/*
+ * Page-selective invalidation from the invalidation queue.  The guest can
+ * only tell that it completed with a later wait descriptor, so the shadow
+ * page table sync is delayed until another kind of descriptor or the end
+ * of the queue.  Meanwhile, adjacent or overlapping ranges of the same
+ * domain are merged, so that a burst of invalidations for consecutive
+ * pages walks the page tables and notifies the mappings only once.
+ */
+static void vtd_iotlb_page_invalidate_queued(IntelIOMMUState *s,
+                                             uint16_t domain_id,
+                                             hwaddr addr, uint8_t am)
+{
+    hwaddr size = (1 << am) * VTD_PAGE_SIZE;
+
+    vtd_iotlb_page_invalidate_cache(s, domain_id, addr, am);
+
+    if (s->psi_pending && s->psi_domain_id == domain_id &&
+        addr <= s->psi_addr + s->psi_size && s->psi_addr <= addr + size) {
+        hwaddr end = MAX(s->psi_addr + s->psi_size, addr + size);
+
+        s->psi_addr = MIN(s->psi_addr, addr);
+        s->psi_size = end - s->psi_addr;
+        return;
+    }
+
+    vtd_iotlb_page_invalidate_flush(s);
+    s->psi_pending = true;
+    s->psi_domain_id = domain_id;
+    s->psi_addr = addr;
+    s->psi_size = size;
 }
 
 /* Flush IOTLB
@@ -2615,7 +2668,7 @@ static bool vtd_process_iotlb_desc(IntelIOMMUState *s, VTDInvDesc *inv_desc)
                               am, (unsigned)VTD_MAMV);
             return false;
         }
-        vtd_iotlb_page_invalidate(s, domain_id, addr, am);
+        vtd_iotlb_page_invalidate_queued(s, domain_id, addr, am);
         break;
 
     default:
@@ -2714,6 +2767,12 @@ static bool vtd_process_inv_desc(IntelIOMMUState *s)
     /* FIXME: should update at first or at last? */
     s->iq_last_desc_type = desc_type;
 
+    /* Only page-selective IOTLB invalidations can be merged */
+    if (desc_type != VTD_INV_DESC_IOTLB ||
+        (inv_desc.lo & VTD_INV_DESC_IOTLB_G) != VTD_INV_DESC_IOTLB_PAGE) {
+        vtd_iotlb_page_invalidate_flush(s);
+    }
+
     switch (desc_type) {
     case VTD_INV_DESC_CC:
         trace_vtd_inv_desc("context-cache", inv_desc.hi, inv_desc.lo);
@@ -2803,6 +2862,7 @@ static void vtd_fetch_inv_desc(IntelIOMMUState *s)
                          (((uint64_t)(s->iq_head)) << qi_shift) &
                          VTD_IQH_QH_MASK);
     }
+    vtd_iotlb_page_invalidate_flush(s);
 }
 
 /* Handle write to Invalidation Queue Tail Register */
@@ -314,6 +314,8 @@ struct AHCIDevice {
     AHCIPortRegs port_regs;
     struct AHCIState *hba;
     QEMUBH *check_bh;
+    /* Writes the SDB FIS for the NCQ commands in @finished */
+    QEMUBH *sdb_bh;
     uint8_t *lst;
     uint8_t *res_fis;
     bool done_first_drq;
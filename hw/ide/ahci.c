@@ -28,6 +28,7 @@
 #include "hw/qdev-properties.h"
 #include "migration/vmstate.h"
 
+#include "qemu/defer-call.h"
 #include "qemu/error-report.h"
 #include "qemu/log.h"
 #include "qemu/main-loop.h"
@@ -598,11 +599,14 @@ static void check_cmd(AHCIState *s, int port)
     uint8_t slot;
 
     if ((pr->cmd & PORT_CMD_START) && pr->cmd_issue) {
+        /* Submit the NCQ commands issued together as one batch */
+        defer_call_begin();
         for (slot = 0; (slot < 32) && pr->cmd_issue; slot++) {
             if (pr->cmd_issue & (1U << slot)) {
                 handle_cmd(s, port, slot);
             }
         }
+        defer_call_end();
     }
 }
 
@@ -700,6 +704,10 @@ static void ahci_reset_port(AHCIState *s, int port)
         ncq_tfs->used = 0;
     }
 
+    /* Nothing to report anymore for the commands that were reset */
+    qemu_bh_cancel(d->sdb_bh);
+    d->finished = 0;
+
     s->dev[port].port_state = STATE_RUN;
     if (ide_state->drive_kind == IDE_CD) {
         ahci_set_signature(d, SATA_SIGNATURE_CDROM);
@@ -783,9 +791,9 @@ static void ahci_unmap_clb_address(AHCIDevice *ad)
     ad->lst = NULL;
 }
 
-static void ahci_write_fis_sdb(AHCIState *s, NCQTransferState *ncq_tfs)
+static void ahci_write_fis_sdb(AHCIDevice *ad)
 {
-    AHCIDevice *ad = ncq_tfs->drive;
+    AHCIState *s = ad->hba;
     AHCIPortRegs *pr = &ad->port_regs;
     IDEState *ide_state;
     SDBFIS *sdb_fis;
@@ -825,6 +833,15 @@ static void ahci_write_fis_sdb(AHCIState *s, NCQTransferState *ncq_tfs)
     }
 }
 
+static void ahci_sdb_bh(void *opaque)
+{
+    AHCIDevice *ad = opaque;
+
+    if (ad->finished) {
+        ahci_write_fis_sdb(ad);
+    }
+}
+
 static void ahci_write_fis_pio(AHCIDevice *ad, uint16_t len, bool pio_fis_i)
 {
     AHCIPortRegs *pr = &ad->port_regs;
@@ -1000,9 +1017,21 @@ static int ahci_populate_sglist(AHCIDevice *ad, QEMUSGList *sglist,
                             limit));
 
         for (i = off_idx + 1; i < prdtl && sglist->size < limit; i++) {
-            qemu_sglist_add(sglist, le64_to_cpu(tbl[i].addr),
-                            MIN(prdt_tbl_entry_size(&tbl[i]),
-                                limit - sglist->size));
+            ScatterGatherEntry *last = &sglist->sg[sglist->nsg - 1];
+            dma_addr_t base = le64_to_cpu(tbl[i].addr);
+            dma_addr_t len = MIN(prdt_tbl_entry_size(&tbl[i]),
+                                 limit - sglist->size);
+
+            /*
+             * Guests describe contiguous buffers with many small entries,
+             * extend the previous one so that they are mapped at once.
+             */
+            if (last->base + last->len == base) {
+                last->len += len;
+                sglist->size += len;
+                continue;
+            }
+            qemu_sglist_add(sglist, base, len);
         }
     }
 
@@ -1026,13 +1055,18 @@ static void ncq_finish(NCQTransferState *ncq_tfs)
 {
     /* If we didn't error out, set our finished bit. Errored commands
      * do not get a bit set for the SDB FIS ACT register, nor do they
-     * clear the outstanding bit in scr_act (PxSACT). */
+     * clear the outstanding bit in scr_act (PxSACT).
+     *
+     * The SDB FIS can report several completions at once: defer it so
+     * that the commands completing together raise a single interrupt.
+     * Errors are reported right away. */
     if (ncq_tfs->used) {
         ncq_tfs->drive->finished |= (1 << ncq_tfs->tag);
+        qemu_bh_schedule(ncq_tfs->drive->sdb_bh);
+    } else {
+        ahci_write_fis_sdb(ncq_tfs->drive);
     }
 
-    ahci_write_fis_sdb(ncq_tfs->drive->hba, ncq_tfs);
-
     trace_ncq_finish(ncq_tfs->drive->hba, ncq_tfs->drive->port_no,
                      ncq_tfs->tag);
 
@@ -1635,6 +1669,8 @@ void ahci_realize(AHCIState *s, DeviceState *qdev, AddressSpace *as)
         ad->port_no = i;
         ad->port.dma = &ad->dma;
         ad->port.dma->ops = &ahci_dma_ops;
+        ad->sdb_bh = qemu_bh_new_guarded(ahci_sdb_bh, ad,
+                                         &ad->mem_reentrancy_guard);
         ide_bus_register_restart_cb(&ad->port);
     }
     g_free(irqs);
@@ -1651,6 +1687,7 @@ void ahci_uninit(AHCIState *s)
             ide_exit(&ad->port.ifs[j]);
         }
         object_unparent(OBJECT(&ad->port));
+        qemu_bh_delete(ad->sdb_bh);
     }
 
     g_free(s->dev);
@@ -1810,6 +1847,11 @@ static int ahci_state_post_load(void *opaque, int version_id)
             }
             ad->cur_cmd = get_cmd_header(s, i, ad->busy_slot);
         }
+
+        /* Completions that the source had not reported yet */
+        if (ad->finished) {
+            qemu_bh_schedule(ad->sdb_bh);
+        }
     }
 
     return 0;
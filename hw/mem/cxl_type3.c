@@ -565,6 +565,9 @@ static void ct3d_reg_write(void *opaque, hwaddr offset, uint64_t value,
     } else if (should_uncommit) {
         hdm_decoder_uncommit(ct3d, which_hdm);
     }
+    if (should_commit || should_uncommit) {
+        cxl_type3_direct_unmap(ct3d);
+    }
 }
 
 static bool cxl_setup_memory(CXLType3Dev *ct3d, Error **errp)
@@ -607,6 +610,15 @@ static bool cxl_setup_memory(CXLType3Dev *ct3d, Error **errp)
             v_name = g_strdup("cxl-type3-dpa-vmem-space");
         }
         address_space_init(&ct3d->hostvmem_as, vmr, v_name);
+        if (ct3d->direct_map) {
+            int i;
+
+            for (i = 0; i < CXL_HDM_DECODER_COUNT; i++) {
+                memory_region_init_alias(&ct3d->direct_mr[i], OBJECT(ct3d),
+                                         "cxl-type3-direct-vmem", vmr, 0,
+                                         memory_region_size(vmr));
+            }
+        }
         ct3d->cxl_dstate.vmem_size = memory_region_size(vmr);
         ct3d->cxl_dstate.mem_size += memory_region_size(vmr);
         g_free(v_name);
@@ -740,6 +752,7 @@ static void ct3_exit(PCIDevice *pci_dev)
     CXLComponentState *cxl_cstate = &ct3d->cxl_cstate;
     ComponentRegisters *regs = &cxl_cstate->crb;
 
+    cxl_type3_direct_unmap(ct3d);
     pcie_aer_exit(pci_dev);
     cxl_doe_cdat_release(cxl_cstate);
     g_free(regs->special_ops);
@@ -751,7 +764,18 @@ static void ct3_exit(PCIDevice *pci_dev)
     }
 }
 
-static bool cxl_type3_dpa(CXLType3Dev *ct3d, hwaddr host_addr, uint64_t *dpa)
+typedef struct CXLType3HDM {
+    int which;
+    uint64_t base;
+    uint64_t size;
+    uint64_t dpa_base;
+    int ig;
+    int iw;
+} CXLType3HDM;
+
+/* Find the committed HDM decoder that decodes @host_addr */
+static bool cxl_type3_find_hdm(CXLType3Dev *ct3d, hwaddr host_addr,
+                               CXLType3HDM *hdm)
 {
     int hdm_inc = R_CXL_HDM_DECODER1_BASE_LO - R_CXL_HDM_DECODER0_BASE_LO;
     uint32_t *cache_mem = ct3d->cxl_cstate.crb.cache_mem_registers;
@@ -805,16 +829,117 @@ static bool cxl_type3_dpa(CXLType3Dev *ct3d, hwaddr host_addr, uint64_t *dpa)
             continue;
         }
 
-        *dpa = dpa_base +
-            ((MAKE_64BIT_MASK(0, 8 + ig) & hpa_offset) |
-             ((MAKE_64BIT_MASK(8 + ig + iw, 64 - 8 - ig - iw) & hpa_offset)
-              >> iw));
-
+        hdm->which = i;
+        hdm->base = decoder_base;
+        hdm->size = decoder_size;
+        hdm->dpa_base = dpa_base;
+        hdm->ig = ig;
+        hdm->iw = iw;
         return true;
     }
     return false;
 }
 
+static bool cxl_type3_dpa(CXLType3Dev *ct3d, hwaddr host_addr, uint64_t *dpa)
+{
+    uint64_t hpa_offset;
+    CXLType3HDM hdm;
+
+    if (!cxl_type3_find_hdm(ct3d, host_addr, &hdm)) {
+        return false;
+    }
+
+    hpa_offset = (uint64_t)host_addr - hdm.base;
+    *dpa = hdm.dpa_base +
+        ((MAKE_64BIT_MASK(0, 8 + hdm.ig) & hpa_offset) |
+         ((MAKE_64BIT_MASK(8 + hdm.ig + hdm.iw, 64 - 8 - hdm.ig - hdm.iw) &
+           hpa_offset) >> hdm.iw));
+
+    return true;
+}
+
+/* Devices with volatile memory mapped straight into a fixed memory window */
+static QLIST_HEAD(, CXLType3Dev) cxl_type3_direct_devs =
+    QLIST_HEAD_INITIALIZER(cxl_type3_direct_devs);
+
+void cxl_type3_direct_map(PCIDevice *d, MemoryRegion *window,
+                          hwaddr window_base, hwaddr start, hwaddr end,
+                          hwaddr host_addr)
+{
+    CXLType3Dev *ct3d = CXL_TYPE3(d);
+    uint64_t align = qemu_real_host_page_size();
+    uint64_t vmem_size, dpa, len;
+    MemoryRegion *mr;
+    CXLType3HDM hdm;
+
+    if (!ct3d->direct_map || !ct3d->hostvmem ||
+        sanitize_running(&ct3d->cci) ||
+        !cxl_type3_find_hdm(ct3d, host_addr, &hdm) || hdm.iw) {
+        return;
+    }
+
+    mr = &ct3d->direct_mr[hdm.which];
+    if (ct3d->direct_window[hdm.which]) {
+        return;
+    }
+
+    start = MAX(start, hdm.base);
+    end = MIN(end, hdm.base + hdm.size);
+    dpa = hdm.dpa_base + (start - hdm.base);
+    vmem_size = ct3d->cxl_dstate.vmem_size;
+    if (dpa >= vmem_size) {
+        /* Persistent memory keeps going through cxl_type3_read/write */
+        return;
+    }
+    len = MIN(end - start, vmem_size - dpa);
+
+    if (host_addr < start || host_addr >= start + len ||
+        !QEMU_IS_ALIGNED(start | len | dpa, align)) {
+        return;
+    }
+
+    memory_region_set_alias_offset(mr, dpa);
+    memory_region_set_size(mr, len);
+    memory_region_add_subregion_overlap(window, start - window_base, mr, 1);
+    ct3d->direct_window[hdm.which] = window;
+
+    if (!ct3d->direct_mapped) {
+        QLIST_INSERT_HEAD(&cxl_type3_direct_devs, ct3d, direct_next);
+        ct3d->direct_mapped = true;
+    }
+}
+
+void cxl_type3_direct_unmap(CXLType3Dev *ct3d)
+{
+    int i;
+
+    if (!ct3d->direct_mapped) {
+        return;
+    }
+
+    memory_region_transaction_begin();
+    for (i = 0; i < CXL_HDM_DECODER_COUNT; i++) {
+        if (ct3d->direct_window[i]) {
+            memory_region_del_subregion(ct3d->direct_window[i],
+                                        &ct3d->direct_mr[i]);
+            ct3d->direct_window[i] = NULL;
+        }
+    }
+    memory_region_transaction_commit();
+
+    QLIST_REMOVE(ct3d, direct_next);
+    ct3d->direct_mapped = false;
+}
+
+void cxl_type3_direct_unmap_all(void)
+{
+    CXLType3Dev *ct3d, *next;
+
+    QLIST_FOREACH_SAFE(ct3d, &cxl_type3_direct_devs, direct_next, next) {
+        cxl_type3_direct_unmap(ct3d);
+    }
+}
+
 static int cxl_type3_hpa_to_as_and_dpa(CXLType3Dev *ct3d,
                                        hwaddr host_addr,
                                        unsigned int size,
@@ -905,6 +1030,7 @@ static void ct3d_reset(DeviceState *dev)
     uint32_t *reg_state = ct3d->cxl_cstate.crb.cache_mem_registers;
     uint32_t *write_msk = ct3d->cxl_cstate.crb.cache_mem_regs_write_mask;
 
+    cxl_type3_direct_unmap(ct3d);
     cxl_component_register_init_common(reg_state, write_msk, CXL2_TYPE3_DEVICE);
     cxl_device_register_init_t3(ct3d);
 
@@ -931,6 +1057,7 @@ static Property ct3_props[] = {
                      HostMemoryBackend *),
     DEFINE_PROP_UINT64("sn", CXLType3Dev, sn, UI64_NULL),
     DEFINE_PROP_STRING("cdat", CXLType3Dev, cxl_cstate.cdat.filename),
+    DEFINE_PROP_BOOL("x-direct-map", CXLType3Dev, direct_map, false),
     DEFINE_PROP_END_OF_LIST(),
 };
 
@@ -56,6 +56,9 @@
 
 #define E1000E_MAX_TX_FRAGS (64)
 
+/* Transmit descriptors fetched with a single DMA read */
+#define E1000E_TX_DESC_BATCH (16)
+
 union e1000_rx_desc_union {
     struct e1000_rx_desc legacy;
     union e1000_rx_desc_extended extended;
@@ -844,6 +847,23 @@ e1000e_ring_free_descr_num(E1000ECore *core, const E1000ERingInfo *r)
     return 0;
 }
 
+/*
+ * Number of descriptors, at most @max, that can be fetched at once from the
+ * head of a non-empty ring: they belong to the device and do not wrap.
+ */
+static inline uint32_t
+e1000e_ring_fetch_num(E1000ECore *core, const E1000ERingInfo *r, uint32_t max)
+{
+    uint32_t len = core->mac[r->dlen] / E1000_RING_DESC_LEN;
+    uint32_t dh = core->mac[r->dh];
+    uint32_t dt = core->mac[r->dt];
+
+    if (dh >= len) {
+        return 1;
+    }
+    return MIN(dh < dt ? dt - dh : len - dh, max);
+}
+
 static inline bool
 e1000e_ring_enabled(E1000ECore *core, const E1000ERingInfo *r)
 {
@@ -902,10 +922,11 @@ static void
 e1000e_start_xmit(E1000ECore *core, const E1000E_TxRing *txr)
 {
     dma_addr_t base;
-    struct e1000_tx_desc desc;
+    struct e1000_tx_desc desc[E1000E_TX_DESC_BATCH];
     bool ide = false;
     const E1000ERingInfo *txi = txr->i;
     uint32_t cause = E1000_ICS_TXQE;
+    uint32_t i, n;
 
     if (!(core->mac[TCTL] & E1000_TCTL_EN)) {
         trace_e1000e_tx_disabled();
@@ -914,16 +935,20 @@ e1000e_start_xmit(E1000ECore *core, const E1000E_TxRing *txr)
 
     while (!e1000e_ring_empty(core, txi)) {
         base = e1000e_ring_head_descr(core, txi);
+        n = e1000e_ring_fetch_num(core, txi, E1000E_TX_DESC_BATCH);
 
-        pci_dma_read(core->owner, base, &desc, sizeof(desc));
+        pci_dma_read(core->owner, base, desc, n * sizeof(desc[0]));
 
-        trace_e1000e_tx_descr((void *)(intptr_t)desc.buffer_addr,
-                              desc.lower.data, desc.upper.data);
+        for (i = 0; i < n; i++, base += sizeof(desc[0])) {
+            trace_e1000e_tx_descr((void *)(intptr_t)desc[i].buffer_addr,
+                                  desc[i].lower.data, desc[i].upper.data);
 
-        e1000e_process_tx_desc(core, txr->tx, &desc, txi->idx);
-        cause |= e1000e_txdesc_writeback(core, base, &desc, &ide, txi->idx);
+            e1000e_process_tx_desc(core, txr->tx, &desc[i], txi->idx);
+            cause |= e1000e_txdesc_writeback(core, base, &desc[i], &ide,
+                                             txi->idx);
 
-        e1000e_ring_advance(core, txi, 1);
+            e1000e_ring_advance(core, txi, 1);
+        }
     }
 
     if (!ide || !e1000e_intrmgr_delay_tx_causes(core, &cause)) {
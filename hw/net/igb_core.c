@@ -57,6 +57,9 @@
 
 #define E1000E_MAX_TX_FRAGS (64)
 
+/* Transmit descriptors fetched with a single DMA read */
+#define IGB_TX_DESC_BATCH   (16)
+
 union e1000_rx_desc_union {
     struct e1000_rx_desc legacy;
     union e1000_adv_rx_desc adv;
@@ -750,6 +753,23 @@ igb_ring_free_descr_num(IGBCore *core, const E1000ERingInfo *r)
     return 0;
 }
 
+/*
+ * Number of descriptors, at most @max, that can be fetched at once from the
+ * head of a non-empty ring: they belong to the device and do not wrap.
+ */
+static inline uint32_t
+igb_ring_fetch_num(IGBCore *core, const E1000ERingInfo *r, uint32_t max)
+{
+    uint32_t len = core->mac[r->dlen] / E1000_RING_DESC_LEN;
+    uint32_t dh = core->mac[r->dh];
+    uint32_t dt = core->mac[r->dt];
+
+    if (dh >= len) {
+        return 1;
+    }
+    return MIN(dh < dt ? dt - dh : len - dh, max);
+}
+
 static inline bool
 igb_ring_enabled(IGBCore *core, const E1000ERingInfo *r)
 {
@@ -878,9 +898,10 @@ igb_start_xmit(IGBCore *core, const IGB_TxRing *txr)
 {
     PCIDevice *d;
     dma_addr_t base;
-    union e1000_adv_tx_desc desc;
+    union e1000_adv_tx_desc desc[IGB_TX_DESC_BATCH];
     const E1000ERingInfo *txi = txr->i;
     uint32_t eic = 0;
+    uint32_t i, n;
 
     if (!igb_tx_enabled(core, txi)) {
         trace_e1000e_tx_disabled();
@@ -894,15 +915,19 @@ igb_start_xmit(IGBCore *core, const IGB_TxRing *txr)
 
     while (!igb_ring_empty(core, txi)) {
         base = igb_ring_head_descr(core, txi);
+        n = igb_ring_fetch_num(core, txi, IGB_TX_DESC_BATCH);
 
-        pci_dma_read(d, base, &desc, sizeof(desc));
+        pci_dma_read(d, base, desc, n * sizeof(desc[0]));
 
-        trace_e1000e_tx_descr((void *)(intptr_t)desc.read.buffer_addr,
-                              desc.read.cmd_type_len, desc.wb.status);
+        for (i = 0; i < n; i++, base += sizeof(desc[0])) {
+            trace_e1000e_tx_descr((void *)(intptr_t)desc[i].read.buffer_addr,
+                                  desc[i].read.cmd_type_len,
+                                  desc[i].wb.status);
 
-        igb_process_tx_desc(core, d, txr->tx, &desc, txi->idx);
-        igb_ring_advance(core, txi, 1);
-        eic |= igb_txdesc_writeback(core, base, &desc, txi);
+            igb_process_tx_desc(core, d, txr->tx, &desc[i], txi->idx);
+            igb_ring_advance(core, txi, 1);
+            eic |= igb_txdesc_writeback(core, base, &desc[i], txi);
+        }
     }
 
     if (eic) {
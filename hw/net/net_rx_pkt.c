@@ -306,78 +306,85 @@ _net_rx_rss_prepare_udp(uint8_t *rss_input,
                           &udphdr->uh_dport, sizeof(uint16_t));
 }
 
-uint32_t
-net_rx_pkt_calc_rss_hash(struct NetRxPkt *pkt,
-                         NetRxPktRssType type,
-                         uint8_t *key)
+static void
+net_rx_pkt_get_rss_input(struct NetRxPkt *pkt, NetRxPktRssType type,
+                         uint8_t *rss_input, size_t *rss_length)
 {
-    uint8_t rss_input[36];
-    size_t rss_length = 0;
-    uint32_t rss_hash = 0;
-    net_toeplitz_key key_data;
-
     switch (type) {
     case NetPktRssIpV4:
         assert(pkt->hasip4);
         trace_net_rx_pkt_rss_ip4();
-        _net_rx_rss_prepare_ip4(&rss_input[0], pkt, &rss_length);
+        _net_rx_rss_prepare_ip4(rss_input, pkt, rss_length);
         break;
     case NetPktRssIpV4Tcp:
         assert(pkt->hasip4);
         assert(pkt->l4hdr_info.proto == ETH_L4_HDR_PROTO_TCP);
         trace_net_rx_pkt_rss_ip4_tcp();
-        _net_rx_rss_prepare_ip4(&rss_input[0], pkt, &rss_length);
-        _net_rx_rss_prepare_tcp(&rss_input[0], pkt, &rss_length);
+        _net_rx_rss_prepare_ip4(rss_input, pkt, rss_length);
+        _net_rx_rss_prepare_tcp(rss_input, pkt, rss_length);
         break;
     case NetPktRssIpV6Tcp:
         assert(pkt->hasip6);
         assert(pkt->l4hdr_info.proto == ETH_L4_HDR_PROTO_TCP);
         trace_net_rx_pkt_rss_ip6_tcp();
-        _net_rx_rss_prepare_ip6(&rss_input[0], pkt, false, &rss_length);
-        _net_rx_rss_prepare_tcp(&rss_input[0], pkt, &rss_length);
+        _net_rx_rss_prepare_ip6(rss_input, pkt, false, rss_length);
+        _net_rx_rss_prepare_tcp(rss_input, pkt, rss_length);
         break;
     case NetPktRssIpV6:
         assert(pkt->hasip6);
         trace_net_rx_pkt_rss_ip6();
-        _net_rx_rss_prepare_ip6(&rss_input[0], pkt, false, &rss_length);
+        _net_rx_rss_prepare_ip6(rss_input, pkt, false, rss_length);
         break;
     case NetPktRssIpV6Ex:
         assert(pkt->hasip6);
         trace_net_rx_pkt_rss_ip6_ex();
-        _net_rx_rss_prepare_ip6(&rss_input[0], pkt, true, &rss_length);
+        _net_rx_rss_prepare_ip6(rss_input, pkt, true, rss_length);
         break;
     case NetPktRssIpV6TcpEx:
         assert(pkt->hasip6);
         assert(pkt->l4hdr_info.proto == ETH_L4_HDR_PROTO_TCP);
         trace_net_rx_pkt_rss_ip6_ex_tcp();
-        _net_rx_rss_prepare_ip6(&rss_input[0], pkt, true, &rss_length);
-        _net_rx_rss_prepare_tcp(&rss_input[0], pkt, &rss_length);
+        _net_rx_rss_prepare_ip6(rss_input, pkt, true, rss_length);
+        _net_rx_rss_prepare_tcp(rss_input, pkt, rss_length);
         break;
     case NetPktRssIpV4Udp:
         assert(pkt->hasip4);
         assert(pkt->l4hdr_info.proto == ETH_L4_HDR_PROTO_UDP);
         trace_net_rx_pkt_rss_ip4_udp();
-        _net_rx_rss_prepare_ip4(&rss_input[0], pkt, &rss_length);
-        _net_rx_rss_prepare_udp(&rss_input[0], pkt, &rss_length);
+        _net_rx_rss_prepare_ip4(rss_input, pkt, rss_length);
+        _net_rx_rss_prepare_udp(rss_input, pkt, rss_length);
         break;
     case NetPktRssIpV6Udp:
         assert(pkt->hasip6);
         assert(pkt->l4hdr_info.proto == ETH_L4_HDR_PROTO_UDP);
         trace_net_rx_pkt_rss_ip6_udp();
-        _net_rx_rss_prepare_ip6(&rss_input[0], pkt, false, &rss_length);
-        _net_rx_rss_prepare_udp(&rss_input[0], pkt, &rss_length);
+        _net_rx_rss_prepare_ip6(rss_input, pkt, false, rss_length);
+        _net_rx_rss_prepare_udp(rss_input, pkt, rss_length);
         break;
     case NetPktRssIpV6UdpEx:
         assert(pkt->hasip6);
         assert(pkt->l4hdr_info.proto == ETH_L4_HDR_PROTO_UDP);
         trace_net_rx_pkt_rss_ip6_ex_udp();
-        _net_rx_rss_prepare_ip6(&rss_input[0], pkt, true, &rss_length);
-        _net_rx_rss_prepare_udp(&rss_input[0], pkt, &rss_length);
+        _net_rx_rss_prepare_ip6(rss_input, pkt, true, rss_length);
+        _net_rx_rss_prepare_udp(rss_input, pkt, rss_length);
         break;
     default:
         assert(false);
         break;
     }
+}
+
+uint32_t
+net_rx_pkt_calc_rss_hash(struct NetRxPkt *pkt,
+                         NetRxPktRssType type,
+                         uint8_t *key)
+{
+    uint8_t rss_input[NET_TOEPLITZ_MAX_INPUT];
+    size_t rss_length = 0;
+    uint32_t rss_hash = 0;
+    net_toeplitz_key key_data;
+
+    net_rx_pkt_get_rss_input(pkt, type, rss_input, &rss_length);
 
     net_toeplitz_key_init(&key_data, key);
     net_toeplitz_add(&rss_hash, rss_input, rss_length, &key_data);
@@ -387,6 +394,24 @@ net_rx_pkt_calc_rss_hash(struct NetRxPkt *pkt,
     return rss_hash;
 }
 
+uint32_t
+net_rx_pkt_calc_rss_hash_table(struct NetRxPkt *pkt,
+                               NetRxPktRssType type,
+                               const net_toeplitz_table *table)
+{
+    uint8_t rss_input[NET_TOEPLITZ_MAX_INPUT];
+    size_t rss_length = 0;
+    uint32_t rss_hash;
+
+    net_rx_pkt_get_rss_input(pkt, type, rss_input, &rss_length);
+
+    rss_hash = net_toeplitz_table_hash(table, rss_input, rss_length);
+
+    trace_net_rx_pkt_rss_hash(rss_length, rss_hash);
+
+    return rss_hash;
+}
+
 uint16_t net_rx_pkt_get_ip_id(struct NetRxPkt *pkt)
 {
     assert(pkt);
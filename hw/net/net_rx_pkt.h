@@ -19,6 +19,7 @@
 #define NET_RX_PKT_H
 
 #include "net/eth.h"
+#include "net/checksum.h"
 
 /* defines to enable packet dump functions */
 /*#define NET_RX_PKT_DEBUG*/
@@ -145,6 +146,22 @@ net_rx_pkt_calc_rss_hash(struct NetRxPkt *pkt,
                          NetRxPktRssType type,
                          uint8_t *key);
 
+/**
+* calculates RSS hash for packet with a key precomputed by
+* net_toeplitz_table_init()
+*
+* @pkt:            packet
+* @type:           RSS hash type
+* @table:          precomputed key
+*
+* Return:  Toeplitz RSS hash.
+*
+*/
+uint32_t
+net_rx_pkt_calc_rss_hash_table(struct NetRxPkt *pkt,
+                               NetRxPktRssType type,
+                               const net_toeplitz_table *table);
+
 /**
 * fetches IP identification for the packet
 *
@@ -639,6 +639,7 @@ static void net_tx_pkt_tcp_fragment_deinit(struct iovec *fragment)
 
 static void net_tx_pkt_tcp_fragment_fix(struct NetTxPkt *pkt,
                                         struct iovec *fragment,
+                                        size_t fragment_offset,
                                         size_t fragment_len,
                                         uint8_t gso_type)
 {
@@ -650,8 +651,15 @@ static void net_tx_pkt_tcp_fragment_fix(struct NetTxPkt *pkt,
 
     switch (gso_type) {
     case VIRTIO_NET_HDR_GSO_TCPV4:
-        ip->ip_len = cpu_to_be16(len);
-        eth_fix_ip4_checksum(l3hdr->iov_base, l3hdr->iov_len);
+        if (!fragment_offset) {
+            ip->ip_len = cpu_to_be16(len);
+            eth_fix_ip4_checksum(l3hdr->iov_base, l3hdr->iov_len);
+        } else {
+            /* The checksum is valid since the first segment, update it */
+            ip->ip_sum = cpu_to_be16(net_checksum_update16(
+                be16_to_cpu(ip->ip_sum), be16_to_cpu(ip->ip_len), len));
+            ip->ip_len = cpu_to_be16(len);
+        }
         break;
 
     case VIRTIO_NET_HDR_GSO_TCPV6:
@@ -672,7 +680,11 @@ static void net_tx_pkt_tcp_fragment_advance(struct NetTxPkt *pkt,
     struct tcp_hdr *th = l4hdr->iov_base;
 
     if (gso_type == VIRTIO_NET_HDR_GSO_TCPV4) {
-        ip->ip_id = cpu_to_be16(be16_to_cpu(ip->ip_id) + 1);
+        uint16_t id = be16_to_cpu(ip->ip_id);
+
+        ip->ip_id = cpu_to_be16(id + 1);
+        ip->ip_sum = cpu_to_be16(net_checksum_update16(
+            be16_to_cpu(ip->ip_sum), id, id + 1));
     }
 
     th->th_seq = cpu_to_be32(be32_to_cpu(th->th_seq) + fragment_len);
@@ -773,7 +785,8 @@ static bool net_tx_pkt_do_sw_fragmentation(struct NetTxPkt *pkt,
         switch (gso_type) {
         case VIRTIO_NET_HDR_GSO_TCPV4:
         case VIRTIO_NET_HDR_GSO_TCPV6:
-            net_tx_pkt_tcp_fragment_fix(pkt, fragment, fragment_len, gso_type);
+            net_tx_pkt_tcp_fragment_fix(pkt, fragment, fragment_offset,
+                                        fragment_len, gso_type);
             net_tx_pkt_do_sw_csum(pkt, fragment + NET_TX_PKT_L2HDR_FRAG,
                                   dst_idx - NET_TX_PKT_L2HDR_FRAG,
                                   l4hdr_len + fragment_len);
@@ -127,3 +127,8 @@ void vhost_net_save_acked_features(NetClientState *nc)
 {
 
 }
+
+void vhost_net_free_inflight(NetClientState *nc)
+{
+
+}
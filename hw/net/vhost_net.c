@@ -47,6 +47,7 @@ static const int kernel_feature_bits[] = {
     VIRTIO_NET_F_MTU,
     VIRTIO_F_IOMMU_PLATFORM,
     VIRTIO_F_RING_PACKED,
+    VIRTIO_F_IN_ORDER,
     VIRTIO_F_RING_RESET,
     VIRTIO_NET_F_HASH_REPORT,
     VHOST_INVALID_FEATURE_BIT
@@ -75,6 +76,7 @@ static const int user_feature_bits[] = {
     VIRTIO_NET_F_MTU,
     VIRTIO_F_IOMMU_PLATFORM,
     VIRTIO_F_RING_PACKED,
+    VIRTIO_F_IN_ORDER,
     VIRTIO_F_RING_RESET,
     VIRTIO_NET_F_RSS,
     VIRTIO_NET_F_HASH_REPORT,
@@ -253,6 +255,60 @@ static void vhost_net_set_vq_index(struct vhost_net *net, int vq_index,
     net->dev.vq_index_end = vq_index_end;
 }
 
+/*
+ * Share with a vhost-user backend the region where it tracks the
+ * descriptors it is processing, so that a restarted backend can resubmit
+ * them and resume from the ring state instead of losing them.  The region
+ * covers all the queues of the device and is set up through the first queue
+ * pair; it is kept across reconnections and dropped on device reset.
+ */
+static int vhost_net_set_inflight(struct vhost_net *net, VirtIODevice *dev)
+{
+#ifdef CONFIG_VHOST_NET_USER
+    VirtIONet *n = VIRTIO_NET(dev);
+    struct vhost_inflight *inflight;
+    int r;
+
+    if (net->nc->info->type != NET_CLIENT_DRIVER_VHOST_USER ||
+        net->dev.vq_index != 0) {
+        return 0;
+    }
+
+    inflight = vhost_user_get_inflight(net->nc);
+    if (!inflight) {
+        return 0;
+    }
+
+    r = vhost_dev_prepare_inflight(&net->dev, dev);
+    if (r < 0) {
+        return r;
+    }
+
+    if (!inflight->addr) {
+        r = vhost_dev_get_inflight(&net->dev,
+                                   MAX(n->net_conf.rx_queue_size,
+                                       n->net_conf.tx_queue_size),
+                                   inflight);
+        if (r < 0) {
+            return r;
+        }
+    }
+
+    return vhost_dev_set_inflight(&net->dev, inflight);
+#else
+    return 0;
+#endif
+}
+
+void vhost_net_free_inflight(NetClientState *nc)
+{
+#ifdef CONFIG_VHOST_NET_USER
+    if (nc->info->type == NET_CLIENT_DRIVER_VHOST_USER) {
+        vhost_dev_free_inflight(vhost_user_get_inflight(nc));
+    }
+#endif
+}
+
 static int vhost_net_start_one(struct vhost_net *net,
                                VirtIODevice *dev)
 {
@@ -271,6 +327,11 @@ static int vhost_net_start_one(struct vhost_net *net,
         goto fail_notifiers;
     }
 
+    r = vhost_net_set_inflight(net, dev);
+    if (r < 0) {
+        goto fail_start;
+    }
+
     r = vhost_dev_start(&net->dev, dev, false);
     if (r < 0) {
         goto fail_start;
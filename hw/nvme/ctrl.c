@@ -192,6 +192,7 @@
 
 #include "qemu/osdep.h"
 #include "qemu/cutils.h"
+#include "qemu/defer-call.h"
 #include "qemu/error-report.h"
 #include "qemu/log.h"
 #include "qemu/units.h"
@@ -854,6 +855,20 @@ static uint16_t nvme_map_addr(NvmeCtrl *n, NvmeSg *sg, hwaddr addr, size_t len)
         return NVME_INVALID_USE_OF_CMB | NVME_DNR;
     }
 
+    /*
+     * Guest pages are often contiguous; extend the previous entry so that
+     * the DMA helpers map them all at once instead of page by page.
+     */
+    if (sg->qsg.nsg) {
+        ScatterGatherEntry *last = &sg->qsg.sg[sg->qsg.nsg - 1];
+
+        if (last->base + last->len == addr) {
+            last->len += len;
+            sg->qsg.size += len;
+            return NVME_SUCCESS;
+        }
+    }
+
     if (sg->qsg.nsg + 1 > IOV_MAX) {
         goto max_mappings_exceeded;
     }
@@ -901,9 +916,11 @@ static uint16_t nvme_map_prp(NvmeCtrl *n, NvmeSg *sg, uint64_t prp1,
             /*
              * The first PRP list entry, pointed to by PRP2 may contain offset.
              * Hence, we need to calculate the number of entries in based on
-             * that offset.
+             * that offset.  Only read the entries that the transfer uses,
+             * the list page need not be filled.
              */
             nents = (n->page_size - (prp2 & (n->page_size - 1))) >> 3;
+            nents = MIN(nents, DIV_ROUND_UP(len, n->page_size));
             prp_trans = MIN(n->max_prp_ents, nents) * sizeof(uint64_t);
             ret = nvme_addr_read(n, prp2, (void *)prp_list, prp_trans);
             if (ret) {
@@ -7018,6 +7035,13 @@ static void nvme_process_sq(void *opaque)
         nvme_update_sq_tail(sq);
     }
 
+    /*
+     * Let the block layer submit the requests of all the commands fetched
+     * in one go, e.g. with a single io_uring_enter() for Linux AIO and
+     * io_uring.
+     */
+    defer_call_begin();
+
     while (!(nvme_sq_empty(sq) || QTAILQ_EMPTY(&sq->req_list))) {
         addr = sq->dma_addr + (sq->head << NVME_SQES);
         if (nvme_addr_read(n, addr, (void *)&cmd, sizeof(cmd))) {
@@ -7047,6 +7071,8 @@ static void nvme_process_sq(void *opaque)
             nvme_update_sq_tail(sq);
         }
     }
+
+    defer_call_end();
 }
 
 static void nvme_update_msixcap_ts(PCIDevice *pci_dev, uint32_t table_size)
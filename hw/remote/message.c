@@ -24,7 +24,8 @@ static void process_config_write(QIOChannel *ioc, PCIDevice *dev,
                                  MPQemuMsg *msg, Error **errp);
 static void process_config_read(QIOChannel *ioc, PCIDevice *dev,
                                 MPQemuMsg *msg, Error **errp);
-static void process_bar_write(QIOChannel *ioc, MPQemuMsg *msg, Error **errp);
+static void process_bar_write(QIOChannel *ioc, MPQemuMsg *msg, bool posted,
+                              Error **errp);
 static void process_bar_read(QIOChannel *ioc, MPQemuMsg *msg, Error **errp);
 static void process_device_reset_msg(QIOChannel *ioc, PCIDevice *dev,
                                      Error **errp);
@@ -60,7 +61,10 @@ void coroutine_fn mpqemu_remote_msg_loop_co(void *data)
             process_config_read(com->ioc, pci_dev, &msg, &local_err);
             break;
         case MPQEMU_CMD_BAR_WRITE:
-            process_bar_write(com->ioc, &msg, &local_err);
+            process_bar_write(com->ioc, &msg, false, &local_err);
+            break;
+        case MPQEMU_CMD_BAR_WRITE_POSTED:
+            process_bar_write(com->ioc, &msg, true, &local_err);
             break;
         case MPQEMU_CMD_BAR_READ:
             process_bar_read(com->ioc, &msg, &local_err);
@@ -138,7 +142,8 @@ static void process_config_read(QIOChannel *ioc, PCIDevice *dev,
     }
 }
 
-static void process_bar_write(QIOChannel *ioc, MPQemuMsg *msg, Error **errp)
+static void process_bar_write(QIOChannel *ioc, MPQemuMsg *msg, bool posted,
+                              Error **errp)
 {
     ERRP_GUARD();
     BarAccessMsg *bar_access = &msg->data.bar_access;
@@ -166,6 +171,10 @@ static void process_bar_write(QIOChannel *ioc, MPQemuMsg *msg, Error **errp)
     }
 
 fail:
+    if (posted) {
+        return;
+    }
+
     ret.cmd = MPQEMU_CMD_RET;
     ret.size = sizeof(ret.data.u64);
 
@@ -212,6 +212,20 @@ uint64_t mpqemu_msg_send_and_await_reply(MPQemuMsg *msg, PCIProxyDev *pdev,
     return msg_reply.data.u64;
 }
 
+/*
+ * Send msg, for which the remote process sends no reply.
+ * Messages are processed in order by the remote process, so a later
+ * mpqemu_msg_send_and_await_reply() also waits for this one.
+ * Called from VCPU thread in non-coroutine context.
+ */
+bool mpqemu_msg_send_posted(MPQemuMsg *msg, PCIProxyDev *pdev, Error **errp)
+{
+    assert(!qemu_in_coroutine());
+
+    QEMU_LOCK_GUARD(&pdev->io_mutex);
+    return mpqemu_msg_send(msg, pdev->ioc, errp);
+}
+
 bool mpqemu_msg_valid(MPQemuMsg *msg)
 {
     if (msg->cmd >= MPQEMU_CMD_MAX || msg->cmd < 0) {
@@ -245,6 +259,7 @@ bool mpqemu_msg_valid(MPQemuMsg *msg)
         }
         break;
     case MPQEMU_CMD_BAR_WRITE:
+    case MPQEMU_CMD_BAR_WRITE_POSTED:
     case MPQEMU_CMD_BAR_READ:
         if ((msg->size != sizeof(BarAccessMsg)) || (msg->num_fds != 0)) {
             return false;
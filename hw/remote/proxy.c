@@ -242,6 +242,19 @@ static void send_bar_access_msg(PCIProxyDev *pdev, MemoryRegion *mr,
     msg.data.bar_access.size = size;
     msg.data.bar_access.memory = memory;
 
+    if (write && memory) {
+        /*
+         * Like on PCI, memory writes are posted: the vCPU doesn't wait for
+         * the remote process, which handles the messages in order anyway.
+         */
+        msg.cmd = MPQEMU_CMD_BAR_WRITE_POSTED;
+        msg.data.bar_access.val = *val;
+        if (!mpqemu_msg_send_posted(&msg, pdev, &local_err)) {
+            error_report_err(local_err);
+        }
+        return;
+    }
+
     if (write) {
         msg.cmd = MPQEMU_CMD_BAR_WRITE;
         msg.data.bar_access.val = *val;
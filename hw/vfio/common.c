@@ -34,6 +34,7 @@
 #include "qemu/error-report.h"
 #include "qemu/main-loop.h"
 #include "qemu/range.h"
+#include "qemu/units.h"
 #include "sysemu/kvm.h"
 #include "sysemu/reset.h"
 #include "sysemu/runstate.h"
@@ -558,6 +559,93 @@ static bool vfio_get_section_iova_range(VFIOContainerBase *bcontainer,
     return true;
 }
 
+/*
+ * While the listener of a container is being registered, large RAM
+ * sections are mapped from worker threads, so that the kernel can pin
+ * their pages in parallel.  vfio_listener_wait_dma_maps() collects them.
+ */
+#define VFIO_DMA_MAP_JOB_MIN_SIZE   (1 * GiB)
+#define VFIO_DMA_MAP_JOBS_MAX       8
+
+typedef struct VFIODMAMapJob {
+    VFIOContainerBase *bcontainer;
+    MemoryRegion *mr;
+    hwaddr iova;
+    ram_addr_t size;
+    void *vaddr;
+    bool readonly;
+    int ret;
+    QemuThread thread;
+} VFIODMAMapJob;
+
+static void *vfio_dma_map_job_thread(void *opaque)
+{
+    VFIODMAMapJob *job = opaque;
+
+    job->ret = vfio_container_dma_map(job->bcontainer, job->iova, job->size,
+                                      job->vaddr, job->readonly);
+    return NULL;
+}
+
+static void vfio_dma_map_job_join(VFIODMAMapJob *job)
+{
+    VFIOContainerBase *bcontainer = job->bcontainer;
+
+    qemu_thread_join(&job->thread);
+    trace_vfio_dma_map_job_join(job->iova, job->size, job->ret);
+
+    /* Same as a failure of the synchronous path on the initfn path */
+    if (job->ret && !bcontainer->error) {
+        error_setg(&bcontainer->error, "Region %s: vfio_container_dma_map(%p, "
+                   "0x%"HWADDR_PRIx", 0x"RAM_ADDR_FMT", %p) = %d (%s)",
+                   memory_region_name(job->mr), bcontainer, job->iova,
+                   job->size, job->vaddr, job->ret, strerror(-job->ret));
+    }
+    g_free(job);
+}
+
+static void vfio_dma_map_job_start(VFIOContainerBase *bcontainer,
+                                   MemoryRegion *mr, hwaddr iova,
+                                   ram_addr_t size, void *vaddr,
+                                   bool readonly)
+{
+    VFIODMAMapJob *job = g_new0(VFIODMAMapJob, 1);
+
+    if (g_queue_get_length(bcontainer->dma_map_jobs) >= VFIO_DMA_MAP_JOBS_MAX) {
+        vfio_dma_map_job_join(g_queue_pop_head(bcontainer->dma_map_jobs));
+    }
+
+    job->bcontainer = bcontainer;
+    job->mr = mr;
+    job->iova = iova;
+    job->size = size;
+    job->vaddr = vaddr;
+    job->readonly = readonly;
+    trace_vfio_dma_map_job_start(iova, size);
+    qemu_thread_create(&job->thread, "vfio-dma-map", vfio_dma_map_job_thread,
+                       job, QEMU_THREAD_JOINABLE);
+    g_queue_push_tail(bcontainer->dma_map_jobs, job);
+}
+
+/*
+ * Register the memory listener of @bcontainer, mapping its large RAM
+ * sections in parallel.  As with memory_listener_register(), errors are
+ * left in bcontainer->error.
+ */
+void vfio_listener_register_parallel(VFIOContainerBase *bcontainer)
+{
+    VFIODMAMapJob *job;
+
+    bcontainer->dma_map_jobs = g_queue_new();
+    memory_listener_register(&bcontainer->listener, bcontainer->space->as);
+
+    while ((job = g_queue_pop_head(bcontainer->dma_map_jobs))) {
+        vfio_dma_map_job_join(job);
+    }
+    g_queue_free(bcontainer->dma_map_jobs);
+    bcontainer->dma_map_jobs = NULL;
+}
+
 static void vfio_listener_region_add(MemoryListener *listener,
                                      MemoryRegionSection *section)
 {
@@ -682,6 +770,13 @@ static void vfio_listener_region_add(MemoryListener *listener,
         }
     }
 
+    if (bcontainer->dma_map_jobs && !memory_region_is_ram_device(section->mr) &&
+        int128_get64(llsize) >= VFIO_DMA_MAP_JOB_MIN_SIZE) {
+        vfio_dma_map_job_start(bcontainer, section->mr, iova,
+                               int128_get64(llsize), vaddr, section->readonly);
+        return;
+    }
+
     ret = vfio_container_dma_map(bcontainer, iova, int128_get64(llsize),
                                  vaddr, section->readonly);
     if (ret) {
@@ -49,6 +49,30 @@ static int iommufd_cdev_unmap(const VFIOContainerBase *bcontainer,
                                      container->ioas_id, iova, size);
 }
 
+static int iommufd_cdev_set_dirty_page_tracking(
+                                       const VFIOContainerBase *bcontainer,
+                                       bool start)
+{
+    const VFIOIOMMUFDContainer *container =
+        container_of(bcontainer, VFIOIOMMUFDContainer, bcontainer);
+
+    return iommufd_backend_set_dirty_tracking(container->be,
+                                              container->hwpt_id, start);
+}
+
+static int iommufd_cdev_query_dirty_bitmap(const VFIOContainerBase *bcontainer,
+                                           VFIOBitmap *vbmap,
+                                           hwaddr iova, hwaddr size)
+{
+    const VFIOIOMMUFDContainer *container =
+        container_of(bcontainer, VFIOIOMMUFDContainer, bcontainer);
+
+    return iommufd_backend_get_dirty_bitmap(container->be, container->hwpt_id,
+                                            iova, size,
+                                            qemu_real_host_page_size(),
+                                            (uint64_t *)vbmap->bitmap);
+}
+
 static int iommufd_cdev_kvm_device_add(VFIODevice *vbasedev, Error **errp)
 {
     return vfio_kvm_device_add_fd(vbasedev->fd, errp);
@@ -220,7 +244,9 @@ static int iommufd_cdev_attach_container(VFIODevice *vbasedev,
                                          VFIOIOMMUFDContainer *container,
                                          Error **errp)
 {
-    return iommufd_cdev_attach_ioas_hwpt(vbasedev, container->ioas_id, errp);
+    return iommufd_cdev_attach_ioas_hwpt(vbasedev,
+                                         container->hwpt_id ?:
+                                         container->ioas_id, errp);
 }
 
 static void iommufd_cdev_detach_container(VFIODevice *vbasedev,
@@ -242,10 +268,50 @@ static void iommufd_cdev_container_destroy(VFIOIOMMUFDContainer *container)
     }
     memory_listener_unregister(&bcontainer->listener);
     vfio_container_destroy(bcontainer);
+    if (container->hwpt_id) {
+        iommufd_backend_free_id(container->be, container->hwpt_id);
+    }
     iommufd_backend_free_id(container->be, container->ioas_id);
     g_free(container);
 }
 
+/*
+ * If the IOMMU of the device can track DMA writes, allocate a hwpt with
+ * dirty tracking on the IOAS of the new container, for the devices of the
+ * container to attach to.  Otherwise they attach to the IOAS directly and
+ * the kernel picks the domain, without dirty tracking.
+ */
+static void iommufd_cdev_container_dirty_tracking_init(
+                                           VFIODevice *vbasedev,
+                                           VFIOIOMMUFDContainer *container)
+{
+    uint64_t caps;
+    uint32_t hwpt_id;
+    Error *err = NULL;
+
+    if (iommufd_backend_get_device_caps(container->be, vbasedev->devid,
+                                        &caps, &err)) {
+        error_free(err);
+        return;
+    }
+    if (!(caps & IOMMU_HW_CAP_DIRTY_TRACKING)) {
+        return;
+    }
+
+    if (iommufd_backend_alloc_hwpt(container->be, vbasedev->devid,
+                                   container->ioas_id,
+                                   IOMMU_HWPT_ALLOC_DIRTY_TRACKING,
+                                   &hwpt_id, &err)) {
+        warn_report_err(err);
+        return;
+    }
+
+    trace_iommufd_cdev_alloc_dirty_hwpt(container->be->fd, container->ioas_id,
+                                        hwpt_id);
+    container->hwpt_id = hwpt_id;
+    container->bcontainer.dirty_pages_supported = true;
+}
+
 static int iommufd_cdev_ram_block_discard_disable(bool state)
 {
     /*
@@ -371,6 +437,8 @@ static int iommufd_cdev_attach(const char *name, VFIODevice *vbasedev,
     vfio_container_init(bcontainer, space, iommufd_vioc);
     QLIST_INSERT_HEAD(&space->containers, bcontainer, next);
 
+    iommufd_cdev_container_dirty_tracking_init(vbasedev, container);
+
     ret = iommufd_cdev_attach_container(vbasedev, container, errp);
     if (ret) {
         goto err_attach_container;
@@ -391,7 +459,7 @@ static int iommufd_cdev_attach(const char *name, VFIODevice *vbasedev,
     }
 
     bcontainer->listener = vfio_memory_listener;
-    memory_listener_register(&bcontainer->listener, bcontainer->space->as);
+    vfio_listener_register_parallel(bcontainer);
 
     if (bcontainer->error) {
         ret = -1;
@@ -631,6 +699,8 @@ static void vfio_iommu_iommufd_class_init(ObjectClass *klass, void *data)
     vioc->dma_unmap = iommufd_cdev_unmap;
     vioc->attach_device = iommufd_cdev_attach;
     vioc->detach_device = iommufd_cdev_detach;
+    vioc->set_dirty_page_tracking = iommufd_cdev_set_dirty_page_tracking;
+    vioc->query_dirty_bitmap = iommufd_cdev_query_dirty_bitmap;
     vioc->pci_hot_reset = iommufd_cdev_pci_hot_reset;
 };
 
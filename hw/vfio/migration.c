@@ -11,6 +11,7 @@
 #include "qemu/main-loop.h"
 #include "qemu/cutils.h"
 #include "qemu/units.h"
+#include "qemu/stats64.h"
 #include "qemu/error-report.h"
 #include <linux/vfio.h>
 #include <sys/ioctl.h>
@@ -54,7 +55,7 @@
  */
 #define VFIO_MIG_DEFAULT_DATA_BUFFER_SIZE (1 * MiB)
 
-static int64_t bytes_transferred;
+static Stat64 bytes_transferred;
 
 static const char *mig_state_to_str(enum vfio_device_mig_state state)
 {
@@ -178,9 +179,38 @@ static int vfio_load_buffer(QEMUFile *f, VFIODevice *vbasedev,
                             uint64_t data_size)
 {
     VFIOMigration *migration = vbasedev->migration;
-    int ret;
+    uint64_t remaining = data_size;
+    int ret = 0;
+
+    /*
+     * Feed the device in chunks of data_buffer_size rather than in pieces
+     * of the size of the QEMUFile buffer, each write() to data_fd can be
+     * costly for the device driver.
+     */
+    while (remaining) {
+        size_t len = MIN(remaining, migration->data_buffer_size);
+        size_t done;
+
+        if (qemu_get_buffer(f, migration->data_buffer, len) != len) {
+            ret = qemu_file_get_error(f) ?: -EIO;
+            break;
+        }
+
+        for (done = 0; done < len;) {
+            ssize_t rc = write(migration->data_fd,
+                               (uint8_t *)migration->data_buffer + done,
+                               len - done);
 
-    ret = qemu_file_get_to_fd(f, migration->data_fd, data_size);
+            if (rc <= 0) {
+                ret = rc < 0 ? -errno : -EIO;
+                goto out;
+            }
+            done += rc;
+        }
+        remaining -= len;
+    }
+
+out:
     trace_vfio_load_state_device_data(vbasedev->name, data_size, ret);
 
     return ret;
@@ -304,8 +334,13 @@ static ssize_t vfio_save_block(QEMUFile *f, VFIOMigration *migration)
 
     qemu_put_be64(f, VFIO_MIG_FLAG_DEV_DATA_STATE);
     qemu_put_be64(f, data_size);
-    qemu_put_buffer(f, migration->data_buffer, data_size);
-    bytes_transferred += data_size;
+    /*
+     * Send the block with a single writev() instead of copying it through
+     * the QEMUFile buffer, but flush before data_buffer is reused.
+     */
+    qemu_put_buffer_async(f, migration->data_buffer, data_size, false);
+    qemu_fflush(f);
+    stat64_add(&bytes_transferred, data_size);
 
     trace_vfio_save_block(migration->vbasedev->name, data_size);
 
@@ -583,16 +618,28 @@ static void vfio_save_state(QEMUFile *f, void *opaque)
 static int vfio_load_setup(QEMUFile *f, void *opaque)
 {
     VFIODevice *vbasedev = opaque;
+    VFIOMigration *migration = vbasedev->migration;
+
+    migration->data_buffer_size = VFIO_MIG_DEFAULT_DATA_BUFFER_SIZE;
+    migration->data_buffer = g_try_malloc0(migration->data_buffer_size);
+    if (!migration->data_buffer) {
+        error_report("%s: Failed to allocate migration data buffer",
+                     vbasedev->name);
+        return -ENOMEM;
+    }
 
     return vfio_migration_set_state(vbasedev, VFIO_DEVICE_STATE_RESUMING,
-                                   vbasedev->migration->device_state);
+                                   migration->device_state);
 }
 
 static int vfio_load_cleanup(void *opaque)
 {
     VFIODevice *vbasedev = opaque;
+    VFIOMigration *migration = vbasedev->migration;
 
     vfio_migration_cleanup(vbasedev);
+    g_free(migration->data_buffer);
+    migration->data_buffer = NULL;
     trace_vfio_load_cleanup(vbasedev->name);
 
     return 0;
@@ -685,7 +732,7 @@ static const SaveVMHandlers savevm_vfio_handlers = {
     .state_pending_exact = vfio_state_pending_exact,
     .is_active_iterate = vfio_is_active_iterate,
     .save_live_iterate = vfio_save_iterate,
-    .save_live_complete_precopy = vfio_save_complete_precopy,
+    .save_live_complete_precopy_thread = vfio_save_complete_precopy,
     .save_state = vfio_save_state,
     .load_setup = vfio_load_setup,
     .load_cleanup = vfio_load_cleanup,
@@ -892,12 +939,12 @@ static int vfio_block_migration(VFIODevice *vbasedev, Error *err, Error **errp)
 
 int64_t vfio_mig_bytes_transferred(void)
 {
-    return bytes_transferred;
+    return stat64_get(&bytes_transferred);
 }
 
 void vfio_reset_bytes_transferred(void)
 {
-    bytes_transferred = 0;
+    stat64_set(&bytes_transferred, 0);
 }
 
 /*
@@ -931,7 +978,12 @@ bool vfio_migration_realize(VFIODevice *vbasedev, Error **errp)
         return !vfio_block_migration(vbasedev, err, errp);
     }
 
-    if (!vbasedev->dirty_pages_supported) {
+    /*
+     * Without device dirty tracking, IOMMUFD dirty tracking of the IOMMU
+     * still gives precise dirty pages.
+     */
+    if (!vbasedev->dirty_pages_supported &&
+        !(vbasedev->iommufd && vbasedev->bcontainer->dirty_pages_supported)) {
         if (vbasedev->enable_migration == ON_OFF_AUTO_AUTO) {
             error_setg(&err,
                        "%s: VFIO device doesn't support device dirty tracking",
@@ -9,15 +9,32 @@
 
 #include "qemu/osdep.h"
 #include "qemu/iova-tree.h"
+#include "qemu/interval-tree.h"
+#include "qemu/lockable.h"
+#include "qemu/atomic.h"
 #include "vhost-iova-tree.h"
 
 #define iova_min_addr qemu_real_host_page_size()
 
+/* A mapping, linked in both trees */
+typedef struct VhostIOVAMap {
+    DMAMap map;
+
+    /* Node keyed by map.iova */
+    IntervalTreeNode iova_node;
+
+    /* Node keyed by map.translated_addr */
+    IntervalTreeNode taddr_node;
+} VhostIOVAMap;
+
 /**
  * VhostIOVATree, able to:
  * - Translate iova address
  * - Reverse translate iova address (from translated to iova)
  * - Allocate IOVA regions for translated range (linear operation)
+ *
+ * The mappings are indexed by interval trees in both address spaces, so
+ * that translations in either direction are logarithmic.
  */
 struct VhostIOVATree {
     /* First addressable iova address in the device */
@@ -27,7 +44,19 @@ struct VhostIOVATree {
     uint64_t iova_last;
 
     /* IOVA address to qemu memory maps. */
-    IOVATree *iova_taddr_map;
+    IntervalTreeRoot iova_root;
+
+    /* Qemu memory to IOVA address maps. */
+    IntervalTreeRoot taddr_root;
+
+    /* Incremented when mappings are removed, see vhost_iova_tree_gen() */
+    unsigned int gen;
+
+    /*
+     * Taken by the modifications of the tree, which happen with the BQL
+     * held, and by the lookups from other threads.
+     */
+    QemuMutex lock;
 };
 
 /**
@@ -37,22 +66,38 @@ struct VhostIOVATree {
  */
 VhostIOVATree *vhost_iova_tree_new(hwaddr iova_first, hwaddr iova_last)
 {
-    VhostIOVATree *tree = g_new(VhostIOVATree, 1);
+    VhostIOVATree *tree = g_new0(VhostIOVATree, 1);
 
     /* Some devices do not like 0 addresses */
     tree->iova_first = MAX(iova_first, iova_min_addr);
     tree->iova_last = iova_last;
+    tree->gen = 1;
 
-    tree->iova_taddr_map = iova_tree_new();
+    qemu_mutex_init(&tree->lock);
     return tree;
 }
 
+static void vhost_iova_tree_remove_map(VhostIOVATree *tree, VhostIOVAMap *m)
+{
+    interval_tree_remove(&m->iova_node, &tree->iova_root);
+    interval_tree_remove(&m->taddr_node, &tree->taddr_root);
+    g_free(m);
+}
+
 /**
  * Delete an iova tree
  */
 void vhost_iova_tree_delete(VhostIOVATree *iova_tree)
 {
-    iova_tree_destroy(iova_tree->iova_taddr_map);
+    IntervalTreeNode *node;
+
+    while ((node = interval_tree_iter_first(&iova_tree->iova_root,
+                                            0, UINT64_MAX))) {
+        vhost_iova_tree_remove_map(iova_tree,
+                                   container_of(node, VhostIOVAMap,
+                                                iova_node));
+    }
+    qemu_mutex_destroy(&iova_tree->lock);
     g_free(iova_tree);
 }
 
@@ -64,10 +109,77 @@ void vhost_iova_tree_delete(VhostIOVATree *iova_tree)
  *
  * Return the stored mapping, or NULL if not found.
  */
-const DMAMap *vhost_iova_tree_find_iova(const VhostIOVATree *tree,
+const DMAMap *vhost_iova_tree_find_iova(VhostIOVATree *tree,
                                         const DMAMap *map)
 {
-    return iova_tree_find_iova(tree->iova_taddr_map, map);
+    IntervalTreeNode *node;
+
+    node = interval_tree_iter_first(&tree->taddr_root, map->translated_addr,
+                                    map->translated_addr + map->size);
+    return node ? &container_of(node, VhostIOVAMap, taddr_node)->map : NULL;
+}
+
+/**
+ * Find the IOVA address stored from a memory address, outside of the BQL
+ *
+ * @tree: The iova tree
+ * @map: The map with the memory address
+ * @result: Where to copy the stored mapping
+ *
+ * Return true if the mapping was found.
+ */
+bool vhost_iova_tree_find_iova_copy(VhostIOVATree *tree, const DMAMap *map,
+                                    DMAMap *result)
+{
+    const DMAMap *found;
+
+    QEMU_LOCK_GUARD(&tree->lock);
+    found = vhost_iova_tree_find_iova(tree, map);
+    if (found) {
+        *result = *found;
+    }
+    return found;
+}
+
+/**
+ * Get the generation of the tree
+ *
+ * A mapping obtained when the generation was @gen is still valid as long as
+ * vhost_iova_tree_gen() keeps returning @gen, which allows to cache it.
+ */
+unsigned int vhost_iova_tree_gen(VhostIOVATree *tree)
+{
+    return qatomic_read(&tree->gen);
+}
+
+/*
+ * Find the lowest hole of @size + 1 bytes in [@iova_first, @iova_last].
+ * Returns false if there is none.
+ */
+static bool vhost_iova_tree_find_hole(VhostIOVATree *tree, hwaddr size,
+                                      hwaddr iova_first, hwaddr iova_last,
+                                      hwaddr *iova)
+{
+    hwaddr start = iova_first;
+    IntervalTreeNode *node;
+
+    for (node = interval_tree_iter_first(&tree->iova_root, iova_first,
+                                         UINT64_MAX);
+         node; node = interval_tree_iter_next(node, iova_first, UINT64_MAX)) {
+        if (node->start > start && node->start - start > size) {
+            break;
+        }
+        if (node->last == UINT64_MAX) {
+            return false;
+        }
+        start = MAX(start, node->last + 1);
+    }
+
+    if (start > iova_last || iova_last - start < size) {
+        return false;
+    }
+    *iova = start;
+    return true;
 }
 
 /**
@@ -87,15 +199,33 @@ int vhost_iova_tree_map_alloc(VhostIOVATree *tree, DMAMap *map)
 {
     /* Some vhost devices do not like addr 0. Skip first page */
     hwaddr iova_first = tree->iova_first ?: qemu_real_host_page_size();
+    VhostIOVAMap *m;
 
     if (map->translated_addr + map->size < map->translated_addr ||
         map->perm == IOMMU_NONE) {
         return IOVA_ERR_INVALID;
     }
 
+    if (unlikely(tree->iova_last < iova_first)) {
+        return IOVA_ERR_INVALID;
+    }
+
     /* Allocate a node in IOVA address */
-    return iova_tree_alloc_map(tree->iova_taddr_map, map, iova_first,
-                               tree->iova_last);
+    QEMU_LOCK_GUARD(&tree->lock);
+    if (!vhost_iova_tree_find_hole(tree, map->size, iova_first,
+                                   tree->iova_last, &map->iova)) {
+        return IOVA_ERR_NOMEM;
+    }
+
+    m = g_new0(VhostIOVAMap, 1);
+    m->map = *map;
+    m->iova_node.start = map->iova;
+    m->iova_node.last = map->iova + map->size;
+    m->taddr_node.start = map->translated_addr;
+    m->taddr_node.last = map->translated_addr + map->size;
+    interval_tree_insert(&m->iova_node, &tree->iova_root);
+    interval_tree_insert(&m->taddr_node, &tree->taddr_root);
+    return IOVA_OK;
 }
 
 /**
@@ -106,5 +236,14 @@ int vhost_iova_tree_map_alloc(VhostIOVATree *tree, DMAMap *map)
  */
 void vhost_iova_tree_remove(VhostIOVATree *iova_tree, DMAMap map)
 {
-    iova_tree_remove(iova_tree->iova_taddr_map, map);
+    IntervalTreeNode *node;
+
+    QEMU_LOCK_GUARD(&iova_tree->lock);
+    while ((node = interval_tree_iter_first(&iova_tree->iova_root, map.iova,
+                                            map.iova + map.size))) {
+        vhost_iova_tree_remove_map(iova_tree,
+                                   container_of(node, VhostIOVAMap,
+                                                iova_node));
+    }
+    qatomic_inc(&iova_tree->gen);
 }
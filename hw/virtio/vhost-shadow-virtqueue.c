@@ -15,6 +15,7 @@
 #include "qemu/main-loop.h"
 #include "qemu/log.h"
 #include "qemu/memalign.h"
+#include "block/aio-wait.h"
 #include "linux-headers/linux/vhost.h"
 
 /**
@@ -71,6 +72,32 @@ uint16_t vhost_svq_available_slots(const VhostShadowVirtqueue *svq)
     return svq->num_free;
 }
 
+/*
+ * Find the mapping of @needle, looking at the last one used first since
+ * buffers tend to come from the same region.
+ */
+static bool vhost_svq_find_iova(VhostShadowVirtqueue *svq,
+                                const DMAMap *needle, DMAMap *map)
+{
+    unsigned int gen = vhost_iova_tree_gen(svq->iova_tree);
+    const DMAMap *cache = &svq->iova_cache;
+
+    if (svq->iova_cache_gen == gen &&
+        needle->translated_addr >= cache->translated_addr &&
+        needle->translated_addr - cache->translated_addr + needle->size <=
+        cache->size) {
+        *map = *cache;
+        return true;
+    }
+
+    if (!vhost_iova_tree_find_iova_copy(svq->iova_tree, needle, map)) {
+        return false;
+    }
+    svq->iova_cache = *map;
+    svq->iova_cache_gen = gen;
+    return true;
+}
+
 /**
  * Translate addresses between the qemu's virtual address and the SVQ IOVA
  *
@@ -79,7 +106,7 @@ uint16_t vhost_svq_available_slots(const VhostShadowVirtqueue *svq)
  * @iovec: Source qemu's VA addresses
  * @num: Length of iovec and minimum length of vaddr
  */
-static bool vhost_svq_translate_addr(const VhostShadowVirtqueue *svq,
+static bool vhost_svq_translate_addr(VhostShadowVirtqueue *svq,
                                      hwaddr *addrs, const struct iovec *iovec,
                                      size_t num)
 {
@@ -92,15 +119,16 @@ static bool vhost_svq_translate_addr(const VhostShadowVirtqueue *svq,
             .translated_addr = (hwaddr)(uintptr_t)iovec[i].iov_base,
             .size = iovec[i].iov_len,
         };
+        DMAMap found;
+        const DMAMap *map = &found;
         Int128 needle_last, map_last;
         size_t off;
 
-        const DMAMap *map = vhost_iova_tree_find_iova(svq->iova_tree, &needle);
         /*
-         * Map cannot be NULL since iova map contains all guest space and
+         * Map cannot be missing since iova map contains all guest space and
          * qemu already has a physical address mapped
          */
-        if (unlikely(!map)) {
+        if (unlikely(!vhost_svq_find_iova(svq, &needle, &found))) {
             qemu_log_mask(LOG_GUEST_ERROR,
                           "Invalid address 0x%"HWADDR_PRIx" given by guest",
                           needle.translated_addr);
@@ -217,7 +245,11 @@ static bool vhost_svq_add_split(VhostShadowVirtqueue *svq,
     return true;
 }
 
-static void vhost_svq_kick(VhostShadowVirtqueue *svq)
+/*
+ * Kick the device if it asked for it since @old_avail_idx was the avail
+ * index it saw.
+ */
+static void vhost_svq_kick(VhostShadowVirtqueue *svq, uint16_t old_avail_idx)
 {
     bool needs_kick;
 
@@ -229,7 +261,8 @@ static void vhost_svq_kick(VhostShadowVirtqueue *svq)
 
     if (virtio_vdev_has_feature(svq->vdev, VIRTIO_RING_F_EVENT_IDX)) {
         uint16_t avail_event = *(uint16_t *)(&svq->vring.used->ring[svq->vring.num]);
-        needs_kick = vring_need_event(avail_event, svq->shadow_avail_idx, svq->shadow_avail_idx - 1);
+        needs_kick = vring_need_event(avail_event, svq->shadow_avail_idx,
+                                      old_avail_idx);
     } else {
         needs_kick = !(svq->vring.used->flags & VRING_USED_F_NO_NOTIFY);
     }
@@ -241,14 +274,11 @@ static void vhost_svq_kick(VhostShadowVirtqueue *svq)
     event_notifier_set(&svq->hdev_kick);
 }
 
-/**
- * Add an element to a SVQ.
- *
- * Return -EINVAL if element is invalid, -ENOSPC if dev queue is full
- */
-int vhost_svq_add(VhostShadowVirtqueue *svq, const struct iovec *out_sg,
-                  size_t out_num, const struct iovec *in_sg, size_t in_num,
-                  VirtQueueElement *elem)
+/* Add an element to a SVQ without notifying the device */
+static int vhost_svq_add_no_kick(VhostShadowVirtqueue *svq,
+                                 const struct iovec *out_sg, size_t out_num,
+                                 const struct iovec *in_sg, size_t in_num,
+                                 VirtQueueElement *elem)
 {
     unsigned qemu_head;
     unsigned ndescs = in_num + out_num;
@@ -266,16 +296,35 @@ int vhost_svq_add(VhostShadowVirtqueue *svq, const struct iovec *out_sg,
     svq->num_free -= ndescs;
     svq->desc_state[qemu_head].elem = elem;
     svq->desc_state[qemu_head].ndescs = ndescs;
-    vhost_svq_kick(svq);
     return 0;
 }
 
-/* Convenience wrapper to add a guest's element to SVQ */
+/**
+ * Add an element to a SVQ.
+ *
+ * Return -EINVAL if element is invalid, -ENOSPC if dev queue is full
+ */
+int vhost_svq_add(VhostShadowVirtqueue *svq, const struct iovec *out_sg,
+                  size_t out_num, const struct iovec *in_sg, size_t in_num,
+                  VirtQueueElement *elem)
+{
+    int r = vhost_svq_add_no_kick(svq, out_sg, out_num, in_sg, in_num, elem);
+
+    if (likely(r == 0)) {
+        vhost_svq_kick(svq, svq->shadow_avail_idx - 1);
+    }
+    return r;
+}
+
+/*
+ * Convenience wrapper to add a guest's element to SVQ, the caller kicks the
+ * device once for the whole batch
+ */
 static int vhost_svq_add_element(VhostShadowVirtqueue *svq,
                                  VirtQueueElement *elem)
 {
-    return vhost_svq_add(svq, elem->out_sg, elem->out_num, elem->in_sg,
-                         elem->in_num, elem);
+    return vhost_svq_add_no_kick(svq, elem->out_sg, elem->out_num,
+                                 elem->in_sg, elem->in_num, elem);
 }
 
 /**
@@ -293,6 +342,8 @@ static int vhost_svq_add_element(VhostShadowVirtqueue *svq,
  */
 static void vhost_handle_guest_kick(VhostShadowVirtqueue *svq)
 {
+    uint16_t old_avail_idx = svq->shadow_avail_idx;
+
     /* Clear event notifier */
     event_notifier_test_and_clear(&svq->svq_kick);
 
@@ -336,7 +387,7 @@ static void vhost_handle_guest_kick(VhostShadowVirtqueue *svq)
                 }
 
                 /* VQ is full or broken, just return and ignore kicks */
-                return;
+                goto out;
             }
             /* elem belongs to SVQ or external caller now */
             elem = NULL;
@@ -344,6 +395,12 @@ static void vhost_handle_guest_kick(VhostShadowVirtqueue *svq)
 
         virtio_queue_set_notification(svq->vq, true);
     } while (!virtio_queue_empty(svq->vq));
+
+out:
+    /* The avail handler kicks by itself through vhost_svq_add() */
+    if (!svq->ops && svq->shadow_avail_idx != old_avail_idx) {
+        vhost_svq_kick(svq, old_avail_idx);
+    }
 }
 
 /**
@@ -564,6 +621,41 @@ static void vhost_svq_handle_call(EventNotifier *n)
     vhost_svq_flush(svq, true);
 }
 
+/* Busy polling of the device and the guest rings, for SVQs in an IOThread */
+static bool vhost_svq_call_poll(void *opaque)
+{
+    EventNotifier *n = opaque;
+    VhostShadowVirtqueue *svq = container_of(n, VhostShadowVirtqueue,
+                                             hdev_call);
+
+    return vhost_svq_more_used(svq);
+}
+
+static void vhost_svq_call_poll_ready(EventNotifier *n)
+{
+    VhostShadowVirtqueue *svq = container_of(n, VhostShadowVirtqueue,
+                                             hdev_call);
+
+    vhost_svq_flush(svq, true);
+}
+
+static bool vhost_svq_kick_poll(void *opaque)
+{
+    EventNotifier *n = opaque;
+    VhostShadowVirtqueue *svq = container_of(n, VhostShadowVirtqueue,
+                                             svq_kick);
+
+    return !svq->next_guest_avail_elem && !virtio_queue_empty(svq->vq);
+}
+
+static void vhost_svq_kick_poll_ready(EventNotifier *n)
+{
+    VhostShadowVirtqueue *svq = container_of(n, VhostShadowVirtqueue,
+                                             svq_kick);
+
+    vhost_handle_guest_kick(svq);
+}
+
 /**
  * Set the call notifier for the SVQ to call the guest
  *
@@ -574,6 +666,10 @@ static void vhost_svq_handle_call(EventNotifier *n)
  */
 void vhost_svq_set_svq_call_fd(VhostShadowVirtqueue *svq, int call_fd)
 {
+    AioContext *ctx = svq->ctx;
+
+    /* Don't change the notifier under the feet of the IOThread */
+    vhost_svq_detach_aio_context(svq);
     if (call_fd == VHOST_FILE_UNBIND) {
         /*
          * Fail event_notifier_set if called handling device call.
@@ -585,6 +681,9 @@ void vhost_svq_set_svq_call_fd(VhostShadowVirtqueue *svq, int call_fd)
     } else {
         event_notifier_init_fd(&svq->svq_call, call_fd);
     }
+    if (ctx) {
+        vhost_svq_attach_aio_context(svq, ctx);
+    }
 }
 
 /**
@@ -627,8 +726,11 @@ size_t vhost_svq_device_area_size(const VhostShadowVirtqueue *svq)
 void vhost_svq_set_svq_kick_fd(VhostShadowVirtqueue *svq, int svq_kick_fd)
 {
     EventNotifier *svq_kick = &svq->svq_kick;
-    bool poll_stop = VHOST_FILE_UNBIND != event_notifier_get_fd(svq_kick);
-    bool poll_start = svq_kick_fd != VHOST_FILE_UNBIND;
+    AioContext *ctx = svq->ctx;
+    bool poll_stop, poll_start = svq_kick_fd != VHOST_FILE_UNBIND;
+
+    vhost_svq_detach_aio_context(svq);
+    poll_stop = VHOST_FILE_UNBIND != event_notifier_get_fd(svq_kick);
 
     if (poll_stop) {
         event_notifier_set_handler(svq_kick, NULL);
@@ -644,6 +746,9 @@ void vhost_svq_set_svq_kick_fd(VhostShadowVirtqueue *svq, int svq_kick_fd)
         event_notifier_set(svq_kick);
         event_notifier_set_handler(svq_kick, vhost_handle_guest_kick_notifier);
     }
+    if (ctx) {
+        vhost_svq_attach_aio_context(svq, ctx);
+    }
 }
 
 /**
@@ -667,6 +772,7 @@ void vhost_svq_start(VhostShadowVirtqueue *svq, VirtIODevice *vdev,
     svq->vdev = vdev;
     svq->vq = vq;
     svq->iova_tree = iova_tree;
+    svq->iova_cache_gen = 0;
 
     svq->vring.num = virtio_queue_get_num(vdev, virtio_get_queue_index(vq));
     svq->num_free = svq->vring.num;
@@ -685,12 +791,89 @@ void vhost_svq_start(VhostShadowVirtqueue *svq, VirtIODevice *vdev,
     }
 }
 
+/**
+ * Move the notifier handlers of a started SVQ to an IOThread, so that it
+ * forwards the buffers outside of the main loop.
+ *
+ * @svq: Shadow Virtqueue
+ * @ctx: AioContext of the IOThread
+ *
+ * Called on BQL context.
+ */
+void vhost_svq_attach_aio_context(VhostShadowVirtqueue *svq, AioContext *ctx)
+{
+    bool kick = event_notifier_get_fd(&svq->svq_kick) != VHOST_FILE_UNBIND;
+
+    assert(!svq->ctx);
+
+    event_notifier_set_handler(&svq->hdev_call, NULL);
+    if (kick) {
+        event_notifier_set_handler(&svq->svq_kick, NULL);
+    }
+
+    svq->ctx = ctx;
+    aio_set_event_notifier(ctx, &svq->hdev_call, vhost_svq_handle_call,
+                           vhost_svq_call_poll, vhost_svq_call_poll_ready);
+    if (kick) {
+        aio_set_event_notifier(ctx, &svq->svq_kick,
+                               vhost_handle_guest_kick_notifier,
+                               vhost_svq_kick_poll, vhost_svq_kick_poll_ready);
+    }
+
+    /* Process what may have arrived in the switch */
+    event_notifier_set(&svq->hdev_call);
+    if (kick) {
+        event_notifier_set(&svq->svq_kick);
+    }
+}
+
+static void vhost_svq_detach_aio_context_bh(void *opaque)
+{
+    VhostShadowVirtqueue *svq = opaque;
+
+    aio_set_event_notifier(svq->ctx, &svq->hdev_call, NULL, NULL, NULL);
+    if (event_notifier_get_fd(&svq->svq_kick) != VHOST_FILE_UNBIND) {
+        aio_set_event_notifier(svq->ctx, &svq->svq_kick, NULL, NULL, NULL);
+    }
+}
+
+/**
+ * Bring the notifier handlers of the SVQ back to the main loop.
+ *
+ * @svq: Shadow Virtqueue
+ *
+ * Called on BQL context.  Once it returns the IOThread doesn't touch the SVQ
+ * anymore.
+ */
+void vhost_svq_detach_aio_context(VhostShadowVirtqueue *svq)
+{
+    bool kick = event_notifier_get_fd(&svq->svq_kick) != VHOST_FILE_UNBIND;
+
+    if (!svq->ctx) {
+        return;
+    }
+
+    aio_wait_bh_oneshot(svq->ctx, vhost_svq_detach_aio_context_bh, svq);
+    svq->ctx = NULL;
+
+    event_notifier_set_handler(&svq->hdev_call, vhost_svq_handle_call);
+    if (kick) {
+        event_notifier_set_handler(&svq->svq_kick,
+                                   vhost_handle_guest_kick_notifier);
+    }
+    event_notifier_set(&svq->hdev_call);
+    if (kick) {
+        event_notifier_set(&svq->svq_kick);
+    }
+}
+
 /**
  * Stop the shadow virtqueue operation.
  * @svq: Shadow Virtqueue
  */
 void vhost_svq_stop(VhostShadowVirtqueue *svq)
 {
+    vhost_svq_detach_aio_context(svq);
     vhost_svq_set_svq_kick_fd(svq, VHOST_FILE_UNBIND);
     g_autofree VirtQueueElement *next_avail_elem = NULL;
 
@@ -78,6 +78,13 @@ typedef struct VhostShadowVirtqueue {
     /* IOVA mapping */
     VhostIOVATree *iova_tree;
 
+    /*
+     * Last mapping used to translate addresses, valid while the generation
+     * of iova_tree is iova_cache_gen.  0 if empty.
+     */
+    DMAMap iova_cache;
+    unsigned int iova_cache_gen;
+
     /* SVQ vring descriptors state */
     SVQDescState *desc_state;
 
@@ -96,6 +103,9 @@ typedef struct VhostShadowVirtqueue {
     /* Caller callbacks opaque */
     void *ops_opaque;
 
+    /* AioContext that handles the notifiers, NULL for the main loop */
+    AioContext *ctx;
+
     /* Next head to expose to the device */
     uint16_t shadow_avail_idx;
 
@@ -132,6 +142,8 @@ size_t vhost_svq_device_area_size(const VhostShadowVirtqueue *svq);
 void vhost_svq_start(VhostShadowVirtqueue *svq, VirtIODevice *vdev,
                      VirtQueue *vq, VhostIOVATree *iova_tree);
 void vhost_svq_stop(VhostShadowVirtqueue *svq);
+void vhost_svq_attach_aio_context(VhostShadowVirtqueue *svq, AioContext *ctx);
+void vhost_svq_detach_aio_context(VhostShadowVirtqueue *svq);
 
 VhostShadowVirtqueue *vhost_svq_new(const VhostShadowVirtqueueOps *ops,
                                     void *ops_opaque);
@@ -43,6 +43,27 @@ static void vub_start(VirtIODevice *vdev)
 
     vub->vhost_dev.acked_features = vdev->guest_features;
 
+    ret = vhost_dev_prepare_inflight(&vub->vhost_dev, vdev);
+    if (ret < 0) {
+        error_report("Error setting inflight format: %d", -ret);
+        goto err_guest_notifiers;
+    }
+
+    if (!vub->inflight->addr) {
+        ret = vhost_dev_get_inflight(&vub->vhost_dev, vub->vq_size,
+                                     vub->inflight);
+        if (ret < 0) {
+            error_report("Error getting inflight: %d", -ret);
+            goto err_guest_notifiers;
+        }
+    }
+
+    ret = vhost_dev_set_inflight(&vub->vhost_dev, vub->inflight);
+    if (ret < 0) {
+        error_report("Error setting inflight: %d", -ret);
+        goto err_guest_notifiers;
+    }
+
     ret = vhost_dev_start(&vub->vhost_dev, vdev, true);
     if (ret < 0) {
         error_report("Error starting vhost-user-base: %d", -ret);
@@ -180,6 +201,8 @@ static void vub_handle_output(VirtIODevice *vdev, VirtQueue *vq)
 
 static void do_vhost_user_cleanup(VirtIODevice *vdev, VHostUserBase *vub)
 {
+    vhost_dev_free_inflight(vub->inflight);
+    g_clear_pointer(&vub->inflight, g_free);
     vhost_user_cleanup(&vub->vhost_user);
 
     for (int i = 0; i < vub->num_vqs; i++) {
@@ -302,6 +325,7 @@ static void vub_device_realize(DeviceState *dev, Error **errp)
     }
 
     virtio_init(vdev, vub->virtio_id, vub->config_size);
+    vub->inflight = g_new0(struct vhost_inflight, 1);
 
     /*
      * Disable guest notifiers, by default all notifications will be via the
@@ -332,6 +356,13 @@ static void vub_device_realize(DeviceState *dev, Error **errp)
                              dev, NULL, true);
 }
 
+static void vub_reset(VirtIODevice *vdev)
+{
+    VHostUserBase *vub = VHOST_USER_BASE(vdev);
+
+    vhost_dev_free_inflight(vub->inflight);
+}
+
 static void vub_device_unrealize(DeviceState *dev)
 {
     VirtIODevice *vdev = VIRTIO_DEVICE(dev);
@@ -355,6 +386,7 @@ static void vub_class_init(ObjectClass *klass, void *data)
     vdc->get_config = vub_get_config;
     vdc->set_config = vub_set_config;
     vdc->set_status = vub_set_status;
+    vdc->reset = vub_reset;
 }
 
 static const TypeInfo vub_types[] = {
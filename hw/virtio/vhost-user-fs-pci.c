@@ -16,6 +16,9 @@
 #include "hw/virtio/vhost-user-fs.h"
 #include "hw/virtio/virtio-pci.h"
 #include "qom/object.h"
+#include "standard-headers/linux/virtio_fs.h"
+
+#define VIRTIO_FS_PCI_CACHE_BAR_IDX 4
 
 struct VHostUserFSPCI {
     VirtIOPCIProxy parent_obj;
@@ -40,12 +43,32 @@ static void vhost_user_fs_pci_realize(VirtIOPCIProxy *vpci_dev, Error **errp)
     VHostUserFSPCI *dev = VHOST_USER_FS_PCI(vpci_dev);
     DeviceState *vdev = DEVICE(&dev->vdev);
 
+    uint64_t cache_size = dev->vdev.conf.cache_size;
+
     if (vpci_dev->nvectors == DEV_NVECTORS_UNSPECIFIED) {
         /* Also reserve config change and hiprio queue vectors */
         vpci_dev->nvectors = dev->vdev.conf.num_request_queues + 2;
     }
 
-    qdev_realize(vdev, BUS(&vpci_dev->bus), errp);
+    if (cache_size) {
+        /* Leave the 64-bit BAR 4 to the DAX window */
+        vpci_dev->msix_bar_idx = 1;
+        vpci_dev->modern_mem_bar_idx = 2;
+    }
+
+    if (!qdev_realize(vdev, BUS(&vpci_dev->bus), errp)) {
+        return;
+    }
+
+    if (cache_size) {
+        pci_register_bar(&vpci_dev->pci_dev, VIRTIO_FS_PCI_CACHE_BAR_IDX,
+                         PCI_BASE_ADDRESS_SPACE_MEMORY |
+                         PCI_BASE_ADDRESS_MEM_PREFETCH |
+                         PCI_BASE_ADDRESS_MEM_TYPE_64,
+                         &dev->vdev.cache);
+        virtio_pci_add_shm_cap(vpci_dev, VIRTIO_FS_PCI_CACHE_BAR_IDX, 0,
+                               cache_size, VIRTIO_FS_SHMCAP_ID_CACHE);
+    }
 }
 
 static void vhost_user_fs_pci_class_init(ObjectClass *klass, void *data)
@@ -22,6 +22,7 @@
 #include "qemu/error-report.h"
 #include "hw/virtio/vhost.h"
 #include "hw/virtio/vhost-user-fs.h"
+#include "migration/blocker.h"
 #include "monitor/monitor.h"
 #include "sysemu/sysemu.h"
 
@@ -31,6 +32,7 @@ static const int user_feature_bits[] = {
     VIRTIO_RING_F_EVENT_IDX,
     VIRTIO_F_NOTIFY_ON_EMPTY,
     VIRTIO_F_RING_PACKED,
+    VIRTIO_F_IN_ORDER,
     VIRTIO_F_IOMMU_PLATFORM,
     VIRTIO_F_RING_RESET,
 
@@ -137,6 +139,22 @@ static void vuf_set_status(VirtIODevice *vdev, uint8_t status)
     }
 }
 
+static void vuf_reset(VirtIODevice *vdev)
+{
+    VHostUserFS *fs = VHOST_USER_FS(vdev);
+
+    if (!fs->cache_ptr) {
+        return;
+    }
+
+    /* Drop the files that the back-end mapped in the DAX window */
+    if (mmap(fs->cache_ptr, fs->conf.cache_size, PROT_NONE,
+             MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED,
+             -1, 0) == MAP_FAILED) {
+        error_report("Failed to reset the DAX window: %s", strerror(errno));
+    }
+}
+
 static uint64_t vuf_get_features(VirtIODevice *vdev,
                                  uint64_t features,
                                  Error **errp)
@@ -191,7 +209,7 @@ static void vuf_device_realize(DeviceState *dev, Error **errp)
 {
     VirtIODevice *vdev = VIRTIO_DEVICE(dev);
     VHostUserFS *fs = VHOST_USER_FS(dev);
-    unsigned int i;
+    unsigned int i, shmid;
     size_t len;
     int ret;
 
@@ -231,12 +249,51 @@ static void vuf_device_realize(DeviceState *dev, Error **errp)
         return;
     }
 
+    if (fs->conf.cache_size) {
+        if (!is_power_of_2(fs->conf.cache_size) ||
+            fs->conf.cache_size < qemu_real_host_page_size()) {
+            error_setg(errp, "cache-size property must be a power of 2 "
+                       "no smaller than the page size");
+            return;
+        }
+
+        error_setg(&fs->migration_blocker,
+                   "vhost-user-fs with a DAX window does not support "
+                   "migration");
+        if (migrate_add_blocker(&fs->migration_blocker, errp) < 0) {
+            return;
+        }
+
+        /*
+         * The back-end maps files over this reservation, which stays
+         * inaccessible elsewhere.
+         */
+        fs->cache_ptr = mmap(NULL, fs->conf.cache_size, PROT_NONE,
+                             MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+                             -1, 0);
+        if (fs->cache_ptr == MAP_FAILED) {
+            fs->cache_ptr = NULL;
+            error_setg_errno(errp, errno, "failed to reserve the DAX window");
+            migrate_del_blocker(&fs->migration_blocker);
+            return;
+        }
+    }
+
     if (!vhost_user_init(&fs->vhost_user, &fs->conf.chardev, errp)) {
+        migrate_del_blocker(&fs->migration_blocker);
         return;
     }
 
     virtio_init(vdev, VIRTIO_ID_FS, sizeof(struct virtio_fs_config));
 
+    if (fs->cache_ptr) {
+        /* Freed with the device, see vuf_instance_finalize() */
+        memory_region_init_ram_ptr(&fs->cache, OBJECT(vdev), "virtio-fs-cache",
+                                   fs->conf.cache_size, fs->cache_ptr);
+        shmid = virtio_add_shmem_region(vdev, &fs->cache);
+        assert(shmid == VIRTIO_FS_SHMCAP_ID_CACHE);
+    }
+
     /* Hiprio queue */
     fs->hiprio_vq = virtio_add_queue(vdev, fs->conf.queue_size, vuf_handle_output);
 
@@ -258,6 +315,7 @@ static void vuf_device_realize(DeviceState *dev, Error **errp)
     return;
 
 err_virtio:
+    migrate_del_blocker(&fs->migration_blocker);
     vhost_user_cleanup(&fs->vhost_user);
     virtio_delete_queue(fs->hiprio_vq);
     for (i = 0; i < fs->conf.num_request_queues; i++) {
@@ -283,6 +341,8 @@ static void vuf_device_unrealize(DeviceState *dev)
 
     vhost_user_cleanup(&fs->vhost_user);
 
+    migrate_del_blocker(&fs->migration_blocker);
+
     virtio_delete_queue(fs->hiprio_vq);
     for (i = 0; i < fs->conf.num_request_queues; i++) {
         virtio_delete_queue(fs->req_vqs[i]);
@@ -408,6 +468,7 @@ static Property vuf_properties[] = {
     DEFINE_PROP_UINT16("num-request-queues", VHostUserFS,
                        conf.num_request_queues, 1),
     DEFINE_PROP_UINT16("queue-size", VHostUserFS, conf.queue_size, 128),
+    DEFINE_PROP_SIZE("cache-size", VHostUserFS, conf.cache_size, 0),
     DEFINE_PROP_END_OF_LIST(),
 };
 
@@ -419,6 +480,16 @@ static void vuf_instance_init(Object *obj)
                                   "/filesystem@0", DEVICE(obj));
 }
 
+static void vuf_instance_finalize(Object *obj)
+{
+    VHostUserFS *fs = VHOST_USER_FS(obj);
+
+    /* The memory region went away with the other children of the device */
+    if (fs->cache_ptr) {
+        munmap(fs->cache_ptr, fs->conf.cache_size);
+    }
+}
+
 static void vuf_class_init(ObjectClass *klass, void *data)
 {
     DeviceClass *dc = DEVICE_CLASS(klass);
@@ -432,6 +503,7 @@ static void vuf_class_init(ObjectClass *klass, void *data)
     vdc->get_features = vuf_get_features;
     vdc->get_config = vuf_get_config;
     vdc->set_status = vuf_set_status;
+    vdc->reset = vuf_reset;
     vdc->guest_notifier_mask = vuf_guest_notifier_mask;
     vdc->guest_notifier_pending = vuf_guest_notifier_pending;
     vdc->get_vhost = vuf_get_vhost;
@@ -442,6 +514,7 @@ static const TypeInfo vuf_info = {
     .parent = TYPE_VIRTIO_DEVICE,
     .instance_size = sizeof(VHostUserFS),
     .instance_init = vuf_instance_init,
+    .instance_finalize = vuf_instance_finalize,
     .class_init = vuf_class_init,
 };
 
@@ -115,6 +115,8 @@ typedef enum VhostUserBackendRequest {
     VHOST_USER_BACKEND_SHARED_OBJECT_ADD = 6,
     VHOST_USER_BACKEND_SHARED_OBJECT_REMOVE = 7,
     VHOST_USER_BACKEND_SHARED_OBJECT_LOOKUP = 8,
+    VHOST_USER_BACKEND_SHMEM_MAP = 9,
+    VHOST_USER_BACKEND_SHMEM_UNMAP = 10,
     VHOST_USER_BACKEND_MAX
 }  VhostUserBackendRequest;
 
@@ -208,6 +210,21 @@ typedef struct VhostUserTransferDeviceState {
     uint32_t phase;
 } VhostUserTransferDeviceState;
 
+/* Request payload of VHOST_USER_BACKEND_SHMEM_MAP/UNMAP */
+typedef struct VhostUserMMap {
+    /* VIRTIO Shared Memory Region ID */
+    uint8_t shmid;
+    uint8_t padding[7];
+    /* File offset */
+    uint64_t fd_offset;
+    /* Offset within the VIRTIO Shared Memory Region */
+    uint64_t shm_offset;
+    /* Size of the mapping */
+    uint64_t len;
+#define VHOST_USER_FLAG_MAP_RW (1u << 0)
+    uint64_t flags;
+} VhostUserMMap;
+
 typedef union {
 #define VHOST_USER_VRING_IDX_MASK   (0xff)
 #define VHOST_USER_VRING_NOFD_MASK  (0x1 << 8)
@@ -224,6 +241,7 @@ typedef union {
         VhostUserInflight inflight;
         VhostUserShared object;
         VhostUserTransferDeviceState transfer_state;
+        VhostUserMMap mmap;
 } VhostUserPayload;
 
 typedef struct VhostUserMsg {
@@ -1748,6 +1766,97 @@ vhost_user_backend_handle_shared_object_lookup(struct vhost_user *u,
     return 0;
 }
 
+/*
+ * Look up the part of a VIRTIO Shared Memory Region that a SHMEM_MAP or
+ * SHMEM_UNMAP request refers to, or return NULL if the request is invalid.
+ */
+static void *vhost_user_backend_shmem_ptr(struct vhost_dev *dev,
+                                          VhostUserMMap *vu_mmap)
+{
+    VirtIODevice *vdev = dev->vdev;
+    MemoryRegion *mr;
+    uint64_t size;
+
+    if (!virtio_has_feature(dev->protocol_features,
+                            VHOST_USER_PROTOCOL_F_SHMEM) || !vdev) {
+        return NULL;
+    }
+
+    mr = virtio_get_shmem_region(vdev, vu_mmap->shmid);
+    if (!mr) {
+        error_report("Device has no VIRTIO Shared Memory Region with id %d",
+                     vu_mmap->shmid);
+        return NULL;
+    }
+
+    size = memory_region_size(mr);
+    if (!vu_mmap->len ||
+        !QEMU_IS_ALIGNED(vu_mmap->shm_offset | vu_mmap->len,
+                         qemu_real_host_page_size()) ||
+        vu_mmap->shm_offset > size ||
+        vu_mmap->len > size - vu_mmap->shm_offset) {
+        error_report("Bad mapping of 0x%" PRIx64 " bytes at 0x%" PRIx64
+                     " in VIRTIO Shared Memory Region %d",
+                     vu_mmap->len, vu_mmap->shm_offset, vu_mmap->shmid);
+        return NULL;
+    }
+
+    return memory_region_get_ram_ptr(mr) + vu_mmap->shm_offset;
+}
+
+static int vhost_user_backend_handle_shmem_map(struct vhost_dev *dev,
+                                               VhostUserMMap *vu_mmap,
+                                               int fd)
+{
+    int prot = PROT_READ;
+    void *addr;
+
+    addr = vhost_user_backend_shmem_ptr(dev, vu_mmap);
+    if (!addr || fd < 0) {
+        return -EFAULT;
+    }
+
+    if (vu_mmap->flags & VHOST_USER_FLAG_MAP_RW) {
+        prot |= PROT_WRITE;
+    }
+
+    trace_vhost_user_backend_shmem_map(dev, vu_mmap->shmid,
+                                       vu_mmap->shm_offset, vu_mmap->len,
+                                       vu_mmap->fd_offset, prot);
+    if (mmap(addr, vu_mmap->len, prot, MAP_SHARED | MAP_FIXED,
+             fd, vu_mmap->fd_offset) == MAP_FAILED) {
+        error_report("Failed to map VIRTIO Shared Memory Region %d: %s",
+                     vu_mmap->shmid, strerror(errno));
+        return -EFAULT;
+    }
+
+    return 0;
+}
+
+static int vhost_user_backend_handle_shmem_unmap(struct vhost_dev *dev,
+                                                 VhostUserMMap *vu_mmap)
+{
+    void *addr;
+
+    addr = vhost_user_backend_shmem_ptr(dev, vu_mmap);
+    if (!addr) {
+        return -EFAULT;
+    }
+
+    trace_vhost_user_backend_shmem_unmap(dev, vu_mmap->shmid,
+                                         vu_mmap->shm_offset, vu_mmap->len);
+    /* Put back the reservation that the region was created with */
+    if (mmap(addr, vu_mmap->len, PROT_NONE,
+             MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED,
+             -1, 0) == MAP_FAILED) {
+        error_report("Failed to unmap VIRTIO Shared Memory Region %d: %s",
+                     vu_mmap->shmid, strerror(errno));
+        return -EFAULT;
+    }
+
+    return 0;
+}
+
 static void close_backend_channel(struct vhost_user *u)
 {
     g_source_destroy(u->backend_src);
@@ -1816,6 +1925,13 @@ static gboolean backend_read(QIOChannel *ioc, GIOCondition condition,
         ret = vhost_user_backend_handle_shared_object_lookup(dev->opaque, ioc,
                                                              &hdr, &payload);
         break;
+    case VHOST_USER_BACKEND_SHMEM_MAP:
+        ret = vhost_user_backend_handle_shmem_map(dev, &payload.mmap,
+                                                  fd ? fd[0] : -1);
+        break;
+    case VHOST_USER_BACKEND_SHMEM_UNMAP:
+        ret = vhost_user_backend_handle_shmem_unmap(dev, &payload.mmap);
+        break;
     default:
         error_report("Received unexpected msg type: %d.", hdr.request);
         ret = -EINVAL;
@@ -2639,6 +2755,16 @@ static bool vhost_user_no_private_memslots(struct vhost_dev *dev)
     return true;
 }
 
+/*
+ * A vhost_dev may only handle some of the queues of the device, like the
+ * one per queue pair of vhost-user-net.  The inflight region is shared by
+ * all of them and set up through the first one, so size it for all queues.
+ */
+static uint32_t vhost_user_inflight_num_queues(struct vhost_dev *dev)
+{
+    return MAX(dev->nvqs, dev->vq_index_end);
+}
+
 static int vhost_user_get_inflight_fd(struct vhost_dev *dev,
                                       uint16_t queue_size,
                                       struct vhost_inflight *inflight)
@@ -2651,7 +2777,7 @@ static int vhost_user_get_inflight_fd(struct vhost_dev *dev,
     VhostUserMsg msg = {
         .hdr.request = VHOST_USER_GET_INFLIGHT_FD,
         .hdr.flags = VHOST_USER_VERSION,
-        .payload.inflight.num_queues = dev->nvqs,
+        .payload.inflight.num_queues = vhost_user_inflight_num_queues(dev),
         .payload.inflight.queue_size = queue_size,
         .hdr.size = sizeof(msg.payload.inflight),
     };
@@ -2719,7 +2845,7 @@ static int vhost_user_set_inflight_fd(struct vhost_dev *dev,
         .hdr.flags = VHOST_USER_VERSION,
         .payload.inflight.mmap_size = inflight->size,
         .payload.inflight.mmap_offset = inflight->offset,
-        .payload.inflight.num_queues = dev->nvqs,
+        .payload.inflight.num_queues = vhost_user_inflight_num_queues(dev),
         .payload.inflight.queue_size = inflight->queue_size,
         .hdr.size = sizeof(msg.payload.inflight),
     };
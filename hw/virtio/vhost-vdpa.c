@@ -24,6 +24,7 @@
 #include "migration/blocker.h"
 #include "qemu/cutils.h"
 #include "qemu/main-loop.h"
+#include "sysemu/runstate.h"
 #include "trace.h"
 #include "qapi/error.h"
 
@@ -163,7 +164,12 @@ static void vhost_vdpa_listener_begin_batch(VhostVDPAShared *s)
     }
 }
 
-static void vhost_vdpa_iotlb_batch_begin_once(VhostVDPAShared *s)
+/*
+ * Open a batch of IOTLB updates if the device supports it and none is open
+ * yet.  The device applies all the updates of the batch at once when it is
+ * closed by vhost_vdpa_iotlb_batch_end_once().
+ */
+void vhost_vdpa_iotlb_batch_begin_once(VhostVDPAShared *s)
 {
     if (s->backend_cap & (0x1ULL << VHOST_BACKEND_F_IOTLB_BATCH) &&
         !s->iotlb_batch_begin_sent) {
@@ -173,9 +179,8 @@ static void vhost_vdpa_iotlb_batch_begin_once(VhostVDPAShared *s)
     s->iotlb_batch_begin_sent = true;
 }
 
-static void vhost_vdpa_listener_commit(MemoryListener *listener)
+void vhost_vdpa_iotlb_batch_end_once(VhostVDPAShared *s)
 {
-    VhostVDPAShared *s = container_of(listener, VhostVDPAShared, listener);
     struct vhost_msg_v2 msg = {};
     int fd = s->device_fd;
 
@@ -199,6 +204,13 @@ static void vhost_vdpa_listener_commit(MemoryListener *listener)
     s->iotlb_batch_begin_sent = false;
 }
 
+static void vhost_vdpa_listener_commit(MemoryListener *listener)
+{
+    VhostVDPAShared *s = container_of(listener, VhostVDPAShared, listener);
+
+    vhost_vdpa_iotlb_batch_end_once(s);
+}
+
 static void vhost_vdpa_iommu_map_notify(IOMMUNotifier *n, IOMMUTLBEntry *iotlb)
 {
     struct vdpa_iommu *iommu = container_of(n, struct vdpa_iommu, n);
@@ -355,7 +367,7 @@ static void vhost_vdpa_listener_region_add(MemoryListener *listener,
                                          vaddr, section->readonly);
 
     llsize = int128_sub(llend, int128_make64(iova));
-    if (s->shadow_data) {
+    if (s->listener_shadow_data) {
         int r;
 
         mem_region.translated_addr = (hwaddr)(uintptr_t)vaddr,
@@ -382,7 +394,7 @@ static void vhost_vdpa_listener_region_add(MemoryListener *listener,
     return;
 
 fail_map:
-    if (s->shadow_data) {
+    if (s->listener_shadow_data) {
         vhost_iova_tree_remove(s->iova_tree, mem_region);
     }
 
@@ -435,7 +447,7 @@ static void vhost_vdpa_listener_region_del(MemoryListener *listener,
 
     llsize = int128_sub(llend, int128_make64(iova));
 
-    if (s->shadow_data) {
+    if (s->listener_shadow_data) {
         const DMAMap *result;
         const void *vaddr = memory_region_get_ram_ptr(section->mr) +
             section->offset_within_region +
@@ -492,6 +504,23 @@ static const MemoryListener vhost_vdpa_memory_listener = {
     .region_del = vhost_vdpa_listener_region_del,
 };
 
+/*
+ * Unregister the memory listener if the mappings it made do not match the
+ * ones needed to start the device with @as and the current shadow_data.
+ */
+static void vhost_vdpa_listener_drop_stale(VhostVDPAShared *s,
+                                           AddressSpace *as)
+{
+    if (!s->listener.address_space) {
+        return;
+    }
+
+    if (s->listener.address_space != as ||
+        s->listener_shadow_data != s->shadow_data) {
+        memory_listener_unregister(&s->listener);
+    }
+}
+
 static int vhost_vdpa_call(struct vhost_dev *dev, unsigned long int request,
                              void *arg)
 {
@@ -590,6 +619,32 @@ static void vhost_vdpa_init_svq(struct vhost_dev *hdev, struct vhost_vdpa *v)
     v->shadow_vqs = g_steal_pointer(&shadow_vqs);
 }
 
+static int vhost_vdpa_set_backend_cap(struct vhost_dev *dev);
+
+/*
+ * On the migration destination, map guest memory while the migration is
+ * still running so that the switchover does not have to wait for all guest
+ * memory to be pinned.  This needs the device to keep the mappings until it
+ * is started, and assumes no vIOMMU: vhost_vdpa_dev_start() replaces them
+ * if the device ends up needing others.
+ */
+static void vhost_vdpa_premap(struct vhost_dev *dev)
+{
+    struct vhost_vdpa *v = dev->opaque;
+
+    if (v->shared->shadow_data || vhost_vdpa_set_backend_cap(dev)) {
+        return;
+    }
+
+    if (!(v->shared->backend_cap & BIT_ULL(VHOST_BACKEND_F_IOTLB_PERSIST))) {
+        return;
+    }
+
+    trace_vhost_vdpa_premap(dev);
+    v->shared->listener_shadow_data = false;
+    memory_listener_register(&v->shared->listener, &address_space_memory);
+}
+
 static int vhost_vdpa_init(struct vhost_dev *dev, void *opaque, Error **errp)
 {
     struct vhost_vdpa *v = opaque;
@@ -635,6 +690,10 @@ static int vhost_vdpa_init(struct vhost_dev *dev, void *opaque, Error **errp)
     vhost_vdpa_add_status(dev, VIRTIO_CONFIG_S_ACKNOWLEDGE |
                                VIRTIO_CONFIG_S_DRIVER);
 
+    if (runstate_check(RUN_STATE_INMIGRATE)) {
+        vhost_vdpa_premap(dev);
+    }
+
     return 0;
 }
 
@@ -845,7 +904,8 @@ static int vhost_vdpa_set_backend_cap(struct vhost_dev *dev)
     uint64_t f = 0x1ULL << VHOST_BACKEND_F_IOTLB_MSG_V2 |
         0x1ULL << VHOST_BACKEND_F_IOTLB_BATCH |
         0x1ULL << VHOST_BACKEND_F_IOTLB_ASID |
-        0x1ULL << VHOST_BACKEND_F_SUSPEND;
+        0x1ULL << VHOST_BACKEND_F_SUSPEND |
+        0x1ULL << VHOST_BACKEND_F_IOTLB_PERSIST;
     int r;
 
     if (vhost_vdpa_call(dev, VHOST_GET_BACKEND_FEATURES, &features)) {
@@ -1245,6 +1305,7 @@ static bool vhost_vdpa_svqs_start(struct vhost_dev *dev)
         return true;
     }
 
+    vhost_vdpa_iotlb_batch_begin_once(v->shared);
     for (i = 0; i < v->shadow_vqs->len; ++i) {
         VirtQueue *vq = virtio_get_queue(dev->vdev, dev->vq_index + i);
         VhostShadowVirtqueue *svq = g_ptr_array_index(v->shadow_vqs, i);
@@ -1270,6 +1331,14 @@ static bool vhost_vdpa_svqs_start(struct vhost_dev *dev)
             goto err_set_addr;
         }
     }
+    vhost_vdpa_iotlb_batch_end_once(v->shared);
+
+    if (v->svq_ctx) {
+        for (i = 0; i < v->shadow_vqs->len; ++i) {
+            vhost_svq_attach_aio_context(g_ptr_array_index(v->shadow_vqs, i),
+                                         v->svq_ctx);
+        }
+    }
 
     return true;
 
@@ -1286,6 +1355,7 @@ err:
         vhost_vdpa_svq_unmap_rings(dev, svq);
         vhost_svq_stop(svq);
     }
+    vhost_vdpa_iotlb_batch_end_once(v->shared);
 
     return false;
 }
@@ -1298,6 +1368,7 @@ static void vhost_vdpa_svqs_stop(struct vhost_dev *dev)
         return;
     }
 
+    vhost_vdpa_iotlb_batch_begin_once(v->shared);
     for (unsigned i = 0; i < v->shadow_vqs->len; ++i) {
         VhostShadowVirtqueue *svq = g_ptr_array_index(v->shadow_vqs, i);
 
@@ -1307,6 +1378,7 @@ static void vhost_vdpa_svqs_stop(struct vhost_dev *dev)
         event_notifier_cleanup(&svq->hdev_kick);
         event_notifier_cleanup(&svq->hdev_call);
     }
+    vhost_vdpa_iotlb_batch_end_once(v->shared);
 }
 
 static void vhost_vdpa_suspend(struct vhost_dev *dev)
@@ -1338,6 +1410,15 @@ static int vhost_vdpa_dev_start(struct vhost_dev *dev, bool started)
     bool ok;
     trace_vhost_vdpa_dev_start(dev, started);
 
+    if (started && vhost_vdpa_first_dev(dev)) {
+        /*
+         * Drop the mappings kept from a previous start or made before the
+         * incoming migration if the device needs different ones, before the
+         * shadow virtqueues allocate their IOVA.
+         */
+        vhost_vdpa_listener_drop_stale(v->shared, dev->vdev->dma_as);
+    }
+
     if (started) {
         vhost_vdpa_host_notifiers_init(dev);
         ok = vhost_vdpa_svqs_start(dev);
@@ -1360,7 +1441,10 @@ static int vhost_vdpa_dev_start(struct vhost_dev *dev, bool started)
                          "IOMMU and try again");
             return -1;
         }
-        memory_listener_register(&v->shared->listener, dev->vdev->dma_as);
+        if (!v->shared->listener.address_space) {
+            v->shared->listener_shadow_data = v->shared->shadow_data;
+            memory_listener_register(&v->shared->listener, dev->vdev->dma_as);
+        }
 
         return vhost_vdpa_add_status(dev, VIRTIO_CONFIG_S_DRIVER_OK);
     }
@@ -1379,7 +1463,16 @@ static void vhost_vdpa_reset_status(struct vhost_dev *dev)
     vhost_vdpa_reset_device(dev);
     vhost_vdpa_add_status(dev, VIRTIO_CONFIG_S_ACKNOWLEDGE |
                                VIRTIO_CONFIG_S_DRIVER);
-    memory_listener_unregister(&v->shared->listener);
+
+    /*
+     * If the device keeps its mappings across the reset there is no need to
+     * replay all guest memory at next start.  SVQ translations live in an
+     * IOVA tree that does not survive the stop, so those must go anyway.
+     */
+    if (!(v->shared->backend_cap & BIT_ULL(VHOST_BACKEND_F_IOTLB_PERSIST)) ||
+        v->shared->listener_shadow_data) {
+        memory_listener_unregister(&v->shared->listener);
+    }
 }
 
 static int vhost_vdpa_set_log_base(struct vhost_dev *dev, uint64_t base,
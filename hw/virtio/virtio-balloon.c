@@ -323,12 +323,46 @@ static void balloon_stats_set_poll_interval(Object *obj, Visitor *v,
     balloon_stats_change_timer(s, 0);
 }
 
+/* A range of reported pages, contiguous in a RAMBlock */
+typedef struct BalloonReportRange {
+    RAMBlock *rb;
+    void *addr;
+    ram_addr_t offset;
+    size_t size;
+} BalloonReportRange;
+
+static void virtio_balloon_report_flush(VirtIODevice *vdev,
+                                        BalloonReportRange *range)
+{
+    if (!range->size) {
+        return;
+    }
+
+    trace_virtio_balloon_report_discard(range->offset, range->size);
+    ram_block_discard_range(range->rb, range->offset, range->size);
+
+    /*
+     * Without page poisoning, the content of reported pages is undefined
+     * for the guest, so like hinted free pages, they do not need to be
+     * migrated until they are dirtied again.  With a poison value of 0
+     * (e.g. init_on_free), the guest zeroed them before reporting and
+     * relies on them reading as zero: skipping them would leave older
+     * content on the destination.
+     */
+    if (!virtio_vdev_has_feature(vdev, VIRTIO_BALLOON_F_PAGE_POISON)) {
+        qemu_guest_free_page_hint(range->addr, range->size);
+    }
+    range->size = 0;
+}
+
 static void virtio_balloon_handle_report(VirtIODevice *vdev, VirtQueue *vq)
 {
     VirtIOBalloon *dev = VIRTIO_BALLOON(vdev);
     VirtQueueElement *elem;
+    bool notify = false;
 
     while ((elem = virtqueue_pop(vq, sizeof(VirtQueueElement)))) {
+        BalloonReportRange range = {};
         unsigned int i;
 
         /*
@@ -374,14 +408,35 @@ static void virtio_balloon_handle_report(VirtIODevice *vdev, VirtQueue *vq)
                 continue;
             }
 
-            ram_block_discard_range(rb, ram_offset, size);
+            /*
+             * The guest reports free pages in the order it finds them, so
+             * neighbouring entries are often adjacent: discard them with a
+             * single call.
+             */
+            if (range.size && range.rb == rb &&
+                range.offset + range.size == ram_offset) {
+                range.size += size;
+                continue;
+            }
+            virtio_balloon_report_flush(vdev, &range);
+            range = (BalloonReportRange) {
+                .rb = rb,
+                .addr = addr,
+                .offset = ram_offset,
+                .size = size,
+            };
         }
+        virtio_balloon_report_flush(vdev, &range);
 
 skip_element:
         virtqueue_push(vq, elem, 0);
-        virtio_notify(vdev, vq);
+        notify = true;
         g_free(elem);
     }
+
+    if (notify) {
+        virtio_notify(vdev, vq);
+    }
 }
 
 static void virtio_balloon_handle_output(VirtIODevice *vdev, VirtQueue *vq)
@@ -271,6 +271,57 @@ static void virtio_iommu_notify_unmap(IOMMUMemoryRegion *mr, hwaddr virt_start,
     virtio_iommu_notify_map_unmap(mr, &event, virt_start, virt_end);
 }
 
+/* Called with s->mutex held */
+static void virtio_iommu_flush_unmaps(VirtIOIOMMU *s)
+{
+    unsigned int i;
+
+    for (i = 0; i < s->nb_pending_unmaps; i++) {
+        VirtIOIOMMUPendingUnmap *p = &s->pending_unmaps[i];
+
+        virtio_iommu_notify_unmap(p->mr, p->low, p->high);
+    }
+    s->nb_pending_unmaps = 0;
+}
+
+/*
+ * Queue an UNMAP notification for [virt_start, virt_end], merging it with a
+ * pending one that it extends.  Called with s->mutex held.
+ */
+static void virtio_iommu_queue_unmap(VirtIOIOMMU *s, IOMMUMemoryRegion *mr,
+                                     hwaddr virt_start, hwaddr virt_end)
+{
+    VirtIOIOMMUPendingUnmap *p;
+    unsigned int i;
+
+    if (!(mr->iommu_notify_flags & IOMMU_NOTIFIER_UNMAP)) {
+        return;
+    }
+
+    for (i = 0; i < s->nb_pending_unmaps; i++) {
+        p = &s->pending_unmaps[i];
+        if (p->mr != mr) {
+            continue;
+        }
+        if (p->high != UINT64_MAX && p->high + 1 == virt_start) {
+            p->high = virt_end;
+            return;
+        }
+        if (virt_end != UINT64_MAX && virt_end + 1 == p->low) {
+            p->low = virt_start;
+            return;
+        }
+    }
+
+    if (s->nb_pending_unmaps == VIOMMU_MAX_PENDING_UNMAPS) {
+        virtio_iommu_flush_unmaps(s);
+    }
+    p = &s->pending_unmaps[s->nb_pending_unmaps++];
+    p->mr = mr;
+    p->low = virt_start;
+    p->high = virt_end;
+}
+
 static gboolean virtio_iommu_notify_unmap_cb(gpointer key, gpointer value,
                                              gpointer data)
 {
@@ -633,8 +684,8 @@ static int virtio_iommu_unmap(VirtIOIOMMU *s,
 
         if (interval.low <= current_low && interval.high >= current_high) {
             QLIST_FOREACH(ep, &domain->endpoint_list, next) {
-                virtio_iommu_notify_unmap(ep->iommu_mr, current_low,
-                                          current_high);
+                virtio_iommu_queue_unmap(s, ep->iommu_mr, current_low,
+                                         current_high);
             }
             g_tree_remove(domain->mappings, iter_key);
             trace_virtio_iommu_unmap_done(domain_id, current_low, current_high);
@@ -751,6 +802,23 @@ static int virtio_iommu_handle_probe(VirtIOIOMMU *s,
     return ret ? ret : virtio_iommu_probe(s, &req, buf);
 }
 
+/* Make the @nb_done requests filled in @vq visible to the guest */
+static void virtio_iommu_complete(VirtIOIOMMU *s, VirtQueue *vq,
+                                  unsigned int nb_done)
+{
+    if (!nb_done) {
+        return;
+    }
+
+    /* The guest may reuse unmapped IOVAs as soon as it sees completions */
+    qemu_rec_mutex_lock(&s->mutex);
+    virtio_iommu_flush_unmaps(s);
+    qemu_rec_mutex_unlock(&s->mutex);
+
+    virtqueue_flush(vq, nb_done);
+    virtio_notify(VIRTIO_DEVICE(s), vq);
+}
+
 static void virtio_iommu_handle_command(VirtIODevice *vdev, VirtQueue *vq)
 {
     VirtIOIOMMU *s = VIRTIO_IOMMU(vdev);
@@ -760,6 +828,7 @@ static void virtio_iommu_handle_command(VirtIODevice *vdev, VirtQueue *vq)
     unsigned int iov_cnt;
     struct iovec *iov;
     void *buf = NULL;
+    unsigned int nb_done = 0;
     size_t sz;
 
     for (;;) {
@@ -767,15 +836,17 @@ static void virtio_iommu_handle_command(VirtIODevice *vdev, VirtQueue *vq)
 
         elem = virtqueue_pop(vq, sizeof(VirtQueueElement));
         if (!elem) {
-            return;
+            break;
         }
 
         if (iov_size(elem->in_sg, elem->in_num) < sizeof(tail) ||
             iov_size(elem->out_sg, elem->out_num) < sizeof(head)) {
-            virtio_error(vdev, "virtio-iommu bad head/tail size");
             virtqueue_detach_element(vq, elem, 0);
             g_free(elem);
-            break;
+            /* Complete the earlier requests before breaking the device */
+            virtio_iommu_complete(s, vq, nb_done);
+            virtio_error(vdev, "virtio-iommu bad head/tail size");
+            return;
         }
 
         iov_cnt = elem->out_num;
@@ -786,6 +857,9 @@ static void virtio_iommu_handle_command(VirtIODevice *vdev, VirtQueue *vq)
             goto out;
         }
         qemu_rec_mutex_lock(&s->mutex);
+        if (head.type != VIRTIO_IOMMU_T_UNMAP) {
+            virtio_iommu_flush_unmaps(s);
+        }
         switch (head.type) {
         case VIRTIO_IOMMU_T_ATTACH:
             tail.status = virtio_iommu_handle_attach(s, iov, iov_cnt);
@@ -820,12 +894,13 @@ out:
                           buf ? buf : &tail, output_size);
         assert(sz == output_size);
 
-        virtqueue_push(vq, elem, sz);
-        virtio_notify(vdev, vq);
+        virtqueue_fill(vq, elem, sz, nb_done++);
         g_free(elem);
         g_free(buf);
         buf = NULL;
     }
+
+    virtio_iommu_complete(s, vq, nb_done);
 }
 
 static void virtio_iommu_report_fault(VirtIOIOMMU *viommu, uint8_t reason,
@@ -988,6 +1063,23 @@ static IOMMUTLBEntry virtio_iommu_translate(IOMMUMemoryRegion *mr, hwaddr addr,
     }
     entry.translated_addr = addr - mapping_key->low + mapping_value->phys_addr;
     entry.perm = flag;
+
+    /*
+     * Return the largest aligned block of the mapping around @addr, so that
+     * users that cache translations, like vhost's device IOTLB, do not miss
+     * again on every page.  UNMAP always removes whole mappings, and the
+     * notification covers the block.
+     */
+    while (entry.addr_mask != UINT64_MAX) {
+        uint64_t mask = (entry.addr_mask << 1) | 1;
+
+        if ((addr & ~mask) < mapping_key->low ||
+            (addr | mask) > mapping_key->high ||
+            ((mapping_value->phys_addr - mapping_key->low) & mask)) {
+            break;
+        }
+        entry.addr_mask = mask;
+    }
     trace_virtio_iommu_translate_out(addr, entry.translated_addr, sid);
 
 unlock:
@@ -576,51 +576,41 @@ static void virtio_mem_deactivate_unplugged_memslots(VirtIOMEM *vmem,
     memory_region_transaction_commit();
 }
 
-static int virtio_mem_set_block_state(VirtIOMEM *vmem, uint64_t start_gpa,
-                                      uint64_t size, bool plug)
+/* Can be called outside of the BQL, see virtio_mem_prealloc_thread(). */
+static int virtio_mem_prealloc_blocks(VirtIOMEM *vmem, uint64_t offset,
+                                      uint64_t size)
 {
-    const uint64_t offset = start_gpa - vmem->addr;
-    RAMBlock *rb = vmem->memdev->mr.ram_block;
-    int ret = 0;
+    void *area = memory_region_get_ram_ptr(&vmem->memdev->mr) + offset;
+    int fd = memory_region_get_fd(&vmem->memdev->mr);
+    Error *local_err = NULL;
 
-    if (virtio_mem_is_busy()) {
-        return -EBUSY;
-    }
+    if (!qemu_prealloc_mem(fd, area, size, vmem->prealloc_threads, NULL,
+                           false, &local_err)) {
+        static bool warned;
 
-    if (!plug) {
-        if (ram_block_discard_range(rb, offset, size)) {
-            return -EBUSY;
-        }
-        virtio_mem_notify_unplug(vmem, offset, size);
-        virtio_mem_set_range_unplugged(vmem, start_gpa, size);
-        /* Deactivate completely unplugged memslots after updating the state. */
-        if (vmem->dynamic_memslots) {
-            virtio_mem_deactivate_unplugged_memslots(vmem, offset, size);
+        /*
+         * Warn only once, we don't want to fill the log with these
+         * warnings.
+         */
+        if (!warned) {
+            warn_report_err(local_err);
+            warned = true;
+        } else {
+            error_free(local_err);
         }
-        return 0;
+        return -EBUSY;
     }
+    return 0;
+}
 
-    if (vmem->prealloc) {
-        void *area = memory_region_get_ram_ptr(&vmem->memdev->mr) + offset;
-        int fd = memory_region_get_fd(&vmem->memdev->mr);
-        Error *local_err = NULL;
-
-        if (!qemu_prealloc_mem(fd, area, size, 1, NULL, false, &local_err)) {
-            static bool warned;
-
-            /*
-             * Warn only once, we don't want to fill the log with these
-             * warnings.
-             */
-            if (!warned) {
-                warn_report_err(local_err);
-                warned = true;
-            } else {
-                error_free(local_err);
-            }
-            ret = -EBUSY;
-        }
-    }
+/*
+ * Plug the blocks, once preallocated if needed.  @ret is the result of the
+ * preallocation: on error, the blocks are discarded again.
+ */
+static int virtio_mem_plug_blocks(VirtIOMEM *vmem, uint64_t start_gpa,
+                                  uint64_t size, int ret)
+{
+    const uint64_t offset = start_gpa - vmem->addr;
 
     if (!ret) {
         /*
@@ -650,12 +640,39 @@ static int virtio_mem_set_block_state(VirtIOMEM *vmem, uint64_t start_gpa,
     return 0;
 }
 
-static int virtio_mem_state_change_request(VirtIOMEM *vmem, uint64_t gpa,
-                                           uint16_t nb_blocks, bool plug)
+static int virtio_mem_set_block_state(VirtIOMEM *vmem, uint64_t start_gpa,
+                                      uint64_t size, bool plug)
 {
-    const uint64_t size = nb_blocks * vmem->block_size;
-    int ret;
+    const uint64_t offset = start_gpa - vmem->addr;
+    RAMBlock *rb = vmem->memdev->mr.ram_block;
+    int ret = 0;
 
+    if (virtio_mem_is_busy()) {
+        return -EBUSY;
+    }
+
+    if (!plug) {
+        if (ram_block_discard_range(rb, offset, size)) {
+            return -EBUSY;
+        }
+        virtio_mem_notify_unplug(vmem, offset, size);
+        virtio_mem_set_range_unplugged(vmem, start_gpa, size);
+        /* Deactivate completely unplugged memslots after updating the state. */
+        if (vmem->dynamic_memslots) {
+            virtio_mem_deactivate_unplugged_memslots(vmem, offset, size);
+        }
+        return 0;
+    }
+
+    if (vmem->prealloc) {
+        ret = virtio_mem_prealloc_blocks(vmem, offset, size);
+    }
+    return virtio_mem_plug_blocks(vmem, start_gpa, size, ret);
+}
+
+static uint16_t virtio_mem_state_change_check(VirtIOMEM *vmem, uint64_t gpa,
+                                              uint64_t size, bool plug)
+{
     if (!virtio_mem_valid_range(vmem, gpa, size)) {
         return VIRTIO_MEM_RESP_ERROR;
     }
@@ -669,8 +686,12 @@ static int virtio_mem_state_change_request(VirtIOMEM *vmem, uint64_t gpa,
         (!plug && !virtio_mem_is_range_plugged(vmem, gpa, size))) {
         return VIRTIO_MEM_RESP_ERROR;
     }
+    return VIRTIO_MEM_RESP_ACK;
+}
 
-    ret = virtio_mem_set_block_state(vmem, gpa, size, plug);
+static uint16_t virtio_mem_state_change_done(VirtIOMEM *vmem, uint64_t size,
+                                             bool plug, int ret)
+{
     if (ret) {
         return VIRTIO_MEM_RESP_BUSY;
     }
@@ -683,16 +704,142 @@ static int virtio_mem_state_change_request(VirtIOMEM *vmem, uint64_t gpa,
     return VIRTIO_MEM_RESP_ACK;
 }
 
+static int virtio_mem_state_change_request(VirtIOMEM *vmem, uint64_t gpa,
+                                           uint16_t nb_blocks, bool plug)
+{
+    const uint64_t size = nb_blocks * vmem->block_size;
+    uint16_t type;
+    int ret;
+
+    type = virtio_mem_state_change_check(vmem, gpa, size, plug);
+    if (type != VIRTIO_MEM_RESP_ACK) {
+        return type;
+    }
+
+    ret = virtio_mem_set_block_state(vmem, gpa, size, plug);
+    return virtio_mem_state_change_done(vmem, size, plug, ret);
+}
+
+static void *virtio_mem_prealloc_thread(void *opaque)
+{
+    VirtIOMEMPrealloc *p = opaque;
+    VirtIOMEM *vmem = p->vmem;
+
+    p->ret = virtio_mem_prealloc_blocks(vmem, p->gpa - vmem->addr, p->size);
+    qemu_bh_schedule(vmem->prealloc_bh);
+    return NULL;
+}
+
+/*
+ * Finish the plug request whose blocks were preallocated in the background,
+ * once its thread was joined.  The state of the device may have changed in
+ * the meantime, check the request again.
+ */
+static void virtio_mem_prealloc_complete(VirtIOMEM *vmem)
+{
+    g_autofree VirtIOMEMPrealloc *p = vmem->prealloc_req;
+    uint16_t type;
+    int ret;
+
+    vmem->prealloc_req = NULL;
+    trace_virtio_mem_prealloc_done(p->gpa, p->size, p->ret);
+
+    type = virtio_mem_state_change_check(vmem, p->gpa, p->size, true);
+    ret = p->ret;
+    if (!ret && (type != VIRTIO_MEM_RESP_ACK || virtio_mem_is_busy())) {
+        ret = -EBUSY;
+    }
+    ret = virtio_mem_plug_blocks(vmem, p->gpa, p->size, ret);
+    if (type == VIRTIO_MEM_RESP_ACK) {
+        type = virtio_mem_state_change_done(vmem, p->size, true, ret);
+    }
+
+    virtio_mem_send_response_simple(vmem, p->elem, type);
+    g_free(p->elem);
+}
+
+static void virtio_mem_handle_request(VirtIODevice *vdev, VirtQueue *vq);
+
+static void virtio_mem_prealloc_bh(void *opaque)
+{
+    VirtIOMEM *vmem = VIRTIO_MEM(opaque);
+
+    /* Already completed by virtio_mem_prealloc_drain() */
+    if (!vmem->prealloc_req) {
+        return;
+    }
+
+    qemu_thread_join(&vmem->prealloc_req->thread);
+    virtio_mem_prealloc_complete(vmem);
+    virtio_mem_handle_request(VIRTIO_DEVICE(vmem), vmem->vq);
+}
+
+/* Wait for the plug request in the background, if any, and complete it. */
+static void virtio_mem_prealloc_drain(VirtIOMEM *vmem)
+{
+    if (vmem->prealloc_req) {
+        /* The thread schedules the BH last: cancel it only once joined */
+        qemu_thread_join(&vmem->prealloc_req->thread);
+        qemu_bh_cancel(vmem->prealloc_bh);
+        virtio_mem_prealloc_complete(vmem);
+    }
+}
+
+static void virtio_mem_vm_state_change(void *opaque, bool running,
+                                       RunState state)
+{
+    VirtIOMEM *vmem = VIRTIO_MEM(opaque);
+
+    if (running) {
+        /* Pick up the requests that a drain left in the queue */
+        virtio_mem_handle_request(VIRTIO_DEVICE(vmem), vmem->vq);
+    } else {
+        /* No request may be in flight when the device state is saved */
+        virtio_mem_prealloc_drain(vmem);
+    }
+}
+
 static void virtio_mem_plug_request(VirtIOMEM *vmem, VirtQueueElement *elem,
                                     struct virtio_mem_req *req)
 {
     const uint64_t gpa = le64_to_cpu(req->u.plug.addr);
     const uint16_t nb_blocks = le16_to_cpu(req->u.plug.nb_blocks);
+    const uint64_t size = nb_blocks * vmem->block_size;
+    VirtIOMEMPrealloc *p;
     uint16_t type;
 
     trace_virtio_mem_plug_request(gpa, nb_blocks);
-    type = virtio_mem_state_change_request(vmem, gpa, nb_blocks, true);
-    virtio_mem_send_response_simple(vmem, elem, type);
+    if (!vmem->prealloc) {
+        type = virtio_mem_state_change_request(vmem, gpa, nb_blocks, true);
+        virtio_mem_send_response_simple(vmem, elem, type);
+        g_free(elem);
+        return;
+    }
+
+    type = virtio_mem_state_change_check(vmem, gpa, size, true);
+    if (type == VIRTIO_MEM_RESP_ACK && virtio_mem_is_busy()) {
+        type = VIRTIO_MEM_RESP_BUSY;
+    }
+    if (type != VIRTIO_MEM_RESP_ACK) {
+        virtio_mem_send_response_simple(vmem, elem, type);
+        g_free(elem);
+        return;
+    }
+
+    /*
+     * Preallocating hundreds of GiB takes a while, do not block the main
+     * loop meanwhile.  The request is completed from a bottom half, and the
+     * following ones stay in the queue until then.
+     */
+    p = g_new0(VirtIOMEMPrealloc, 1);
+    p->vmem = vmem;
+    p->elem = elem;
+    p->gpa = gpa;
+    p->size = size;
+    vmem->prealloc_req = p;
+    trace_virtio_mem_prealloc_start(gpa, size, vmem->prealloc_threads);
+    qemu_thread_create(&p->thread, "virtio-mem-prealloc",
+                       virtio_mem_prealloc_thread, p, QEMU_THREAD_JOINABLE);
 }
 
 static void virtio_mem_unplug_request(VirtIOMEM *vmem, VirtQueueElement *elem,
@@ -805,6 +952,10 @@ static void virtio_mem_handle_request(VirtIODevice *vdev, VirtQueue *vq)
     uint16_t type;
 
     while (true) {
+        if (vmem->prealloc_req) {
+            return;
+        }
+
         elem = virtqueue_pop(vq, sizeof(VirtQueueElement));
         if (!elem) {
             return;
@@ -831,8 +982,9 @@ static void virtio_mem_handle_request(VirtIODevice *vdev, VirtQueue *vq)
         type = le16_to_cpu(req.type);
         switch (type) {
         case VIRTIO_MEM_REQ_PLUG:
+            /* Takes ownership of the element */
             virtio_mem_plug_request(vmem, elem, &req);
-            break;
+            continue;
         case VIRTIO_MEM_REQ_UNPLUG:
             virtio_mem_unplug_request(vmem, elem, &req);
             break;
@@ -899,6 +1051,8 @@ static void virtio_mem_system_reset(void *opaque)
 {
     VirtIOMEM *vmem = VIRTIO_MEM(opaque);
 
+    virtio_mem_prealloc_drain(vmem);
+
     /*
      * During usual resets, we will unplug all memory and shrink the usable
      * region size. This is, however, not possible in all scenarios. Then,
@@ -907,6 +1061,11 @@ static void virtio_mem_system_reset(void *opaque)
     virtio_mem_unplug_all(vmem);
 }
 
+static void virtio_mem_device_reset(VirtIODevice *vdev)
+{
+    virtio_mem_prealloc_drain(VIRTIO_MEM(vdev));
+}
+
 static void virtio_mem_prepare_mr(VirtIOMEM *vmem)
 {
     const uint64_t region_size = memory_region_size(&vmem->memdev->mr);
@@ -982,6 +1141,12 @@ static void virtio_mem_device_realize(DeviceState *dev, Error **errp)
         return;
     }
 
+    if (!vmem->prealloc_threads) {
+        error_setg(errp, "'%s' property must be at least 1",
+                   VIRTIO_MEM_PREALLOC_THREADS_PROP);
+        return;
+    }
+
     if ((nb_numa_nodes && vmem->node >= nb_numa_nodes) ||
         (!nb_numa_nodes && vmem->node)) {
         error_setg(errp, "'%s' property has value '%" PRIu32 "', which exceeds"
@@ -1097,6 +1262,13 @@ static void virtio_mem_device_realize(DeviceState *dev, Error **errp)
 
     virtio_init(vdev, VIRTIO_ID_MEM, sizeof(struct virtio_mem_config));
     vmem->vq = virtio_add_queue(vdev, 128, virtio_mem_handle_request);
+    if (vmem->prealloc) {
+        vmem->prealloc_bh = qemu_bh_new_guarded(virtio_mem_prealloc_bh, vmem,
+                                                &dev->mem_reentrancy_guard);
+        vmem->prealloc_vmstate = qdev_add_vm_change_state_handler(dev,
+                                                 virtio_mem_vm_state_change,
+                                                 vmem);
+    }
 
     /*
      * With "dynamic-memslots=off" (old behavior) we always map the whole
@@ -1143,6 +1315,11 @@ static void virtio_mem_device_unrealize(DeviceState *dev)
      * found via an address space anymore. Unset ourselves.
      */
     memory_region_set_ram_discard_manager(&vmem->memdev->mr, NULL);
+    if (vmem->prealloc) {
+        virtio_mem_prealloc_drain(vmem);
+        qemu_del_vm_change_state_handler(vmem->prealloc_vmstate);
+        qemu_bh_delete(vmem->prealloc_bh);
+    }
     qemu_unregister_reset(virtio_mem_system_reset, vmem);
     if (vmem->early_migration) {
         vmstate_unregister(VMSTATE_IF(vmem), &vmstate_virtio_mem_device_early,
@@ -1248,7 +1425,8 @@ static int virtio_mem_prealloc_range_cb(VirtIOMEM *vmem, void *arg,
     int fd = memory_region_get_fd(&vmem->memdev->mr);
     Error *local_err = NULL;
 
-    if (!qemu_prealloc_mem(fd, area, size, 1, NULL, false, &local_err)) {
+    if (!qemu_prealloc_mem(fd, area, size, vmem->prealloc_threads, NULL, false,
+                           &local_err)) {
         error_report_err(local_err);
         return -ENOMEM;
     }
@@ -1686,6 +1864,8 @@ static Property virtio_mem_properties[] = {
     DEFINE_PROP_UINT64(VIRTIO_MEM_ADDR_PROP, VirtIOMEM, addr, 0),
     DEFINE_PROP_UINT32(VIRTIO_MEM_NODE_PROP, VirtIOMEM, node, 0),
     DEFINE_PROP_BOOL(VIRTIO_MEM_PREALLOC_PROP, VirtIOMEM, prealloc, false),
+    DEFINE_PROP_UINT32(VIRTIO_MEM_PREALLOC_THREADS_PROP, VirtIOMEM,
+                       prealloc_threads, 1),
     DEFINE_PROP_LINK(VIRTIO_MEM_MEMDEV_PROP, VirtIOMEM, memdev,
                      TYPE_MEMORY_BACKEND, HostMemoryBackend *),
 #if defined(VIRTIO_MEM_HAS_LEGACY_GUESTS)
@@ -1856,6 +2036,7 @@ static void virtio_mem_class_init(ObjectClass *klass, void *data)
     set_bit(DEVICE_CATEGORY_MISC, dc->categories);
     vdc->realize = virtio_mem_device_realize;
     vdc->unrealize = virtio_mem_device_unrealize;
+    vdc->reset = virtio_mem_device_reset;
     vdc->get_config = virtio_mem_get_config;
     vdc->get_features = virtio_mem_get_features;
     vdc->validate_features = virtio_mem_validate_features;
@@ -808,19 +808,22 @@ static uint32_t virtio_read_config(PCIDevice *pci_dev,
     return pci_default_read_config(pci_dev, address, len);
 }
 
+/*
+ * The route is only added to @c, the caller commits the changes of all the
+ * vectors it sets up at once.
+ */
 static int kvm_virtio_pci_vq_vector_use(VirtIOPCIProxy *proxy,
-                                        unsigned int vector)
+                                        unsigned int vector,
+                                        KVMRouteChange *c)
 {
     VirtIOIRQFD *irqfd = &proxy->vector_irqfd[vector];
     int ret;
 
     if (irqfd->users == 0) {
-        KVMRouteChange c = kvm_irqchip_begin_route_changes(kvm_state);
-        ret = kvm_irqchip_add_msi_route(&c, vector, &proxy->pci_dev);
+        ret = kvm_irqchip_add_msi_route(c, vector, &proxy->pci_dev);
         if (ret < 0) {
             return ret;
         }
-        kvm_irqchip_commit_route_changes(&c);
         irqfd->virq = ret;
     }
     irqfd->users++;
@@ -874,7 +877,8 @@ static int virtio_pci_get_notifier(VirtIOPCIProxy *proxy, int queue_no,
     return 0;
 }
 
-static int kvm_virtio_pci_vector_use_one(VirtIOPCIProxy *proxy, int queue_no)
+static int kvm_virtio_pci_vector_use_one(VirtIOPCIProxy *proxy, int queue_no,
+                                         KVMRouteChange *c)
 {
     unsigned int vector;
     int ret;
@@ -890,13 +894,14 @@ static int kvm_virtio_pci_vector_use_one(VirtIOPCIProxy *proxy, int queue_no)
     if (vector >= msix_nr_vectors_allocated(dev)) {
         return 0;
     }
-    ret = kvm_virtio_pci_vq_vector_use(proxy, vector);
+    ret = kvm_virtio_pci_vq_vector_use(proxy, vector, c);
     if (ret < 0) {
         goto undo;
     }
     /*
      * If guest supports masking, set up irqfd now.
      * Otherwise, delay until unmasked in the frontend.
+     * The route may not be committed yet, KVM updates the irqfd when it is.
      */
     if (vdev->use_guest_notifier_mask && k->guest_notifier_mask) {
         ret = kvm_virtio_pci_irqfd_use(proxy, n, vector);
@@ -922,7 +927,8 @@ undo:
     }
     return ret;
 }
-static int kvm_virtio_pci_vector_vq_use(VirtIOPCIProxy *proxy, int nvqs)
+static int kvm_virtio_pci_vector_vq_use(VirtIOPCIProxy *proxy, int nvqs,
+                                        KVMRouteChange *c)
 {
     int queue_no;
     int ret = 0;
@@ -932,14 +938,15 @@ static int kvm_virtio_pci_vector_vq_use(VirtIOPCIProxy *proxy, int nvqs)
         if (!virtio_queue_get_num(vdev, queue_no)) {
             return -1;
         }
-        ret = kvm_virtio_pci_vector_use_one(proxy, queue_no);
+        ret = kvm_virtio_pci_vector_use_one(proxy, queue_no, c);
     }
     return ret;
 }
 
-static int kvm_virtio_pci_vector_config_use(VirtIOPCIProxy *proxy)
+static int kvm_virtio_pci_vector_config_use(VirtIOPCIProxy *proxy,
+                                            KVMRouteChange *c)
 {
-    return kvm_virtio_pci_vector_use_one(proxy, VIRTIO_CONFIG_IRQ_IDX);
+    return kvm_virtio_pci_vector_use_one(proxy, VIRTIO_CONFIG_IRQ_IDX, c);
 }
 
 static void kvm_virtio_pci_vector_release_one(VirtIOPCIProxy *proxy,
@@ -1275,14 +1282,19 @@ static int virtio_pci_set_guest_notifiers(DeviceState *d, int nvqs, bool assign)
          (vdev->use_guest_notifier_mask && k->guest_notifier_mask)) &&
         assign) {
         if (with_irqfd) {
+            /* A single GSI routing update for all the vectors */
+            KVMRouteChange c = kvm_irqchip_begin_route_changes(kvm_state);
+
             proxy->vector_irqfd =
                 g_malloc0(sizeof(*proxy->vector_irqfd) *
                           msix_nr_vectors_allocated(&proxy->pci_dev));
-            r = kvm_virtio_pci_vector_vq_use(proxy, nvqs);
+            r = kvm_virtio_pci_vector_vq_use(proxy, nvqs, &c);
             if (r < 0) {
+                kvm_irqchip_commit_route_changes(&c);
                 goto config_assign_error;
             }
-            r = kvm_virtio_pci_vector_config_use(proxy);
+            r = kvm_virtio_pci_vector_config_use(proxy, &c);
+            kvm_irqchip_commit_route_changes(&c);
             if (r < 0) {
                 goto config_error;
             }
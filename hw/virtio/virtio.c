@@ -15,11 +15,13 @@
 #include "qapi/error.h"
 #include "qapi/qapi-commands-virtio.h"
 #include "trace.h"
+#include "qemu/counters.h"
 #include "qemu/defer-call.h"
 #include "qemu/error-report.h"
 #include "qemu/log.h"
 #include "qemu/main-loop.h"
 #include "qemu/module.h"
+#include "qemu/timer.h"
 #include "qom/object_interfaces.h"
 #include "hw/core/cpu.h"
 #include "hw/virtio/virtio.h"
@@ -116,6 +118,17 @@ typedef struct VRingPackedDescEvent {
     uint16_t flags;
 } VRingPackedDescEvent ;
 
+/*
+ * Number of descriptors an element of the pool has room for, an element
+ * with more is allocated with g_malloc().
+ */
+#define VIRTQUEUE_ELEM_POOL_SG 16
+
+/* A free slot of the element pool, see virtio_queue_enable_element_pool() */
+typedef struct VirtQueueElementSlot {
+    QSLIST_ENTRY(VirtQueueElementSlot) next;
+} VirtQueueElementSlot;
+
 struct VirtQueue
 {
     VRing vring;
@@ -152,6 +165,21 @@ struct VirtQueue
     EventNotifier host_notifier;
     bool host_notifier_enabled;
     QLIST_ENTRY(VirtQueue) node;
+
+    /* Element pool, elem_pool_sz is 0 if it is disabled */
+    size_t elem_pool_sz;
+    size_t elem_pool_slot_size;
+    unsigned int elem_pool_slots;
+    QSLIST_HEAD(, VirtQueueElementSlot) elem_pool;
+
+    /* Interrupt coalescing, coalesce_usecs is 0 if it is disabled */
+    uint32_t coalesce_usecs;
+    uint32_t coalesce_frames;
+    /* Notifications held back in the current window */
+    uint32_t coalesce_pending;
+    /* Whether they were for virtio_notify_irqfd() */
+    bool coalesce_irqfd;
+    QEMUTimer *coalesce_timer;
 };
 
 const char *virtio_device_names[] = {
@@ -605,12 +633,12 @@ static void vring_packed_desc_read(VirtIODevice *vdev,
         smp_rmb();
     }
 
-    address_space_read_cached(cache, off + offsetof(VRingPackedDesc, addr),
-                              &desc->addr, sizeof(desc->addr));
-    address_space_read_cached(cache, off + offsetof(VRingPackedDesc, id),
-                              &desc->id, sizeof(desc->id));
-    address_space_read_cached(cache, off + offsetof(VRingPackedDesc, len),
-                              &desc->len, sizeof(desc->len));
+    /* addr, len and id are contiguous, read them in one go */
+    QEMU_BUILD_BUG_ON(offsetof(VRingPackedDesc, addr) != 0 ||
+                      offsetof(VRingPackedDesc, len) != 8 ||
+                      offsetof(VRingPackedDesc, id) != 12);
+    address_space_read_cached(cache, off, desc,
+                              offsetof(VRingPackedDesc, flags));
     virtio_tswap64s(vdev, &desc->addr);
     virtio_tswap16s(vdev, &desc->id);
     virtio_tswap32s(vdev, &desc->len);
@@ -769,6 +797,10 @@ static void virtqueue_unmap_sg(VirtQueue *vq, const VirtQueueElement *elem,
                          elem->out_sg[i].iov_len);
 }
 
+static void virtqueue_ordered_fill(VirtQueue *vq, const VirtQueueElement *elem,
+                                   unsigned int len);
+static void virtqueue_ordered_flush(VirtQueue *vq);
+
 /* virtqueue_detach_element:
  * @vq: The #VirtQueue
  * @elem: The #VirtQueueElement
@@ -777,12 +809,29 @@ static void virtqueue_unmap_sg(VirtQueue *vq, const VirtQueueElement *elem,
  * Detach the element from the virtqueue.  This function is suitable for device
  * reset or other situations where a #VirtQueueElement is simply freed and will
  * not be pushed or discarded.
+ *
+ * With VIRTIO_F_IN_ORDER, the element is completed with a length of 0 while
+ * the device is running, so that the elements after it can still be used.
  */
 void virtqueue_detach_element(VirtQueue *vq, const VirtQueueElement *elem,
                               unsigned int len)
 {
-    vq->inuse -= elem->ndescs;
     virtqueue_unmap_sg(vq, elem, len);
+
+    if (virtio_vdev_has_feature(vq->vdev, VIRTIO_F_IN_ORDER) &&
+        (vq->vdev->status & VIRTIO_CONFIG_S_DRIVER_OK) &&
+        !virtio_device_disabled(vq->vdev) && vq->inuse) {
+        /*
+         * The ring position of the element must still be released, or
+         * the completions of all the elements popped after it would
+         * never be flushed.  Complete it with no data instead.
+         */
+        RCU_READ_LOCK_GUARD();
+        virtqueue_ordered_fill(vq, elem, 0);
+        virtqueue_ordered_flush(vq);
+        return;
+    }
+    vq->inuse -= elem->ndescs;
 }
 
 static void virtqueue_split_rewind(VirtQueue *vq, unsigned int num)
@@ -910,6 +959,63 @@ static void virtqueue_packed_fill_desc(VirtQueue *vq,
     vring_packed_desc_write(vq->vdev, &desc, &caches->desc, head, strict_order);
 }
 
+/*
+ * With VIRTIO_F_IN_ORDER, used_elems is indexed by ring position: the
+ * entry of an element is recorded when it is popped, and completions are
+ * only flushed to the used ring once all the elements popped before them
+ * have completed too.
+ */
+static void virtqueue_ordered_track(VirtQueue *vq, unsigned int pos,
+                                    const VirtQueueElement *elem)
+{
+    VirtQueueElement *uelem = &vq->used_elems[pos];
+
+    uelem->index = elem->index;
+    uelem->len = 0;
+    uelem->ndescs = elem->ndescs;
+    uelem->in_order_filled = false;
+}
+
+static void virtqueue_ordered_fill(VirtQueue *vq, const VirtQueueElement *elem,
+                                   unsigned int len)
+{
+    unsigned int i = vq->used_idx % vq->vring.num;
+    unsigned int seen = 0, step;
+    VirtQueueElement *uelem = NULL, *unfilled = NULL;
+
+    while (seen < vq->inuse) {
+        uelem = &vq->used_elems[i];
+        if (!uelem->in_order_filled) {
+            if (uelem->index == elem->index) {
+                break;
+            }
+            unfilled = unfilled ? unfilled : uelem;
+        }
+        step = MAX(uelem->ndescs, 1);
+        seen += step;
+        i = (i + step) % vq->vring.num;
+        uelem = NULL;
+    }
+
+    if (!uelem) {
+        /*
+         * Not tracked, e.g. popped before migration: complete it in the
+         * place of the oldest element that is still in flight.
+         */
+        uelem = unfilled;
+        if (!uelem) {
+            virtio_error(vq->vdev, "Used buffer %u was not in flight",
+                         elem->index);
+            return;
+        }
+        uelem->index = elem->index;
+    }
+    /* A zeroed entry that was never tracked may match index 0 as well */
+    uelem->ndescs = elem->ndescs;
+    uelem->len = len;
+    uelem->in_order_filled = true;
+}
+
 /* Called within rcu_read_lock().  */
 void virtqueue_fill(VirtQueue *vq, const VirtQueueElement *elem,
                     unsigned int len, unsigned int idx)
@@ -922,7 +1028,9 @@ void virtqueue_fill(VirtQueue *vq, const VirtQueueElement *elem,
         return;
     }
 
-    if (virtio_vdev_has_feature(vq->vdev, VIRTIO_F_RING_PACKED)) {
+    if (virtio_vdev_has_feature(vq->vdev, VIRTIO_F_IN_ORDER)) {
+        virtqueue_ordered_fill(vq, elem, len);
+    } else if (virtio_vdev_has_feature(vq->vdev, VIRTIO_F_RING_PACKED)) {
         virtqueue_packed_fill(vq, elem, len, idx);
     } else {
         virtqueue_split_fill(vq, elem, len, idx);
@@ -973,6 +1081,60 @@ static void virtqueue_packed_flush(VirtQueue *vq, unsigned int count)
     }
 }
 
+/*
+ * Flush the completed elements at the head of the in-order queue, writing
+ * their used entries first and publishing them with a single update of the
+ * used index, or of the flags of the first used descriptor.
+ */
+static void virtqueue_ordered_flush(VirtQueue *vq)
+{
+    unsigned int num = vq->vring.num;
+    unsigned int i = vq->used_idx % num;
+    unsigned int count = 0, ndescs = 0;
+    VirtQueueElement *uelem;
+    VRingUsedElem split_uelem;
+    bool packed = virtio_vdev_has_feature(vq->vdev, VIRTIO_F_RING_PACKED);
+
+    if (unlikely(packed ? !vq->vring.desc : !vq->vring.used)) {
+        return;
+    }
+
+    while (ndescs < vq->inuse && vq->used_elems[i].in_order_filled) {
+        uelem = &vq->used_elems[i];
+        if (packed) {
+            /* The first one makes the batch visible, write it last */
+            if (ndescs) {
+                virtqueue_packed_fill_desc(vq, uelem, ndescs, false);
+            }
+        } else {
+            split_uelem.id = uelem->index;
+            split_uelem.len = uelem->len;
+            vring_used_write(vq, &split_uelem, i);
+        }
+        uelem->in_order_filled = false;
+        count++;
+        ndescs += uelem->ndescs;
+        i = (i + uelem->ndescs) % num;
+    }
+
+    if (!count) {
+        return;
+    }
+
+    if (packed) {
+        virtqueue_packed_fill_desc(vq, &vq->used_elems[vq->used_idx], 0, true);
+        vq->inuse -= ndescs;
+        vq->used_idx += ndescs;
+        if (vq->used_idx >= vq->vring.num) {
+            vq->used_idx -= vq->vring.num;
+            vq->used_wrap_counter ^= 1;
+            vq->signalled_used_valid = false;
+        }
+    } else {
+        virtqueue_split_flush(vq, count);
+    }
+}
+
 void virtqueue_flush(VirtQueue *vq, unsigned int count)
 {
     if (virtio_device_disabled(vq->vdev)) {
@@ -980,7 +1142,9 @@ void virtqueue_flush(VirtQueue *vq, unsigned int count)
         return;
     }
 
-    if (virtio_vdev_has_feature(vq->vdev, VIRTIO_F_RING_PACKED)) {
+    if (virtio_vdev_has_feature(vq->vdev, VIRTIO_F_IN_ORDER)) {
+        virtqueue_ordered_flush(vq);
+    } else if (virtio_vdev_has_feature(vq->vdev, VIRTIO_F_RING_PACKED)) {
         virtqueue_packed_flush(vq, count);
     } else {
         virtqueue_split_flush(vq, count);
@@ -995,6 +1159,22 @@ void virtqueue_push(VirtQueue *vq, const VirtQueueElement *elem,
     virtqueue_flush(vq, 1);
 }
 
+void virtqueue_push_batch(VirtQueue *vq, VirtQueueElement *const *elems,
+                          const unsigned int *len, unsigned int count)
+{
+    unsigned int i;
+
+    if (!count) {
+        return;
+    }
+
+    RCU_READ_LOCK_GUARD();
+    for (i = 0; i < count; i++) {
+        virtqueue_fill(vq, elems[i], len ? len[i] : 0, i);
+    }
+    virtqueue_flush(vq, count);
+}
+
 /* Called within rcu_read_lock().  */
 static int virtqueue_num_heads(VirtQueue *vq, unsigned int idx)
 {
@@ -1473,9 +1653,77 @@ void virtqueue_map(VirtIODevice *vdev, VirtQueueElement *elem)
                                                                         false);
 }
 
-static void *virtqueue_alloc_element(size_t sz, unsigned out_num, unsigned in_num)
+static VirtQueueElement *virtqueue_pool_get(VirtQueue *vq, size_t size)
+{
+    VirtQueueElementSlot *slot;
+
+    if (vq->elem_pool_slot_size < size) {
+        return NULL;
+    }
+
+    slot = QSLIST_FIRST(&vq->elem_pool);
+    if (slot) {
+        QSLIST_REMOVE_HEAD(&vq->elem_pool, next);
+    } else if (vq->elem_pool_slots < vq->vring.num) {
+        /* The pool grows up to the queue depth */
+        slot = g_malloc(vq->elem_pool_slot_size);
+        vq->elem_pool_slots++;
+    } else {
+        return NULL;
+    }
+    return (VirtQueueElement *)slot;
+}
+
+static void virtqueue_pool_destroy(VirtQueue *vq)
+{
+    VirtQueueElementSlot *slot;
+
+    while ((slot = QSLIST_FIRST(&vq->elem_pool))) {
+        QSLIST_REMOVE_HEAD(&vq->elem_pool, next);
+        g_free(slot);
+    }
+    vq->elem_pool_sz = 0;
+    vq->elem_pool_slot_size = 0;
+    vq->elem_pool_slots = 0;
+}
+
+static void virtio_queue_coalesce_destroy(VirtQueue *vq)
+{
+    timer_free(vq->coalesce_timer);
+    vq->coalesce_timer = NULL;
+    vq->coalesce_usecs = 0;
+    vq->coalesce_pending = 0;
+}
+
+void virtio_queue_enable_element_pool(VirtQueue *vq, size_t sz)
 {
     VirtQueueElement *elem;
+
+    assert(sz >= sizeof(VirtQueueElement));
+    assert(!vq->elem_pool_sz);
+
+    vq->elem_pool_sz = sz;
+    vq->elem_pool_slot_size =
+        QEMU_ALIGN_UP(sz, __alignof__(elem->in_addr[0])) +
+        VIRTQUEUE_ELEM_POOL_SG * (sizeof(elem->in_addr[0]) +
+                                  sizeof(elem->in_sg[0]));
+    QSLIST_INIT(&vq->elem_pool);
+}
+
+void virtqueue_element_free(VirtQueue *vq, VirtQueueElement *elem)
+{
+    if (elem->pooled && vq->elem_pool_sz) {
+        QSLIST_INSERT_HEAD(&vq->elem_pool, (VirtQueueElementSlot *)elem, next);
+    } else {
+        g_free(elem);
+    }
+}
+
+/* @vq is NULL for an element that does not come from a virtqueue_pop() */
+static void *virtqueue_alloc_element(VirtQueue *vq, size_t sz,
+                                     unsigned out_num, unsigned in_num)
+{
+    VirtQueueElement *elem = NULL;
     size_t in_addr_ofs = QEMU_ALIGN_UP(sz, __alignof__(elem->in_addr[0]));
     size_t out_addr_ofs = in_addr_ofs + in_num * sizeof(elem->in_addr[0]);
     size_t out_addr_end = out_addr_ofs + out_num * sizeof(elem->out_addr[0]);
@@ -1484,7 +1732,15 @@ static void *virtqueue_alloc_element(size_t sz, unsigned out_num, unsigned in_nu
     size_t out_sg_end = out_sg_ofs + out_num * sizeof(elem->out_sg[0]);
 
     assert(sz >= sizeof(VirtQueueElement));
-    elem = g_malloc(out_sg_end);
+    if (vq && vq->elem_pool_sz == sz) {
+        elem = virtqueue_pool_get(vq, out_sg_end);
+    }
+    if (elem) {
+        elem->pooled = true;
+    } else {
+        elem = g_malloc(out_sg_end);
+        elem->pooled = false;
+    }
     trace_virtqueue_alloc_element(elem, sz, in_num, out_num);
     elem->out_num = out_num;
     elem->in_num = in_num;
@@ -1495,7 +1751,11 @@ static void *virtqueue_alloc_element(size_t sz, unsigned out_num, unsigned in_nu
     return elem;
 }
 
-static void *virtqueue_split_pop(VirtQueue *vq, size_t sz)
+/*
+ * Called within rcu_read_lock(), once the queue is known not to be empty.
+ * The caller updates the avail event.
+ */
+static void *virtqueue_split_pop_rcu(VirtQueue *vq, size_t sz)
 {
     unsigned int i, head, max;
     VRingMemoryRegionCaches *caches;
@@ -1512,14 +1772,6 @@ static void *virtqueue_split_pop(VirtQueue *vq, size_t sz)
 
     address_space_cache_init_empty(&indirect_desc_cache);
 
-    RCU_READ_LOCK_GUARD();
-    if (virtio_queue_empty_rcu(vq)) {
-        goto done;
-    }
-    /* Needed after virtio_queue_empty(), see comment in
-     * virtqueue_num_heads(). */
-    smp_rmb();
-
     /* When we start there are none of either input nor output. */
     out_num = in_num = elem_entries = 0;
 
@@ -1534,10 +1786,6 @@ static void *virtqueue_split_pop(VirtQueue *vq, size_t sz)
         goto done;
     }
 
-    if (virtio_vdev_has_feature(vdev, VIRTIO_RING_F_EVENT_IDX)) {
-        vring_set_avail_event(vq, vq->last_avail_idx);
-    }
-
     i = head;
 
     caches = vring_get_region_caches(vq);
@@ -1609,7 +1857,7 @@ static void *virtqueue_split_pop(VirtQueue *vq, size_t sz)
     }
 
     /* Now copy what we have collected and mapped */
-    elem = virtqueue_alloc_element(sz, out_num, in_num);
+    elem = virtqueue_alloc_element(vq, sz, out_num, in_num);
     elem->index = head;
     elem->ndescs = 1;
     for (i = 0; i < out_num; i++) {
@@ -1621,6 +1869,10 @@ static void *virtqueue_split_pop(VirtQueue *vq, size_t sz)
         elem->in_sg[i] = iov[out_num + i];
     }
 
+    if (virtio_vdev_has_feature(vdev, VIRTIO_F_IN_ORDER)) {
+        virtqueue_ordered_track(vq, (vq->last_avail_idx - 1) % vq->vring.num,
+                                elem);
+    }
     vq->inuse++;
 
     trace_virtqueue_pop(vq, elem, elem->in_num, elem->out_num);
@@ -1634,7 +1886,54 @@ err_undo_map:
     goto done;
 }
 
-static void *virtqueue_packed_pop(VirtQueue *vq, size_t sz)
+/*
+ * Pop up to @max elements with a single RCU critical section, a single
+ * read barrier unless the avail index has to be fetched again, and a
+ * single update of the avail event.
+ */
+static unsigned int virtqueue_split_pop_batch(VirtQueue *vq, void **elems,
+                                              unsigned int max, size_t sz)
+{
+    uint16_t last_avail_idx = vq->last_avail_idx;
+    unsigned int n = 0;
+    bool fetch;
+
+    RCU_READ_LOCK_GUARD();
+    while (n < max) {
+        fetch = vq->shadow_avail_idx == vq->last_avail_idx;
+        if (virtio_queue_empty_rcu(vq)) {
+            break;
+        }
+        /* Needed after virtio_queue_empty(), see comment in
+         * virtqueue_num_heads(). */
+        if (n == 0 || fetch) {
+            smp_rmb();
+        }
+
+        elems[n] = virtqueue_split_pop_rcu(vq, sz);
+        if (!elems[n]) {
+            break;
+        }
+        n++;
+    }
+
+    if (vq->last_avail_idx != last_avail_idx &&
+        virtio_vdev_has_feature(vq->vdev, VIRTIO_RING_F_EVENT_IDX)) {
+        vring_set_avail_event(vq, vq->last_avail_idx);
+    }
+    return n;
+}
+
+static void *virtqueue_split_pop(VirtQueue *vq, size_t sz)
+{
+    void *elem = NULL;
+
+    virtqueue_split_pop_batch(vq, &elem, 1, sz);
+    return elem;
+}
+
+/* Called within rcu_read_lock().  */
+static void *virtqueue_packed_pop_rcu(VirtQueue *vq, size_t sz)
 {
     unsigned int i, max;
     VRingMemoryRegionCaches *caches;
@@ -1652,7 +1951,6 @@ static void *virtqueue_packed_pop(VirtQueue *vq, size_t sz)
 
     address_space_cache_init_empty(&indirect_desc_cache);
 
-    RCU_READ_LOCK_GUARD();
     if (virtio_queue_packed_empty_rcu(vq)) {
         goto done;
     }
@@ -1737,7 +2035,7 @@ static void *virtqueue_packed_pop(VirtQueue *vq, size_t sz)
     } while (rc == VIRTQUEUE_READ_DESC_MORE);
 
     /* Now copy what we have collected and mapped */
-    elem = virtqueue_alloc_element(sz, out_num, in_num);
+    elem = virtqueue_alloc_element(vq, sz, out_num, in_num);
     for (i = 0; i < out_num; i++) {
         elem->out_addr[i] = addr[i];
         elem->out_sg[i] = iov[i];
@@ -1749,6 +2047,9 @@ static void *virtqueue_packed_pop(VirtQueue *vq, size_t sz)
 
     elem->index = id;
     elem->ndescs = (desc_cache == &indirect_desc_cache) ? 1 : elem_entries;
+    if (virtio_vdev_has_feature(vdev, VIRTIO_F_IN_ORDER)) {
+        virtqueue_ordered_track(vq, vq->last_avail_idx, elem);
+    }
     vq->last_avail_idx += elem->ndescs;
     vq->inuse += elem->ndescs;
 
@@ -1771,17 +2072,69 @@ err_undo_map:
     goto done;
 }
 
+static unsigned int virtqueue_packed_pop_batch(VirtQueue *vq, void **elems,
+                                               unsigned int max, size_t sz)
+{
+    unsigned int n;
+
+    RCU_READ_LOCK_GUARD();
+    for (n = 0; n < max; n++) {
+        elems[n] = virtqueue_packed_pop_rcu(vq, sz);
+        if (!elems[n]) {
+            break;
+        }
+    }
+    return n;
+}
+
+static void *virtqueue_packed_pop(VirtQueue *vq, size_t sz)
+{
+    void *elem;
+
+    return virtqueue_packed_pop_batch(vq, &elem, 1, sz) ? elem : NULL;
+}
+
+QEMU_COUNTER_DEFINE(virtqueue_pops, "virtqueue-pops")
+QEMU_COUNTER_DEFINE(virtqueue_kicks, "virtqueue-kicks")
+QEMU_COUNTER_DEFINE(virtqueue_interrupts, "virtqueue-interrupts")
+
 void *virtqueue_pop(VirtQueue *vq, size_t sz)
 {
+    void *elem;
+
     if (virtio_device_disabled(vq->vdev)) {
         return NULL;
     }
 
     if (virtio_vdev_has_feature(vq->vdev, VIRTIO_F_RING_PACKED)) {
-        return virtqueue_packed_pop(vq, sz);
+        elem = virtqueue_packed_pop(vq, sz);
+    } else {
+        elem = virtqueue_split_pop(vq, sz);
+    }
+    if (elem) {
+        qemu_counter_inc(&virtqueue_pops);
+    }
+    return elem;
+}
+
+unsigned int virtqueue_pop_batch(VirtQueue *vq, void **elems,
+                                 unsigned int max, size_t sz)
+{
+    unsigned int n;
+
+    if (virtio_device_disabled(vq->vdev)) {
+        return 0;
+    }
+
+    if (virtio_vdev_has_feature(vq->vdev, VIRTIO_F_RING_PACKED)) {
+        n = virtqueue_packed_pop_batch(vq, elems, max, sz);
     } else {
-        return virtqueue_split_pop(vq, sz);
+        n = virtqueue_split_pop_batch(vq, elems, max, sz);
+    }
+    if (n) {
+        qemu_counter_add(&virtqueue_pops, n);
     }
+    return n;
 }
 
 static unsigned int virtqueue_packed_drop_all(VirtQueue *vq)
@@ -1821,6 +2174,10 @@ static unsigned int virtqueue_packed_drop_all(VirtQueue *vq)
                                                vq->vring.num, &idx, false)) {
             ++elem.ndescs;
         }
+        if (virtio_vdev_has_feature(vdev, VIRTIO_F_IN_ORDER)) {
+            virtqueue_ordered_track(vq, vq->last_avail_idx, &elem);
+        }
+        vq->inuse += elem.ndescs;
         /*
          * immediately push the element, nothing to unmap
          * as both in_num and out_num are set to 0.
@@ -1851,6 +2208,11 @@ static unsigned int virtqueue_split_drop_all(VirtQueue *vq)
         if (!virtqueue_get_head(vq, vq->last_avail_idx, &elem.index)) {
             break;
         }
+        elem.ndescs = 1;
+        if (virtio_vdev_has_feature(vdev, VIRTIO_F_IN_ORDER)) {
+            virtqueue_ordered_track(vq, vq->last_avail_idx % vq->vring.num,
+                                    &elem);
+        }
         vq->inuse++;
         vq->last_avail_idx++;
         if (fEventIdx) {
@@ -1919,7 +2281,7 @@ void *qemu_get_virtqueue_element(VirtIODevice *vdev, QEMUFile *f, size_t sz)
     assert(ARRAY_SIZE(data.in_addr) >= data.in_num);
     assert(ARRAY_SIZE(data.out_addr) >= data.out_num);
 
-    elem = virtqueue_alloc_element(sz, data.out_num, data.in_num);
+    elem = virtqueue_alloc_element(NULL, sz, data.out_num, data.in_num);
     elem->index = data.index;
 
     for (i = 0; i < elem->in_num; i++) {
@@ -2087,6 +2449,14 @@ static void __virtio_queue_reset(VirtIODevice *vdev, uint32_t i)
     vdev->vq[i].notification = true;
     vdev->vq[i].vring.num = vdev->vq[i].vring.num_default;
     vdev->vq[i].inuse = 0;
+    if (vdev->vq[i].coalesce_timer) {
+        timer_del(vdev->vq[i].coalesce_timer);
+    }
+    vdev->vq[i].coalesce_pending = 0;
+    if (vdev->vq[i].used_elems) {
+        memset(vdev->vq[i].used_elems, 0,
+               vdev->vq[i].vring.num_default * sizeof(VirtQueueElement));
+    }
     virtio_virtqueue_reset_region_cache(&vdev->vq[i]);
 }
 
@@ -2197,6 +2567,11 @@ void virtio_queue_set_num(VirtIODevice *vdev, int n, int num)
         num < 0) {
         return;
     }
+    if (num > vdev->vq[n].vring.num_default) {
+        /* used_elems is indexed by ring position with VIRTIO_F_IN_ORDER */
+        g_free(vdev->vq[n].used_elems);
+        vdev->vq[n].used_elems = g_new0(VirtQueueElement, num);
+    }
     vdev->vq[n].vring.num = num;
 }
 
@@ -2282,6 +2657,7 @@ void virtio_queue_notify(VirtIODevice *vdev, int n)
     }
 
     trace_virtio_queue_notify(vdev, vq - vdev->vq, vq);
+    qemu_counter_inc(&virtqueue_kicks);
     if (vq->host_notifier_enabled) {
         event_notifier_set(&vq->host_notifier);
     } else if (vq->handle_output) {
@@ -2346,6 +2722,8 @@ void virtio_delete_queue(VirtQueue *vq)
     g_free(vq->used_elems);
     vq->used_elems = NULL;
     virtio_virtqueue_reset_region_cache(vq);
+    virtqueue_pool_destroy(vq);
+    virtio_queue_coalesce_destroy(vq);
 }
 
 void virtio_del_queue(VirtIODevice *vdev, int n)
@@ -2456,6 +2834,94 @@ static void virtio_notify_irqfd_deferred_fn(void *opaque)
     event_notifier_set(notifier);
 }
 
+/* Same for the interrupts that are injected from userspace */
+static void virtio_notify_deferred_fn(void *opaque)
+{
+    VirtQueue *vq = opaque;
+
+    trace_virtio_notify_deferred_fn(vq->vdev, vq);
+    virtio_notify_vector(vq->vdev, vq->vector);
+}
+
+static void virtio_irq(VirtQueue *vq)
+{
+    virtio_set_isr(vq->vdev, 0x1);
+    virtio_notify_vector(vq->vdev, vq->vector);
+}
+
+static void virtio_queue_coalesce_send(VirtQueue *vq)
+{
+    trace_virtio_notify_coalesced(vq->vdev, vq, vq->coalesce_pending);
+    qemu_counter_inc(&virtqueue_interrupts);
+    vq->coalesce_pending = 0;
+    if (vq->coalesce_irqfd) {
+        virtio_set_isr(vq->vdev, 0x1);
+        event_notifier_set(&vq->guest_notifier);
+    } else {
+        virtio_irq(vq);
+    }
+}
+
+static void virtio_queue_coalesce_timer_cb(void *opaque)
+{
+    VirtQueue *vq = opaque;
+
+    if (vq->coalesce_pending) {
+        virtio_queue_coalesce_send(vq);
+    }
+}
+
+/*
+ * Returns true if a notification that virtio_should_notify() asked for must
+ * be sent now.  The first notification of a window goes out immediately, so
+ * that coalescing adds no latency when the queue is mostly idle; the
+ * following ones are held back until the window of coalesce_usecs closes or
+ * coalesce_frames of them are pending.
+ */
+static bool virtio_queue_coalesce(VirtQueue *vq, bool irqfd)
+{
+    if (!vq->coalesce_usecs) {
+        return true;
+    }
+
+    if (!timer_pending(vq->coalesce_timer)) {
+        timer_mod(vq->coalesce_timer,
+                  qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) +
+                  (int64_t)vq->coalesce_usecs * SCALE_US);
+        return true;
+    }
+
+    vq->coalesce_irqfd = irqfd;
+    vq->coalesce_pending++;
+    if (vq->coalesce_frames && vq->coalesce_pending >= vq->coalesce_frames) {
+        vq->coalesce_pending = 0;
+        return true;
+    }
+    return false;
+}
+
+/* Send the notifications held back by coalescing */
+static void virtio_queue_coalesce_flush(VirtQueue *vq)
+{
+    timer_del(vq->coalesce_timer);
+    if (vq->coalesce_pending) {
+        virtio_queue_coalesce_send(vq);
+    }
+}
+
+void virtio_queue_set_notification_coalescing(VirtQueue *vq, uint32_t usecs,
+                                              uint32_t frames)
+{
+    if (vq->coalesce_timer) {
+        virtio_queue_coalesce_flush(vq);
+    } else if (usecs) {
+        vq->coalesce_timer = timer_new_ns(QEMU_CLOCK_VIRTUAL,
+                                          virtio_queue_coalesce_timer_cb, vq);
+    }
+    vq->coalesce_usecs = usecs;
+    vq->coalesce_frames = frames;
+}
+
 void virtio_notify_irqfd(VirtIODevice *vdev, VirtQueue *vq)
 {
     WITH_RCU_READ_LOCK_GUARD() {
@@ -2464,7 +2930,12 @@ void virtio_notify_irqfd(VirtIODevice *vdev, VirtQueue *vq)
         }
     }
 
+    if (!virtio_queue_coalesce(vq, true)) {
+        return;
+    }
+
     trace_virtio_notify_irqfd(vdev, vq);
+    qemu_counter_inc(&virtqueue_interrupts);
 
     /*
      * virtio spec 1.0 says ISR bit 0 should be ignored with MSI, but
@@ -2485,12 +2956,6 @@ void virtio_notify_irqfd(VirtIODevice *vdev, VirtQueue *vq)
     defer_call(virtio_notify_irqfd_deferred_fn, &vq->guest_notifier);
 }
 
-static void virtio_irq(VirtQueue *vq)
-{
-    virtio_set_isr(vq->vdev, 0x1);
-    virtio_notify_vector(vq->vdev, vq->vector);
-}
-
 void virtio_notify(VirtIODevice *vdev, VirtQueue *vq)
 {
     WITH_RCU_READ_LOCK_GUARD() {
@@ -2499,8 +2964,14 @@ void virtio_notify(VirtIODevice *vdev, VirtQueue *vq)
         }
     }
 
+    if (!virtio_queue_coalesce(vq, false)) {
+        return;
+    }
+
     trace_virtio_notify(vdev, vq);
-    virtio_irq(vq);
+    qemu_counter_inc(&virtqueue_interrupts);
+    virtio_set_isr(vq->vdev, 0x1);
+    defer_call(virtio_notify_deferred_fn, vq);
 }
 
 void virtio_notify_config(VirtIODevice *vdev)
@@ -3180,6 +3651,9 @@ virtio_load(VirtIODevice *vdev, QEMUFile *f, int version_id)
 void virtio_cleanup(VirtIODevice *vdev)
 {
     qemu_del_vm_change_state_handler(vdev->vmstate);
+    g_free(vdev->shmem_list);
+    vdev->shmem_list = NULL;
+    vdev->n_shmem_regions = 0;
 }
 
 static void virtio_vmstate_change(void *opaque, bool running, RunState state)
@@ -3190,6 +3664,15 @@ static void virtio_vmstate_change(void *opaque, bool running, RunState state)
     bool backend_run = running && virtio_device_started(vdev, vdev->status);
     vdev->vm_running = running;
 
+    if (!running) {
+        /* The state of coalescing is not migrated */
+        for (int i = 0; i < VIRTIO_QUEUE_MAX; i++) {
+            if (vdev->vq[i].coalesce_timer) {
+                virtio_queue_coalesce_flush(&vdev->vq[i]);
+            }
+        }
+    }
+
     if (backend_run) {
         virtio_set_status(vdev, vdev->status);
     }
@@ -3668,6 +4151,7 @@ void virtio_queue_host_notifier_read(EventNotifier *n)
 {
     VirtQueue *vq = container_of(n, VirtQueue, host_notifier);
     if (event_notifier_test_and_clear(n)) {
+        qemu_counter_inc(&virtqueue_kicks);
         virtio_queue_notify_vq(vq);
     }
 }
@@ -3700,6 +4184,19 @@ int virtio_queue_set_host_notifier_mr(VirtIODevice *vdev, int n,
     return -1;
 }
 
+unsigned int virtio_add_shmem_region(VirtIODevice *vdev, MemoryRegion *mr)
+{
+    vdev->shmem_list = g_renew(MemoryRegion *, vdev->shmem_list,
+                               vdev->n_shmem_regions + 1);
+    vdev->shmem_list[vdev->n_shmem_regions] = mr;
+    return vdev->n_shmem_regions++;
+}
+
+MemoryRegion *virtio_get_shmem_region(VirtIODevice *vdev, unsigned int shmid)
+{
+    return shmid < vdev->n_shmem_regions ? vdev->shmem_list[shmid] : NULL;
+}
+
 void virtio_device_set_child_bus_name(VirtIODevice *vdev, char *bus_name)
 {
     g_free(vdev->bus_name);
@@ -3792,6 +4289,8 @@ static void virtio_device_free_virtqueues(VirtIODevice *vdev)
             break;
         }
         virtio_virtqueue_reset_region_cache(&vdev->vq[i]);
+        virtqueue_pool_destroy(&vdev->vq[i]);
+        virtio_queue_coalesce_destroy(&vdev->vq[i]);
     }
     g_free(vdev->vq);
 }
@@ -399,8 +399,9 @@ ram_addr_t xen_ram_addr_from_mapcache(void *ptr)
             trace_xen_ram_addr_from_mapcache_found(reventry->paddr_index,
                                                    reventry->vaddr_req);
         }
-        abort();
-        return 0;
+        /* Not a mapping of guest memory, for example a bounce buffer */
+        mapcache_unlock();
+        return RAM_ADDR_INVALID;
     }
 
     entry = &mapcache->entry[paddr_index % mapcache->nr_buckets];
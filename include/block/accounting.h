@@ -79,6 +79,13 @@ typedef struct BlockLatencyHistogram {
     uint64_t *bins;
 } BlockLatencyHistogram;
 
+/*
+ * Buckets of the latency distribution that is always collected: bucket 0
+ * counts the requests that completed in 0 ns, and bucket i those whose
+ * latency is in [2^(i-1), 2^i) ns.
+ */
+#define BLOCK_ACCT_LATENCY_LOG2_BUCKETS 64
+
 struct BlockAcctStats {
     QemuMutex lock;
     uint64_t nr_bytes[BLOCK_MAX_IOTYPE];
@@ -92,6 +99,7 @@ struct BlockAcctStats {
     bool account_invalid;
     bool account_failed;
     BlockLatencyHistogram latency_histogram[BLOCK_MAX_IOTYPE];
+    uint64_t latency_log2[BLOCK_MAX_IOTYPE][BLOCK_ACCT_LATENCY_LOG2_BUCKETS];
 };
 
 typedef struct BlockAcctCookie {
@@ -120,5 +128,7 @@ double block_acct_queue_depth(BlockAcctTimedStats *stats,
 int block_latency_histogram_set(BlockAcctStats *stats, enum BlockAcctType type,
                                 uint64List *boundaries);
 void block_latency_histograms_clear(BlockAcctStats *stats);
+uint64List *block_acct_latency_log2(BlockAcctStats *stats,
+                                    enum BlockAcctType type);
 
 #endif
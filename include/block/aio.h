@@ -53,7 +53,7 @@ typedef void QEMUBHFunc(void *opaque);
 typedef bool AioPollFn(void *opaque);
 typedef void IOHandler(void *opaque);
 
-struct ThreadPool;
+struct ThreadPoolAio;
 struct LinuxAioState;
 typedef struct LuringState LuringState;
 
@@ -206,13 +206,17 @@ struct AioContext {
     /* Thread pool for performing work and receiving completion callbacks.
      * Has its own locking.
      */
-    struct ThreadPool *thread_pool;
+    struct ThreadPoolAio *thread_pool;
 
 #ifdef CONFIG_LINUX_AIO
     struct LinuxAioState *linux_aio;
 #endif
 #ifdef CONFIG_LINUX_IO_URING
     LuringState *linux_io_uring;
+    /* Ring set up with IORING_SETUP_IOPOLL, for files with aio-iopoll=on */
+    LuringState *linux_io_uring_iopoll;
+    /* Ring with 128-byte entries, for IORING_OP_URING_CMD commands */
+    LuringState *linux_io_uring_cmd;
 
     /* State for file descriptor monitoring using Linux io_uring */
     struct io_uring fdmon_io_uring;
@@ -227,14 +231,22 @@ struct AioContext {
     /* Number of AioHandlers without .io_poll() */
     int poll_disable_cnt;
 
-    /* Polling mode parameters */
-    int64_t poll_ns;        /* current polling time in nanoseconds */
+    /*
+     * Polling mode parameters.  The polling time itself is adapted for each
+     * AioHandler, see AioHandler::poll_ns.
+     */
     int64_t poll_max_ns;    /* maximum polling time in nanoseconds */
     int64_t poll_grow;      /* polling time growth factor */
     int64_t poll_shrink;    /* polling time shrink factor */
+    int64_t poll_budget;    /* maximum share of time spent polling, in % */
+
+    /* Time spent polling in the current budget window */
+    int64_t poll_budget_start_ns;
+    int64_t poll_budget_used_ns;
 
     /* AIO engine parameters */
     int64_t aio_max_batch;  /* maximum number of requests in a batch */
+    int64_t aio_sqpoll_idle; /* io_uring SQ polling idle time in ms */
 
     /*
      * List of handlers participating in userspace polling.  Protected by
@@ -499,8 +511,8 @@ void aio_set_event_notifier_poll(AioContext *ctx,
  */
 GSource *aio_get_g_source(AioContext *ctx);
 
-/* Return the ThreadPool bound to this AioContext */
-struct ThreadPool *aio_get_thread_pool(AioContext *ctx);
+/* Return the ThreadPoolAio bound to this AioContext */
+struct ThreadPoolAio *aio_get_thread_pool(AioContext *ctx);
 
 /* Setup the LinuxAioState bound to this AioContext */
 struct LinuxAioState *aio_setup_linux_aio(AioContext *ctx, Error **errp);
@@ -513,6 +525,18 @@ LuringState *aio_setup_linux_io_uring(AioContext *ctx, Error **errp);
 
 /* Return the LuringState bound to this AioContext */
 LuringState *aio_get_linux_io_uring(AioContext *ctx);
+
+/* Setup the polled LuringState bound to this AioContext */
+LuringState *aio_setup_linux_io_uring_iopoll(AioContext *ctx, Error **errp);
+
+/* Return the polled LuringState bound to this AioContext */
+LuringState *aio_get_linux_io_uring_iopoll(AioContext *ctx);
+
+/* Setup the LuringState for passthrough commands bound to this AioContext */
+LuringState *aio_setup_linux_io_uring_cmd(AioContext *ctx, Error **errp);
+
+/* Return the LuringState for passthrough commands bound to this AioContext */
+LuringState *aio_get_linux_io_uring_cmd(AioContext *ctx);
 /**
  * aio_timer_new_with_attrs:
  * @ctx: the aio context
@@ -691,20 +715,25 @@ void aio_context_use_g_source(AioContext *ctx);
  * @max_ns: how long to busy poll for, in nanoseconds
  * @grow: polling time growth factor
  * @shrink: polling time shrink factor
+ * @budget: maximum percentage of time spent busy polling, 0 for no limit
  *
  * Poll mode can be disabled by setting poll_max_ns to 0.
  */
 void aio_context_set_poll_params(AioContext *ctx, int64_t max_ns,
                                  int64_t grow, int64_t shrink,
-                                 Error **errp);
+                                 int64_t budget, Error **errp);
 
 /**
  * aio_context_set_aio_params:
  * @ctx: the aio context
  * @max_batch: maximum number of requests in a batch, 0 means that the
  *             engine will use its default
+ * @sqpoll_idle: milliseconds after which the io_uring submission queue
+ *               polling thread goes to sleep, 0 disables the thread.
+ *               Only applies to rings created afterwards.
  */
-void aio_context_set_aio_params(AioContext *ctx, int64_t max_batch);
+void aio_context_set_aio_params(AioContext *ctx, int64_t max_batch,
+                                int64_t sqpoll_idle);
 
 /**
  * aio_context_set_thread_pool_params:
@@ -255,6 +255,7 @@ typedef enum {
 #define BDRV_OPT_AUTO_READ_ONLY "auto-read-only"
 #define BDRV_OPT_DISCARD        "discard"
 #define BDRV_OPT_FORCE_SHARE    "force-share"
+#define BDRV_OPT_BACKING_STATUS_CACHE "backing-status-cache"
 
 
 #define BDRV_SECTOR_BITS   9
@@ -40,6 +40,13 @@ void block_copy_reset(BlockCopyState *s, int64_t offset, int64_t bytes);
 int64_t coroutine_fn GRAPH_RDLOCK
 block_copy_reset_unallocated(BlockCopyState *s, int64_t offset, int64_t *count);
 
+/*
+ * Return true if nothing is left to copy in the region and no copy is in
+ * flight there, i.e. block_copy() on the region would have nothing to do.
+ */
+bool coroutine_fn block_copy_is_clean(BlockCopyState *s, int64_t offset,
+                                      int64_t bytes);
+
 int coroutine_fn block_copy(BlockCopyState *s, int64_t offset, int64_t bytes,
                             bool ignore_ratelimit, uint64_t timeout_ns,
                             BlockCopyAsyncCallbackFunc cb,
@@ -28,6 +28,7 @@
 #include "block/block-common.h"
 #include "block/block-global-state.h"
 #include "block/snapshot.h"
+#include "qemu/interval-tree.h"
 #include "qemu/iov.h"
 #include "qemu/rcu.h"
 #include "qemu/stats64.h"
@@ -1069,6 +1070,28 @@ typedef struct BdrvBlockStatusCache {
     int64_t data_end;
 } BdrvBlockStatusCache;
 
+/*
+ * Lets bdrv_co_block_status_above() skip the backing chain of a node for
+ * ranges that the node does not allocate: each extent remembers which
+ * node of the chain was found to allocate the range, or the bottom of the
+ * chain if none does.
+ *
+ * Extents are dropped when a node of the chain is written to, and all of
+ * them when the graph below the node changes.
+ *
+ * @lock: Protects all fields
+ * @gen: Incremented whenever extents are dropped, so that results of
+ *       walks that raced with the invalidation are not added
+ * @extents: BdrvChainStatusExtent objects, which do not overlap
+ * @nr_extents: Number of extents in @extents
+ */
+typedef struct BdrvChainStatusCache {
+    QemuMutex lock;
+    uint64_t gen;
+    IntervalTreeRoot extents;
+    unsigned nr_extents;
+} BdrvChainStatusCache;
+
 struct BlockDriverState {
     /*
      * Protected by big QEMU lock or read-only after opening.  No special
@@ -1254,6 +1277,8 @@ struct BlockDriverState {
     CoMutex bsc_modify_lock;
     /* Always non-NULL, but must only be dereferenced under an RCU read guard */
     BdrvBlockStatusCache *block_status_cache;
+    /* NULL unless enabled with the backing-status-cache option */
+    BdrvChainStatusCache *chain_status_cache;
 
     /* array of write pointers' location of each zone in the zoned device. */
     BlockZoneWps *wps;
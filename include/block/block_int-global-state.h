@@ -112,6 +112,8 @@ void commit_start(const char *job_id, BlockDriverState *bs,
  * @filter_node_name: The node name that should be assigned to the filter
  * driver that the commit job inserts into the graph above @bs. NULL means that
  * a node name should be autogenerated.
+ * @bitmap: If not NULL, a bitmap of @bs; only the clusters that are dirty in
+ * it are committed.
  * @cb: Completion function for the job.
  * @opaque: Opaque pointer value passed to @cb.
  * @auto_complete: Auto complete the job.
@@ -122,6 +124,7 @@ BlockJob *commit_active_start(const char *job_id, BlockDriverState *bs,
                               BlockDriverState *base, int creation_flags,
                               int64_t speed, BlockdevOnError on_error,
                               const char *filter_node_name,
+                              BdrvDirtyBitmap *bitmap,
                               BlockCompletionFunc *cb, void *opaque,
                               bool auto_complete, Error **errp);
 /*
@@ -147,6 +150,7 @@ BlockJob *commit_active_start(const char *job_id, BlockDriverState *bs,
  * driver that the mirror job inserts into the graph above @bs. NULL means that
  * a node name should be autogenerated.
  * @copy_mode: When to trigger writes to the target.
+ * @perf: Performance options.
  * @errp: Error object.
  *
  * Start a mirroring operation on @bs.  Clusters that are allocated
@@ -163,7 +167,8 @@ void mirror_start(const char *job_id, BlockDriverState *bs,
                   BlockdevOnError on_source_error,
                   BlockdevOnError on_target_error,
                   bool unmap, const char *filter_node_name,
-                  MirrorCopyMode copy_mode, Error **errp);
+                  MirrorCopyMode copy_mode, const MirrorPerf *perf,
+                  Error **errp);
 
 /*
  * backup_job_create:
@@ -191,4 +191,30 @@ void bdrv_bsc_invalidate_range(BlockDriverState *bs,
  */
 void bdrv_bsc_fill(BlockDriverState *bs, int64_t offset, int64_t bytes);
 
+/**
+ * Look up the node of the backing chain of @bs that provides the block
+ * status at @offset, according to the chain status cache of @bs.
+ *
+ * *@gen is set in any case, to be passed to bdrv_csc_fill().  If the cache
+ * has an extent at @offset, *@node is set to the node and *@bytes is
+ * limited to the end of the extent, and true is returned.
+ */
+bool bdrv_csc_lookup(BlockDriverState *bs, int64_t offset, int64_t *bytes,
+                     BlockDriverState **node, uint64_t *gen);
+
+/**
+ * Record that @node provides the block status of [offset, offset + bytes)
+ * for the backing chain of @bs, unless the cache was invalidated since
+ * bdrv_csc_lookup() returned @gen.
+ */
+void bdrv_csc_fill(BlockDriverState *bs, uint64_t gen, int64_t offset,
+                   int64_t bytes, BlockDriverState *node);
+
+/**
+ * Drop what the chain status caches of the nodes above @bs know about
+ * [offset, offset + bytes), after a write to @bs.
+ */
+void bdrv_csc_invalidate_range(BlockDriverState *bs,
+                               int64_t offset, int64_t bytes);
+
 #endif /* BLOCK_INT_IO_H */
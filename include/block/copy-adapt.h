@@ -0,0 +1,62 @@
+/*
+ * Adaptive chunk size and parallelism for block jobs copying data
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#ifndef BLOCK_COPY_ADAPT_H
+#define BLOCK_COPY_ADAPT_H
+
+/*
+ * CopyAdapt tunes the size and number of the requests a job keeps in flight
+ * from the throughput and latency it observes:
+ *
+ * - the chunk size is halved when requests take longer than a target
+ *   latency, so that guest requests that have to wait for an intersecting
+ *   copy are not delayed for too long, and doubled again when requests
+ *   complete well within the target;
+ *
+ * - the number of workers is searched by hill climbing on the throughput.
+ *   It starts at the maximum and keeps moving in the same direction while
+ *   throughput does not drop, so that the job ends up using as few
+ *   parallel requests as it needs for the bandwidth the storage gives it.
+ *
+ * Not thread-safe, users serialize the calls.
+ */
+typedef struct CopyAdapt {
+    /* Current limits, read directly by the user */
+    int64_t chunk;
+    int workers;
+
+    /* Bounds, the chunk size is always a multiple of min_chunk */
+    int64_t min_chunk;
+    int64_t max_chunk;
+    int max_workers;
+
+    /* Measurement window */
+    int64_t window_start_ns;
+    uint64_t window_bytes;
+    uint64_t window_requests;
+    int64_t window_latency_ns;
+
+    /* Throughput of the previous window in bytes/s, 0 if none */
+    uint64_t last_rate;
+    /* Direction of the next change of workers, +1 or -1 */
+    int direction;
+} CopyAdapt;
+
+void copy_adapt_init(CopyAdapt *a, int64_t min_chunk, int64_t max_chunk,
+                     int max_workers);
+
+/*
+ * Record that a request of @bytes completed in @latency_ns.  Returns true
+ * if the limits changed.
+ */
+bool copy_adapt_account(CopyAdapt *a, uint64_t bytes, int64_t latency_ns);
+
+/* Same, with the current QEMU_CLOCK_REALTIME time given in @now */
+bool copy_adapt_account_at(CopyAdapt *a, uint64_t bytes, int64_t latency_ns,
+                           int64_t now);
+
+#endif /* BLOCK_COPY_ADAPT_H */
@@ -78,6 +78,8 @@ typedef struct NBDRequest {
     uint16_t type;  /* NBD_CMD_* */
     NBDMode mode;   /* Determines which network representation to use */
     NBDMetaContexts *contexts; /* Used by NBD_CMD_BLOCK_STATUS */
+    char *src_export;       /* Used by NBD_CMD_COPY, server side only */
+    uint64_t src_offset;    /* Used by NBD_CMD_COPY, server side only */
 } NBDRequest;
 
 typedef struct NBDSimpleReply {
@@ -180,6 +182,13 @@ typedef struct NBDBlockStatusPayload {
     /* uint32_t ids[] follows, array length implied by header */
 } QEMU_PACKED NBDBlockStatusPayload;
 
+/* Client payload for NBD_CMD_COPY, an experimental QEMU extension */
+typedef struct NBDCopyPayload {
+    uint64_t effect_length;
+    uint64_t src_offset;
+    /* char src_export[] follows, not NUL-terminated, length implied */
+} QEMU_PACKED NBDCopyPayload;
+
 /* Transmission (export) flags: sent from server to client during handshake,
    but describe what will happen during transmission */
 enum {
@@ -197,6 +206,11 @@ enum {
     NBD_FLAG_SEND_CACHE_BIT         = 10, /* Send CACHE (prefetch) */
     NBD_FLAG_SEND_FAST_ZERO_BIT     = 11, /* FAST_ZERO flag for WRITE_ZEROES */
     NBD_FLAG_BLOCK_STAT_PAYLOAD_BIT = 12, /* PAYLOAD flag for BLOCK_STATUS */
+    /*
+     * Experimental QEMU extension.  Bit 15 is not registered in the NBD
+     * protocol and may be reassigned, see docs/interop/nbd.txt.
+     */
+    NBD_FLAG_SEND_COPY_BIT          = 15, /* Send COPY */
 };
 
 #define NBD_FLAG_HAS_FLAGS          (1 << NBD_FLAG_HAS_FLAGS_BIT)
@@ -212,6 +226,7 @@ enum {
 #define NBD_FLAG_SEND_CACHE         (1 << NBD_FLAG_SEND_CACHE_BIT)
 #define NBD_FLAG_SEND_FAST_ZERO     (1 << NBD_FLAG_SEND_FAST_ZERO_BIT)
 #define NBD_FLAG_BLOCK_STAT_PAYLOAD (1 << NBD_FLAG_BLOCK_STAT_PAYLOAD_BIT)
+#define NBD_FLAG_SEND_COPY          (1 << NBD_FLAG_SEND_COPY_BIT)
 
 /* New-style handshake (global) flags, sent from server to client, and
    control what will happen during handshake phase. */
@@ -281,6 +296,7 @@ enum {
     NBD_CMD_CACHE = 5,
     NBD_CMD_WRITE_ZEROES = 6,
     NBD_CMD_BLOCK_STATUS = 7,
+    NBD_CMD_COPY = 16,          /* Experimental QEMU extension */
 };
 
 #define NBD_DEFAULT_PORT	10809
@@ -414,7 +430,7 @@ bool nbd_server_is_running(void);
 int nbd_server_max_connections(void);
 void nbd_server_start(SocketAddress *addr, const char *tls_creds,
                       const char *tls_authz, uint32_t max_connections,
-                      Error **errp);
+                      bool zero_copy, Error **errp);
 void nbd_server_start_options(NbdServerOptions *arg, Error **errp);
 
 /* nbd_read
@@ -65,12 +65,24 @@ void laio_attach_aio_context(LinuxAioState *s, AioContext *new_context);
 #endif
 /* io_uring.c - Linux io_uring implementation */
 #ifdef CONFIG_LINUX_IO_URING
-LuringState *luring_init(Error **errp);
+LuringState *luring_init(int64_t sqpoll_idle, bool iopoll, bool cmd,
+                         Error **errp);
 void luring_cleanup(LuringState *s);
+void luring_enable_fixed_bufs(LuringState *s);
+void luring_register_buf(void *host, size_t size);
+void luring_unregister_buf(void *host, size_t size);
 
 /* luring_co_submit: submit I/O requests in the thread's current AioContext. */
 int coroutine_fn luring_co_submit(BlockDriverState *bs, int fd, uint64_t offset,
                                   QEMUIOVector *qiov, int type);
+int coroutine_fn luring_co_submit_iopoll(BlockDriverState *bs, int fd,
+                                         uint64_t offset, QEMUIOVector *qiov,
+                                         int type);
+#ifdef CONFIG_LINUX_IO_URING_CMD
+int coroutine_fn luring_co_submit_cmd(BlockDriverState *bs, int fd,
+                                      uint32_t cmd_op, const void *cmd,
+                                      size_t cmd_len, QEMUIOVector *qiov);
+#endif
 void luring_detach_aio_context(LuringState *s, AioContext *old_context);
 void luring_attach_aio_context(LuringState *s, AioContext *new_context);
 #endif
@@ -16,6 +16,7 @@
 #define REQLIST_H
 
 #include "qemu/coroutine.h"
+#include "qemu/interval-tree.h"
 
 /*
  * The API is not thread-safe and shouldn't be. The struct is public to be part
@@ -28,10 +29,18 @@ typedef struct BlockReq {
     int64_t bytes;
 
     CoQueue wait_queue; /* coroutines blocked on this req */
-    QLIST_ENTRY(BlockReq) list;
+    IntervalTreeNode node;
+    IntervalTreeRoot *reqs;
 } BlockReq;
 
-typedef QLIST_HEAD(, BlockReq) BlockReqList;
+/*
+ * Requests in a list never intersect, but there may be many of them, e.g.
+ * in-flight block-copy tasks, so they are kept in an interval tree to find
+ * conflicts in logarithmic time.
+ */
+typedef IntervalTreeRoot BlockReqList;
+
+void reqlist_init(BlockReqList *reqs);
 
 /*
  * Initialize new request and add it to the list. Caller must be sure that
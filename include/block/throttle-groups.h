@@ -55,7 +55,9 @@ typedef struct ThrottleGroupMember {
     ThrottleState *throttle_state;
     ThrottleTimers throttle_timers;
     unsigned       pending_reqs[THROTTLE_MAX];
-    QLIST_ENTRY(ThrottleGroupMember) round_robin;
+    QLIST_ENTRY(ThrottleGroupMember) next;
+    /* In the group's queue while pending_reqs[direction] is nonzero */
+    QTAILQ_ENTRY(ThrottleGroupMember) pending_entry[THROTTLE_MAX];
 
 } ThrottleGroupMember;
 
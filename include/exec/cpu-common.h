@@ -60,6 +60,15 @@ typedef uintptr_t ram_addr_t;
 /* memory API */
 
 void qemu_ram_remap(ram_addr_t addr, ram_addr_t length);
+#ifndef _WIN32
+/*
+ * Replace the memory of @block with a private, copy-on-write mapping of
+ * @fd at @offset.  Only private anonymous memory with host-sized pages
+ * can be remapped.
+ */
+bool qemu_ram_map_file_private(RAMBlock *block, int fd, off_t offset,
+                               Error **errp);
+#endif
 /* This should not be used by devices.  */
 ram_addr_t qemu_ram_addr_from_host(void *ptr);
 ram_addr_t qemu_ram_addr_from_host_nofail(void *ptr);
@@ -141,8 +150,6 @@ void *cpu_physical_memory_map(hwaddr addr,
                               bool is_write);
 void cpu_physical_memory_unmap(void *buffer, hwaddr len,
                                bool is_write, hwaddr access_len);
-void cpu_register_map_client(QEMUBH *bh);
-void cpu_unregister_map_client(QEMUBH *bh);
 
 bool cpu_physical_memory_is_io(hwaddr phys_addr);
 
@@ -34,6 +34,9 @@ static inline AddressSpaceDispatch *address_space_to_dispatch(AddressSpace *as)
 }
 
 FlatView *address_space_get_flatview(AddressSpace *as);
+
+/* Incremented whenever the FlatView of an address space changes */
+extern unsigned int flatview_generation;
 void flatview_unref(FlatView *view);
 
 extern const MemoryRegionOps unassigned_mem_ops;
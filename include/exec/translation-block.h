@@ -77,6 +77,7 @@ struct TranslationBlock {
 #define CF_PARALLEL      0x00008000 /* Generate code for a parallel context */
 #define CF_NOIRQ         0x00010000 /* Generate an uninterruptible TB */
 #define CF_PCREL         0x00020000 /* Opcodes in TB are PC-relative */
+#define CF_PROFILE       0x00040000 /* Count executions and helper calls */
 #define CF_CLUSTER_MASK  0xff000000 /* Top 8 bits are cluster ID */
 #define CF_CLUSTER_SHIFT 24
 
@@ -90,6 +91,9 @@ struct TranslationBlock {
 
     struct tb_tc tc;
 
+    /* Set if CF_PROFILE, see accel/tcg/tb-profile.h */
+    struct TBProfile *profile;
+
     /*
      * Track tb_page_addr_t intervals that intersect this TB.
      * For user-only, the virtual addresses are always contiguous,
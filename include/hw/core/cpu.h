@@ -195,8 +195,13 @@ struct CPUClass {
  */
 #define NB_MMU_MODES 16
 
-/* Use a fully associative victim tlb of 8 entries. */
-#define CPU_VTLB_SIZE 8
+/*
+ * Use a set associative victim tlb of 8 sets of 8 entries, indexed by
+ * the low bits of the page number.  A lookup only scans one set.
+ */
+#define CPU_VTLB_SETS 8
+#define CPU_VTLB_WAYS 8
+#define CPU_VTLB_SIZE (CPU_VTLB_SETS * CPU_VTLB_WAYS)
 
 /*
  * The full TLB entry, which is not accessed by generated TCG code,
@@ -269,7 +274,8 @@ typedef struct CPUTLBDesc {
     /*
      * Describe a region covering all of the large pages allocated
      * into the tlb.  When any page within this region is flushed,
-     * we must flush the entire tlb.  The region is matched if
+     * we must flush the entire region, or the entire tlb if the
+     * region is larger than the tlb.  The region is matched if
      * (addr & large_page_mask) == large_page_addr.
      */
     vaddr large_page_addr;
@@ -279,14 +285,28 @@ typedef struct CPUTLBDesc {
     /* maximum number of entries observed in the window */
     size_t window_max_entries;
     size_t n_used_entries;
-    /* The next index to use in the tlb victim table.  */
-    size_t vindex;
+    /* The next way to use in each set of the tlb victim table.  */
+    uint8_t vindex[CPU_VTLB_SETS];
     /* The tlb victim table, in two parts.  */
     CPUTLBEntry vtable[CPU_VTLB_SIZE];
     CPUTLBEntryFull vfulltlb[CPU_VTLB_SIZE];
     CPUTLBEntryFull *fulltlb;
 } CPUTLBDesc;
 
+/* A page or range flush, see tlb_flush_range_by_mmuidx(). */
+typedef struct TLBFlushRangeData {
+    vaddr addr;
+    vaddr len;
+    uint16_t idxmap;
+    uint16_t bits;
+} TLBFlushRangeData;
+
+/*
+ * Number of page or range flushes that can be queued for a cpu before
+ * they are promoted to a flush of the whole mmu indexes.
+ */
+#define CPU_TLB_PENDING_FLUSHES 16
+
 /*
  * Data elements that are shared between all MMU modes.
  */
@@ -299,6 +319,18 @@ typedef struct CPUTLBCommon {
      * Protected by tlb_c.lock.
      */
     uint16_t dirty;
+    /*
+     * Page and range flushes queued by other cpus, all done by a single
+     * work item.  pending_full holds the mmu indexes that are going to be
+     * flushed entirely, which subsumes any page flush for them.  A work
+     * item is queued while pending_scheduled is true.  All protected by
+     * pending_lock.
+     */
+    QemuSpin pending_lock;
+    bool pending_scheduled;
+    uint16_t pending_full;
+    unsigned int n_pending;
+    TLBFlushRangeData pending[CPU_TLB_PENDING_FLUSHES];
     /*
      * Statistics.  These are not lock protected, but are read and
      * written atomically.  This allows the monitor to print a snapshot
@@ -307,6 +339,9 @@ typedef struct CPUTLBCommon {
     size_t full_flush_count;
     size_t part_flush_count;
     size_t elide_flush_count;
+    /* Queued page flushes that were merged with another, or promoted */
+    size_t merge_flush_count;
+    size_t promote_flush_count;
 } CPUTLBCommon;
 
 /*
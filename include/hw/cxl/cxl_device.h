@@ -452,6 +452,16 @@ struct CXLType3Dev {
     unsigned int poison_list_cnt;
     bool poison_list_overflowed;
     uint64_t poison_list_overflow_ts;
+
+    /*
+     * Volatile memory decoded without interleaving is mapped into the
+     * fixed memory window on first access, one alias per HDM decoder.
+     */
+    bool direct_map;
+    bool direct_mapped;
+    MemoryRegion direct_mr[CXL_HDM_DECODER_COUNT];
+    MemoryRegion *direct_window[CXL_HDM_DECODER_COUNT];
+    QLIST_ENTRY(CXLType3Dev) direct_next;
 };
 
 #define TYPE_CXL_TYPE3 "cxl-type3"
@@ -488,6 +498,17 @@ MemTxResult cxl_type3_read(PCIDevice *d, hwaddr host_addr, uint64_t *data,
 MemTxResult cxl_type3_write(PCIDevice *d, hwaddr host_addr, uint64_t data,
                             unsigned size, MemTxAttrs attrs);
 
+/*
+ * Map the volatile memory of @d that backs @host_addr into @window, which
+ * is at @window_base, if the HPA range [@start, @end) decodes to @d without
+ * interleaving.  Any change to the HDM decoders must drop the mappings.
+ */
+void cxl_type3_direct_map(PCIDevice *d, MemoryRegion *window,
+                          hwaddr window_base, hwaddr start, hwaddr end,
+                          hwaddr host_addr);
+void cxl_type3_direct_unmap(CXLType3Dev *ct3d);
+void cxl_type3_direct_unmap_all(void);
+
 uint64_t cxl_device_get_timestamp(CXLDeviceState *cxlds);
 
 void cxl_event_init(CXLDeviceState *cxlds, int start_msg_num);
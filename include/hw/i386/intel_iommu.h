@@ -276,6 +276,15 @@ struct IntelIOMMUState {
     bool qi_enabled;                /* Set if the QI is enabled */
     uint8_t iq_last_desc_type;      /* The type of last completed descriptor */
 
+    /*
+     * Page-selective IOTLB invalidations of the invalidation queue whose
+     * notifications are still pending, merged into one range.
+     */
+    bool psi_pending;
+    uint16_t psi_domain_id;
+    hwaddr psi_addr;
+    hwaddr psi_size;
+
     /* The index of the Fault Recording Register to be used next.
      * Wraps around from N-1 to 0, where N is the number of FRCD_REG.
      */
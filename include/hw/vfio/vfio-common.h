@@ -95,6 +95,8 @@ typedef struct VFIOIOMMUFDContainer {
     VFIOContainerBase bcontainer;
     IOMMUFDBackend *be;
     uint32_t ioas_id;
+    /* hwpt with dirty tracking the devices attach to, or 0 for the IOAS */
+    uint32_t hwpt_id;
 } VFIOIOMMUFDContainer;
 
 typedef struct VFIODeviceOps VFIODeviceOps;
@@ -214,6 +216,7 @@ typedef QLIST_HEAD(VFIODeviceList, VFIODevice) VFIODeviceList;
 extern VFIOGroupList vfio_group_list;
 extern VFIODeviceList vfio_device_list;
 extern const MemoryListener vfio_memory_listener;
+void vfio_listener_register_parallel(VFIOContainerBase *bcontainer);
 extern int vfio_kvm_device_fd;
 
 bool vfio_mig_active(void);
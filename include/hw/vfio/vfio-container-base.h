@@ -49,6 +49,8 @@ typedef struct VFIOContainerBase {
     QLIST_ENTRY(VFIOContainerBase) next;
     QLIST_HEAD(, VFIODevice) device_list;
     GList *iova_ranges;
+    /* DMA maps in flight during vfio_listener_register_parallel() */
+    GQueue *dma_map_jobs;
     NotifierWithReturn cpr_reboot_notifier;
 } VFIOContainerBase;
 
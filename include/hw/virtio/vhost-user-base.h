@@ -29,6 +29,7 @@ struct VHostUserBase {
     VhostUserState vhost_user;
     struct vhost_virtqueue *vhost_vq;
     struct vhost_dev vhost_dev;
+    struct vhost_inflight *inflight;
     GPtrArray *vqs;
     bool connected;
 };
@@ -30,6 +30,12 @@ OBJECT_DECLARE_SIMPLE_TYPE(VHostUserBlk, VHOST_USER_BLK)
 struct VHostUserBlk {
     VirtIODevice parent_obj;
     CharBackend chardev;
+    /*
+     * Optional second backend, connected ahead of time so that the device
+     * can switch to it as soon as the one in use disconnects.  The two
+     * swap roles on failover; vhost_user.chr is the one in use.
+     */
+    CharBackend standby_chardev;
     int32_t bootindex;
     struct virtio_blk_config blkcfg;
     uint16_t num_queues;
@@ -28,6 +28,7 @@ typedef struct {
     char *tag;
     uint16_t num_request_queues;
     uint16_t queue_size;
+    uint64_t cache_size;
 } VHostUserFSConf;
 
 struct VHostUserFS {
@@ -41,6 +42,11 @@ struct VHostUserFS {
     VirtQueue *hiprio_vq;
     int32_t bootindex;
 
+    /* DAX window, where the back-end maps the files that the guest uses */
+    MemoryRegion cache;
+    void *cache_ptr;
+    Error *migration_blocker;
+
     /*< public >*/
 };
 
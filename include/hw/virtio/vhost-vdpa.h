@@ -54,6 +54,13 @@ typedef struct vhost_vdpa_shared {
     /* Vdpa must send shadow addresses as IOTLB key for data queues, not GPA */
     bool shadow_data;
 
+    /*
+     * Value of shadow_data when the memory listener was registered, which is
+     * how the mappings it made have to be removed.  The listener can outlive
+     * a device reset with VHOST_BACKEND_F_IOTLB_PERSIST.
+     */
+    bool listener_shadow_data;
+
     /* SVQ switching is in progress, or already completed? */
     SVQTransitionState svq_switching;
 } VhostVDPAShared;
@@ -69,6 +76,8 @@ typedef struct vhost_vdpa {
     GPtrArray *shadow_vqs;
     const VhostShadowVirtqueueOps *shadow_vq_ops;
     void *shadow_vq_ops_opaque;
+    /* AioContext the shadow virtqueues run in, NULL for the main loop */
+    AioContext *svq_ctx;
     struct vhost_dev *dev;
     Error *migration_blocker;
     VhostVDPAHostNotifier notifier[VIRTIO_QUEUE_MAX];
@@ -82,6 +91,8 @@ int vhost_vdpa_dma_map(VhostVDPAShared *s, uint32_t asid, hwaddr iova,
                        hwaddr size, void *vaddr, bool readonly);
 int vhost_vdpa_dma_unmap(VhostVDPAShared *s, uint32_t asid, hwaddr iova,
                          hwaddr size);
+void vhost_vdpa_iotlb_batch_begin_once(VhostVDPAShared *s);
+void vhost_vdpa_iotlb_batch_end_once(VhostVDPAShared *s);
 
 typedef struct vdpa_iommu {
     VhostVDPAShared *dev_shared;
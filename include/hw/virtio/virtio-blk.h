@@ -21,7 +21,7 @@
 #include "sysemu/block-backend.h"
 #include "sysemu/block-ram-registrar.h"
 #include "qom/object.h"
-#include "qapi/qapi-types-virtio.h"
+#include "qapi/qapi-types-block-export.h"
 
 #define TYPE_VIRTIO_BLK "virtio-blk-device"
 OBJECT_DECLARE_SIMPLE_TYPE(VirtIOBlock, VIRTIO_BLK)
@@ -34,6 +34,9 @@ struct virtio_blk_inhdr
 
 #define VIRTIO_BLK_AUTO_NUM_QUEUES UINT16_MAX
 
+/* Largest number of segments of a discard request */
+#define VIRTIO_BLK_MAX_DISCARD_SEG 256
+
 struct VirtIOBlkConf
 {
     BlockConf conf;
@@ -46,6 +49,7 @@ struct VirtIOBlkConf
     bool seg_max_adjust;
     bool report_discard_granularity;
     uint32_t max_discard_sectors;
+    uint32_t max_discard_seg;
     uint32_t max_write_zeroes_sectors;
     bool x_enable_wce_if_config_wce;
 };
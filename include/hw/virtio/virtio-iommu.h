@@ -50,6 +50,19 @@ typedef struct IOMMUPciBus {
     IOMMUDevice  *pbdev[]; /* Parent array is sparse, so dynamically alloc */
 } IOMMUPciBus;
 
+/*
+ * UNMAP notifications are queued while the request queue is processed and
+ * delivered with contiguous ranges merged, before any other request and
+ * before the completions are made visible to the guest.
+ */
+#define VIOMMU_MAX_PENDING_UNMAPS 16
+
+typedef struct VirtIOIOMMUPendingUnmap {
+    IOMMUMemoryRegion *mr;
+    hwaddr low;
+    hwaddr high;
+} VirtIOIOMMUPendingUnmap;
+
 struct VirtIOIOMMU {
     VirtIODevice parent_obj;
     VirtQueue *req_vq;
@@ -69,6 +82,8 @@ struct VirtIOIOMMU {
     bool granule_frozen;
     GranuleMode granule_mode;
     uint8_t aw_bits;
+    VirtIOIOMMUPendingUnmap pending_unmaps[VIOMMU_MAX_PENDING_UNMAPS];
+    unsigned int nb_pending_unmaps;
 };
 
 #endif
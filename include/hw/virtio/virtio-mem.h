@@ -33,8 +33,19 @@ OBJECT_DECLARE_TYPE(VirtIOMEM, VirtIOMEMClass,
 #define VIRTIO_MEM_UNPLUGGED_INACCESSIBLE_PROP "unplugged-inaccessible"
 #define VIRTIO_MEM_EARLY_MIGRATION_PROP "x-early-migration"
 #define VIRTIO_MEM_PREALLOC_PROP "prealloc"
+#define VIRTIO_MEM_PREALLOC_THREADS_PROP "prealloc-threads"
 #define VIRTIO_MEM_DYNAMIC_MEMSLOTS_PROP "dynamic-memslots"
 
+/* A plug request whose blocks are preallocated in the background */
+typedef struct VirtIOMEMPrealloc {
+    VirtIOMEM *vmem;
+    VirtQueueElement *elem;
+    uint64_t gpa;
+    uint64_t size;
+    QemuThread thread;
+    int ret;
+} VirtIOMEMPrealloc;
+
 struct VirtIOMEM {
     VirtIODevice parent_obj;
 
@@ -97,6 +108,14 @@ struct VirtIOMEM {
     /* whether to prealloc memory when plugging new blocks */
     bool prealloc;
 
+    /* number of threads preallocating the blocks of a plug request */
+    uint32_t prealloc_threads;
+
+    /* the plug request being preallocated, if any */
+    VirtIOMEMPrealloc *prealloc_req;
+    QEMUBH *prealloc_bh;
+    VMChangeStateEntry *prealloc_vmstate;
+
     /*
      * Whether we migrate properties that are immutable while migration is
      * active early, before state of other devices and especially, before
@@ -18,6 +18,7 @@
 #include "standard-headers/linux/virtio_net.h"
 #include "hw/virtio/virtio.h"
 #include "net/announce.h"
+#include "net/checksum.h"
 #include "qemu/option_int.h"
 #include "qom/object.h"
 
@@ -48,6 +49,8 @@ typedef struct virtio_net_conf
 {
     uint32_t txtimer;
     int32_t txburst;
+    uint32_t irq_coalesce_usecs;
+    uint32_t irq_coalesce_frames;
     char *tx;
     uint16_t rx_queue_size;
     uint16_t tx_queue_size;
@@ -146,6 +149,8 @@ typedef struct VirtioNetRssData {
     bool    populate_hash;
     uint32_t hash_types;
     uint8_t key[VIRTIO_NET_RSS_MAX_KEY_SIZE];
+    /* @key precomputed for software RSS */
+    net_toeplitz_table toeplitz;
     uint16_t indirections_len;
     uint16_t *indirections_table;
     uint16_t default_queue;
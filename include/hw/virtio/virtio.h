@@ -75,6 +75,9 @@ typedef struct VirtQueueElement
     hwaddr *out_addr;
     struct iovec *in_sg;
     struct iovec *out_sg;
+    bool pooled;
+    /* Completed but not flushed yet, for VIRTIO_F_IN_ORDER */
+    bool in_order_filled;
 } VirtQueueElement;
 
 #define VIRTIO_QUEUE_MAX 1024
@@ -180,6 +183,12 @@ struct VirtIODevice
      */
     EventNotifier config_notifier;
     bool device_iotlb_enabled;
+    /**
+     * @shmem_list: the VIRTIO Shared Memory Regions of the device,
+     * indexed by their shmid
+     */
+    MemoryRegion **shmem_list;
+    unsigned int n_shmem_regions;
 };
 
 struct VirtioDeviceClass {
@@ -269,6 +278,12 @@ void virtio_delete_queue(VirtQueue *vq);
 
 void virtqueue_push(VirtQueue *vq, const VirtQueueElement *elem,
                     unsigned int len);
+/*
+ * Like virtqueue_push() for @count elements, with a single update of the
+ * used index.  @len may be NULL if nothing was written to the elements.
+ */
+void virtqueue_push_batch(VirtQueue *vq, VirtQueueElement *const *elems,
+                          const unsigned int *len, unsigned int count);
 void virtqueue_flush(VirtQueue *vq, unsigned int count);
 void virtqueue_detach_element(VirtQueue *vq, const VirtQueueElement *elem,
                               unsigned int len);
@@ -280,6 +295,29 @@ void virtqueue_fill(VirtQueue *vq, const VirtQueueElement *elem,
 
 void virtqueue_map(VirtIODevice *vdev, VirtQueueElement *elem);
 void *virtqueue_pop(VirtQueue *vq, size_t sz);
+/*
+ * Let virtqueue_pop() take elements of size @sz from a pool that grows up
+ * to the queue depth, instead of allocating each of them.  They must then
+ * be freed with virtqueue_element_free(), before the queue is deleted.
+ * Freeing one with g_free() is safe, the pool just loses that slot.
+ */
+void virtio_queue_enable_element_pool(VirtQueue *vq, size_t sz);
+void virtqueue_element_free(VirtQueue *vq, VirtQueueElement *elem);
+/*
+ * Coalesce the interrupts of @vq: after a notification, the following ones
+ * are held back for up to @usecs, or until @frames of them are pending if
+ * @frames is not 0.  @usecs of 0 disables coalescing.  Only for queues that
+ * are notified with the BQL held.
+ */
+void virtio_queue_set_notification_coalescing(VirtQueue *vq, uint32_t usecs,
+                                              uint32_t frames);
+/*
+ * Pop up to @max elements of size @sz into @elems, as by as many calls to
+ * virtqueue_pop() but with fewer memory barriers and ring updates.
+ * Returns the number of elements popped.
+ */
+unsigned int virtqueue_pop_batch(VirtQueue *vq, void **elems,
+                                 unsigned int max, size_t sz);
 unsigned int virtqueue_drop_all(VirtQueue *vq);
 void *qemu_get_virtqueue_element(VirtIODevice *vdev, QEMUFile *f, size_t sz);
 void qemu_put_virtqueue_element(VirtIODevice *vdev, QEMUFile *f,
@@ -355,6 +393,24 @@ uint16_t virtio_queue_vector(VirtIODevice *vdev, int n);
 void virtio_queue_set_vector(VirtIODevice *vdev, int n, uint16_t vector);
 int virtio_queue_set_host_notifier_mr(VirtIODevice *vdev, int n,
                                       MemoryRegion *mr, bool assign);
+
+/**
+ * virtio_add_shmem_region() - add a VIRTIO Shared Memory Region
+ * @vdev: the VirtIO device
+ * @mr: a RAM region, whose host memory the back-end can map files over
+ *
+ * Return: the shmid of the region, which is the next free one.
+ */
+unsigned int virtio_add_shmem_region(VirtIODevice *vdev, MemoryRegion *mr);
+
+/**
+ * virtio_get_shmem_region() - find a VIRTIO Shared Memory Region
+ * @vdev: the VirtIO device
+ * @shmid: the shmid of the region
+ *
+ * Return: the region, or NULL if the device has no region @shmid.
+ */
+MemoryRegion *virtio_get_shmem_region(VirtIODevice *vdev, unsigned int shmid);
 int virtio_set_status(VirtIODevice *vdev, uint8_t val);
 void virtio_reset(void *opaque);
 void virtio_queue_reset(VirtIODevice *vdev, uint32_t queue_index);
@@ -384,7 +440,9 @@ typedef struct VirtIORNGConf VirtIORNGConf;
     DEFINE_PROP_BIT64("packed", _state, _field, \
                       VIRTIO_F_RING_PACKED, false), \
     DEFINE_PROP_BIT64("queue_reset", _state, _field, \
-                      VIRTIO_F_RING_RESET, true)
+                      VIRTIO_F_RING_RESET, true), \
+    DEFINE_PROP_BIT64("in_order", _state, _field, \
+                      VIRTIO_F_IN_ORDER, false)
 
 hwaddr virtio_queue_get_desc_addr(VirtIODevice *vdev, int n);
 bool virtio_queue_enabled_legacy(VirtIODevice *vdev, int n);
@@ -23,6 +23,9 @@ typedef enum XenBlockVdevType {
     XEN_BLOCK_VDEV_TYPE__MAX
 } XenBlockVdevType;
 
+/* Upper bound for the max-queues property */
+#define XEN_BLOCK_MAX_QUEUES 64
+
 typedef struct XenBlockVdev {
     XenBlockVdevType type;
     unsigned long disk;
@@ -35,7 +38,10 @@ typedef struct XenBlockProperties {
     XenBlockVdev vdev;
     BlockConf conf;
     unsigned int max_ring_page_order;
+    unsigned int max_queues;
     IOThread *iothread;
+    uint32_t num_iothreads;
+    char **iothreads;
 } XenBlockProperties;
 
 typedef struct XenBlockDrive {
@@ -95,6 +95,20 @@ int qio_channel_socket_connect_sync(QIOChannelSocket *ioc,
                                     SocketAddress *addr,
                                     Error **errp);
 
+/**
+ * qio_channel_socket_enable_zero_copy:
+ * @ioc: the socket channel object
+ *
+ * Try to enable zero copy writes on the connected socket
+ * @ioc, which is done automatically for sockets connected
+ * with qio_channel_socket_connect_sync() but not for the
+ * ones returned by qio_channel_socket_accept().
+ *
+ * Returns: true if QIO_CHANNEL_FEATURE_WRITE_ZERO_COPY is
+ * now set on @ioc, false if the host does not support it
+ */
+bool qio_channel_socket_enable_zero_copy(QIOChannelSocket *ioc);
+
 /**
  * qio_channel_socket_connect_async:
  * @ioc: the socket channel object
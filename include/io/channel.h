@@ -971,6 +971,10 @@ int coroutine_mixed_fn qio_channel_writev_full_all(QIOChannel *ioc,
  * qio_channel_writev_full() + QIO_CHANNEL_WRITE_FLAG_ZERO_COPY
  * is sent, or return in case of any error.
  *
+ * It can be called from another thread than the one writing to the
+ * channel, as long as there is only one flush at a time.  Packets
+ * queued after the call started are not waited for then.
+ *
  * If not implemented, acts as a no-op, and returns 0.
  *
  * Returns -1 if any error is found,
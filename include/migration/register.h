@@ -102,6 +102,22 @@ typedef struct SaveVMHandlers {
      */
     int (*save_live_complete_precopy)(QEMUFile *f, void *opaque);
 
+    /**
+     * @save_live_complete_precopy_thread
+     *
+     * Same as @save_live_complete_precopy, to be used instead of it by
+     * devices that can produce their last section without the BQL.
+     * It runs in a worker thread, in parallel with the other devices
+     * saving their state, and what it writes to @f is buffered and
+     * sent in the usual order of the sections.
+     *
+     * @f: QEMUFile where to send the data
+     * @opaque: data pointer passed to register_savevm_live()
+     *
+     * Returns zero to indicate success and negative for error
+     */
+    int (*save_live_complete_precopy_thread)(QEMUFile *f, void *opaque);
+
     /* This runs both outside and inside the BQL.  */
 
     /**
@@ -50,6 +50,35 @@ net_raw_checksum(uint8_t *data, int length)
     return net_checksum_finish(net_checksum_add(length, data));
 }
 
+/**
+ * net_checksum_update16: incremental checksum update
+ *
+ * @csum: checksum of the data, as stored in the header but in host order
+ * @from: old value of a 16-bit word of the checksummed data
+ * @to: new value of the same word
+ *
+ * Returns the checksum of the data after the rewrite, computed as in
+ * RFC 1624 without going over the data again.
+ */
+static inline uint16_t
+net_checksum_update16(uint16_t csum, uint16_t from, uint16_t to)
+{
+    return net_checksum_finish((uint16_t)~csum + (uint16_t)~from + to);
+}
+
+/**
+ * net_checksum_update32: incremental checksum update of a 32-bit word
+ *
+ * Like net_checksum_update16(), for a 16-bit aligned 32-bit field such as
+ * an IPv4 address or a TCP sequence number.
+ */
+static inline uint16_t
+net_checksum_update32(uint16_t csum, uint32_t from, uint32_t to)
+{
+    csum = net_checksum_update16(csum, from >> 16, to >> 16);
+    return net_checksum_update16(csum, from & 0xffff, to & 0xffff);
+}
+
 /**
  * net_checksum_add_iov: scatter-gather vector checksumming
  *
@@ -108,4 +137,34 @@ void net_toeplitz_add(uint32_t *result,
     *result = accumulator;
 }
 
+/*
+ * The Toeplitz hash of an input of up to NET_TOEPLITZ_MAX_INPUT bytes,
+ * precomputed for a given key of NET_TOEPLITZ_MAX_INPUT + 4 bytes: the
+ * contribution of each value of each input nibble is looked up instead of
+ * being computed bit by bit.
+ */
+#define NET_TOEPLITZ_MAX_INPUT 36
+
+typedef struct toeplitz_table_st {
+    uint32_t nibble[NET_TOEPLITZ_MAX_INPUT * 2][16];
+} net_toeplitz_table;
+
+void net_toeplitz_table_init(net_toeplitz_table *table,
+                             const uint8_t *key_bytes);
+
+static inline
+uint32_t net_toeplitz_table_hash(const net_toeplitz_table *table,
+                                 const uint8_t *input, uint32_t len)
+{
+    uint32_t result = 0;
+    uint32_t i;
+
+    assert(len <= NET_TOEPLITZ_MAX_INPUT);
+    for (i = 0; i < len; i++) {
+        result ^= table->nibble[2 * i][input[i] >> 4] ^
+                  table->nibble[2 * i + 1][input[i] & 0xf];
+    }
+    return result;
+}
+
 #endif /* QEMU_NET_CHECKSUM_H */
@@ -12,8 +12,10 @@
 #define VHOST_USER_H
 
 struct vhost_net;
+struct vhost_inflight;
 struct vhost_net *vhost_user_get_vhost_net(NetClientState *nc);
 uint64_t vhost_user_get_acked_features(NetClientState *nc);
+struct vhost_inflight *vhost_user_get_inflight(NetClientState *nc);
 void vhost_user_save_acked_features(NetClientState *nc);
 
 #endif /* VHOST_USER_H */
@@ -14,7 +14,17 @@
 #ifndef JSON_WRITER_H
 #define JSON_WRITER_H
 
+typedef void JSONWriterFlush(void *opaque, const char *buf, size_t len);
+
 JSONWriter *json_writer_new(bool pretty);
+/*
+ * A writer that passes its output to @flush in chunks as it goes, rather
+ * than accumulating all of it; json_writer_get() must not be used.  Call
+ * json_writer_flush() for the last chunk.
+ */
+JSONWriter *json_writer_new_stream(bool pretty, JSONWriterFlush *flush,
+                                   void *opaque);
+void json_writer_flush(JSONWriter *);
 const char *json_writer_get(JSONWriter *);
 GString *json_writer_get_and_free(JSONWriter *);
 void json_writer_free(JSONWriter *);
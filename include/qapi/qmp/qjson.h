@@ -28,4 +28,13 @@ QDict *qdict_from_jsonf_nofail(const char *string, ...)
 GString *qobject_to_json(const QObject *obj);
 GString *qobject_to_json_pretty(const QObject *obj, bool pretty);
 
+/*
+ * Serialize @obj and pass the output to @flush in chunks, so that large
+ * objects need not be held in memory as a whole JSON text.
+ */
+void qobject_to_json_stream(const QObject *obj, bool pretty,
+                            void (*flush)(void *opaque, const char *buf,
+                                          size_t len),
+                            void *opaque);
+
 #endif /* QJSON_H */
@@ -0,0 +1,73 @@
+/*
+ * Big QEMU Lock hold-time profiling
+ *
+ * Copyright (c) 2024 The QEMU Project Developers
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#ifndef QEMU_BQL_PROFILE_H
+#define QEMU_BQL_PROFILE_H
+
+/*
+ * While profiling is enabled, the time for which the BQL is held is
+ * attributed to a holder.  By default the holder is the call site that
+ * took the lock; an MMIO dispatch that had to take the BQL is attributed
+ * to the memory region instead.  Timer and bottom half callbacks that run
+ * under the BQL, typically in the main loop, are timed separately: their
+ * time is also part of the hold time of the main loop's acquisition.
+ *
+ * All the functions below must be called with the BQL held.
+ */
+typedef enum BQLProfileKind {
+    BQL_PROFILE_LOCK,
+    BQL_PROFILE_MMIO,
+    BQL_PROFILE_TIMER,
+    BQL_PROFILE_BH,
+} BQLProfileKind;
+
+typedef struct BQLProfileEntry {
+    BQLProfileKind kind;
+    /* Call site file for BQL_PROFILE_LOCK, else region or callback */
+    const char *name;
+    int line;
+    uint64_t count;
+    uint64_t hold_ns;
+    uint64_t hold_max_ns;
+    /* Time spent waiting for the BQL, not for timers and bottom halves */
+    uint64_t wait_ns;
+} BQLProfileEntry;
+
+extern bool bql_profile_enabled;
+
+static inline bool bql_profile_is_enabled(void)
+{
+    return unlikely(qatomic_read(&bql_profile_enabled));
+}
+
+void bql_profile_enable(void);
+void bql_profile_disable(void);
+void bql_profile_reset(void);
+
+/* Call @fn for each holder that has been seen since the last reset */
+void bql_profile_foreach(void (*fn)(const BQLProfileEntry *e, void *opaque),
+                         void *opaque);
+
+/* The BQL was just acquired at @file:@line after waiting @wait_ns */
+void bql_profile_acquired(const char *file, int line, int64_t wait_ns);
+
+/* The BQL is about to be released */
+void bql_profile_released(void);
+
+/* Charge the current hold of the BQL to @name instead of the call site */
+void bql_profile_set_holder(BQLProfileKind kind, const char *name);
+
+/*
+ * Time a callback that runs with the BQL held.  bql_profile_begin()
+ * returns 0 if the callback need not be timed.
+ */
+int64_t bql_profile_begin(void);
+void bql_profile_end(BQLProfileKind kind, const char *name, int64_t start);
+
+#endif /* QEMU_BQL_PROFILE_H */
@@ -0,0 +1,74 @@
+/*
+ * Low-overhead event counters for QEMU internals
+ *
+ * Copyright (c) 2024 The QEMU Project Developers
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#ifndef QEMU_COUNTERS_H
+#define QEMU_COUNTERS_H
+
+#include "qemu/stats64.h"
+
+/*
+ * A QemuCounter counts events on a hot path, such as virtqueue pops or
+ * AioContext polling.  Each thread has its own copy of every counter,
+ * so that incrementing it never bounces cache lines between threads;
+ * reading a counter sums the copies of all threads.  The counts of the
+ * threads that have exited are not lost.
+ *
+ * A counter can also export a Stat64 that is updated elsewhere, in which
+ * case it has no per-thread copies.
+ *
+ * Counters are defined at file scope with QEMU_COUNTER_DEFINE() or
+ * QEMU_COUNTER_STAT64(), and are registered before main() runs.  The
+ * stats subsystem exposes them through query-stats.
+ */
+typedef struct QemuCounter {
+    const char *name;
+    const Stat64 *stat;
+    unsigned int index;
+} QemuCounter;
+
+void qemu_counter_register(QemuCounter *c);
+
+/**
+ * qemu_counter_add: add @n to the copy of @c of the current thread
+ */
+void qemu_counter_add(QemuCounter *c, uint64_t n);
+
+static inline void qemu_counter_inc(QemuCounter *c)
+{
+    qemu_counter_add(c, 1);
+}
+
+/**
+ * qemu_counter_get: return the total value of @c across all threads
+ */
+uint64_t qemu_counter_get(QemuCounter *c);
+
+/**
+ * qemu_counters_foreach: call @fn for every registered counter
+ */
+void qemu_counters_foreach(void (*fn)(QemuCounter *c, void *opaque),
+                           void *opaque);
+
+#define QEMU_COUNTER_REGISTER_(var)                                     \
+    static void __attribute__((constructor)) var##_register(void)       \
+    {                                                                   \
+        qemu_counter_register(&var);                                    \
+    }
+
+/* Define a per-thread counter @var, called @cname in query-stats */
+#define QEMU_COUNTER_DEFINE(var, cname)                                 \
+    static QemuCounter var = { .name = cname };                         \
+    QEMU_COUNTER_REGISTER_(var)
+
+/* Export the existing Stat64 @s as a counter called @cname */
+#define QEMU_COUNTER_STAT64(var, cname, s)                              \
+    static QemuCounter var = { .name = cname, .stat = s };              \
+    QEMU_COUNTER_REGISTER_(var)
+
+#endif /* QEMU_COUNTERS_H */
@@ -0,0 +1,56 @@
+/*
+ * Sampling lock profiler
+ *
+ * Copyright (c) 2024 The QEMU Project Developers
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#ifndef QEMU_LOCK_SAMPLE_H
+#define QEMU_LOCK_SAMPLE_H
+
+#include "qemu/thread.h"
+
+/*
+ * Bucket 0 counts the samples that took 0 ns, bucket i those that took
+ * [2^(i-1), 2^i) ns and the last bucket everything above.
+ */
+#define LOCK_SAMPLE_BUCKETS 32
+
+typedef enum LockSampleType {
+    LOCK_SAMPLE_MUTEX,
+    LOCK_SAMPLE_BQL,
+} LockSampleType;
+
+typedef struct LockSampleSite {
+    const char *file;
+    int line;
+    LockSampleType type;
+    uint64_t samples;
+    uint64_t wait_ns;
+    uint64_t wait_max_ns;
+    uint64_t wait_hist[LOCK_SAMPLE_BUCKETS];
+    uint64_t hold_ns;
+    uint64_t hold_max_ns;
+    uint64_t hold_hist[LOCK_SAMPLE_BUCKETS];
+} LockSampleSite;
+
+/*
+ * Start sampling one acquisition of QemuMutexes and of the BQL every
+ * @period, in each thread.  Fails if QSP is enabled.
+ */
+bool lock_sample_enable(unsigned int period);
+void lock_sample_disable(void);
+bool lock_sample_is_enabled(void);
+unsigned int lock_sample_get_period(void);
+void lock_sample_reset(void);
+
+/* Call @fn with a copy of each call site that has samples */
+void lock_sample_foreach(void (*fn)(const LockSampleSite *site, void *opaque),
+                         void *opaque);
+
+/* Called by qemu_mutex_unlock() for mutexes whose acquisition was sampled */
+void lock_sample_release(QemuMutex *mutex);
+
+#endif /* QEMU_LOCK_SAMPLE_H */
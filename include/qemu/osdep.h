@@ -697,6 +697,7 @@ typedef struct ThreadContext ThreadContext;
  * after allocating file blocks for mapped files.
  *
  * When setting @async, allocation might be performed asynchronously.
+ * It begins with qemu_start_async_prealloc_mem(), and
  * qemu_finish_async_prealloc_mem() must be called to finish any asynchronous
  * preallocation.
  *
@@ -705,11 +706,22 @@ typedef struct ThreadContext ThreadContext;
 bool qemu_prealloc_mem(int fd, char *area, size_t sz, int max_threads,
                        ThreadContext *tc, bool async, Error **errp);
 
+/**
+ * qemu_start_async_prealloc_mem:
+ *
+ * Start all outstanding asynchronous memory preallocation, while the caller
+ * goes on with other work.  Creating the preallocation threads would contend
+ * with the page faults of threads that already run, so it is best to call
+ * this once all memory backends have been created.
+ */
+void qemu_start_async_prealloc_mem(void);
+
 /**
  * qemu_finish_async_prealloc_mem:
  * @errp: returns an error if this function fails
  *
- * Finish all outstanding asynchronous memory preallocation.
+ * Finish all outstanding asynchronous memory preallocation, starting it
+ * first if needed.
  *
  * Return: true on success, else false setting @errp with error.
  */
@@ -57,11 +57,15 @@ typedef uint64_t qemu_plugin_id_t;
  * - Remove qemu_plugin_register_vcpu_{tb, insn, mem}_exec_inline.
  *   Those functions are replaced by *_per_vcpu variants, which guarantee
  *   thread-safety for operations.
+ *
+ * version 3:
+ * - added qemu_plugin_register_vcpu_{tb, insn}_exec_cond_cb
+ * - added batched memory callbacks (qemu_plugin_mem_batch_*)
  */
 
 extern QEMU_PLUGIN_EXPORT int qemu_plugin_version;
 
-#define QEMU_PLUGIN_VERSION 2
+#define QEMU_PLUGIN_VERSION 3
 
 /**
  * struct qemu_info_t - system information for plugins
@@ -301,6 +305,54 @@ void qemu_plugin_register_vcpu_tb_exec_cb(struct qemu_plugin_tb *tb,
                                           enum qemu_plugin_cb_flags flags,
                                           void *userdata);
 
+/**
+ * enum qemu_plugin_cond - condition to enable callback
+ *
+ * @QEMU_PLUGIN_COND_NEVER: false
+ * @QEMU_PLUGIN_COND_ALWAYS: true
+ * @QEMU_PLUGIN_COND_EQ: is equal?
+ * @QEMU_PLUGIN_COND_NE: is not equal?
+ * @QEMU_PLUGIN_COND_LT: is less than?
+ * @QEMU_PLUGIN_COND_LE: is less than or equal?
+ * @QEMU_PLUGIN_COND_GT: is greater than?
+ * @QEMU_PLUGIN_COND_GE: is greater than or equal?
+ */
+enum qemu_plugin_cond {
+    QEMU_PLUGIN_COND_NEVER,
+    QEMU_PLUGIN_COND_ALWAYS,
+    QEMU_PLUGIN_COND_EQ,
+    QEMU_PLUGIN_COND_NE,
+    QEMU_PLUGIN_COND_LT,
+    QEMU_PLUGIN_COND_LE,
+    QEMU_PLUGIN_COND_GT,
+    QEMU_PLUGIN_COND_GE,
+};
+
+/**
+ * qemu_plugin_register_vcpu_tb_exec_cond_cb() - register conditional callback
+ * @tb: the opaque qemu_plugin_tb handle for the translation
+ * @cb: callback function
+ * @flags: does the plugin read or write the CPU's registers?
+ * @cond: condition to enable callback
+ * @entry: first operand for condition
+ * @imm: second operand for condition
+ * @userdata: any plugin data to pass to the @cb?
+ *
+ * The @cb function is called when a translated unit executes if
+ * entry @cond imm.
+ * Entry is a scoreboard entry, so it is read for the vcpu executing
+ * the block.  This is meant to be combined with inline ops on the same
+ * entry, e.g. to only call into the plugin every N executions.
+ */
+QEMU_PLUGIN_API
+void qemu_plugin_register_vcpu_tb_exec_cond_cb(struct qemu_plugin_tb *tb,
+                                               qemu_plugin_vcpu_udata_cb_t cb,
+                                               enum qemu_plugin_cb_flags flags,
+                                               enum qemu_plugin_cond cond,
+                                               qemu_plugin_u64 entry,
+                                               uint64_t imm,
+                                               void *userdata);
+
 /**
  * enum qemu_plugin_op - describes an inline op
  *
@@ -344,6 +396,31 @@ void qemu_plugin_register_vcpu_insn_exec_cb(struct qemu_plugin_insn *insn,
                                             enum qemu_plugin_cb_flags flags,
                                             void *userdata);
 
+/**
+ * qemu_plugin_register_vcpu_insn_exec_cond_cb() - conditional insn execution cb
+ * @insn: the opaque qemu_plugin_insn handle for an instruction
+ * @cb: callback function
+ * @flags: does the plugin read or write the CPU's registers?
+ * @cond: condition to enable callback
+ * @entry: first operand for condition
+ * @imm: second operand for condition
+ * @userdata: any plugin data to pass to the @cb?
+ *
+ * The @cb function is called when an instruction executes if
+ * entry @cond imm.
+ * Entry is a scoreboard entry, so it is read for the vcpu executing
+ * the instruction.
+ */
+QEMU_PLUGIN_API
+void qemu_plugin_register_vcpu_insn_exec_cond_cb(
+    struct qemu_plugin_insn *insn,
+    qemu_plugin_vcpu_udata_cb_t cb,
+    enum qemu_plugin_cb_flags flags,
+    enum qemu_plugin_cond cond,
+    qemu_plugin_u64 entry,
+    uint64_t imm,
+    void *userdata);
+
 /**
  * qemu_plugin_register_vcpu_insn_exec_inline_per_vcpu() - insn exec inline op
  * @insn: the opaque qemu_plugin_insn handle for an instruction
@@ -586,6 +663,101 @@ void qemu_plugin_register_vcpu_mem_inline_per_vcpu(
     qemu_plugin_u64 entry,
     uint64_t imm);
 
+/**
+ * struct qemu_plugin_mem_access - a recorded memory access
+ * @vaddr: virtual address of the access
+ * @paddr: physical address in system emulation, @vaddr otherwise
+ * @userdata: the data passed to qemu_plugin_register_vcpu_mem_batch()
+ * @info: information about the access, see the qemu_plugin_mem_* helpers
+ * @is_io: whether the access went to a device rather than to RAM
+ *
+ * The address translation is done when the access is recorded, since it
+ * can't be done any more by the time the batch is delivered.
+ */
+typedef struct qemu_plugin_mem_access {
+    uint64_t vaddr;
+    uint64_t paddr;
+    void *userdata;
+    qemu_plugin_meminfo_t info;
+    bool is_io;
+} qemu_plugin_mem_access;
+
+/**
+ * typedef qemu_plugin_vcpu_mem_batch_cb_t - batched memory callback type
+ * @vcpu_index: the executing vCPU
+ * @accesses: the accesses of @vcpu_index, in program order
+ * @n: number of entries in @accesses
+ * @userdata: the data passed to qemu_plugin_mem_batch_new()
+ *
+ * @accesses is only valid for the duration of the callback.
+ */
+typedef void
+(*qemu_plugin_vcpu_mem_batch_cb_t)(unsigned int vcpu_index,
+                                   const qemu_plugin_mem_access *accesses,
+                                   size_t n, void *userdata);
+
+struct qemu_plugin_mem_batch;
+
+/**
+ * qemu_plugin_mem_batch_new() - allocate per-vCPU memory access buffers
+ * @capacity: number of accesses buffered per vCPU before calling @cb
+ * @cb: callback receiving the accesses
+ * @userdata: any plugin data to pass to @cb
+ *
+ * Memory accesses registered with qemu_plugin_register_vcpu_mem_batch()
+ * are appended to a buffer of the executing vCPU, and @cb is called in
+ * that vCPU's context when the buffer is full.  This amortizes the cost
+ * of the plugin's own processing (e.g. taking its locks) over @capacity
+ * accesses.
+ *
+ * Returns a new batch, to be freed with qemu_plugin_mem_batch_free().
+ */
+QEMU_PLUGIN_API
+struct qemu_plugin_mem_batch *
+qemu_plugin_mem_batch_new(size_t capacity,
+                          qemu_plugin_vcpu_mem_batch_cb_t cb,
+                          void *userdata);
+
+/**
+ * qemu_plugin_mem_batch_flush() - deliver the buffered accesses of a vCPU
+ * @batch: the batch to flush
+ * @vcpu_index: the vCPU whose buffer is delivered
+ *
+ * Call the batch callback for the accesses of @vcpu_index that were not
+ * delivered yet.  This must be called from the context of @vcpu_index
+ * (e.g. from a vCPU exit callback) or when no vCPU runs, e.g. from the
+ * atexit callback to collect the tail of every buffer.
+ */
+QEMU_PLUGIN_API
+void qemu_plugin_mem_batch_flush(struct qemu_plugin_mem_batch *batch,
+                                 unsigned int vcpu_index);
+
+/**
+ * qemu_plugin_mem_batch_free() - free a batch
+ * @batch: the batch to free
+ *
+ * Pending accesses are discarded, flush them first if needed.  No
+ * instrumentation referencing @batch must run any more.
+ */
+QEMU_PLUGIN_API
+void qemu_plugin_mem_batch_free(struct qemu_plugin_mem_batch *batch);
+
+/**
+ * qemu_plugin_register_vcpu_mem_batch() - record memory accesses in a batch
+ * @insn: handle for instruction to instrument
+ * @rw: apply to reads, writes or both
+ * @batch: the batch to record the accesses in
+ * @userdata: any plugin data to store with each access
+ *
+ * This records every memory access generated by the instruction in the
+ * buffer of the executing vCPU, instead of calling into the plugin.
+ */
+QEMU_PLUGIN_API
+void qemu_plugin_register_vcpu_mem_batch(struct qemu_plugin_insn *insn,
+                                         enum qemu_plugin_mem_rw rw,
+                                         struct qemu_plugin_mem_batch *batch,
+                                         void *userdata);
+
 typedef void
 (*qemu_plugin_vcpu_syscall_cb_t)(qemu_plugin_id_t id, unsigned int vcpu_index,
                                  int64_t num, uint64_t a1, uint64_t a2,
@@ -16,8 +16,9 @@ typedef bool (*qht_cmp_func_t)(const void *a, const void *b);
 struct qht {
     struct qht_map *map;
     qht_cmp_func_t cmp;
-    QemuMutex lock; /* serializes setters of ht->map */
+    QemuMutex lock; /* serializes resizes and setters of ht->map */
     unsigned int mode;
+    size_t n_resizes; /* completed resizes, protected by lock */
 };
 
 /**
@@ -29,6 +30,10 @@ struct qht {
  *         chain, excluding empty chains.
  * @occupancy: frequency distribution representing chain occupancy rate.
  *             Valid range: from 0.0 (empty) to 1.0 (full occupancy).
+ * @resizes: number of resizes completed since the QHT was initialized.
+ * @resizing: whether a resize was in progress. If so, the other fields cover
+ *            the head buckets of the old map that were not moved yet plus
+ *            all the head buckets of the new map.
  *
  * An entry is a pointer-hash pair.
  * Each bucket can host several entries.
@@ -40,6 +45,8 @@ struct qht_stats {
     size_t entries;
     struct qdist chain;
     struct qdist occupancy;
+    size_t resizes;
+    bool resizing;
 };
 
 typedef bool (*qht_lookup_func_t)(const void *obj, const void *userp);
@@ -166,6 +173,10 @@ bool qht_reset_size(struct qht *ht, size_t n_elems);
  * @ht: QHT to be resized
  * @n_elems: number of entries the resized hash table should be optimized for
  *
+ * Entries are moved to the new map one head bucket at a time, so concurrent
+ * writers only wait for the bucket they are accessing to be moved. The resize
+ * is complete when the function returns.
+ *
  * Returns true on success.
  * Returns false if the resize was not necessary and therefore not performed.
  * See also: qht_reset_size().
@@ -0,0 +1,66 @@
+/*
+ * Startup time profiling
+ *
+ * Copyright (c) 2024 The QEMU Project Developers
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#ifndef QEMU_STARTUP_PROFILE_H
+#define QEMU_STARTUP_PROFILE_H
+
+/*
+ * Between startup_profile_start() and startup_profile_finish(), vl.c
+ * records how long each initialization phase took, and qdev records how
+ * long each device took to realize.  Realize times include the devices
+ * that a device realizes itself.  Times are both wall-clock and process
+ * CPU time, so that waiting for the host (opening files, allocating
+ * memory) can be told apart from computation.
+ */
+typedef enum StartupProfileSpanKind {
+    STARTUP_PROFILE_PHASE,
+    STARTUP_PROFILE_REALIZE,
+} StartupProfileSpanKind;
+
+typedef struct StartupProfileTime {
+    int64_t wall_ns;
+    int64_t cpu_ns;
+} StartupProfileTime;
+
+typedef struct StartupProfileSpan {
+    StartupProfileSpanKind kind;
+    const char *name;
+    /* Wall-clock time of the end of the entry, relative to process start */
+    int64_t end_ns;
+    int64_t wall_ns;
+    int64_t cpu_ns;
+} StartupProfileSpan;
+
+extern bool startup_profile_active;
+
+/*
+ * The functions below are only called by the main thread, or with the BQL
+ * held.
+ */
+void startup_profile_start(void);
+
+StartupProfileTime startup_profile_now(void);
+
+/* End phase @name, which started when the previous phase ended */
+void startup_profile_phase(const char *name);
+
+/* Record that device @name was realized, starting at @start */
+void startup_profile_realized(const char *name, StartupProfileTime start);
+
+/* Stop recording; called when the guest is about to start */
+void startup_profile_finish(void);
+
+void startup_profile_foreach(void (*fn)(const StartupProfileSpan *e,
+                                        void *opaque),
+                             void *opaque);
+
+/* Print the profile to stderr */
+void startup_profile_print(void);
+
+#endif /* QEMU_STARTUP_PROFILE_H */
@@ -9,6 +9,9 @@ struct QemuMutex {
     const char *file;
     int line;
 #endif
+    /* Set while the holder's acquisition is sampled, see lock-sample.h */
+    struct LockSampleSite *sample;
+    int64_t sample_start;
     bool initialized;
 };
 
@@ -86,7 +86,8 @@ struct QEMUTimer {
     QEMUTimerList *timer_list;
     QEMUTimerCB *cb;
     void *opaque;
-    QEMUTimer *next;
+    size_t heap_index;          /* position in the timer list's heap */
+    uint64_t seq;               /* orders timers with the same expire_time */
     int attributes;
     int scale;
 };
@@ -16,6 +16,7 @@
 #include "io/channel-file.h"
 #include "io/net-listener.h"
 #include "qapi/error.h"
+#include "qemu/thread.h"
 #include "standard-headers/linux/virtio_blk.h"
 
 /* A kick fd that we monitor on behalf of libvhost-user */
@@ -27,6 +28,16 @@ typedef struct VuFdWatch {
     QTAILQ_ENTRY(VuFdWatch) next;
 } VuFdWatch;
 
+/*
+ * With vhost_user_server_set_vq_aio_contexts(), the watch and lock of each
+ * virtqueue, which outlive the kick fds so that a late kick_handler() in
+ * another thread never sees freed memory.
+ */
+typedef struct VuVirtqThread {
+    VuFdWatch watch;
+    QemuRecMutex lock;
+} VuVirtqThread;
+
 /**
  * VuServer:
  * A vhost-user server instance with user-defined VuDevIface callbacks.
@@ -52,6 +63,15 @@ typedef struct {
     QTAILQ_HEAD(, VuFdWatch) vu_fd_watches;
 
     Coroutine *co_trip; /* coroutine for processing VhostUserMsg */
+
+    /*
+     * AioContext of each virtqueue, or NULL if the kicks are handled in ctx
+     * too.  Each virtqueue is then locked while it is processed, and all of
+     * them while a vhost-user message is handled.
+     */
+    AioContext **vq_ctx;
+    VuVirtqThread *vq_threads;
+    bool vqs_locked;
 } VuServer;
 
 bool vhost_user_server_start(VuServer *server,
@@ -63,6 +83,11 @@ bool vhost_user_server_start(VuServer *server,
 
 void vhost_user_server_stop(VuServer *server);
 
+void vhost_user_server_set_vq_aio_contexts(VuServer *server,
+                                           AioContext **vq_ctx);
+void vhost_user_server_lock_vq(VuServer *server, int idx);
+void vhost_user_server_unlock_vq(VuServer *server, int idx);
+
 void vhost_user_server_inc_in_flight(VuServer *server);
 void vhost_user_server_dec_in_flight(VuServer *server);
 bool vhost_user_server_has_in_flight(VuServer *server);
@@ -136,6 +136,13 @@ struct ObjectClass
     ObjectUnparent *unparent;
 
     GHashTable *properties;
+
+    /*
+     * The properties of the class and of all its ancestors, built once
+     * the class is initialized.  Properties added to an initialized class
+     * are added to the tables of its subclasses too.
+     */
+    GHashTable *all_properties;
 };
 
 /**
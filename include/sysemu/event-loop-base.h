@@ -32,6 +32,7 @@ struct EventLoopBase {
 
     /* AioContext AIO engine parameters */
     int64_t aio_max_batch;
+    int64_t aio_sqpoll_idle;
 
     /* AioContext thread pool parameters */
     int64_t thread_pool_min;
@@ -76,8 +76,11 @@ struct HostMemoryBackend {
     bool prealloc, is_mapped, share, reserve;
     uint32_t prealloc_threads;
     ThreadContext *prealloc_context;
+    bool prealloc_node_local;
     DECLARE_BITMAP(host_nodes, MAX_NODES + 1);
     HostMemPolicy policy;
+    uint64_t interleave_granularity;
+    HostMemThpMode thp;
 
     MemoryRegion mr;
 };
@@ -88,6 +91,11 @@ MemoryRegion *host_memory_backend_get_memory(HostMemoryBackend *backend);
 void host_memory_backend_set_mapped(HostMemoryBackend *backend, bool mapped);
 bool host_memory_backend_is_mapped(HostMemoryBackend *backend);
 size_t host_memory_backend_pagesize(HostMemoryBackend *memdev);
+/*
+ * Whether the memory of @backend is set up like any other guest RAM, with
+ * no preallocation, NUMA policy, or merge, dump or THP setting of its own.
+ */
+bool host_memory_backend_has_default_settings(HostMemoryBackend *backend);
 char *host_memory_backend_get_name(HostMemoryBackend *backend);
 
 #endif
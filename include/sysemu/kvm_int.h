@@ -65,6 +65,8 @@ struct KVMDirtyRingReaper {
     QemuThread reaper_thr;
     volatile uint64_t reaper_iteration; /* iteration number of reaper thr */
     volatile enum KVMDirtyRingReaperState reaper_state; /* reap thr state */
+    uint64_t reaper_interval_us; /* sleep time between two reaps */
+    uint32_t max_fill; /* fullest ring seen since the last reaper iteration */
 };
 struct KVMState
 {
@@ -112,6 +114,8 @@ struct KVMState
     uint64_t kvm_dirty_ring_bytes;  /* Size of the per-vcpu dirty ring */
     uint32_t kvm_dirty_ring_size;   /* Number of dirty GFNs per ring */
     bool kvm_dirty_ring_with_bitmap;
+    uint32_t kvm_dirty_ring_reap_threads;  /* Threads reaping the rings */
+    struct ThreadPool *kvm_dirty_ring_reap_pool;
     uint64_t kvm_eager_split_size;  /* Eager Page Splitting chunk size */
     struct KVMDirtyRingReaper reaper;
     NotifyVmexitOption notify_vmexit;
@@ -77,6 +77,15 @@ void tcg_gen_lookup_and_goto_ptr(void);
 void tcg_gen_plugin_cb_start(unsigned from, unsigned type, unsigned wr);
 void tcg_gen_plugin_cb_end(void);
 
+/**
+ * tcg_gen_profile_inc() - increment a host counter
+ * @counter: the counter
+ *
+ * The increment is not atomic, so parallel vCPUs may lose a few counts.
+ * This is good enough for profiling and keeps the overhead low.
+ */
+void tcg_gen_profile_inc(uint64_t *counter);
+
 /* 32 bit ops */
 
 void tcg_gen_movi_i32(TCGv_i32 ret, int32_t arg);
@@ -577,6 +577,17 @@ extern bool tcg_use_softmmu;
 
 extern __thread TCGContext *tcg_ctx;
 extern const void *tcg_code_gen_epilogue;
+
+/* Calls of one helper from TBs generated with CF_PROFILE */
+typedef struct TCGProfileHelper {
+    const char *name;
+    uint64_t calls;     /* incremented by the generated code */
+} TCGProfileHelper;
+
+void tcg_profile_foreach_helper(void (*fn)(const TCGProfileHelper *h,
+                                           void *opaque),
+                                void *opaque);
+void tcg_profile_reset_helpers(void);
 extern uintptr_t tcg_splitwx_diff;
 extern TCGv_env tcg_env;
 
@@ -755,6 +766,7 @@ void tcg_pool_reset(TCGContext *s);
 TranslationBlock *tcg_tb_alloc(TCGContext *s);
 
 void tcg_region_reset_all(void);
+bool tcg_region_reclaim(void (*evict)(TranslationBlock *tb));
 
 size_t tcg_code_size(void);
 size_t tcg_code_capacity(void);
@@ -145,6 +145,22 @@ qio_channel_socket_new_fd(int fd,
 }
 
 
+bool qio_channel_socket_enable_zero_copy(QIOChannelSocket *ioc)
+{
+#ifdef QEMU_MSG_ZEROCOPY
+    int v = 1;
+
+    if (setsockopt(ioc->fd, SOL_SOCKET, SO_ZEROCOPY, &v, sizeof(v)) == 0) {
+        /* Zero copy available on host */
+        qio_channel_set_feature(QIO_CHANNEL(ioc),
+                                QIO_CHANNEL_FEATURE_WRITE_ZERO_COPY);
+        return true;
+    }
+#endif
+    return false;
+}
+
+
 int qio_channel_socket_connect_sync(QIOChannelSocket *ioc,
                                     SocketAddress *addr,
                                     Error **errp)
@@ -164,15 +180,7 @@ int qio_channel_socket_connect_sync(QIOChannelSocket *ioc,
         return -1;
     }
 
-#ifdef QEMU_MSG_ZEROCOPY
-    int ret, v = 1;
-    ret = setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &v, sizeof(v));
-    if (ret == 0) {
-        /* Zero copy available on host */
-        qio_channel_set_feature(QIO_CHANNEL(ioc),
-                                QIO_CHANNEL_FEATURE_WRITE_ZERO_COPY);
-    }
-#endif
+    qio_channel_socket_enable_zero_copy(ioc);
 
     qio_channel_set_feature(QIO_CHANNEL(ioc),
                             QIO_CHANNEL_FEATURE_READ_MSG_PEEK);
@@ -625,7 +633,8 @@ static ssize_t qio_channel_socket_writev(QIOChannel *ioc,
     }
 
     if (flags & QIO_CHANNEL_WRITE_FLAG_ZERO_COPY) {
-        sioc->zero_copy_queued++;
+        /* qio_channel_flush() may run in another thread */
+        qatomic_set(&sioc->zero_copy_queued, sioc->zero_copy_queued + 1);
     }
 
     return ret;
@@ -733,10 +742,12 @@ static int qio_channel_socket_flush(QIOChannel *ioc,
     struct sock_extended_err *serr;
     struct cmsghdr *cm;
     char control[CMSG_SPACE(sizeof(*serr))];
+    /* Sends queued from now on are left for the next flush */
+    ssize_t queued = qatomic_read(&sioc->zero_copy_queued);
     int received;
     int ret;
 
-    if (sioc->zero_copy_queued == sioc->zero_copy_sent) {
+    if (queued == sioc->zero_copy_sent) {
         return 0;
     }
 
@@ -746,7 +757,7 @@ static int qio_channel_socket_flush(QIOChannel *ioc,
 
     ret = 1;
 
-    while (sioc->zero_copy_sent < sioc->zero_copy_queued) {
+    while (sioc->zero_copy_sent < queued) {
         received = recvmsg(sioc->fd, &msg, MSG_ERRQUEUE);
         if (received < 0) {
             switch (errno) {
@@ -164,13 +164,15 @@ static void iothread_set_aio_context_params(EventLoopBase *base, Error **errp)
                                 iothread->poll_max_ns,
                                 iothread->poll_grow,
                                 iothread->poll_shrink,
+                                iothread->poll_budget,
                                 errp);
     if (*errp) {
         return;
     }
 
     aio_context_set_aio_params(iothread->ctx,
-                               iothread->parent_obj.aio_max_batch);
+                               iothread->parent_obj.aio_max_batch,
+                               iothread->parent_obj.aio_sqpoll_idle);
 
     aio_context_set_thread_pool_params(iothread->ctx, base->thread_pool_min,
                                        base->thread_pool_max, errp);
@@ -222,6 +224,7 @@ static void iothread_init(EventLoopBase *base, Error **errp)
 typedef struct {
     const char *name;
     ptrdiff_t offset; /* field's byte offset in IOThread struct */
+    int64_t max; /* maximum value, 0 for INT64_MAX */
 } IOThreadParamInfo;
 
 static IOThreadParamInfo poll_max_ns_info = {
@@ -233,6 +236,9 @@ static IOThreadParamInfo poll_grow_info = {
 static IOThreadParamInfo poll_shrink_info = {
     "poll-shrink", offsetof(IOThread, poll_shrink),
 };
+static IOThreadParamInfo poll_budget_info = {
+    "poll-budget", offsetof(IOThread, poll_budget), 100,
+};
 
 static void iothread_get_param(Object *obj, Visitor *v,
         const char *name, IOThreadParamInfo *info, Error **errp)
@@ -248,15 +254,16 @@ static bool iothread_set_param(Object *obj, Visitor *v,
 {
     IOThread *iothread = IOTHREAD(obj);
     int64_t *field = (void *)iothread + info->offset;
+    int64_t max = info->max ?: INT64_MAX;
     int64_t value;
 
     if (!visit_type_int64(v, name, &value, errp)) {
         return false;
     }
 
-    if (value < 0) {
+    if (value < 0 || value > max) {
         error_setg(errp, "%s value must be in range [0, %" PRId64 "]",
-                   info->name, INT64_MAX);
+                   info->name, max);
         return false;
     }
 
@@ -288,6 +295,7 @@ static void iothread_set_poll_param(Object *obj, Visitor *v,
                                     iothread->poll_max_ns,
                                     iothread->poll_grow,
                                     iothread->poll_shrink,
+                                    iothread->poll_budget,
                                     errp);
     }
 }
@@ -311,6 +319,10 @@ static void iothread_class_init(ObjectClass *klass, void *class_data)
                               iothread_get_poll_param,
                               iothread_set_poll_param,
                               NULL, &poll_shrink_info);
+    object_class_property_add(klass, "poll-budget", "int",
+                              iothread_get_poll_param,
+                              iothread_set_poll_param,
+                              NULL, &poll_budget_info);
 }
 
 static const TypeInfo iothread_info = {
@@ -356,6 +368,7 @@ static int query_one_iothread(Object *object, void *opaque)
     info->poll_max_ns = iothread->poll_max_ns;
     info->poll_grow = iothread->poll_grow;
     info->poll_shrink = iothread->poll_shrink;
+    info->poll_budget = iothread->poll_budget;
     info->aio_max_batch = iothread->parent_obj.aio_max_batch;
 
     QAPI_LIST_APPEND(*tail, info);
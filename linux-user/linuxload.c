@@ -236,7 +236,8 @@ abi_long imgsrc_mmap(abi_ulong start, abi_ulong len, int prot,
     /*
      * This case is for the vdso; we don't expect bad images.
      * The mmap may extend beyond the end of the image, especially
-     * to the end of the page.  Zero fill.
+     * to the end of the page; the fresh anonymous mapping is already
+     * zero filled there.
      */
     assert(offset < src->cache_size);
 
@@ -247,13 +248,7 @@ abi_long imgsrc_mmap(abi_ulong start, abi_ulong len, int prot,
 
     haddr = lock_user(VERIFY_WRITE, start, len, 0);
     assert(haddr != NULL);
-    if (offset + len <= src->cache_size) {
-        memcpy(haddr, src->cache + offset, len);
-    } else {
-        size_t rest = src->cache_size - offset;
-        memcpy(haddr, src->cache + offset, rest);
-        memset(haddr + rest, 0, len - rest);
-    }
+    memcpy(haddr, src->cache + offset, MIN(len, src->cache_size - offset));
     unlock_user(haddr, start, len);
 
     if (prot != prot_write) {
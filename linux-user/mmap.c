@@ -327,12 +327,40 @@ static bool mmap_frag(abi_ulong real_start, abi_ulong start, abi_ulong last,
     if (prot_old == 0) {
         /*
          * Since !(prot_old & PAGE_VALID), there were no guest pages
-         * outside of the fragment we need to map.  Allocate a new host
-         * page to cover, discarding whatever else may have been present.
+         * outside of the fragment we need to map.  If the file offset
+         * of the host page is representable, map the host page directly,
+         * as for the middle of the mapping; a fresh anonymous page needs
+         * no zeroing either.
+         *
+         * Only do this for private file mappings: a later fragment in
+         * the same host page is filled with pread(), which must not
+         * write through to a shared file.
          */
-        void *p = mmap(host_start, host_page_size,
-                       target_to_host_prot(prot),
-                       flags | MAP_ANONYMOUS, -1, 0);
+        abi_ulong frag_ofs = start - real_start;
+        void *p;
+
+        if ((flags & MAP_ANONYMOUS) ||
+            ((flags & MAP_TYPE) == MAP_PRIVATE && offset >= frag_ofs &&
+             !((offset - frag_ofs) & (host_page_size - 1)))) {
+            p = mmap(host_start, host_page_size, target_to_host_prot(prot),
+                     flags, flags & MAP_ANONYMOUS ? -1 : fd,
+                     flags & MAP_ANONYMOUS ? 0 : offset - frag_ofs);
+            if (p != host_start) {
+                if (p != MAP_FAILED) {
+                    do_munmap(p, host_page_size);
+                    errno = EEXIST;
+                }
+                return false;
+            }
+            return true;
+        }
+
+        /*
+         * Otherwise allocate a new host page to cover, discarding
+         * whatever else may have been present.
+         */
+        p = mmap(host_start, host_page_size, target_to_host_prot(prot),
+                 flags | MAP_ANONYMOUS, -1, 0);
         if (p != host_start) {
             if (p != MAP_FAILED) {
                 do_munmap(p, host_page_size);
@@ -3055,6 +3055,11 @@ static struct iovec *lock_iovec(int type, abi_ulong target_addr,
 static void unlock_iovec(struct iovec *vec, abi_ulong target_addr,
                          abi_ulong count, int copy)
 {
+    /*
+     * Without DEBUG_REMAP the buffers are guest memory itself and
+     * unlock_user() does nothing, so don't walk the guest vector again.
+     */
+#ifdef DEBUG_REMAP
     struct target_iovec *target_vec;
     int i;
 
@@ -3071,6 +3076,7 @@ static void unlock_iovec(struct iovec *vec, abi_ulong target_addr,
         }
         unlock_user(target_vec, target_addr, 0);
     }
+#endif
 
     g_free(vec);
 }
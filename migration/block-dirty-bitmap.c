@@ -28,7 +28,7 @@
  * format of migration:
  *
  * # Header (shared for different chunk types)
- * 1, 2 or 4 bytes: flags (see qemu_{put,put}_flags)
+ * 1, 2 or 4 bytes: flags (see qemu_{get,put}_bitmap_flags)
  * [ 1 byte: node alias size ] \  flags & DEVICE_NAME
  * [ n bytes: node alias     ] /
  * [ 1 byte: bitmap alias size ] \  flags & BITMAP_NAME
@@ -53,6 +53,14 @@
  * [ be64: buffer size  ] \ ! (flags & ZEROES)
  * [ n bytes: buffer    ] /
  *
+ * A ZEROES chunk may span more than one chunk's worth of sectors; the
+ * source merges consecutive clean chunks into one.
+ *
+ * With the x-dirty-bitmaps-rle capability, a chunk with flags & RLE has
+ * its buffer encoded as the ULEB128 lengths of alternating runs of clear
+ * and set bits, starting with a (possibly empty) run of clear bits.  Bits
+ * after the last run are clear.
+ *
  * The last chunk in stream should contain flags & EOS. The chunk may skip
  * device and/or bitmap names, assuming them to be the same with the previous
  * chunk.
@@ -101,6 +109,9 @@
 
 #define DIRTY_BITMAP_MIG_EXTRA_FLAGS        0x80
 
+/* Two byte flags */
+#define DIRTY_BITMAP_MIG_FLAG_RLE           0x0100
+
 #define DIRTY_BITMAP_MIG_START_FLAG_ENABLED          0x01
 #define DIRTY_BITMAP_MIG_START_FLAG_PERSISTENT       0x02
 /* 0x04 was "AUTOLOAD" flags on older versions, now it is ignored */
@@ -358,7 +369,7 @@ bool check_dirty_bitmap_mig_alias_map(const BitmapMigrationNodeAliasList *bbm,
 
 static uint32_t qemu_get_bitmap_flags(QEMUFile *f)
 {
-    uint8_t flags = qemu_get_byte(f);
+    uint32_t flags = qemu_get_byte(f);
     if (flags & DIRTY_BITMAP_MIG_EXTRA_FLAGS) {
         flags = flags << 8 | qemu_get_byte(f);
         if (flags & DIRTY_BITMAP_MIG_EXTRA_FLAGS) {
@@ -371,10 +382,14 @@ static uint32_t qemu_get_bitmap_flags(QEMUFile *f)
 
 static void qemu_put_bitmap_flags(QEMUFile *f, uint32_t flags)
 {
-    /* The code currently does not send flags as more than one byte */
-    assert(!(flags & (0xffffff00 | DIRTY_BITMAP_MIG_EXTRA_FLAGS)));
+    /* The code currently does not send flags as more than two bytes */
+    assert(!(flags & (0xffff0000 | DIRTY_BITMAP_MIG_EXTRA_FLAGS)));
 
-    qemu_put_byte(f, flags);
+    if (flags & 0xff00) {
+        qemu_put_be16(f, flags | DIRTY_BITMAP_MIG_EXTRA_FLAGS << 8);
+    } else {
+        qemu_put_byte(f, flags);
+    }
 }
 
 static void send_bitmap_header(QEMUFile *f, DBMSaveState *s,
@@ -420,6 +435,77 @@ static void send_bitmap_complete(QEMUFile *f, DBMSaveState *s,
     send_bitmap_header(f, s, dbms, DIRTY_BITMAP_MIG_FLAG_COMPLETE);
 }
 
+static void send_bitmap_zeroes(QEMUFile *f, DBMSaveState *s,
+                               SaveBitmapState *dbms,
+                               uint64_t start_sector, uint32_t nr_sectors)
+{
+    uint32_t flags = DIRTY_BITMAP_MIG_FLAG_BITS | DIRTY_BITMAP_MIG_FLAG_ZEROES;
+
+    trace_send_bitmap_bits(flags, start_sector, nr_sectors, 0);
+
+    send_bitmap_header(f, s, dbms, flags);
+
+    qemu_put_be64(f, start_sector);
+    qemu_put_be32(f, nr_sectors);
+
+    /* if a block is zero we need to flush here since the network
+     * bandwidth is now a lot higher than the storage device bandwidth.
+     * thus if we queue zero blocks we slow down the migration. */
+    qemu_fflush(f);
+}
+
+/* Length of the run of bits equal to @set that starts at bit @pos */
+static size_t bitmap_rle_run(const uint8_t *buf, size_t pos, size_t nbits,
+                             bool set)
+{
+    uint8_t fill = set ? 0xff : 0;
+    size_t start = pos;
+
+    while (pos < nbits) {
+        if (!(pos & 7) && pos + 8 <= nbits && buf[pos >> 3] == fill) {
+            pos += 8;
+        } else if (!!(buf[pos >> 3] & (1 << (pos & 7))) == set) {
+            pos++;
+        } else {
+            break;
+        }
+    }
+
+    return pos - start;
+}
+
+/*
+ * Encode the @size bytes of serialized bitmap in @buf into @out.  Return
+ * the length of the encoding, or 0 if it would not be shorter than
+ * @out_size bytes.
+ */
+static size_t bitmap_rle_encode(const uint8_t *buf, size_t size,
+                                uint8_t *out, size_t out_size)
+{
+    size_t nbits = size * 8;
+    size_t pos = 0, len = 0;
+    bool set = false;
+
+    /* Runs are at most one chunk long, which uleb128_encode_small takes */
+    assert(nbits <= 0x3fff);
+
+    while (pos < nbits) {
+        size_t run = bitmap_rle_run(buf, pos, nbits, set);
+
+        if (!set && pos + run == nbits) {
+            break;
+        }
+        if (len + 2 >= out_size) {
+            return 0;
+        }
+        len += uleb128_encode_small(out + len, run);
+        pos += run;
+        set = !set;
+    }
+
+    return len;
+}
+
 static void send_bitmap_bits(QEMUFile *f, DBMSaveState *s,
                              SaveBitmapState *dbms,
                              uint64_t start_sector, uint32_t nr_sectors)
@@ -431,7 +517,8 @@ static void send_bitmap_bits(QEMUFile *f, DBMSaveState *s,
             dbms->bitmap, start_sector << BDRV_SECTOR_BITS,
             (uint64_t)nr_sectors << BDRV_SECTOR_BITS);
     uint64_t buf_size = QEMU_ALIGN_UP(unaligned_size, align);
-    uint8_t *buf = g_malloc0(buf_size);
+    g_autofree uint8_t *buf = g_malloc0(buf_size);
+    g_autofree uint8_t *rle = NULL;
     uint32_t flags = DIRTY_BITMAP_MIG_FLAG_BITS;
 
     bdrv_dirty_bitmap_serialize_part(
@@ -439,9 +526,19 @@ static void send_bitmap_bits(QEMUFile *f, DBMSaveState *s,
         (uint64_t)nr_sectors << BDRV_SECTOR_BITS);
 
     if (buffer_is_zero(buf, buf_size)) {
-        g_free(buf);
-        buf = NULL;
-        flags |= DIRTY_BITMAP_MIG_FLAG_ZEROES;
+        send_bitmap_zeroes(f, s, dbms, start_sector, nr_sectors);
+        return;
+    }
+
+    if (migrate_dirty_bitmaps_rle()) {
+        size_t rle_size;
+
+        rle = g_malloc(buf_size);
+        rle_size = bitmap_rle_encode(buf, unaligned_size, rle, buf_size);
+        if (rle_size) {
+            flags |= DIRTY_BITMAP_MIG_FLAG_RLE;
+            buf_size = rle_size;
+        }
     }
 
     trace_send_bitmap_bits(flags, start_sector, nr_sectors, buf_size);
@@ -450,18 +547,9 @@ static void send_bitmap_bits(QEMUFile *f, DBMSaveState *s,
 
     qemu_put_be64(f, start_sector);
     qemu_put_be32(f, nr_sectors);
-
-    /* if a block is zero we need to flush here since the network
-     * bandwidth is now a lot higher than the storage device bandwidth.
-     * thus if we queue zero blocks we slow down the migration. */
-    if (flags & DIRTY_BITMAP_MIG_FLAG_ZEROES) {
-        qemu_fflush(f);
-    } else {
-        qemu_put_be64(f, buf_size);
-        qemu_put_buffer(f, buf, buf_size);
-    }
-
-    g_free(buf);
+    qemu_put_be64(f, buf_size);
+    qemu_put_buffer(f, flags & DIRTY_BITMAP_MIG_FLAG_RLE ? rle : buf,
+                    buf_size);
 }
 
 /* Called with the BQL taken.  */
@@ -691,10 +779,31 @@ fail:
 static void bulk_phase_send_chunk(QEMUFile *f, DBMSaveState *s,
                                   SaveBitmapState *dbms)
 {
-    uint32_t nr_sectors = MIN(dbms->total_sectors - dbms->cur_sector,
-                             dbms->sectors_per_chunk);
-
-    send_bitmap_bits(f, s, dbms, dbms->cur_sector, nr_sectors);
+    uint64_t nr_sectors = MIN(dbms->total_sectors - dbms->cur_sector,
+                              dbms->sectors_per_chunk);
+    int64_t next_dirty = bdrv_dirty_bitmap_next_dirty(
+        dbms->bitmap, dbms->cur_sector << BDRV_SECTOR_BITS,
+        (dbms->total_sectors - dbms->cur_sector) << BDRV_SECTOR_BITS);
+
+    if (next_dirty < 0 ||
+        next_dirty >> BDRV_SECTOR_BITS >= dbms->cur_sector + nr_sectors) {
+        /*
+         * Send all the clean chunks up to the one with the next dirty bit
+         * at once.  Large bitmaps are mostly clean, so this saves most of
+         * the chunks.
+         */
+        uint64_t end = next_dirty < 0 ? dbms->total_sectors :
+            QEMU_ALIGN_DOWN(next_dirty >> BDRV_SECTOR_BITS,
+                            dbms->sectors_per_chunk);
+        uint64_t max_sectors = QEMU_ALIGN_DOWN(UINT32_MAX,
+                                               dbms->sectors_per_chunk);
+
+        nr_sectors = MIN(end - dbms->cur_sector,
+                         MAX(max_sectors, nr_sectors));
+        send_bitmap_zeroes(f, s, dbms, dbms->cur_sector, nr_sectors);
+    } else {
+        send_bitmap_bits(f, s, dbms, dbms->cur_sector, nr_sectors);
+    }
 
     dbms->cur_sector += nr_sectors;
     if (dbms->cur_sector >= dbms->total_sectors) {
@@ -976,6 +1085,49 @@ static void dirty_bitmap_load_complete(QEMUFile *f, DBMLoadState *s)
     }
 }
 
+/* Decode the run lengths in @in into the @size bytes of zeroed @buf */
+static int bitmap_rle_decode(const uint8_t *in, size_t in_size,
+                             uint8_t *buf, size_t size)
+{
+    size_t nbits = size * 8;
+    size_t pos = 0, i = 0;
+    bool set = false;
+
+    while (i < in_size) {
+        uint32_t run;
+        int n;
+
+        if ((in[i] & 0x80) && i + 1 == in_size) {
+            return -1;
+        }
+        n = uleb128_decode_small(in + i, &run);
+        if (n < 0 || run > nbits - pos) {
+            return -1;
+        }
+        i += n;
+
+        if (set) {
+            size_t end = pos + run;
+
+            for (; pos < end && (pos & 7); pos++) {
+                buf[pos >> 3] |= 1 << (pos & 7);
+            }
+            if (end - pos >= 8) {
+                memset(buf + (pos >> 3), 0xff, (end - pos) >> 3);
+                pos += (end - pos) & ~7;
+            }
+            for (; pos < end; pos++) {
+                buf[pos >> 3] |= 1 << (pos & 7);
+            }
+        } else {
+            pos += run;
+        }
+        set = !set;
+    }
+
+    return 0;
+}
+
 static int dirty_bitmap_load_bits(QEMUFile *f, DBMLoadState *s)
 {
     uint64_t first_byte = qemu_get_be64(f) << BDRV_SECTOR_BITS;
@@ -1026,6 +1178,21 @@ static int dirty_bitmap_load_bits(QEMUFile *f, DBMLoadState *s)
                                                            first_byte,
                                                            nr_bytes);
 
+        if (s->flags & DIRTY_BITMAP_MIG_FLAG_RLE) {
+            uint8_t *bits = g_malloc0(needed_size);
+
+            if (bitmap_rle_decode(buf, buf_size, bits, needed_size) < 0) {
+                g_free(bits);
+                error_report("Invalid run lengths in migrated bitmap '%s'",
+                             bdrv_dirty_bitmap_name(s->bitmap));
+                cancel_incoming_locked(s);
+                return 0;
+            }
+            g_free(buf);
+            buf = bits;
+            buf_size = needed_size;
+        }
+
         if (needed_size > buf_size ||
             buf_size > QEMU_ALIGN_UP(needed_size, 4 * sizeof(long))
              /* Here used same alignment as in send_bitmap_bits */
@@ -21,9 +21,30 @@
 #include "qemu/osdep.h"
 #include "migration/channel-block.h"
 #include "qapi/error.h"
+#include "block/aio-wait.h"
 #include "block/block.h"
+#include "block/graph-lock.h"
+#include "qemu/coroutine.h"
+#include "qemu/iov.h"
+#include "qemu/main-loop.h"
+#include "qemu/units.h"
 #include "trace.h"
 
+/*
+ * Small writes are gathered into buffers of this size, and at most
+ * QIO_CHANNEL_BLOCK_MAX_WRITES buffers are written at the same time.
+ */
+#define QIO_CHANNEL_BLOCK_WRITE_SIZE (1 * MiB)
+#define QIO_CHANNEL_BLOCK_MAX_WRITES 8
+
+struct QIOChannelBlockWrite {
+    QIOChannelBlock *bioc;
+    uint8_t *buf;
+    size_t len;
+    off_t offset;
+    QLIST_ENTRY(QIOChannelBlockWrite) next;
+};
+
 QIOChannelBlock *
 qio_channel_block_new(BlockDriverState *bs)
 {
@@ -33,16 +54,180 @@ qio_channel_block_new(BlockDriverState *bs)
 
     bdrv_ref(bs);
     ioc->bs = bs;
+    QLIST_INIT(&ioc->writes);
+    qio_channel_set_feature(QIO_CHANNEL(ioc), QIO_CHANNEL_FEATURE_SEEKABLE);
 
     return ioc;
 }
 
 
+static void coroutine_fn
+qio_channel_block_write_co(void *opaque)
+{
+    QIOChannelBlockWrite *req = opaque;
+    QIOChannelBlock *bioc = req->bioc;
+    QEMUIOVector qiov = QEMU_IOVEC_INIT_BUF(qiov, req->buf, req->len);
+    int ret;
+
+    bdrv_graph_co_rdlock();
+    ret = bdrv_co_writev_vmstate(bioc->bs, &qiov, req->offset);
+    bdrv_graph_co_rdunlock();
+    trace_qio_channel_block_write_done(bioc, req->offset, req->len, ret);
+
+    if (ret < 0 && !bioc->write_error) {
+        bioc->write_error = ret;
+    }
+    QLIST_REMOVE(req, next);
+    bioc->nr_writes--;
+    qemu_vfree(req->buf);
+    g_free(req);
+    aio_wait_kick();
+}
+
+
+static bool
+qio_channel_block_write_overlaps(QIOChannelBlock *bioc,
+                                 off_t offset, size_t len)
+{
+    QIOChannelBlockWrite *req;
+
+    QLIST_FOREACH(req, &bioc->writes, next) {
+        if (offset < req->offset + req->len &&
+            req->offset < offset + len) {
+            return true;
+        }
+    }
+    return false;
+}
+
+
+static void
+qio_channel_block_submit(QIOChannelBlock *bioc)
+{
+    QIOChannelBlockWrite *req = bioc->pending;
+    Coroutine *co;
+
+    if (!req) {
+        return;
+    }
+    bioc->pending = NULL;
+
+    /*
+     * mapped-ram rewrites pages that were dirtied again, so a write must
+     * not race with an earlier one to the same range.
+     */
+    AIO_WAIT_WHILE(qemu_get_aio_context(),
+                   bioc->nr_writes >= QIO_CHANNEL_BLOCK_MAX_WRITES ||
+                   qio_channel_block_write_overlaps(bioc, req->offset,
+                                                    req->len));
+
+    QLIST_INSERT_HEAD(&bioc->writes, req, next);
+    bioc->nr_writes++;
+    trace_qio_channel_block_write(bioc, req->offset, req->len);
+
+    co = qemu_coroutine_create(qio_channel_block_write_co, req);
+    aio_co_enter(qemu_get_aio_context(), co);
+}
+
+
+static int
+qio_channel_block_write_status(QIOChannelBlock *bioc, Error **errp)
+{
+    if (bioc->write_error < 0) {
+        error_setg_errno(errp, -bioc->write_error,
+                         "bdrv_writev_vmstate failed");
+        return -1;
+    }
+    return 0;
+}
+
+
+/* Wait for all writes to complete, and report the first error if any */
+static int
+qio_channel_block_drain(QIOChannelBlock *bioc, Error **errp)
+{
+    qio_channel_block_submit(bioc);
+    AIO_WAIT_WHILE(qemu_get_aio_context(), bioc->nr_writes > 0);
+
+    return qio_channel_block_write_status(bioc, errp);
+}
+
+
+static ssize_t
+qio_channel_block_write_at(QIOChannelBlock *bioc,
+                           const struct iovec *iov,
+                           size_t niov,
+                           off_t offset,
+                           Error **errp)
+{
+    size_t size = iov_size(iov, niov);
+    size_t done = 0;
+
+    if (qio_channel_block_write_status(bioc, errp) < 0) {
+        return -1;
+    }
+
+    while (done < size) {
+        QIOChannelBlockWrite *req = bioc->pending;
+        size_t len;
+
+        if (req && (req->offset + req->len != offset + done ||
+                    req->len == QIO_CHANNEL_BLOCK_WRITE_SIZE)) {
+            qio_channel_block_submit(bioc);
+            req = NULL;
+        }
+        if (!req) {
+            req = g_new0(QIOChannelBlockWrite, 1);
+            req->bioc = bioc;
+            req->buf = qemu_blockalign(bioc->bs,
+                                       QIO_CHANNEL_BLOCK_WRITE_SIZE);
+            req->offset = offset + done;
+            bioc->pending = req;
+        }
+
+        len = MIN(size - done, QIO_CHANNEL_BLOCK_WRITE_SIZE - req->len);
+        iov_to_buf(iov, niov, done, req->buf + req->len, len);
+        req->len += len;
+        done += len;
+    }
+
+    return size;
+}
+
+
+static ssize_t
+qio_channel_block_read_at(QIOChannelBlock *bioc,
+                          const struct iovec *iov,
+                          size_t niov,
+                          off_t offset,
+                          Error **errp)
+{
+    QEMUIOVector qiov;
+    int ret;
+
+    if (qio_channel_block_drain(bioc, errp) < 0) {
+        return -1;
+    }
+
+    qemu_iovec_init_external(&qiov, (struct iovec *)iov, niov);
+    ret = bdrv_readv_vmstate(bioc->bs, &qiov, offset);
+    if (ret < 0) {
+        error_setg_errno(errp, -ret, "bdrv_readv_vmstate failed");
+        return -1;
+    }
+
+    return qiov.size;
+}
+
+
 static void
 qio_channel_block_finalize(Object *obj)
 {
     QIOChannelBlock *ioc = QIO_CHANNEL_BLOCK(obj);
 
+    if (ioc->bs) {
+        qio_channel_block_drain(ioc, NULL);
+    }
     g_clear_pointer(&ioc->bs, bdrv_unref);
 }
 
@@ -57,18 +242,25 @@ qio_channel_block_readv(QIOChannel *ioc,
                         Error **errp)
 {
     QIOChannelBlock *bioc = QIO_CHANNEL_BLOCK(ioc);
-    QEMUIOVector qiov;
-    int ret;
+    ssize_t ret;
 
-    qemu_iovec_init_external(&qiov, (struct iovec *)iov, niov);
-    ret = bdrv_readv_vmstate(bioc->bs, &qiov, bioc->offset);
-    if (ret < 0) {
-        error_setg_errno(errp, -ret, "bdrv_readv_vmstate failed");
-        return -1;
+    ret = qio_channel_block_read_at(bioc, iov, niov, bioc->offset, errp);
+    if (ret > 0) {
+        bioc->offset += ret;
     }
+    return ret;
+}
 
-    bioc->offset += qiov.size;
-    return qiov.size;
+
+static ssize_t
+qio_channel_block_preadv(QIOChannel *ioc,
+                         const struct iovec *iov,
+                         size_t niov,
+                         off_t offset,
+                         Error **errp)
+{
+    return qio_channel_block_read_at(QIO_CHANNEL_BLOCK(ioc), iov, niov,
+                                     offset, errp);
 }
 
 
@@ -82,18 +274,25 @@ qio_channel_block_writev(QIOChannel *ioc,
                          Error **errp)
 {
     QIOChannelBlock *bioc = QIO_CHANNEL_BLOCK(ioc);
-    QEMUIOVector qiov;
-    int ret;
+    ssize_t ret;
 
-    qemu_iovec_init_external(&qiov, (struct iovec *)iov, niov);
-    ret = bdrv_writev_vmstate(bioc->bs, &qiov, bioc->offset);
-    if (ret < 0) {
-        error_setg_errno(errp, -ret, "bdrv_writev_vmstate failed");
-        return -1;
+    ret = qio_channel_block_write_at(bioc, iov, niov, bioc->offset, errp);
+    if (ret > 0) {
+        bioc->offset += ret;
     }
+    return ret;
+}
 
-    bioc->offset += qiov.size;
-    return qiov.size;
+
+static ssize_t
+qio_channel_block_pwritev(QIOChannel *ioc,
+                          const struct iovec *iov,
+                          size_t niov,
+                          off_t offset,
+                          Error **errp)
+{
+    return qio_channel_block_write_at(QIO_CHANNEL_BLOCK(ioc), iov, niov,
+                                      offset, errp);
 }
 
 
@@ -123,7 +322,7 @@ qio_channel_block_seek(QIOChannel *ioc,
         bioc->offset = offset;
         break;
     case SEEK_CUR:
-        bioc->offset += whence;
+        bioc->offset += offset;
         break;
     case SEEK_END:
         error_setg(errp, "Size of VMstate region is unknown");
@@ -141,8 +340,13 @@ qio_channel_block_close(QIOChannel *ioc,
                         Error **errp)
 {
     QIOChannelBlock *bioc = QIO_CHANNEL_BLOCK(ioc);
-    int rv = bdrv_flush(bioc->bs);
+    int rv;
+
+    if (qio_channel_block_drain(bioc, errp) < 0) {
+        return -1;
+    }
 
+    rv = bdrv_flush(bioc->bs);
     if (rv < 0) {
         error_setg_errno(errp, -rv,
                          "Unable to flush VMState");
@@ -176,6 +380,8 @@ qio_channel_block_class_init(ObjectClass *klass,
 
     ioc_klass->io_writev = qio_channel_block_writev;
     ioc_klass->io_readv = qio_channel_block_readv;
+    ioc_klass->io_pwritev = qio_channel_block_pwritev;
+    ioc_klass->io_preadv = qio_channel_block_preadv;
     ioc_klass->io_set_blocking = qio_channel_block_set_blocking;
     ioc_klass->io_seek = qio_channel_block_seek;
     ioc_klass->io_close = qio_channel_block_close;
@@ -23,6 +23,7 @@
 
 #include "io/channel.h"
 #include "qom/object.h"
+#include "qemu/queue.h"
 
 #define TYPE_QIO_CHANNEL_BLOCK "qio-channel-block"
 OBJECT_DECLARE_SIMPLE_TYPE(QIOChannelBlock, QIO_CHANNEL_BLOCK)
@@ -34,12 +35,28 @@ OBJECT_DECLARE_SIMPLE_TYPE(QIOChannelBlock, QIO_CHANNEL_BLOCK)
  * The QIOChannelBlock object provides a channel implementation
  * that is able to perform I/O on the BlockDriverState objects
  * to the VMState region.
+ *
+ * Writes are buffered and submitted in the background, with a bounded
+ * number of them in flight, so that the VMState region is written at
+ * the bandwidth of the storage rather than one request at a time.
+ * Errors are reported by the next call on the channel.  The channel
+ * supports positioned I/O, so the mapped-ram capability can be used
+ * with savevm and loadvm.  It must only be used from the main thread.
  */
 
+typedef struct QIOChannelBlockWrite QIOChannelBlockWrite;
+
 struct QIOChannelBlock {
     QIOChannel parent;
     BlockDriverState *bs;
     off_t offset;
+
+    /* Write that is still being filled, if any */
+    QIOChannelBlockWrite *pending;
+    QLIST_HEAD(, QIOChannelBlockWrite) writes;
+    unsigned int nr_writes;
+    /* First error of a background write */
+    int write_error;
 };
 
 
@@ -35,6 +35,8 @@
 #include "sysemu/runstate.h"
 #include "net/filter.h"
 #include "options.h"
+#include "qemu/bswap.h"
+#include "xbzrle.h"
 
 static bool vmstate_loading;
 static Notifier packets_compare_notifier;
@@ -403,10 +405,125 @@ static uint64_t colo_receive_message_value(QEMUFile *f, uint32_t expect_msg,
     return value;
 }
 
+/*
+ * With x-colo-delta-vmstate, the device state of a checkpoint is sent as
+ * its 32-bit big endian size, and the 32-bit big endian length of the
+ * prefix that is encoded against the device state of the previous
+ * checkpoint.  The prefix is cut in chunks of COLO_DELTA_CHUNK bytes, each
+ * starting with a 32-bit big endian header like multifd XBZRLE pages: the
+ * chunk size for a chunk sent as is, or else the length of the XBZRLE
+ * delta that follows, 0 meaning that the chunk did not change.  The rest
+ * of the device state follows as is.
+ *
+ * Most devices do not change between two checkpoints, so only a small
+ * part of the device state has to be sent.
+ */
+#define COLO_DELTA_CHUNK        4096
+#define COLO_DELTA_HEADER_SIZE  (2 * sizeof(uint32_t))
+
+static void colo_delta_encode(GByteArray *prev, uint8_t *data, size_t size,
+                              GByteArray *out)
+{
+    /* XBZRLE compares whole longs */
+    size_t prefix = QEMU_ALIGN_DOWN(MIN(prev->len, size), sizeof(long));
+    size_t off, pos = COLO_DELTA_HEADER_SIZE;
+
+    g_byte_array_set_size(out, COLO_DELTA_HEADER_SIZE + size +
+                          DIV_ROUND_UP(prefix, COLO_DELTA_CHUNK) *
+                          sizeof(uint32_t));
+    stl_be_p(out->data, size);
+    stl_be_p(out->data + sizeof(uint32_t), prefix);
+
+    for (off = 0; off < prefix; off += COLO_DELTA_CHUNK) {
+        size_t len = MIN(prefix - off, COLO_DELTA_CHUNK);
+        uint8_t *hdr = out->data + pos;
+        int ret;
+
+        pos += sizeof(uint32_t);
+        ret = xbzrle_encode_buffer(prev->data + off, data + off, len,
+                                   out->data + pos, len - 1);
+        if (ret < 0) {
+            memcpy(out->data + pos, data + off, len);
+            ret = len;
+        }
+        stl_be_p(hdr, ret);
+        pos += ret;
+    }
+
+    memcpy(out->data + pos, data + prefix, size - prefix);
+    g_byte_array_set_size(out, pos + size - prefix);
+
+    /* This is what the secondary will have after loading the checkpoint */
+    g_byte_array_set_size(prev, 0);
+    g_byte_array_append(prev, data, size);
+}
+
+/*
+ * Decode @buf on top of the device state of the previous checkpoint, that
+ * is still in @bioc.
+ */
+static bool colo_delta_decode(QIOChannelBuffer *bioc, uint8_t *buf,
+                              size_t buflen, Error **errp)
+{
+    size_t size, prefix, off, pos = COLO_DELTA_HEADER_SIZE;
+
+    if (buflen < COLO_DELTA_HEADER_SIZE) {
+        goto fail;
+    }
+    size = ldl_be_p(buf);
+    prefix = ldl_be_p(buf + sizeof(uint32_t));
+    if (prefix > size || prefix > bioc->usage) {
+        goto fail;
+    }
+
+    if (size > bioc->capacity) {
+        bioc->capacity = size;
+        bioc->data = g_realloc(bioc->data, bioc->capacity);
+    }
+
+    for (off = 0; off < prefix; off += COLO_DELTA_CHUNK) {
+        size_t len = MIN(prefix - off, COLO_DELTA_CHUNK);
+        uint32_t hdr;
+
+        if (buflen - pos < sizeof(uint32_t)) {
+            goto fail;
+        }
+        hdr = ldl_be_p(buf + pos);
+        pos += sizeof(uint32_t);
+        if (hdr > len || buflen - pos < hdr) {
+            goto fail;
+        }
+
+        if (hdr == len) {
+            memcpy(bioc->data + off, buf + pos, len);
+        } else if (hdr &&
+                   xbzrle_decode_buffer(buf + pos, hdr,
+                                        bioc->data + off, len) < 0) {
+            goto fail;
+        }
+        pos += hdr;
+    }
+
+    if (buflen - pos != size - prefix) {
+        goto fail;
+    }
+    memcpy(bioc->data + prefix, buf + pos, size - prefix);
+    bioc->usage = size;
+    return true;
+
+fail:
+    error_setg(errp, "COLO: invalid device state delta");
+    return false;
+}
+
 static int colo_do_checkpoint_transaction(MigrationState *s,
                                           QIOChannelBuffer *bioc,
-                                          QEMUFile *fb)
+                                          QEMUFile *fb,
+                                          GByteArray *vmstate_prev)
 {
+    g_autoptr(GByteArray) delta = NULL;
+    uint8_t *vmstate;
+    size_t vmstate_size;
     Error *local_err = NULL;
     int ret = -1;
 
@@ -473,17 +590,27 @@ static int colo_do_checkpoint_transaction(MigrationState *s,
 
     qemu_fflush(fb);
 
+    vmstate = bioc->data;
+    vmstate_size = bioc->usage;
+    if (vmstate_prev) {
+        delta = g_byte_array_new();
+        colo_delta_encode(vmstate_prev, bioc->data, bioc->usage, delta);
+        vmstate = delta->data;
+        vmstate_size = delta->len;
+        trace_colo_send_vmstate_delta(bioc->usage, vmstate_size);
+    }
+
     /*
      * We need the size of the VMstate data in Secondary side,
      * With which we can decide how much data should be read.
      */
     colo_send_message_value(s->to_dst_file, COLO_MESSAGE_VMSTATE_SIZE,
-                            bioc->usage, &local_err);
+                            vmstate_size, &local_err);
     if (local_err) {
         goto out;
     }
 
-    qemu_put_buffer(s->to_dst_file, bioc->data, bioc->usage);
+    qemu_put_buffer(s->to_dst_file, vmstate, vmstate_size);
     ret = qemu_fflush(s->to_dst_file);
     if (ret < 0) {
         goto out;
@@ -530,6 +657,7 @@ static void colo_process_checkpoint(MigrationState *s)
 {
     QIOChannelBuffer *bioc;
     QEMUFile *fb = NULL;
+    GByteArray *vmstate_prev = NULL;
     Error *local_err = NULL;
     int ret;
 
@@ -561,6 +689,9 @@ static void colo_process_checkpoint(MigrationState *s)
     bioc = qio_channel_buffer_new(COLO_BUFFER_BASE_SIZE);
     fb = qemu_file_new_output(QIO_CHANNEL(bioc));
     object_unref(OBJECT(bioc));
+    if (migrate_colo_delta_vmstate()) {
+        vmstate_prev = g_byte_array_new();
+    }
 
     bql_lock();
     replication_start_all(REPLICATION_MODE_PRIMARY, &local_err);
@@ -587,7 +718,7 @@ static void colo_process_checkpoint(MigrationState *s)
         if (s->state != MIGRATION_STATUS_COLO) {
             goto out;
         }
-        ret = colo_do_checkpoint_transaction(s, bioc, fb);
+        ret = colo_do_checkpoint_transaction(s, bioc, fb, vmstate_prev);
         if (ret < 0) {
             goto out;
         }
@@ -602,6 +733,9 @@ out:
     if (fb) {
         qemu_fclose(fb);
     }
+    if (vmstate_prev) {
+        g_byte_array_free(vmstate_prev, true);
+    }
 
     /*
      * There are only two reasons we can get here, some error happened
@@ -699,23 +833,39 @@ static void colo_incoming_process_checkpoint(MigrationIncomingState *mis,
         return;
     }
 
-    /*
-     * Read VM device state data into channel buffer,
-     * It's better to re-use the memory allocated.
-     * Here we need to handle the channel buffer directly.
-     */
-    if (value > bioc->capacity) {
-        bioc->capacity = value;
-        bioc->data = g_realloc(bioc->data, bioc->capacity);
-    }
-    total_size = qemu_get_buffer(mis->from_src_file, bioc->data, value);
-    if (total_size != value) {
-        error_setg(errp, "Got %" PRIu64 " VMState data, less than expected"
-                    " %" PRIu64, total_size, value);
-        return;
+    if (migrate_colo_delta_vmstate()) {
+        g_autofree uint8_t *delta = g_malloc(value);
+
+        total_size = qemu_get_buffer(mis->from_src_file, delta, value);
+        if (total_size != value) {
+            error_setg(errp, "Got %" PRIu64 " VMState data, less than expected"
+                        " %" PRIu64, total_size, value);
+            return;
+        }
+        if (!colo_delta_decode(bioc, delta, value, errp)) {
+            return;
+        }
+        trace_colo_receive_vmstate_delta(bioc->usage, value);
+        qio_channel_io_seek(QIO_CHANNEL(bioc), 0, 0, NULL);
+    } else {
+        /*
+         * Read VM device state data into channel buffer,
+         * It's better to re-use the memory allocated.
+         * Here we need to handle the channel buffer directly.
+         */
+        if (value > bioc->capacity) {
+            bioc->capacity = value;
+            bioc->data = g_realloc(bioc->data, bioc->capacity);
+        }
+        total_size = qemu_get_buffer(mis->from_src_file, bioc->data, value);
+        if (total_size != value) {
+            error_setg(errp, "Got %" PRIu64 " VMState data, less than expected"
+                        " %" PRIu64, total_size, value);
+            return;
+        }
+        bioc->usage = total_size;
+        qio_channel_io_seek(QIO_CHANNEL(bioc), 0, 0, NULL);
     }
-    bioc->usage = total_size;
-    qio_channel_io_seek(QIO_CHANNEL(bioc), 0, 0, NULL);
 
     colo_send_message(mis->to_src_file, COLO_MESSAGE_VMSTATE_RECEIVED,
                  &local_err);
@@ -44,6 +44,33 @@ int file_parse_offset(char *filespec, uint64_t *offsetp, Error **errp)
     return 0;
 }
 
+/*
+ * The multifd channels only transfer guest pages, from page aligned
+ * host memory to page aligned file offsets, so they can bypass the page
+ * cache.  The main channel is left alone, its accesses are unaligned.
+ */
+static bool file_enable_direct_io(int *flags, Error **errp)
+{
+    if (!migrate_direct_io()) {
+        return true;
+    }
+
+    if (!migrate_mapped_ram() || !migrate_multifd()) {
+        error_setg(errp, "direct-io requires the mapped-ram and multifd "
+                   "capabilities");
+        return false;
+    }
+
+#ifdef O_DIRECT
+    *flags |= O_DIRECT;
+    return true;
+#else
+    error_setg(errp, "System does not support O_DIRECT");
+    error_append_hint(errp, "Try disabling the direct-io parameter\n");
+    return false;
+#endif
+}
+
 void file_cleanup_outgoing_migration(void)
 {
     g_free(outgoing_args.fname);
@@ -56,6 +83,11 @@ bool file_send_channel_create(gpointer opaque, Error **errp)
     int flags = O_WRONLY;
     bool ret = true;
 
+    if (!file_enable_direct_io(&flags, errp)) {
+        ret = false;
+        goto out;
+    }
+
     ioc = qio_channel_file_new_path(outgoing_args.fname, flags, 0, errp);
     if (!ioc) {
         ret = false;
@@ -109,11 +141,18 @@ static gboolean file_accept_incoming_migration(QIOChannel *ioc,
     return G_SOURCE_REMOVE;
 }
 
-void file_create_incoming_channels(QIOChannel *ioc, Error **errp)
+void file_create_incoming_channels(QIOChannel *ioc, const char *filename,
+                                   Error **errp)
 {
     int i, fd, channels = 1;
+    int flags = O_RDONLY;
     g_autofree QIOChannel **iocs = NULL;
 
+    if (!file_enable_direct_io(&flags, errp)) {
+        object_unref(OBJECT(ioc));
+        return;
+    }
+
     if (migrate_multifd()) {
         channels += migrate_multifd_channels();
     }
@@ -123,7 +162,17 @@ void file_create_incoming_channels(QIOChannel *ioc, Error **errp)
     iocs[0] = ioc;
 
     for (i = 1; i < channels; i++) {
-        QIOChannelFile *fioc = qio_channel_file_new_dupfd(fd, errp);
+        QIOChannelFile *fioc;
+
+        /*
+         * A duplicated fd shares the file status flags with the main
+         * channel, open the file again to get O_DIRECT on its own.
+         */
+        if (flags & ~O_RDONLY) {
+            fioc = qio_channel_file_new_path(filename, flags, 0, errp);
+        } else {
+            fioc = qio_channel_file_new_dupfd(fd, errp);
+        }
 
         if (!fioc) {
             while (i) {
@@ -163,7 +212,7 @@ void file_start_incoming_migration(FileMigrationArgs *file_args, Error **errp)
         return;
     }
 
-    file_create_incoming_channels(QIO_CHANNEL(fioc), errp);
+    file_create_incoming_channels(QIO_CHANNEL(fioc), filename, errp);
 }
 
 int file_write_ramblock_iov(QIOChannel *ioc, const struct iovec *iov,
@@ -0,0 +1,456 @@
+/*
+ * Lazy restore of RAM from a mapped-ram migration file
+ *
+ * Instead of reading every page from the file before the guest starts,
+ * the RAMBlocks are registered with userfaultfd.  Missing pages are
+ * read from their fixed offset in the file when the guest or QEMU
+ * touches them, while a background thread prefetches the rest.  Once
+ * all the pages are in place userfaultfd is dropped.
+ *
+ * A page that cannot be read or placed fails the incoming migration.
+ * Whatever waits for that page stays blocked, and management has to
+ * deal with the guest.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/eventfd.h>
+#include "qemu/bitmap.h"
+#include "qemu/error-report.h"
+#include "qemu/rcu.h"
+#include "qemu/rcu_queue.h"
+#include "qemu/thread.h"
+#include "qemu/userfaultfd.h"
+#include "exec/ramblock.h"
+#include "exec/target_page.h"
+#include "io/channel-file.h"
+#include "qapi/error.h"
+#include "mapped-ram-lazy.h"
+#include "migration.h"
+#include "qemu-file.h"
+#include "trace.h"
+
+/* Number of userfaultfd messages read at once by the fault thread */
+#define LAZY_FAULT_MSGS 16
+
+typedef struct MappedRamLazyBlock {
+    RAMBlock *rb;
+    /* host page size of the block, the unit the pages are placed in */
+    size_t pagesize;
+    /* target pages present in the file, others are zero */
+    unsigned long *file_bmap;
+    /* host pages placed by the prefetch thread or the fault thread */
+    unsigned long *placed;
+    QLIST_ENTRY(MappedRamLazyBlock) next;
+} MappedRamLazyBlock;
+
+static struct {
+    int uffd;
+    /* eventfd to stop the fault thread */
+    int quit_fd;
+    /* migration file, read with pread() */
+    int fd;
+    QemuThread fault_thread;
+    QemuThread prefetch_thread;
+    bool prefetch_started;
+    /* Set once a page could not be placed */
+    bool failed;
+    /* Grows while loading, RCU protected for the fault thread */
+    QLIST_HEAD(, MappedRamLazyBlock) blocks;
+} lazy = {
+    .uffd = -1,
+    .quit_fd = -1,
+    .fd = -1,
+};
+
+static bool lazy_pread(uint8_t *buf, size_t len, off_t offset)
+{
+    while (len) {
+        ssize_t ret = pread(lazy.fd, buf, len, offset);
+
+        if (ret < 0 && errno == EINTR) {
+            continue;
+        }
+        if (ret <= 0) {
+            return false;
+        }
+        buf += ret;
+        len -= ret;
+        offset += ret;
+    }
+    return true;
+}
+
+/* Report the first error and fail the incoming migration */
+static void lazy_fail(Error *err)
+{
+    MigrationIncomingState *mis = migration_incoming_get_current();
+
+    if (qatomic_xchg(&lazy.failed, true)) {
+        error_free(err);
+        return;
+    }
+
+    migrate_set_error(migrate_get_current(), err);
+    error_report_err(err);
+    migrate_set_state(&mis->state, qatomic_read(&mis->state),
+                      MIGRATION_STATUS_FAILED);
+}
+
+/*
+ * Fill the host page at @offset of the block from the file, using @buf
+ * as bounce buffer, and resolve the faults waiting on it.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+static int lazy_place_page(MappedRamLazyBlock *lb, ram_addr_t offset,
+                           uint8_t *buf, Error **errp)
+{
+    unsigned int bits = qemu_target_page_bits();
+    unsigned long first = offset >> bits;
+    unsigned long end = MIN(first + MAX(lb->pagesize >> bits, (size_t)1),
+                            lb->rb->used_length >> bits);
+    void *host = lb->rb->host + offset;
+    unsigned long set, clear;
+    int ret;
+
+    set = find_next_bit(lb->file_bmap, end, first);
+    if (set == end && lb->pagesize == qemu_real_host_page_size()) {
+        struct uffdio_zeropage zero_struct = {
+            .range.start = (uint64_t)(uintptr_t)host,
+            .range.len = lb->pagesize,
+        };
+
+        ret = ioctl(lazy.uffd, UFFDIO_ZEROPAGE, &zero_struct);
+    } else {
+        struct uffdio_copy copy_struct = {
+            .dst = (uint64_t)(uintptr_t)host,
+            .src = (uint64_t)(uintptr_t)buf,
+            .len = lb->pagesize,
+        };
+
+        memset(buf, 0, lb->pagesize);
+        for (; set < end; set = find_next_bit(lb->file_bmap, end, clear)) {
+            clear = find_next_zero_bit(lb->file_bmap, end, set + 1);
+            if (!lazy_pread(buf + ((set - first) << bits),
+                            (clear - set) << bits,
+                            lb->rb->pages_offset + (set << bits))) {
+                error_setg_errno(errp, errno, "mapped-ram lazy restore: "
+                                 "failed to read %s page " RAM_ADDR_FMT
+                                 " from the file", lb->rb->idstr,
+                                 (ram_addr_t)set << bits);
+                return -1;
+            }
+        }
+        ret = ioctl(lazy.uffd, UFFDIO_COPY, &copy_struct);
+    }
+
+    if (ret && errno == EEXIST) {
+        /*
+         * The other thread was first, but the faulting thread may have
+         * been sleeping on the page in between.
+         */
+        uffd_wakeup(lazy.uffd, host, lb->pagesize);
+        ret = 0;
+    }
+    if (ret) {
+        error_setg_errno(errp, errno, "mapped-ram lazy restore: failed to "
+                         "place %s page " RAM_ADDR_FMT, lb->rb->idstr,
+                         offset);
+        return -1;
+    }
+
+    set_bit_atomic(offset / lb->pagesize, lb->placed);
+    return 0;
+}
+
+static MappedRamLazyBlock *lazy_find_block(RAMBlock *rb)
+{
+    MappedRamLazyBlock *lb;
+
+    QLIST_FOREACH_RCU(lb, &lazy.blocks, next) {
+        if (lb->rb == rb) {
+            return lb;
+        }
+    }
+    return NULL;
+}
+
+static void *lazy_fault_thread(void *opaque)
+{
+    struct uffd_msg msgs[LAZY_FAULT_MSGS];
+    uint8_t *buf = NULL;
+    size_t buf_size = 0;
+
+    rcu_register_thread();
+
+    while (true) {
+        struct pollfd pfd[2] = {
+            { .fd = lazy.uffd, .events = POLLIN },
+            { .fd = lazy.quit_fd, .events = POLLIN },
+        };
+        int n;
+
+        if (poll(pfd, 2, -1) < 0) {
+            Error *local_err = NULL;
+
+            if (errno == EINTR) {
+                continue;
+            }
+            error_setg_errno(&local_err, errno,
+                             "mapped-ram lazy restore: poll failed");
+            lazy_fail(local_err);
+            break;
+        }
+        if (pfd[1].revents) {
+            break;
+        }
+
+        n = uffd_read_events(lazy.uffd, msgs, LAZY_FAULT_MSGS);
+        if (n < 0) {
+            break;
+        }
+
+        for (int i = 0; i < n; i++) {
+            void *addr = (void *)(uintptr_t)msgs[i].arg.pagefault.address;
+            MappedRamLazyBlock *lb;
+            ram_addr_t offset;
+            RAMBlock *rb;
+            Error *local_err = NULL;
+
+            if (msgs[i].event != UFFD_EVENT_PAGEFAULT) {
+                continue;
+            }
+
+            WITH_RCU_READ_LOCK_GUARD() {
+                rb = qemu_ram_block_from_host(addr, false, &offset);
+                lb = rb ? lazy_find_block(rb) : NULL;
+            }
+            if (!lb) {
+                error_report("mapped-ram lazy restore: fault at %p outside "
+                             "of guest RAM", addr);
+                continue;
+            }
+
+            if (buf_size < lb->pagesize) {
+                qemu_vfree(buf);
+                buf_size = lb->pagesize;
+                buf = qemu_memalign(buf_size, buf_size);
+            }
+
+            trace_mapped_ram_lazy_fault(rb->idstr, offset);
+            /*
+             * Don't look at lb->placed: the page may have been placed
+             * and discarded since, e.g. by a balloon.
+             */
+            if (lazy_place_page(lb, QEMU_ALIGN_DOWN(offset, lb->pagesize),
+                                buf, &local_err)) {
+                /* The faulting thread keeps waiting, serve the others */
+                lazy_fail(local_err);
+            }
+        }
+    }
+
+    qemu_vfree(buf);
+    rcu_unregister_thread();
+    return NULL;
+}
+
+static void lazy_cleanup(void)
+{
+    MappedRamLazyBlock *lb, *tmp;
+
+    QLIST_FOREACH_SAFE(lb, &lazy.blocks, next, tmp) {
+        uffd_unregister_memory(lazy.uffd, lb->rb->host, lb->rb->used_length);
+        QLIST_REMOVE(lb, next);
+        g_free(lb->file_bmap);
+        g_free(lb->placed);
+        g_free(lb);
+    }
+
+    close(lazy.fd);
+    lazy.fd = -1;
+    uffd_close_fd(lazy.uffd);
+    lazy.uffd = -1;
+    close(lazy.quit_fd);
+    lazy.quit_fd = -1;
+}
+
+/* Stop the fault thread and drop userfaultfd */
+static void lazy_stop(void)
+{
+    uint64_t quit = 1;
+
+    if (write(lazy.quit_fd, &quit, sizeof(quit)) != sizeof(quit)) {
+        error_report("mapped-ram lazy restore: failed to stop the fault "
+                     "thread: %s", strerror(errno));
+        return;
+    }
+    qemu_thread_join(&lazy.fault_thread);
+    lazy_cleanup();
+}
+
+static void *lazy_prefetch_thread(void *opaque)
+{
+    MappedRamLazyBlock *lb;
+    int64_t start = g_get_monotonic_time();
+
+    rcu_register_thread();
+
+    QLIST_FOREACH(lb, &lazy.blocks, next) {
+        uint8_t *buf = qemu_memalign(lb->pagesize, lb->pagesize);
+        unsigned long pages = DIV_ROUND_UP(lb->rb->used_length, lb->pagesize);
+        Error *local_err = NULL;
+
+        for (unsigned long i = 0; i < pages; i++) {
+            if (test_bit(i, lb->placed)) {
+                continue;
+            }
+            if (lazy_place_page(lb, i * lb->pagesize, buf, &local_err)) {
+                break;
+            }
+        }
+        qemu_vfree(buf);
+
+        if (local_err) {
+            /* Keep serving faults on the pages that can still be placed */
+            lazy_fail(local_err);
+            rcu_unregister_thread();
+            return NULL;
+        }
+    }
+
+    /* Every page is in place, no more faults to wait for */
+    lazy_stop();
+
+    trace_mapped_ram_lazy_prefetch_done((g_get_monotonic_time() - start) /
+                                        1000);
+    rcu_unregister_thread();
+    return NULL;
+}
+
+static bool lazy_init(QEMUFile *f, Error **errp)
+{
+    QIOChannel *ioc = qemu_file_get_ioc(f);
+    uint64_t features, wanted = 0;
+
+    if (!object_dynamic_cast(OBJECT(ioc), TYPE_QIO_CHANNEL_FILE)) {
+        error_setg(errp, "mapped-ram lazy restore requires a file");
+        return false;
+    }
+
+    if (uffd_query_features(&features)) {
+        error_setg(errp, "userfaultfd not available");
+        return false;
+    }
+#ifdef UFFD_FEATURE_MISSING_SHMEM
+    wanted |= features & UFFD_FEATURE_MISSING_SHMEM;
+#endif
+#ifdef UFFD_FEATURE_MISSING_HUGETLBFS
+    wanted |= features & UFFD_FEATURE_MISSING_HUGETLBFS;
+#endif
+
+    lazy.uffd = uffd_create_fd(wanted, true);
+    if (lazy.uffd < 0) {
+        error_setg(errp, "failed to create userfaultfd");
+        return false;
+    }
+
+    lazy.quit_fd = eventfd(0, EFD_CLOEXEC);
+    if (lazy.quit_fd < 0) {
+        error_setg_errno(errp, errno, "failed to create eventfd");
+        goto fail;
+    }
+
+    /* The migration channel is closed once loading is done */
+    lazy.fd = qemu_dup(QIO_CHANNEL_FILE(ioc)->fd);
+    if (lazy.fd < 0) {
+        error_setg_errno(errp, errno, "failed to dup the migration file");
+        goto fail;
+    }
+
+    QLIST_INIT(&lazy.blocks);
+
+    /*
+     * Start serving faults right away: loading the device states can
+     * already touch guest RAM.
+     */
+    qemu_thread_create(&lazy.fault_thread, "mig/lazy/fault",
+                       lazy_fault_thread, NULL, QEMU_THREAD_JOINABLE);
+    return true;
+
+fail:
+    if (lazy.quit_fd >= 0) {
+        close(lazy.quit_fd);
+        lazy.quit_fd = -1;
+    }
+    uffd_close_fd(lazy.uffd);
+    lazy.uffd = -1;
+    return false;
+}
+
+bool mapped_ram_lazy_add_block(QEMUFile *f, RAMBlock *block,
+                               unsigned long *bitmap, Error **errp)
+{
+    MappedRamLazyBlock *lb;
+    uint64_t ioctls;
+
+    if (lazy.uffd < 0 && !lazy_init(f, errp)) {
+        return false;
+    }
+
+    /* Anything already in the block, e.g. ROMs, comes from the file too */
+    if (ram_block_discard_range(block, 0, block->used_length)) {
+        error_setg(errp, "failed to discard RAMBlock %s", block->idstr);
+        return false;
+    }
+
+    if (uffd_register_memory(lazy.uffd, block->host, block->used_length,
+                             UFFDIO_REGISTER_MODE_MISSING, &ioctls)) {
+        error_setg_errno(errp, errno,
+                         "failed to register RAMBlock %s with userfaultfd",
+                         block->idstr);
+        return false;
+    }
+    if (!(ioctls & BIT(_UFFDIO_COPY))) {
+        uffd_unregister_memory(lazy.uffd, block->host, block->used_length);
+        error_setg(errp, "userfaultfd can't place pages in RAMBlock %s",
+                   block->idstr);
+        return false;
+    }
+
+    lb = g_new0(MappedRamLazyBlock, 1);
+    lb->rb = block;
+    lb->pagesize = qemu_ram_pagesize(block);
+    lb->file_bmap = bitmap;
+    lb->placed = bitmap_new(DIV_ROUND_UP(block->used_length, lb->pagesize));
+    QLIST_INSERT_HEAD_RCU(&lazy.blocks, lb, next);
+
+    trace_mapped_ram_lazy_add_block(block->idstr, block->used_length);
+    return true;
+}
+
+void mapped_ram_lazy_start_prefetch(void)
+{
+    if (lazy.uffd < 0 || lazy.prefetch_started) {
+        return;
+    }
+
+    lazy.prefetch_started = true;
+    qemu_thread_create(&lazy.prefetch_thread, "mig/lazy/prefetch",
+                       lazy_prefetch_thread, NULL, QEMU_THREAD_DETACHED);
+}
+
+void mapped_ram_lazy_abort(void)
+{
+    if (lazy.uffd < 0) {
+        return;
+    }
+
+    assert(!lazy.prefetch_started);
+    lazy_stop();
+}
@@ -0,0 +1,49 @@
+/*
+ * Lazy restore of RAM from a mapped-ram migration file
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#ifndef QEMU_MIGRATION_MAPPED_RAM_LAZY_H
+#define QEMU_MIGRATION_MAPPED_RAM_LAZY_H
+
+#include "exec/cpu-common.h"
+#include "qemu-file.h"
+
+#ifdef CONFIG_LINUX
+/*
+ * Register @block for lazy restore from the file behind @f.  @bitmap,
+ * the pages of the block present in the file, is owned by the lazy
+ * restore on success.
+ */
+bool mapped_ram_lazy_add_block(QEMUFile *f, RAMBlock *block,
+                               unsigned long *bitmap, Error **errp);
+/*
+ * Load the pages that were not faulted in yet, in the background.  Only
+ * called once loading the migration stream succeeded.
+ */
+void mapped_ram_lazy_start_prefetch(void);
+/* Drop the lazy restore after loading the migration stream failed */
+void mapped_ram_lazy_abort(void);
+#else
+#include "qapi/error.h"
+
+static inline bool mapped_ram_lazy_add_block(QEMUFile *f, RAMBlock *block,
+                                             unsigned long *bitmap,
+                                             Error **errp)
+{
+    error_setg(errp, "mapped-ram lazy restore requires userfaultfd");
+    return false;
+}
+
+static inline void mapped_ram_lazy_start_prefetch(void)
+{
+}
+
+static inline void mapped_ram_lazy_abort(void)
+{
+}
+#endif
+
+#endif
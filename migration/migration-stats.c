@@ -11,6 +11,7 @@
  */
 
 #include "qemu/osdep.h"
+#include "qemu/counters.h"
 #include "qemu/stats64.h"
 #include "qemu-file.h"
 #include "trace.h"
@@ -18,6 +19,11 @@
 
 MigrationAtomicStats mig_stats;
 
+QEMU_COUNTER_STAT64(migration_main_bytes, "migration-main-channel-bytes",
+                    &mig_stats.qemu_file_transferred)
+QEMU_COUNTER_STAT64(migration_multifd_bytes, "migration-multifd-bytes",
+                    &mig_stats.multifd_bytes)
+
 bool migration_rate_exceeded(QEMUFile *f)
 {
     if (qemu_file_get_error(f)) {
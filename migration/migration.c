@@ -48,6 +48,7 @@
 #include "qemu/rcu.h"
 #include "block.h"
 #include "postcopy-ram.h"
+#include "mapped-ram-lazy.h"
 #include "qemu/thread.h"
 #include "trace.h"
 #include "exec/target_page.h"
@@ -794,6 +795,10 @@ process_incoming_migration_co(void *opaque)
         goto fail;
     }
 
+    if (migrate_mapped_ram_lazy_restore()) {
+        mapped_ram_lazy_start_prefetch();
+    }
+
     migration_bh_schedule(process_incoming_migration_bh, mis);
     return;
 fail:
@@ -801,6 +806,10 @@ fail:
                       MIGRATION_STATUS_FAILED);
     qemu_fclose(mis->from_src_file);
 
+    if (migrate_mapped_ram_lazy_restore()) {
+        mapped_ram_lazy_abort();
+    }
+
     multifd_recv_cleanup();
     compress_threads_load_cleanup();
 
@@ -1278,7 +1287,7 @@ static void fill_source_migration_info(MigrationInfo *info)
     info->status = state;
 
     QEMU_LOCK_GUARD(&s->error_mutex);
-    if (s->error) {
+    if (s->error && !info->error_desc) {
         info->error_desc = g_strdup(error_get_pretty(s->error));
     }
 }
@@ -1313,6 +1322,15 @@ static void fill_destination_migration_info(MigrationInfo *info)
         break;
     }
     info->status = mis->state;
+
+    if (mis->state == MIGRATION_STATUS_FAILED) {
+        MigrationState *s = migrate_get_current();
+
+        QEMU_LOCK_GUARD(&s->error_mutex);
+        if (s->error) {
+            info->error_desc = g_strdup(error_get_pretty(s->error));
+        }
+    }
 }
 
 MigrationInfo *qmp_query_migrate(Error **errp)
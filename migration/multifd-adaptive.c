@@ -0,0 +1,371 @@
+/*
+ * Multifd adaptive compression implementation
+ *
+ * Chooses, for every packet, the compression method that maximises
+ * the rate at which guest pages leave the channel.  The choice is
+ * made per channel and per RAMBlock from the measured compression
+ * ratio and cost of each candidate and the measured throughput of
+ * the channel.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/timer.h"
+#include "exec/ramblock.h"
+#include "qapi/error.h"
+#include "migration.h"
+#include "trace.h"
+#include "options.h"
+#include "multifd.h"
+
+/* Number of packets between two forced samples of a non-best candidate */
+#define ADAPTIVE_SAMPLE_INTERVAL 32
+/* Weight of a new sample in the moving averages */
+#define ADAPTIVE_EWMA_WEIGHT 0.25
+
+typedef struct {
+    MultiFDCompression method;
+    /* compression level, 0 to keep the level of the migration parameters */
+    int level;
+} AdaptiveCandidate;
+
+static const AdaptiveCandidate adaptive_candidates[] = {
+    /* zero page detection is done by every method, this is zero-page-only */
+    { MULTIFD_COMPRESSION_NONE, 0 },
+    { MULTIFD_COMPRESSION_ZLIB, 0 },
+#ifdef CONFIG_ZSTD
+    { MULTIFD_COMPRESSION_ZSTD, 1 },
+    { MULTIFD_COMPRESSION_ZSTD, 3 },
+#endif
+};
+
+#define ADAPTIVE_NR_CANDIDATES ARRAY_SIZE(adaptive_candidates)
+
+typedef struct {
+    /* compressed size divided by uncompressed size */
+    double ratio;
+    /* nanoseconds spent per uncompressed byte */
+    double ns_per_byte;
+    uint64_t samples;
+} AdaptiveStats;
+
+typedef struct {
+    AdaptiveStats stats[ADAPTIVE_NR_CANDIDATES];
+    /* packets of this RAMBlock sent through the channel */
+    uint64_t packets;
+} AdaptiveBlockState;
+
+struct adaptive_data {
+    /* compress_data of each sub method, indexed by MultiFDCompression */
+    void *sub_data[MULTIFD_COMPRESSION__MAX];
+    /* RAMBlock * -> AdaptiveBlockState *, send side only */
+    GHashTable *blocks;
+    /* zstd level currently programmed in the channel, send side only */
+    int zstd_level;
+};
+
+static bool adaptive_method_used(MultiFDCompression method)
+{
+    for (int i = 0; i < ADAPTIVE_NR_CANDIDATES; i++) {
+        if (adaptive_candidates[i].method == method) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * adaptive_send_setup: setup send side
+ *
+ * Setup every available compression method on the channel.
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @errp: pointer to an error
+ */
+static int adaptive_send_setup(MultiFDSendParams *p, Error **errp)
+{
+    struct adaptive_data *a = g_new0(struct adaptive_data, 1);
+    int ret = 0;
+
+    for (int m = 0; m < MULTIFD_COMPRESSION__MAX; m++) {
+        if (!adaptive_method_used(m)) {
+            continue;
+        }
+        p->compress_data = NULL;
+        ret = multifd_get_ops(m)->send_setup(p, errp);
+        a->sub_data[m] = p->compress_data;
+        if (ret) {
+            break;
+        }
+    }
+    a->blocks = g_hash_table_new_full(NULL, NULL, NULL, g_free);
+    a->zstd_level = migrate_multifd_zstd_level();
+    p->compress_data = a;
+
+    return ret;
+}
+
+/**
+ * adaptive_send_cleanup: cleanup send side
+ *
+ * @p: Params for the channel that we are using
+ * @errp: pointer to an error
+ */
+static void adaptive_send_cleanup(MultiFDSendParams *p, Error **errp)
+{
+    struct adaptive_data *a = p->compress_data;
+
+    for (int m = 0; m < MULTIFD_COMPRESSION__MAX; m++) {
+        if (!a->sub_data[m]) {
+            continue;
+        }
+        p->compress_data = a->sub_data[m];
+        multifd_get_ops(m)->send_cleanup(p, errp);
+    }
+    g_hash_table_destroy(a->blocks);
+    g_free(a);
+    p->compress_data = NULL;
+}
+
+/*
+ * Estimated rate, in uncompressed bytes per second, at which the
+ * candidate can feed the channel: compression and transmission of a
+ * packet are done in sequence by the channel thread.
+ */
+static double adaptive_rate(const AdaptiveStats *s, double link_ns_per_byte)
+{
+    return 1e9 / (s->ns_per_byte + s->ratio * link_ns_per_byte + 1e-6);
+}
+
+static unsigned int adaptive_pick(AdaptiveBlockState *bs,
+                                  double link_ns_per_byte)
+{
+    unsigned int best = 0;
+
+    bs->packets++;
+
+    /* Make sure every candidate has been measured once */
+    for (unsigned int i = 0; i < ADAPTIVE_NR_CANDIDATES; i++) {
+        if (!bs->stats[i].samples) {
+            return i;
+        }
+    }
+
+    /* Data changes over time, keep sampling the other candidates */
+    if (bs->packets % ADAPTIVE_SAMPLE_INTERVAL == 0) {
+        return (bs->packets / ADAPTIVE_SAMPLE_INTERVAL) %
+               ADAPTIVE_NR_CANDIDATES;
+    }
+
+    for (unsigned int i = 1; i < ADAPTIVE_NR_CANDIDATES; i++) {
+        if (adaptive_rate(&bs->stats[i], link_ns_per_byte) >
+            adaptive_rate(&bs->stats[best], link_ns_per_byte)) {
+            best = i;
+        }
+    }
+    return best;
+}
+
+static void adaptive_update_stats(AdaptiveStats *s, uint64_t in,
+                                  uint64_t out, int64_t ns)
+{
+    double ratio = (double)out / in;
+    double ns_per_byte = (double)ns / in;
+
+    if (!s->samples) {
+        s->ratio = ratio;
+        s->ns_per_byte = ns_per_byte;
+    } else {
+        s->ratio += ADAPTIVE_EWMA_WEIGHT * (ratio - s->ratio);
+        s->ns_per_byte += ADAPTIVE_EWMA_WEIGHT * (ns_per_byte - s->ns_per_byte);
+    }
+    s->samples++;
+}
+
+/**
+ * adaptive_send_prepare: prepare data to be able to send
+ *
+ * Pick the best candidate for the RAMBlock and let its method build
+ * the packet.
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @errp: pointer to an error
+ */
+static int adaptive_send_prepare(MultiFDSendParams *p, Error **errp)
+{
+    struct adaptive_data *a = p->compress_data;
+    RAMBlock *block = p->pages->block;
+    const AdaptiveCandidate *c;
+    AdaptiveBlockState *bs;
+    MultiFDMethods *ops;
+    double link_ns_per_byte = 0;
+    unsigned int idx;
+    int64_t start;
+    uint64_t in;
+    int ret;
+
+    bs = g_hash_table_lookup(a->blocks, block);
+    if (!bs) {
+        bs = g_new0(AdaptiveBlockState, 1);
+        g_hash_table_insert(a->blocks, block, bs);
+    }
+
+    /* No measurement yet means the link is idle, i.e. not a bottleneck */
+    if (p->write_bytes) {
+        link_ns_per_byte = (double)p->write_ns / p->write_bytes;
+    }
+
+    idx = adaptive_pick(bs, link_ns_per_byte);
+    c = &adaptive_candidates[idx];
+    ops = multifd_get_ops(c->method);
+
+    p->compress_data = a->sub_data[c->method];
+    if (c->level && ops->send_set_level &&
+        c->method == MULTIFD_COMPRESSION_ZSTD && c->level != a->zstd_level) {
+        ret = ops->send_set_level(p, c->level, errp);
+        if (ret) {
+            p->compress_data = a;
+            return ret;
+        }
+        a->zstd_level = c->level;
+    }
+
+    /*
+     * p->flags is only reset after a SYNC packet, and every method ORs
+     * its own compression flag in: drop the one of the previous packet.
+     */
+    p->flags &= ~MULTIFD_FLAG_COMPRESSION_MASK;
+
+    start = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    ret = ops->send_prepare(p, errp);
+    p->compress_data = a;
+    if (ret) {
+        return ret;
+    }
+
+    in = (uint64_t)p->pages->normal_num * p->page_size;
+    if (in) {
+        adaptive_update_stats(&bs->stats[idx], in, p->next_packet_size,
+                              qemu_clock_get_ns(QEMU_CLOCK_REALTIME) - start);
+    }
+    trace_multifd_adaptive_send_prepare(p->id, block->idstr,
+                                        MultiFDCompression_str(c->method),
+                                        c->level, in, p->next_packet_size);
+    return 0;
+}
+
+/**
+ * adaptive_recv_setup: setup receive side
+ *
+ * The sender can pick any of the candidates for every packet, so all
+ * of them need to be ready to decode.
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @errp: pointer to an error
+ */
+static int adaptive_recv_setup(MultiFDRecvParams *p, Error **errp)
+{
+    struct adaptive_data *a = g_new0(struct adaptive_data, 1);
+    int ret = 0;
+
+    for (int m = 0; m < MULTIFD_COMPRESSION__MAX; m++) {
+        if (!adaptive_method_used(m)) {
+            continue;
+        }
+        p->compress_data = NULL;
+        ret = multifd_get_ops(m)->recv_setup(p, errp);
+        a->sub_data[m] = p->compress_data;
+        if (ret) {
+            break;
+        }
+    }
+    p->compress_data = a;
+
+    return ret;
+}
+
+/**
+ * adaptive_recv_cleanup: cleanup receive side
+ *
+ * @p: Params for the channel that we are using
+ */
+static void adaptive_recv_cleanup(MultiFDRecvParams *p)
+{
+    struct adaptive_data *a = p->compress_data;
+
+    for (int m = 0; m < MULTIFD_COMPRESSION__MAX; m++) {
+        if (!a->sub_data[m]) {
+            continue;
+        }
+        p->compress_data = a->sub_data[m];
+        multifd_get_ops(m)->recv_cleanup(p);
+    }
+    g_free(a);
+    p->compress_data = NULL;
+}
+
+/**
+ * adaptive_recv: read the data from the channel into actual pages
+ *
+ * Dispatch the packet to the method recorded in its flags.
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @errp: pointer to an error
+ */
+static int adaptive_recv(MultiFDRecvParams *p, Error **errp)
+{
+    struct adaptive_data *a = p->compress_data;
+    uint32_t flags = p->flags & MULTIFD_FLAG_COMPRESSION_MASK;
+    MultiFDCompression method;
+    int ret;
+
+    switch (flags) {
+    case MULTIFD_FLAG_NOCOMP:
+        method = MULTIFD_COMPRESSION_NONE;
+        break;
+    case MULTIFD_FLAG_ZLIB:
+        method = MULTIFD_COMPRESSION_ZLIB;
+        break;
+#ifdef CONFIG_ZSTD
+    case MULTIFD_FLAG_ZSTD:
+        method = MULTIFD_COMPRESSION_ZSTD;
+        break;
+#endif
+    default:
+        error_setg(errp, "multifd %u: unexpected compression flags %x",
+                   p->id, flags);
+        return -1;
+    }
+
+    p->compress_data = a->sub_data[method];
+    ret = multifd_get_ops(method)->recv(p, errp);
+    p->compress_data = a;
+
+    return ret;
+}
+
+static MultiFDMethods multifd_adaptive_ops = {
+    .send_setup = adaptive_send_setup,
+    .send_cleanup = adaptive_send_cleanup,
+    .send_prepare = adaptive_send_prepare,
+    .recv_setup = adaptive_recv_setup,
+    .recv_cleanup = adaptive_recv_cleanup,
+    .recv = adaptive_recv
+};
+
+static void multifd_adaptive_register(void)
+{
+    multifd_register_ops(MULTIFD_COMPRESSION_ADAPTIVE, &multifd_adaptive_ops);
+}
+
+migration_init(multifd_adaptive_register);
@@ -0,0 +1,375 @@
+/*
+ * Multifd XBZRLE implementation
+ *
+ * Pages that were already sent are kept in a cache shared by all the
+ * channels so that, when they get dirty again, only the bytes that
+ * changed are sent.  The destination applies the delta on top of its
+ * copy of the page, which matches the cached copy on the source: a
+ * page is sent at most once between two multifd syncs, so its
+ * previous version has always been received by the time the delta
+ * is decoded, whatever channel carried it.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/bswap.h"
+#include "exec/ramblock.h"
+#include "qapi/error.h"
+#include "migration.h"
+#include "migration-stats.h"
+#include "trace.h"
+#include "options.h"
+#include "page_cache.h"
+#include "xbzrle.h"
+#include "multifd.h"
+
+/*
+ * Each page of the packet starts with a 32-bit big endian header: the
+ * page size for a page sent as is, or else the length of the XBZRLE
+ * delta that follows, 0 meaning that the page did not change.
+ */
+#define XBZRLE_HEADER_SIZE sizeof(uint32_t)
+
+struct xbzrle_data {
+    /* copy of the guest page being encoded, it may change under us */
+    uint8_t *buf;
+    /* packet data */
+    uint8_t *zbuff;
+    /* size of packet data buffer */
+    uint32_t zbuff_len;
+};
+
+/* Cache shared by the send channels and number of channels using it */
+static PageCache *xbzrle_cache;
+static unsigned int xbzrle_cache_users;
+
+static uint32_t xbzrle_zbuff_len(uint32_t page_count, uint32_t page_size)
+{
+    return page_count * (page_size + XBZRLE_HEADER_SIZE);
+}
+
+/**
+ * xbzrle_send_setup: setup send side
+ *
+ * Allocate the channel buffers, and the cache on the first channel.
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @errp: pointer to an error
+ */
+static int xbzrle_send_setup(MultiFDSendParams *p, Error **errp)
+{
+    struct xbzrle_data *x;
+
+    if (!xbzrle_cache) {
+        xbzrle_cache = cache_init_partitioned(migrate_xbzrle_cache_size(),
+                                              p->page_size,
+                                              migrate_multifd_channels(),
+                                              errp);
+        if (!xbzrle_cache) {
+            error_prepend(errp, "multifd %u: ", p->id);
+            return -1;
+        }
+    }
+
+    x = g_new0(struct xbzrle_data, 1);
+    x->buf = g_try_malloc(p->page_size);
+    x->zbuff_len = xbzrle_zbuff_len(p->page_count, p->page_size);
+    x->zbuff = g_try_malloc(x->zbuff_len);
+    if (!x->buf || !x->zbuff) {
+        g_free(x->buf);
+        g_free(x->zbuff);
+        g_free(x);
+        if (!xbzrle_cache_users) {
+            cache_fini(xbzrle_cache);
+            xbzrle_cache = NULL;
+        }
+        error_setg(errp, "multifd %u: out of memory for xbzrle buffers",
+                   p->id);
+        return -1;
+    }
+
+    xbzrle_cache_users++;
+    p->compress_data = x;
+    return 0;
+}
+
+/**
+ * xbzrle_send_cleanup: cleanup send side
+ *
+ * Free the channel buffers, and the cache with the last channel.
+ *
+ * @p: Params for the channel that we are using
+ * @errp: pointer to an error
+ */
+static void xbzrle_send_cleanup(MultiFDSendParams *p, Error **errp)
+{
+    struct xbzrle_data *x = p->compress_data;
+
+    if (!x) {
+        return;
+    }
+
+    g_free(x->buf);
+    g_free(x->zbuff);
+    g_free(x);
+    p->compress_data = NULL;
+
+    if (!--xbzrle_cache_users) {
+        cache_fini(xbzrle_cache);
+        xbzrle_cache = NULL;
+    }
+}
+
+/*
+ * Encode one page into @out, keeping the cache in sync with the data
+ * the destination will have.  Returns the number of bytes used.
+ */
+static uint32_t xbzrle_send_page(MultiFDSendParams *p, struct xbzrle_data *x,
+                                 ram_addr_t offset, uint8_t *out,
+                                 uint64_t generation)
+{
+    RAMBlock *block = p->pages->block;
+    uint64_t addr = block->offset + offset;
+    uint8_t *host = block->host + offset;
+    uint8_t *cached;
+    int len;
+
+    cache_lock(xbzrle_cache, addr);
+
+    /*
+     * Nothing was sent yet during the first round, don't fill the
+     * cache with pages that may never be dirtied again.
+     */
+    if (generation < 2) {
+        memcpy(out + XBZRLE_HEADER_SIZE, host, p->page_size);
+        len = p->page_size;
+    } else if (!cache_is_cached(xbzrle_cache, addr, generation)) {
+        if (cache_insert(xbzrle_cache, addr, host, generation) == 0) {
+            /* send what was cached, the guest may have changed the page */
+            host = get_cached_data(xbzrle_cache, addr);
+        }
+        memcpy(out + XBZRLE_HEADER_SIZE, host, p->page_size);
+        len = p->page_size;
+    } else {
+        cached = get_cached_data(xbzrle_cache, addr);
+        memcpy(x->buf, host, p->page_size);
+
+        /* Keep the delta strictly smaller than the page to tell them apart */
+        len = xbzrle_encode_buffer(cached, x->buf, p->page_size,
+                                   out + XBZRLE_HEADER_SIZE,
+                                   p->page_size - 1);
+        if (len) {
+            memcpy(cached, x->buf, p->page_size);
+        }
+        if (len == -1) {
+            memcpy(out + XBZRLE_HEADER_SIZE, x->buf, p->page_size);
+            len = p->page_size;
+        }
+    }
+
+    cache_unlock(xbzrle_cache, addr);
+
+    stl_be_p(out, len);
+    return XBZRLE_HEADER_SIZE + len;
+}
+
+/* A zero page is sent without us, update its cached copy if any */
+static void xbzrle_send_zero_page(MultiFDSendParams *p, ram_addr_t offset)
+{
+    uint64_t addr = p->pages->block->offset + offset;
+    uint8_t *cached;
+
+    cache_lock(xbzrle_cache, addr);
+    cached = get_cached_data(xbzrle_cache, addr);
+    if (cached) {
+        memset(cached, 0, p->page_size);
+    }
+    cache_unlock(xbzrle_cache, addr);
+}
+
+/**
+ * xbzrle_send_prepare: prepare data to be able to send
+ *
+ * Encode every page of the packet against its cached copy.
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @errp: pointer to an error
+ */
+static int xbzrle_send_prepare(MultiFDSendParams *p, Error **errp)
+{
+    MultiFDPages_t *pages = p->pages;
+    struct xbzrle_data *x = p->compress_data;
+    uint64_t generation = stat64_get(&mig_stats.dirty_sync_count);
+    uint32_t out_size = 0;
+    bool has_normal;
+    uint32_t i;
+
+    has_normal = multifd_send_prepare_common(p);
+
+    for (i = pages->normal_num; i < pages->num; i++) {
+        xbzrle_send_zero_page(p, pages->offset[i]);
+    }
+
+    if (!has_normal) {
+        goto out;
+    }
+
+    for (i = 0; i < pages->normal_num; i++) {
+        out_size += xbzrle_send_page(p, x, pages->offset[i],
+                                     x->zbuff + out_size, generation);
+    }
+
+    p->iov[p->iovs_num].iov_base = x->zbuff;
+    p->iov[p->iovs_num].iov_len = out_size;
+    p->iovs_num++;
+    p->next_packet_size = out_size;
+
+    trace_multifd_xbzrle_send_prepare(p->id, pages->normal_num, out_size);
+
+out:
+    p->flags |= MULTIFD_FLAG_XBZRLE;
+    multifd_send_fill_packet(p);
+    return 0;
+}
+
+/**
+ * xbzrle_recv_setup: setup receive side
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @errp: pointer to an error
+ */
+static int xbzrle_recv_setup(MultiFDRecvParams *p, Error **errp)
+{
+    struct xbzrle_data *x = g_new0(struct xbzrle_data, 1);
+
+    x->zbuff_len = xbzrle_zbuff_len(p->page_count, p->page_size);
+    x->zbuff = g_try_malloc(x->zbuff_len);
+    if (!x->zbuff) {
+        g_free(x);
+        error_setg(errp, "multifd %u: out of memory for xbzrle buffer",
+                   p->id);
+        return -1;
+    }
+    p->compress_data = x;
+    return 0;
+}
+
+/**
+ * xbzrle_recv_cleanup: cleanup receive side
+ *
+ * @p: Params for the channel that we are using
+ */
+static void xbzrle_recv_cleanup(MultiFDRecvParams *p)
+{
+    struct xbzrle_data *x = p->compress_data;
+
+    if (!x) {
+        return;
+    }
+    g_free(x->zbuff);
+    g_free(x);
+    p->compress_data = NULL;
+}
+
+/**
+ * xbzrle_recv: read the data from the channel into actual pages
+ *
+ * Read the packet data and apply every delta to its page.
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @errp: pointer to an error
+ */
+static int xbzrle_recv(MultiFDRecvParams *p, Error **errp)
+{
+    struct xbzrle_data *x = p->compress_data;
+    uint32_t in_size = p->next_packet_size;
+    uint32_t flags = p->flags & MULTIFD_FLAG_COMPRESSION_MASK;
+    uint32_t pos = 0;
+    int ret;
+    int i;
+
+    if (flags != MULTIFD_FLAG_XBZRLE) {
+        error_setg(errp, "multifd %u: flags received %x flags expected %x",
+                   p->id, flags, MULTIFD_FLAG_XBZRLE);
+        return -1;
+    }
+
+    multifd_recv_zero_page_process(p);
+
+    if (!p->normal_num) {
+        assert(in_size == 0);
+        return 0;
+    }
+
+    if (in_size > x->zbuff_len) {
+        error_setg(errp, "multifd %u: packet size received %u size max %u",
+                   p->id, in_size, x->zbuff_len);
+        return -1;
+    }
+
+    ret = qio_channel_read_all(p->c, (void *)x->zbuff, in_size, errp);
+    if (ret != 0) {
+        return ret;
+    }
+
+    for (i = 0; i < p->normal_num; i++) {
+        uint8_t *page = p->host + p->normal[i];
+        uint32_t len;
+
+        if (in_size - pos < XBZRLE_HEADER_SIZE) {
+            goto truncated;
+        }
+        len = ldl_be_p(x->zbuff + pos);
+        pos += XBZRLE_HEADER_SIZE;
+        if (len > p->page_size || in_size - pos < len) {
+            goto truncated;
+        }
+
+        if (len == p->page_size) {
+            memcpy(page, x->zbuff + pos, len);
+        } else if (len &&
+                   xbzrle_decode_buffer(x->zbuff + pos, len, page,
+                                        p->page_size) == -1) {
+            error_setg(errp, "multifd %u: failed to decode xbzrle page "
+                       "at offset " RAM_ADDR_FMT, p->id, p->normal[i]);
+            return -1;
+        }
+        pos += len;
+    }
+
+    if (pos != in_size) {
+        goto truncated;
+    }
+    return 0;
+
+truncated:
+    error_setg(errp, "multifd %u: malformed xbzrle packet of size %u",
+               p->id, in_size);
+    return -1;
+}
+
+static MultiFDMethods multifd_xbzrle_ops = {
+    .send_setup = xbzrle_send_setup,
+    .send_cleanup = xbzrle_send_cleanup,
+    .send_prepare = xbzrle_send_prepare,
+    .recv_setup = xbzrle_recv_setup,
+    .recv_cleanup = xbzrle_recv_cleanup,
+    .recv = xbzrle_recv
+};
+
+static void multifd_xbzrle_register(void)
+{
+    multifd_register_ops(MULTIFD_COMPRESSION_XBZRLE, &multifd_xbzrle_ops);
+}
+
+migration_init(multifd_xbzrle_register);
@@ -170,6 +170,32 @@ out:
     return 0;
 }
 
+/**
+ * zstd_send_set_level: change the compression level
+ *
+ * The new level applies to the data compressed from now on; the
+ * decompressor does not need to know about it.
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @level: new zstd compression level
+ * @errp: pointer to an error
+ */
+static int zstd_send_set_level(MultiFDSendParams *p, int level, Error **errp)
+{
+    struct zstd_data *z = p->compress_data;
+    size_t res;
+
+    res = ZSTD_CCtx_setParameter(z->zcs, ZSTD_c_compressionLevel, level);
+    if (ZSTD_isError(res)) {
+        error_setg(errp, "multifd %u: setting level %d failed with error %s",
+                   p->id, level, ZSTD_getErrorName(res));
+        return -1;
+    }
+    return 0;
+}
+
 /**
  * zstd_recv_setup: setup receive side
  *
@@ -318,6 +344,7 @@ static MultiFDMethods multifd_zstd_ops = {
     .send_setup = zstd_send_setup,
     .send_cleanup = zstd_send_cleanup,
     .send_prepare = zstd_send_prepare,
+    .send_set_level = zstd_send_set_level,
     .recv_setup = zstd_recv_setup,
     .recv_cleanup = zstd_recv_cleanup,
     .recv = zstd_recv
@@ -12,7 +12,9 @@
 
 #include "qemu/osdep.h"
 #include "qemu/cutils.h"
+#include "qemu/bitmap.h"
 #include "qemu/rcu.h"
+#include "qemu/timer.h"
 #include "exec/target_page.h"
 #include "sysemu/sysemu.h"
 #include "exec/ramblock.h"
@@ -300,6 +302,12 @@ void multifd_register_ops(int method, MultiFDMethods *ops)
     multifd_ops[method] = ops;
 }
 
+MultiFDMethods *multifd_get_ops(int method)
+{
+    assert(0 <= method && method < MULTIFD_COMPRESSION__MAX);
+    return multifd_ops[method];
+}
+
 /* Reset a MultiFDPages_t* object for the next use */
 static void multifd_pages_reset(MultiFDPages_t *pages)
 {
@@ -310,6 +318,7 @@ static void multifd_pages_reset(MultiFDPages_t *pages)
     pages->num = 0;
     pages->normal_num = 0;
     pages->block = NULL;
+    pages->range_pages = 0;
 }
 
 static int multifd_send_initial_packet(MultiFDSendParams *p, Error **errp)
@@ -382,6 +391,7 @@ static MultiFDPages_t *multifd_pages_init(uint32_t n)
 
     pages->allocated = n;
     pages->offset = g_new0(ram_addr_t, n);
+    pages->range_bmap = bitmap_new(n);
 
     return pages;
 }
@@ -392,6 +402,8 @@ static void multifd_pages_clear(MultiFDPages_t *pages)
     pages->allocated = 0;
     g_free(pages->offset);
     pages->offset = NULL;
+    g_free(pages->range_bmap);
+    pages->range_bmap = NULL;
     g_free(pages);
 }
 
@@ -676,6 +688,76 @@ retry:
     return true;
 }
 
+/**
+ * multifd_queue_dirty_range: hand out a range of dirty pages
+ *
+ * Copy the dirty bits of the range to a channel, which builds the list
+ * of pages and checks them for zero pages on its own, and send it.
+ * The caller is in charge of clearing the bits in @bmap.
+ *
+ * Returns the number of dirty pages in the range, or -1 on error
+ *
+ * @block: RAMBlock the range belongs to
+ * @start: first target page of the range
+ * @bmap: dirty bitmap of @block
+ * @npages: number of pages in the range, at most multifd_ram_page_count()
+ */
+int multifd_queue_dirty_range(RAMBlock *block, unsigned long start,
+                              const unsigned long *bmap, uint32_t npages)
+{
+    MultiFDPages_t *pages = multifd_send_state->pages;
+    uint32_t dirty;
+
+    assert(npages && npages <= pages->allocated);
+
+    /* Send the pages queued one by one first */
+    if (!multifd_queue_empty(pages)) {
+        if (!multifd_send_pages()) {
+            return -1;
+        }
+        pages = multifd_send_state->pages;
+    }
+
+    bitmap_copy_with_src_offset(pages->range_bmap, bmap, start, npages);
+    dirty = bitmap_count_one(pages->range_bmap, npages);
+    if (!dirty) {
+        return 0;
+    }
+
+    pages->block = block;
+    pages->range_start = start;
+    pages->range_pages = npages;
+    pages->num = dirty;
+
+    if (!multifd_send_pages()) {
+        return -1;
+    }
+    return dirty;
+}
+
+/* Maximum number of pages in a packet */
+uint32_t multifd_ram_page_count(void)
+{
+    return MULTIFD_PACKET_SIZE / qemu_target_page_size();
+}
+
+/* Turn a range handed out by multifd_queue_dirty_range() into pages */
+static void multifd_pages_expand_range(MultiFDPages_t *pages,
+                                       uint32_t page_size)
+{
+    unsigned long n = pages->range_pages;
+    unsigned long i;
+    uint32_t dirty = pages->num;
+
+    pages->num = 0;
+    for (i = find_first_bit(pages->range_bmap, n); i < n;
+         i = find_next_bit(pages->range_bmap, n, i + 1)) {
+        multifd_enqueue(pages, (ram_addr_t)(pages->range_start + i) *
+                               page_size);
+    }
+    assert(pages->num == dirty);
+}
+
 /* Multifd send side hit an error; remember it and prepare to quit */
 static void multifd_send_set_error(Error *err)
 {
@@ -931,15 +1013,21 @@ static void *multifd_send_thread(void *opaque)
          */
         if (qatomic_load_acquire(&p->pending_job)) {
             MultiFDPages_t *pages = p->pages;
+            int64_t write_start;
 
             p->iovs_num = 0;
             assert(pages->num);
 
+            if (pages->range_pages) {
+                multifd_pages_expand_range(pages, p->page_size);
+            }
+
             ret = multifd_send_state->ops->send_prepare(p, &local_err);
             if (ret != 0) {
                 break;
             }
 
+            write_start = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
             if (migrate_mapped_ram()) {
                 ret = file_write_ramblock_iov(p->c, p->iov, p->iovs_num,
                                               p->pages->block, &local_err);
@@ -953,6 +1041,8 @@ static void *multifd_send_thread(void *opaque)
                 break;
             }
 
+            p->write_ns += qemu_clock_get_ns(QEMU_CLOCK_REALTIME) - write_start;
+            p->write_bytes += p->next_packet_size + p->packet_len;
             stat64_add(&mig_stats.multifd_bytes,
                        p->next_packet_size + p->packet_len);
             stat64_add(&mig_stats.normal_pages, pages->normal_num);
@@ -1147,7 +1237,7 @@ bool multifd_send_setup(void)
     MigrationState *s = migrate_get_current();
     Error *local_err = NULL;
     int thread_count, ret = 0;
-    uint32_t page_count = MULTIFD_PACKET_SIZE / qemu_target_page_size();
+    uint32_t page_count = multifd_ram_page_count();
     bool use_packets = multifd_use_packets();
     uint8_t i;
 
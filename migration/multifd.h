@@ -28,18 +28,24 @@ void multifd_recv_new_channel(QIOChannel *ioc, Error **errp);
 void multifd_recv_sync_main(void);
 int multifd_send_sync_main(void);
 bool multifd_queue_page(RAMBlock *block, ram_addr_t offset);
+int multifd_queue_dirty_range(RAMBlock *block, unsigned long start,
+                              const unsigned long *bmap, uint32_t npages);
+uint32_t multifd_ram_page_count(void);
 bool multifd_recv(void);
 MultiFDRecvData *multifd_get_recv_data(void);
 
 /* Multifd Compression flags */
 #define MULTIFD_FLAG_SYNC (1 << 0)
 
-/* We reserve 3 bits for compression methods */
-#define MULTIFD_FLAG_COMPRESSION_MASK (7 << 1)
+/* We reserve 4 bits for compression methods */
+#define MULTIFD_FLAG_COMPRESSION_MASK (0xf << 1)
 /* we need to be compatible. Before compression value was 0 */
 #define MULTIFD_FLAG_NOCOMP (0 << 1)
 #define MULTIFD_FLAG_ZLIB (1 << 1)
 #define MULTIFD_FLAG_ZSTD (2 << 1)
+#define MULTIFD_FLAG_XBZRLE (3 << 1)
+#define MULTIFD_FLAG_QPL (4 << 1)
+#define MULTIFD_FLAG_UADK (8 << 1)
 
 /* This value needs to be a multiple of qemu_target_page_size() */
 #define MULTIFD_PACKET_SIZE (512 * 1024)
@@ -78,6 +84,15 @@ typedef struct {
     /* offset of each page */
     ram_addr_t *offset;
     RAMBlock *block;
+    /*
+     * Range of pages handed out by the migration thread, turned into
+     * offset[] by the channel thread: bit i of range_bmap is set when
+     * page range_start + i is dirty.  range_pages is 0 when the pages
+     * were queued one by one.
+     */
+    unsigned long range_start;
+    uint32_t range_pages;
+    unsigned long *range_bmap;
 } MultiFDPages_t;
 
 struct MultiFDRecvData {
@@ -148,6 +163,9 @@ typedef struct {
     uint64_t total_normal_pages;
     /* zero pages sent through this channel */
     uint64_t total_zero_pages;
+    /* bytes written to the channel and time spent writing them */
+    uint64_t write_bytes;
+    uint64_t write_ns;
     /* buffers to send */
     struct iovec *iov;
     /* number of iovs used */
@@ -229,6 +247,8 @@ typedef struct {
     void (*send_cleanup)(MultiFDSendParams *p, Error **errp);
     /* Prepare the send packet */
     int (*send_prepare)(MultiFDSendParams *p, Error **errp);
+    /* Change the compression level used by the sending side (optional) */
+    int (*send_set_level)(MultiFDSendParams *p, int level, Error **errp);
     /* Setup for receiving side */
     int (*recv_setup)(MultiFDRecvParams *p, Error **errp);
     /* Cleanup for receiving side */
@@ -238,6 +258,7 @@ typedef struct {
 } MultiFDMethods;
 
 void multifd_register_ops(int method, MultiFDMethods *ops);
+MultiFDMethods *multifd_get_ops(int method);
 void multifd_send_fill_packet(MultiFDSendParams *p);
 bool multifd_send_prepare_common(MultiFDSendParams *p);
 void multifd_send_zero_page_detect(MultiFDSendParams *p);
@@ -65,6 +65,15 @@
 /* 0: means nocompress, 1: best speed, ... 20: best compress ratio */
 #define DEFAULT_MIGRATE_MULTIFD_ZSTD_LEVEL 1
 
+#define DEFAULT_MIGRATE_DIRTY_SYNC_THREADS 0
+
+#define DEFAULT_MIGRATE_DIRECT_IO false
+
+#define DEFAULT_MIGRATE_POSTCOPY_PREFETCH_PAGES 0
+#define MAX_POSTCOPY_PREFETCH_PAGES 4096
+
+#define DEFAULT_MIGRATE_DIRTY_LIMIT_PREDICTIVE false
+
 /* Background transfer rate for postcopy, 0 means unlimited, note
  * that page requests can still exceed this limit.
  */
@@ -182,6 +191,18 @@ Property migration_properties[] = {
     DEFINE_PROP_ZERO_PAGE_DETECTION("zero-page-detection", MigrationState,
                        parameters.zero_page_detection,
                        ZERO_PAGE_DETECTION_MULTIFD),
+    DEFINE_PROP_UINT8("dirty-sync-threads", MigrationState,
+                      parameters.dirty_sync_threads,
+                      DEFAULT_MIGRATE_DIRTY_SYNC_THREADS),
+    DEFINE_PROP_BOOL("direct-io", MigrationState,
+                     parameters.direct_io,
+                     DEFAULT_MIGRATE_DIRECT_IO),
+    DEFINE_PROP_UINT32("postcopy-prefetch-pages", MigrationState,
+                      parameters.postcopy_prefetch_pages,
+                      DEFAULT_MIGRATE_POSTCOPY_PREFETCH_PAGES),
+    DEFINE_PROP_BOOL("dirty-limit-predictive", MigrationState,
+                     parameters.dirty_limit_predictive,
+                     DEFAULT_MIGRATE_DIRTY_LIMIT_PREDICTIVE),
 
     /* Migration capabilities */
     DEFINE_PROP_MIG_CAP("x-xbzrle", MIGRATION_CAPABILITY_XBZRLE),
@@ -208,6 +229,14 @@ Property migration_properties[] = {
                         MIGRATION_CAPABILITY_SWITCHOVER_ACK),
     DEFINE_PROP_MIG_CAP("x-dirty-limit", MIGRATION_CAPABILITY_DIRTY_LIMIT),
     DEFINE_PROP_MIG_CAP("mapped-ram", MIGRATION_CAPABILITY_MAPPED_RAM),
+    DEFINE_PROP_MIG_CAP("x-mapped-ram-lazy-restore",
+                        MIGRATION_CAPABILITY_MAPPED_RAM_LAZY_RESTORE),
+    DEFINE_PROP_MIG_CAP("x-mapped-ram-cow-restore",
+                        MIGRATION_CAPABILITY_MAPPED_RAM_COW_RESTORE),
+    DEFINE_PROP_MIG_CAP("x-colo-delta-vmstate",
+                        MIGRATION_CAPABILITY_X_COLO_DELTA_VMSTATE),
+    DEFINE_PROP_MIG_CAP("x-dirty-bitmaps-rle",
+                        MIGRATION_CAPABILITY_X_DIRTY_BITMAPS_RLE),
     DEFINE_PROP_END_OF_LIST(),
 };
 
@@ -239,6 +268,13 @@ bool migrate_colo(void)
     return s->capabilities[MIGRATION_CAPABILITY_X_COLO];
 }
 
+bool migrate_colo_delta_vmstate(void)
+{
+    MigrationState *s = migrate_get_current();
+
+    return s->capabilities[MIGRATION_CAPABILITY_X_COLO_DELTA_VMSTATE];
+}
+
 bool migrate_compress(void)
 {
     MigrationState *s = migrate_get_current();
@@ -253,6 +289,13 @@ bool migrate_dirty_bitmaps(void)
     return s->capabilities[MIGRATION_CAPABILITY_DIRTY_BITMAPS];
 }
 
+bool migrate_dirty_bitmaps_rle(void)
+{
+    MigrationState *s = migrate_get_current();
+
+    return s->capabilities[MIGRATION_CAPABILITY_X_DIRTY_BITMAPS_RLE];
+}
+
 bool migrate_dirty_limit(void)
 {
     MigrationState *s = migrate_get_current();
@@ -274,6 +317,20 @@ bool migrate_mapped_ram(void)
     return s->capabilities[MIGRATION_CAPABILITY_MAPPED_RAM];
 }
 
+bool migrate_mapped_ram_lazy_restore(void)
+{
+    MigrationState *s = migrate_get_current();
+
+    return s->capabilities[MIGRATION_CAPABILITY_MAPPED_RAM_LAZY_RESTORE];
+}
+
+bool migrate_mapped_ram_cow_restore(void)
+{
+    MigrationState *s = migrate_get_current();
+
+    return s->capabilities[MIGRATION_CAPABILITY_MAPPED_RAM_COW_RESTORE];
+}
+
 bool migrate_ignore_shared(void)
 {
     MigrationState *s = migrate_get_current();
@@ -676,6 +733,47 @@ bool migrate_caps_check(bool *old_caps, bool *new_caps, Error **errp)
         }
     }
 
+    if (new_caps[MIGRATION_CAPABILITY_MAPPED_RAM_LAZY_RESTORE]) {
+#ifndef CONFIG_LINUX
+        error_setg(errp, "Mapped-ram lazy restore is only supported on Linux");
+        return false;
+#endif
+        if (!new_caps[MIGRATION_CAPABILITY_MAPPED_RAM]) {
+            error_setg(errp, "Mapped-ram lazy restore requires mapped-ram");
+            return false;
+        }
+    }
+
+    if (new_caps[MIGRATION_CAPABILITY_X_COLO_DELTA_VMSTATE] &&
+        !new_caps[MIGRATION_CAPABILITY_X_COLO]) {
+        error_setg(errp, "COLO delta vmstate requires COLO");
+        return false;
+    }
+
+    if (new_caps[MIGRATION_CAPABILITY_X_DIRTY_BITMAPS_RLE] &&
+        !new_caps[MIGRATION_CAPABILITY_DIRTY_BITMAPS]) {
+        error_setg(errp, "Dirty bitmaps RLE requires dirty-bitmaps");
+        return false;
+    }
+
+    if (new_caps[MIGRATION_CAPABILITY_MAPPED_RAM_COW_RESTORE]) {
+#ifdef _WIN32
+        error_setg(errp, "Mapped-ram copy-on-write restore is not supported "
+                   "on Windows");
+        return false;
+#endif
+        if (!new_caps[MIGRATION_CAPABILITY_MAPPED_RAM]) {
+            error_setg(errp,
+                       "Mapped-ram copy-on-write restore requires mapped-ram");
+            return false;
+        }
+        if (new_caps[MIGRATION_CAPABILITY_MAPPED_RAM_LAZY_RESTORE]) {
+            error_setg(errp, "Mapped-ram copy-on-write restore is "
+                       "incompatible with lazy restore");
+            return false;
+        }
+    }
+
     return true;
 }
 
@@ -948,6 +1046,34 @@ ZeroPageDetection migrate_zero_page_detection(void)
     return s->parameters.zero_page_detection;
 }
 
+uint8_t migrate_dirty_sync_threads(void)
+{
+    MigrationState *s = migrate_get_current();
+
+    return s->parameters.dirty_sync_threads;
+}
+
+bool migrate_direct_io(void)
+{
+    MigrationState *s = migrate_get_current();
+
+    return s->parameters.direct_io;
+}
+
+uint32_t migrate_postcopy_prefetch_pages(void)
+{
+    MigrationState *s = migrate_get_current();
+
+    return s->parameters.postcopy_prefetch_pages;
+}
+
+bool migrate_dirty_limit_predictive(void)
+{
+    MigrationState *s = migrate_get_current();
+
+    return s->parameters.dirty_limit_predictive;
+}
+
 /* parameter setters */
 
 void migrate_set_block_incremental(bool value)
@@ -1060,6 +1186,14 @@ MigrationParameters *qmp_query_migrate_parameters(Error **errp)
     params->mode = s->parameters.mode;
     params->has_zero_page_detection = true;
     params->zero_page_detection = s->parameters.zero_page_detection;
+    params->has_dirty_sync_threads = true;
+    params->dirty_sync_threads = s->parameters.dirty_sync_threads;
+    params->has_direct_io = true;
+    params->direct_io = s->parameters.direct_io;
+    params->has_postcopy_prefetch_pages = true;
+    params->postcopy_prefetch_pages = s->parameters.postcopy_prefetch_pages;
+    params->has_dirty_limit_predictive = true;
+    params->dirty_limit_predictive = s->parameters.dirty_limit_predictive;
 
     return params;
 }
@@ -1097,6 +1231,10 @@ void migrate_params_init(MigrationParameters *params)
     params->has_vcpu_dirty_limit = true;
     params->has_mode = true;
     params->has_zero_page_detection = true;
+    params->has_dirty_sync_threads = true;
+    params->has_direct_io = true;
+    params->has_postcopy_prefetch_pages = true;
+    params->has_dirty_limit_predictive = true;
 }
 
 /*
@@ -1107,6 +1245,13 @@ bool migrate_params_check(MigrationParameters *params, Error **errp)
 {
     ERRP_GUARD();
 
+#ifndef O_DIRECT
+    if (params->has_direct_io && params->direct_io) {
+        error_setg(errp, "No support for direct-io on this platform");
+        return false;
+    }
+#endif
+
     if (params->has_compress_level &&
         (params->compress_level > 9)) {
         error_setg(errp, QERR_INVALID_PARAMETER_VALUE, "compress_level",
@@ -1275,6 +1420,15 @@ bool migrate_params_check(MigrationParameters *params, Error **errp)
         return false;
     }
 
+    if (params->has_multifd_compression &&
+        params->multifd_compression == MULTIFD_COMPRESSION_XBZRLE &&
+        params->has_zero_page_detection &&
+        params->zero_page_detection == ZERO_PAGE_DETECTION_LEGACY) {
+        error_setg(errp, "Multifd xbzrle compression is not compatible with "
+                   "legacy zero page detection");
+        return false;
+    }
+
     if (params->has_x_vcpu_dirty_limit_period &&
         (params->x_vcpu_dirty_limit_period < 1 ||
          params->x_vcpu_dirty_limit_period > 1000)) {
@@ -1292,6 +1446,22 @@ bool migrate_params_check(MigrationParameters *params, Error **errp)
         return false;
     }
 
+    if (params->has_dirty_sync_threads &&
+        params->dirty_sync_threads > 64) {
+        error_setg(errp, QERR_INVALID_PARAMETER_VALUE,
+                   "dirty-sync-threads",
+                   "a value between 0 and 64");
+        return false;
+    }
+
+    if (params->has_postcopy_prefetch_pages &&
+        params->postcopy_prefetch_pages > MAX_POSTCOPY_PREFETCH_PAGES) {
+        error_setg(errp, QERR_INVALID_PARAMETER_VALUE,
+                   "postcopy-prefetch-pages",
+                   "a value between 0 and 4096");
+        return false;
+    }
+
     return true;
 }
 
@@ -1417,6 +1587,22 @@ static void migrate_params_test_apply(MigrateSetParameters *params,
     if (params->has_zero_page_detection) {
         dest->zero_page_detection = params->zero_page_detection;
     }
+
+    if (params->has_dirty_sync_threads) {
+        dest->dirty_sync_threads = params->dirty_sync_threads;
+    }
+
+    if (params->has_direct_io) {
+        dest->direct_io = params->direct_io;
+    }
+
+    if (params->has_postcopy_prefetch_pages) {
+        dest->postcopy_prefetch_pages = params->postcopy_prefetch_pages;
+    }
+
+    if (params->has_dirty_limit_predictive) {
+        dest->dirty_limit_predictive = params->dirty_limit_predictive;
+    }
 }
 
 static void migrate_params_apply(MigrateSetParameters *params, Error **errp)
@@ -1571,6 +1757,22 @@ static void migrate_params_apply(MigrateSetParameters *params, Error **errp)
     if (params->has_zero_page_detection) {
         s->parameters.zero_page_detection = params->zero_page_detection;
     }
+
+    if (params->has_dirty_sync_threads) {
+        s->parameters.dirty_sync_threads = params->dirty_sync_threads;
+    }
+
+    if (params->has_direct_io) {
+        s->parameters.direct_io = params->direct_io;
+    }
+
+    if (params->has_postcopy_prefetch_pages) {
+        s->parameters.postcopy_prefetch_pages = params->postcopy_prefetch_pages;
+    }
+
+    if (params->has_dirty_limit_predictive) {
+        s->parameters.dirty_limit_predictive = params->dirty_limit_predictive;
+    }
 }
 
 void qmp_migrate_set_parameters(MigrateSetParameters *params, Error **errp)
@@ -27,10 +27,14 @@ extern Property migration_properties[];
 bool migrate_auto_converge(void);
 bool migrate_block(void);
 bool migrate_colo(void);
+bool migrate_colo_delta_vmstate(void);
 bool migrate_compress(void);
 bool migrate_dirty_bitmaps(void);
+bool migrate_dirty_bitmaps_rle(void);
 bool migrate_events(void);
 bool migrate_mapped_ram(void);
+bool migrate_mapped_ram_lazy_restore(void);
+bool migrate_mapped_ram_cow_restore(void);
 bool migrate_ignore_shared(void);
 bool migrate_late_block_activate(void);
 bool migrate_multifd(void);
@@ -91,6 +95,10 @@ const char *migrate_tls_creds(void);
 const char *migrate_tls_hostname(void);
 uint64_t migrate_xbzrle_cache_size(void);
 ZeroPageDetection migrate_zero_page_detection(void);
+uint8_t migrate_dirty_sync_threads(void);
+bool migrate_direct_io(void);
+uint32_t migrate_postcopy_prefetch_pages(void);
+bool migrate_dirty_limit_predictive(void);
 
 /* parameters setters */
 
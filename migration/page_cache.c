@@ -1,6 +1,6 @@
 /*
  * Page cache for QEMU
- * The cache is base on a hash of the page address
+ * The cache is a set associative cache indexed by the page address
  *
  * Copyright 2012 Red Hat, Inc. and/or its affiliates
  *
@@ -17,31 +17,57 @@
 #include "qapi/qmp/qerror.h"
 #include "qapi/error.h"
 #include "qemu/host-utils.h"
+#include "qemu/madvise.h"
+#include "qemu/memalign.h"
+#include "qemu/thread.h"
 #include "page_cache.h"
 #include "trace.h"
 
 /* the page in cache will not be replaced in two cycles */
 #define CACHED_PAGE_LIFETIME 2
 
+/* number of pages a page can be cached in */
+#define CACHE_WAYS 8
+
 typedef struct CacheItem CacheItem;
 
 struct CacheItem {
     uint64_t it_addr;
     uint64_t it_age;
+    /* last use of the item, for LRU replacement within a set */
+    uint64_t it_used;
     uint8_t *it_data;
 };
 
+typedef struct CachePartition {
+    /* only taken by cache_lock(), i.e. with several users */
+    QemuMutex lock;
+    /* num_sets sets of ways items */
+    CacheItem *items;
+    size_t num_sets;
+    uint64_t clock;
+} CachePartition;
+
 struct PageCache {
-    CacheItem *page_cache;
+    CachePartition *parts;
+    unsigned int nr_parts;
+    unsigned int ways;
     size_t page_size;
     size_t max_num_items;
-    size_t num_items;
+    /* storage of all the cached pages */
+    uint8_t *data;
 };
 
 PageCache *cache_init(uint64_t new_size, size_t page_size, Error **errp)
 {
-    int64_t i;
+    return cache_init_partitioned(new_size, page_size, 1, errp);
+}
+
+PageCache *cache_init_partitioned(uint64_t new_size, size_t page_size,
+                                  unsigned int nr_partitions, Error **errp)
+{
     size_t num_pages = new_size / page_size;
+    size_t part_items, i;
     PageCache *cache;
 
     if (new_size < page_size) {
@@ -57,74 +83,144 @@ PageCache *cache_init(uint64_t new_size, size_t page_size, Error **errp)
         return NULL;
     }
 
+    assert(nr_partitions);
+    part_items = num_pages / nr_partitions;
+    if (!part_items) {
+        error_setg(errp, QERR_INVALID_PARAMETER_VALUE, "cache size",
+                   "is smaller than one page per channel");
+        return NULL;
+    }
+    part_items = pow2floor(part_items);
+
     /* We prefer not to abort if there is no memory */
-    cache = g_try_malloc(sizeof(*cache));
+    cache = g_try_malloc0(sizeof(*cache));
     if (!cache) {
         error_setg(errp, "Failed to allocate cache");
         return NULL;
     }
     cache->page_size = page_size;
-    cache->num_items = 0;
-    cache->max_num_items = num_pages;
+    cache->nr_parts = nr_partitions;
+    cache->ways = MIN(CACHE_WAYS, part_items);
+    cache->max_num_items = part_items * nr_partitions;
 
     trace_migration_pagecache_init(cache->max_num_items);
 
-    /* We prefer not to abort if there is no memory */
-    cache->page_cache = g_try_malloc((cache->max_num_items) *
-                                     sizeof(*cache->page_cache));
-    if (!cache->page_cache) {
+    /*
+     * A single allocation, backed by huge pages when possible: the
+     * cache is accessed randomly and is often several GiB large, so it
+     * would otherwise miss in the TLB on most accesses.  The memory is
+     * only populated when pages get inserted.
+     */
+    cache->data = qemu_try_memalign(QEMU_VMALLOC_ALIGN,
+                                    cache->max_num_items * page_size);
+    cache->parts = g_try_new0(CachePartition, nr_partitions);
+    if (!cache->data || !cache->parts) {
         error_setg(errp, "Failed to allocate page cache");
-        g_free(cache);
-        return NULL;
+        goto err;
     }
-
-    for (i = 0; i < cache->max_num_items; i++) {
-        cache->page_cache[i].it_data = NULL;
-        cache->page_cache[i].it_age = 0;
-        cache->page_cache[i].it_addr = -1;
+    qemu_madvise(cache->data, cache->max_num_items * page_size,
+                 QEMU_MADV_HUGEPAGE);
+
+    for (i = 0; i < nr_partitions; i++) {
+        CachePartition *part = &cache->parts[i];
+        size_t j;
+
+        part->num_sets = part_items / cache->ways;
+        part->items = g_try_new(CacheItem, part_items);
+        if (!part->items) {
+            error_setg(errp, "Failed to allocate page cache");
+            goto err;
+        }
+        qemu_mutex_init(&part->lock);
+
+        for (j = 0; j < part_items; j++) {
+            part->items[j].it_data =
+                cache->data + (i * part_items + j) * page_size;
+            part->items[j].it_age = 0;
+            part->items[j].it_used = 0;
+            part->items[j].it_addr = -1;
+        }
     }
 
     return cache;
+
+err:
+    cache_fini(cache);
+    return NULL;
 }
 
 void cache_fini(PageCache *cache)
 {
-    int64_t i;
+    unsigned int i;
 
     g_assert(cache);
-    g_assert(cache->page_cache);
 
-    for (i = 0; i < cache->max_num_items; i++) {
-        g_free(cache->page_cache[i].it_data);
+    if (cache->parts) {
+        for (i = 0; i < cache->nr_parts; i++) {
+            if (cache->parts[i].items) {
+                qemu_mutex_destroy(&cache->parts[i].lock);
+                g_free(cache->parts[i].items);
+            }
+        }
     }
 
-    g_free(cache->page_cache);
-    cache->page_cache = NULL;
+    g_free(cache->parts);
+    cache->parts = NULL;
+    qemu_vfree(cache->data);
+    cache->data = NULL;
     g_free(cache);
 }
 
-static size_t cache_get_cache_pos(const PageCache *cache,
-                                  uint64_t address)
+static CachePartition *cache_get_partition(const PageCache *cache,
+                                           uint64_t addr)
+{
+    return &cache->parts[(addr / cache->page_size) % cache->nr_parts];
+}
+
+/* Returns the first item of the set @addr belongs to */
+static CacheItem *cache_get_set(const PageCache *cache, CachePartition *part,
+                                uint64_t addr)
 {
-    g_assert(cache->max_num_items);
-    return (address / cache->page_size) & (cache->max_num_items - 1);
+    uint64_t page = addr / cache->page_size / cache->nr_parts;
+
+    return &part->items[(page & (part->num_sets - 1)) * cache->ways];
 }
 
 static CacheItem *cache_get_by_addr(const PageCache *cache, uint64_t addr)
 {
-    size_t pos;
+    CachePartition *part;
+    CacheItem *set;
 
     g_assert(cache);
-    g_assert(cache->page_cache);
+    g_assert(cache->parts);
 
-    pos = cache_get_cache_pos(cache, addr);
+    part = cache_get_partition(cache, addr);
+    set = cache_get_set(cache, part, addr);
 
-    return &cache->page_cache[pos];
+    for (unsigned int i = 0; i < cache->ways; i++) {
+        if (set[i].it_addr == addr) {
+            set[i].it_used = ++part->clock;
+            return &set[i];
+        }
+    }
+    return NULL;
+}
+
+void cache_lock(PageCache *cache, uint64_t addr)
+{
+    qemu_mutex_lock(&cache_get_partition(cache, addr)->lock);
+}
+
+void cache_unlock(PageCache *cache, uint64_t addr)
+{
+    qemu_mutex_unlock(&cache_get_partition(cache, addr)->lock);
 }
 
 uint8_t *get_cached_data(const PageCache *cache, uint64_t addr)
 {
-    return cache_get_by_addr(cache, addr)->it_data;
+    CacheItem *it = cache_get_by_addr(cache, addr);
+
+    return it ? it->it_data : NULL;
 }
 
 bool cache_is_cached(const PageCache *cache, uint64_t addr,
@@ -134,7 +230,7 @@ bool cache_is_cached(const PageCache *cache, uint64_t addr,
 
     it = cache_get_by_addr(cache, addr);
 
-    if (it->it_addr == addr) {
+    if (it) {
         /* update the it_age when the cache hit */
         it->it_age = current_age;
         return true;
@@ -145,25 +241,32 @@ bool cache_is_cached(const PageCache *cache, uint64_t addr,
 int cache_insert(PageCache *cache, uint64_t addr, const uint8_t *pdata,
                  uint64_t current_age)
 {
+    CachePartition *part;
+    CacheItem *it, *set;
 
-    CacheItem *it;
-
-    /* actual update of entry */
     it = cache_get_by_addr(cache, addr);
-
-    if (it->it_data && it->it_addr != addr &&
-        it->it_age + CACHED_PAGE_LIFETIME > current_age) {
-        /* the cache page is fresh, don't replace it */
-        return -1;
-    }
-    /* allocate page */
-    if (!it->it_data) {
-        it->it_data = g_try_malloc(cache->page_size);
-        if (!it->it_data) {
-            trace_migration_pagecache_insert();
+    if (!it) {
+        part = cache_get_partition(cache, addr);
+        set = cache_get_set(cache, part, addr);
+
+        /* Pick a free item, or else the least recently used stale one */
+        for (unsigned int i = 0; i < cache->ways; i++) {
+            if (set[i].it_addr == -1) {
+                it = &set[i];
+                break;
+            }
+            if (set[i].it_age + CACHED_PAGE_LIFETIME > current_age) {
+                /* the cache page is fresh, don't replace it */
+                continue;
+            }
+            if (!it || set[i].it_used < it->it_used) {
+                it = &set[i];
+            }
+        }
+        if (!it) {
             return -1;
         }
-        cache->num_items++;
+        it->it_used = ++part->clock;
     }
 
     memcpy(it->it_data, pdata, cache->page_size);
@@ -1,6 +1,6 @@
 /*
  * Page cache for QEMU
- * The cache is base on a hash of the page address
+ * The cache is a set associative cache indexed by the page address
  *
  * Copyright 2012 Red Hat, Inc. and/or its affiliates
  *
@@ -29,6 +29,35 @@ typedef struct PageCache PageCache;
  * @errp: set *errp if the check failed, with reason
  */
 PageCache *cache_init(uint64_t cache_size, size_t page_size, Error **errp);
+/**
+ * cache_init_partitioned: Initialize a page cache shared by several threads
+ *
+ * The pages are split in @nr_partitions partitions by address, each
+ * with its own lock so that users of different partitions don't
+ * contend.  Every access to the cache must be done with the partition
+ * of the address locked, see cache_lock().
+ *
+ * Returns new allocated cache or NULL on error
+ *
+ * @cache_size: cache size in bytes, split evenly between partitions
+ * @page_size: cache page size
+ * @nr_partitions: number of partitions
+ * @errp: set *errp if the check failed, with reason
+ */
+PageCache *cache_init_partitioned(uint64_t cache_size, size_t page_size,
+                                  unsigned int nr_partitions, Error **errp);
+/**
+ * cache_lock: lock the partition of an address
+ * @cache pointer to the PageCache struct
+ * @addr: page addr
+ */
+void cache_lock(PageCache *cache, uint64_t addr);
+/**
+ * cache_unlock: unlock the partition of an address
+ * @cache pointer to the PageCache struct
+ * @addr: page addr
+ */
+void cache_unlock(PageCache *cache, uint64_t addr);
 /**
  * cache_fini: free all cache resources
  * @cache pointer to the PageCache struct
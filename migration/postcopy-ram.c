@@ -18,6 +18,7 @@
 
 #include "qemu/osdep.h"
 #include "qemu/madvise.h"
+#include "qemu/stats64.h"
 #include "exec/target_page.h"
 #include "migration.h"
 #include "qemu-file.h"
@@ -110,9 +111,18 @@ void postcopy_thread_create(MigrationIncomingState *mis,
 #include <sys/eventfd.h>
 #include <linux/userfaultfd.h>
 
+/*
+ * Number of buckets of the page fault latency distribution: bucket N
+ * counts the faults resolved in [2^N, 2^(N+1)) microseconds, the first
+ * and last buckets also count the faster and slower ones.
+ */
+#define POSTCOPY_LATENCY_BUCKETS 24
+
 typedef struct PostcopyBlocktimeContext {
     /* time when page fault initiated per vCPU */
     uint32_t *page_fault_vcpu_time;
+    /* same, in microseconds, for the page fault latency */
+    uint32_t *page_fault_vcpu_time_us;
     /* page address per vCPU */
     uintptr_t *vcpu_addr;
     uint32_t total_blocktime;
@@ -124,6 +134,11 @@ typedef struct PostcopyBlocktimeContext {
     int smp_cpus_down;
     uint64_t start_time;
 
+    /* page fault latency, summed up, counted and distributed in buckets */
+    Stat64 latency_total_us;
+    Stat64 latency_count;
+    Stat64 latency_dist[POSTCOPY_LATENCY_BUCKETS];
+
     /*
      * Handler for exit event, necessary for
      * releasing whole blocktime_ctx
@@ -134,6 +149,7 @@ typedef struct PostcopyBlocktimeContext {
 static void destroy_blocktime_context(struct PostcopyBlocktimeContext *ctx)
 {
     g_free(ctx->page_fault_vcpu_time);
+    g_free(ctx->page_fault_vcpu_time_us);
     g_free(ctx->vcpu_addr);
     g_free(ctx->vcpu_blocktime);
     g_free(ctx);
@@ -152,6 +168,7 @@ static struct PostcopyBlocktimeContext *blocktime_context_new(void)
     unsigned int smp_cpus = ms->smp.cpus;
     PostcopyBlocktimeContext *ctx = g_new0(PostcopyBlocktimeContext, 1);
     ctx->page_fault_vcpu_time = g_new0(uint32_t, smp_cpus);
+    ctx->page_fault_vcpu_time_us = g_new0(uint32_t, smp_cpus);
     ctx->vcpu_addr = g_new0(uintptr_t, smp_cpus);
     ctx->vcpu_blocktime = g_new0(uint32_t, smp_cpus);
 
@@ -174,6 +191,18 @@ static uint32List *get_vcpu_blocktime_list(PostcopyBlocktimeContext *ctx)
     return list;
 }
 
+static uint64List *get_latency_dist_list(PostcopyBlocktimeContext *ctx)
+{
+    uint64List *list = NULL;
+    int i;
+
+    for (i = POSTCOPY_LATENCY_BUCKETS - 1; i >= 0; i--) {
+        QAPI_LIST_PREPEND(list, stat64_get(&ctx->latency_dist[i]));
+    }
+
+    return list;
+}
+
 /*
  * This function just populates MigrationInfo from postcopy's
  * blocktime context. It will not populate MigrationInfo,
@@ -194,6 +223,10 @@ void fill_destination_postcopy_migration_info(MigrationInfo *info)
     info->postcopy_blocktime = bc->total_blocktime;
     info->has_postcopy_vcpu_blocktime = true;
     info->postcopy_vcpu_blocktime = get_vcpu_blocktime_list(bc);
+    info->has_postcopy_latency = true;
+    info->postcopy_latency = stat64_get(&bc->latency_count) ?
+        stat64_get(&bc->latency_total_us) / stat64_get(&bc->latency_count) : 0;
+    info->postcopy_latency_dist = get_latency_dist_list(bc);
 }
 
 static uint32_t get_postcopy_total_blocktime(void)
@@ -826,6 +859,24 @@ static uint32_t get_low_time_offset(PostcopyBlocktimeContext *dc)
     return start_time_offset < 1 ? 1 : start_time_offset & UINT32_MAX;
 }
 
+/* Wraps around after about 71 minutes, only use it for differences */
+static uint32_t get_low_time_offset_us(PostcopyBlocktimeContext *dc)
+{
+    return (qemu_clock_get_us(QEMU_CLOCK_REALTIME) -
+            dc->start_time * 1000) & UINT32_MAX;
+}
+
+static void postcopy_latency_account(PostcopyBlocktimeContext *dc,
+                                     uint32_t latency_us)
+{
+    int bucket = latency_us < 2 ? 0 : 31 - clz32(latency_us);
+
+    bucket = MIN(bucket, POSTCOPY_LATENCY_BUCKETS - 1);
+    stat64_add(&dc->latency_dist[bucket], 1);
+    stat64_add(&dc->latency_total_us, latency_us);
+    stat64_add(&dc->latency_count, 1);
+}
+
 /*
  * This function is being called when pagefault occurs. It
  * tracks down vCPU blocking time.
@@ -857,6 +908,8 @@ static void mark_postcopy_blocktime_begin(uintptr_t addr, uint32_t ptid,
 
     qatomic_xchg(&dc->last_begin, low_time_offset);
     qatomic_xchg(&dc->page_fault_vcpu_time[cpu], low_time_offset);
+    qatomic_xchg(&dc->page_fault_vcpu_time_us[cpu],
+                 get_low_time_offset_us(dc));
     qatomic_xchg(&dc->vcpu_addr[cpu], addr);
 
     /*
@@ -909,13 +962,14 @@ static void mark_postcopy_blocktime_end(uintptr_t addr)
     unsigned int smp_cpus = ms->smp.cpus;
     int i, affected_cpu = 0;
     bool vcpu_total_blocktime = false;
-    uint32_t read_vcpu_time, low_time_offset;
+    uint32_t read_vcpu_time, low_time_offset, low_time_offset_us;
 
     if (!dc) {
         return;
     }
 
     low_time_offset = get_low_time_offset(dc);
+    low_time_offset_us = get_low_time_offset_us(dc);
     /* lookup cpu, to clear it,
      * that algorithm looks straightforward, but it's not
      * optimal, more optimal algorithm is keeping tree or hash
@@ -930,6 +984,8 @@ static void mark_postcopy_blocktime_end(uintptr_t addr)
         }
         qatomic_xchg(&dc->vcpu_addr[i], 0);
         vcpu_blocktime = low_time_offset - read_vcpu_time;
+        postcopy_latency_account(dc, low_time_offset_us -
+                                 qatomic_read(&dc->page_fault_vcpu_time_us[i]));
         affected_cpu += 1;
         /* we need to know is that mark_postcopy_end was due to
          * faulted page, another possible case it's prefetched
@@ -31,6 +31,7 @@
 #include "qemu/bitops.h"
 #include "qemu/bitmap.h"
 #include "qemu/madvise.h"
+#include "qemu/units.h"
 #include "qemu/main-loop.h"
 #include "xbzrle.h"
 #include "ram-compress.h"
@@ -57,12 +58,16 @@
 #include "sysemu/cpu-throttle.h"
 #include "savevm.h"
 #include "qemu/iov.h"
+#include "block/thread-pool.h"
 #include "multifd.h"
+#include "mapped-ram-lazy.h"
+#include "io/channel-file.h"
 #include "sysemu/runstate.h"
 #include "rdma.h"
 #include "options.h"
 #include "sysemu/dirtylimit.h"
 #include "sysemu/kvm.h"
+#include "sysemu/tcg.h"
 
 #include "hw/boards.h" /* for machine_dump_guest_core() */
 
@@ -412,6 +417,8 @@ struct RAMState {
      * RAM migration.
      */
     unsigned int postcopy_bmap_sync_requested;
+    /* Worker threads for the dirty bitmap sync, see dirty-sync-threads */
+    ThreadPool *dirty_sync_pool;
 };
 typedef struct RAMState RAMState;
 
@@ -921,6 +928,91 @@ static void ramblock_sync_dirty_bitmap(RAMState *rs, RAMBlock *rb)
     rs->num_dirty_pages_period += new_dirty_pages;
 }
 
+/*
+ * RAMBlocks are split in ranges of this size for the parallel dirty
+ * bitmap sync.  It is a multiple of BITS_PER_LONG target pages, so
+ * that two ranges never share a word of the destination bitmap.
+ */
+#define DIRTY_SYNC_RANGE_SIZE (1ULL << 30)
+
+typedef struct {
+    RAMBlock *rb;
+    ram_addr_t start;
+    ram_addr_t length;
+    Stat64 *new_dirty_pages;
+} DirtySyncRange;
+
+/*
+ * Runs in a worker thread.  The RCU read critical section of
+ * migration_bitmap_sync() covers it, because the caller waits for all
+ * the ranges to be done before leaving it.
+ */
+static int ramblock_sync_dirty_range(void *opaque)
+{
+    DirtySyncRange *r = opaque;
+
+    stat64_add(r->new_dirty_pages,
+               cpu_physical_memory_sync_dirty_bitmap(r->rb, r->start,
+                                                     r->length));
+    return 0;
+}
+
+static bool ramblock_sync_dirty_bitmap_parallel(RAMBlock *rb)
+{
+    /*
+     * TCG needs to flush the TLBs of the synced ranges, which is not
+     * thread safe.  Without a clear bitmap the KVM dirty log is cleared
+     * while syncing, keep that in the migration thread too.
+     */
+    return !tcg_enabled() && rb->clear_bmap &&
+           rb->used_length > DIRTY_SYNC_RANGE_SIZE &&
+           QEMU_IS_ALIGNED(rb->offset, BITS_PER_LONG << TARGET_PAGE_BITS);
+}
+
+/*
+ * Sync the dirty bitmap of all the RAMBlocks, handing out the ranges of
+ * the big ones to the dirty sync worker threads.  Small RAMBlocks are
+ * synced by the migration thread while the workers run.
+ *
+ * Called with bitmap_mutex held and within an RCU critical section.
+ */
+static void migration_bitmap_sync_parallel(RAMState *rs)
+{
+    Stat64 new_dirty_pages;
+    uint64_t new_dirty;
+    RAMBlock *block;
+
+    if (!rs->dirty_sync_pool) {
+        rs->dirty_sync_pool = thread_pool_new();
+    }
+    thread_pool_set_max_threads(rs->dirty_sync_pool,
+                                migrate_dirty_sync_threads());
+    stat64_init(&new_dirty_pages, 0);
+
+    RAMBLOCK_FOREACH_NOT_IGNORED(block) {
+        if (!ramblock_sync_dirty_bitmap_parallel(block)) {
+            ramblock_sync_dirty_bitmap(rs, block);
+            continue;
+        }
+        for (ram_addr_t start = 0; start < block->used_length;
+             start += DIRTY_SYNC_RANGE_SIZE) {
+            DirtySyncRange *r = g_new(DirtySyncRange, 1);
+
+            r->rb = block;
+            r->start = start;
+            r->length = MIN(DIRTY_SYNC_RANGE_SIZE, block->used_length - start);
+            r->new_dirty_pages = &new_dirty_pages;
+            thread_pool_submit_work(rs->dirty_sync_pool,
+                                    ramblock_sync_dirty_range, r, g_free);
+        }
+    }
+    thread_pool_wait(rs->dirty_sync_pool);
+
+    new_dirty = stat64_get(&new_dirty_pages);
+    rs->migration_dirty_pages += new_dirty;
+    rs->num_dirty_pages_period += new_dirty;
+}
+
 /**
  * ram_pagesize_summary: calculate all the pagesizes of a VM
  *
@@ -993,6 +1085,20 @@ static void migration_dirty_limit_guest(void)
      */
     static int64_t quota_dirtyrate;
     MigrationState *s = migrate_get_current();
+    uint64_t budget;
+
+    /*
+     * Dirty no more memory within a dirty-limit period than what can be
+     * sent within the downtime limit, once the bandwidth is known.
+     */
+    if (migrate_dirty_limit_predictive() && s->threshold_size) {
+        budget = s->threshold_size * 1000 /
+                 migrate_vcpu_dirty_limit_period() / MiB;
+        dirtylimit_set_budget(budget, s->parameters.vcpu_dirty_limit);
+        trace_migration_dirty_limit_budget(budget);
+        quota_dirtyrate = 0;
+        return;
+    }
 
     /*
      * If dirty limit already enabled and migration parameter
@@ -1064,8 +1170,12 @@ static void migration_bitmap_sync(RAMState *rs, bool last_stage)
 
     qemu_mutex_lock(&rs->bitmap_mutex);
     WITH_RCU_READ_LOCK_GUARD() {
-        RAMBLOCK_FOREACH_NOT_IGNORED(block) {
-            ramblock_sync_dirty_bitmap(rs, block);
+        if (migrate_dirty_sync_threads()) {
+            migration_bitmap_sync_parallel(rs);
+        } else {
+            RAMBLOCK_FOREACH_NOT_IGNORED(block) {
+                ramblock_sync_dirty_bitmap(rs, block);
+            }
         }
         stat64_set(&mig_stats.dirty_bytes_last_sync, ram_bytes_remaining());
     }
@@ -1921,6 +2031,46 @@ static void migration_page_queue_free(RAMState *rs)
     }
 }
 
+static void ram_save_queue_request(RAMState *rs, RAMBlock *ramblock,
+                                   ram_addr_t start, ram_addr_t len)
+{
+    struct RAMSrcPageRequest *new_entry =
+        g_new0(struct RAMSrcPageRequest, 1);
+    new_entry->rb = ramblock;
+    new_entry->offset = start;
+    new_entry->len = len;
+
+    memory_region_ref(ramblock->mr);
+    qemu_mutex_lock(&rs->src_page_req_mutex);
+    QSIMPLEQ_INSERT_TAIL(&rs->src_page_requests, new_entry, next_req);
+    migration_make_urgent_request();
+    qemu_mutex_unlock(&rs->src_page_req_mutex);
+}
+
+/*
+ * With postcopy preempt, the pages requested by the destination are
+ * sent by the return path thread and the background stream goes on
+ * from where it was.  The guest is likely to access the pages that
+ * follow the faulted one soon, so queue them for the migration thread
+ * to send them next on the main channel, without delaying the other
+ * requests on the preempt channel.
+ */
+static void ram_save_queue_prefetch(RAMState *rs, RAMBlock *ramblock,
+                                    ram_addr_t start)
+{
+    ram_addr_t len = (ram_addr_t)migrate_postcopy_prefetch_pages() <<
+                     TARGET_PAGE_BITS;
+
+    len = ROUND_UP(len, qemu_ram_pagesize(ramblock));
+    len = MIN(len, ramblock->used_length - start);
+    if (!len) {
+        return;
+    }
+
+    trace_ram_save_queue_prefetch(ramblock->idstr, start, len);
+    ram_save_queue_request(rs, ramblock, start, len);
+}
+
 /**
  * ram_save_queue_pages: queue the page for transmission
  *
@@ -1981,6 +2131,7 @@ int ram_save_queue_pages(const char *rbname, ram_addr_t start, ram_addr_t len,
         ram_addr_t page_start = start >> TARGET_PAGE_BITS;
         size_t page_size = qemu_ram_pagesize(ramblock);
         PageSearchStatus *pss = &ram_state->pss[RAM_CHANNEL_POSTCOPY];
+        ram_addr_t end = start + len;
         int ret = 0;
 
         qemu_mutex_lock(&rs->bitmap_mutex);
@@ -2020,20 +2171,14 @@ int ram_save_queue_pages(const char *rbname, ram_addr_t start, ram_addr_t len,
         };
         qemu_mutex_unlock(&rs->bitmap_mutex);
 
+        if (!ret && migrate_postcopy_prefetch_pages()) {
+            ram_save_queue_prefetch(rs, ramblock, end);
+        }
+
         return ret;
     }
 
-    struct RAMSrcPageRequest *new_entry =
-        g_new0(struct RAMSrcPageRequest, 1);
-    new_entry->rb = ramblock;
-    new_entry->offset = start;
-    new_entry->len = len;
-
-    memory_region_ref(ramblock->mr);
-    qemu_mutex_lock(&rs->src_page_req_mutex);
-    QSIMPLEQ_INSERT_TAIL(&rs->src_page_requests, new_entry, next_req);
-    migration_make_urgent_request();
-    qemu_mutex_unlock(&rs->src_page_req_mutex);
+    ram_save_queue_request(rs, ramblock, start, len);
 
     return 0;
 }
@@ -2123,6 +2268,58 @@ static int ram_save_target_page_multifd(RAMState *rs, PageSearchStatus *pss)
     return ram_save_multifd_page(block, offset);
 }
 
+/*
+ * Whether the migration thread can hand out whole ranges of dirty pages
+ * to the multifd channels instead of queuing them one by one.  Postcopy
+ * needs the pages of a host page to be sent together, and the legacy
+ * zero page detection is done page by page by the migration thread.
+ */
+static bool ram_save_dirty_range_enabled(void)
+{
+    return migrate_multifd() && !migrate_postcopy_ram() &&
+           migrate_zero_page_detection() != ZERO_PAGE_DETECTION_LEGACY;
+}
+
+/**
+ * ram_save_dirty_range_multifd: hand out dirty pages to multifd
+ *
+ * Clear the dirty bits of up to a packet worth of pages from pss->page
+ * and let a multifd channel thread pick the dirty pages of the range
+ * and detect the zero ones.  pss->page is moved past the range.
+ *
+ * The caller must be with ram_state.bitmap_mutex held.
+ *
+ * Returns the number of dirty pages handed out, or negative on error
+ *
+ * @rs: current RAM state
+ * @pss: data about the first dirty page of the range
+ */
+static int ram_save_dirty_range_multifd(RAMState *rs, PageSearchStatus *pss)
+{
+    RAMBlock *rb = pss->block;
+    unsigned long start = pss->page;
+    unsigned long npages = MIN(multifd_ram_page_count(),
+                               (rb->used_length >> TARGET_PAGE_BITS) - start);
+    int dirty;
+
+    /* See migration_bitmap_clear_dirty() */
+    if (rb->clear_bmap) {
+        migration_clear_memory_region_dirty_bitmap_range(rb, start, npages);
+    }
+
+    dirty = multifd_queue_dirty_range(rb, start, rb->bmap, npages);
+    if (dirty < 0) {
+        error_report_once("%s: multifd_queue_dirty_range failed", __func__);
+        return -1;
+    }
+
+    bitmap_clear(rb->bmap, start, npages);
+    rs->migration_dirty_pages -= dirty;
+    pss->page = start + npages;
+
+    return dirty;
+}
+
 /* Should be called before sending a host page */
 static void pss_host_page_prepare(PageSearchStatus *pss)
 {
@@ -2361,6 +2558,10 @@ static int ram_find_and_save_block(RAMState *rs)
                     break;
                 }
             }
+            if (ram_save_dirty_range_enabled()) {
+                pages = ram_save_dirty_range_multifd(rs, pss);
+                break;
+            }
         }
         pages = ram_save_host_page(rs, pss);
         if (pages) {
@@ -2415,6 +2616,9 @@ static void ram_state_cleanup(RAMState **rsp)
 {
     if (*rsp) {
         migration_page_queue_free(*rsp);
+        if ((*rsp)->dirty_sync_pool) {
+            thread_pool_free((*rsp)->dirty_sync_pool);
+        }
         qemu_mutex_destroy(&(*rsp)->bitmap_mutex);
         qemu_mutex_destroy(&(*rsp)->src_page_req_mutex);
         g_free(*rsp);
@@ -2928,8 +3132,11 @@ void qemu_guest_free_page_hint(void *addr, size_t len)
     ram_addr_t offset;
     size_t used_len, start, npages;
 
-    /* This function is currently expected to be used during live migration */
-    if (!migration_is_setup_or_active()) {
+    /*
+     * This function is currently expected to be used during live migration,
+     * once the dirty bitmaps of the RAMBlocks exist.
+     */
+    if (!migration_is_setup_or_active() || !ram_state) {
         return;
     }
 
@@ -3595,6 +3802,147 @@ static void colo_init_ram_state(void)
     ram_state_init(&ram_state);
 }
 
+/*
+ * At each checkpoint the pages that the PVM or the SVM dirtied are
+ * copied from the COLO cache into the SVM's memory.  Each run of dirty
+ * pages is cut into slices of at most COLO_FLUSH_SLICE_PAGES, and the
+ * slices are copied by the flushing thread and a few helper threads.
+ * Small flushes are done by the flushing thread alone.
+ */
+#define COLO_FLUSH_SLICE_PAGES      256
+#define COLO_FLUSH_MAX_THREADS      8
+#define COLO_FLUSH_PARALLEL_PAGES   1024
+
+typedef struct ColoFlushSlice {
+    void *dst;
+    const void *src;
+    size_t len;
+} ColoFlushSlice;
+
+static struct {
+    QemuThread *threads;
+    unsigned int nr_threads;
+    /* Slices of the current flush, claimed with @next */
+    GArray *slices;
+    unsigned int next;
+    QemuMutex lock;
+    QemuCond work_cond;
+    QemuCond done_cond;
+    /* Protected by @lock */
+    unsigned int generation;
+    unsigned int busy;
+    bool quit;
+} colo_flush;
+
+static void colo_flush_copy_slices(void)
+{
+    GArray *slices = colo_flush.slices;
+    unsigned int i;
+
+    while ((i = qatomic_fetch_inc(&colo_flush.next)) < slices->len) {
+        ColoFlushSlice *slice = &g_array_index(slices, ColoFlushSlice, i);
+
+        memcpy(slice->dst, slice->src, slice->len);
+    }
+}
+
+static void *colo_flush_thread(void *opaque)
+{
+    unsigned int generation = 0;
+
+    qemu_mutex_lock(&colo_flush.lock);
+    for (;;) {
+        while (!colo_flush.quit && colo_flush.generation == generation) {
+            qemu_cond_wait(&colo_flush.work_cond, &colo_flush.lock);
+        }
+        if (colo_flush.quit) {
+            break;
+        }
+        generation = colo_flush.generation;
+        qemu_mutex_unlock(&colo_flush.lock);
+
+        colo_flush_copy_slices();
+
+        qemu_mutex_lock(&colo_flush.lock);
+        if (--colo_flush.busy == 0) {
+            qemu_cond_signal(&colo_flush.done_cond);
+        }
+    }
+    qemu_mutex_unlock(&colo_flush.lock);
+
+    return NULL;
+}
+
+static void colo_flush_threads_init(void)
+{
+    unsigned int i;
+
+    colo_flush.slices = g_array_new(false, false, sizeof(ColoFlushSlice));
+    qemu_mutex_init(&colo_flush.lock);
+    qemu_cond_init(&colo_flush.work_cond);
+    qemu_cond_init(&colo_flush.done_cond);
+    colo_flush.quit = false;
+
+    /* The flushing thread does its share of the copies too */
+    colo_flush.nr_threads = MIN(g_get_num_processors(),
+                                COLO_FLUSH_MAX_THREADS) - 1;
+    colo_flush.threads = g_new0(QemuThread, colo_flush.nr_threads);
+    for (i = 0; i < colo_flush.nr_threads; i++) {
+        qemu_thread_create(&colo_flush.threads[i], "colo-flush",
+                           colo_flush_thread, NULL, QEMU_THREAD_JOINABLE);
+    }
+}
+
+static void colo_flush_threads_cleanup(void)
+{
+    unsigned int i;
+
+    if (!colo_flush.slices) {
+        return;
+    }
+
+    qemu_mutex_lock(&colo_flush.lock);
+    colo_flush.quit = true;
+    qemu_cond_broadcast(&colo_flush.work_cond);
+    qemu_mutex_unlock(&colo_flush.lock);
+
+    for (i = 0; i < colo_flush.nr_threads; i++) {
+        qemu_thread_join(&colo_flush.threads[i]);
+    }
+    g_clear_pointer(&colo_flush.threads, g_free);
+    colo_flush.nr_threads = 0;
+
+    qemu_cond_destroy(&colo_flush.done_cond);
+    qemu_cond_destroy(&colo_flush.work_cond);
+    qemu_mutex_destroy(&colo_flush.lock);
+    g_array_free(colo_flush.slices, true);
+    colo_flush.slices = NULL;
+}
+
+/* Copy the slices queued in colo_flush.slices */
+static void colo_flush_run(uint64_t pages)
+{
+    colo_flush.next = 0;
+    if (!colo_flush.nr_threads || pages < COLO_FLUSH_PARALLEL_PAGES) {
+        colo_flush_copy_slices();
+        return;
+    }
+
+    qemu_mutex_lock(&colo_flush.lock);
+    colo_flush.busy = colo_flush.nr_threads;
+    colo_flush.generation++;
+    qemu_cond_broadcast(&colo_flush.work_cond);
+    qemu_mutex_unlock(&colo_flush.lock);
+
+    colo_flush_copy_slices();
+
+    qemu_mutex_lock(&colo_flush.lock);
+    while (colo_flush.busy) {
+        qemu_cond_wait(&colo_flush.done_cond, &colo_flush.lock);
+    }
+    qemu_mutex_unlock(&colo_flush.lock);
+}
+
 /*
  * colo cache: this is for secondary VM, we cache the whole
  * memory of the secondary VM, it is need to hold the global lock
@@ -3640,6 +3988,7 @@ int colo_init_ram_cache(void)
     }
 
     colo_init_ram_state();
+    colo_flush_threads_init();
     return 0;
 }
 
@@ -3670,6 +4019,7 @@ void colo_release_ram_cache(void)
 {
     RAMBlock *block;
 
+    colo_flush_threads_cleanup();
     memory_global_dirty_log_stop(GLOBAL_DIRTY_MIGRATION);
     RAMBLOCK_FOREACH_NOT_IGNORED(block) {
         g_free(block->bmap);
@@ -3940,9 +4290,8 @@ static bool postcopy_is_running(void)
 void colo_flush_ram_cache(void)
 {
     RAMBlock *block = NULL;
-    void *dst_host;
-    void *src_host;
     unsigned long offset = 0;
+    uint64_t pages = 0;
 
     memory_global_dirty_log_sync(false);
     qemu_mutex_lock(&ram_state->bitmap_mutex);
@@ -3954,6 +4303,7 @@ void colo_flush_ram_cache(void)
 
     trace_colo_flush_ram_cache_begin(ram_state->migration_dirty_pages);
     WITH_RCU_READ_LOCK_GUARD() {
+        g_array_set_size(colo_flush.slices, 0);
         block = QLIST_FIRST_RCU(&ram_list.blocks);
 
         while (block) {
@@ -3971,14 +4321,25 @@ void colo_flush_ram_cache(void)
                 for (i = 0; i < num; i++) {
                     migration_bitmap_clear_dirty(ram_state, block, offset + i);
                 }
-                dst_host = block->host
-                         + (((ram_addr_t)offset) << TARGET_PAGE_BITS);
-                src_host = block->colo_cache
-                         + (((ram_addr_t)offset) << TARGET_PAGE_BITS);
-                memcpy(dst_host, src_host, TARGET_PAGE_SIZE * num);
+                for (i = 0; i < num; i += COLO_FLUSH_SLICE_PAGES) {
+                    ram_addr_t addr = ((ram_addr_t)offset + i) <<
+                                      TARGET_PAGE_BITS;
+                    ColoFlushSlice slice = {
+                        .dst = block->host + addr,
+                        .src = block->colo_cache + addr,
+                        .len = MIN(num - i, COLO_FLUSH_SLICE_PAGES) <<
+                               TARGET_PAGE_BITS,
+                    };
+
+                    g_array_append_val(colo_flush.slices, slice);
+                }
+                pages += num;
                 offset += num;
             }
         }
+
+        /* The RCU read lock keeps the blocks alive for the helpers */
+        colo_flush_run(pages);
     }
     qemu_mutex_unlock(&ram_state->bitmap_mutex);
     trace_colo_flush_ram_cache_end();
@@ -4055,6 +4416,73 @@ err:
     return false;
 }
 
+#ifndef _WIN32
+/*
+ * Map the pages of @block copy-on-write from the file instead of reading
+ * them.  Pages that are clear in @bitmap must read as zero, but the file
+ * may still have data for them from an earlier pass of a live migration;
+ * those are cleared by hand.  Returns false if the block can't be mapped
+ * and must be read instead.
+ */
+static bool map_ramblock_mapped_ram(QEMUFile *f, RAMBlock *block,
+                                    long num_pages, unsigned long *bitmap)
+{
+    QIOChannel *ioc = qemu_file_get_ioc(f);
+    unsigned long set_bit_idx, clear_bit_idx;
+    Error *local_err = NULL;
+    int fd;
+
+    if (!object_dynamic_cast(OBJECT(ioc), TYPE_QIO_CHANNEL_FILE)) {
+        return false;
+    }
+    fd = QIO_CHANNEL_FILE(ioc)->fd;
+
+    if (!qemu_ram_map_file_private(block, fd, block->pages_offset,
+                                   &local_err)) {
+        trace_mapped_ram_cow_fallback(block->idstr,
+                                      error_get_pretty(local_err));
+        error_free(local_err);
+        return false;
+    }
+
+    for (clear_bit_idx = find_first_zero_bit(bitmap, num_pages);
+         clear_bit_idx < num_pages;
+         clear_bit_idx = find_next_zero_bit(bitmap, num_pages,
+                                            set_bit_idx + 1)) {
+        ram_addr_t offset = (ram_addr_t)clear_bit_idx << TARGET_PAGE_BITS;
+        ram_addr_t end;
+
+        set_bit_idx = find_next_bit(bitmap, num_pages, clear_bit_idx + 1);
+        end = (ram_addr_t)set_bit_idx << TARGET_PAGE_BITS;
+
+#ifdef SEEK_DATA
+        {
+            /*
+             * Holes in the file read as zero.  This moves the file offset,
+             * which the caller sets again after parsing the block.
+             */
+            off_t data = lseek(fd, block->pages_offset + offset, SEEK_DATA);
+
+            if ((data < 0 && errno == ENXIO) ||
+                data >= block->pages_offset + end) {
+                continue;
+            }
+        }
+#endif
+        memset(host_from_ram_block_offset(block, offset), 0, end - offset);
+    }
+
+    trace_mapped_ram_cow_map_block(block->idstr, block->used_length);
+    return true;
+}
+#else
+static bool map_ramblock_mapped_ram(QEMUFile *f, RAMBlock *block,
+                                    long num_pages, unsigned long *bitmap)
+{
+    return false;
+}
+#endif
+
 static void parse_ramblock_mapped_ram(QEMUFile *f, RAMBlock *block,
                                       ram_addr_t length, Error **errp)
 {
@@ -4092,7 +4520,15 @@ static void parse_ramblock_mapped_ram(QEMUFile *f, RAMBlock *block,
         return;
     }
 
-    if (!read_ramblock_mapped_ram(f, block, num_pages, bitmap, errp)) {
+    if (migrate_mapped_ram_lazy_restore()) {
+        if (!mapped_ram_lazy_add_block(f, block, bitmap, errp)) {
+            return;
+        }
+        bitmap = NULL;
+    } else if (migrate_mapped_ram_cow_restore() &&
+               map_ramblock_mapped_ram(f, block, num_pages, bitmap)) {
+        /* Nothing to read */
+    } else if (!read_ramblock_mapped_ram(f, block, num_pages, bitmap, errp)) {
         return;
     }
 
@@ -44,6 +44,11 @@
 
 /* Do not merge data if larger than this. */
 #define RDMA_MERGE_MAX (2 * 1024 * 1024)
+/*
+ * With pin-all, RAMBlocks are registered as a whole on both sides,
+ * so writes are not bound to chunks and can be larger.
+ */
+#define RDMA_PIN_ALL_MERGE_MAX (8 * 1024 * 1024)
 #define RDMA_SIGNALED_SEND_MAX (RDMA_MERGE_MAX / 4096)
 
 #define RDMA_REG_CHUNK_SHIFT 20 /* 1 MB */
@@ -2292,6 +2297,15 @@ static inline bool qemu_rdma_buffer_mergeable(RDMAContext *rdma,
         return false;
     }
 
+    /*
+     * Without pin-all, each write is registered chunk by chunk.  With
+     * pin-all the RAMBlock is a single memory region on both sides, so
+     * merge across chunks and only mark the first one in transit.
+     */
+    if (rdma->pin_all && block->is_ram_block) {
+        return rdma->current_length + len <= RDMA_PIN_ALL_MERGE_MAX;
+    }
+
     if ((host_addr + len) > chunk_end) {
         return false;
     }
@@ -2335,7 +2349,8 @@ static int qemu_rdma_write(RDMAContext *rdma,
     rdma->current_length += len;
 
     /* flush it if buffer is too large */
-    if (rdma->current_length >= RDMA_MERGE_MAX) {
+    if (rdma->current_length >= (rdma->pin_all ? RDMA_PIN_ALL_MERGE_MAX :
+                                 RDMA_MERGE_MAX)) {
         return qemu_rdma_write_flush(rdma, errp);
     }
 
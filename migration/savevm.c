@@ -57,6 +57,7 @@
 #include "block/snapshot.h"
 #include "qemu/cutils.h"
 #include "io/channel-buffer.h"
+#include "block/thread-pool.h"
 #include "io/channel-file.h"
 #include "sysemu/replay.h"
 #include "sysemu/runstate.h"
@@ -246,6 +247,8 @@ static bool should_validate_capability(int capability)
     switch (capability) {
     case MIGRATION_CAPABILITY_X_IGNORE_SHARED:
     case MIGRATION_CAPABILITY_MAPPED_RAM:
+    case MIGRATION_CAPABILITY_X_COLO_DELTA_VMSTATE:
+    case MIGRATION_CAPABILITY_X_DIRTY_BITMAPS_RLE:
         return true;
     default:
         return false;
@@ -1490,25 +1493,131 @@ void qemu_savevm_state_complete_postcopy(QEMUFile *f)
     qemu_fflush(f);
 }
 
+/* Last section of a device saved by a worker thread */
+typedef struct SaveCompleteThreadJob {
+    SaveStateEntry *se;
+    QIOChannelBuffer *bioc;
+    QEMUFile *f;
+    int64_t downtime;
+    int ret;
+    QemuEvent done;
+} SaveCompleteThreadJob;
+
+static int qemu_savevm_complete_precopy_thread(void *opaque)
+{
+    SaveCompleteThreadJob *job = opaque;
+    int64_t start_ts = qemu_clock_get_us(QEMU_CLOCK_REALTIME);
+
+    job->ret = job->se->ops->save_live_complete_precopy_thread(job->f,
+                                                               job->se->opaque);
+    qemu_fflush(job->f);
+    if (!job->ret) {
+        job->ret = qemu_file_get_error(job->f);
+    }
+    job->downtime = qemu_clock_get_us(QEMU_CLOCK_REALTIME) - start_ts;
+    qemu_event_set(&job->done);
+
+    return 0;
+}
+
+static bool qemu_savevm_complete_precopy_needed(SaveStateEntry *se,
+                                                bool in_postcopy)
+{
+    if (!se->ops ||
+        (in_postcopy && se->ops->has_postcopy &&
+         se->ops->has_postcopy(se->opaque)) ||
+        (!se->ops->save_live_complete_precopy &&
+         !se->ops->save_live_complete_precopy_thread)) {
+        return false;
+    }
+
+    if (se->ops->is_active) {
+        if (!se->ops->is_active(se->opaque)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
 static
 int qemu_savevm_state_complete_precopy_iterable(QEMUFile *f, bool in_postcopy)
 {
     int64_t start_ts_each, end_ts_each;
+    g_autofree SaveCompleteThreadJob *jobs = NULL;
+    ThreadPool *pool = NULL;
+    int nr_jobs = 0, next_job = 0;
     SaveStateEntry *se;
-    int ret;
+    int ret = 0;
 
+    /*
+     * Start the devices which don't need the BQL first, so that they
+     * run while the others save their state.
+     */
     QTAILQ_FOREACH(se, &savevm_state.handlers, entry) {
-        if (!se->ops ||
-            (in_postcopy && se->ops->has_postcopy &&
-             se->ops->has_postcopy(se->opaque)) ||
-            !se->ops->save_live_complete_precopy) {
-            continue;
+        if (qemu_savevm_complete_precopy_needed(se, in_postcopy) &&
+            se->ops->save_live_complete_precopy_thread) {
+            nr_jobs++;
         }
+    }
 
-        if (se->ops->is_active) {
-            if (!se->ops->is_active(se->opaque)) {
+    if (nr_jobs) {
+        jobs = g_new0(SaveCompleteThreadJob, nr_jobs);
+        pool = thread_pool_new();
+        nr_jobs = 0;
+
+        QTAILQ_FOREACH(se, &savevm_state.handlers, entry) {
+            SaveCompleteThreadJob *job = &jobs[nr_jobs];
+
+            if (!qemu_savevm_complete_precopy_needed(se, in_postcopy) ||
+                !se->ops->save_live_complete_precopy_thread) {
                 continue;
             }
+
+            job->se = se;
+            job->bioc = qio_channel_buffer_new(4096);
+            qio_channel_set_name(QIO_CHANNEL(job->bioc),
+                                 "migration-complete-buffer");
+            job->f = qemu_file_new_output(QIO_CHANNEL(job->bioc));
+            object_unref(OBJECT(job->bioc));
+            qemu_event_init(&job->done, false);
+            trace_savevm_section_start(se->idstr, se->section_id);
+            thread_pool_submit_immediate(pool,
+                                         qemu_savevm_complete_precopy_thread,
+                                         job, NULL);
+            nr_jobs++;
+        }
+    }
+
+    QTAILQ_FOREACH(se, &savevm_state.handlers, entry) {
+        if (!qemu_savevm_complete_precopy_needed(se, in_postcopy)) {
+            continue;
+        }
+
+        if (se->ops->save_live_complete_precopy_thread) {
+            SaveCompleteThreadJob *job = &jobs[next_job++];
+
+            assert(job->se == se);
+            /*
+             * Keep the order of the sections: wait for this job only, the
+             * later ones go on while its section is written out.
+             */
+            qemu_event_wait(&job->done);
+
+            save_section_header(f, se, QEMU_VM_SECTION_END);
+            if (!job->ret) {
+                qemu_put_buffer(f, job->bioc->data, job->bioc->usage);
+            }
+            trace_savevm_section_end(se->idstr, se->section_id, job->ret);
+            save_section_footer(f, se);
+            if (job->ret < 0) {
+                qemu_file_set_error(f, job->ret);
+                ret = -1;
+                break;
+            }
+            trace_vmstate_downtime_save("iterable", se->idstr,
+                                        se->instance_id, job->downtime);
+            continue;
         }
 
         start_ts_each = qemu_clock_get_us(QEMU_CLOCK_REALTIME);
@@ -1521,13 +1630,25 @@ int qemu_savevm_state_complete_precopy_iterable(QEMUFile *f, bool in_postcopy)
         save_section_footer(f, se);
         if (ret < 0) {
             qemu_file_set_error(f, ret);
-            return -1;
+            ret = -1;
+            break;
         }
         end_ts_each = qemu_clock_get_us(QEMU_CLOCK_REALTIME);
         trace_vmstate_downtime_save("iterable", se->idstr, se->instance_id,
                                     end_ts_each - start_ts_each);
     }
 
+    /* Waits for the jobs which were not reached on error */
+    thread_pool_free(pool);
+    for (int i = 0; i < nr_jobs; i++) {
+        qemu_fclose(jobs[i].f);
+        qemu_event_destroy(&jobs[i].done);
+    }
+
+    if (ret < 0) {
+        return ret;
+    }
+
     trace_vmstate_downtime_checkpoint("src-iterable-saved");
 
     return 0;
@@ -1716,6 +1837,16 @@ static int qemu_savevm_state(QEMUFile *f, Error **errp)
         return -EINVAL;
     }
 
+    /*
+     * The multifd channels are opened from the migration URI, which
+     * snapshots do not have.  With mapped-ram, the block channel already
+     * keeps several writes in flight.
+     */
+    if (migrate_multifd()) {
+        error_setg(errp, "Multifd and snapshots are incompatible");
+        return -EINVAL;
+    }
+
     ret = migrate_init(ms, errp);
     if (ret) {
         return ret;
@@ -3122,7 +3253,12 @@ bool save_snapshot(const char *name, bool overwrite, const char *vmstate,
         goto the_end;
     }
     ret = qemu_savevm_state(f, errp);
-    vm_state_size = qemu_file_transferred(f);
+    if (migrate_mapped_ram()) {
+        /* RAM pages are not all written, but the whole range is in use */
+        vm_state_size = qemu_get_offset(f);
+    } else {
+        vm_state_size = qemu_file_transferred(f);
+    }
     ret2 = qemu_fclose(f);
     if (ret < 0) {
         goto the_end;
@@ -3239,6 +3375,11 @@ bool load_snapshot(const char *name, const char *vmstate,
     int ret;
     MigrationIncomingState *mis = migration_incoming_get_current();
 
+    if (migrate_multifd()) {
+        error_setg(errp, "Multifd and snapshots are incompatible");
+        return false;
+    }
+
     if (!bdrv_all_can_snapshot(has_devices, devices, errp)) {
         return false;
     }
@@ -15,9 +15,106 @@
 #include "qemu/host-utils.h"
 #include "xbzrle.h"
 
-#if defined(CONFIG_AVX512BW_OPT)
+/*
+ * Encoder for hosts that can compare 64 bytes at once: @eq64 returns
+ * a mask with bit i set when byte i of both buffers is the same.  It
+ * produces the same output as the generic encoder below.
+ */
+static inline uint64_t xbzrle_eq_mask_tail(const uint8_t *old_buf,
+                                           const uint8_t *new_buf, int len)
+{
+    uint64_t mask = 0;
+
+    for (int i = 0; i < len; i++) {
+        if (old_buf[i] == new_buf[i]) {
+            mask |= 1ULL << i;
+        }
+    }
+    return mask;
+}
+
+/* Returns the end of the run of same (or different) bytes starting at @i */
+static inline QEMU_ALWAYS_INLINE int
+xbzrle_run_end(const uint8_t *old_buf, const uint8_t *new_buf, int i,
+               int slen, bool same,
+               uint64_t (*eq64)(const uint8_t *, const uint8_t *))
+{
+    while (i < slen) {
+        int len = MIN(slen - i, 64);
+        uint64_t mask;
+
+        if (len == 64) {
+            mask = eq64(old_buf + i, new_buf + i);
+        } else {
+            mask = xbzrle_eq_mask_tail(old_buf + i, new_buf + i, len);
+        }
+        if (same) {
+            mask = ~mask;
+        }
+        mask &= MAKE_64BIT_MASK(0, len);
+        if (mask) {
+            return i + ctz64(mask);
+        }
+        i += len;
+    }
+    return slen;
+}
+
+static inline QEMU_ALWAYS_INLINE int
+xbzrle_encode_runs(uint8_t *old_buf, uint8_t *new_buf, int slen,
+                   uint8_t *dst, int dlen,
+                   uint64_t (*eq64)(const uint8_t *, const uint8_t *))
+{
+    int d = 0, i = 0;
+
+    while (i < slen) {
+        int start = i;
+        int len;
+
+        /* overflow */
+        if (d + 2 > dlen) {
+            return -1;
+        }
+
+        i = xbzrle_run_end(old_buf, new_buf, i, slen, true, eq64);
+
+        /* buffer unchanged */
+        if (i - start == slen) {
+            return 0;
+        }
+
+        /* skip last zero run */
+        if (i == slen) {
+            return d;
+        }
+
+        d += uleb128_encode_small(dst + d, i - start);
+
+        start = i;
+        i = xbzrle_run_end(old_buf, new_buf, i, slen, false, eq64);
+        len = i - start;
+
+        /* overflow */
+        if (d + 2 > dlen) {
+            return -1;
+        }
+        d += uleb128_encode_small(dst + d, len);
+        if (d + len > dlen) {
+            return -1;
+        }
+        memcpy(dst + d, new_buf + start, len);
+        d += len;
+    }
+
+    return d;
+}
+
+#if defined(CONFIG_AVX512BW_OPT) || defined(CONFIG_AVX2_OPT)
 #include <immintrin.h>
 #include "host/cpuinfo.h"
+#endif
+
+#if defined(CONFIG_AVX512BW_OPT)
 
 static int __attribute__((target("avx512bw")))
 xbzrle_encode_buffer_avx512(uint8_t *old_buf, uint8_t *new_buf, int slen,
@@ -136,20 +233,49 @@ xbzrle_encode_buffer_avx512(uint8_t *old_buf, uint8_t *new_buf, int slen,
     }
     return d;
 }
+#endif /* CONFIG_AVX512BW_OPT */
 
-static int xbzrle_encode_buffer_int(uint8_t *old_buf, uint8_t *new_buf,
-                                    int slen, uint8_t *dst, int dlen);
+#if defined(CONFIG_AVX2_OPT)
+static inline uint64_t __attribute__((target("avx2")))
+xbzrle_eq64_avx2(const uint8_t *old_buf, const uint8_t *new_buf)
+{
+    __m256i o0 = _mm256_loadu_si256((const __m256i *)old_buf);
+    __m256i o1 = _mm256_loadu_si256((const __m256i *)(old_buf + 32));
+    __m256i n0 = _mm256_loadu_si256((const __m256i *)new_buf);
+    __m256i n1 = _mm256_loadu_si256((const __m256i *)(new_buf + 32));
+    uint32_t lo = _mm256_movemask_epi8(_mm256_cmpeq_epi8(o0, n0));
+    uint32_t hi = _mm256_movemask_epi8(_mm256_cmpeq_epi8(o1, n1));
+
+    return ((uint64_t)hi << 32) | lo;
+}
+
+static int __attribute__((target("avx2")))
+xbzrle_encode_buffer_avx2(uint8_t *old_buf, uint8_t *new_buf, int slen,
+                          uint8_t *dst, int dlen)
+{
+    return xbzrle_encode_runs(old_buf, new_buf, slen, dst, dlen,
+                              xbzrle_eq64_avx2);
+}
+#endif /* CONFIG_AVX2_OPT */
 
+#if defined(CONFIG_AVX512BW_OPT) || defined(CONFIG_AVX2_OPT)
 static int (*accel_func)(uint8_t *, uint8_t *, int, uint8_t *, int);
 
 static void __attribute__((constructor)) init_accel(void)
 {
     unsigned info = cpuinfo_init();
+
+    accel_func = xbzrle_encode_buffer_generic;
+#if defined(CONFIG_AVX2_OPT)
+    if (info & CPUINFO_AVX2) {
+        accel_func = xbzrle_encode_buffer_avx2;
+    }
+#endif
+#if defined(CONFIG_AVX512BW_OPT)
     if (info & CPUINFO_AVX512BW) {
         accel_func = xbzrle_encode_buffer_avx512;
-    } else {
-        accel_func = xbzrle_encode_buffer_int;
     }
+#endif
 }
 
 int xbzrle_encode_buffer(uint8_t *old_buf, uint8_t *new_buf, int slen,
@@ -157,8 +283,42 @@ int xbzrle_encode_buffer(uint8_t *old_buf, uint8_t *new_buf, int slen,
 {
     return accel_func(old_buf, new_buf, slen, dst, dlen);
 }
+#elif defined(__aarch64__)
+#include <arm_neon.h>
 
-#define xbzrle_encode_buffer xbzrle_encode_buffer_int
+/* Advanced SIMD is always present on AArch64 */
+static inline uint64_t xbzrle_eq64_neon(const uint8_t *old_buf,
+                                        const uint8_t *new_buf)
+{
+    static const uint8_t weights[16] = {
+        1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128
+    };
+    uint8x16_t w = vld1q_u8(weights);
+    uint8x16_t m0, m1, m2, m3;
+
+    m0 = vandq_u8(vceqq_u8(vld1q_u8(old_buf), vld1q_u8(new_buf)), w);
+    m1 = vandq_u8(vceqq_u8(vld1q_u8(old_buf + 16), vld1q_u8(new_buf + 16)), w);
+    m2 = vandq_u8(vceqq_u8(vld1q_u8(old_buf + 32), vld1q_u8(new_buf + 32)), w);
+    m3 = vandq_u8(vceqq_u8(vld1q_u8(old_buf + 48), vld1q_u8(new_buf + 48)), w);
+
+    /* Add up the lanes of each half until every byte holds 8 bits */
+    m0 = vpaddq_u8(vpaddq_u8(m0, m1), vpaddq_u8(m2, m3));
+    m0 = vpaddq_u8(m0, m0);
+    return vgetq_lane_u64(vreinterpretq_u64_u8(m0), 0);
+}
+
+int xbzrle_encode_buffer(uint8_t *old_buf, uint8_t *new_buf, int slen,
+                         uint8_t *dst, int dlen)
+{
+    return xbzrle_encode_runs(old_buf, new_buf, slen, dst, dlen,
+                              xbzrle_eq64_neon);
+}
+#else
+int xbzrle_encode_buffer(uint8_t *old_buf, uint8_t *new_buf, int slen,
+                         uint8_t *dst, int dlen)
+{
+    return xbzrle_encode_buffer_generic(old_buf, new_buf, slen, dst, dlen);
+}
 #endif
 
 /*
@@ -171,8 +331,8 @@ int xbzrle_encode_buffer(uint8_t *old_buf, uint8_t *new_buf, int slen,
 
   length = uleb128 encoded integer
  */
-int xbzrle_encode_buffer(uint8_t *old_buf, uint8_t *new_buf, int slen,
-                         uint8_t *dst, int dlen)
+int xbzrle_encode_buffer_generic(uint8_t *old_buf, uint8_t *new_buf, int slen,
+                                 uint8_t *dst, int dlen)
 {
     uint32_t zrun_len = 0, nzrun_len = 0;
     int d = 0, i = 0;
@@ -17,6 +17,10 @@
 int xbzrle_encode_buffer(uint8_t *old_buf, uint8_t *new_buf, int slen,
                          uint8_t *dst, int dlen);
 
+/* Portable encoder; xbzrle_encode_buffer() may use a SIMD version instead */
+int xbzrle_encode_buffer_generic(uint8_t *old_buf, uint8_t *new_buf, int slen,
+                                 uint8_t *dst, int dlen);
+
 int xbzrle_decode_buffer(uint8_t *src, int slen, uint8_t *dst, int dlen);
 
 #endif
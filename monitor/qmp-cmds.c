@@ -14,7 +14,10 @@
  */
 
 #include "qemu/osdep.h"
+#include "qemu/bql-profile.h"
+#include "qemu/lock-sample.h"
 #include "qemu/sockets.h"
+#include "qemu/startup-profile.h"
 #include "monitor-internal.h"
 #include "monitor/qdev.h"
 #include "monitor/qmp-helpers.h"
@@ -190,6 +193,144 @@ out:
     return output;
 }
 
+void qmp_x_lock_profile_set(bool enable, bool has_period, uint32_t period,
+                            bool has_reset, bool reset, Error **errp)
+{
+    if (!has_period) {
+        period = 1000;
+    } else if (!period) {
+        error_setg(errp, QERR_INVALID_PARAMETER_VALUE, "period",
+                   "a positive integer");
+        return;
+    }
+
+    if (enable) {
+        if (!lock_sample_enable(period)) {
+            error_setg(errp, "The lock profiler cannot be enabled while "
+                       "sync-profile is on");
+            return;
+        }
+    } else {
+        lock_sample_disable();
+    }
+
+    if (has_reset && reset) {
+        lock_sample_reset();
+    }
+}
+
+static uint64List *lock_profile_histogram(const uint64_t *hist)
+{
+    uint64List *list = NULL;
+    int i;
+
+    for (i = LOCK_SAMPLE_BUCKETS - 1; i >= 0; i--) {
+        QAPI_LIST_PREPEND(list, hist[i]);
+    }
+    return list;
+}
+
+static void lock_profile_add_site(const LockSampleSite *s, void *opaque)
+{
+    LockProfileSiteList **sites = opaque;
+    LockProfileSite *site = g_new0(LockProfileSite, 1);
+
+    site->file = g_strdup(s->file);
+    site->line = s->line;
+    site->type = s->type == LOCK_SAMPLE_BQL ? LOCK_PROFILE_TYPE_BQL
+                                            : LOCK_PROFILE_TYPE_MUTEX;
+    site->samples = s->samples;
+    site->wait_ns = s->wait_ns;
+    site->wait_max_ns = s->wait_max_ns;
+    site->wait_histogram = lock_profile_histogram(s->wait_hist);
+    site->hold_ns = s->hold_ns;
+    site->hold_max_ns = s->hold_max_ns;
+    site->hold_histogram = lock_profile_histogram(s->hold_hist);
+    QAPI_LIST_PREPEND(*sites, site);
+}
+
+LockProfileInfo *qmp_x_query_lock_profile(Error **errp)
+{
+    LockProfileInfo *info = g_new0(LockProfileInfo, 1);
+
+    info->enabled = lock_sample_is_enabled();
+    info->period = lock_sample_get_period();
+    lock_sample_foreach(lock_profile_add_site, &info->sites);
+    return info;
+}
+
+void qmp_x_bql_profile_set(bool enable, bool has_reset, bool reset,
+                           Error **errp)
+{
+    if (enable) {
+        bql_profile_enable();
+    } else {
+        bql_profile_disable();
+    }
+
+    if (has_reset && reset) {
+        bql_profile_reset();
+    }
+}
+
+static void bql_profile_add_holder(const BQLProfileEntry *e, void *opaque)
+{
+    static const BqlHolderKind kinds[] = {
+        [BQL_PROFILE_LOCK] = BQL_HOLDER_KIND_LOCK,
+        [BQL_PROFILE_MMIO] = BQL_HOLDER_KIND_MMIO,
+        [BQL_PROFILE_TIMER] = BQL_HOLDER_KIND_TIMER,
+        [BQL_PROFILE_BH] = BQL_HOLDER_KIND_BH,
+    };
+    BqlHolderList **holders = opaque;
+    BqlHolder *holder = g_new0(BqlHolder, 1);
+
+    holder->kind = kinds[e->kind];
+    holder->name = g_strdup(e->name);
+    if (e->kind == BQL_PROFILE_LOCK) {
+        holder->has_line = true;
+        holder->line = e->line;
+    }
+    holder->count = e->count;
+    holder->hold_ns = e->hold_ns;
+    holder->hold_max_ns = e->hold_max_ns;
+    holder->wait_ns = e->wait_ns;
+    QAPI_LIST_PREPEND(*holders, holder);
+}
+
+BqlProfileInfo *qmp_x_query_bql_profile(Error **errp)
+{
+    BqlProfileInfo *info = g_new0(BqlProfileInfo, 1);
+
+    info->enabled = bql_profile_is_enabled();
+    bql_profile_foreach(bql_profile_add_holder, &info->holders);
+    return info;
+}
+
+static void startup_profile_add_entry(const StartupProfileSpan *e,
+                                      void *opaque)
+{
+    StartupProfileEntryList ***tail = opaque;
+    StartupProfileEntry *entry = g_new0(StartupProfileEntry, 1);
+
+    entry->kind = e->kind == STARTUP_PROFILE_PHASE ?
+        STARTUP_PROFILE_KIND_PHASE : STARTUP_PROFILE_KIND_REALIZE;
+    entry->name = g_strdup(e->name);
+    entry->end_ns = e->end_ns;
+    entry->wall_ns = e->wall_ns;
+    entry->cpu_ns = e->cpu_ns;
+    QAPI_LIST_APPEND(*tail, entry);
+}
+
+StartupProfileInfo *qmp_x_query_startup_profile(Error **errp)
+{
+    StartupProfileInfo *info = g_new0(StartupProfileInfo, 1);
+    StartupProfileEntryList **tail = &info->entries;
+
+    info->complete = !startup_profile_active;
+    startup_profile_foreach(startup_profile_add_entry, &tail);
+    return info;
+}
+
 static void __attribute__((__constructor__)) monitor_init_qmp_commands(void)
 {
     /*
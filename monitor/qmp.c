@@ -31,8 +31,12 @@
 #include "qapi/qmp/qdict.h"
 #include "qapi/qmp/qjson.h"
 #include "qapi/qmp/qlist.h"
+#include "qemu/units.h"
 #include "trace.h"
 
+/* How much of a response is buffered before it is written out */
+#define QMP_STREAM_FLUSH_SIZE (64 * KiB)
+
 /*
  * qmp_dispatcher_co_busy is used for synchronisation between the
  * monitor thread and the main thread to ensure that the dispatcher
@@ -129,11 +133,39 @@ static void monitor_qmp_cleanup_queue_and_resume(MonitorQMP *mon)
 
 }
 
+/* Called with mon->common.mon_lock held */
+static void qmp_send_response_chunk(void *opaque, const char *buf, size_t len)
+{
+    MonitorQMP *mon = opaque;
+
+    /* @buf is NUL-terminated; monitor_puts_locked() translates newlines */
+    monitor_puts_locked(&mon->common, buf);
+
+    /* Small responses are written in one go by the final newline */
+    if (mon->common.outbuf->len >= QMP_STREAM_FLUSH_SIZE) {
+        monitor_flush_locked(&mon->common);
+    }
+}
+
 void qmp_send_response(MonitorQMP *mon, const QDict *rsp)
 {
     const QObject *data = QOBJECT(rsp);
     GString *json;
 
+    if (!trace_event_get_state_backends(TRACE_MONITOR_QMP_RESPOND)) {
+        /*
+         * Serialize straight into the output buffer, which is flushed
+         * to the chardev every chunk, instead of building the whole JSON
+         * text first.  Large responses such as query-named-block-nodes
+         * then never exist as a complete string in memory.
+         */
+        QEMU_LOCK_GUARD(&mon->common.mon_lock);
+        qobject_to_json_stream(data, mon->pretty, qmp_send_response_chunk,
+                               mon);
+        monitor_puts_locked(&mon->common, "\n");
+        return;
+    }
+
     json = qobject_to_json_pretty(data, mon->pretty);
     assert(json != NULL);
     trace_monitor_qmp_respond(mon, json->str);
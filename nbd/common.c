@@ -160,6 +160,8 @@ const char *nbd_cmd_lookup(uint16_t cmd)
         return "write zeroes";
     case NBD_CMD_BLOCK_STATUS:
         return "block status";
+    case NBD_CMD_COPY:
+        return "copy";
     default:
         return "<unknown>";
     }
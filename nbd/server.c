@@ -22,12 +22,14 @@
 #include "block/block_int.h"
 #include "block/export.h"
 #include "block/dirty-bitmap.h"
+#include "block/thread-pool.h"
 #include "qapi/error.h"
 #include "qemu/queue.h"
 #include "trace.h"
 #include "nbd-internal.h"
 #include "qemu/units.h"
 #include "qemu/memalign.h"
+#include "qemu/cutils.h"
 
 #define NBD_META_ID_BASE_ALLOCATION 0
 #define NBD_META_ID_ALLOCATION_DEPTH 1
@@ -42,6 +44,16 @@
  */
 #define NBD_MAX_BLOCK_STATUS_EXTENTS (1 * MiB / 8)
 
+/* Bounce buffer for NBD_CMD_COPY when the copy cannot be offloaded */
+#define NBD_COPY_BUFFER_SIZE (4 * MiB)
+/* Largest request NBD_CMD_COPY is split into */
+#define NBD_COPY_MAX_CHUNK (1 * GiB)
+
+/* Read data smaller than this is copied even with zero copy enabled */
+#define NBD_ZERO_COPY_MIN_SIZE (16 * KiB)
+/* Memory held by zero copy read buffers before waiting for the kernel */
+#define NBD_ZERO_COPY_MAX_PENDING (64 * MiB)
+
 static int system_errno_to_nbd_errno(int err)
 {
     switch (err) {
@@ -83,6 +95,8 @@ struct NBDRequestData {
     NBDClient *client;
     uint8_t *data;
     bool complete;
+    /* Length of @data, if it may have been sent with zero copy */
+    uint64_t zero_copy_len;
 };
 
 struct NBDExport {
@@ -99,6 +113,7 @@ struct NBDExport {
     Notifier eject_notifier;
 
     bool allocation_depth;
+    bool copy_offload; /* advertise NBD_FLAG_SEND_COPY (x-copy-offload) */
     BdrvDirtyBitmap **export_bitmaps;
     size_t nr_export_bitmaps;
 };
@@ -150,6 +165,11 @@ struct NBDClient {
     NBDMode mode;
     NBDMetaContexts contexts; /* Negotiated meta contexts */
 
+    bool zero_copy; /* Send read data with QIO_CHANNEL_WRITE_FLAG_ZERO_COPY */
+    GSList *zero_copy_bufs; /* protected by lock */
+    uint64_t zero_copy_pending; /* protected by lock */
+    bool zero_copy_flushing; /* protected by lock */
+
     uint32_t opt; /* Current option being negotiated */
     uint32_t optlen; /* remaining length of data in ioc for the option being
                         negotiated now */
@@ -517,6 +537,10 @@ static int nbd_negotiate_handle_export_name(NBDClient *client, bool no_zeroes,
     if (client->mode >= NBD_MODE_EXTENDED && client->contexts.count) {
         myflags |= NBD_FLAG_BLOCK_STAT_PAYLOAD;
     }
+    if (client->mode >= NBD_MODE_EXTENDED && client->exp->copy_offload &&
+        !(myflags & NBD_FLAG_READ_ONLY)) {
+        myflags |= NBD_FLAG_SEND_COPY;
+    }
     trace_nbd_negotiate_new_style_size_flags(client->exp->size, myflags);
     stq_be_p(buf, client->exp->size);
     stw_be_p(buf + 8, myflags);
@@ -708,6 +732,10 @@ static int nbd_negotiate_handle_info(NBDClient *client, Error **errp)
         (client->contexts.count || client->opt == NBD_OPT_INFO)) {
         myflags |= NBD_FLAG_BLOCK_STAT_PAYLOAD;
     }
+    if (client->mode >= NBD_MODE_EXTENDED && exp->copy_offload &&
+        !(myflags & NBD_FLAG_READ_ONLY)) {
+        myflags |= NBD_FLAG_SEND_COPY;
+    }
     trace_nbd_negotiate_new_style_size_flags(exp->size, myflags);
     stq_be_p(buf, exp->size);
     stw_be_p(buf + 8, myflags);
@@ -1526,6 +1554,11 @@ void nbd_client_put(NBDClient *client)
          */
         assert(client->closing);
 
+        if (client->zero_copy_bufs) {
+            /* The kernel may still be reading from these buffers */
+            qio_channel_flush(client->ioc, NULL);
+            g_slist_free_full(client->zero_copy_bufs, qemu_vfree);
+        }
         object_unref(OBJECT(client->sioc));
         object_unref(OBJECT(client->ioc));
         if (client->tlscreds) {
@@ -1604,12 +1637,80 @@ static NBDRequestData *nbd_request_get(NBDClient *client)
     return req;
 }
 
+/*
+ * The kernel may still be reading from buffers sent with zero copy, so
+ * they are only freed after a qio_channel_flush(), see
+ * nbd_co_zero_copy_flush().
+ *
+ * Called with client->lock held.
+ */
+static void nbd_zero_copy_release(NBDClient *client, uint8_t *buf,
+                                  uint64_t len)
+{
+    client->zero_copy_bufs = g_slist_prepend(client->zero_copy_bufs, buf);
+    client->zero_copy_pending += len;
+}
+
+typedef struct NBDZeroCopyFlush {
+    NBDClient *client;
+    Error *err;
+} NBDZeroCopyFlush;
+
+static int nbd_zero_copy_flush_fn(void *opaque)
+{
+    NBDZeroCopyFlush *flush = opaque;
+
+    return qio_channel_flush(flush->client->ioc, &flush->err);
+}
+
+/*
+ * qio_channel_flush() blocks until the kernel is done with all data queued
+ * so far, therefore it is done once for many buffers, in a worker thread
+ * so that requests keep being processed meanwhile.  Buffers released while
+ * the flush runs are kept for the next one.
+ *
+ * Runs in export AioContext without client->lock held.
+ */
+static void coroutine_fn nbd_co_zero_copy_flush(NBDClient *client)
+{
+    NBDZeroCopyFlush flush = { .client = client };
+    GSList *bufs;
+    uint64_t pending;
+    int ret;
+
+    WITH_QEMU_LOCK_GUARD(&client->lock) {
+        if (client->zero_copy_pending < NBD_ZERO_COPY_MAX_PENDING ||
+            client->zero_copy_flushing || client->closing) {
+            return;
+        }
+        bufs = client->zero_copy_bufs;
+        pending = client->zero_copy_pending;
+        client->zero_copy_bufs = NULL;
+        client->zero_copy_pending = 0;
+        client->zero_copy_flushing = true;
+    }
+
+    ret = thread_pool_submit_co(nbd_zero_copy_flush_fn, &flush);
+    trace_nbd_zero_copy_flush(client, pending, ret);
+    if (ret < 0) {
+        /* The connection is broken, nobody will look at the data anymore */
+        warn_report_err(flush.err);
+    }
+    g_slist_free_full(bufs, qemu_vfree);
+
+    WITH_QEMU_LOCK_GUARD(&client->lock) {
+        client->zero_copy_flushing = false;
+    }
+}
+
 /* Runs in export AioContext with client->lock held */
 static void nbd_request_put(NBDRequestData *req)
 {
     NBDClient *client = req->client;
 
-    if (req->data) {
+    if (req->data && req->zero_copy_len) {
+        nbd_zero_copy_release(client, req->data, req->zero_copy_len);
+    } else if (req->data) {
         qemu_vfree(req->data);
     }
     g_free(req);
@@ -1887,6 +1988,7 @@ static int nbd_export_create(BlockExport *blk_exp, BlockExportOptions *exp_args,
     }
 
     exp->allocation_depth = arg->allocation_depth;
+    exp->copy_offload = arg->x_copy_offload;
 
     /*
      * We need to inhibit request queuing in the block layer to ensure we can
@@ -2004,6 +2106,40 @@ static int coroutine_fn nbd_co_send_iov(NBDClient *client, struct iovec *iov,
     return ret;
 }
 
+/*
+ * Like nbd_co_send_iov(), but the last element of @iov is read data in
+ * the request buffer, which is kept by nbd_request_put() until the kernel
+ * is done with it.  The headers before it are on the stack, they are
+ * always copied.
+ */
+static int coroutine_fn nbd_co_send_iov_data(NBDClient *client,
+                                             struct iovec *iov,
+                                             unsigned niov, Error **errp)
+{
+    int ret;
+
+    if (!client->zero_copy || iov[niov - 1].iov_len < NBD_ZERO_COPY_MIN_SIZE) {
+        return nbd_co_send_iov(client, iov, niov, errp);
+    }
+
+    g_assert(qemu_in_coroutine());
+    qemu_co_mutex_lock(&client->send_lock);
+    client->send_coroutine = qemu_coroutine_self();
+
+    ret = qio_channel_writev_all(client->ioc, iov, niov - 1, errp);
+    if (ret == 0) {
+        ret = qio_channel_writev_full_all(client->ioc, &iov[niov - 1], 1,
+                                          NULL, 0,
+                                          QIO_CHANNEL_WRITE_FLAG_ZERO_COPY,
+                                          errp);
+    }
+
+    client->send_coroutine = NULL;
+    qemu_co_mutex_unlock(&client->send_lock);
+
+    return ret < 0 ? -EIO : 0;
+}
+
 static inline void set_be_simple_reply(NBDSimpleReply *reply, uint64_t error,
                                        uint64_t cookie)
 {
@@ -2035,7 +2171,7 @@ static int coroutine_fn nbd_co_send_simple_reply(NBDClient *client,
                                    nbd_err_lookup(nbd_err), len);
     set_be_simple_reply(&reply, nbd_err, request->cookie);
 
-    return nbd_co_send_iov(client, iov, 2, errp);
+    return nbd_co_send_iov_data(client, iov, 2, errp);
 }
 
 /*
@@ -2116,7 +2252,7 @@ static int coroutine_fn nbd_co_send_chunk_read(NBDClient *client,
                  NBD_REPLY_TYPE_OFFSET_DATA, request);
     stq_be_p(&chunk.offset, offset);
 
-    return nbd_co_send_iov(client, iov, 3, errp);
+    return nbd_co_send_iov_data(client, iov, 3, errp);
 }
 
 static int coroutine_fn nbd_co_send_chunk_error(NBDClient *client,
@@ -2590,6 +2726,58 @@ nbd_co_block_status_payload_read(NBDClient *client, NBDRequest *request,
     return nbd_drop(client->ioc, payload_len, errp);
 }
 
+/*
+ * nbd_co_copy_payload_read
+ * Called when a client sends NBD_CMD_COPY, whose payload names the source
+ * export and offset of the copy.  On success, return 0 with request
+ * updated to the effective length and the source.  If the payload was
+ * invalid but fully consumed, return 0 with request->len set to 0 and no
+ * source (which will trigger an NBD_EINVAL response later on).  Return
+ * negative errno if the payload was not fully consumed.
+ */
+static int
+nbd_co_copy_payload_read(NBDClient *client, NBDRequest *request,
+                         Error **errp)
+{
+    uint64_t payload_len = request->len;
+    g_autofree char *buf = NULL;
+    size_t name_len;
+
+    if (payload_len > NBD_MAX_BUFFER_SIZE) {
+        error_setg(errp, "len (%" PRIu64 ") is larger than max len (%u)",
+                   request->len, NBD_MAX_BUFFER_SIZE);
+        return -EINVAL;
+    }
+
+    if (payload_len < sizeof(NBDCopyPayload) ||
+        payload_len > sizeof(NBDCopyPayload) + NBD_MAX_STRING_SIZE) {
+        goto skip;
+    }
+
+    buf = g_malloc(payload_len);
+    if (nbd_read(client->ioc, buf, payload_len,
+                 "CMD_COPY data", errp) < 0) {
+        return -EIO;
+    }
+    trace_nbd_co_receive_request_payload_received(request->cookie,
+                                                  payload_len);
+
+    name_len = payload_len - sizeof(NBDCopyPayload);
+    if (memchr(buf + sizeof(NBDCopyPayload), 0, name_len)) {
+        payload_len = 0;
+        goto skip;
+    }
+    request->len = ldq_be_p(buf);
+    request->src_offset = ldq_be_p(buf + 8);
+    request->src_export = g_strndup(buf + sizeof(NBDCopyPayload), name_len);
+    return 0;
+
+ skip:
+    trace_nbd_co_receive_copy_payload_compliance(request->from, request->len);
+    request->len = 0;
+    return nbd_drop(client->ioc, payload_len, errp);
+}
+
 /* nbd_co_receive_request
  * Collect a client request. Return 0 if request looks valid, -EIO to drop
  * connection right away, -EAGAIN to indicate we were interrupted and the
@@ -2689,6 +2877,24 @@ static int coroutine_fn nbd_co_receive_request(NBDRequestData *req,
         valid_flags |= NBD_CMD_FLAG_REQ_ONE;
         break;
 
+    case NBD_CMD_COPY:
+        if (!client->exp->copy_offload) {
+            /* Not advertised, fail like any unrecognized command */
+            break;
+        }
+        if (extended_with_payload) {
+            ret = nbd_co_copy_payload_read(client, request, errp);
+            if (ret < 0) {
+                return ret;
+            }
+            /* payload now consumed */
+            check_length = false;
+            payload_len = 0;
+            valid_flags |= NBD_CMD_FLAG_PAYLOAD_LEN;
+        }
+        check_rofs = true;
+        break;
+
     default:
         /* Unrecognized, will fail later */
         ;
@@ -2742,7 +2948,7 @@ static int coroutine_fn nbd_co_receive_request(NBDRequestData *req,
 
     /* Sanity checks. */
     if (client->exp->nbdflags & NBD_FLAG_READ_ONLY && check_rofs) {
-        /* WRITE, TRIM, WRITE_ZEROES */
+        /* WRITE, TRIM, WRITE_ZEROES, COPY */
         error_setg(errp, "Export is read-only");
         return -EROFS;
     }
@@ -2752,7 +2958,8 @@ static int coroutine_fn nbd_co_receive_request(NBDRequestData *req,
                    ", Size: %" PRIu64, request->from, request->len,
                    client->exp->size);
         return (request->type == NBD_CMD_WRITE ||
-                request->type == NBD_CMD_WRITE_ZEROES) ? -ENOSPC : -EINVAL;
+                request->type == NBD_CMD_WRITE_ZEROES ||
+                request->type == NBD_CMD_COPY) ? -ENOSPC : -EINVAL;
     }
     if (client->check_align && !QEMU_IS_ALIGNED(request->from | request->len,
                                                 client->check_align)) {
@@ -2864,6 +3071,121 @@ static coroutine_fn int nbd_do_cmd_cache(NBDClient *client, NBDRequest *request,
                                   "caching data failed", errp);
 }
 
+/*
+ * Copy @bytes from @src to the export of @client through a bounce buffer,
+ * for when the nodes cannot offload the copy themselves.
+ */
+static coroutine_fn int nbd_co_copy_bounce(NBDClient *client, NBDExport *src,
+                                           uint64_t src_offset,
+                                           uint64_t dst_offset,
+                                           uint64_t bytes)
+{
+    BlockBackend *blk = client->exp->common.blk;
+    uint64_t buf_size = MIN(bytes, NBD_COPY_BUFFER_SIZE);
+    uint64_t done;
+    void *buf;
+    int ret = 0;
+
+    buf = blk_try_blockalign(blk, buf_size);
+    if (!buf) {
+        return -ENOMEM;
+    }
+
+    for (done = 0; done < bytes && ret >= 0; done += buf_size) {
+        buf_size = MIN(bytes - done, buf_size);
+        ret = blk_co_pread(src->common.blk, src_offset + done, buf_size,
+                           buf, 0);
+        if (ret < 0) {
+            break;
+        }
+        if (buffer_is_zero(buf, buf_size)) {
+            ret = blk_co_pwrite_zeroes(blk, dst_offset + done, buf_size, 0);
+        } else {
+            ret = blk_co_pwrite(blk, dst_offset + done, buf_size, buf, 0);
+        }
+    }
+
+    qemu_vfree(buf);
+    return ret;
+}
+
+/*
+ * nbd_do_cmd_copy
+ *
+ * Handle NBD_CMD_COPY request, copying data from another export of this
+ * server without sending it over the connection.
+ * Return -errno if sending fails. Other errors are reported directly to the
+ * client as an error reply.
+ */
+static coroutine_fn int nbd_do_cmd_copy(NBDClient *client, NBDRequest *request,
+                                        Error **errp)
+{
+    NBDExport *exp = client->exp;
+    NBDExport *src;
+    bool use_copy_range = true;
+    uint64_t done, bytes;
+    int ret = 0;
+
+    assert(request->type == NBD_CMD_COPY);
+
+    if (!request->src_export) {
+        return nbd_send_generic_reply(client, request, -EINVAL,
+                                      "copy without a source export", errp);
+    }
+
+    /*
+     * The export list may only be looked up in the main loop, and the
+     * block layer cannot copy between nodes of different AioContexts.
+     */
+    if (qemu_get_current_aio_context() != qemu_get_aio_context()) {
+        return nbd_send_generic_reply(client, request, -ENOTSUP,
+                                      "copy needs the main AioContext", errp);
+    }
+    src = nbd_export_find(request->src_export);
+    if (!src) {
+        return nbd_send_generic_reply(client, request, -EINVAL,
+                                      "copy source export not found", errp);
+    }
+    if (blk_get_aio_context(src->common.blk) !=
+        blk_get_aio_context(exp->common.blk)) {
+        return nbd_send_generic_reply(client, request, -ENOTSUP,
+                                      "copy between AioContexts", errp);
+    }
+    if (request->src_offset > src->size ||
+        request->len > src->size - request->src_offset) {
+        return nbd_send_generic_reply(client, request, -EINVAL,
+                                      "copy source past EOF", errp);
+    }
+
+    /* The source export must not go away while we yield */
+    blk_exp_ref(&src->common);
+
+    for (done = 0; done < request->len && ret >= 0; done += bytes) {
+        bytes = MIN(request->len - done, NBD_COPY_MAX_CHUNK);
+        if (use_copy_range) {
+            ret = blk_co_copy_range(src->common.blk, request->src_offset + done,
+                                    exp->common.blk, request->from + done,
+                                    bytes, 0, 0);
+            if (ret != -ENOTSUP) {
+                continue;
+            }
+            use_copy_range = false;
+        }
+        ret = nbd_co_copy_bounce(client, src, request->src_offset + done,
+                                 request->from + done, bytes);
+    }
+    trace_nbd_co_copy(request->from, request->len, src->name,
+                      request->src_offset, use_copy_range, ret);
+
+    blk_exp_unref(&src->common);
+
+    if (ret >= 0 && request->flags & NBD_CMD_FLAG_FUA) {
+        ret = blk_co_flush(exp->common.blk);
+    }
+    return nbd_send_generic_reply(client, request, ret,
+                                  "copy failed", errp);
+}
+
 /* Handle NBD request.
  * Return -errno if sending fails. Other errors are reported directly to the
  * client as an error reply. */
@@ -2928,6 +3250,13 @@ static coroutine_fn int nbd_handle_request(NBDClient *client,
         return nbd_send_generic_reply(client, request, ret,
                                       "discard failed", errp);
 
+    case NBD_CMD_COPY:
+        if (!exp->copy_offload) {
+            return nbd_send_generic_reply(client, request, -EINVAL,
+                                          "copy offload not enabled", errp);
+        }
+        return nbd_do_cmd_copy(client, request, errp);
+
     case NBD_CMD_BLOCK_STATUS:
         assert(request->contexts);
         assert(client->mode >= NBD_MODE_EXTENDED ||
@@ -3084,6 +3413,9 @@ static coroutine_fn void nbd_trip(void *opaque)
                                      error_get_pretty(export_err), &local_err);
         error_free(export_err);
     } else {
+        if (client->zero_copy && request.type == NBD_CMD_READ) {
+            req->zero_copy_len = request.len;
+        }
         ret = nbd_handle_request(client, &request, req->data, &local_err);
     }
     if (request.contexts && request.contexts != &client->contexts) {
@@ -3091,6 +3423,7 @@ static coroutine_fn void nbd_trip(void *opaque)
         g_free(request.contexts->bitmaps);
         g_free(request.contexts);
     }
+    g_free(request.src_export);
 
     qio_channel_set_cork(client->ioc, false);
     qemu_mutex_lock(&client->lock);
@@ -3114,6 +3447,8 @@ done:
 
     qemu_mutex_unlock(&client->lock);
 
+    nbd_co_zero_copy_flush(client);
+
     if (!nbd_client_put_nonzero(client)) {
         aio_co_reschedule_self(qemu_get_aio_context());
         nbd_client_put(client);
@@ -3165,6 +3500,10 @@ static coroutine_fn void nbd_co_client_start(void *opaque)
         return;
     }
 
+    /* Only plain sockets support it, not TLS */
+    client->zero_copy = qio_channel_has_feature(
+        client->ioc, QIO_CHANNEL_FEATURE_WRITE_ZERO_COPY);
+
     WITH_QEMU_LOCK_GUARD(&client->lock) {
         nbd_client_receive_next_request(client);
     }
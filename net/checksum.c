@@ -21,22 +21,35 @@
 
 uint32_t net_checksum_add_cont(int len, uint8_t *buf, int seq)
 {
-    uint32_t sum1 = 0, sum2 = 0;
+    uint64_t sum = 0;
+    uint16_t folded;
     int i;
 
-    for (i = 0; i < len - 1; i += 2) {
-        sum1 += (uint32_t)buf[i];
-        sum2 += (uint32_t)buf[i + 1];
+    /*
+     * The one's complement sum does not depend on byte order (RFC 1071), so
+     * add 32-bit words in host order and only swap the folded result.  The
+     * loop has no carries to propagate and the compiler can vectorize it.
+     */
+    for (i = 0; i + 4 <= len; i += 4) {
+        sum += ldl_he_p(buf + i);
+    }
+    if (i + 2 <= len) {
+        sum += lduw_he_p(buf + i);
+        i += 2;
     }
     if (i < len) {
-        sum1 += (uint32_t)buf[i];
+        uint8_t last[2] = { buf[i], 0 };
+        sum += lduw_he_p(last);
     }
 
-    if (seq & 1) {
-        return sum1 + (sum2 << 8);
-    } else {
-        return sum2 + (sum1 << 8);
-    }
+    sum = (sum & 0xffffffff) + (sum >> 32);
+    sum = (sum & 0xffffffff) + (sum >> 32);
+    sum = (sum & 0xffff) + (sum >> 16);
+    sum = (sum & 0xffff) + (sum >> 16);
+    folded = be16_to_cpu(sum);
+
+    /* A chunk starting at an odd offset has its bytes swapped */
+    return seq & 1 ? bswap16(folded) : folded;
 }
 
 uint16_t net_checksum_finish(uint32_t sum)
@@ -206,3 +219,31 @@ net_checksum_add_iov(const struct iovec *iov, const unsigned int iov_cnt,
     }
     return res;
 }
+
+/* The 32 bits of the key starting at bit @bit, most significant first */
+static uint32_t net_toeplitz_window(const uint8_t *key, unsigned int bit)
+{
+    uint64_t window = ((uint64_t)ldl_be_p(key + bit / 8) << 8) |
+                      key[bit / 8 + 4];
+
+    return window >> (8 - bit % 8);
+}
+
+void net_toeplitz_table_init(net_toeplitz_table *table,
+                             const uint8_t *key_bytes)
+{
+    unsigned int n, value, bit;
+
+    for (n = 0; n < ARRAY_SIZE(table->nibble); n++) {
+        for (value = 0; value < 16; value++) {
+            uint32_t result = 0;
+
+            for (bit = 0; bit < 4; bit++) {
+                if (value & (8 >> bit)) {
+                    result ^= net_toeplitz_window(key_bytes, n * 4 + bit);
+                }
+            }
+            table->nibble[n][value] = result;
+        }
+    }
+}
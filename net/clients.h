@@ -69,6 +69,11 @@ int net_init_af_xdp(const Netdev *netdev, const char *name,
                     NetClientState *peer, Error **errp);
 #endif
 
+#ifdef CONFIG_POSIX
+int net_init_shm(const Netdev *netdev, const char *name,
+                 NetClientState *peer, Error **errp);
+#endif
+
 int net_init_vhost_user(const Netdev *netdev, const char *name,
                         NetClientState *peer, Error **errp);
 
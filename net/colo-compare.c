@@ -729,35 +729,27 @@ static void coroutine_fn _compare_chr_send(void *opaque)
     int ret = 0;
 
     while (!g_queue_is_empty(&sendco->send_list)) {
-        SendEntry *entry = g_queue_pop_tail(&sendco->send_list);
-        uint32_t len = htonl(entry->size);
+        SendEntry *entry = g_queue_pop_head(&sendco->send_list);
+        uint32_t hdr[2] = { htonl(entry->size), htonl(entry->vnet_hdr_len) };
+        int hdr_len = sizeof(hdr[0]);
+
+        /*
+         * We send vnet header len make other module(like filter-redirector)
+         * know how to parse net packet correctly.  Both lengths go out
+         * in a single write, this runs once per released packet.
+         */
+        if (!sendco->notify_remote_frame && s->vnet_hdr) {
+            hdr_len = sizeof(hdr);
+        }
 
-        ret = qemu_chr_fe_write_all(sendco->chr, (uint8_t *)&len, sizeof(len));
+        ret = qemu_chr_fe_write_all(sendco->chr, (uint8_t *)hdr, hdr_len);
 
-        if (ret != sizeof(len)) {
+        if (ret != hdr_len) {
             g_free(entry->buf);
             g_slice_free(SendEntry, entry);
             goto err;
         }
 
-        if (!sendco->notify_remote_frame && s->vnet_hdr) {
-            /*
-             * We send vnet header len make other module(like filter-redirector)
-             * know how to parse net packet correctly.
-             */
-            len = htonl(entry->vnet_hdr_len);
-
-            ret = qemu_chr_fe_write_all(sendco->chr,
-                                        (uint8_t *)&len,
-                                        sizeof(len));
-
-            if (ret != sizeof(len)) {
-                g_free(entry->buf);
-                g_slice_free(SendEntry, entry);
-                goto err;
-            }
-        }
-
         ret = qemu_chr_fe_write_all(sendco->chr,
                                     (uint8_t *)entry->buf,
                                     entry->size);
@@ -27,7 +27,9 @@
 #include "qapi/error.h"
 #include "qemu/error-report.h"
 #include "qemu/iov.h"
+#include "qemu/lockable.h"
 #include "qemu/module.h"
+#include "qemu/thread.h"
 #include "qemu/timer.h"
 #include "qapi/visitor.h"
 #include "net/filter.h"
@@ -38,8 +40,27 @@ typedef struct DumpState {
     int64_t start_ts;
     int fd;
     int pcap_caplen;
+
+    /*
+     * With a buffer, packets are appended to @buf and a thread writes the
+     * buffer out while the other one, @flush_buf, is being filled.  The
+     * fields below are protected by @lock.
+     */
+    size_t buf_size;
+    uint8_t *buf;
+    size_t buf_len;
+    uint8_t *flush_buf;
+    size_t flush_len;
+    uint64_t dropped;
+    bool stop;
+    QemuThread thread;
+    QemuMutex lock;
+    QemuCond cond;
 } DumpState;
 
+/* Longest time a buffered packet waits before it is written out */
+#define DUMP_FLUSH_INTERVAL_MS 1000
+
 #define PCAP_MAGIC 0xa1b2c3d4
 
 struct pcap_file_hdr {
@@ -68,7 +89,7 @@ static ssize_t dump_receive_iov(DumpState *s, const struct iovec *iov, int cnt,
     int64_t ts;
     int caplen;
     size_t size = iov_size(iov, cnt) - offset;
-    g_autofree struct iovec *dumpiov = g_new(struct iovec, cnt + 1);
+    g_autofree struct iovec *dumpiov = NULL;
 
     /* Early return in case of previous error. */
     if (s->fd < 0) {
@@ -83,6 +104,28 @@ static ssize_t dump_receive_iov(DumpState *s, const struct iovec *iov, int cnt,
     hdr.caplen = caplen;
     hdr.len = size;
 
+    if (s->buf) {
+        QEMU_LOCK_GUARD(&s->lock);
+
+        if (s->stop) {
+            return size;
+        }
+        if (s->buf_len + sizeof(hdr) + caplen > s->buf_size) {
+            /* The thread is still writing the other buffer out */
+            s->dropped++;
+            return size;
+        }
+        memcpy(s->buf + s->buf_len, &hdr, sizeof(hdr));
+        iov_to_buf(iov, cnt, offset, s->buf + s->buf_len + sizeof(hdr),
+                   caplen);
+        s->buf_len += sizeof(hdr) + caplen;
+        if (s->buf_len >= s->buf_size / 2 && !s->flush_len) {
+            qemu_cond_signal(&s->cond);
+        }
+        return size;
+    }
+
+    dumpiov = g_new(struct iovec, cnt + 1);
     dumpiov[0].iov_base = &hdr;
     dumpiov[0].iov_len = sizeof(hdr);
     cnt = iov_copy(&dumpiov[1], cnt, iov, cnt, offset, caplen);
@@ -96,12 +139,81 @@ static ssize_t dump_receive_iov(DumpState *s, const struct iovec *iov, int cnt,
     return size;
 }
 
+static void *dump_thread(void *opaque)
+{
+    DumpState *s = opaque;
+    uint8_t *buf;
+    size_t len;
+    bool stop;
+
+    qemu_mutex_lock(&s->lock);
+    do {
+        if (!s->stop && s->buf_len < s->buf_size / 2) {
+            qemu_cond_timedwait(&s->cond, &s->lock, DUMP_FLUSH_INTERVAL_MS);
+        }
+        stop = s->stop;
+        if (!s->buf_len) {
+            continue;
+        }
+
+        buf = s->buf;
+        len = s->buf_len;
+        s->buf = s->flush_buf;
+        s->buf_len = 0;
+        s->flush_buf = buf;
+        s->flush_len = len;
+        qemu_mutex_unlock(&s->lock);
+
+        if (write(s->fd, buf, len) != len) {
+            error_report("network dump write error - stopping dump");
+            stop = true;
+        }
+
+        qemu_mutex_lock(&s->lock);
+        s->flush_len = 0;
+    } while (!stop);
+
+    /* Drop the packets that come after a write error */
+    s->stop = true;
+    qemu_mutex_unlock(&s->lock);
+    return NULL;
+}
+
 static void dump_cleanup(DumpState *s)
 {
+    if (s->buf) {
+        qemu_mutex_lock(&s->lock);
+        s->stop = true;
+        qemu_cond_signal(&s->cond);
+        qemu_mutex_unlock(&s->lock);
+        qemu_thread_join(&s->thread);
+
+        if (s->dropped) {
+            warn_report("network dump dropped %" PRIu64 " packets, "
+                        "the buffer was too small", s->dropped);
+        }
+        g_free(s->buf);
+        g_free(s->flush_buf);
+        s->buf = s->flush_buf = NULL;
+        qemu_cond_destroy(&s->cond);
+        qemu_mutex_destroy(&s->lock);
+    }
     close(s->fd);
     s->fd = -1;
 }
 
+/* Write the packets out from a thread, with a buffer of @size bytes */
+static void net_dump_state_start_thread(DumpState *s, size_t size)
+{
+    s->buf_size = size;
+    s->buf = g_malloc(size);
+    s->flush_buf = g_malloc(size);
+    qemu_mutex_init(&s->lock);
+    qemu_cond_init(&s->cond);
+    qemu_thread_create(&s->thread, "filter-dump", dump_thread, s,
+                       QEMU_THREAD_JOINABLE);
+}
+
 static int net_dump_state_init(DumpState *s, const char *filename,
                                int len, Error **errp)
 {
@@ -147,6 +259,9 @@ struct NetFilterDumpState {
     DumpState ds;
     char *filename;
     uint32_t maxlen;
+    uint32_t buffer_size;
+    uint32_t sample;
+    uint32_t sample_count;
 };
 
 static ssize_t filter_dump_receive_iov(NetFilterState *nf, NetClientState *sndr,
@@ -157,6 +272,11 @@ static ssize_t filter_dump_receive_iov(NetFilterState *nf, NetClientState *sndr,
     int offset = qemu_get_using_vnet_hdr(nf->netdev) ?
                  qemu_get_vnet_hdr_len(nf->netdev) : 0;
 
+    if (++nfds->sample_count < nfds->sample) {
+        return 0;
+    }
+    nfds->sample_count = 0;
+
     dump_receive_iov(&nfds->ds, iov, iovcnt, offset);
     return 0;
 }
@@ -177,7 +297,20 @@ static void filter_dump_setup(NetFilterState *nf, Error **errp)
         return;
     }
 
-    net_dump_state_init(&nfds->ds, nfds->filename, nfds->maxlen, errp);
+    if (nfds->buffer_size && nfds->buffer_size < sizeof(struct pcap_sf_pkthdr)
+                                                 + nfds->maxlen) {
+        error_setg(errp, "dump filter 'buffer-size' must be at least "
+                   "'maxlen' plus %zu bytes", sizeof(struct pcap_sf_pkthdr));
+        return;
+    }
+
+    if (net_dump_state_init(&nfds->ds, nfds->filename, nfds->maxlen,
+                            errp) < 0) {
+        return;
+    }
+    if (nfds->buffer_size) {
+        net_dump_state_start_thread(&nfds->ds, nfds->buffer_size);
+    }
 }
 
 static void filter_dump_get_maxlen(Object *obj, Visitor *v, const char *name,
@@ -206,6 +339,55 @@ static void filter_dump_set_maxlen(Object *obj, Visitor *v, const char *name,
     nfds->maxlen = value;
 }
 
+static void filter_dump_get_buffer_size(Object *obj, Visitor *v,
+                                        const char *name, void *opaque,
+                                        Error **errp)
+{
+    NetFilterDumpState *nfds = FILTER_DUMP(obj);
+    uint32_t value = nfds->buffer_size;
+
+    visit_type_uint32(v, name, &value, errp);
+}
+
+static void filter_dump_set_buffer_size(Object *obj, Visitor *v,
+                                        const char *name, void *opaque,
+                                        Error **errp)
+{
+    NetFilterDumpState *nfds = FILTER_DUMP(obj);
+    uint32_t value;
+
+    if (!visit_type_uint32(v, name, &value, errp)) {
+        return;
+    }
+    nfds->buffer_size = value;
+}
+
+static void filter_dump_get_sample(Object *obj, Visitor *v, const char *name,
+                                   void *opaque, Error **errp)
+{
+    NetFilterDumpState *nfds = FILTER_DUMP(obj);
+    uint32_t value = nfds->sample;
+
+    visit_type_uint32(v, name, &value, errp);
+}
+
+static void filter_dump_set_sample(Object *obj, Visitor *v, const char *name,
+                                   void *opaque, Error **errp)
+{
+    NetFilterDumpState *nfds = FILTER_DUMP(obj);
+    uint32_t value;
+
+    if (!visit_type_uint32(v, name, &value, errp)) {
+        return;
+    }
+    if (value == 0) {
+        error_setg(errp, "Property '%s.%s' doesn't take value '%u'",
+                   object_get_typename(obj), name, value);
+        return;
+    }
+    nfds->sample = value;
+}
+
 static char *file_dump_get_filename(Object *obj, Error **errp)
 {
     NetFilterDumpState *nfds = FILTER_DUMP(obj);
@@ -226,6 +408,7 @@ static void filter_dump_instance_init(Object *obj)
     NetFilterDumpState *nfds = FILTER_DUMP(obj);
 
     nfds->maxlen = 65536;
+    nfds->sample = 1;
 }
 
 static void filter_dump_instance_finalize(Object *obj)
@@ -243,6 +426,11 @@ static void filter_dump_class_init(ObjectClass *oc, void *data)
                               filter_dump_set_maxlen, NULL, NULL);
     object_class_property_add_str(oc, "file", file_dump_get_filename,
                                   file_dump_set_filename);
+    object_class_property_add(oc, "buffer-size", "uint32",
+                              filter_dump_get_buffer_size,
+                              filter_dump_set_buffer_size, NULL, NULL);
+    object_class_property_add(oc, "sample", "uint32", filter_dump_get_sample,
+                              filter_dump_set_sample, NULL, NULL);
 
     nfc->setup = filter_dump_setup;
     nfc->cleanup = filter_dump_cleanup;
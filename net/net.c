@@ -1255,6 +1255,9 @@ static int (* const net_client_init_fun[NET_CLIENT_DRIVER__MAX])(
 #ifdef CONFIG_AF_XDP
         [NET_CLIENT_DRIVER_AF_XDP]    = net_init_af_xdp,
 #endif
+#ifdef CONFIG_POSIX
+        [NET_CLIENT_DRIVER_SHM]       = net_init_shm,
+#endif
 #ifdef CONFIG_NET_BRIDGE
         [NET_CLIENT_DRIVER_BRIDGE]    = net_init_bridge,
 #endif
@@ -1363,6 +1366,7 @@ void show_netdevs(void)
         "af-xdp",
 #endif
 #ifdef CONFIG_POSIX
+        "shm",
         "vhost-user",
 #endif
 #ifdef CONFIG_VHOST_VDPA
@@ -0,0 +1,374 @@
+/*
+ * Shared memory ring network backend
+ *
+ * Two QEMU instances on the same host exchange packets through a shared
+ * memory region, with one single-producer single-consumer ring per
+ * direction.  Notifications go through eventfds and are only sent when
+ * the other side is idle, so that a busy consumer is never woken up.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include <sys/mman.h>
+
+#include "clients.h"
+#include "monitor/monitor.h"
+#include "net/net.h"
+#include "qapi/error.h"
+#include "qemu/atomic.h"
+#include "qemu/bswap.h"
+#include "qemu/error-report.h"
+#include "qemu/event_notifier.h"
+#include "qemu/host-utils.h"
+#include "qemu/iov.h"
+#include "qemu/main-loop.h"
+#include "qemu/units.h"
+#include "trace.h"
+
+/*
+ * The shared memory is split in two halves, the ring of side 0 followed
+ * by the ring of side 1.  Each side produces on its own ring and consumes
+ * on the other one.  A ring is a header page followed by the data area,
+ * whose size is the largest power of two that fits in the half; both
+ * instances compute the same layout from the size of the shared memory.
+ *
+ * All of the memory starts zeroed, which is a valid empty ring.
+ */
+typedef struct ShmRingHdr {
+    /* Free-running byte offset of the next record, written by the producer */
+    uint32_t head QEMU_ALIGNED(64);
+    /* Free-running byte offset of the next unread record, by the consumer */
+    uint32_t tail QEMU_ALIGNED(64);
+    /* Set by the consumer before it waits for a notification */
+    uint32_t consumer_idle QEMU_ALIGNED(64);
+    /* Set by the producer when it waits for space */
+    uint32_t producer_waiting QEMU_ALIGNED(64);
+} ShmRingHdr;
+
+#define SHM_RING_HDR_SIZE 4096
+QEMU_BUILD_BUG_ON(sizeof(ShmRingHdr) > SHM_RING_HDR_SIZE);
+
+/*
+ * A record is the packet length followed by the packet, padded to
+ * SHM_RING_ALIGN bytes.  Records do not wrap: a record of length
+ * SHM_RING_PAD fills the end of the data area instead.
+ */
+#define SHM_RING_ALIGN 8
+#define SHM_RING_PAD UINT32_MAX
+
+/* Enough for a few packets of the maximum size */
+#define SHM_RING_MIN_SIZE (256 * KiB)
+
+typedef struct ShmRing {
+    ShmRingHdr *hdr;
+    uint8_t *data;
+} ShmRing;
+
+typedef struct ShmState {
+    NetClientState nc;
+    void *mem;
+    size_t mem_size;
+    /* Size of the data area of each ring, a power of two */
+    uint32_t ring_size;
+    /* Largest packet that is exchanged through the rings */
+    uint32_t max_len;
+    ShmRing tx;
+    ShmRing rx;
+    EventNotifier notifier;
+    EventNotifier peer_notifier;
+    bool read_poll;
+    bool tx_blocked;
+    /* Received packets are copied here, out of reach of the peer */
+    uint8_t buf[NET_BUFSIZE];
+} ShmState;
+
+static uint32_t shm_record_size(uint32_t len)
+{
+    return ROUND_UP(sizeof(uint32_t) + len, SHM_RING_ALIGN);
+}
+
+static void shm_kick_peer(ShmState *s, uint32_t *flag)
+{
+    /* Order the index update before reading the flag of the other side */
+    smp_mb();
+    if (qatomic_xchg(flag, 0)) {
+        event_notifier_set(&s->peer_notifier);
+    }
+}
+
+static ssize_t shm_receive_iov(NetClientState *nc,
+                               const struct iovec *iov, int iovcnt)
+{
+    ShmState *s = DO_UPCAST(ShmState, nc, nc);
+    ShmRingHdr *hdr = s->tx.hdr;
+    size_t size = iov_size(iov, iovcnt);
+    uint32_t rec, head, off, contig, need;
+
+    if (size > s->max_len) {
+        /* Can't transmit a packet this size, drop it */
+        return size;
+    }
+
+    rec = shm_record_size(size);
+    head = hdr->head;
+    off = head & (s->ring_size - 1);
+    contig = s->ring_size - off;
+    need = contig < rec ? contig + rec : rec;
+
+    if (s->ring_size - (head - qatomic_load_acquire(&hdr->tail)) < need) {
+        qatomic_set(&hdr->producer_waiting, 1);
+        smp_mb();
+        if (s->ring_size - (head - qatomic_load_acquire(&hdr->tail)) < need) {
+            /* Queued by the net layer, flushed when the peer makes room */
+            s->tx_blocked = true;
+            return 0;
+        }
+        qatomic_set(&hdr->producer_waiting, 0);
+    }
+
+    if (contig < rec) {
+        stl_he_p(s->tx.data + off, SHM_RING_PAD);
+        head += contig;
+        off = 0;
+    }
+    stl_he_p(s->tx.data + off, size);
+    iov_to_buf(iov, iovcnt, 0, s->tx.data + off + sizeof(uint32_t), size);
+
+    qatomic_store_release(&hdr->head, head + rec);
+    shm_kick_peer(s, &hdr->consumer_idle);
+    return size;
+}
+
+static ssize_t shm_receive(NetClientState *nc, const uint8_t *buf, size_t size)
+{
+    struct iovec iov = {
+        .iov_base = (void *)buf,
+        .iov_len = size,
+    };
+
+    return shm_receive_iov(nc, &iov, 1);
+}
+
+static void shm_send(ShmState *s);
+
+static void shm_send_completed(NetClientState *nc, ssize_t len)
+{
+    ShmState *s = DO_UPCAST(ShmState, nc, nc);
+
+    s->read_poll = true;
+    shm_send(s);
+}
+
+static void shm_ring_corrupted(ShmState *s)
+{
+    error_report_once("shm: %s: corrupted ring, discarding it", s->nc.name);
+}
+
+/*
+ * Pass the packets of the peer to our own peer, until the ring is empty.
+ *
+ * The peer can write to the ring at any time, so everything read from it
+ * is validated and each packet is copied before it is used.
+ */
+static void shm_send(ShmState *s)
+{
+    ShmRingHdr *hdr = s->rx.hdr;
+    uint32_t tail = hdr->tail;
+    uint32_t head, off, len;
+    unsigned int n = 0;
+
+    while (s->read_poll) {
+        head = qatomic_load_acquire(&hdr->head);
+        if (head == tail) {
+            /* Let the producer know that it has to notify us */
+            qatomic_set(&hdr->consumer_idle, 1);
+            smp_mb();
+            if (qatomic_read(&hdr->head) == tail) {
+                break;
+            }
+            qatomic_set(&hdr->consumer_idle, 0);
+            continue;
+        }
+        if (head - tail > s->ring_size) {
+            shm_ring_corrupted(s);
+            tail = head;
+        }
+
+        while (tail != head) {
+            off = tail & (s->ring_size - 1);
+            len = ldl_he_p(s->rx.data + off);
+            if (len == SHM_RING_PAD) {
+                if (s->ring_size - off > head - tail) {
+                    shm_ring_corrupted(s);
+                    tail = head;
+                    break;
+                }
+                tail += s->ring_size - off;
+                continue;
+            }
+            if (len > s->max_len || shm_record_size(len) > head - tail ||
+                off + sizeof(uint32_t) + len > s->ring_size) {
+                shm_ring_corrupted(s);
+                tail = head;
+                break;
+            }
+            memcpy(s->buf, s->rx.data + off + sizeof(uint32_t), len);
+
+            n++;
+            tail += shm_record_size(len);
+            if (!qemu_send_packet_async(&s->nc, s->buf, len,
+                                        shm_send_completed)) {
+                /*
+                 * The packet was copied to the queue of our peer, which
+                 * does not receive anymore.  Stop reading until
+                 * shm_send_completed().
+                 */
+                s->read_poll = false;
+                break;
+            }
+        }
+
+        qatomic_store_release(&hdr->tail, tail);
+        shm_kick_peer(s, &hdr->producer_waiting);
+    }
+
+    trace_net_shm_send(s, n);
+}
+
+static void shm_notified(void *opaque)
+{
+    ShmState *s = opaque;
+
+    event_notifier_test_and_clear(&s->notifier);
+
+    if (s->tx_blocked) {
+        s->tx_blocked = false;
+        qemu_flush_queued_packets(&s->nc);
+    }
+    shm_send(s);
+}
+
+static void shm_cleanup(NetClientState *nc)
+{
+    ShmState *s = DO_UPCAST(ShmState, nc, nc);
+
+    qemu_purge_queued_packets(nc);
+
+    if (s->mem) {
+        qemu_set_fd_handler(event_notifier_get_fd(&s->notifier),
+                            NULL, NULL, NULL);
+        munmap(s->mem, s->mem_size);
+        s->mem = NULL;
+    }
+    event_notifier_cleanup(&s->notifier);
+    event_notifier_cleanup(&s->peer_notifier);
+}
+
+static NetClientInfo net_shm_info = {
+    .type = NET_CLIENT_DRIVER_SHM,
+    .size = sizeof(ShmState),
+    .receive = shm_receive,
+    .receive_iov = shm_receive_iov,
+    .cleanup = shm_cleanup,
+};
+
+static int shm_map(ShmState *s, int fd, uint8_t side, Error **errp)
+{
+    size_t half;
+    uint8_t *ring[2];
+    struct stat st;
+
+    if (fstat(fd, &st) < 0) {
+        error_setg_errno(errp, errno, "failed to get the shared memory size");
+        return -1;
+    }
+
+    half = QEMU_ALIGN_DOWN(st.st_size / 2, qemu_real_host_page_size());
+    if (half < SHM_RING_HDR_SIZE + SHM_RING_MIN_SIZE) {
+        error_setg(errp, "shared memory of %" PRIi64 " bytes is too small, "
+                   "at least %zu bytes are needed", (int64_t)st.st_size,
+                   2 * (size_t)(SHM_RING_HDR_SIZE + SHM_RING_MIN_SIZE));
+        return -1;
+    }
+    s->ring_size = pow2floor(MIN(half - SHM_RING_HDR_SIZE, 1U << 30));
+    s->max_len = MIN(s->ring_size / 4, NET_BUFSIZE);
+
+    s->mem_size = 2 * half;
+    s->mem = mmap(NULL, s->mem_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                  fd, 0);
+    if (s->mem == MAP_FAILED) {
+        s->mem = NULL;
+        error_setg_errno(errp, errno, "failed to map the shared memory");
+        return -1;
+    }
+
+    ring[0] = s->mem;
+    ring[1] = ring[0] + half;
+    s->tx.hdr = (ShmRingHdr *)ring[side];
+    s->tx.data = ring[side] + SHM_RING_HDR_SIZE;
+    s->rx.hdr = (ShmRingHdr *)ring[!side];
+    s->rx.data = ring[!side] + SHM_RING_HDR_SIZE;
+    return 0;
+}
+
+/*
+ * The exported init function.
+ *
+ * ... -netdev shm,id=...,fd=...,notify-fd=...,peer-notify-fd=...,side=0|1
+ */
+int net_init_shm(const Netdev *netdev, const char *name,
+                 NetClientState *peer, Error **errp)
+{
+    const NetdevShmOptions *opts = &netdev->u.shm;
+    NetClientState *nc;
+    ShmState *s;
+    int fd, ret;
+
+    if (opts->side > 1) {
+        error_setg(errp, "'side' must be 0 or 1");
+        return -1;
+    }
+
+    nc = qemu_new_net_client(&net_shm_info, peer, "shm", name);
+    s = DO_UPCAST(ShmState, nc, nc);
+
+    fd = monitor_fd_param(monitor_cur(), opts->notify_fd, errp);
+    if (fd < 0) {
+        goto err;
+    }
+    event_notifier_init_fd(&s->notifier, fd);
+
+    fd = monitor_fd_param(monitor_cur(), opts->peer_notify_fd, errp);
+    if (fd < 0) {
+        goto err;
+    }
+    event_notifier_init_fd(&s->peer_notifier, fd);
+
+    fd = monitor_fd_param(monitor_cur(), opts->fd, errp);
+    if (fd < 0) {
+        goto err;
+    }
+    ret = shm_map(s, fd, opts->side, errp);
+    close(fd);
+    if (ret < 0) {
+        goto err;
+    }
+
+    qemu_set_info_str(nc, "shm side %d, %u bytes per ring", opts->side,
+                      s->ring_size);
+
+    g_unix_set_fd_nonblocking(event_notifier_get_fd(&s->notifier), true, NULL);
+    qemu_set_fd_handler(event_notifier_get_fd(&s->notifier),
+                        shm_notified, NULL, s);
+
+    /* Pick up what the peer sent before we started, and go idle */
+    s->read_poll = true;
+    shm_send(s);
+    return 0;
+
+err:
+    qemu_del_net_client(nc);
+    return -1;
+}
@@ -12,6 +12,7 @@
 #include "clients.h"
 #include "net/vhost_net.h"
 #include "net/vhost-user.h"
+#include "hw/virtio/vhost.h"
 #include "hw/virtio/vhost-user.h"
 #include "chardev/char-fe.h"
 #include "qapi/error.h"
@@ -26,6 +27,8 @@ typedef struct NetVhostUserState {
     CharBackend chr; /* only queue index 0 */
     VhostUserState *vhost_user;
     VHostNetState *vhost_net;
+    /* only queue index 0, kept across reconnections of the backend */
+    struct vhost_inflight *inflight;
     guint watch;
     uint64_t acked_features;
     bool started;
@@ -45,6 +48,13 @@ uint64_t vhost_user_get_acked_features(NetClientState *nc)
     return s->acked_features;
 }
 
+struct vhost_inflight *vhost_user_get_inflight(NetClientState *nc)
+{
+    NetVhostUserState *s = DO_UPCAST(NetVhostUserState, nc, nc);
+    assert(nc->info->type == NET_CLIENT_DRIVER_VHOST_USER);
+    return s->inflight;
+}
+
 void vhost_user_save_acked_features(NetClientState *nc)
 {
     NetVhostUserState *s;
@@ -172,6 +182,8 @@ static void net_vhost_user_cleanup(NetClientState *nc)
             s->watch = 0;
         }
         qemu_chr_fe_deinit(&s->chr, true);
+        vhost_dev_free_inflight(s->inflight);
+        g_clear_pointer(&s->inflight, g_free);
         if (s->vhost_user) {
             vhost_user_cleanup(s->vhost_user);
             g_free(s->vhost_user);
@@ -356,6 +368,7 @@ static int net_vhost_user_init(NetClientState *peer, const char *device,
                 error_report_err(err);
                 goto err;
             }
+            s->inflight = g_new0(struct vhost_inflight, 1);
         }
         s = DO_UPCAST(NetVhostUserState, nc, nc);
         s->vhost_user = user;
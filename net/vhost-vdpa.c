@@ -28,6 +28,7 @@
 #include "monitor/monitor.h"
 #include "migration/misc.h"
 #include "hw/virtio/vhost.h"
+#include "sysemu/iothread.h"
 #include "trace.h"
 
 /* Todo:need to add the multiqueue support here */
@@ -47,6 +48,9 @@ typedef struct VhostVDPAState {
     /* The device can isolate CVQ in its own ASID */
     bool cvq_isolated;
 
+    /* IOThread running the data shadow virtqueues, if any */
+    IOThread *svq_iothread;
+
     bool started;
 } VhostVDPAState;
 
@@ -57,6 +61,7 @@ typedef struct VhostVDPAState {
  */
 const int vdpa_feature_bits[] = {
     VIRTIO_F_ANY_LAYOUT,
+    VIRTIO_F_IN_ORDER,
     VIRTIO_F_IOMMU_PLATFORM,
     VIRTIO_F_NOTIFY_ON_EMPTY,
     VIRTIO_F_RING_PACKED,
@@ -236,6 +241,10 @@ static void vhost_vdpa_cleanup(NetClientState *nc)
         g_free(s->vhost_net);
         s->vhost_net = NULL;
     }
+    if (s->svq_iothread) {
+        iothread_destroy(s->svq_iothread);
+        s->svq_iothread = NULL;
+    }
     if (s->vhost_vdpa.index != 0) {
         return;
     }
@@ -602,10 +611,11 @@ out:
                                                    v->shared->iova_range.last);
     }
 
+    vhost_vdpa_iotlb_batch_begin_once(v->shared);
     r = vhost_vdpa_cvq_map_buf(&s->vhost_vdpa, s->cvq_cmd_out_buffer,
                                vhost_vdpa_net_cvq_cmd_page_len(), false);
     if (unlikely(r < 0)) {
-        return r;
+        goto out_batch;
     }
 
     r = vhost_vdpa_cvq_map_buf(&s->vhost_vdpa, s->status,
@@ -614,6 +624,8 @@ out:
         vhost_vdpa_cvq_unmap_buf(&s->vhost_vdpa, s->cvq_cmd_out_buffer);
     }
 
+out_batch:
+    vhost_vdpa_iotlb_batch_end_once(v->shared);
     return r;
 }
 
@@ -624,8 +636,10 @@ static void vhost_vdpa_net_cvq_stop(NetClientState *nc)
     assert(nc->info->type == NET_CLIENT_DRIVER_VHOST_VDPA);
 
     if (s->vhost_vdpa.shadow_vqs_enabled) {
+        vhost_vdpa_iotlb_batch_begin_once(s->vhost_vdpa.shared);
         vhost_vdpa_cvq_unmap_buf(&s->vhost_vdpa, s->cvq_cmd_out_buffer);
         vhost_vdpa_cvq_unmap_buf(&s->vhost_vdpa, s->status);
+        vhost_vdpa_iotlb_batch_end_once(s->vhost_vdpa.shared);
     }
 
     vhost_vdpa_net_client_stop(nc);
@@ -1848,6 +1862,18 @@ int net_init_vhost_vdpa(const Netdev *netdev, const char *name,
                                      iova_range, features, shared, errp);
         if (!ncs[i])
             goto err;
+
+        if (opts->x_svq_iothread) {
+            VhostVDPAState *s = DO_UPCAST(VhostVDPAState, nc, ncs[i]);
+            g_autofree char *id = g_strdup_printf("%s-svq%d", name, i);
+
+            s->svq_iothread = iothread_create(id, errp);
+            if (!s->svq_iothread) {
+                qemu_del_net_client(ncs[i]);
+                goto err;
+            }
+            s->vhost_vdpa.svq_ctx = iothread_get_aio_context(s->svq_iothread);
+        }
     }
 
     if (has_cvq) {
@@ -101,6 +101,24 @@ void qemu_plugin_register_vcpu_tb_exec_cb(struct qemu_plugin_tb *tb,
     }
 }
 
+void qemu_plugin_register_vcpu_tb_exec_cond_cb(struct qemu_plugin_tb *tb,
+                                               qemu_plugin_vcpu_udata_cb_t cb,
+                                               enum qemu_plugin_cb_flags flags,
+                                               enum qemu_plugin_cond cond,
+                                               qemu_plugin_u64 entry,
+                                               uint64_t imm,
+                                               void *udata)
+{
+    if (!tb->mem_only) {
+        int index = flags == QEMU_PLUGIN_CB_R_REGS ||
+                    flags == QEMU_PLUGIN_CB_RW_REGS ?
+                    PLUGIN_CB_REGULAR_R : PLUGIN_CB_REGULAR;
+
+        plugin_register_dyn_cond_cb__udata(&tb->cbs[index], cb, flags,
+                                           cond, entry, imm, udata);
+    }
+}
+
 void qemu_plugin_register_vcpu_tb_exec_inline_per_vcpu(
     struct qemu_plugin_tb *tb,
     enum qemu_plugin_op op,
@@ -128,6 +146,25 @@ void qemu_plugin_register_vcpu_insn_exec_cb(struct qemu_plugin_insn *insn,
     }
 }
 
+void qemu_plugin_register_vcpu_insn_exec_cond_cb(
+    struct qemu_plugin_insn *insn,
+    qemu_plugin_vcpu_udata_cb_t cb,
+    enum qemu_plugin_cb_flags flags,
+    enum qemu_plugin_cond cond,
+    qemu_plugin_u64 entry,
+    uint64_t imm,
+    void *udata)
+{
+    if (!insn->mem_only) {
+        int index = flags == QEMU_PLUGIN_CB_R_REGS ||
+                    flags == QEMU_PLUGIN_CB_RW_REGS ?
+                    PLUGIN_CB_REGULAR_R : PLUGIN_CB_REGULAR;
+
+        plugin_register_dyn_cond_cb__udata(&insn->cbs[PLUGIN_CB_INSN][index],
+                                           cb, flags, cond, entry, imm, udata);
+    }
+}
+
 void qemu_plugin_register_vcpu_insn_exec_inline_per_vcpu(
     struct qemu_plugin_insn *insn,
     enum qemu_plugin_op op,
@@ -155,6 +192,111 @@ void qemu_plugin_register_vcpu_mem_cb(struct qemu_plugin_insn *insn,
                                 cb, flags, rw, udata);
 }
 
+struct qemu_plugin_mem_batch {
+    /* One PluginMemBatchBuf per vCPU */
+    struct qemu_plugin_scoreboard *bufs;
+    size_t capacity;
+    qemu_plugin_vcpu_mem_batch_cb_t cb;
+    void *userdata;
+};
+
+typedef struct PluginMemBatchBuf {
+    qemu_plugin_mem_access *accesses;
+    size_t len;
+} PluginMemBatchBuf;
+
+/* What an instrumented instruction records in, lives in the code cache */
+typedef struct PluginMemBatchInsn {
+    struct qemu_plugin_mem_batch *batch;
+    void *userdata;
+} PluginMemBatchInsn;
+
+struct qemu_plugin_mem_batch *
+qemu_plugin_mem_batch_new(size_t capacity,
+                          qemu_plugin_vcpu_mem_batch_cb_t cb,
+                          void *userdata)
+{
+    struct qemu_plugin_mem_batch *batch = g_new0(struct qemu_plugin_mem_batch,
+                                                 1);
+
+    g_assert(capacity > 0);
+    batch->bufs = plugin_scoreboard_new(sizeof(PluginMemBatchBuf));
+    batch->capacity = capacity;
+    batch->cb = cb;
+    batch->userdata = userdata;
+    return batch;
+}
+
+void qemu_plugin_mem_batch_flush(struct qemu_plugin_mem_batch *batch,
+                                 unsigned int vcpu_index)
+{
+    PluginMemBatchBuf *buf = qemu_plugin_scoreboard_find(batch->bufs,
+                                                         vcpu_index);
+
+    if (buf->len) {
+        batch->cb(vcpu_index, buf->accesses, buf->len, batch->userdata);
+        buf->len = 0;
+    }
+}
+
+void qemu_plugin_mem_batch_free(struct qemu_plugin_mem_batch *batch)
+{
+    for (int i = 0; i < plugin_num_vcpus(); i++) {
+        PluginMemBatchBuf *buf = qemu_plugin_scoreboard_find(batch->bufs, i);
+        g_free(buf->accesses);
+    }
+    plugin_scoreboard_free(batch->bufs);
+    g_free(batch);
+}
+
+static void plugin_vcpu_mem_batch_record(unsigned int vcpu_index,
+                                         qemu_plugin_meminfo_t info,
+                                         uint64_t vaddr, void *udata)
+{
+    PluginMemBatchInsn *insn = udata;
+    struct qemu_plugin_mem_batch *batch = insn->batch;
+    PluginMemBatchBuf *buf = qemu_plugin_scoreboard_find(batch->bufs,
+                                                         vcpu_index);
+    struct qemu_plugin_hwaddr *hwaddr = qemu_plugin_get_hwaddr(info, vaddr);
+    qemu_plugin_mem_access *access;
+
+    if (!buf->accesses) {
+        buf->accesses = g_new(qemu_plugin_mem_access, batch->capacity);
+    }
+    access = &buf->accesses[buf->len];
+    access->vaddr = vaddr;
+    access->paddr = hwaddr ? qemu_plugin_hwaddr_phys_addr(hwaddr) : vaddr;
+    access->userdata = insn->userdata;
+    access->info = info;
+    access->is_io = hwaddr && qemu_plugin_hwaddr_is_io(hwaddr);
+
+    if (++buf->len == batch->capacity) {
+        qemu_plugin_mem_batch_flush(batch, vcpu_index);
+    }
+}
+
+void qemu_plugin_register_vcpu_mem_batch(struct qemu_plugin_insn *insn,
+                                         enum qemu_plugin_mem_rw rw,
+                                         struct qemu_plugin_mem_batch *batch,
+                                         void *udata)
+{
+    GArray *arr = g_array_sized_new(false, false,
+                                    sizeof(PluginMemBatchInsn), 1);
+    PluginMemBatchInsn rec = {
+        .batch = batch,
+        .userdata = udata,
+    };
+
+    /* Freed with the other callback arrays when the code cache is flushed */
+    g_array_append_val(arr, rec);
+    qemu_plugin_add_dyn_cb_arr(arr);
+
+    plugin_register_vcpu_mem_cb(&insn->cbs[PLUGIN_CB_MEM][PLUGIN_CB_REGULAR],
+                                plugin_vcpu_mem_batch_record,
+                                QEMU_PLUGIN_CB_NO_REGS, rw,
+                                &g_array_index(arr, PluginMemBatchInsn, 0));
+}
+
 void qemu_plugin_register_vcpu_mem_inline_per_vcpu(
     struct qemu_plugin_insn *insn,
     enum qemu_plugin_mem_rw rw,
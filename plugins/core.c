@@ -346,6 +346,84 @@ void plugin_register_dyn_cb__udata(GArray **arr,
     dyn_cb->type = PLUGIN_CB_REGULAR;
 }
 
+static bool plugin_cond_check(enum qemu_plugin_cond cond,
+                              uint64_t a, uint64_t b)
+{
+    switch (cond) {
+    case QEMU_PLUGIN_COND_NEVER:
+        return false;
+    case QEMU_PLUGIN_COND_ALWAYS:
+        return true;
+    case QEMU_PLUGIN_COND_EQ:
+        return a == b;
+    case QEMU_PLUGIN_COND_NE:
+        return a != b;
+    case QEMU_PLUGIN_COND_LT:
+        return a < b;
+    case QEMU_PLUGIN_COND_LE:
+        return a <= b;
+    case QEMU_PLUGIN_COND_GT:
+        return a > b;
+    case QEMU_PLUGIN_COND_GE:
+        return a >= b;
+    default:
+        g_assert_not_reached();
+    }
+}
+
+static void plugin_vcpu_cond_cb(unsigned int vcpu_index, void *udata)
+{
+    struct qemu_plugin_dyn_cb *cb = udata;
+
+    if (plugin_cond_check(cb->cond.cond,
+                          qemu_plugin_u64_get(cb->cond.entry, vcpu_index),
+                          cb->cond.imm)) {
+        cb->f.vcpu_udata(vcpu_index, cb->userp);
+    }
+}
+
+/*
+ * The condition is evaluated before calling into the plugin, so that a
+ * plugin only pays for the executions it is interested in.  Like the
+ * memory callbacks, the description of the callback is referenced from
+ * the code cache and lives until it is flushed.
+ */
+void plugin_register_dyn_cond_cb__udata(GArray **arr,
+                                        qemu_plugin_vcpu_udata_cb_t cb,
+                                        enum qemu_plugin_cb_flags flags,
+                                        enum qemu_plugin_cond cond,
+                                        qemu_plugin_u64 entry,
+                                        uint64_t imm,
+                                        void *udata)
+{
+    struct qemu_plugin_dyn_cb *dyn_cb;
+    GArray *cond_arr;
+
+    switch (cond) {
+    case QEMU_PLUGIN_COND_NEVER:
+        return;
+    case QEMU_PLUGIN_COND_ALWAYS:
+        plugin_register_dyn_cb__udata(arr, cb, flags, udata);
+        return;
+    default:
+        break;
+    }
+
+    cond_arr = g_array_sized_new(false, true,
+                                 sizeof(struct qemu_plugin_dyn_cb), 1);
+    g_array_set_size(cond_arr, 1);
+    dyn_cb = &g_array_index(cond_arr, struct qemu_plugin_dyn_cb, 0);
+    dyn_cb->userp = udata;
+    dyn_cb->f.vcpu_udata = cb;
+    dyn_cb->type = PLUGIN_CB_REGULAR;
+    dyn_cb->cond.entry = entry;
+    dyn_cb->cond.cond = cond;
+    dyn_cb->cond.imm = imm;
+    qemu_plugin_add_dyn_cb_arr(cond_arr);
+
+    plugin_register_dyn_cb__udata(arr, plugin_vcpu_cond_cb, flags, dyn_cb);
+}
+
 void plugin_register_vcpu_mem_cb(GArray **arr,
                                  void *cb,
                                  enum qemu_plugin_cb_flags flags,
@@ -86,6 +86,11 @@ enum {
     OPTION_BITMAPS = 275,
     OPTION_FORCE = 276,
     OPTION_SKIP_BROKEN = 277,
+    OPTION_COMPRESS_THREADS = 278,
+    OPTION_RANDOM = 279,
+    OPTION_WRITE_PERCENT = 280,
+    OPTION_THREADS = 281,
+    OPTION_BITMAP = 282,
 };
 
 typedef enum OutputFormat {
@@ -207,6 +212,15 @@ void help(void)
            "  '-m' specifies how many coroutines work in parallel during the convert\n"
            "       process (defaults to 8)\n"
            "  '-W' allow to write to the target out of order rather than sequential\n"
+           "  '--compress-threads' specifies how many threads compress the clusters of\n"
+           "       a new qcow2 target in parallel (defaults to the number of host CPUs)\n"
+           "\n"
+           "Parameters to commit subcommand:\n"
+           "  '--bitmap' only commits the clusters that are dirty in this bitmap\n"
+           "\n"
+           "Parameters to rebase subcommand:\n"
+           "  '-m' specifies how many coroutines work in parallel during the rebase\n"
+           "       process (defaults to 8)\n"
            "\n"
            "Parameters to snapshot subcommand:\n"
            "  'snapshot' is the name of the snapshot to create, apply or delete\n"
@@ -951,9 +965,10 @@ static void run_block_job(BlockJob *job, Error **errp)
 static int img_commit(int argc, char **argv)
 {
     int c, ret, flags;
-    const char *filename, *fmt, *cache, *base;
+    const char *filename, *fmt, *cache, *base, *bitmap_name = NULL;
     BlockBackend *blk;
     BlockDriverState *bs, *base_bs;
+    BdrvDirtyBitmap *bitmap = NULL;
     BlockJob *job;
     bool progress = false, quiet = false, drop = false;
     bool writethrough;
@@ -970,6 +985,7 @@ static int img_commit(int argc, char **argv)
             {"help", no_argument, 0, 'h'},
             {"object", required_argument, 0, OPTION_OBJECT},
             {"image-opts", no_argument, 0, OPTION_IMAGE_OPTS},
+            {"bitmap", required_argument, 0, OPTION_BITMAP},
             {0, 0, 0, 0}
         };
         c = getopt_long(argc, argv, ":f:ht:b:dpqr:",
@@ -1019,6 +1035,9 @@ static int img_commit(int argc, char **argv)
         case OPTION_IMAGE_OPTS:
             image_opts = true;
             break;
+        case OPTION_BITMAP:
+            bitmap_name = optarg;
+            break;
         }
     }
 
@@ -1032,6 +1051,12 @@ static int img_commit(int argc, char **argv)
     }
     filename = argv[optind++];
 
+    /* Emptying the image would drop the clusters that were not committed */
+    if (bitmap_name && !drop) {
+        error_report("--bitmap requires -d or -b");
+        return 1;
+    }
+
     flags = BDRV_O_RDWR | BDRV_O_UNMAP;
     ret = bdrv_parse_cache_mode(cache, &flags, &writethrough);
     if (ret < 0) {
@@ -1072,23 +1097,36 @@ static int img_commit(int argc, char **argv)
     }
     bdrv_graph_rdunlock_main_loop();
 
+    if (bitmap_name) {
+        bitmap = bdrv_find_dirty_bitmap(bs, bitmap_name);
+        if (!bitmap) {
+            error_setg(&local_err, "Bitmap '%s' not found in '%s'",
+                       bitmap_name, filename);
+            goto done;
+        }
+        if (bdrv_dirty_bitmap_check(bitmap, BDRV_BITMAP_DEFAULT,
+                                    &local_err)) {
+            goto done;
+        }
+    }
+
     cbi = (CommonBlockJobCBInfo){
         .errp = &local_err,
         .bs   = bs,
     };
 
     commit_active_start("commit", bs, base_bs, JOB_DEFAULT, rate_limit,
-                        BLOCKDEV_ON_ERROR_REPORT, NULL, common_block_job_cb,
-                        &cbi, false, &local_err);
+                        BLOCKDEV_ON_ERROR_REPORT, NULL, bitmap,
+                        common_block_job_cb, &cbi, false, &local_err);
     if (local_err) {
         goto done;
     }
 
     /* When the block job completes, the BlockBackend reference will point to
      * the old backing file. In order to avoid that the top image is already
-     * deleted, so we can still empty it afterwards, increment the reference
-     * counter here preemptively. */
-    if (!drop) {
+     * deleted, so we can still empty it or clear its bitmap afterwards,
+     * increment the reference counter here preemptively. */
+    if (!drop || bitmap) {
         bdrv_ref(bs);
     }
 
@@ -1099,6 +1137,11 @@ static int img_commit(int argc, char **argv)
         goto unref_backing;
     }
 
+    if (bitmap) {
+        /* The next commit only needs what changes from now on */
+        bdrv_clear_dirty_bitmap(bitmap, NULL);
+    }
+
     if (!drop) {
         BlockBackend *old_backing_blk;
 
@@ -1118,7 +1161,7 @@ static int img_commit(int argc, char **argv)
     }
 
 unref_backing:
-    if (!drop) {
+    if (!drop || bitmap) {
         bdrv_unref(bs);
     }
 
@@ -1664,7 +1707,19 @@ enum ImgConvertBlockStatus {
     BLK_BACKING_FILE,
 };
 
+/* Block status of [start, end) as found by the scan before the copy */
+typedef struct ImgConvertExtent {
+    int64_t start;
+    int64_t end;
+    enum ImgConvertBlockStatus status;
+} ImgConvertExtent;
+
 #define MAX_COROUTINES 16
+/*
+ * Limit of compression threads, the maximum qcow2 accepts
+ * (QCOW2_MAX_COMPRESS_THREADS)
+ */
+#define MAX_COMPRESS_THREADS 64
 #define CONVERT_THROTTLE_GROUP "img_convert"
 
 typedef struct ImgConvertState {
@@ -1679,6 +1734,10 @@ typedef struct ImgConvertState {
     int64_t wr_offs;
     enum ImgConvertBlockStatus status;
     int64_t sector_next_status;
+    /* Allocation map of the source, recorded by the scan and then replayed */
+    GArray *extents;
+    bool extents_recorded;
+    guint next_extent;
     BlockBackend *target;
     bool has_zero_init;
     bool compressed;
@@ -1713,6 +1772,35 @@ static void convert_select_part(ImgConvertState *s, int64_t sector_num,
     }
 }
 
+/*
+ * Look up the status of @sector_num in the map recorded by the scan, and
+ * make it the current status.  The copy goes through the image in order,
+ * so the search starts from the extent found last time.
+ */
+static bool convert_lookup_extent(ImgConvertState *s, int64_t sector_num)
+{
+    ImgConvertExtent *e;
+
+    if (!s->extents_recorded) {
+        return false;
+    }
+
+    while (s->next_extent < s->extents->len) {
+        e = &g_array_index(s->extents, ImgConvertExtent, s->next_extent);
+        if (e->end > sector_num) {
+            if (e->start > sector_num) {
+                return false;
+            }
+            s->status = e->status;
+            s->sector_next_status = e->end;
+            return true;
+        }
+        s->next_extent++;
+    }
+
+    return false;
+}
+
 static int coroutine_mixed_fn GRAPH_RDLOCK
 convert_iteration_sectors(ImgConvertState *s, int64_t sector_num)
 {
@@ -1735,7 +1823,9 @@ convert_iteration_sectors(ImgConvertState *s, int64_t sector_num)
         }
     }
 
-    if (s->sector_next_status <= sector_num) {
+    /* During the copy, the status is normally known from the scan */
+    if (s->sector_next_status <= sector_num &&
+        !convert_lookup_extent(s, sector_num)) {
         uint64_t offset = (sector_num - src_cur_offset) * BDRV_SECTOR_SIZE;
         int64_t count;
         int tail;
@@ -1798,6 +1888,15 @@ convert_iteration_sectors(ImgConvertState *s, int64_t sector_num)
         }
 
         s->sector_next_status = sector_num + n;
+
+        if (!s->extents_recorded) {
+            ImgConvertExtent e = {
+                .start = sector_num,
+                .end = s->sector_next_status,
+                .status = s->status,
+            };
+            g_array_append_val(s->extents, e);
+        }
     }
 
     n = MIN(n, s->sector_next_status - sector_num);
@@ -1874,6 +1973,31 @@ static int coroutine_fn convert_co_read(ImgConvertState *s, int64_t sector_num,
 }
 
 
+/*
+ * Returns true if the first cluster of @buf contains data, false if it is
+ * zeroed, and sets *pnum to the number of sectors of the clusters that
+ * follow and are in the same state.  Compressed clusters are written as a
+ * whole, so only complete zero clusters can be skipped.
+ */
+static bool is_allocated_clusters(ImgConvertState *s, const uint8_t *buf,
+                                  int n, int *pnum)
+{
+    int cluster = s->cluster_sectors;
+    bool allocated = !buffer_is_zero(buf, MIN(n, cluster) * BDRV_SECTOR_SIZE);
+    int i;
+
+    for (i = cluster; i < n; i += cluster) {
+        if (allocated == buffer_is_zero(buf + i * BDRV_SECTOR_SIZE,
+                                        MIN(n - i, cluster) * BDRV_SECTOR_SIZE))
+        {
+            break;
+        }
+    }
+
+    *pnum = MIN(i, n);
+    return allocated;
+}
+
 static int coroutine_fn convert_co_write(ImgConvertState *s, int64_t sector_num,
                                          int nb_sectors, uint8_t *buf,
                                          enum ImgConvertBlockStatus status)
@@ -1897,14 +2021,14 @@ static int coroutine_fn convert_co_write(ImgConvertState *s, int64_t sector_num,
              * is real non-zero data, we must write it. Otherwise we can treat
              * it as zero sectors.
              * Compressed clusters need to be written as a whole, so in that
-             * case we can only save the write if the buffer is completely
-             * zeroed. */
+             * case we can only save the write of completely zeroed
+             * clusters. */
             if (!s->min_sparse ||
                 (!s->compressed &&
                  is_allocated_sectors_min(buf, n, &n, s->min_sparse,
                                           sector_num, s->alignment)) ||
                 (s->compressed &&
-                 !buffer_is_zero(buf, n * BDRV_SECTOR_SIZE)))
+                 is_allocated_clusters(s, buf, n, &n)))
             {
                 ret = blk_co_pwrite(s->target, sector_num << BDRV_SECTOR_BITS,
                                     n << BDRV_SECTOR_BITS, buf, flags);
@@ -2105,16 +2229,26 @@ static int convert_do_copy(ImgConvertState *s)
         bdrv_graph_rdunlock_main_loop();
     }
 
-    /* Allocate buffer for copied data. For compressed images, only one cluster
-     * can be copied at a time. */
+    /*
+     * Allocate buffer for copied data. For compressed images, copy whole
+     * clusters so that the target driver can compress several of them in
+     * parallel.
+     */
     if (s->compressed) {
         if (s->cluster_sectors <= 0 || s->cluster_sectors > s->buf_sectors) {
             error_report("invalid cluster size");
             return -EINVAL;
         }
-        s->buf_sectors = s->cluster_sectors;
+        s->buf_sectors = QEMU_ALIGN_DOWN(s->buf_sectors, s->cluster_sectors);
     }
 
+    /*
+     * Scan the whole allocation map of the source first, both to know how
+     * much there is to copy and so that copying never has to wait for the
+     * block status of the source, which can take a round trip per extent
+     * for network protocols.
+     */
+    s->extents = g_array_new(false, false, sizeof(ImgConvertExtent));
     while (sector_num < s->total_sectors) {
         bdrv_graph_rdlock_main_loop();
         n = convert_iteration_sectors(s, sector_num);
@@ -2131,6 +2265,7 @@ static int convert_do_copy(ImgConvertState *s)
 
     /* Do the copy */
     s->sector_next_status = 0;
+    s->extents_recorded = true;
     s->ret = -EINPROGRESS;
 
     qemu_co_mutex_init(&s->lock);
@@ -2254,6 +2389,7 @@ static int img_convert(int argc, char **argv)
     bool bitmaps = false;
     bool skip_broken = false;
     int64_t rate_limit = 0;
+    int64_t compress_threads = 0;
 
     ImgConvertState s = (ImgConvertState) {
         /* Need at least 4k of zeros for sparse detection */
@@ -2275,6 +2411,8 @@ static int img_convert(int argc, char **argv)
             {"target-is-zero", no_argument, 0, OPTION_TARGET_IS_ZERO},
             {"bitmaps", no_argument, 0, OPTION_BITMAPS},
             {"skip-broken-bitmaps", no_argument, 0, OPTION_SKIP_BROKEN},
+            {"compress-threads", required_argument, 0,
+             OPTION_COMPRESS_THREADS},
             {0, 0, 0, 0}
         };
         c = getopt_long(argc, argv, ":hf:O:B:CcF:o:l:S:pt:T:qnm:WUr:",
@@ -2409,6 +2547,15 @@ static int img_convert(int argc, char **argv)
         case OPTION_SKIP_BROKEN:
             skip_broken = true;
             break;
+        case OPTION_COMPRESS_THREADS:
+            if (qemu_strtoi64(optarg, NULL, 0, &compress_threads) ||
+                compress_threads < 1 ||
+                compress_threads > MAX_COMPRESS_THREADS) {
+                error_report("compress-threads must be between 1 and %d",
+                             MAX_COMPRESS_THREADS);
+                goto fail_getopt;
+            }
+            break;
         }
     }
 
@@ -2416,6 +2563,13 @@ static int img_convert(int argc, char **argv)
         out_fmt = "raw";
     }
 
+    if (compress_threads && (skip_create || strcmp(out_fmt, "qcow2"))) {
+        error_report("--compress-threads is only supported when creating "
+                     "a qcow2 target, use the compress-threads option of "
+                     "the qcow2 driver with -n");
+        goto fail_getopt;
+    }
+
     if (skip_broken && !bitmaps) {
         error_report("Use of --skip-broken-bitmaps requires --bitmaps");
         goto fail_getopt;
@@ -2667,6 +2821,15 @@ static int img_convert(int argc, char **argv)
         open_opts = qdict_new();
         qemu_opt_foreach(opts, img_add_key_secrets, open_opts, &error_abort);
 
+        /* Compress in as many threads as there are CPUs unless told not to */
+        if (s.compressed && !compress_threads && !strcmp(out_fmt, "qcow2")) {
+            compress_threads = MIN(g_get_num_processors(),
+                                   MAX_COMPRESS_THREADS);
+        }
+        if (compress_threads) {
+            qdict_put_int(open_opts, "compress-threads", compress_threads);
+        }
+
         /* Create the new image */
         ret = bdrv_create(drv, out_filename, opts, &local_err);
         if (ret < 0) {
@@ -2807,6 +2970,9 @@ out:
     }
     g_free(s.src_sectors);
     g_free(s.src_alignment);
+    if (s.extents) {
+        g_array_free(s.extents, true);
+    }
 fail_getopt:
     qemu_opts_del(sn_opts);
     g_free(options);
@@ -3531,11 +3697,253 @@ static int img_snapshot(int argc, char **argv)
     return 0;
 }
 
+typedef struct ImgRebaseState {
+    BlockBackend *blk;
+    BlockBackend *blk_old_backing;
+    BlockBackend *blk_new_backing;
+    BlockDriverState *unfiltered_bs;
+    BlockDriverState *unfiltered_bs_cow;
+    BlockDriverState *prefix_chain_bs;
+    BdrvRequestFlags write_flags;
+    int64_t write_align;
+    int64_t size;
+    int64_t old_backing_size;
+    int64_t new_backing_size;
+
+    /* Protects offset, the start of the next region to look at */
+    CoMutex lock;
+    int64_t offset;
+    long num_coroutines;
+    int running_coroutines;
+    int ret;
+} ImgRebaseState;
+
+/*
+ * Find the next region starting at or after s->offset that is unallocated
+ * in the COW file and that may have changed between the old and new backing
+ * file, and claim it.  Returns its length, 0 at the end of the image or
+ * -errno on error.  Called with s->lock held.
+ */
+static int64_t coroutine_fn GRAPH_RDLOCK
+rebase_co_next_region(ImgRebaseState *s, int64_t *region_offset)
+{
+    int64_t offset = s->offset;
+    int64_t n = 0, n_alloc;
+    int ret;
+
+    for (; offset < s->size; offset += n) {
+        /* How many bytes can we handle with the next read? */
+        n = MIN(IO_BUF_SIZE, s->size - offset);
+
+        /* If the cluster is allocated, we don't need to take action */
+        ret = bdrv_co_is_allocated(s->unfiltered_bs, offset, n, &n);
+        if (ret < 0) {
+            return ret;
+        }
+        if (ret) {
+            continue;
+        }
+
+        if (s->prefix_chain_bs) {
+            int64_t bytes = n;
+
+            /*
+             * If cluster wasn't changed since prefix_chain, we don't need
+             * to take action
+             */
+            ret = bdrv_co_is_allocated_above(s->unfiltered_bs_cow,
+                                             s->prefix_chain_bs, false,
+                                             offset, n, &n);
+            if (ret < 0) {
+                return ret;
+            }
+            if (!ret && n) {
+                continue;
+            }
+            if (!n) {
+                /*
+                 * If we've reached EOF of the old backing, it means that
+                 * offsets beyond the old backing size were read as zeroes.
+                 * Now we will need to explicitly zero the cluster in
+                 * order to preserve that state after the rebase.
+                 */
+                n = bytes;
+            }
+        }
+        break;
+    }
+
+    if (offset >= s->size) {
+        s->offset = s->size;
+        return 0;
+    }
+
+    /*
+     * At this point we know that the region [offset; offset + n)
+     * is unallocated within the target image.  This region might be
+     * unaligned to the target image's (sub)cluster boundaries, as
+     * old backing may have smaller clusters (or have subclusters).
+     * We extend it to the aligned boundaries to avoid CoW on
+     * partial writes in blk_pwrite().  The part before @offset was
+     * skipped above and nobody else writes to it.
+     */
+    n += offset - QEMU_ALIGN_DOWN(offset, s->write_align);
+    offset = QEMU_ALIGN_DOWN(offset, s->write_align);
+    n += QEMU_ALIGN_UP(offset + n, s->write_align) - (offset + n);
+    n = MIN(n, s->size - offset);
+    assert(!bdrv_co_is_allocated(s->unfiltered_bs, offset, n, &n_alloc) &&
+           n_alloc == n);
+
+    s->offset = offset + n;
+    *region_offset = offset;
+    return n;
+}
+
+/*
+ * Compare the old and new backing file region by region and copy the data
+ * that differs into the COW file.  Several of these run in parallel; each
+ * claims the next region under s->lock and does its I/O outside of it.
+ */
+static void coroutine_fn rebase_co_do_copy(void *opaque)
+{
+    ImgRebaseState *s = opaque;
+    uint8_t *buf_old, *buf_new;
+    int ret;
+
+    s->running_coroutines++;
+
+    if (s->blk_old_backing && bdrv_opt_mem_align(blk_bs(s->blk_old_backing)) >
+        bdrv_opt_mem_align(blk_bs(s->blk))) {
+        buf_old = blk_blockalign(s->blk_old_backing, IO_BUF_SIZE);
+    } else {
+        buf_old = blk_blockalign(s->blk, IO_BUF_SIZE);
+    }
+    buf_new = blk_blockalign(s->blk_new_backing, IO_BUF_SIZE);
+
+    while (1) {
+        bool old_backing_eof = false;
+        int64_t offset = 0, n, n_old, n_new, written;
+
+        qemu_co_mutex_lock(&s->lock);
+        if (s->ret != -EINPROGRESS) {
+            qemu_co_mutex_unlock(&s->lock);
+            break;
+        }
+        WITH_GRAPH_RDLOCK_GUARD() {
+            n = rebase_co_next_region(s, &offset);
+        }
+        if (n < 0) {
+            error_report("error while reading image metadata: %s",
+                         strerror(-n));
+            s->ret = n;
+        }
+        if (s->size) {
+            qemu_progress_print(100.0 * s->offset / s->size, 0);
+        }
+        qemu_co_mutex_unlock(&s->lock);
+        if (n <= 0) {
+            break;
+        }
+
+        /*
+         * Much like with the target image, we'll try to read as much
+         * of the old and new backings as we can.
+         */
+        n_old = MIN(n, MAX(0, s->old_backing_size - offset));
+        n_new = MIN(n, MAX(0, s->new_backing_size - offset));
+
+        /*
+         * Read old and new backing file and take into consideration that
+         * backing files may be smaller than the COW image.
+         */
+        memset(buf_old + n_old, 0, n - n_old);
+        if (!n_old) {
+            old_backing_eof = true;
+        } else {
+            ret = blk_co_pread(s->blk_old_backing, offset, n_old, buf_old, 0);
+            if (ret < 0) {
+                error_report("error while reading from old backing file");
+                s->ret = ret;
+                break;
+            }
+        }
+
+        memset(buf_new + n_new, 0, n - n_new);
+        if (n_new) {
+            ret = blk_co_pread(s->blk_new_backing, offset, n_new, buf_new, 0);
+            if (ret < 0) {
+                error_report("error while reading from new backing file");
+                s->ret = ret;
+                break;
+            }
+        }
+
+        /* If they differ, we need to write to the COW file */
+        for (written = 0; written < n; ) {
+            int64_t pnum;
+
+            if (compare_buffers(buf_old + written, buf_new + written,
+                                n - written, s->write_align, &pnum))
+            {
+                /*
+                 * Old data that reads as zeroes does not need to be
+                 * written out, keep the COW file sparse instead.
+                 */
+                if (old_backing_eof ||
+                    (!(s->write_flags & BDRV_REQ_WRITE_COMPRESSED) &&
+                     buffer_is_zero(buf_old + written, pnum))) {
+                    ret = blk_co_pwrite_zeroes(s->blk, offset + written,
+                                               pnum, 0);
+                } else {
+                    assert(written + pnum <= IO_BUF_SIZE);
+                    ret = blk_co_pwrite(s->blk, offset + written, pnum,
+                                        buf_old + written, s->write_flags);
+                }
+                if (ret < 0) {
+                    error_report("Error while writing to COW image: %s",
+                                 strerror(-ret));
+                    s->ret = ret;
+                    break;
+                }
+            }
+
+            written += pnum;
+            if (offset + written >= s->old_backing_size) {
+                old_backing_eof = true;
+            }
+        }
+    }
+
+    qemu_vfree(buf_old);
+    qemu_vfree(buf_new);
+    s->running_coroutines--;
+    if (!s->running_coroutines && s->ret == -EINPROGRESS) {
+        s->ret = 0;
+    }
+}
+
+static int rebase_do_copy(ImgRebaseState *s)
+{
+    int i;
+
+    s->offset = 0;
+    s->ret = -EINPROGRESS;
+    qemu_co_mutex_init(&s->lock);
+    for (i = 0; i < s->num_coroutines; i++) {
+        Coroutine *co = qemu_coroutine_create(rebase_co_do_copy, s);
+        qemu_coroutine_enter(co);
+    }
+
+    while (s->running_coroutines) {
+        main_loop_wait(false);
+    }
+
+    return s->ret;
+}
+
 static int img_rebase(int argc, char **argv)
 {
     BlockBackend *blk = NULL, *blk_old_backing = NULL, *blk_new_backing = NULL;
-    uint8_t *buf_old = NULL;
-    uint8_t *buf_new = NULL;
     BlockDriverState *bs = NULL, *prefix_chain_bs = NULL;
     BlockDriverState *unfiltered_bs, *unfiltered_bs_cow;
     BlockDriverInfo bdi = {0};
@@ -3552,6 +3960,7 @@ static int img_rebase(int argc, char **argv)
     Error *local_err = NULL;
     bool image_opts = false;
     int64_t write_align;
+    long num_coroutines = 8;
 
     /* Parse commandline parameters */
     fmt = NULL;
@@ -3568,7 +3977,7 @@ static int img_rebase(int argc, char **argv)
             {"compress", no_argument, 0, 'c'},
             {0, 0, 0, 0}
         };
-        c = getopt_long(argc, argv, ":hf:F:b:upt:T:qUc",
+        c = getopt_long(argc, argv, ":hf:F:b:upt:T:qUcm:",
                         long_options, NULL);
         if (c == -1) {
             break;
@@ -3619,6 +4028,14 @@ static int img_rebase(int argc, char **argv)
         case 'c':
             compress = true;
             break;
+        case 'm':
+            if (qemu_strtol(optarg, NULL, 0, &num_coroutines) ||
+                num_coroutines < 1 || num_coroutines > MAX_COROUTINES) {
+                error_report("Invalid number of coroutines. Allowed number of"
+                             " coroutines is between 1 and %d", MAX_COROUTINES);
+                return 1;
+            }
+            break;
         }
     }
 
@@ -3803,177 +4220,51 @@ static int img_rebase(int argc, char **argv)
      * the image is the same as the original one at any time.
      */
     if (!unsafe) {
-        int64_t size;
-        int64_t old_backing_size = 0;
-        int64_t new_backing_size = 0;
-        uint64_t offset;
-        int64_t n, n_old = 0, n_new = 0;
-        float local_progress = 0;
-
-        if (blk_old_backing && bdrv_opt_mem_align(blk_bs(blk_old_backing)) >
-            bdrv_opt_mem_align(blk_bs(blk))) {
-            buf_old = blk_blockalign(blk_old_backing, IO_BUF_SIZE);
-        } else {
-            buf_old = blk_blockalign(blk, IO_BUF_SIZE);
-        }
-        buf_new = blk_blockalign(blk_new_backing, IO_BUF_SIZE);
+        ImgRebaseState state = {
+            .blk = blk,
+            .blk_old_backing = blk_old_backing,
+            .blk_new_backing = blk_new_backing,
+            .unfiltered_bs = unfiltered_bs,
+            .unfiltered_bs_cow = unfiltered_bs_cow,
+            .prefix_chain_bs = prefix_chain_bs,
+            .write_flags = write_flags,
+            .write_align = write_align,
+            .num_coroutines = num_coroutines,
+        };
 
-        size = blk_getlength(blk);
-        if (size < 0) {
+        state.size = blk_getlength(blk);
+        if (state.size < 0) {
             error_report("Could not get size of '%s': %s",
-                         filename, strerror(-size));
+                         filename, strerror(-state.size));
             ret = -1;
             goto out;
         }
         if (blk_old_backing) {
-            old_backing_size = blk_getlength(blk_old_backing);
-            if (old_backing_size < 0) {
+            state.old_backing_size = blk_getlength(blk_old_backing);
+            if (state.old_backing_size < 0) {
                 char backing_name[PATH_MAX];
 
                 bdrv_get_backing_filename(bs, backing_name,
                                           sizeof(backing_name));
                 error_report("Could not get size of '%s': %s",
-                             backing_name, strerror(-old_backing_size));
+                             backing_name, strerror(-state.old_backing_size));
                 ret = -1;
                 goto out;
             }
         }
         if (blk_new_backing) {
-            new_backing_size = blk_getlength(blk_new_backing);
-            if (new_backing_size < 0) {
+            state.new_backing_size = blk_getlength(blk_new_backing);
+            if (state.new_backing_size < 0) {
                 error_report("Could not get size of '%s': %s",
-                             out_baseimg, strerror(-new_backing_size));
+                             out_baseimg, strerror(-state.new_backing_size));
                 ret = -1;
                 goto out;
             }
         }
 
-        if (size != 0) {
-            local_progress = (float)100 / (size / MIN(size, IO_BUF_SIZE));
-        }
-
-        for (offset = 0; offset < size; offset += n) {
-            bool old_backing_eof = false;
-            int64_t n_alloc;
-
-            /* How many bytes can we handle with the next read? */
-            n = MIN(IO_BUF_SIZE, size - offset);
-
-            /* If the cluster is allocated, we don't need to take action */
-            ret = bdrv_is_allocated(unfiltered_bs, offset, n, &n);
-            if (ret < 0) {
-                error_report("error while reading image metadata: %s",
-                             strerror(-ret));
-                goto out;
-            }
-            if (ret) {
-                continue;
-            }
-
-            if (prefix_chain_bs) {
-                uint64_t bytes = n;
-
-                /*
-                 * If cluster wasn't changed since prefix_chain, we don't need
-                 * to take action
-                 */
-                ret = bdrv_is_allocated_above(unfiltered_bs_cow,
-                                              prefix_chain_bs, false,
-                                              offset, n, &n);
-                if (ret < 0) {
-                    error_report("error while reading image metadata: %s",
-                                 strerror(-ret));
-                    goto out;
-                }
-                if (!ret && n) {
-                    continue;
-                }
-                if (!n) {
-                    /*
-                     * If we've reached EOF of the old backing, it means that
-                     * offsets beyond the old backing size were read as zeroes.
-                     * Now we will need to explicitly zero the cluster in
-                     * order to preserve that state after the rebase.
-                     */
-                    n = bytes;
-                }
-            }
-
-            /*
-             * At this point we know that the region [offset; offset + n)
-             * is unallocated within the target image.  This region might be
-             * unaligned to the target image's (sub)cluster boundaries, as
-             * old backing may have smaller clusters (or have subclusters).
-             * We extend it to the aligned boundaries to avoid CoW on
-             * partial writes in blk_pwrite(),
-             */
-            n += offset - QEMU_ALIGN_DOWN(offset, write_align);
-            offset = QEMU_ALIGN_DOWN(offset, write_align);
-            n += QEMU_ALIGN_UP(offset + n, write_align) - (offset + n);
-            n = MIN(n, size - offset);
-            assert(!bdrv_is_allocated(unfiltered_bs, offset, n, &n_alloc) &&
-                   n_alloc == n);
-
-            /*
-             * Much like with the target image, we'll try to read as much
-             * of the old and new backings as we can.
-             */
-            n_old = MIN(n, MAX(0, old_backing_size - (int64_t) offset));
-            n_new = MIN(n, MAX(0, new_backing_size - (int64_t) offset));
-
-            /*
-             * Read old and new backing file and take into consideration that
-             * backing files may be smaller than the COW image.
-             */
-            memset(buf_old + n_old, 0, n - n_old);
-            if (!n_old) {
-                old_backing_eof = true;
-            } else {
-                ret = blk_pread(blk_old_backing, offset, n_old, buf_old, 0);
-                if (ret < 0) {
-                    error_report("error while reading from old backing file");
-                    goto out;
-                }
-            }
-
-            memset(buf_new + n_new, 0, n - n_new);
-            if (n_new) {
-                ret = blk_pread(blk_new_backing, offset, n_new, buf_new, 0);
-                if (ret < 0) {
-                    error_report("error while reading from new backing file");
-                    goto out;
-                }
-            }
-
-            /* If they differ, we need to write to the COW file */
-            uint64_t written = 0;
-
-            while (written < n) {
-                int64_t pnum;
-
-                if (compare_buffers(buf_old + written, buf_new + written,
-                                    n - written, write_align, &pnum))
-                {
-                    if (old_backing_eof) {
-                        ret = blk_pwrite_zeroes(blk, offset + written, pnum, 0);
-                    } else {
-                        assert(written + pnum <= IO_BUF_SIZE);
-                        ret = blk_pwrite(blk, offset + written, pnum,
-                                         buf_old + written, write_flags);
-                    }
-                    if (ret < 0) {
-                        error_report("Error while writing to COW image: %s",
-                            strerror(-ret));
-                        goto out;
-                    }
-                }
-
-                written += pnum;
-                if (offset + written >= old_backing_size) {
-                    old_backing_eof = true;
-                }
-            }
-            qemu_progress_print(local_progress, 100);
+        ret = rebase_do_copy(&state);
+        if (ret < 0) {
+            goto out;
         }
     }
 
@@ -4014,8 +4305,6 @@ out:
         blk_unref(blk_old_backing);
         blk_unref(blk_new_backing);
     }
-    qemu_vfree(buf_old);
-    qemu_vfree(buf_new);
 
     blk_unref(blk);
     if (ret) {
@@ -4410,10 +4699,39 @@ out_no_progress:
     return 0;
 }
 
-typedef struct BenchData {
+/*
+ * Latency histogram with 2^BENCH_HIST_SUB_BITS buckets per power of two
+ * nanoseconds, so that percentiles are accurate to about 3%.
+ */
+#define BENCH_HIST_SUB_BITS 5
+#define BENCH_HIST_BUCKETS \
+    ((64 - BENCH_HIST_SUB_BITS + 1) << BENCH_HIST_SUB_BITS)
+
+#define BENCH_MAX_THREADS 64
+
+typedef struct BenchStats {
+    uint64_t requests;
+    uint64_t total_ns;
+    uint64_t min_ns;
+    uint64_t max_ns;
+    uint64_t hist[BENCH_HIST_BUCKETS];
+} BenchStats;
+
+typedef struct BenchData BenchData;
+
+typedef struct BenchRequest {
+    BenchData *b;
+    QEMUIOVector qiov;
+    int64_t start_ns;
+    bool write;
+} BenchRequest;
+
+/* One thread submitting requests */
+struct BenchData {
     BlockBackend *blk;
     uint64_t image_size;
-    bool write;
+    int write_percent;
+    bool random;
     int bufsize;
     int step;
     int nrreq;
@@ -4421,21 +4739,166 @@ typedef struct BenchData {
     int flush_interval;
     bool drain_on_flush;
     uint8_t *buf;
-    QEMUIOVector *qiov;
+    BenchRequest *reqs;
+    BenchRequest **free_reqs;
+    int nr_free_reqs;
+
+    /* NULL for the main thread, which uses the main loop */
+    AioContext *ctx;
+    QemuThread thread;
+    GRand *rand;
 
     int in_flight;
     bool in_flush;
+    int flushes_in_flight;
     uint64_t offset;
-} BenchData;
 
-static void bench_undrained_flush_cb(void *opaque, int ret)
+    uint64_t flushes;
+    BenchStats read_stats;
+    BenchStats write_stats;
+};
+
+static int bench_hist_bucket(uint64_t ns)
+{
+    int shift;
+
+    if (ns < (1 << BENCH_HIST_SUB_BITS)) {
+        return ns;
+    }
+
+    shift = 63 - clz64(ns) - BENCH_HIST_SUB_BITS;
+    return ((shift + 1) << BENCH_HIST_SUB_BITS) +
+           ((ns >> shift) & ((1 << BENCH_HIST_SUB_BITS) - 1));
+}
+
+/* Middle of the range of latencies counted in @bucket */
+static uint64_t bench_hist_value(int bucket)
+{
+    int shift = (bucket >> BENCH_HIST_SUB_BITS) - 1;
+    uint64_t base;
+
+    if (shift < 0) {
+        return bucket;
+    }
+
+    base = (1ULL << BENCH_HIST_SUB_BITS) +
+           (bucket & ((1 << BENCH_HIST_SUB_BITS) - 1));
+    return (base << shift) + ((1ULL << shift) >> 1);
+}
+
+static void bench_stats_account(BenchStats *s, uint64_t ns)
+{
+    if (!s->requests || ns < s->min_ns) {
+        s->min_ns = ns;
+    }
+    s->max_ns = MAX(s->max_ns, ns);
+    s->total_ns += ns;
+    s->requests++;
+    s->hist[bench_hist_bucket(ns)]++;
+}
+
+static void bench_stats_merge(BenchStats *dst, const BenchStats *src)
+{
+    int i;
+
+    if (!src->requests) {
+        return;
+    }
+
+    if (!dst->requests || src->min_ns < dst->min_ns) {
+        dst->min_ns = src->min_ns;
+    }
+    dst->max_ns = MAX(dst->max_ns, src->max_ns);
+    dst->total_ns += src->total_ns;
+    dst->requests += src->requests;
+    for (i = 0; i < BENCH_HIST_BUCKETS; i++) {
+        dst->hist[i] += src->hist[i];
+    }
+}
+
+/* Latency that is not exceeded by @per_mille thousandths of the requests */
+static uint64_t bench_stats_percentile(const BenchStats *s, int per_mille)
+{
+    uint64_t target = DIV_ROUND_UP(s->requests * per_mille, 1000);
+    uint64_t seen = 0;
+    int i;
+
+    for (i = 0; i < BENCH_HIST_BUCKETS; i++) {
+        seen += s->hist[i];
+        if (seen >= target) {
+            break;
+        }
+    }
+
+    return MIN(MAX(bench_hist_value(i), s->min_ns), s->max_ns);
+}
+
+static BenchOpStats *bench_op_stats(const BenchStats *s, int bufsize,
+                                    double seconds)
+{
+    BenchOpStats *info;
+
+    if (!s->requests) {
+        return NULL;
+    }
+
+    info = g_new0(BenchOpStats, 1);
+    *info = (BenchOpStats) {
+        .requests   = s->requests,
+        .bytes      = s->requests * bufsize,
+        .iops       = s->requests / seconds,
+        .bandwidth  = s->requests * bufsize / seconds,
+        .min_ns     = s->min_ns,
+        .avg_ns     = s->total_ns / s->requests,
+        .max_ns     = s->max_ns,
+        .p50_ns     = bench_stats_percentile(s, 500),
+        .p99_ns     = bench_stats_percentile(s, 990),
+        .p999_ns    = bench_stats_percentile(s, 999),
+    };
+    return info;
+}
+
+static void bench_flush_done(BenchData *b, int ret)
 {
     if (ret < 0) {
         error_report("Failed flush request: %s", strerror(-ret));
         exit(EXIT_FAILURE);
     }
+    b->flushes_in_flight--;
+}
+
+static void bench_undrained_flush_cb(void *opaque, int ret)
+{
+    bench_flush_done(opaque, ret);
+}
+
+static uint64_t bench_next_offset(BenchData *b)
+{
+    uint64_t offset;
+
+    if (b->random) {
+        uint64_t r = ((uint64_t)g_rand_int(b->rand) << 32) |
+                     g_rand_int(b->rand);
+
+        return r % (b->image_size / b->bufsize) * b->bufsize;
+    }
+
+    offset = b->offset;
+    b->offset += b->step;
+    b->offset %= b->image_size;
+    return offset;
+}
+
+static bool bench_next_is_write(BenchData *b)
+{
+    if (b->write_percent == 0 || b->write_percent == 100) {
+        return b->write_percent;
+    }
+    return g_rand_int_range(b->rand, 0, 100) < b->write_percent;
 }
 
+static void bench_request_cb(void *opaque, int ret);
+
 static void bench_cb(void *opaque, int ret)
 {
     BenchData *b = opaque;
@@ -4450,6 +4913,7 @@ static void bench_cb(void *opaque, int ret)
         /* Just finished a flush with drained queue: Start next requests */
         assert(b->in_flight == 0);
         b->in_flush = false;
+        bench_flush_done(b, ret);
     } else if (b->in_flight > 0) {
         int remaining = b->n - b->in_flight;
 
@@ -4468,6 +4932,8 @@ static void bench_cb(void *opaque, int ret)
                     cb = bench_undrained_flush_cb;
                 }
 
+                b->flushes++;
+                b->flushes_in_flight++;
                 acb = blk_aio_flush(b->blk, cb, b);
                 if (!acb) {
                     error_report("Failed to issue flush request");
@@ -4481,18 +4947,22 @@ static void bench_cb(void *opaque, int ret)
     }
 
     while (b->n > b->in_flight && b->in_flight < b->nrreq) {
-        int64_t offset = b->offset;
+        BenchRequest *req = b->free_reqs[--b->nr_free_reqs];
+        int64_t offset = bench_next_offset(b);
+
         /* blk_aio_* might look for completed I/Os and kick bench_cb
          * again, so make sure this operation is counted by in_flight
          * and b->offset is ready for the next submission.
          */
         b->in_flight++;
-        b->offset += b->step;
-        b->offset %= b->image_size;
-        if (b->write) {
-            acb = blk_aio_pwritev(b->blk, offset, b->qiov, 0, bench_cb, b);
+        req->write = bench_next_is_write(b);
+        req->start_ns = get_clock();
+        if (req->write) {
+            acb = blk_aio_pwritev(b->blk, offset, &req->qiov, 0,
+                                  bench_request_cb, req);
         } else {
-            acb = blk_aio_preadv(b->blk, offset, b->qiov, 0, bench_cb, b);
+            acb = blk_aio_preadv(b->blk, offset, &req->qiov, 0,
+                                 bench_request_cb, req);
         }
         if (!acb) {
             error_report("Failed to issue request");
@@ -4501,15 +4971,76 @@ static void bench_cb(void *opaque, int ret)
     }
 }
 
+static void bench_request_cb(void *opaque, int ret)
+{
+    BenchRequest *req = opaque;
+    BenchData *b = req->b;
+
+    bench_stats_account(req->write ? &b->write_stats : &b->read_stats,
+                        get_clock() - req->start_ns);
+    b->free_reqs[b->nr_free_reqs++] = req;
+    bench_cb(b, ret);
+}
+
+static bool bench_done(BenchData *b)
+{
+    return b->n == 0 && b->flushes_in_flight == 0;
+}
+
+/* Additional threads submit requests from their own AioContext */
+static void *bench_thread(void *opaque)
+{
+    BenchData *b = opaque;
+
+    rcu_register_thread();
+    qemu_set_current_aio_context(b->ctx);
+
+    bench_cb(b, 0);
+    while (!bench_done(b)) {
+        aio_poll(b->ctx, true);
+    }
+
+    rcu_unregister_thread();
+    return NULL;
+}
+
+static void dump_human_bench_stats(const char *name, BenchOpStats *s)
+{
+    printf("%s: %" PRId64 " requests, %.1f IOPS, %.1f MiB/s\n",
+           name, s->requests, s->iops, s->bandwidth / MiB);
+    printf("  latency (us): min %.1f, avg %.1f, p50 %.1f, p99 %.1f, "
+           "p99.9 %.1f, max %.1f\n",
+           s->min_ns / 1000.0, s->avg_ns / 1000.0, s->p50_ns / 1000.0,
+           s->p99_ns / 1000.0, s->p999_ns / 1000.0, s->max_ns / 1000.0);
+}
+
+static void dump_json_bench_info(BenchInfo *info)
+{
+    GString *str;
+    QObject *obj;
+    Visitor *v = qobject_output_visitor_new(&obj);
+
+    visit_type_BenchInfo(v, NULL, &info, &error_abort);
+    visit_complete(v, &obj);
+    str = qobject_to_json_pretty(obj, true);
+    assert(str != NULL);
+    printf("%s\n", str->str);
+    qobject_unref(obj);
+    visit_free(v);
+    g_string_free(str, true);
+}
+
 static int img_bench(int argc, char **argv)
 {
     int c, ret = 0;
     const char *fmt = NULL, *filename;
     bool quiet = false;
     bool image_opts = false;
-    bool is_write = false;
+    int write_percent = 0;
+    bool random_offsets = false;
     int count = 75000;
     int depth = 64;
+    int nr_threads = 1;
     int64_t offset = 0;
     size_t bufsize = 4096;
     int pattern = 0;
@@ -4518,11 +5049,15 @@ static int img_bench(int argc, char **argv)
     bool drain_on_flush = true;
     int64_t image_size;
     BlockBackend *blk = NULL;
-    BenchData data = {};
+    BenchData *data = NULL;
+    BenchStats *read_stats = NULL, *write_stats = NULL;
+    BenchInfo *info = NULL;
+    const char *output = NULL;
+    OutputFormat output_format = OFORMAT_HUMAN;
     int flags = 0;
     bool writethrough = false;
-    struct timeval t1, t2;
-    int i;
+    int64_t t1, t2;
+    int i, j;
     bool force_share = false;
     size_t buf_size = 0;
 
@@ -4534,6 +5069,10 @@ static int img_bench(int argc, char **argv)
             {"pattern", required_argument, 0, OPTION_PATTERN},
             {"no-drain", no_argument, 0, OPTION_NO_DRAIN},
             {"force-share", no_argument, 0, 'U'},
+            {"random", no_argument, 0, OPTION_RANDOM},
+            {"write-percent", required_argument, 0, OPTION_WRITE_PERCENT},
+            {"threads", required_argument, 0, OPTION_THREADS},
+            {"output", required_argument, 0, OPTION_OUTPUT},
             {0, 0, 0, 0}
         };
         c = getopt_long(argc, argv, ":hc:d:f:ni:o:qs:S:t:wU", long_options,
@@ -4633,8 +5172,7 @@ static int img_bench(int argc, char **argv)
             }
             break;
         case 'w':
-            flags |= BDRV_O_RDWR;
-            is_write = true;
+            write_percent = 100;
             break;
         case 'U':
             force_share = true;
@@ -4664,6 +5202,35 @@ static int img_bench(int argc, char **argv)
         case OPTION_NO_DRAIN:
             drain_on_flush = false;
             break;
+        case OPTION_RANDOM:
+            random_offsets = true;
+            break;
+        case OPTION_WRITE_PERCENT:
+        {
+            unsigned long res;
+
+            if (qemu_strtoul(optarg, NULL, 0, &res) < 0 || res > 100) {
+                error_report("Invalid write percentage specified");
+                return 1;
+            }
+            write_percent = res;
+            break;
+        }
+        case OPTION_THREADS:
+        {
+            unsigned long res;
+
+            if (qemu_strtoul(optarg, NULL, 0, &res) < 0 || res < 1 ||
+                res > BENCH_MAX_THREADS) {
+                error_report("Invalid number of threads specified");
+                return 1;
+            }
+            nr_threads = res;
+            break;
+        }
+        case OPTION_OUTPUT:
+            output = optarg;
+            break;
         case OPTION_IMAGE_OPTS:
             image_opts = true;
             break;
@@ -4675,7 +5242,16 @@ static int img_bench(int argc, char **argv)
     }
     filename = argv[argc - 1];
 
-    if (!is_write && flush_interval) {
+    if (output && !strcmp(output, "json")) {
+        output_format = OFORMAT_JSON;
+    } else if (output && !strcmp(output, "human")) {
+        output_format = OFORMAT_HUMAN;
+    } else if (output) {
+        error_report("--output must be used with human or json as argument.");
+        return 1;
+    }
+
+    if (!write_percent && flush_interval) {
         error_report("--flush-interval is only available in write tests");
         ret = -1;
         goto out;
@@ -4685,6 +5261,14 @@ static int img_bench(int argc, char **argv)
         ret = -1;
         goto out;
     }
+    if (random_offsets && (offset || step)) {
+        error_report("--random can't be used with -o or -S");
+        ret = -1;
+        goto out;
+    }
+    if (write_percent) {
+        flags |= BDRV_O_RDWR;
+    }
 
     blk = img_open(image_opts, filename, fmt, flags, writethrough, quiet,
                    force_share);
@@ -4698,57 +5282,139 @@ static int img_bench(int argc, char **argv)
         ret = image_size;
         goto out;
     }
+    if (random_offsets && image_size < bufsize) {
+        error_report("Image is smaller than the buffer size");
+        ret = -1;
+        goto out;
+    }
 
-    data = (BenchData) {
-        .blk            = blk,
-        .image_size     = image_size,
-        .bufsize        = bufsize,
-        .step           = step ?: bufsize,
-        .nrreq          = depth,
-        .n              = count,
-        .offset         = offset,
-        .write          = is_write,
-        .flush_interval = flush_interval,
-        .drain_on_flush = drain_on_flush,
-    };
-    printf("Sending %d %s requests, %d bytes each, %d in parallel "
-           "(starting at offset %" PRId64 ", step size %d)\n",
-           data.n, data.write ? "write" : "read", data.bufsize, data.nrreq,
-           data.offset, data.step);
-    if (flush_interval) {
-        printf("Sending flush every %d requests\n", flush_interval);
+    step = step ?: bufsize;
+    if (output_format == OFORMAT_HUMAN) {
+        printf("Sending %d %s requests, %zu bytes each, %d in parallel ",
+               count, write_percent == 100 ? "write" :
+                      write_percent ? "mixed" : "read",
+               bufsize, depth);
+        if (random_offsets) {
+            printf("(random offsets)\n");
+        } else {
+            printf("(starting at offset %" PRId64 ", step size %zu)\n",
+                   offset, step);
+        }
+        if (write_percent && write_percent < 100) {
+            printf("%d%% of the requests are writes\n", write_percent);
+        }
+        if (nr_threads > 1) {
+            printf("Submitting from %d threads\n", nr_threads);
+        }
+        if (flush_interval) {
+            printf("Sending flush every %d requests\n", flush_interval);
+        }
     }
 
-    buf_size = data.nrreq * data.bufsize;
-    data.buf = blk_blockalign(blk, buf_size);
-    memset(data.buf, pattern, data.nrreq * data.bufsize);
+    /*
+     * Each thread submits its share of the requests, with up to @depth of
+     * them in flight.  Sequential offsets are interleaved between them.
+     */
+    buf_size = depth * bufsize;
+    data = g_new0(BenchData, nr_threads);
+    for (i = 0; i < nr_threads; i++) {
+        BenchData *b = &data[i];
+
+        *b = (BenchData) {
+            .blk            = blk,
+            .image_size     = image_size,
+            .write_percent  = write_percent,
+            .random         = random_offsets,
+            .bufsize        = bufsize,
+            .step           = step * nr_threads,
+            .nrreq          = depth,
+            .n              = count / nr_threads + (i < count % nr_threads),
+            .offset         = offset + i * step,
+            .flush_interval = flush_interval,
+            .drain_on_flush = drain_on_flush,
+            .rand           = g_rand_new(),
+        };
 
-    blk_register_buf(blk, data.buf, buf_size, &error_fatal);
+        b->buf = blk_blockalign(blk, buf_size);
+        memset(b->buf, pattern, buf_size);
+        blk_register_buf(blk, b->buf, buf_size, &error_fatal);
 
-    data.qiov = g_new(QEMUIOVector, data.nrreq);
-    for (i = 0; i < data.nrreq; i++) {
-        qemu_iovec_init(&data.qiov[i], 1);
-        qemu_iovec_add(&data.qiov[i],
-                       data.buf + i * data.bufsize, data.bufsize);
+        b->reqs = g_new0(BenchRequest, depth);
+        b->free_reqs = g_new(BenchRequest *, depth);
+        for (j = 0; j < depth; j++) {
+            BenchRequest *req = &b->reqs[j];
+
+            req->b = b;
+            qemu_iovec_init(&req->qiov, 1);
+            qemu_iovec_add(&req->qiov, b->buf + j * bufsize, bufsize);
+            b->free_reqs[b->nr_free_reqs++] = req;
+        }
     }
 
-    gettimeofday(&t1, NULL);
-    bench_cb(&data, 0);
+    t1 = get_clock();
+    for (i = 1; i < nr_threads; i++) {
+        data[i].ctx = aio_context_new(&error_fatal);
+        qemu_thread_create(&data[i].thread, "bench", bench_thread, &data[i],
+                           QEMU_THREAD_JOINABLE);
+    }
 
-    while (data.n > 0) {
+    bench_cb(&data[0], 0);
+    while (!bench_done(&data[0])) {
         main_loop_wait(false);
     }
-    gettimeofday(&t2, NULL);
 
-    printf("Run completed in %3.3f seconds.\n",
-           (t2.tv_sec - t1.tv_sec)
-           + ((double)(t2.tv_usec - t1.tv_usec) / 1000000));
+    for (i = 1; i < nr_threads; i++) {
+        qemu_thread_join(&data[i].thread);
+    }
+    t2 = get_clock();
+
+    read_stats = g_new0(BenchStats, 1);
+    write_stats = g_new0(BenchStats, 1);
+    info = g_new0(BenchInfo, 1);
+    *info = (BenchInfo) {
+        .seconds    = (t2 - t1) / (double)NANOSECONDS_PER_SECOND,
+        .threads    = nr_threads,
+    };
+    for (i = 0; i < nr_threads; i++) {
+        bench_stats_merge(read_stats, &data[i].read_stats);
+        bench_stats_merge(write_stats, &data[i].write_stats);
+        info->flushes += data[i].flushes;
+    }
+    info->read = bench_op_stats(read_stats, bufsize, info->seconds);
+    info->write = bench_op_stats(write_stats, bufsize, info->seconds);
+
+    if (output_format == OFORMAT_JSON) {
+        dump_json_bench_info(info);
+    } else {
+        printf("Run completed in %3.3f seconds.\n", info->seconds);
+        if (info->read) {
+            dump_human_bench_stats("Read", info->read);
+        }
+        if (info->write) {
+            dump_human_bench_stats("Write", info->write);
+        }
+    }
 
 out:
-    if (data.buf) {
-        blk_unregister_buf(blk, data.buf, buf_size);
+    for (i = 0; data && i < nr_threads; i++) {
+        BenchData *b = &data[i];
+
+        for (j = 0; j < depth; j++) {
+            qemu_iovec_destroy(&b->reqs[j].qiov);
+        }
+        g_free(b->reqs);
+        g_free(b->free_reqs);
+        blk_unregister_buf(blk, b->buf, buf_size);
+        qemu_vfree(b->buf);
+        g_rand_free(b->rand);
+        if (b->ctx) {
+            aio_context_unref(b->ctx);
+        }
     }
-    qemu_vfree(data.buf);
+    g_free(data);
+    g_free(read_stats);
+    g_free(write_stats);
+    qapi_free_BenchInfo(info);
     blk_unref(blk);
 
     if (ret) {
@@ -221,6 +221,7 @@ static int qemu_nbd_client_list(SocketAddress *saddr, QCryptoTLSCreds *tls,
                 [NBD_FLAG_SEND_CACHE_BIT]           = "cache",
                 [NBD_FLAG_SEND_FAST_ZERO_BIT]       = "fast-zero",
                 [NBD_FLAG_BLOCK_STAT_PAYLOAD_BIT]   = "block-status-payload",
+                [NBD_FLAG_SEND_COPY_BIT]            = "copy",
             };
 
             printf("  size:  %" PRIu64 "\n", list[i].size);
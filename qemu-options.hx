@@ -32,6 +32,7 @@ DEF("machine", HAS_ARG, QEMU_OPTION_machine, \
     "                vmport=on|off|auto controls emulation of vmport (default: auto)\n"
     "                dump-guest-core=on|off include guest memory in a core dump (default=on)\n"
     "                mem-merge=on|off controls memory merge support (default: on)\n"
+    "                reset-ram=keep|discard|zero controls the content of guest RAM on reset (default: keep)\n"
     "                aes-key-wrap=on|off controls support for AES key wrapping (default=on)\n"
     "                dea-key-wrap=on|off controls support for DEA key wrapping (default=on)\n"
     "                suppress-vmdesc=on|off disables self-describing migration (default=off)\n"
@@ -79,6 +80,19 @@ SRST
         supported by the host, de-duplicates identical memory pages
         among VMs instances (enabled by default).
 
+    ``reset-ram=keep|discard|zero``
+        Controls what happens to the content of guest RAM when the guest
+        reboots or ``system_reset`` is issued, so that a VM can be
+        recycled for a new workload without being restarted. ``discard``
+        gives the memory back to the host, while ``zero`` clears it but
+        keeps it populated, including preallocated memory and huge
+        pages; ``discard`` behaves like ``zero`` when RAM discards are
+        disabled, for example by VFIO. The memory is cleared by up to
+        one thread per vCPU before devices are reset. Shared
+        ``memory-backend-file`` objects and virtio-mem devices are left
+        alone. Only use this with boards and firmware that are loaded
+        again on reset. The default is ``keep``.
+
     ``aes-key-wrap=on|off``
         Enables or disables AES key wrapping support on s390-ccw hosts.
         This feature controls whether AES wrapping keys will be created
@@ -185,9 +199,11 @@ DEF("accel", HAS_ARG, QEMU_OPTION_accel,
     "                kernel-irqchip=on|off|split controls accelerated irqchip support (default=on)\n"
     "                kvm-shadow-mem=size of KVM shadow MMU in bytes\n"
     "                one-insn-per-tb=on|off (one guest instruction per TCG translation block)\n"
+    "                profile=on|off (count TCG translation block executions)\n"
     "                split-wx=on|off (enable TCG split w^x mapping)\n"
     "                tb-size=n (TCG translation block cache size)\n"
     "                dirty-ring-size=n (KVM dirty ring GFN count, default 0)\n"
+    "                dirty-ring-reap-threads=n (threads reaping the KVM dirty rings, default 0)\n"
     "                eager-split-size=n (KVM Eager Page Split chunk size, default 0, disabled. ARM only)\n"
     "                notify-vmexit=run|internal-error|disable,notify-window=n (enable notify VM exit and set notify window, x86 only)\n"
     "                thread=single|multi (enable multi-threaded TCG)\n"
@@ -221,6 +237,13 @@ SRST
         can be useful in some situations, such as when trying to analyse
         the logs produced by the ``-d`` option.
 
+    ``profile=on|off``
+        Makes the TCG accelerator generate code that counts how many times
+        each translation block runs, how it exits and how many times each
+        helper is called.  The results are shown by ``info tb-profile``
+        in the monitor.  Profiling can also be started and stopped at run
+        time with the ``tb-profile`` monitor command.
+
     ``split-wx=on|off``
         Controls the use of split w^x mapping for the TCG code generation
         buffer. Some operating systems require this to be enabled, and in
@@ -248,6 +271,13 @@ SRST
         is disabled (dirty-ring-size=0).  When enabled, KVM will instead
         record dirty pages in a bitmap.
 
+    ``dirty-ring-reap-threads=n``
+        When the KVM dirty ring is used, it controls the number of threads
+        that reap the dirty rings of all the vCPUs in parallel during a
+        global dirty log sync.  This shortens the sync with a lot of vCPUs.
+        By default, the rings are reaped one after the other by the thread
+        requesting the sync (dirty-ring-reap-threads=0).
+
     ``eager-split-size=n``
         KVM implements dirty page logging at the PAGE_SIZE granularity and
         enabling dirty-logging on a huge-page requires breaking it into
@@ -2277,6 +2307,7 @@ DEF("spice", HAS_ARG, QEMU_OPTION_spice,
     "       [,jpeg-wan-compression=[auto|never|always]]\n"
     "       [,zlib-glz-wan-compression=[auto|never|always]]\n"
     "       [,streaming-video=[off|all|filter]][,disable-copy-paste=on|off]\n"
+    "       [,video-codecs=<encoder>:<codec>[;<encoder>:<codec>]]\n"
     "       [,disable-agent-file-xfer=on|off][,agent-mouse=[on|off]]\n"
     "       [,playback-compression=[on|off]][,seamless-migration=[on|off]]\n"
     "       [,gl=[on|off]][,rendernode=<file>]\n"
@@ -2357,6 +2388,15 @@ SRST
     ``streaming-video=[off|all|filter]``
         Configure video stream detection. Default is off.
 
+    ``video-codecs=<encoder>:<codec>[;<encoder>:<codec>]``
+        Provide the preferred order of the video encoders used for video
+        streams, for example ``gstreamer:h264;spice:mjpeg``. The
+        ``gstreamer`` encoders use whatever GStreamer elements are
+        available on the host, including hardware encoders such as VAAPI
+        or NVENC, and cut the bandwidth and CPU cost of streaming
+        compared to the default ``spice:mjpeg``. Only takes effect
+        together with ``streaming-video``.
+
     ``agent-mouse=[on|off]``
         Enable/disable passing mouse events via vdagent. Default is on.
 
@@ -2606,7 +2646,9 @@ SRST
         default. An adaptive encoding will try to detect frequently
         updated screen regions, and send updates in these regions using
         a lossy encoding (like JPEG). This can be really helpful to save
-        bandwidth when playing videos. Disabling adaptive encodings
+        bandwidth when playing videos. The JPEG quality is also lowered
+        while a client can't keep up with the updates, and raised again
+        when it catches up. Disabling adaptive encodings
         restores the original static behavior of encodings like Tight.
 
     ``share=[allow-exclusive|force-shared|ignore]``
@@ -2930,6 +2972,10 @@ DEF("netdev", HAS_ARG, QEMU_OPTION_netdev,
     "                use 'start-queue=m' to specify the first queue that should be used\n"
 #endif
 #ifdef CONFIG_POSIX
+    "-netdev shm,id=str,fd=h,notify-fd=h,peer-notify-fd=h,side=0|1\n"
+    "                connect to another QEMU instance through the shared memory\n"
+    "                given by 'fd', waiting on the eventfd 'notify-fd' and\n"
+    "                waking up the other instance with the eventfd 'peer-notify-fd'\n"
     "-netdev vhost-user,id=str,chardev=dev[,vhostforce=on|off]\n"
     "                configure a vhost-user network, backed by a chardev 'dev'\n"
 #endif
@@ -2978,7 +3024,7 @@ DEF("nic", HAS_ARG, QEMU_OPTION_nic,
     "af-xdp|"
 #endif
 #ifdef CONFIG_POSIX
-    "vhost-user|"
+    "shm|vhost-user|"
 #endif
 #ifdef CONFIG_VMNET
     "vmnet-host|vmnet-shared|vmnet-bridged|"
@@ -3480,6 +3526,29 @@ SRST
         |qemu_system| linux.img -device virtio-net-pci,netdev=n1 \\
             -netdev af-xdp,id=n1,ifname=eth0,queues=3,inhibit=on,sock-fds=15:16:17
 
+``-netdev shm,id=str,fd=h,notify-fd=h,peer-notify-fd=h,side=0|1``
+    Connect to another QEMU instance on the same host through shared
+    memory.  The memory given by 'fd', typically a memfd, holds one ring
+    per direction; the two instances map the same memory and use
+    different values for 'side'.  Each instance waits on its 'notify-fd'
+    eventfd and wakes up the other one by writing to the other instance's
+    eventfd, given as 'peer-notify-fd'.  Notifications are only sent when
+    the receiving instance has drained its ring.
+
+    The file descriptors are created by the management application and
+    passed to both instances, either inherited or with ``getfd``.
+
+    Example, with fd 9 being a memfd and fds 10 and 11 two eventfds:
+
+    .. parsed-literal::
+
+        # first instance
+        |qemu_system| linux.img -device virtio-net-pci,netdev=n1 \\
+            -netdev shm,id=n1,fd=9,notify-fd=10,peer-notify-fd=11,side=0
+        # second instance
+        |qemu_system| linux.img -device virtio-net-pci,netdev=n1 \\
+            -netdev shm,id=n1,fd=9,notify-fd=11,peer-notify-fd=10,side=1
+
 ``-netdev vhost-user,chardev=id[,vhostforce=on|off][,queues=n]``
     Establish a vhost-user netdev, backed by a chardev id. The chardev
     should be a unix domain socket backed one. The vhost-user uses a
@@ -3557,7 +3626,8 @@ DEF("chardev", HAS_ARG, QEMU_OPTION_chardev,
     "-chardev vc,id=id[[,width=width][,height=height]][[,cols=cols][,rows=rows]]\n"
     "         [,mux=on|off][,logfile=PATH][,logappend=on|off]\n"
     "-chardev ringbuf,id=id[,size=size][,logfile=PATH][,logappend=on|off]\n"
-    "-chardev file,id=id,path=path[,input-path=input-file][,mux=on|off][,logfile=PATH][,logappend=on|off]\n"
+    "-chardev file,id=id,path=path[,input-path=input-file][,async=on|off][,max-size=size]\n"
+    "         [,mux=on|off][,logfile=PATH][,logappend=on|off]\n"
     "-chardev pipe,id=id,path=path[,mux=on|off][,logfile=PATH][,logappend=on|off]\n"
 #ifdef _WIN32
     "-chardev console,id=id[,mux=on|off][,logfile=PATH][,logappend=on|off]\n"
@@ -3760,7 +3830,7 @@ The available backends are:
     Create a ring buffer with fixed size ``size``. size must be a power
     of two and defaults to ``64K``.
 
-``-chardev file,id=id,path=path[,input-path=input-path]``
+``-chardev file,id=id,path=path[,input-path=input-path][,async=on|off][,max-size=size]``
     Log all traffic received from the guest to a file.
 
     ``path`` specifies the path of the file to be opened. This file will
@@ -3773,6 +3843,15 @@ The available backends are:
 
     Note that ``input-path`` is not supported on Windows hosts.
 
+    If ``async`` is on, the output is buffered in memory and written to
+    the file by a separate thread, so that slow storage does not delay
+    the guest. Output that does not fit in the buffer is dropped.
+    ``async`` is not supported on Windows hosts.
+
+    ``max-size`` rotates the output file: once it reaches ``size``
+    bytes, it is renamed with a ``.1`` suffix, replacing any previous
+    one, and a new file is started. It requires ``async=on``.
+
 ``-chardev pipe,id=id,path=path``
     Create a two-way connection to the guest. The behaviour differs
     slightly between Windows hosts and other hosts:
@@ -5057,6 +5136,18 @@ SRST
     Enable synchronization profiling.
 ERST
 
+DEF("enable-startup-profile", 0, QEMU_OPTION_enable_startup_profile,
+    "-enable-startup-profile\n"
+    "                print how long each phase of startup took\n",
+    QEMU_ARCH_ALL)
+SRST
+``-enable-startup-profile``
+    When startup is complete, print to stderr how much wall-clock and
+    CPU time each initialization phase took, and how long each device
+    took to realize.  The same data is available at any time through
+    the ``x-query-startup-profile`` QMP command.
+ERST
+
 #if defined(CONFIG_TCG) && defined(CONFIG_LINUX)
 DEF("perfmap", 0, QEMU_OPTION_perfmap,
     "-perfmap        generate a /tmp/perf-${pid}.map file for perf\n",
@@ -5094,7 +5185,7 @@ SRST
     they are specified. Note that the 'id' property must be set. These
     objects are placed in the '/objects' path.
 
-    ``-object memory-backend-file,id=id,size=size,mem-path=dir,share=on|off,discard-data=on|off,merge=on|off,dump=on|off,prealloc=on|off,host-nodes=host-nodes,policy=default|preferred|bind|interleave,align=align,offset=offset,readonly=on|off,rom=on|off|auto``
+    ``-object memory-backend-file,id=id,size=size,mem-path=dir,share=on|off,discard-data=on|off,merge=on|off,dump=on|off,prealloc=on|off,prealloc-node-local=on|off,host-nodes=host-nodes,policy=default|preferred|bind|interleave,interleave-granularity=size,thp=defer|never|collapse,align=align,offset=offset,readonly=on|off,rom=on|off|auto``
         Creates a memory file backend object, which can be used to back
         the guest RAM with huge pages.
 
@@ -5156,6 +5247,32 @@ SRST
             interleave memory allocations across the given host node
             list
 
+        With the ``interleave`` policy, the ``interleave-granularity``
+        option sets the size of the chunks that are interleaved across
+        the host nodes, instead of single pages. It must be a multiple
+        of the page size of the memory.
+
+        The ``prealloc-node-local`` boolean option preallocates the
+        memory bound to each host node with threads running on that
+        node. Without ``interleave-granularity`` the threads run on any
+        of the host nodes. It cannot be combined with
+        ``prealloc-context``.
+
+        The ``thp`` option sets the use of transparent huge pages, which
+        is not applicable to memory backed by huge pages, to one of the
+        following values:
+
+        ``defer``
+            huge pages are used when available at page fault time, or
+            collapsed later in the background by the host (default)
+
+        ``never``
+            huge pages are not used
+
+        ``collapse``
+            like ``defer``, and with ``prealloc`` the preallocated
+            memory is collapsed into huge pages right away
+
         The ``align`` option specifies the base address alignment when
         QEMU mmap(2) ``mem-path``, and accepts common suffixes, eg
         ``2M``. Some backend store specified by ``mem-path`` requires an
@@ -5456,12 +5573,19 @@ SRST
         filter-redirector,id=f2,netdev=hn0,queue=rx,outdev=red1 -object
         filter-rewriter,id=rew0,netdev=hn0,queue=all
 
-    ``-object filter-dump,id=id,netdev=dev[,file=filename][,maxlen=len][,position=head|tail|id=<id>][,insert=behind|before]``
+    ``-object filter-dump,id=id,netdev=dev[,file=filename][,maxlen=len][,buffer-size=size][,sample=n][,position=head|tail|id=<id>][,insert=behind|before]``
         Dump the network traffic on netdev dev to the file specified by
         filename. At most len bytes (64k by default) per packet are
         stored. The file format is libpcap, so it can be analyzed with
         tools such as tcpdump or Wireshark.
 
+        By default each packet is written to the file as it passes
+        through the filter. With buffer-size, packets are instead
+        copied to a memory buffer of size bytes and written out by a
+        separate thread, at least once per second; packets that do not
+        fit in the buffer while it is being written are dropped.
+        sample=n stores only one of every n packets.
+
     ``-object colo-compare,id=id,primary_in=chardevid,secondary_in=chardevid,outdev=chardevid,iothread=id[,vnet_hdr_support][,notify_dev=id][,compare_timeout=@var{ms}][,expired_scan_cycle=@var{ms}][,max_queue_size=@var{size}]``
         Colo-compare gets packet from primary\_in chardevid and
         secondary\_in, then compare whether the payload of primary packet
@@ -5545,7 +5669,8 @@ SRST
         be used to reference this cryptodev backend from the
         ``virtio-crypto`` device. The queues parameter is optional,
         which specify the queue number of cryptodev backend, the default
-        of queues is 1.
+        of queues is 1. The operations of all queues run in the thread
+        pool of QEMU, small symmetric operations being batched together.
 
         .. parsed-literal::
 
@@ -5814,7 +5939,7 @@ SRST
 
             CN=laptop.example.com,O=Example Home,L=London,ST=London,C=GB
 
-    ``-object iothread,id=id,poll-max-ns=poll-max-ns,poll-grow=poll-grow,poll-shrink=poll-shrink,aio-max-batch=aio-max-batch``
+    ``-object iothread,id=id,poll-max-ns=poll-max-ns,poll-grow=poll-grow,poll-shrink=poll-shrink,poll-budget=poll-budget,aio-max-batch=aio-max-batch``
         Creates a dedicated event loop thread that devices can be
         assigned to. This is known as an IOThread. By default device
         emulation happens in vCPU threads or the main event loop thread.
@@ -5834,9 +5959,12 @@ SRST
         latency. Instead of entering a blocking system call to monitor
         file descriptors and then pay the cost of being woken up when an
         event occurs, the polling algorithm spins waiting for events for
-        a short time. The algorithm's default parameters are suitable
-        for many cases but can be adjusted based on knowledge of the
-        workload and/or host device latency.
+        a short time. The polling time is adapted separately for each
+        event source, and the thread polls as long as the busiest one
+        needs, so that idle devices do not keep it spinning. The
+        algorithm's default parameters are suitable for many cases but
+        can be adjusted based on knowledge of the workload and/or host
+        device latency.
 
         The ``poll-max-ns`` parameter is the maximum number of
         nanoseconds to busy wait for events. Polling can be disabled by
@@ -5850,6 +5978,10 @@ SRST
         the polling time when the algorithm detects it is spending too
         long polling without encountering events.
 
+        The ``poll-budget`` parameter is the maximum percentage of time
+        that the IOThread may spend busy waiting for events, measured
+        over windows of 100 milliseconds. 0, the default, means no limit.
+
         The ``aio-max-batch`` parameter is the maximum number of requests
         in a batch for the AIO engine, 0 means that the engine will use
         its default.
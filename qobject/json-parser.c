@@ -24,17 +24,10 @@
 #include "qapi/qmp/qstring.h"
 #include "json-parser-int.h"
 
-struct JSONToken {
-    JSONTokenType type;
-    int x;
-    int y;
-    char str[];
-};
-
 typedef struct JSONParserContext {
     Error *err;
-    JSONToken *current;
-    GQueue *buf;
+    GArray *buf;
+    guint pos;
     va_list *ap;
 } JSONParserContext;
 
@@ -235,20 +228,20 @@ out:
     return NULL;
 }
 
-/* Note: the token object returned by parser_context_peek_token or
- * parser_context_pop_token is deleted as soon as parser_context_pop_token
- * is called again.
- */
 static JSONToken *parser_context_pop_token(JSONParserContext *ctxt)
 {
-    g_free(ctxt->current);
-    ctxt->current = g_queue_pop_head(ctxt->buf);
-    return ctxt->current;
+    if (ctxt->pos == ctxt->buf->len) {
+        return NULL;
+    }
+    return &g_array_index(ctxt->buf, JSONToken, ctxt->pos++);
 }
 
 static JSONToken *parser_context_peek_token(JSONParserContext *ctxt)
 {
-    return g_queue_peek_head(ctxt->buf);
+    if (ctxt->pos == ctxt->buf->len) {
+        return NULL;
+    }
+    return &g_array_index(ctxt->buf, JSONToken, ctxt->pos);
 }
 
 /**
@@ -559,32 +552,27 @@ static QObject *parse_value(JSONParserContext *ctxt)
     }
 }
 
-JSONToken *json_token(JSONTokenType type, int x, int y, GString *tokstr)
-{
-    JSONToken *token = g_malloc(sizeof(JSONToken) + tokstr->len + 1);
-
-    token->type = type;
-    memcpy(token->str, tokstr->str, tokstr->len);
-    token->str[tokstr->len] = 0;
-    token->x = x;
-    token->y = y;
-    return token;
-}
-
-QObject *json_parser_parse(GQueue *tokens, va_list *ap, Error **errp)
+QObject *json_parser_parse(GArray *tokens, const char *text, va_list *ap,
+                           Error **errp)
 {
     JSONParserContext ctxt = { .buf = tokens, .ap = ap };
     QObject *result;
+    guint i;
+
+    /*
+     * The token strings are only located now, because @text may have
+     * moved while the tokens were being collected.
+     */
+    for (i = 0; i < tokens->len; i++) {
+        JSONToken *token = &g_array_index(tokens, JSONToken, i);
+
+        token->str = text + token->offset;
+    }
 
     result = parse_value(&ctxt);
-    assert(ctxt.err || g_queue_is_empty(ctxt.buf));
+    assert(ctxt.err || ctxt.pos == tokens->len);
 
     error_propagate(errp, ctxt.err);
 
-    while (!g_queue_is_empty(ctxt.buf)) {
-        parser_context_pop_token(&ctxt);
-    }
-    g_free(ctxt.current);
-
     return result;
 }
@@ -13,28 +13,60 @@
 
 #include "qemu/osdep.h"
 #include "qapi/error.h"
+#include "qemu/units.h"
 #include "json-parser-int.h"
 
 #define MAX_TOKEN_SIZE (64ULL << 20)
 #define MAX_TOKEN_COUNT (2ULL << 20)
 #define MAX_NESTING (1 << 10)
 
+/*
+ * Tokens and their strings are appended to buffers that are reused from
+ * one message to the next, instead of allocating each token separately.
+ * Do not keep the memory of an unusually large message around, though.
+ */
+#define MAX_RETAINED_TOKEN_TEXT (64 * KiB)
+#define MAX_RETAINED_TOKEN_COUNT 1024
+
 static void json_message_free_tokens(JSONMessageParser *parser)
 {
-    JSONToken *token;
+    if (parser->tokens->len > MAX_RETAINED_TOKEN_COUNT) {
+        g_array_free(parser->tokens, true);
+        parser->tokens = g_array_new(false, false, sizeof(JSONToken));
+    } else {
+        g_array_set_size(parser->tokens, 0);
+    }
 
-    while ((token = g_queue_pop_head(&parser->tokens))) {
-        g_free(token);
+    if (parser->token_text->allocated_len > MAX_RETAINED_TOKEN_TEXT) {
+        g_string_free(parser->token_text, true);
+        parser->token_text = g_string_new(NULL);
+    } else {
+        g_string_truncate(parser->token_text, 0);
     }
 }
 
+static void json_message_add_token(JSONMessageParser *parser,
+                                   JSONTokenType type, int x, int y,
+                                   GString *input)
+{
+    JSONToken token = {
+        .type = type,
+        .x = x,
+        .y = y,
+        .offset = parser->token_text->len,
+    };
+
+    /* Include the terminating NUL */
+    g_string_append_len(parser->token_text, input->str, input->len + 1);
+    g_array_append_val(parser->tokens, token);
+}
+
 void json_message_process_token(JSONLexer *lexer, GString *input,
                                 JSONTokenType type, int x, int y)
 {
     JSONMessageParser *parser = container_of(lexer, JSONMessageParser, lexer);
     QObject *json = NULL;
     Error *err = NULL;
-    JSONToken *token;
 
     switch (type) {
     case JSON_LCURLY:
@@ -53,10 +85,11 @@ void json_message_process_token(JSONLexer *lexer, GString *input,
         error_setg(&err, "JSON parse error, stray '%s'", input->str);
         goto out_emit;
     case JSON_END_OF_INPUT:
-        if (g_queue_is_empty(&parser->tokens)) {
+        if (!parser->tokens->len) {
             return;
         }
-        json = json_parser_parse(&parser->tokens, parser->ap, &err);
+        json = json_parser_parse(parser->tokens, parser->token_text->str,
+                                 parser->ap, &err);
         goto out_emit;
     default:
         break;
@@ -66,11 +99,11 @@ void json_message_process_token(JSONLexer *lexer, GString *input,
      * Security consideration, we limit total memory allocated per object
      * and the maximum recursion depth that a message can force.
      */
-    if (parser->token_size + input->len + 1 > MAX_TOKEN_SIZE) {
+    if (parser->token_text->len + input->len + 1 > MAX_TOKEN_SIZE) {
         error_setg(&err, "JSON token size limit exceeded");
         goto out_emit;
     }
-    if (g_queue_get_length(&parser->tokens) + 1 > MAX_TOKEN_COUNT) {
+    if (parser->tokens->len + 1 > MAX_TOKEN_COUNT) {
         error_setg(&err, "JSON token count limit exceeded");
         goto out_emit;
     }
@@ -79,23 +112,20 @@ void json_message_process_token(JSONLexer *lexer, GString *input,
         goto out_emit;
     }
 
-    token = json_token(type, x, y, input);
-    parser->token_size += input->len;
-
-    g_queue_push_tail(&parser->tokens, token);
+    json_message_add_token(parser, type, x, y, input);
 
     if ((parser->brace_count > 0 || parser->bracket_count > 0)
         && parser->brace_count >= 0 && parser->bracket_count >= 0) {
         return;
     }
 
-    json = json_parser_parse(&parser->tokens, parser->ap, &err);
+    json = json_parser_parse(parser->tokens, parser->token_text->str,
+                             parser->ap, &err);
 
 out_emit:
     parser->brace_count = 0;
     parser->bracket_count = 0;
     json_message_free_tokens(parser);
-    parser->token_size = 0;
     parser->emit(parser->opaque, json, err);
 }
 
@@ -109,8 +139,8 @@ void json_message_parser_init(JSONMessageParser *parser,
     parser->ap = ap;
     parser->brace_count = 0;
     parser->bracket_count = 0;
-    g_queue_init(&parser->tokens);
-    parser->token_size = 0;
+    parser->tokens = g_array_new(false, false, sizeof(JSONToken));
+    parser->token_text = g_string_new(NULL);
 
     json_lexer_init(&parser->lexer, !!ap);
 }
@@ -124,11 +154,12 @@ void json_message_parser_feed(JSONMessageParser *parser,
 void json_message_parser_flush(JSONMessageParser *parser)
 {
     json_lexer_flush(&parser->lexer);
-    assert(g_queue_is_empty(&parser->tokens));
+    assert(!parser->tokens->len);
 }
 
 void json_message_parser_destroy(JSONMessageParser *parser)
 {
     json_lexer_destroy(&parser->lexer);
-    json_message_free_tokens(parser);
+    g_array_free(parser->tokens, true);
+    g_string_free(parser->token_text, true);
 }
@@ -15,18 +15,26 @@
 
 #include "qemu/osdep.h"
 #include "qapi/qmp/json-writer.h"
+#include "qemu/units.h"
 #include "qemu/unicode.h"
 
+/* A streaming writer passes its output on once it has this much */
+#define JSON_WRITER_CHUNK_SIZE (64 * KiB)
+
 struct JSONWriter {
     bool pretty;
     bool need_comma;
     GString *contents;
     GByteArray *container_is_array;
+    JSONWriterFlush *flush;
+    void *flush_opaque;
+    /* How much output was already passed to @flush */
+    size_t flushed;
 };
 
 JSONWriter *json_writer_new(bool pretty)
 {
-    JSONWriter *writer = g_new(JSONWriter, 1);
+    JSONWriter *writer = g_new0(JSONWriter, 1);
 
     writer->pretty = pretty;
     writer->need_comma = false;
@@ -35,9 +43,38 @@ JSONWriter *json_writer_new(bool pretty)
     return writer;
 }
 
+JSONWriter *json_writer_new_stream(bool pretty, JSONWriterFlush *flush,
+                                   void *opaque)
+{
+    JSONWriter *writer = json_writer_new(pretty);
+
+    writer->flush = flush;
+    writer->flush_opaque = opaque;
+    return writer;
+}
+
+void json_writer_flush(JSONWriter *writer)
+{
+    g_assert(writer->flush);
+    if (writer->contents->len) {
+        writer->flush(writer->flush_opaque, writer->contents->str,
+                      writer->contents->len);
+        writer->flushed += writer->contents->len;
+        g_string_truncate(writer->contents, 0);
+    }
+}
+
+static void maybe_flush(JSONWriter *writer)
+{
+    if (writer->flush && writer->contents->len >= JSON_WRITER_CHUNK_SIZE) {
+        json_writer_flush(writer);
+    }
+}
+
 const char *json_writer_get(JSONWriter *writer)
 {
     g_assert(!writer->container_is_array->len);
+    g_assert(!writer->flush);
     return writer->contents->str;
 }
 
@@ -111,6 +148,17 @@ static void quoted_str(JSONWriter *writer, const char *str)
     g_string_append_c(writer->contents, '"');
 
     for (ptr = str; *ptr; ptr = end) {
+        /* Copy runs of characters that need no escaping in one go */
+        for (end = (char *)ptr;
+             *end >= 0x20 && *end < 0x7F && *end != '"' && *end != '\\';
+             end++) {
+            /* nothing */
+        }
+        if (end != ptr) {
+            g_string_append_len(writer->contents, ptr, end - ptr);
+            continue;
+        }
+
         cp = mod_utf8_codepoint(ptr, 6, &end);
         switch (cp) {
         case '\"':
@@ -156,11 +204,13 @@ static void quoted_str(JSONWriter *writer, const char *str)
 
 static void maybe_comma_name(JSONWriter *writer, const char *name)
 {
+    maybe_flush(writer);
+
     if (writer->need_comma) {
         g_string_append_c(writer->contents, ',');
         pretty_newline_or_space(writer);
     } else {
-        if (writer->contents->len) {
+        if (writer->contents->len || writer->flushed) {
             pretty_newline(writer);
         }
         writer->need_comma = true;
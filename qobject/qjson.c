@@ -230,3 +230,15 @@ GString *qobject_to_json(const QObject *obj)
 {
     return qobject_to_json_pretty(obj, false);
 }
+
+void qobject_to_json_stream(const QObject *obj, bool pretty,
+                            void (*flush)(void *opaque, const char *buf,
+                                          size_t len),
+                            void *opaque)
+{
+    g_autoptr(JSONWriter) writer = json_writer_new_stream(pretty, flush,
+                                                          opaque);
+
+    to_json(writer, NULL, obj);
+    json_writer_flush(writer);
+}
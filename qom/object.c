@@ -101,7 +101,11 @@ static TypeImpl *type_table_lookup(const char *name)
     return g_hash_table_lookup(type_table_get(), name);
 }
 
-static TypeImpl *type_new(const TypeInfo *info)
+/*
+ * If @copy is false, the strings of @info must live as long as the type,
+ * which is only guaranteed for type_register_static_array().
+ */
+static TypeImpl *type_new(const TypeInfo *info, bool copy)
 {
     TypeImpl *ti = g_malloc0(sizeof(*ti));
     int i;
@@ -113,8 +117,8 @@ static TypeImpl *type_new(const TypeInfo *info)
         abort();
     }
 
-    ti->name = g_strdup(info->name);
-    ti->parent = g_strdup(info->parent);
+    ti->name = copy ? g_strdup(info->name) : info->name;
+    ti->parent = copy ? g_strdup(info->parent) : info->parent;
 
     ti->class_size = info->class_size;
     ti->instance_size = info->instance_size;
@@ -131,7 +135,8 @@ static TypeImpl *type_new(const TypeInfo *info)
     ti->abstract = info->abstract;
 
     for (i = 0; info->interfaces && info->interfaces[i].type; i++) {
-        ti->interfaces[i].typename = g_strdup(info->interfaces[i].type);
+        ti->interfaces[i].typename = copy ? g_strdup(info->interfaces[i].type)
+                                          : info->interfaces[i].type;
     }
     ti->num_interfaces = i;
 
@@ -169,7 +174,7 @@ static bool type_name_is_valid(const char *name)
     return plen == slen;
 }
 
-static TypeImpl *type_register_internal(const TypeInfo *info)
+static TypeImpl *type_register_internal(const TypeInfo *info, bool copy)
 {
     TypeImpl *ti;
 
@@ -178,7 +183,7 @@ static TypeImpl *type_register_internal(const TypeInfo *info)
         abort();
     }
 
-    ti = type_new(info);
+    ti = type_new(info, copy);
 
     type_table_add(ti);
     return ti;
@@ -187,7 +192,7 @@ static TypeImpl *type_register_internal(const TypeInfo *info)
 TypeImpl *type_register(const TypeInfo *info)
 {
     assert(info->parent);
-    return type_register_internal(info);
+    return type_register_internal(info, true);
 }
 
 TypeImpl *type_register_static(const TypeInfo *info)
@@ -199,8 +204,14 @@ void type_register_static_array(const TypeInfo *infos, int nr_infos)
 {
     int i;
 
+    /*
+     * Unlike type_register_static(), which some callers use with strings
+     * that they free afterwards, the arrays are static constants and need
+     * not be copied.
+     */
     for (i = 0; i < nr_infos; i++) {
-        type_register_static(&infos[i]);
+        assert(infos[i].parent);
+        type_register_internal(&infos[i], false);
     }
 }
 
@@ -297,6 +308,48 @@ static bool type_is_ancestor(TypeImpl *type, TypeImpl *target_type)
 
 static void type_initialize(TypeImpl *ti);
 
+/*
+ * Build the table of the properties of @klass and of all its ancestors.
+ * This is done once, when the class is initialized, so that lookups from
+ * several threads never race with a rebuild.
+ */
+static void object_class_build_all_properties(ObjectClass *klass)
+{
+    ObjectClass *k;
+    GHashTableIter iter;
+    gpointer key, val;
+
+    /* The properties are owned by the per-class tables */
+    klass->all_properties = g_hash_table_new(g_str_hash, g_str_equal);
+
+    /* Ancestors come last and win, as in the walk up the hierarchy */
+    for (k = klass; k; k = object_class_get_parent(k)) {
+        g_hash_table_iter_init(&iter, k->properties);
+        while (g_hash_table_iter_next(&iter, &key, &val)) {
+            g_hash_table_insert(klass->all_properties, key, val);
+        }
+    }
+}
+
+/* Add a property of an initialized class to the tables of its subclasses */
+static void object_class_add_inherited_property(gpointer key, gpointer value,
+                                                gpointer opaque)
+{
+    TypeImpl *ti = value;
+    ObjectProperty *prop = opaque;
+    ObjectClass *k;
+
+    if (!ti->class || !ti->class->all_properties) {
+        return;
+    }
+    for (k = ti->class; k; k = object_class_get_parent(k)) {
+        if (g_hash_table_lookup(k->properties, prop->name) == prop) {
+            g_hash_table_insert(ti->class->all_properties, prop->name, prop);
+            return;
+        }
+    }
+}
+
 static void type_initialize_interface(TypeImpl *ti, TypeImpl *interface_type,
                                       TypeImpl *parent_type)
 {
@@ -371,6 +424,7 @@ static void type_initialize(TypeImpl *ti)
         g_assert(parent->instance_size <= ti->instance_size);
         memcpy(ti->class, parent->class, parent->class_size);
         ti->class->interfaces = NULL;
+        ti->class->all_properties = NULL;
 
         for (e = parent->class->interfaces; e; e = e->next) {
             InterfaceClass *iface = e->data;
@@ -417,6 +471,8 @@ static void type_initialize(TypeImpl *ti)
     if (ti->class_init) {
         ti->class_init(ti->class, ti->class_data);
     }
+
+    object_class_build_all_properties(ti->class);
 }
 
 static void object_init_with_type(Object *obj, TypeImpl *ti)
@@ -1119,10 +1175,36 @@ typedef struct OCFData
 {
     void (*fn)(ObjectClass *klass, void *opaque);
     const char *implements_type;
+    TypeImpl *target_type;
     bool include_abstract;
     void *opaque;
 } OCFData;
 
+/*
+ * Whether @type may be cast to @target_type: @target_type is an ancestor
+ * of @type or of one of the interfaces that @type or its ancestors
+ * declare.  Unlike object_class_dynamic_cast(), this does not need the
+ * class of @type to be initialized.
+ */
+static bool type_may_implement(TypeImpl *type, TypeImpl *target_type)
+{
+    int i;
+
+    for (; type; type = type_get_parent(type)) {
+        if (type == target_type) {
+            return true;
+        }
+        for (i = 0; i < type->num_interfaces; i++) {
+            TypeImpl *iface = type_get_by_name(type->interfaces[i].typename);
+
+            if (iface && type_is_ancestor(iface, target_type)) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
 static void object_class_foreach_tramp(gpointer key, gpointer value,
                                        gpointer opaque)
 {
@@ -1130,14 +1212,22 @@ static void object_class_foreach_tramp(gpointer key, gpointer value,
     TypeImpl *type = value;
     ObjectClass *k;
 
-    type_initialize(type);
-    k = type->class;
-
     if (!data->include_abstract && type->abstract) {
         return;
     }
 
-    if (data->implements_type && 
+    /*
+     * Do not initialize the classes that can't match: looking up e.g. the
+     * machine types would otherwise run class_init for every type.
+     */
+    if (data->target_type && !type_may_implement(type, data->target_type)) {
+        return;
+    }
+
+    type_initialize(type);
+    k = type->class;
+
+    if (data->implements_type &&
         !object_class_dynamic_cast(k, data->implements_type)) {
         return;
     }
@@ -1149,7 +1239,15 @@ void object_class_foreach(void (*fn)(ObjectClass *klass, void *opaque),
                           const char *implements_type, bool include_abstract,
                           void *opaque)
 {
-    OCFData data = { fn, implements_type, include_abstract, opaque };
+    OCFData data = { fn, implements_type, NULL, include_abstract, opaque };
+
+    if (implements_type) {
+        data.target_type = type_get_by_name(implements_type);
+        if (!data.target_type) {
+            /* No class can be cast to an unknown type */
+            return;
+        }
+    }
 
     enumerating_types = true;
     g_hash_table_foreach(type_table_get(), object_class_foreach_tramp, &data);
@@ -1342,6 +1440,12 @@ object_class_property_add(ObjectClass *klass,
 
     g_hash_table_insert(klass->properties, prop->name, prop);
 
+    /* Classes that are already initialized need it in their flat tables */
+    if (klass->all_properties) {
+        g_hash_table_foreach(type_table_get(),
+                             object_class_add_inherited_property, prop);
+    }
+
     return prop;
 }
 
@@ -1400,6 +1504,14 @@ ObjectProperty *object_class_property_find(ObjectClass *klass, const char *name)
 {
     ObjectClass *parent_klass;
 
+    /*
+     * Once the class is initialized a single lookup is enough, instead
+     * of one for each level of the hierarchy.
+     */
+    if (klass->all_properties) {
+        return g_hash_table_lookup(klass->all_properties, name);
+    }
+
     parent_klass = object_class_get_parent(klass);
     if (parent_klass) {
         ObjectProperty *prop =
@@ -2896,8 +3008,8 @@ static void register_types(void)
         .abstract = true,
     };
 
-    type_interface = type_register_internal(&interface_info);
-    type_register_internal(&object_info);
+    type_interface = type_register_internal(&interface_info, false);
+    type_register_internal(&object_info, false);
 }
 
 type_init(register_types)
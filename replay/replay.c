@@ -19,18 +19,22 @@
 #include "qemu/option.h"
 #include "sysemu/cpus.h"
 #include "qemu/error-report.h"
+#include "qemu/units.h"
 
 /* Current version of the replay mechanism.
    Increase it when file format changes. */
 #define REPLAY_VERSION              0xe0200c
 /* Size of replay log header */
 #define HEADER_SIZE                 (sizeof(uint32_t) + sizeof(uint64_t))
+/* Size of the stdio buffer of the replay log */
+#define REPLAY_FILE_BUF_SIZE        (1 * MiB)
 
 ReplayMode replay_mode = REPLAY_MODE_NONE;
 char *replay_snapshot;
 
 /* Name of replay file  */
 static char *replay_filename;
+static char *replay_file_buf;
 ReplayState replay_state;
 static GSList *replay_blockers;
 
@@ -360,6 +364,12 @@ static void replay_enable(const char *fname, int mode)
         fprintf(stderr, "Replay: open %s: %s\n", fname, strerror(errno));
         exit(1);
     }
+    /*
+     * Events are small and frequent, give stdio a large buffer so that
+     * they reach the file in few big writes.
+     */
+    replay_file_buf = g_malloc(REPLAY_FILE_BUF_SIZE);
+    setvbuf(replay_file, replay_file_buf, _IOFBF, REPLAY_FILE_BUF_SIZE);
 
     replay_filename = g_strdup(fname);
     replay_mode = mode;
@@ -497,6 +507,8 @@ void replay_finish(void)
         fclose(replay_file);
         replay_file = NULL;
     }
+    g_free(replay_file_buf);
+    replay_file_buf = NULL;
     g_free(replay_filename);
     replay_filename = NULL;
 
@@ -36,6 +36,7 @@
 allpatterns = []
 anyextern = False
 testforerror = False
+tableswitch = False
 
 translate_prefix = 'trans'
 translate_scope = 'static '
@@ -245,6 +246,42 @@ def is_contiguous(bits):
         return -1
 
 
+def bit_runs(bits):
+    """Return the (shift, length) of each run of set bits in BITS,
+       starting from the least significant one."""
+    runs = []
+    while bits != 0:
+        shift = ctz(bits)
+        length = ctz(~(bits >> shift))
+        runs.append((shift, length))
+        bits &= ~(((1 << length) - 1) << shift)
+    return runs
+
+
+def pack_bits(val, runs):
+    """Return the bits of VAL selected by RUNS, moved next to each other."""
+    r = 0
+    pos = 0
+    for (sh, ln) in runs:
+        r |= ((val >> sh) & ((1 << ln) - 1)) << pos
+        pos += ln
+    return r
+
+
+def str_pack_bits(runs):
+    """Return a C expression computing pack_bits(insn, RUNS)."""
+    r = []
+    pos = 0
+    for (sh, ln) in runs:
+        m = whexC(((1 << ln) - 1) << pos)
+        if sh == pos:
+            r.append(f'(insn & {m})')
+        else:
+            r.append(f'((insn >> {sh - pos}) & {m})')
+        pos += ln
+    return ' | '.join(r)
+
+
 def eq_fields_for_args(flds_a, arg):
     if len(flds_a) != len(arg.fields):
         return False
@@ -748,6 +785,7 @@ def output_code(self, i, extracted, outerbits, outermask):
         # Attempt to aid the compiler in producing compact switch statements.
         # If the bits in the mask are contiguous, extract them.
         sh = is_contiguous(self.thismask)
+        runs = bit_runs(self.thismask)
         if sh > 0:
             # Propagate SH down into the local functions.
             def str_switch(b, sh=sh):
@@ -755,6 +793,14 @@ def str_switch(b, sh=sh):
 
             def str_case(b, sh=sh):
                 return hex(b >> sh)
+        elif tableswitch and len(runs) <= 4 and len(self.subs) >= 4:
+            # Pack the bits into a dense index, so that the compiler can
+            # use a jump table rather than a tree of comparisons.
+            def str_switch(b, runs=runs):
+                return str_pack_bits(runs)
+
+            def str_case(b, runs=runs):
+                return hex(pack_bits(b, runs))
         else:
             def str_switch(b):
                 return f'insn & {whexC(b)}'
@@ -1511,12 +1557,13 @@ def main():
     global variablewidth
     global anyextern
     global testforerror
+    global tableswitch
 
     decode_scope = 'static '
 
     long_opts = ['decode=', 'translate=', 'output=', 'insnwidth=',
                  'static-decode=', 'varinsnwidth=', 'test-for-error',
-                 'output-null']
+                 'output-null', 'table-switch']
     try:
         (opts, args) = getopt.gnu_getopt(sys.argv[1:], 'o:vw:', long_opts)
     except getopt.GetoptError as err:
@@ -1549,6 +1596,8 @@ def main():
             testforerror = True
         elif o == '--output-null':
             output_null = True
+        elif o == '--table-switch':
+            tableswitch = True
         else:
             assert False, 'unhandled option'
 
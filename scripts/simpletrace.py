@@ -25,13 +25,12 @@
 # QEMU was built with.
 header_event_id = 0xffffffffffffffff
 header_magic    = 0xf2b177cb0aa429b4
-dropped_event_id = 0xfffffffffffffffe
-
-record_type_mapping = 0
-record_type_event = 1
+mapping_event_id = 0xffffffff
+dropped_event_id = 0xfffffffe
 
 log_header_fmt = '=QQQ'
-rec_header_fmt = '=QQII'
+log_header_pid_fmt = '=Q'
+rec_header_fmt = '=QII'
 rec_header_fmt_len = struct.calcsize(rec_header_fmt)
 
 class SimpleException(Exception):
@@ -45,39 +44,49 @@ def read_header(fobj, hfmt):
         raise SimpleException('Error reading header. Wrong filetype provided?')
     return struct.unpack(hfmt, hdr)
 
-def get_mapping(fobj):
-    (event_id, ) = struct.unpack('=Q', fobj.read(8))
-    (len, ) = struct.unpack('=L', fobj.read(4))
-    name = fobj.read(len).decode()
+def get_mapping(payload):
+    (event_id, len) = struct.unpack_from('=LL', payload)
+    name = payload[8:8 + len].decode()
 
     return (event_id, name)
 
 def read_record(fobj):
-    """Deserialize a trace record from a file into a tuple (event_num, timestamp, pid, args)."""
-    event_id, timestamp_ns, record_length, record_pid = read_header(fobj, rec_header_fmt)
+    """Deserialize a trace record from a file into a tuple (event_num, timestamp, args).
+
+    Returns None at the end of the file."""
+    hdr = fobj.read(rec_header_fmt_len)
+    if len(hdr) == 0:
+        return None
+    if len(hdr) != rec_header_fmt_len:
+        raise SimpleException('Truncated trace record')
+    timestamp_ns, event_id, record_length = struct.unpack(rec_header_fmt, hdr)
     args_payload = fobj.read(record_length - rec_header_fmt_len)
-    return (event_id, timestamp_ns, record_pid, args_payload)
+    return (event_id, timestamp_ns, args_payload)
 
 def read_trace_header(fobj):
-    """Read and verify trace file header"""
+    """Read and verify trace file header, returning the pid of the traced process"""
     _header_event_id, _header_magic, log_version = read_header(fobj, log_header_fmt)
     if _header_event_id != header_event_id:
         raise ValueError(f'Not a valid trace file, header id {_header_event_id} != {header_event_id}')
     if _header_magic != header_magic:
         raise ValueError(f'Not a valid trace file, header magic {_header_magic} != {header_magic}')
 
-    if log_version not in [0, 2, 3, 4]:
+    if log_version not in [0, 2, 3, 4, 5]:
         raise ValueError(f'Unknown version {log_version} of tracelog format!')
-    if log_version != 4:
+    if log_version != 5:
         raise ValueError(f'Log format {log_version} not supported with this QEMU release!')
 
-def read_trace_records(events, fobj, read_header):
+    (pid, ) = read_header(fobj, log_header_pid_fmt)
+    return pid
+
+def read_trace_records(events, fobj, read_header, pid=0):
     """Deserialize trace records from a file, yielding record tuples (event, event_num, timestamp, pid, arg1, ..., arg6).
 
     Args:
         event_mapping (str -> Event): events dict, indexed by name
         fobj (file): input file
         read_header (bool): whether headers were read from fobj
+        pid (int): pid of the traced process, from the header
 
     """
     frameinfo = inspect.getframeinfo(inspect.currentframe())
@@ -94,16 +103,15 @@ def read_trace_records(events, fobj, read_header):
             event_id_to_name[event_id] = event.name
 
     while True:
-        t = fobj.read(8)
-        if len(t) == 0:
+        rec = read_record(fobj)
+        if rec is None:
             break
 
-        (rectype, ) = struct.unpack('=Q', t)
-        if rectype == record_type_mapping:
-            event_id, event_name = get_mapping(fobj)
+        event_id, timestamp_ns, args_payload = rec
+        if event_id == mapping_event_id:
+            event_id, event_name = get_mapping(args_payload)
             event_id_to_name[event_id] = event_name
         else:
-            event_id, timestamp_ns, pid, args_payload = read_record(fobj)
             event_name = event_id_to_name[event_id]
 
             try:
@@ -306,11 +314,12 @@ def _process(events, log_fobj, analyzer, read_header=True):
         read_header (bool, optional): Whether to read header data from the log data. Defaults to True.
     """
 
+    pid = 0
     if read_header:
-        read_trace_header(log_fobj)
+        pid = read_trace_header(log_fobj)
 
     with analyzer:
-        for event, event_id, timestamp_ns, record_pid, *rec_args in read_trace_records(events, log_fobj, read_header):
+        for event, event_id, timestamp_ns, record_pid, *rec_args in read_trace_records(events, log_fobj, read_header, pid):
             analyzer._process_event(
                 rec_args,
                 event=event,
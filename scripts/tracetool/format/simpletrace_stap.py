@@ -34,7 +34,7 @@ def generate(events, backend, group):
             name=e.name)
 
         # Calculate record size
-        sizes = ['24'] # sizeof(TraceRecord)
+        sizes = ['16'] # sizeof(TraceRecord)
         for type_, name in e.args:
             name = stap_escape(name)
             if is_string(type_):
@@ -49,10 +49,9 @@ def generate(events, backend, group):
         sizestr = ' + '.join(sizes)
 
         # Generate format string and value pairs for record header and arguments
-        fields = [('8b', str(event_id)),
-                  ('8b', 'gettimeofday_ns()'),
-                  ('4b', sizestr),
-                  ('4b', 'pid()')]
+        fields = [('8b', 'gettimeofday_ns()'),
+                  ('4b', str(event_id)),
+                  ('4b', sizestr)]
         for type_, name in e.args:
             name = stap_escape(name)
             if is_string(type_):
@@ -64,7 +63,7 @@ def generate(events, backend, group):
         # Emit the entire record in a single SystemTap printf()
         fmt_str = '%'.join(fmt for fmt, _ in fields)
         arg_str = ', '.join(arg for _, arg in fields)
-        out('    printf("%%8b%%%(fmt_str)s", 1, %(arg_str)s)',
+        out('    printf("%%%(fmt_str)s", %(arg_str)s)',
             fmt_str=fmt_str, arg_str=arg_str)
 
         out('}')
@@ -0,0 +1,71 @@
+/*
+ * query-stats provider for the counters of QEMU internals
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * (at your option) any later version.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/counters.h"
+#include "sysemu/stats.h"
+
+typedef struct CountersStatsArgs {
+    strList *names;
+    StatsList *stats;
+    StatsSchemaValueList *schema;
+} CountersStatsArgs;
+
+static void counters_stats_add(QemuCounter *c, void *opaque)
+{
+    CountersStatsArgs *args = opaque;
+    Stats *stats;
+
+    if (!apply_str_list_filter(c->name, args->names)) {
+        return;
+    }
+
+    stats = g_new0(Stats, 1);
+    stats->name = g_strdup(c->name);
+    stats->value = g_new0(StatsValue, 1);
+    stats->value->type = QTYPE_QNUM;
+    stats->value->u.scalar = qemu_counter_get(c);
+    QAPI_LIST_PREPEND(args->stats, stats);
+}
+
+static void counters_stats_cb(StatsResultList **result, StatsTarget target,
+                              strList *names, strList *targets, Error **errp)
+{
+    CountersStatsArgs args = { .names = names };
+
+    if (target != STATS_TARGET_VM) {
+        return;
+    }
+
+    qemu_counters_foreach(counters_stats_add, &args);
+    add_stats_entry(result, STATS_PROVIDER_QEMU, NULL, args.stats);
+}
+
+static void counters_schema_add(QemuCounter *c, void *opaque)
+{
+    CountersStatsArgs *args = opaque;
+    StatsSchemaValue *value = g_new0(StatsSchemaValue, 1);
+
+    value->name = g_strdup(c->name);
+    value->type = STATS_TYPE_CUMULATIVE;
+    QAPI_LIST_PREPEND(args->schema, value);
+}
+
+static void counters_schemas_cb(StatsSchemaList **result, Error **errp)
+{
+    CountersStatsArgs args = {};
+
+    qemu_counters_foreach(counters_schema_add, &args);
+    add_stats_schema(result, STATS_PROVIDER_QEMU, STATS_TARGET_VM,
+                     args.schema);
+}
+
+static void __attribute__((constructor)) counters_stats_init(void)
+{
+    add_stats_callbacks(STATS_PROVIDER_QEMU, counters_stats_cb,
+                        counters_schemas_cb);
+}
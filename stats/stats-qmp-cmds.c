@@ -66,6 +66,15 @@ static bool invoke_stats_cb(StatsCallbacks *entry,
         break;
     case STATS_TARGET_CRYPTODEV:
         break;
+    case STATS_TARGET_BLOCK:
+        if (filter->u.block.has_devices) {
+            if (!filter->u.block.devices) {
+                /* No targets allowed?  Return no statistics.  */
+                return true;
+            }
+            targets = filter->u.block.devices;
+        }
+        break;
     default:
         abort();
     }
@@ -35,6 +35,7 @@
 #include "exec/cpu-common.h"
 #include "qemu/thread.h"
 #include "qemu/main-loop.h"
+#include "qemu/bql-profile.h"
 #include "qemu/plugin.h"
 #include "sysemu/cpus.h"
 #include "qemu/guest-random.h"
@@ -520,27 +521,49 @@ bool qemu_in_main_thread(void)
 void bql_lock_impl(const char *file, int line)
 {
     QemuMutexLockFunc bql_lock_fn = qatomic_read(&bql_mutex_lock_func);
+    int64_t t0;
 
     g_assert(!bql_locked());
-    bql_lock_fn(&bql, file, line);
+    if (bql_profile_is_enabled()) {
+        t0 = get_clock();
+        bql_lock_fn(&bql, file, line);
+        bql_profile_acquired(file, line, get_clock() - t0);
+    } else {
+        bql_lock_fn(&bql, file, line);
+    }
     set_bql_locked(true);
 }
 
 void bql_unlock(void)
 {
     g_assert(bql_locked());
+    if (bql_profile_is_enabled()) {
+        bql_profile_released();
+    }
     set_bql_locked(false);
     qemu_mutex_unlock(&bql);
 }
 
 void qemu_cond_wait_bql(QemuCond *cond)
 {
-    qemu_cond_wait(cond, &bql);
+    if (bql_profile_is_enabled()) {
+        bql_profile_released();
+        qemu_cond_wait(cond, &bql);
+        bql_profile_acquired(__FILE__, __LINE__, 0);
+    } else {
+        qemu_cond_wait(cond, &bql);
+    }
 }
 
 void qemu_cond_timedwait_bql(QemuCond *cond, int ms)
 {
-    qemu_cond_timedwait(cond, &bql, ms);
+    if (bql_profile_is_enabled()) {
+        bql_profile_released();
+        qemu_cond_timedwait(cond, &bql, ms);
+        bql_profile_acquired(__FILE__, __LINE__, 0);
+    } else {
+        qemu_cond_timedwait(cond, &bql, ms);
+    }
 }
 
 /* signal CPU creation */
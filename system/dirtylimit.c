@@ -43,6 +43,11 @@
  * composed of dirty ring full and sleep time.
  */
 #define DIRTYLIMIT_THROTTLE_PCT_MAX 99
+/*
+ * A vCPU throttled to a dirty page rate of at least this percentage of
+ * its quota is considered to want more.
+ */
+#define DIRTYLIMIT_SATURATED_PCT 90
 
 struct {
     VcpuStat stat;
@@ -441,6 +446,75 @@ static void dirtylimit_cleanup(void)
     dirtylimit_state_finalize();
 }
 
+static int dirtylimit_rate_cmp(const void *a, const void *b)
+{
+    const DirtyRateVcpu *ra = a, *rb = b;
+
+    return ra->dirty_rate < rb->dirty_rate ? -1 :
+           ra->dirty_rate > rb->dirty_rate;
+}
+
+/*
+ * Share a total dirty page rate of @budget MB/s among the vCPUs.
+ *
+ * The vCPUs that dirty memory slower than their even share of what is
+ * left are not limited, and what they do not use is split among the
+ * others, so that only the hottest vCPUs get throttled.  No vCPU gets a
+ * quota lower than @min_quota.
+ */
+void dirtylimit_set_budget(uint64_t budget, uint64_t min_quota)
+{
+    g_autofree DirtyRateVcpu *rates = NULL;
+    bool measured;
+    uint64_t share = 0;
+    CPUState *cpu;
+    int n = 0, i;
+
+    dirtylimit_state_lock();
+
+    /* Until the stat thread runs, consider every vCPU as hot */
+    measured = dirtylimit_in_service();
+    if (!measured) {
+        dirtylimit_init();
+    }
+
+    rates = g_new(DirtyRateVcpu, dirtylimit_state->max_cpus);
+    CPU_FOREACH(cpu) {
+        VcpuDirtyLimitState *state = dirtylimit_vcpu_get_state(cpu->cpu_index);
+        int64_t rate = vcpu_dirty_rate_get(cpu->cpu_index);
+
+        /* The rate of a vCPU held down by its quota is not its demand */
+        if (!measured || (state->enabled && rate * 100 >=
+                          state->quota * DIRTYLIMIT_SATURATED_PCT)) {
+            rate = INT64_MAX;
+        }
+        rates[n].id = cpu->cpu_index;
+        rates[n].dirty_rate = rate;
+        n++;
+    }
+    qsort(rates, n, sizeof(*rates), dirtylimit_rate_cmp);
+
+    for (i = 0; i < n; i++) {
+        share = budget / (n - i);
+        if ((uint64_t)rates[i].dirty_rate > share) {
+            break;
+        }
+        budget -= rates[i].dirty_rate;
+        if (dirtylimit_vcpu_get_state(rates[i].id)->enabled) {
+            qemu_get_cpu(rates[i].id)->throttle_us_per_full = 0;
+            dirtylimit_set_vcpu(rates[i].id, 0, false);
+        }
+    }
+
+    share = MAX(share, min_quota);
+    trace_dirtylimit_set_budget(budget, n - i, share);
+    for (; i < n; i++) {
+        dirtylimit_set_vcpu(rates[i].id, share, true);
+    }
+
+    dirtylimit_state_unlock();
+}
+
 /*
  * dirty page rate limit is not allowed to set if migration
  * is running with dirty-limit capability enabled.
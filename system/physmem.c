@@ -59,6 +59,9 @@
 
 #include "qemu/rcu_queue.h"
 #include "qemu/main-loop.h"
+#include "qemu/bql-profile.h"
+#include "qemu/counters.h"
+#include "qemu/lockable.h"
 #include "exec/translate-all.h"
 #include "sysemu/replay.h"
 
@@ -2150,6 +2153,65 @@ void qemu_ram_remap(ram_addr_t addr, ram_addr_t length)
         }
     }
 }
+
+bool qemu_ram_map_file_private(RAMBlock *block, int fd, off_t offset,
+                               Error **errp)
+{
+    size_t pagesize = qemu_real_host_page_size();
+    int flags = MAP_FIXED | MAP_PRIVATE;
+    struct stat st;
+    void *area;
+
+    if (xen_enabled() || block->fd >= 0 ||
+        (block->flags & (RAM_PREALLOC | RAM_SHARED))) {
+        error_setg(errp, "RAMBlock %s is not private anonymous memory",
+                   block->idstr);
+        return false;
+    }
+    if (memory_region_has_ram_discard_manager(block->mr)) {
+        error_setg(errp, "RAMBlock %s has a RAM discard manager",
+                   block->idstr);
+        return false;
+    }
+    /*
+     * Only the settings that ram_block_add() applies to all RAM are
+     * applied again to the new mapping.
+     */
+    if (object_dynamic_cast(block->mr->owner, TYPE_MEMORY_BACKEND) &&
+        !host_memory_backend_has_default_settings(
+            MEMORY_BACKEND(block->mr->owner))) {
+        error_setg(errp, "memory backend settings of RAMBlock %s would be "
+                   "lost", block->idstr);
+        return false;
+    }
+    if (qemu_ram_pagesize(block) != pagesize ||
+        !QEMU_IS_ALIGNED(offset, pagesize)) {
+        error_setg(errp, "RAMBlock %s can't be mapped with host pages",
+                   block->idstr);
+        return false;
+    }
+    /* Accessing a page past the end of the file would raise SIGBUS */
+    if (fstat(fd, &st) < 0 || st.st_size < offset + block->used_length) {
+        error_setg(errp, "file is too short for RAMBlock %s", block->idstr);
+        return false;
+    }
+
+    flags |= block->flags & RAM_NORESERVE ? MAP_NORESERVE : 0;
+    area = mmap(block->host, block->used_length, PROT_READ | PROT_WRITE,
+                flags, fd, offset);
+    if (area == MAP_FAILED) {
+        error_setg_errno(errp, errno, "failed to map RAMBlock %s",
+                         block->idstr);
+        return false;
+    }
+    memory_try_enable_merging(area, block->used_length);
+    qemu_ram_setup_dump(area, block->used_length);
+    qemu_madvise(area, block->used_length, QEMU_MADV_HUGEPAGE);
+    if (!qtest_enabled()) {
+        qemu_madvise(area, block->used_length, QEMU_MADV_DONTFORK);
+    }
+    return true;
+}
 #endif /* !_WIN32 */
 
 /* Return a host pointer to ram allocated with qemu_ram_alloc.
@@ -2233,6 +2295,10 @@ RAMBlock *qemu_ram_block_from_host(void *ptr, bool round_offset,
         ram_addr_t ram_addr;
         RCU_READ_LOCK_GUARD();
         ram_addr = xen_ram_addr_from_mapcache(ptr);
+        if (ram_addr == RAM_ADDR_INVALID) {
+            return NULL;
+        }
+
         block = qemu_get_ram_block(ram_addr);
         if (block) {
             *offset = ram_addr - block->offset;
@@ -2637,13 +2703,26 @@ int memory_access_size(MemoryRegion *mr, unsigned l, hwaddr addr)
     return l;
 }
 
+QEMU_COUNTER_DEFINE(mmio_lockless, "mmio-lockless")
+QEMU_COUNTER_DEFINE(mmio_locked, "mmio-locked")
+
 bool prepare_mmio_access(MemoryRegion *mr)
 {
     bool release_lock = false;
 
+    if (mr->lockless_io) {
+        qemu_counter_inc(&mmio_lockless);
+        return false;
+    }
+    qemu_counter_inc(&mmio_locked);
     if (!bql_locked()) {
         bql_lock();
         release_lock = true;
+        if (bql_profile_is_enabled()) {
+            const char *name = memory_region_name(mr);
+
+            bql_profile_set_holder(BQL_PROFILE_MMIO, name ?: "unnamed");
+        }
     }
     if (mr->flush_coalesced_mmio) {
         qemu_flush_coalesced_mmio_buffer();
@@ -3005,55 +3084,46 @@ void cpu_flush_icache_range(hwaddr start, hwaddr len)
                                      NULL, len, FLUSH_CACHE);
 }
 
+#define BOUNCE_BUFFER_MAGIC 0xb4017ceb4ffe12edULL
+
 typedef struct {
+    uint64_t magic;
     MemoryRegion *mr;
-    void *buffer;
     hwaddr addr;
-    hwaddr len;
-    bool in_use;
+    size_t len;
+    uint8_t buffer[];
 } BounceBuffer;
 
-static BounceBuffer bounce;
-
-typedef struct MapClient {
-    QEMUBH *bh;
-    QLIST_ENTRY(MapClient) link;
-} MapClient;
-
-QemuMutex map_client_list_lock;
-static QLIST_HEAD(, MapClient) map_client_list
-    = QLIST_HEAD_INITIALIZER(map_client_list);
-
-static void cpu_unregister_map_client_do(MapClient *client)
+static void
+address_space_unregister_map_client_do(AddressSpaceMapClient *client)
 {
     QLIST_REMOVE(client, link);
     g_free(client);
 }
 
-static void cpu_notify_map_clients_locked(void)
+static void address_space_notify_map_clients_locked(AddressSpace *as)
 {
-    MapClient *client;
+    AddressSpaceMapClient *client;
 
-    while (!QLIST_EMPTY(&map_client_list)) {
-        client = QLIST_FIRST(&map_client_list);
+    while (!QLIST_EMPTY(&as->map_client_list)) {
+        client = QLIST_FIRST(&as->map_client_list);
         qemu_bh_schedule(client->bh);
-        cpu_unregister_map_client_do(client);
+        address_space_unregister_map_client_do(client);
     }
 }
 
-void cpu_register_map_client(QEMUBH *bh)
+void address_space_register_map_client(AddressSpace *as, QEMUBH *bh)
 {
-    MapClient *client = g_malloc(sizeof(*client));
+    AddressSpaceMapClient *client = g_malloc(sizeof(*client));
 
-    qemu_mutex_lock(&map_client_list_lock);
+    QEMU_LOCK_GUARD(&as->map_client_list_lock);
     client->bh = bh;
-    QLIST_INSERT_HEAD(&map_client_list, client, link);
-    /* Write map_client_list before reading in_use.  */
+    QLIST_INSERT_HEAD(&as->map_client_list, client, link);
+    /* Write map_client_list before reading bounce_buffer_size.  */
     smp_mb();
-    if (!qatomic_read(&bounce.in_use)) {
-        cpu_notify_map_clients_locked();
+    if (qatomic_read(&as->bounce_buffer_size) < as->max_bounce_buffer_size) {
+        address_space_notify_map_clients_locked(as);
     }
-    qemu_mutex_unlock(&map_client_list_lock);
 }
 
 void cpu_exec_init_all(void)
@@ -3069,28 +3139,25 @@ void cpu_exec_init_all(void)
     finalize_target_page_bits();
     io_mem_init();
     memory_map_init();
-    qemu_mutex_init(&map_client_list_lock);
 }
 
-void cpu_unregister_map_client(QEMUBH *bh)
+void address_space_unregister_map_client(AddressSpace *as, QEMUBH *bh)
 {
-    MapClient *client;
+    AddressSpaceMapClient *client;
 
-    qemu_mutex_lock(&map_client_list_lock);
-    QLIST_FOREACH(client, &map_client_list, link) {
+    QEMU_LOCK_GUARD(&as->map_client_list_lock);
+    QLIST_FOREACH(client, &as->map_client_list, link) {
         if (client->bh == bh) {
-            cpu_unregister_map_client_do(client);
+            address_space_unregister_map_client_do(client);
             break;
         }
     }
-    qemu_mutex_unlock(&map_client_list_lock);
 }
 
-static void cpu_notify_map_clients(void)
+static void address_space_notify_map_clients(AddressSpace *as)
 {
-    qemu_mutex_lock(&map_client_list_lock);
-    cpu_notify_map_clients_locked();
-    qemu_mutex_unlock(&map_client_list_lock);
+    QEMU_LOCK_GUARD(&as->map_client_list_lock);
+    address_space_notify_map_clients_locked(as);
 }
 
 static bool flatview_access_valid(FlatView *fv, hwaddr addr, hwaddr len,
@@ -3153,12 +3220,84 @@ flatview_extend_translation(FlatView *fv, hwaddr addr,
     }
 }
 
+/*
+ * The last RAM section that address_space_map() went through, per thread.
+ * Devices with their own IOThreads keep hitting the same guest RAM, and the
+ * shared mru_section of the dispatch thrashes once several threads map
+ * different regions concurrently.  The entry is valid as long as no FlatView
+ * changed since it was filled, which also keeps the MemoryRegion alive
+ * within the RCU critical section.
+ */
+typedef struct AddressSpaceMapCache {
+    AddressSpace *as;
+    unsigned int gen;
+    MemoryRegion *mr;
+    hwaddr start;
+    hwaddr size;
+    uint8_t *host;
+    bool direct_read;
+    bool direct_write;
+} AddressSpaceMapCache;
+
+static __thread AddressSpaceMapCache as_map_cache;
+
+/* Called from RCU critical section */
+static void address_space_map_cache_fill(AddressSpace *as, FlatView *fv,
+                                         unsigned int gen, hwaddr addr)
+{
+    AddressSpaceMapCache *c = &as_map_cache;
+    MemoryRegionSection *section;
+    MemoryRegion *mr;
+
+    if (xen_enabled()) {
+        return;
+    }
+
+    section = address_space_lookup_region(flatview_to_dispatch(fv), addr, true);
+    mr = section->mr;
+    /* IOMMU mappings can change without a new FlatView */
+    if (!memory_region_is_ram(mr) || memory_region_get_iommu(mr) ||
+        int128_gethi(section->size)) {
+        return;
+    }
+
+    *c = (AddressSpaceMapCache) {
+        .as = as,
+        .gen = gen,
+        .mr = mr,
+        .start = section->offset_within_address_space,
+        .size = int128_get64(section->size),
+        .host = (uint8_t *)memory_region_get_ram_ptr(mr) +
+                section->offset_within_region,
+        .direct_read = memory_access_is_direct(mr, false),
+        .direct_write = memory_access_is_direct(mr, true),
+    };
+}
+
+/* Called from RCU critical section */
+static void *address_space_map_cached(AddressSpace *as, unsigned int gen,
+                                      hwaddr addr, hwaddr len, bool is_write)
+{
+    AddressSpaceMapCache *c = &as_map_cache;
+    hwaddr offset = addr - c->start;
+
+    if (c->as != as || c->gen != gen || addr < c->start ||
+        offset >= c->size || len > c->size - offset ||
+        !(is_write ? c->direct_write : c->direct_read)) {
+        return NULL;
+    }
+
+    memory_region_ref(c->mr);
+    fuzz_dma_read_cb(addr, len, c->mr);
+    return c->host + offset;
+}
+
 /* Map a physical memory region into a host virtual address.
  * May map a subset of the requested range, given by and returned in *plen.
  * May return NULL if resources needed to perform the mapping are exhausted.
  * Use only for reads OR writes - not for read-modify-write operations.
- * Use cpu_register_map_client() to know when retrying the map operation is
- * likely to succeed.
+ * Use address_space_register_map_client() to know when retrying the map
+ * operation is likely to succeed.
  */
 void *address_space_map(AddressSpace *as,
                         hwaddr addr,
@@ -3170,6 +3309,8 @@ void *address_space_map(AddressSpace *as,
     hwaddr l, xlat;
     MemoryRegion *mr;
     FlatView *fv;
+    unsigned int gen;
+    void *ptr;
 
     if (len == 0) {
         return NULL;
@@ -3177,33 +3318,57 @@ void *address_space_map(AddressSpace *as,
 
     l = len;
     RCU_READ_LOCK_GUARD();
+    /* Read the generation first, a concurrent update only causes a miss */
+    gen = qatomic_load_acquire(&flatview_generation);
+    ptr = address_space_map_cached(as, gen, addr, len, is_write);
+    if (ptr) {
+        return ptr;
+    }
+
     fv = address_space_to_flatview(as);
     mr = flatview_translate(fv, addr, &xlat, &l, is_write, attrs);
 
     if (!memory_access_is_direct(mr, is_write)) {
-        if (qatomic_xchg(&bounce.in_use, true)) {
+        size_t used = qatomic_read(&as->bounce_buffer_size);
+        BounceBuffer *bounce;
+
+        /* Reserve as much of the bounce buffer space as is left */
+        for (;;) {
+            hwaddr alloc = used < as->max_bounce_buffer_size ?
+                           MIN(as->max_bounce_buffer_size - used, l) : 0;
+            size_t actual = qatomic_cmpxchg(&as->bounce_buffer_size, used,
+                                            used + alloc);
+            if (actual == used) {
+                l = alloc;
+                break;
+            }
+            used = actual;
+        }
+
+        if (l == 0) {
             *plen = 0;
             return NULL;
         }
-        /* Avoid unbounded allocations */
-        l = MIN(l, TARGET_PAGE_SIZE);
-        bounce.buffer = qemu_memalign(TARGET_PAGE_SIZE, l);
-        bounce.addr = addr;
-        bounce.len = l;
 
+        bounce = g_malloc0(l + sizeof(BounceBuffer));
+        bounce->magic = BOUNCE_BUFFER_MAGIC;
         memory_region_ref(mr);
-        bounce.mr = mr;
+        bounce->mr = mr;
+        bounce->addr = addr;
+        bounce->len = l;
+
         if (!is_write) {
             flatview_read(fv, addr, MEMTXATTRS_UNSPECIFIED,
-                               bounce.buffer, l);
+                          bounce->buffer, l);
         }
 
         *plen = l;
-        return bounce.buffer;
+        return bounce->buffer;
     }
 
 
     memory_region_ref(mr);
+    address_space_map_cache_fill(as, fv, gen, addr);
     *plen = flatview_extend_translation(fv, addr, len, mr, xlat,
                                         l, is_write, attrs);
     fuzz_dma_read_cb(addr, *plen, mr);
@@ -3217,12 +3382,12 @@ void *address_space_map(AddressSpace *as,
 void address_space_unmap(AddressSpace *as, void *buffer, hwaddr len,
                          bool is_write, hwaddr access_len)
 {
-    if (buffer != bounce.buffer) {
-        MemoryRegion *mr;
-        ram_addr_t addr1;
+    MemoryRegion *mr;
+    ram_addr_t addr1;
+    BounceBuffer *bounce;
 
-        mr = memory_region_from_host(buffer, &addr1);
-        assert(mr != NULL);
+    mr = memory_region_from_host(buffer, &addr1);
+    if (mr != NULL) {
         if (is_write) {
             invalidate_and_set_dirty(mr, addr1, access_len);
         }
@@ -3232,16 +3397,22 @@ void address_space_unmap(AddressSpace *as, void *buffer, hwaddr len,
         memory_region_unref(mr);
         return;
     }
+
+    bounce = container_of(buffer, BounceBuffer, buffer);
+    assert(bounce->magic == BOUNCE_BUFFER_MAGIC);
+
     if (is_write) {
-        address_space_write(as, bounce.addr, MEMTXATTRS_UNSPECIFIED,
-                            bounce.buffer, access_len);
-    }
-    qemu_vfree(bounce.buffer);
-    bounce.buffer = NULL;
-    memory_region_unref(bounce.mr);
-    /* Clear in_use before reading map_client_list.  */
-    qatomic_set_mb(&bounce.in_use, false);
-    cpu_notify_map_clients();
+        address_space_write(as, bounce->addr, MEMTXATTRS_UNSPECIFIED,
+                            bounce->buffer, access_len);
+    }
+
+    qatomic_sub(&as->bounce_buffer_size, bounce->len);
+    bounce->magic = ~BOUNCE_BUFFER_MAGIC;
+    memory_region_unref(bounce->mr);
+    g_free(bounce);
+    /* Write bounce_buffer_size before reading map_client_list.  */
+    smp_mb();
+    address_space_notify_map_clients(as);
 }
 
 void *cpu_physical_memory_map(hwaddr addr,
@@ -488,6 +488,17 @@ void qemu_system_reset(ShutdownCause reason)
 
     cpu_synchronize_all_states();
 
+    switch (reason) {
+    case SHUTDOWN_CAUSE_NONE:
+    case SHUTDOWN_CAUSE_SUBSYSTEM_RESET:
+    case SHUTDOWN_CAUSE_SNAPSHOT_LOAD:
+        break;
+    default:
+        if (current_machine) {
+            machine_reset_ram(current_machine);
+        }
+    }
+
     if (mc && mc->reset) {
         mc->reset(current_machine, reason);
     } else {
@@ -50,6 +50,7 @@
 #include "qemu/sockets.h"
 #include "qemu/accel.h"
 #include "qemu/async-teardown.h"
+#include "qemu/startup-profile.h"
 #include "hw/usb.h"
 #include "hw/isa/isa.h"
 #include "hw/scsi/scsi.h"
@@ -168,6 +169,7 @@ static QTAILQ_HEAD(, DeviceOption) device_opts = QTAILQ_HEAD_INITIALIZER(device_
 static int display_remote;
 static int snapshot;
 static bool preconfig_requested;
+static bool startup_profile_requested;
 static QemuPluginList plugin_list = QTAILQ_HEAD_INITIALIZER(plugin_list);
 static BlockdevOptionsQueue bdo_queue = QSIMPLEQ_HEAD_INITIALIZER(bdo_queue);
 static bool nographic = false;
@@ -2013,12 +2015,11 @@ static void qemu_create_late_backends(void)
     object_option_foreach_add(object_create_late);
 
     /*
-     * Wait for any outstanding memory prealloc from created memory
-     * backends to complete.
+     * Preallocation of the memory backends runs in the background while
+     * the machine and the devices are created, see
+     * qemu_machine_creation_done().
      */
-    if (!qemu_finish_async_prealloc_mem(&error_fatal)) {
-        exit(1);
-    }
+    qemu_start_async_prealloc_mem();
 
     if (tpm_init() < 0) {
         exit(1);
@@ -2674,6 +2675,15 @@ static bool qemu_machine_creation_done(Error **errp)
 
     qdev_prop_check_globals();
 
+    /*
+     * Wait for any outstanding memory prealloc from created memory
+     * backends to complete, before the guest or an incoming migration
+     * can touch guest memory.
+     */
+    if (!qemu_finish_async_prealloc_mem(&error_fatal)) {
+        exit(1);
+    }
+
     qdev_machine_creation_done();
 
     if (machine->cgs && !machine->cgs->ready) {
@@ -2695,6 +2705,14 @@ static bool qemu_machine_creation_done(Error **errp)
     return true;
 }
 
+static void qemu_finish_startup_profile(void)
+{
+    startup_profile_finish();
+    if (startup_profile_requested) {
+        startup_profile_print();
+    }
+}
+
 void qmp_x_exit_preconfig(Error **errp)
 {
     if (phase_check(PHASE_MACHINE_INITIALIZED)) {
@@ -2702,11 +2720,17 @@ void qmp_x_exit_preconfig(Error **errp)
         return;
     }
 
+    if (preconfig_requested) {
+        startup_profile_phase("preconfig");
+    }
     qemu_init_board();
+    startup_profile_phase("board-init");
     qemu_create_cli_devices();
+    startup_profile_phase("cli-devices");
     if (!qemu_machine_creation_done(errp)) {
         return;
     }
+    startup_profile_phase("machine-done");
 
     if (loadvm) {
         RunState state = autostart ? RUN_STATE_RUNNING : runstate_get();
@@ -2729,6 +2753,11 @@ void qmp_x_exit_preconfig(Error **errp)
     } else if (autostart) {
         qmp_cont(NULL);
     }
+
+    if (preconfig_requested) {
+        startup_profile_phase("start");
+        qemu_finish_startup_profile();
+    }
 }
 
 void qemu_init(int argc, char **argv)
@@ -2784,6 +2813,8 @@ void qemu_init(int argc, char **argv)
     qemu_init_arch_modules();
 
     qemu_init_subsystems();
+    startup_profile_start();
+    startup_profile_phase("early-init");
 
     /* first pass of option parsing */
     optind = 1;
@@ -3578,6 +3609,9 @@ void qemu_init(int argc, char **argv)
             case QEMU_OPTION_enable_sync_profile:
                 qsp_enable();
                 break;
+            case QEMU_OPTION_enable_startup_profile:
+                startup_profile_requested = true;
+                break;
             case QEMU_OPTION_nouserconfig:
                 /* Nothing to be parsed here. Especially, do not error out below. */
                 break;
@@ -3636,6 +3670,7 @@ void qemu_init(int argc, char **argv)
 
     qemu_process_help_options();
     qemu_maybe_daemonize(pid_file);
+    startup_profile_phase("options");
 
     /*
      * The trace backend must be initialized after daemonizing.
@@ -3652,6 +3687,7 @@ void qemu_init(int argc, char **argv)
 
     qemu_init_main_loop(&error_fatal);
     cpu_timers_init();
+    startup_profile_phase("main-loop");
 
     user_register_global_props();
     replay_configure(icount_opts);
@@ -3674,6 +3710,7 @@ void qemu_init(int argc, char **argv)
     qemu_apply_machine_options(machine_opts_dict);
     qobject_unref(machine_opts_dict);
     phase_advance(PHASE_MACHINE_CREATED);
+    startup_profile_phase("machine-create");
 
     /*
      * Note: uses machine properties such as kernel-irqchip, must run
@@ -3681,6 +3718,7 @@ void qemu_init(int argc, char **argv)
      */
     configure_accelerators(argv[0]);
     phase_advance(PHASE_ACCEL_CREATED);
+    startup_profile_phase("accel");
 
     /*
      * Beware, QOM objects created before this point miss global and
@@ -3711,6 +3749,7 @@ void qemu_init(int argc, char **argv)
      */
     qemu_create_late_backends();
     phase_advance(PHASE_LATE_BACKENDS_CREATED);
+    startup_profile_phase("late-backends");
 
     /*
      * Note: creates a QOM object, must run only after global and
@@ -3735,6 +3774,8 @@ void qemu_init(int argc, char **argv)
         exit(0);
     }
 
+    startup_profile_phase("machine-options");
+
     if (!preconfig_requested) {
         qmp_x_exit_preconfig(&error_fatal);
     }
@@ -3742,4 +3783,9 @@ void qemu_init(int argc, char **argv)
     accel_setup_post(current_machine);
     os_setup_post();
     resume_mux_open();
+
+    if (!preconfig_requested) {
+        startup_profile_phase("displays");
+        qemu_finish_startup_profile();
+    }
 }
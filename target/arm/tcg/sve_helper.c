@@ -5644,6 +5644,56 @@ void sve_cont_ldst_mte_check(SVEContLdSt *info, CPUARMState *env,
     }
 }
 
+/*
+ * Return true if all the elements of size 1 << @esz from @reg_off to
+ * @reg_last, inclusive, are active in the predicate @vg, and there is
+ * at least one of them.
+ */
+static bool sve_pred_all_active(uint64_t *vg, intptr_t reg_off,
+                                intptr_t reg_last, int esz)
+{
+    intptr_t i, first = reg_off >> 6, last = reg_last >> 6;
+
+    if (reg_last < reg_off) {
+        return false;
+    }
+    for (i = first; i <= last; i++) {
+        uint64_t mask = pred_esz_masks[esz];
+
+        if (i == first) {
+            mask &= -1ull << (reg_off & 63);
+        }
+        if (i == last) {
+            mask &= MAKE_64BIT_MASK(0, (reg_last & 63) + 1);
+        }
+        if ((vg[i] & mask) != mask) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * For contiguous accesses with no extension and little-endian data,
+ * the register image on a little-endian host is the memory image, so
+ * a run of active elements can be copied at once.
+ */
+static inline QEMU_ALWAYS_INLINE
+bool sve_ld1_host_is_memcpy(sve_ldst1_host_fn *host_fn)
+{
+    return !HOST_BIG_ENDIAN &&
+           (host_fn == sve_ld1bb_host || host_fn == sve_ld1hh_le_host ||
+            host_fn == sve_ld1ss_le_host || host_fn == sve_ld1dd_le_host);
+}
+
+static inline QEMU_ALWAYS_INLINE
+bool sve_st1_host_is_memcpy(sve_ldst1_host_fn *host_fn)
+{
+    return !HOST_BIG_ENDIAN &&
+           (host_fn == sve_st1bb_host || host_fn == sve_st1hh_le_host ||
+            host_fn == sve_st1ss_le_host || host_fn == sve_st1dd_le_host);
+}
+
 /*
  * Common helper for all contiguous 1,2,3,4-register predicated stores.
  */
@@ -5737,6 +5787,13 @@ void sve_ldN_r(CPUARMState *env, uint64_t *vg, const target_ulong addr,
     reg_last = info.reg_off_last[0];
     host = info.page[0].host;
 
+    if (N == 1 && sve_ld1_host_is_memcpy(host_fn) &&
+        sve_pred_all_active(vg, reg_off, reg_last, esz)) {
+        memcpy((void *)&env->vfp.zregs[rd] + reg_off, host + mem_off,
+               reg_last - reg_off + (1 << esz));
+        reg_off = reg_last + 1;
+    }
+
     while (reg_off <= reg_last) {
         uint64_t pg = vg[reg_off >> 6];
         do {
@@ -6347,6 +6404,13 @@ void sve_stN_r(CPUARMState *env, uint64_t *vg, target_ulong addr,
     reg_last = info.reg_off_last[0];
     host = info.page[0].host;
 
+    if (N == 1 && sve_st1_host_is_memcpy(host_fn) &&
+        sve_pred_all_active(vg, reg_off, reg_last, esz)) {
+        memcpy(host + mem_off, (void *)&env->vfp.zregs[rd] + reg_off,
+               reg_last - reg_off + (1 << esz));
+        reg_off = reg_last + 1;
+    }
+
     while (reg_off <= reg_last) {
         uint64_t pg = vg[reg_off >> 6];
         do {
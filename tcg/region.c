@@ -49,6 +49,8 @@
 struct tcg_region_tree {
     QemuMutex lock;
     QTree *tree;
+    /* code size of the region once full, protected by region.lock */
+    size_t size_full;
     /* padding to avoid false sharing is computed at run-time */
 };
 
@@ -57,6 +59,10 @@ struct tcg_region_tree {
  * dynamically allocate from as demand dictates. Given appropriate region
  * sizing, this minimizes flushes even when some TCG threads generate a lot
  * more code than others.
+ *
+ * Regions are handed out in a circular order, so that when they have all
+ * been filled the ones that were filled first can be reclaimed, see
+ * tcg_region_reclaim().
  */
 struct tcg_region_state {
     QemuMutex lock;
@@ -70,7 +76,8 @@ struct tcg_region_state {
     size_t total_size; /* size of entire buffer, >= n * stride */
 
     /* fields protected by the lock */
-    size_t current; /* current region index */
+    size_t oldest; /* index of the first region that was handed out */
+    size_t current; /* number of regions handed out */
     size_t agg_size_full; /* aggregate size of full regions */
 };
 
@@ -311,6 +318,15 @@ size_t tcg_nb_tbs(void)
     return nb_tbs;
 }
 
+/* Call with rt->lock held */
+static void tcg_region_tree_reset(struct tcg_region_tree *rt)
+{
+    /* Increment the refcount first so that destroy acts as a reset */
+    q_tree_ref(rt->tree);
+    q_tree_destroy(rt->tree);
+    rt->size_full = 0;
+}
+
 static void tcg_region_tree_reset_all(void)
 {
     size_t i;
@@ -319,9 +335,7 @@ static void tcg_region_tree_reset_all(void)
     for (i = 0; i < region.n; i++) {
         struct tcg_region_tree *rt = region_trees + i * tree_size;
 
-        /* Increment the refcount first so that destroy acts as a reset */
-        q_tree_ref(rt->tree);
-        q_tree_destroy(rt->tree);
+        tcg_region_tree_reset(rt);
     }
     tcg_region_tree_unlock_all();
 }
@@ -362,7 +376,7 @@ static bool tcg_region_alloc__locked(TCGContext *s)
     if (region.current == region.n) {
         return true;
     }
-    tcg_region_assign(s, region.current);
+    tcg_region_assign(s, (region.oldest + region.current) % region.n);
     region.current++;
     return false;
 }
@@ -376,11 +390,13 @@ bool tcg_region_alloc(TCGContext *s)
     bool err;
     /* read the region size now; alloc__locked will overwrite it on success */
     size_t size_full = s->code_gen_buffer_size;
+    struct tcg_region_tree *rt = tc_ptr_to_region_tree(s->code_gen_buffer);
 
     qemu_mutex_lock(&region.lock);
     err = tcg_region_alloc__locked(s);
     if (!err) {
-        region.agg_size_full += size_full - TCG_HIGHWATER;
+        rt->size_full = size_full - TCG_HIGHWATER;
+        region.agg_size_full += rt->size_full;
     }
     qemu_mutex_unlock(&region.lock);
     return err;
@@ -410,6 +426,7 @@ void tcg_region_reset_all(void)
     unsigned int i;
 
     qemu_mutex_lock(&region.lock);
+    region.oldest = 0;
     region.current = 0;
     region.agg_size_full = 0;
 
@@ -422,6 +439,81 @@ void tcg_region_reset_all(void)
     tcg_region_tree_reset_all();
 }
 
+/*
+ * The more regions are reclaimed at once, the less often the vCPUs have to
+ * be stopped; the fewer, the more translated code survives.
+ */
+#define TCG_REGION_RECLAIM_DIV 4
+
+static gboolean tcg_region_collect_tb(gpointer key, gpointer value,
+                                      gpointer data)
+{
+    g_ptr_array_add(data, value);
+    return FALSE;
+}
+
+/*
+ * Reclaim the regions that were filled first: at least
+ * 1/TCG_REGION_RECLAIM_DIV of them, and more if needed so that a region is
+ * left for the context that ran out of space once the contexts using the
+ * reclaimed regions have moved on to a new one.  @evict is called for every
+ * TB of a region before the region is reused.
+ *
+ * Returns false if there is a single region, reclaiming it would just be a
+ * slower tb_flush().
+ *
+ * Call from a safe-work context.
+ */
+bool tcg_region_reclaim(void (*evict)(TranslationBlock *tb))
+{
+    unsigned int n_ctxs = qatomic_read(&tcg_cur_ctxs);
+    g_autoptr(GPtrArray) tbs = NULL;
+    size_t min, done = 0;
+    unsigned int i;
+
+    if (region.n == 1) {
+        return false;
+    }
+    min = DIV_ROUND_UP(region.n, TCG_REGION_RECLAIM_DIV);
+    tbs = g_ptr_array_new();
+
+    qemu_mutex_lock(&region.lock);
+    while (region.current &&
+           (done < min || (region.current == region.n && done < region.n))) {
+        struct tcg_region_tree *rt = region_trees + region.oldest * tree_size;
+
+        qemu_mutex_lock(&rt->lock);
+        q_tree_foreach(rt->tree, tcg_region_collect_tb, tbs);
+        qemu_mutex_unlock(&rt->lock);
+
+        for (i = 0; i < tbs->len; i++) {
+            evict(g_ptr_array_index(tbs, i));
+        }
+        g_ptr_array_set_size(tbs, 0);
+
+        region.agg_size_full -= rt->size_full;
+        qemu_mutex_lock(&rt->lock);
+        tcg_region_tree_reset(rt);
+        qemu_mutex_unlock(&rt->lock);
+
+        region.oldest = (region.oldest + 1) % region.n;
+        region.current--;
+        done++;
+
+        /* A context that was using the region starts over in a new one */
+        for (i = 0; i < n_ctxs; i++) {
+            TCGContext *s = qatomic_read(&tcg_ctxs[i]);
+
+            if (tc_ptr_to_region_tree(s->code_gen_buffer) == rt) {
+                tcg_region_initial_alloc__locked(s);
+            }
+        }
+    }
+
+    qemu_mutex_unlock(&region.lock);
+    return true;
+}
+
 static size_t tcg_n_regions(size_t tb_size, unsigned max_cpus)
 {
 #ifdef CONFIG_USER_ONLY
@@ -435,9 +527,13 @@ static size_t tcg_n_regions(size_t tb_size, unsigned max_cpus)
      * being of reasonable size. If that's not possible we make do by evenly
      * dividing the code_gen_buffer among the vCPUs.
      */
-    /* Use a single region if all we have is one vCPU thread */
+    /*
+     * With a single vCPU thread there is no parallel code generation, but
+     * a few regions of >= 2 MB still let tcg_region_reclaim() keep part of
+     * the translated code when the buffer is full.
+     */
     if (max_cpus == 1 || !qemu_tcg_mttcg_enabled()) {
-        return 1;
+        return MAX(MIN(tb_size / (2 * MiB), 8), 1);
     }
 
     /*
@@ -33,6 +33,7 @@
 #include "qemu/qemu-print.h"
 #include "qemu/cacheflush.h"
 #include "qemu/cacheinfo.h"
+#include "qemu/lockable.h"
 #include "qemu/timer.h"
 #include "exec/translation-block.h"
 #include "exec/tlb-common.h"
@@ -1307,6 +1308,10 @@ static void process_op_defs(TCGContext *s);
 static TCGTemp *tcg_global_reg_new_internal(TCGContext *s, TCGType type,
                                             TCGReg reg, const char *name);
 
+/* Protects tcg_profile_helpers; its entries are never freed */
+static QemuMutex tcg_profile_lock;
+static GHashTable *tcg_profile_helpers;
+
 static void tcg_context_init(unsigned max_cpus)
 {
     TCGContext *s = &tcg_init_ctx;
@@ -1318,6 +1323,9 @@ static void tcg_context_init(unsigned max_cpus)
     memset(s, 0, sizeof(*s));
     s->nb_globals = 0;
 
+    qemu_mutex_init(&tcg_profile_lock);
+    tcg_profile_helpers = g_hash_table_new(NULL, NULL);
+
     /* Count total number of arguments and allocate the corresponding
        space */
     total_args = 0;
@@ -2250,6 +2258,46 @@ bool tcg_op_supported(TCGOpcode op)
 
 static TCGOp *tcg_op_alloc(TCGOpcode opc, unsigned nargs);
 
+static uint64_t *tcg_profile_helper_counter(const TCGHelperInfo *info)
+{
+    TCGProfileHelper *h;
+
+    QEMU_LOCK_GUARD(&tcg_profile_lock);
+    h = g_hash_table_lookup(tcg_profile_helpers, info);
+    if (!h) {
+        h = g_new0(TCGProfileHelper, 1);
+        h->name = info->name;
+        g_hash_table_insert(tcg_profile_helpers, (gpointer)info, h);
+    }
+    return &h->calls;
+}
+
+void tcg_profile_foreach_helper(void (*fn)(const TCGProfileHelper *h,
+                                           void *opaque),
+                                void *opaque)
+{
+    GHashTableIter iter;
+    gpointer h;
+
+    QEMU_LOCK_GUARD(&tcg_profile_lock);
+    g_hash_table_iter_init(&iter, tcg_profile_helpers);
+    while (g_hash_table_iter_next(&iter, NULL, &h)) {
+        fn(h, opaque);
+    }
+}
+
+void tcg_profile_reset_helpers(void)
+{
+    GHashTableIter iter;
+    gpointer h;
+
+    QEMU_LOCK_GUARD(&tcg_profile_lock);
+    g_hash_table_iter_init(&iter, tcg_profile_helpers);
+    while (g_hash_table_iter_next(&iter, NULL, &h)) {
+        qatomic_set_u64(&((TCGProfileHelper *)h)->calls, 0);
+    }
+}
+
 static void tcg_gen_callN(TCGHelperInfo *info, TCGTemp *ret, TCGTemp **args)
 {
     TCGv_i64 extend_free[MAX_CALL_IARGS];
@@ -2262,6 +2310,11 @@ static void tcg_gen_callN(TCGHelperInfo *info, TCGTemp *ret, TCGTemp **args)
         g_once_init_leave(HELPER_INFO_INIT(info), HELPER_INFO_INIT_VAL(info));
     }
 
+    if (unlikely(tcg_ctx->gen_tb &&
+                 (tcg_ctx->gen_tb->cflags & CF_PROFILE))) {
+        tcg_gen_profile_inc(tcg_profile_helper_counter(info));
+    }
+
     total_args = info->nr_out + info->nr_in + 2;
     op = tcg_op_alloc(INDEX_op_call, total_args);
 
@@ -0,0 +1,46 @@
+/*
+ * QEMU buffer_is_zero speed benchmark
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * (at your option) any later version.  See the COPYING file in the
+ * top-level directory.
+ */
+#include "qemu/osdep.h"
+#include "qemu/cutils.h"
+#include "qemu/units.h"
+
+static void test_bufferiszero_speed(void)
+{
+    static const size_t sizes[] = { 64, 512, 4 * KiB, 64 * KiB, 1 * MiB };
+    const size_t total = 2 * GiB;
+    size_t max = sizes[ARRAY_SIZE(sizes) - 1];
+    uint8_t *buf = g_malloc0(max);
+    int accel = 0;
+
+    /* Start with the accelerator that is used by default.  */
+    do {
+        for (unsigned i = 0; i < ARRAY_SIZE(sizes); i++) {
+            size_t remain;
+
+            g_test_timer_start();
+            for (remain = total; remain >= sizes[i]; remain -= sizes[i]) {
+                g_assert(buffer_is_zero(buf, sizes[i]));
+            }
+            g_test_timer_elapsed();
+
+            g_test_message("bufferiszero: accel %d len %zu %.2f MB/sec",
+                           accel, sizes[i],
+                           total / MiB / g_test_timer_last());
+        }
+        accel++;
+    } while (test_buffer_is_zero_next_accel());
+
+    g_free(buf);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_func("/cutils/benchmark/bufferiszero", test_bufferiszero_speed);
+    return g_test_run();
+}
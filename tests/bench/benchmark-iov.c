@@ -0,0 +1,104 @@
+/*
+ * QEMU iovec helpers speed benchmark
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * (at your option) any later version.  See the COPYING file in the
+ * top-level directory.
+ */
+#include "qemu/osdep.h"
+#include "qemu/iov.h"
+#include "qemu/units.h"
+
+#define ITERATIONS (4 * 1000 * 1000)
+
+typedef struct IovBenchOpts {
+    const char *name;
+    unsigned int niov;
+    size_t elem_size;
+    size_t bytes;
+} IovBenchOpts;
+
+static struct iovec *iov_bench_alloc(const IovBenchOpts *opts)
+{
+    struct iovec *iov = g_new(struct iovec, opts->niov);
+
+    for (unsigned int i = 0; i < opts->niov; i++) {
+        iov[i].iov_base = g_malloc0(opts->elem_size);
+        iov[i].iov_len = opts->elem_size;
+    }
+    return iov;
+}
+
+static void iov_bench_free(const IovBenchOpts *opts, struct iovec *iov)
+{
+    for (unsigned int i = 0; i < opts->niov; i++) {
+        g_free(iov[i].iov_base);
+    }
+    g_free(iov);
+}
+
+static void test_iov_copy_speed(const void *opaque)
+{
+    const IovBenchOpts *opts = opaque;
+    struct iovec *iov = iov_bench_alloc(opts);
+    uint8_t *buf = g_malloc0(opts->bytes);
+    /* keep the compiler from using the inline constant-size fast path */
+    volatile size_t bytes = opts->bytes;
+
+    g_test_timer_start();
+    for (int i = 0; i < ITERATIONS; i++) {
+        iov_from_buf(iov, opts->niov, 0, buf, bytes);
+        iov_to_buf(iov, opts->niov, 0, buf, bytes);
+    }
+    g_test_timer_elapsed();
+
+    g_test_message("%s: %u x %zu bytes, copy %zu bytes: %.1f ns/iteration",
+                   opts->name, opts->niov, opts->elem_size, opts->bytes,
+                   g_test_timer_last() * 1e9 / ITERATIONS);
+
+    g_free(buf);
+    iov_bench_free(opts, iov);
+}
+
+static void test_iov_concat_speed(const void *opaque)
+{
+    const IovBenchOpts *opts = opaque;
+    struct iovec *iov = iov_bench_alloc(opts);
+    QEMUIOVector qiov;
+
+    g_test_timer_start();
+    for (int i = 0; i < ITERATIONS / 4; i++) {
+        qemu_iovec_init(&qiov, 1);
+        qemu_iovec_concat_iov(&qiov, iov, opts->niov, 0, opts->bytes);
+        qemu_iovec_destroy(&qiov);
+    }
+    g_test_timer_elapsed();
+
+    g_test_message("%s: %u x %zu bytes, concat %zu bytes: %.1f ns/iteration",
+                   opts->name, opts->niov, opts->elem_size, opts->bytes,
+                   g_test_timer_last() * 1e9 / (ITERATIONS / 4));
+
+    iov_bench_free(opts, iov);
+}
+
+int main(int argc, char **argv)
+{
+    static const IovBenchOpts opts[] = {
+        { "header", 1, 4 * KiB, 12 },
+        { "single", 1, 4 * KiB, 4 * KiB },
+        { "pages", 16, 4 * KiB, 64 * KiB },
+        { "small", 64, 64, 4 * KiB },
+    };
+    char name[64];
+
+    g_test_init(&argc, &argv, NULL);
+
+    for (int i = 0; i < ARRAY_SIZE(opts); i++) {
+        snprintf(name, sizeof(name), "/iov/benchmark/copy/%s", opts[i].name);
+        g_test_add_data_func(name, &opts[i], test_iov_copy_speed);
+        snprintf(name, sizeof(name), "/iov/benchmark/concat/%s", opts[i].name);
+        g_test_add_data_func(name, &opts[i], test_iov_concat_speed);
+    }
+
+    return g_test_run();
+}
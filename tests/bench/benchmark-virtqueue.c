@@ -0,0 +1,222 @@
+/*
+ * Virtqueue datapath speed benchmark
+ *
+ * A synthetic guest made of a single memory region drives a split ring as
+ * a driver would, while libvhost-user pops and pushes the elements on the
+ * device side.  This measures the cost per element of the descriptor walk,
+ * of the address translation and of the used ring updates.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * (at your option) any later version.  See the COPYING file in the
+ * top-level directory.
+ */
+#include "qemu/osdep.h"
+#include "qemu/bswap.h"
+#include "qemu/memalign.h"
+#include "qemu/units.h"
+#include "standard-headers/linux/virtio_config.h"
+#include "libvhost-user.h"
+
+#define ITERATIONS (1000 * 1000)
+
+#define RING_NUM 256
+
+/* Guest physical layout of the synthetic guest */
+#define GUEST_DESC_GPA      0
+#define GUEST_AVAIL_GPA     (4 * KiB)
+#define GUEST_USED_GPA      (8 * KiB)
+#define GUEST_INDIRECT_GPA  (64 * KiB)
+#define GUEST_DATA_GPA      (1 * MiB)
+#define GUEST_MEM_SIZE      (8 * MiB)
+
+typedef struct VirtqBenchOpts {
+    const char *name;
+    /* Device-readable and device-writable segments of each element */
+    unsigned int out_num;
+    unsigned int in_num;
+    size_t seg_size;
+    bool indirect;
+    /* Elements that the driver makes available at once */
+    unsigned int batch;
+} VirtqBenchOpts;
+
+typedef struct VirtqBench {
+    const VirtqBenchOpts *opts;
+    uint8_t *mem;
+    VuDevRegion region;
+    VuVirtq vq;
+    VuDev dev;
+    uint16_t avail_idx;
+    uint16_t last_used_idx;
+    uint16_t heads[RING_NUM];
+} VirtqBench;
+
+static void virtq_bench_panic(VuDev *dev, const char *err)
+{
+    g_error("libvhost-user: %s", err);
+}
+
+static void virtq_bench_fill_desc(struct vring_desc *desc, uint64_t gpa,
+                                  uint32_t len, uint16_t flags, uint16_t next)
+{
+    desc->addr = cpu_to_le64(gpa);
+    desc->len = cpu_to_le32(len);
+    desc->flags = cpu_to_le16(flags);
+    desc->next = cpu_to_le16(next);
+}
+
+static void virtq_bench_init(VirtqBench *b, const VirtqBenchOpts *opts)
+{
+    unsigned int n = opts->out_num + opts->in_num;
+    struct vring_desc *ring_desc;
+    uint64_t data = GUEST_DATA_GPA;
+
+    g_assert(opts->indirect ? opts->batch <= RING_NUM
+                            : opts->batch * n <= RING_NUM);
+    g_assert(GUEST_INDIRECT_GPA + opts->batch * n * sizeof(*ring_desc) <=
+             GUEST_DATA_GPA);
+    g_assert(GUEST_DATA_GPA + opts->batch * n * opts->seg_size <=
+             GUEST_MEM_SIZE);
+
+    memset(b, 0, sizeof(*b));
+    b->opts = opts;
+    b->mem = qemu_memalign(4 * KiB, GUEST_MEM_SIZE);
+    memset(b->mem, 0, GUEST_MEM_SIZE);
+
+    b->region.gpa = 0;
+    b->region.size = GUEST_MEM_SIZE;
+    b->region.qva = (uintptr_t)b->mem;
+    b->region.mmap_addr = (uintptr_t)b->mem;
+
+    b->vq.vring.num = RING_NUM;
+    b->vq.vring.desc = (struct vring_desc *)(b->mem + GUEST_DESC_GPA);
+    b->vq.vring.avail = (struct vring_avail *)(b->mem + GUEST_AVAIL_GPA);
+    b->vq.vring.used = (struct vring_used *)(b->mem + GUEST_USED_GPA);
+    b->vq.call_fd = b->vq.kick_fd = b->vq.err_fd = -1;
+    b->vq.enable = 1;
+    b->vq.started = true;
+
+    b->dev.nregions = 1;
+    b->dev.regions = &b->region;
+    b->dev.vq = &b->vq;
+    b->dev.max_queues = 1;
+    b->dev.features = 1ULL << VIRTIO_F_VERSION_1;
+    if (opts->indirect) {
+        b->dev.features |= 1ULL << VIRTIO_RING_F_INDIRECT_DESC;
+    }
+    b->dev.sock = b->dev.backend_fd = b->dev.log_call_fd = -1;
+    b->dev.panic = virtq_bench_panic;
+
+    /* The chains never change, the driver only recycles their heads */
+    for (unsigned int e = 0; e < opts->batch; e++) {
+        struct vring_desc *desc;
+        unsigned int base;
+
+        if (opts->indirect) {
+            uint64_t table = GUEST_INDIRECT_GPA + e * n * sizeof(*desc);
+
+            virtq_bench_fill_desc(&b->vq.vring.desc[e], table,
+                                  n * sizeof(*desc), VRING_DESC_F_INDIRECT, 0);
+            desc = (struct vring_desc *)(b->mem + table);
+            base = 0;
+            b->heads[e] = e;
+        } else {
+            desc = b->vq.vring.desc;
+            base = e * n;
+            b->heads[e] = base;
+        }
+
+        for (unsigned int j = 0; j < n; j++) {
+            uint16_t flags = j >= opts->out_num ? VRING_DESC_F_WRITE : 0;
+
+            if (j + 1 < n) {
+                flags |= VRING_DESC_F_NEXT;
+            }
+            virtq_bench_fill_desc(&desc[base + j], data, opts->seg_size,
+                                  flags, base + j + 1);
+            data += opts->seg_size;
+        }
+    }
+}
+
+static void virtq_bench_cleanup(VirtqBench *b)
+{
+    qemu_vfree(b->mem);
+}
+
+/* One round trip for a batch: make it available, process it, reclaim it */
+static void virtq_bench_round(VirtqBench *b)
+{
+    const VirtqBenchOpts *opts = b->opts;
+    struct vring_avail *avail = b->vq.vring.avail;
+    struct vring_used *used = b->vq.vring.used;
+    unsigned int in_len = opts->in_num * opts->seg_size;
+    VuVirtqElement *elem;
+    unsigned int i;
+
+    for (i = 0; i < opts->batch; i++) {
+        avail->ring[b->avail_idx++ % RING_NUM] = cpu_to_le16(b->heads[i]);
+    }
+    smp_wmb();
+    qatomic_set(&avail->idx, cpu_to_le16(b->avail_idx));
+
+    for (i = 0; (elem = vu_queue_pop(&b->dev, &b->vq, sizeof(*elem))); i++) {
+        vu_queue_fill(&b->dev, &b->vq, elem, in_len, i);
+        free(elem);
+    }
+    vu_queue_flush(&b->dev, &b->vq, i);
+    g_assert_cmpuint(i, ==, opts->batch);
+
+    smp_rmb();
+    while (b->last_used_idx != le16_to_cpu(qatomic_read(&used->idx))) {
+        b->last_used_idx++;
+    }
+}
+
+static void test_virtqueue_speed(const void *opaque)
+{
+    const VirtqBenchOpts *opts = opaque;
+    unsigned int rounds = ITERATIONS / opts->batch;
+    VirtqBench b;
+
+    virtq_bench_init(&b, opts);
+
+    g_test_timer_start();
+    for (unsigned int i = 0; i < rounds; i++) {
+        virtq_bench_round(&b);
+    }
+    g_test_timer_elapsed();
+
+    g_test_message("%s: %u+%u x %zu bytes%s, batch %u: %.1f ns/element",
+                   opts->name, opts->out_num, opts->in_num, opts->seg_size,
+                   opts->indirect ? " indirect" : "", opts->batch,
+                   g_test_timer_last() * 1e9 / (rounds * opts->batch));
+
+    virtq_bench_cleanup(&b);
+}
+
+int main(int argc, char **argv)
+{
+    static const VirtqBenchOpts opts[] = {
+        /* virtio-net transmit, one packet at a time or NAPI-like */
+        { "net-single", 1, 0, 1536, false, 1 },
+        { "net-batch", 1, 0, 1536, false, 64 },
+        /* virtio-blk 4k read: header, data, status */
+        { "blk-read", 1, 2, 4 * KiB, false, 32 },
+        { "blk-read-indirect", 1, 2, 4 * KiB, true, 32 },
+        /* 64k scatter-gather list */
+        { "sg-64k", 1, 16, 4 * KiB, false, 8 },
+        { "sg-64k-indirect", 1, 16, 4 * KiB, true, 8 },
+    };
+    char name[64];
+
+    g_test_init(&argc, &argv, NULL);
+
+    for (int i = 0; i < ARRAY_SIZE(opts); i++) {
+        snprintf(name, sizeof(name), "/virtqueue/benchmark/split/%s",
+                 opts[i].name);
+        g_test_add_data_func(name, &opts[i], test_virtqueue_speed);
+    }
+
+    return g_test_run();
+}
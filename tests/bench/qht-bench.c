@@ -11,6 +11,7 @@
 #include "qemu/rcu.h"
 #include "qemu/xxhash.h"
 #include "qemu/memalign.h"
+#include "qemu/timer.h"
 
 struct thread_stats {
     size_t rd;
@@ -21,6 +22,8 @@ struct thread_stats {
     size_t not_rm;
     size_t rz;
     size_t not_rz;
+    uint64_t update_ns;
+    uint64_t update_ns_max;
 };
 
 struct thread_info {
@@ -61,6 +64,7 @@ static double resize_rate; /* 0.0 to 1.0 */
 static unsigned int n_rz_threads = 1;
 static QemuThread *rz_threads;
 static bool precompute_hash;
+static bool measure_latency;
 
 static double update_rate; /* 0.0 to 1.0 */
 static uint64_t update_threshold;
@@ -93,7 +97,9 @@ static const char commands_string[] =
     " -R = enable auto-resize\n"
     " -S = resize rate (0.0 to 100.0)\n"
     " -D = delay (in us) between potential resizes\n"
-    " -N = number of resize threads";
+    " -N = number of resize threads\n"
+    "\n"
+    " -L = measure the latency of updates, e.g. to spot resize stalls";
 
 static void usage_complete(int argc, char *argv[])
 {
@@ -175,6 +181,8 @@ static void do_rw(struct thread_info *info)
             stats->not_rd++;
         }
     } else {
+        int64_t start = measure_latency ? get_clock() : 0;
+
         p = &keys[r & (update_range - 1)];
         hash = hfunc(*p);
         if (info->write_op) {
@@ -201,6 +209,13 @@ static void do_rw(struct thread_info *info)
             }
         }
         info->write_op = !info->write_op;
+
+        if (measure_latency) {
+            uint64_t ns = get_clock() - start;
+
+            stats->update_ns += ns;
+            stats->update_ns_max = MAX(stats->update_ns_max, ns);
+        }
     }
 }
 
@@ -384,6 +399,9 @@ static void add_stats(struct thread_stats *s, struct thread_info *info, int n)
 
         s->rz += stats->rz;
         s->not_rz += stats->not_rz;
+
+        s->update_ns += stats->update_ns;
+        s->update_ns_max = MAX(s->update_ns_max, stats->update_ns_max);
     }
 }
 
@@ -414,6 +432,13 @@ static void pr_stats(void)
            (double)s.rm / 1e6,
            (double)s.rm / (s.rm + s.not_rm) * 100,
            (double)(s.rm + s.not_rm) / 1e6);
+    if (measure_latency) {
+        size_t updates = s.in + s.not_in + s.rm + s.not_rm;
+
+        printf(" Update latency:    %.2f us avg, %.2f us max\n",
+               updates ? (double)s.update_ns / updates / 1e3 : 0.0,
+               (double)s.update_ns_max / 1e3);
+    }
 
     tx = (s.rd + s.not_rd + s.in + s.not_in + s.rm + s.not_rm) / 1e6 / duration;
     printf(" Throughput:        %.2f MT/s\n", tx);
@@ -445,7 +470,7 @@ static void parse_args(int argc, char *argv[])
     int c;
 
     for (;;) {
-        c = getopt(argc, argv, "d:D:g:k:K:l:hn:N:o:pr:Rs:S:u:");
+        c = getopt(argc, argv, "d:D:g:k:K:l:Lhn:N:o:pr:Rs:S:u:");
         if (c < 0) {
             break;
         }
@@ -475,6 +500,9 @@ static void parse_args(int argc, char *argv[])
         case 'l':
             lookup_range = pow2ceil(atol(optarg));
             break;
+        case 'L':
+            measure_latency = true;
+            break;
         case 'n':
             n_rw_threads = atoi(optarg);
             break;
@@ -56,7 +56,12 @@ def _vcpu_timing(self, pid, tid_list):
         jiffies_per_sec = os.sysconf(os.sysconf_names['SC_CLK_TCK'])
         for tid in tid_list:
             statfile = "/proc/%d/task/%d/stat" % (pid, tid)
-            with open(statfile, "r") as fh:
+            try:
+                fh = open(statfile, "r")
+            except FileNotFoundError:
+                # Migration threads exit when migration completes
+                continue
+            with fh:
                 stat = fh.readline()
                 fields = stat.split(" ")
                 stime = int(fields[13])
@@ -106,9 +111,15 @@ def _migrate_progress(self, vm):
             info.get("dirty-limit-ring-full-time", 0),
         )
 
+    def _migration_threads(self, vm, threads):
+        for thread in vm.cmd("query-migrationthreads"):
+            threads[thread["thread-id"]] = thread["name"]
+
     def _migrate(self, hardware, scenario, src, dst, connect_uri):
         src_qemu_time = []
         src_vcpu_time = []
+        src_migration_time = []
+        src_migration_threads = {}
         src_pid = src.get_pid()
 
         vcpus = src.cmd("query-cpus-fast")
@@ -237,6 +248,9 @@ def _migrate(self, hardware, scenario, src, dst, connect_uri):
             if (loop % 20) == 0:
                 src_qemu_time.append(self._cpu_timing(src_pid))
                 src_vcpu_time.extend(self._vcpu_timing(src_pid, src_threads))
+                self._migration_threads(src, src_migration_threads)
+                src_migration_time.extend(
+                    self._vcpu_timing(src_pid, src_migration_threads.keys()))
 
             if (len(progress_history) == 0 or
                 (progress_history[-1]._ram._iterations <
@@ -259,7 +273,8 @@ def _migrate(self, hardware, scenario, src, dst, connect_uri):
                         src_vcpu_time.extend(self._vcpu_timing(src_pid, src_threads))
                         sleep_secs -= 1
 
-                return [progress_history, src_qemu_time, src_vcpu_time]
+                return [progress_history, src_qemu_time, src_vcpu_time,
+                        src_migration_time, src_migration_threads]
 
             if self._verbose and (loop % 20) == 0:
                 print("Iter %d: remain %5dMB of %5dMB (total %5dMB @ %5dMb/sec)" % (
@@ -336,6 +351,9 @@ def _get_common_args(self, hardware, tunnelled=False):
             args.append("quiet")
 
         args.append("ramsize=%s" % hardware._mem)
+        args.append("wss=%s" % hardware._wss)
+        args.append("dirtyrate=%s" % hardware._dirty_rate)
+        args.append("zeropct=%s" % hardware._zero_pages)
 
         cmdline = " ".join(args)
         if tunnelled:
@@ -465,6 +483,8 @@ def run(self, hardware, scenario, result_dir=os.getcwd()):
             progress_history = ret[0]
             qemu_timings = ret[1]
             vcpu_timings = ret[2]
+            migration_timings = ret[3]
+            migration_threads = ret[4]
             if uri[0:5] == "unix:" and os.path.exists(uri[5:]):
                 os.remove(uri[5:])
 
@@ -484,6 +504,8 @@ def run(self, hardware, scenario, result_dir=os.getcwd()):
                           Timings(self._get_timings(src) + self._get_timings(dst)),
                           Timings(qemu_timings),
                           Timings(vcpu_timings),
+                          Timings(migration_timings),
+                          migration_threads,
                           self._binary, self._dst_host, self._kernel,
                           self._initrd, self._transport, self._sleep)
         except Exception as e:
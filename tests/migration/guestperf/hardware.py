@@ -24,7 +24,8 @@ def __init__(self, cpus=1, mem=1,
                  dst_cpu_bind=None, dst_mem_bind=None,
                  prealloc_pages = False,
                  huge_pages=False, locked_pages=False,
-                 dirty_ring_size=0):
+                 dirty_ring_size=0,
+                 wss=0, dirty_rate=0, zero_pages=0):
         self._cpus = cpus
         self._mem = mem # GiB
         self._src_mem_bind = src_mem_bind # List of NUMA nodes
@@ -35,6 +36,9 @@ def __init__(self, cpus=1, mem=1,
         self._huge_pages = huge_pages
         self._locked_pages = locked_pages
         self._dirty_ring_size = dirty_ring_size
+        self._wss = wss # MiB dirtied by the guest, 0 for all of mem
+        self._dirty_rate = dirty_rate # MiB/s, 0 for unlimited
+        self._zero_pages = zero_pages # Percentage of the working set
 
 
     def serialize(self):
@@ -49,6 +53,9 @@ def serialize(self):
             "huge_pages": self._huge_pages,
             "locked_pages": self._locked_pages,
             "dirty_ring_size": self._dirty_ring_size,
+            "wss": self._wss,
+            "dirty_rate": self._dirty_rate,
+            "zero_pages": self._zero_pages,
         }
 
     @classmethod
@@ -63,4 +70,7 @@ def deserialize(cls, data):
             data["prealloc_pages"],
             data["huge_pages"],
             data["locked_pages"],
-            data["dirty_ring_size"])
+            data["dirty_ring_size"],
+            data.get("wss", 0),
+            data.get("dirty_rate", 0),
+            data.get("zero_pages", 0))
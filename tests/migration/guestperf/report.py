@@ -33,6 +33,8 @@ def __init__(self,
                  guest_timings,
                  qemu_timings,
                  vcpu_timings,
+                 migration_timings,
+                 migration_threads,
                  binary,
                  dst_host,
                  kernel,
@@ -46,6 +48,8 @@ def __init__(self,
         self._guest_timings = guest_timings
         self._qemu_timings = qemu_timings
         self._vcpu_timings = vcpu_timings
+        self._migration_timings = migration_timings
+        self._migration_threads = migration_threads # tid -> thread name
         self._binary = binary
         self._dst_host = dst_host
         self._kernel = kernel
@@ -61,6 +65,10 @@ def serialize(self):
             "guest_timings": self._guest_timings.serialize(),
             "qemu_timings": self._qemu_timings.serialize(),
             "vcpu_timings": self._vcpu_timings.serialize(),
+            "migration_timings": self._migration_timings.serialize(),
+            "migration_threads": [{"tid": tid, "name": name}
+                                  for tid, name in
+                                  self._migration_threads.items()],
             "binary": self._binary,
             "dst_host": self._dst_host,
             "kernel": self._kernel,
@@ -78,6 +86,9 @@ def deserialize(cls, data):
             Timings.deserialize(data["guest_timings"]),
             Timings.deserialize(data["qemu_timings"]),
             Timings.deserialize(data["vcpu_timings"]),
+            Timings.deserialize(data.get("migration_timings", [])),
+            {thread["tid"]: thread["name"]
+             for thread in data.get("migration_threads", [])},
             data["binary"],
             data["dst_host"],
             data["kernel"],
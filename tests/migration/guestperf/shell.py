@@ -63,6 +63,18 @@ def __init__(self):
         parser.add_argument("--dirty-ring-size", dest="dirty_ring_size",
                             default=0, type=int)
 
+        # Guest workload args
+        parser.add_argument("--wss", dest="wss", default=0, type=int,
+                            help="MiB dirtied by the guest (default: all)")
+        parser.add_argument("--dirty-rate", dest="dirty_rate", default=0,
+                            type=int,
+                            help="MiB/s dirtied by the guest (default: "
+                                 "unlimited)")
+        parser.add_argument("--zero-pages", dest="zero_pages", default=0,
+                            type=int,
+                            help="percentage of the working set that is "
+                                 "rewritten with zeroes")
+
         self._parser = parser
 
     def get_engine(self, args):
@@ -93,7 +105,11 @@ def split_map(value):
                         huge_pages=args.huge_pages,
                         prealloc_pages=args.prealloc_pages,
 
-                        dirty_ring_size=args.dirty_ring_size)
+                        dirty_ring_size=args.dirty_ring_size,
+
+                        wss=args.wss,
+                        dirty_rate=args.dirty_rate,
+                        zero_pages=args.zero_pages)
 
 
 class Shell(BaseShell):
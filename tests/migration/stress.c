@@ -156,40 +156,64 @@ static unsigned long long now(void)
     return (tv.tv_sec * 1000ull) + (tv.tv_usec / 1000ull);
 }
 
-static void stressone(unsigned long long ramsizeMB)
+/*
+ * Dirty @wssMB megabytes of RAM in a loop.  The first @zeropct percent of
+ * the pages of each megabyte are kept zero, but still written to so that
+ * they are dirtied like the others.  If @rateMB is not zero, the loop is
+ * throttled to dirty at most @rateMB megabytes per second.
+ */
+static void stressone(unsigned long long wssMB, unsigned long long rateMB,
+                      unsigned int zeropct)
 {
     size_t pagesPerMB = 1024 * 1024 / RAM_PAGE_SIZE;
-    g_autofree char *ram = g_malloc(ramsizeMB * 1024 * 1024);
+    size_t zeroPagesPerMB = pagesPerMB * zeropct / 100;
+    g_autofree char *ram = g_malloc(wssMB * 1024 * 1024);
     char *ramptr;
     size_t i, j, k;
     g_autofree char *data = g_malloc(RAM_PAGE_SIZE);
     char *dataptr;
     size_t nMB = 0;
-    unsigned long long before, after;
+    unsigned long long before, after, start, dirtiedMB = 0;
 
     /* We don't care about initial state, but we do want
      * to fault it all into RAM, otherwise the first iter
      * of the loop below will be quite slow. We can't use
      * 0x0 as the byte as gcc optimizes that away into a
      * calloc instead :-) */
-    memset(ram, 0xfe, ramsizeMB * 1024 * 1024);
+    memset(ram, 0xfe, wssMB * 1024 * 1024);
+    for (i = 0; i < wssMB; i++) {
+        memset(ram + i * 1024 * 1024, 0, zeroPagesPerMB * RAM_PAGE_SIZE);
+    }
 
     if (random_bytes(data, RAM_PAGE_SIZE) < 0) {
         return;
     }
 
-    before = now();
+    before = start = now();
 
     while (1) {
 
         ramptr = ram;
-        for (i = 0; i < ramsizeMB; i++, nMB++) {
-            for (j = 0; j < pagesPerMB; j++) {
+        for (i = 0; i < wssMB; i++, nMB++) {
+            for (j = 0; j < zeroPagesPerMB; j++) {
+                *(volatile unsigned long long *)ramptr = 0;
+                ramptr += RAM_PAGE_SIZE;
+            }
+            for (; j < pagesPerMB; j++) {
                 dataptr = data;
                 for (k = 0; k < RAM_PAGE_SIZE; k += sizeof(long long)) {
+                    *(unsigned long long *)ramptr ^= *(unsigned long long *)dataptr;
                     ramptr += sizeof(long long);
                     dataptr += sizeof(long long);
-                    *(unsigned long long *)ramptr ^= *(unsigned long long *)dataptr;
+                }
+            }
+
+            if (rateMB) {
+                unsigned long long due = start + ++dirtiedMB * 1000 / rateMB;
+
+                after = now();
+                if (after < due) {
+                    g_usleep((due - after) * 1000);
                 }
             }
 
@@ -205,28 +229,40 @@ static void stressone(unsigned long long ramsizeMB)
 }
 
 
+typedef struct StressArgs {
+    unsigned long long wssMB;
+    unsigned long long rateMB;
+    unsigned int zeropct;
+} StressArgs;
+
 static void *stressthread(void *arg)
 {
-    unsigned long long ramsizeMB = *(unsigned long long *)arg;
+    StressArgs *args = arg;
 
-    stressone(ramsizeMB);
+    stressone(args->wssMB, args->rateMB, args->zeropct);
 
     return NULL;
 }
 
-static void stress(unsigned long long ramsizeGB, int ncpus)
+static void stress(unsigned long long wssMB, unsigned long long rateMB,
+                   unsigned int zeropct, int ncpus)
 {
     size_t i;
-    unsigned long long ramsizeMB = ramsizeGB * 1024 / ncpus;
+    StressArgs args = {
+        .wssMB = MAX(wssMB / ncpus, 1),
+        /* Round up, so that a low total rate does not mean unthrottled */
+        .rateMB = DIV_ROUND_UP(rateMB, ncpus),
+        .zeropct = zeropct,
+    };
     ncpus--;
 
     for (i = 0; i < ncpus; i++) {
         pthread_t thr;
         pthread_create(&thr, NULL,
-                       stressthread,   &ramsizeMB);
+                       stressthread,   &args);
     }
 
-    stressone(ramsizeMB);
+    stressone(args.wssMB, args.rateMB, args.zeropct);
 }
 
 
@@ -263,14 +299,20 @@ static int mount_all(void)
 int main(int argc, char **argv)
 {
     unsigned long long ramsizeGB = 1;
+    unsigned long long wssMB = 0;
+    unsigned long long rateMB = 0;
+    unsigned long long zeropct = 0;
     char *end;
     int ch;
     int opt_ind = 0;
-    const char *sopt = "hr:c:";
+    const char *sopt = "hr:c:w:d:z:";
     struct option lopt[] = {
         { "help", no_argument, NULL, 'h' },
         { "ramsize", required_argument, NULL, 'r' },
         { "cpus", required_argument, NULL, 'c' },
+        { "wss", required_argument, NULL, 'w' },
+        { "dirty-rate", required_argument, NULL, 'd' },
+        { "zero-pages", required_argument, NULL, 'z' },
         { NULL, 0, NULL, 0 }
     };
     int ret;
@@ -300,9 +342,40 @@ int main(int argc, char **argv)
             }
             break;
 
+        case 'w':
+            errno = 0;
+            wssMB = strtoll(optarg, &end, 10);
+            if (errno != 0 || *end) {
+                fprintf(stderr, "%s (%05d): ERROR: Cannot parse working set size %s\n",
+                        argv0, gettid(), optarg);
+                exit_failure();
+            }
+            break;
+
+        case 'd':
+            errno = 0;
+            rateMB = strtoll(optarg, &end, 10);
+            if (errno != 0 || *end) {
+                fprintf(stderr, "%s (%05d): ERROR: Cannot parse dirty rate %s\n",
+                        argv0, gettid(), optarg);
+                exit_failure();
+            }
+            break;
+
+        case 'z':
+            errno = 0;
+            zeropct = strtoll(optarg, &end, 10);
+            if (errno != 0 || *end) {
+                fprintf(stderr, "%s (%05d): ERROR: Cannot parse zero pages percentage %s\n",
+                        argv0, gettid(), optarg);
+                exit_failure();
+            }
+            break;
+
         case '?':
         case 'h':
-            fprintf(stderr, "%s: [--help][--ramsize GB][--cpus N]\n", argv0);
+            fprintf(stderr, "%s: [--help][--ramsize GB][--cpus N][--wss MB]"
+                    "[--dirty-rate MB/s][--zero-pages PERCENT]\n", argv0);
             exit_failure();
         }
     }
@@ -314,15 +387,31 @@ int main(int argc, char **argv)
         ret = get_command_arg_ull("ramsize", &ramsizeGB);
         if (ret < 0)
             exit_failure();
+
+        if (get_command_arg_ull("wss", &wssMB) < 0 ||
+            get_command_arg_ull("dirtyrate", &rateMB) < 0 ||
+            get_command_arg_ull("zeropct", &zeropct) < 0)
+            exit_failure();
     }
 
     if (ncpus == 0)
         ncpus = sysconf(_SC_NPROCESSORS_ONLN);
 
-    fprintf(stdout, "%s (%05d): INFO: RAM %llu GiB across %d CPUs\n",
-            argv0, gettid(), ramsizeGB, ncpus);
+    /* By default, the whole RAM is the working set */
+    if (wssMB == 0 || wssMB > ramsizeGB * 1024)
+        wssMB = ramsizeGB * 1024;
+
+    if (zeropct > 100) {
+        fprintf(stderr, "%s (%05d): ERROR: zero pages percentage %llu is over 100\n",
+                argv0, gettid(), zeropct);
+        exit_failure();
+    }
+
+    fprintf(stdout, "%s (%05d): INFO: RAM %llu GiB across %d CPUs, "
+            "dirtying %llu MiB (%llu MiB/s, 0 is unlimited) with %llu%% zero pages\n",
+            argv0, gettid(), ramsizeGB, ncpus, wssMB, rateMB, zeropct);
 
-    stress(ramsizeGB, ncpus);
+    stress(wssMB, rateMB, zeropct, ncpus);
 
     exit_failure();
 }
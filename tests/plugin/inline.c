@@ -16,6 +16,8 @@
 typedef struct {
     uint64_t count_tb;
     uint64_t count_tb_inline;
+    uint64_t tb_cond_num_trigger;
+    uint64_t tb_cond_track_count;
     uint64_t count_insn;
     uint64_t count_insn_inline;
     uint64_t count_mem;
@@ -25,6 +27,8 @@ typedef struct {
 static struct qemu_plugin_scoreboard *counts;
 static qemu_plugin_u64 count_tb;
 static qemu_plugin_u64 count_tb_inline;
+static qemu_plugin_u64 tb_cond_num_trigger;
+static qemu_plugin_u64 tb_cond_track_count;
 static qemu_plugin_u64 count_insn;
 static qemu_plugin_u64 count_insn_inline;
 static qemu_plugin_u64 count_mem;
@@ -38,6 +42,9 @@ static GMutex tb_lock;
 static GMutex insn_lock;
 static GMutex mem_lock;
 
+/* Number of executions of a block after which the conditional cb fires */
+static const uint64_t cond_trigger_limit = 100;
+
 QEMU_PLUGIN_EXPORT int qemu_plugin_version = QEMU_PLUGIN_VERSION;
 
 static void stats_insn(void)
@@ -100,6 +107,9 @@ static void plugin_exit(qemu_plugin_id_t id, void *udata)
                "\n",
                i, tb, tb_inline, insn, insn_inline, mem, mem_inline);
         g_assert(tb == tb_inline);
+        g_assert(qemu_plugin_u64_get(tb_cond_num_trigger, i) *
+                 cond_trigger_limit +
+                 qemu_plugin_u64_get(tb_cond_track_count, i) == tb);
         g_assert(insn == insn_inline);
         g_assert(mem == mem_inline);
     }
@@ -120,6 +130,14 @@ static void vcpu_tb_exec(unsigned int cpu_index, void *udata)
     g_mutex_unlock(&tb_lock);
 }
 
+static void vcpu_tb_cond_exec(unsigned int cpu_index, void *udata)
+{
+    g_assert(qemu_plugin_u64_get(tb_cond_track_count, cpu_index) ==
+             cond_trigger_limit);
+    qemu_plugin_u64_set(tb_cond_track_count, cpu_index, 0);
+    qemu_plugin_u64_add(tb_cond_num_trigger, cpu_index, 1);
+}
+
 static void vcpu_insn_exec(unsigned int cpu_index, void *udata)
 {
     qemu_plugin_u64_add(count_insn, cpu_index, 1);
@@ -145,6 +163,11 @@ static void vcpu_tb_trans(qemu_plugin_id_t id, struct qemu_plugin_tb *tb)
         tb, vcpu_tb_exec, QEMU_PLUGIN_CB_NO_REGS, 0);
     qemu_plugin_register_vcpu_tb_exec_inline_per_vcpu(
         tb, QEMU_PLUGIN_INLINE_ADD_U64, count_tb_inline, 1);
+    qemu_plugin_register_vcpu_tb_exec_inline_per_vcpu(
+        tb, QEMU_PLUGIN_INLINE_ADD_U64, tb_cond_track_count, 1);
+    qemu_plugin_register_vcpu_tb_exec_cond_cb(
+        tb, vcpu_tb_cond_exec, QEMU_PLUGIN_CB_NO_REGS,
+        QEMU_PLUGIN_COND_EQ, tb_cond_track_count, cond_trigger_limit, 0);
 
     for (int idx = 0; idx < qemu_plugin_tb_n_insns(tb); ++idx) {
         struct qemu_plugin_insn *insn = qemu_plugin_tb_get_insn(tb, idx);
@@ -175,6 +198,10 @@ int qemu_plugin_install(qemu_plugin_id_t id, const qemu_info_t *info,
         counts, CPUCount, count_mem);
     count_tb_inline = qemu_plugin_scoreboard_u64_in_struct(
         counts, CPUCount, count_tb_inline);
+    tb_cond_num_trigger = qemu_plugin_scoreboard_u64_in_struct(
+        counts, CPUCount, tb_cond_num_trigger);
+    tb_cond_track_count = qemu_plugin_scoreboard_u64_in_struct(
+        counts, CPUCount, tb_cond_track_count);
     count_insn_inline = qemu_plugin_scoreboard_u64_in_struct(
         counts, CPUCount, count_insn_inline);
     count_mem_inline = qemu_plugin_scoreboard_u64_in_struct(
@@ -0,0 +1,128 @@
+/*
+ * QTest testcase for dump-guest-memory
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ *
+ * Checks that compressing a kdump in several threads produces the same
+ * file as compressing it in one.
+ */
+
+#include "qemu/osdep.h"
+#include "libqtest.h"
+#include "qapi/qmp/qdict.h"
+#include "qapi/qmp/qlist.h"
+#include "qapi/qmp/qstring.h"
+
+static bool dump_format_available(QTestState *qts, const char *format)
+{
+    QDict *rsp;
+    QListEntry *e;
+    bool found = false;
+
+    rsp = qtest_qmp_assert_success_ref(qts,
+              "{ 'execute': 'query-dump-guest-memory-capability' }");
+    QLIST_FOREACH_ENTRY(qdict_get_qlist(rsp, "formats"), e) {
+        QString *name = qobject_to(QString, qlist_entry_obj(e));
+
+        if (g_str_equal(qstring_get_str(name), format)) {
+            found = true;
+            break;
+        }
+    }
+    qobject_unref(rsp);
+    return found;
+}
+
+/* Dump the guest memory in @format and return the contents of the file */
+static char *dump_guest_memory(QTestState *qts, const char *format,
+                               int compress_threads, gsize *len)
+{
+    g_autofree char *path = NULL;
+    g_autofree char *protocol = NULL;
+    char *contents;
+    int fd;
+
+    fd = g_file_open_tmp("dump-XXXXXX", &path, NULL);
+    g_assert(fd >= 0);
+    close(fd);
+    protocol = g_strdup_printf("file:%s", path);
+
+    if (compress_threads) {
+        qtest_qmp_assert_success(qts,
+            "{ 'execute': 'dump-guest-memory', 'arguments': {"
+            " 'paging': false, 'protocol': %s, 'format': %s,"
+            " 'compress-threads': %d } }",
+            protocol, format, compress_threads);
+    } else {
+        qtest_qmp_assert_success(qts,
+            "{ 'execute': 'dump-guest-memory', 'arguments': {"
+            " 'paging': false, 'protocol': %s, 'format': %s } }",
+            protocol, format);
+    }
+
+    g_assert(g_file_get_contents(path, &contents, len, NULL));
+    unlink(path);
+    return contents;
+}
+
+static void test_dump_compress_threads_format(QTestState *qts,
+                                              const char *format)
+{
+    g_autofree char *single = NULL;
+    g_autofree char *multi = NULL;
+    gsize single_len, multi_len;
+
+    if (!dump_format_available(qts, format)) {
+        g_test_message("%s not available, skipping", format);
+        return;
+    }
+
+    single = dump_guest_memory(qts, format, 0, &single_len);
+    multi = dump_guest_memory(qts, format, 4, &multi_len);
+    g_assert_cmpuint(single_len, ==, multi_len);
+    g_assert(memcmp(single, multi, single_len) == 0);
+}
+
+static void test_dump_compress_threads(void)
+{
+    const size_t page_size = 4096;
+    const size_t size = 4 * 1024 * 1024;
+    g_autofree uint8_t *buf = g_malloc0(size);
+    QTestState *qts;
+    size_t i;
+
+    qts = qtest_init("-S -m 32");
+
+    /*
+     * Mix zero pages, compressible pages and pages that do not compress,
+     * so that the batches handed to the workers differ in size.
+     */
+    for (i = 0; i < size; i++) {
+        size_t page = i / page_size;
+
+        switch (page % 3) {
+        case 1:
+            buf[i] = page;
+            break;
+        case 2:
+            buf[i] = (i * 2654435761u) >> 24;
+            break;
+        }
+    }
+    qtest_memwrite(qts, 1024 * 1024, buf, size);
+
+    test_dump_compress_threads_format(qts, "kdump-zlib");
+    test_dump_compress_threads_format(qts, "kdump-zstd");
+
+    qtest_quit(qts);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    qtest_add_func("dump/compress-threads", test_dump_compress_threads);
+
+    return g_test_run();
+}
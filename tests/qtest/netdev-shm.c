@@ -0,0 +1,136 @@
+/*
+ * QTest testcase for netdev shm
+ *
+ * The test plays the other instance: it writes records to the receive
+ * ring of QEMU and reads the packets that come out of a socket netdev
+ * on the same hub.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "qemu/osdep.h"
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include "libqtest.h"
+#include "qemu/atomic.h"
+#include "qemu/bswap.h"
+#include "qemu/units.h"
+
+/* Must match the layout in net/shm.c */
+#define SHM_RING_HDR_SIZE 4096
+#define SHM_RING_SIZE (256 * KiB)
+#define SHM_RING_PAD UINT32_MAX
+#define SHM_HALF_SIZE (SHM_RING_HDR_SIZE + SHM_RING_SIZE)
+
+typedef struct ShmRingHdr {
+    uint32_t head QEMU_ALIGNED(64);
+    uint32_t tail QEMU_ALIGNED(64);
+    uint32_t consumer_idle QEMU_ALIGNED(64);
+    uint32_t producer_waiting QEMU_ALIGNED(64);
+} ShmRingHdr;
+
+typedef struct TestState {
+    QTestState *qts;
+    int notify_fd;
+    int sock;
+    ShmRingHdr *hdr;
+    uint8_t *data;
+} TestState;
+
+static void kick(TestState *t)
+{
+    uint64_t value = 1;
+
+    g_assert_cmpint(write(t->notify_fd, &value, sizeof(value)), ==,
+                    sizeof(value));
+}
+
+/* Publish records up to @head and wait until QEMU has consumed them */
+static void produce(TestState *t, uint32_t head)
+{
+    gint64 deadline = g_get_monotonic_time() + 60 * G_USEC_PER_SEC;
+
+    qatomic_store_release(&t->hdr->head, head);
+    kick(t);
+    while (qatomic_load_acquire(&t->hdr->tail) != head) {
+        g_assert_cmpint(g_get_monotonic_time(), <, deadline);
+        g_usleep(1000);
+    }
+}
+
+static void test_shm_corrupted(void)
+{
+    char path[] = "/tmp/qtest-netdev-shm-XXXXXX";
+    const char msg[] = "Hello! netdev-shm";
+    uint32_t len, size;
+    char buf[sizeof(msg)];
+    int notify[2], sock[2];
+    TestState t;
+    int fd, ret;
+    uint8_t *mem;
+
+    fd = mkstemp(path);
+    g_assert_cmpint(fd, >=, 0);
+    unlink(path);
+    g_assert_cmpint(ftruncate(fd, 2 * SHM_HALF_SIZE), ==, 0);
+    mem = mmap(NULL, 2 * SHM_HALF_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED,
+               fd, 0);
+    g_assert(mem != MAP_FAILED);
+
+    notify[0] = eventfd(0, 0);
+    notify[1] = eventfd(0, 0);
+    g_assert_cmpint(notify[0], >=, 0);
+    g_assert_cmpint(notify[1], >=, 0);
+    ret = socketpair(PF_UNIX, SOCK_STREAM, 0, sock);
+    g_assert_cmpint(ret, !=, -1);
+
+    /* QEMU transmits on side 0, the test on side 1 */
+    t.qts = qtest_initf("-netdev shm,id=s0,fd=%d,notify-fd=%d,"
+                        "peer-notify-fd=%d,side=0 "
+                        "-netdev socket,id=k0,fd=%d "
+                        "-netdev hubport,id=h0,hubid=0,netdev=s0 "
+                        "-netdev hubport,id=h1,hubid=0,netdev=k0",
+                        fd, notify[0], notify[1], sock[1]);
+    t.notify_fd = notify[0];
+    t.sock = sock[0];
+    t.hdr = (ShmRingHdr *)(mem + SHM_HALF_SIZE);
+    t.data = mem + SHM_HALF_SIZE + SHM_RING_HDR_SIZE;
+    qtest_qmp_assert_success(t.qts, "{ 'execute' : 'query-status'}");
+
+    /* A record that extends past the head is discarded */
+    stl_he_p(t.data, 64 * KiB);
+    produce(&t, 8);
+
+    /* So is a padding record that skips past the head */
+    stl_he_p(t.data + 8, SHM_RING_PAD);
+    produce(&t, 16);
+
+    /* A valid packet still goes through afterwards */
+    stl_he_p(t.data + 16, sizeof(msg));
+    memcpy(t.data + 20, msg, sizeof(msg));
+    produce(&t, 16 + ROUND_UP(sizeof(uint32_t) + sizeof(msg), 8));
+
+    ret = recv(t.sock, &size, sizeof(size), 0);
+    g_assert_cmpint(ret, ==, sizeof(size));
+    len = ntohl(size);
+    g_assert_cmpint(len, ==, sizeof(msg));
+    ret = recv(t.sock, buf, len, 0);
+    g_assert_cmpint(ret, ==, len);
+    g_assert_cmpstr(buf, ==, msg);
+
+    qtest_quit(t.qts);
+    close(sock[0]);
+    close(sock[1]);
+    close(notify[0]);
+    close(notify[1]);
+    munmap(mem, 2 * SHM_HALF_SIZE);
+    close(fd);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    qtest_add_func("/netdev/shm/corrupted", test_shm_corrupted);
+    return g_test_run();
+}
@@ -0,0 +1,156 @@
+/*
+ * QTest testcase for running out of TCG code buffer space
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ *
+ * The guest runs through more code than fits in a small code buffer, in
+ * a loop, so the buffer is flushed (one region) or its oldest regions
+ * are reclaimed (several regions) over and over.  The guest must keep
+ * running correctly across that.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/units.h"
+#include "libqtest.h"
+
+#define BIOS_SIZE       (64 * KiB)
+
+/* The code occupies the real mode segments 0x1000 to 0x9000 */
+#define CODE_FIRST_SEG  0x1000
+#define CODE_LAST_SEG   0x9000
+#define SEG_SIZE        (64 * KiB)
+#define SEG_TAIL        16
+
+/* Incremented by the guest every time it goes through all the code */
+#define COUNTER_ADDR    0x500
+
+#define TIMEOUT_S       120
+
+static void write_far_jmp(uint8_t *p, uint16_t seg)
+{
+    /* jmp far seg:0000 */
+    p[0] = 0xea;
+    p[1] = 0x00;
+    p[2] = 0x00;
+    p[3] = seg & 0xff;
+    p[4] = seg >> 8;
+}
+
+/* A BIOS that only jumps to the start of the code in RAM */
+static char *make_bios(void)
+{
+    g_autofree uint8_t *bios = g_malloc(BIOS_SIZE);
+    GError *err = NULL;
+    char *path;
+    int fd;
+
+    memset(bios, 0xf4, BIOS_SIZE); /* hlt */
+    write_far_jmp(bios + BIOS_SIZE - 16, CODE_FIRST_SEG);
+
+    fd = g_file_open_tmp("tcg-region-bios-XXXXXX", &path, &err);
+    g_assert_no_error(err);
+    close(fd);
+    g_file_set_contents(path, (char *)bios, BIOS_SIZE, &err);
+    g_assert_no_error(err);
+    return path;
+}
+
+/*
+ * Fill each segment with "mov [0x600], ax": every instruction needs a
+ * softmmu store, so the host code is many times larger than the guest
+ * code.  Each segment ends with a jump to the next one and the last one
+ * increments the counter and jumps back to the first.
+ */
+static void write_code(QTestState *qts)
+{
+    g_autofree uint8_t *seg = g_malloc(SEG_SIZE);
+    uint16_t s;
+    int i;
+
+    for (i = 0; i < SEG_SIZE - SEG_TAIL; i += 3) {
+        seg[i] = 0xa3;
+        seg[i + 1] = 0x00;
+        seg[i + 2] = 0x06;
+    }
+    for (s = CODE_FIRST_SEG; s <= CODE_LAST_SEG; s += 0x1000) {
+        uint8_t *tail = seg + SEG_SIZE - SEG_TAIL;
+
+        memset(tail, 0xf4, SEG_TAIL);
+        if (s != CODE_LAST_SEG) {
+            write_far_jmp(tail, s + 0x1000);
+        } else {
+            /* inc word [COUNTER_ADDR] */
+            tail[0] = 0xff;
+            tail[1] = 0x06;
+            tail[2] = COUNTER_ADDR & 0xff;
+            tail[3] = COUNTER_ADDR >> 8;
+            write_far_jmp(tail + 4, CODE_FIRST_SEG);
+        }
+        qtest_memwrite(qts, (uint64_t)s << 4, seg, SEG_SIZE);
+    }
+}
+
+static unsigned int jit_stat(QTestState *qts, const char *name)
+{
+    g_autofree char *info = qtest_hmp(qts, "info jit");
+    const char *p = strstr(info, name);
+    unsigned int val;
+
+    g_assert(p);
+    g_assert_cmpint(sscanf(p + strlen(name), " %u", &val), ==, 1);
+    return val;
+}
+
+static void test_tb_size(const void *data)
+{
+    int tb_size = GPOINTER_TO_INT(data);
+    /* With a single region, the whole buffer is flushed */
+    const char *stat = tb_size < 4 ? "TB flush count" : "TB reclaim count";
+    g_autofree char *bios = make_bios();
+    gint64 end = g_get_monotonic_time() + TIMEOUT_S * G_USEC_PER_SEC;
+    QTestState *qts;
+    uint16_t start;
+
+    qts = qtest_initf("-machine pc -nodefaults -S -bios %s "
+                      "-accel tcg,tb-size=%d", bios, tb_size);
+    write_code(qts);
+    qtest_qmp_assert_success(qts, "{ 'execute': 'cont' }");
+
+    /* Wait for the buffer to fill once... */
+    while (!jit_stat(qts, stat)) {
+        g_assert(g_get_monotonic_time() < end);
+        g_usleep(10 * 1000);
+    }
+
+    /* ... then for the guest to go through all of its code twice more */
+    start = qtest_readw(qts, COUNTER_ADDR);
+    while ((uint16_t)(qtest_readw(qts, COUNTER_ADDR) - start) < 2) {
+        g_assert(g_get_monotonic_time() < end);
+        g_usleep(10 * 1000);
+    }
+    g_assert_cmpuint(jit_stat(qts, stat), >=, 2);
+
+    qtest_quit(qts);
+    unlink(bios);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    if (!qtest_has_accel("tcg")) {
+        g_test_skip("TCG is not available");
+        return g_test_run();
+    }
+    if (!qtest_has_machine("pc")) {
+        g_test_skip("pc machine is not available");
+        return g_test_run();
+    }
+
+    qtest_add_data_func("tcg-region/flush", GINT_TO_POINTER(1), test_tb_size);
+    qtest_add_data_func("tcg-region/reclaim", GINT_TO_POINTER(4),
+                        test_tb_size);
+
+    return g_test_run();
+}
@@ -9,8 +9,22 @@
 
 #include "qemu/osdep.h"
 #include "libqtest-single.h"
+#include "qemu/bswap.h"
 #include "qemu/module.h"
 #include "libqos/virtio-serial.h"
+#include "standard-headers/linux/virtio_config.h"
+#include "standard-headers/linux/virtio_console.h"
+#include "standard-headers/linux/virtio_ring.h"
+
+#define QVIRTIO_SERIAL_TIMEOUT_US   (30 * 1000 * 1000)
+
+/* Port 1 queues come after the ones of port 0 and of the control port */
+#define VSER_CTRL_TX_QUEUE          3
+#define VSER_PORT1_TX_QUEUE         5
+
+/* Enough data to fill up the socket buffer and throttle the port */
+#define VSER_TX_BUFS                16
+#define VSER_TX_BUF_SIZE            (64 * 1024)
 
 /* Tests only initialization so far. TODO: Replace with functional tests */
 static void virtio_serial_nop(void *obj, void *data, QGuestAllocator *alloc)
@@ -24,6 +38,151 @@ static void serial_hotplug(void *obj, void *data, QGuestAllocator *alloc)
     qtest_qmp_device_del(global_qtest, "hp-port");
 }
 
+#ifndef _WIN32
+
+static void send_control_event(QVirtioDevice *dev, QGuestAllocator *alloc,
+                               QVirtQueue *vq, uint32_t id, uint16_t event,
+                               uint16_t value)
+{
+    QTestState *qts = global_qtest;
+    struct virtio_console_control cpkt;
+    uint64_t addr;
+    uint32_t free_head;
+
+    if (qvirtio_is_big_endian(dev)) {
+        cpkt.id = cpu_to_be32(id);
+        cpkt.event = cpu_to_be16(event);
+        cpkt.value = cpu_to_be16(value);
+    } else {
+        cpkt.id = cpu_to_le32(id);
+        cpkt.event = cpu_to_le16(event);
+        cpkt.value = cpu_to_le16(value);
+    }
+
+    addr = guest_alloc(alloc, sizeof(cpkt));
+    memwrite(addr, &cpkt, sizeof(cpkt));
+
+    free_head = qvirtqueue_add(qts, vq, addr, sizeof(cpkt), false, false);
+    qvirtqueue_kick(qts, dev, vq, free_head);
+    qvirtio_wait_used_elem(qts, dev, vq, free_head, NULL,
+                           QVIRTIO_SERIAL_TIMEOUT_US);
+    guest_free(alloc, addr);
+}
+
+/*
+ * With VIRTIO_F_IN_ORDER, the element a throttled port holds on to is
+ * detached when the host side goes away.  The buffers the guest queued
+ * after it must still be returned to the guest.
+ */
+static void serial_in_order_detach(void *obj, void *data,
+                                   QGuestAllocator *alloc)
+{
+    QVirtioSerial *serial = obj;
+    QVirtioDevice *dev = serial->vdev;
+    QTestState *qts = global_qtest;
+    int *sv = data;
+    QVirtQueue *ctrl_vq, *tx_vq;
+    uint64_t features;
+    uint64_t addr[VSER_TX_BUFS];
+    uint32_t free_head;
+    unsigned int used = 0;
+    gint64 start_time;
+    int i;
+
+    features = qvirtio_get_features(dev);
+    if (!(features & (1ull << VIRTIO_F_IN_ORDER))) {
+        g_test_skip("VIRTIO_F_IN_ORDER not offered by the transport");
+        return;
+    }
+    features = features & ~(QVIRTIO_F_BAD_FEATURE |
+                    (1u << VIRTIO_RING_F_INDIRECT_DESC) |
+                    (1u << VIRTIO_RING_F_EVENT_IDX) |
+                    (1ull << VIRTIO_F_NOTIFICATION_DATA));
+    g_assert(features & (1u << VIRTIO_CONSOLE_F_MULTIPORT));
+    qvirtio_set_features(dev, features);
+
+    ctrl_vq = qvirtqueue_setup(dev, alloc, VSER_CTRL_TX_QUEUE);
+    tx_vq = qvirtqueue_setup(dev, alloc, VSER_PORT1_TX_QUEUE);
+    qvirtio_set_driver_ok(dev);
+
+    send_control_event(dev, alloc, ctrl_vq, 1, VIRTIO_CONSOLE_PORT_OPEN, 1);
+
+    /* Nobody reads the other end of the socket, so the port gets throttled */
+    for (i = 0; i < VSER_TX_BUFS; i++) {
+        addr[i] = guest_alloc(alloc, VSER_TX_BUF_SIZE);
+        free_head = qvirtqueue_add(qts, tx_vq, addr[i], VSER_TX_BUF_SIZE,
+                                   false, false);
+        qvirtqueue_kick(qts, dev, tx_vq, free_head);
+    }
+
+    start_time = g_get_monotonic_time();
+    for (;;) {
+        qtest_clock_step(qts, 100);
+        while (qvirtqueue_get_buf(qts, tx_vq, &free_head, NULL)) {
+            g_assert_cmpint(free_head, ==, used);
+            used++;
+        }
+        if (g_get_monotonic_time() - start_time > 1000 * 1000) {
+            break;
+        }
+        g_usleep(1000 * 10);
+    }
+    g_assert_cmpint(used, <, VSER_TX_BUFS);
+
+    /* The host side closes, the port detaches the element it holds */
+    close(sv[0]);
+    sv[0] = -1;
+
+    start_time = g_get_monotonic_time();
+    while (used < VSER_TX_BUFS) {
+        qtest_clock_step(qts, 100);
+        while (qvirtqueue_get_buf(qts, tx_vq, &free_head, NULL)) {
+            g_assert_cmpint(free_head, ==, used);
+            used++;
+        }
+        g_assert(g_get_monotonic_time() - start_time <=
+                 QVIRTIO_SERIAL_TIMEOUT_US);
+    }
+
+    for (i = 0; i < VSER_TX_BUFS; i++) {
+        guest_free(alloc, addr[i]);
+    }
+    qvirtqueue_cleanup(dev->bus, tx_vq, alloc);
+    qvirtqueue_cleanup(dev->bus, ctrl_vq, alloc);
+}
+
+static void serial_in_order_cleanup(void *sockets)
+{
+    int *sv = sockets;
+
+    if (sv[0] >= 0) {
+        close(sv[0]);
+    }
+    qos_invalidate_command_line();
+    close(sv[1]);
+    g_free(sv);
+}
+
+static void *serial_in_order_setup(GString *cmd_line, void *arg)
+{
+    int ret;
+    int *sv = g_new(int, 2);
+
+    ret = socketpair(PF_UNIX, SOCK_STREAM, 0, sv);
+    g_assert_cmpint(ret, !=, -1);
+
+    g_string_append_printf(cmd_line,
+                           " -global virtio-serial-device.in_order=on"
+                           " -chardev socket,id=vsp0,fd=%d"
+                           " -device virtserialport,bus=vser0.0,nr=1,"
+                           "chardev=vsp0 ", sv[1]);
+
+    g_test_queue_destroy(serial_in_order_cleanup, sv);
+    return sv;
+}
+
+#endif /* _WIN32 */
+
 static void register_virtio_serial_test(void)
 {
     QOSGraphTestOptions opts = { };
@@ -35,5 +194,12 @@ static void register_virtio_serial_test(void)
     qos_add_test("serialport-nop", "virtio-serial", virtio_serial_nop, &opts);
 
     qos_add_test("hotplug", "virtio-serial", serial_hotplug, NULL);
+
+#ifndef _WIN32
+    opts.edge.before_cmd_line = NULL;
+    opts.before = serial_in_order_setup;
+    qos_add_test("in-order-detach", "virtio-serial", serial_in_order_detach,
+                 &opts);
+#endif
 }
 libqos_init(register_virtio_serial_test);
@@ -15,6 +15,7 @@
 
 #include "qapi/error.h"
 #include "qapi/qmp/qbool.h"
+#include "qapi/qmp/json-parser.h"
 #include "qapi/qmp/qjson.h"
 #include "qapi/qmp/qlit.h"
 #include "qapi/qmp/qnull.h"
@@ -1150,6 +1151,95 @@ static void large_dict(void)
     g_string_free(gstr, true);
 }
 
+static void stream_emit(void *opaque, QObject *json, Error *err)
+{
+    GPtrArray *values = opaque;
+
+    g_assert(!err);
+    g_ptr_array_add(values, json);
+}
+
+static void stream_messages(void)
+{
+    g_autoptr(GPtrArray) values = g_ptr_array_new_with_free_func(
+        (GDestroyNotify)qobject_unref_impl);
+    GString *large = g_string_new("");
+    GString *input = g_string_new("");
+    JSONMessageParser parser;
+    QObject *obj;
+    GString *expected, *actual;
+    int i;
+
+    /*
+     * Large messages around small ones, so that the token buffers are
+     * both reused and dropped between messages.
+     */
+    gen_test_json(large, 10, 100);
+    g_string_append_printf(input, "%s {'a': 1} [\"b\"] %s",
+                           large->str, large->str);
+
+    json_message_parser_init(&parser, stream_emit, values, NULL);
+    for (i = 0; i < input->len; i += 7) {
+        json_message_parser_feed(&parser, input->str + i,
+                                 MIN(7, input->len - i));
+    }
+    json_message_parser_flush(&parser);
+    json_message_parser_destroy(&parser);
+
+    g_assert_cmpint(values->len, ==, 4);
+
+    obj = qobject_from_json(large->str, &error_abort);
+    expected = qobject_to_json(obj);
+    for (i = 0; i < values->len; i += 3) {
+        actual = qobject_to_json(g_ptr_array_index(values, i));
+        g_assert_cmpstr(actual->str, ==, expected->str);
+        g_string_free(actual, true);
+    }
+    actual = qobject_to_json(g_ptr_array_index(values, 1));
+    g_assert_cmpstr(actual->str, ==, "{\"a\": 1}");
+    g_string_free(actual, true);
+    actual = qobject_to_json(g_ptr_array_index(values, 2));
+    g_assert_cmpstr(actual->str, ==, "[\"b\"]");
+    g_string_free(actual, true);
+
+    g_string_free(expected, true);
+    qobject_unref(obj);
+    g_string_free(input, true);
+    g_string_free(large, true);
+}
+
+static void stream_append(void *opaque, const char *buf, size_t len)
+{
+    GString *out = opaque;
+
+    g_assert_cmpint(strlen(buf), ==, len);
+    g_string_append_len(out, buf, len);
+}
+
+static void stream_writer(void)
+{
+    GString *gstr = g_string_new("");
+    QObject *obj;
+    int pretty;
+
+    /* Large enough to be written in several chunks */
+    gen_test_json(gstr, 10, 200);
+    obj = qobject_from_json(gstr->str, &error_abort);
+
+    for (pretty = 0; pretty <= 1; pretty++) {
+        GString *expected = qobject_to_json_pretty(obj, pretty);
+        GString *actual = g_string_new("");
+
+        qobject_to_json_stream(obj, pretty, stream_append, actual);
+        g_assert_cmpstr(actual->str, ==, expected->str);
+        g_string_free(actual, true);
+        g_string_free(expected, true);
+    }
+
+    qobject_unref(obj);
+    g_string_free(gstr, true);
+}
+
 static void simple_list(void)
 {
     int i;
@@ -1492,6 +1582,8 @@ int main(int argc, char **argv)
     g_test_add_func("/dicts/simple_dict", simple_dict);
     g_test_add_func("/dicts/large_dict", large_dict);
     g_test_add_func("/lists/simple_list", simple_list);
+    g_test_add_func("/stream/messages", stream_messages);
+    g_test_add_func("/stream/writer", stream_writer);
 
     g_test_add_func("/mixed/simple_whitespace", simple_whitespace);
     g_test_add_func("/mixed/interpolation", simple_interpolation);
@@ -607,6 +607,28 @@ static void test_dummy_delchild(void)
     object_unparent(OBJECT(dev));
 }
 
+static void test_dummy_late_class_prop(void)
+{
+    ObjectClass *klass = object_class_by_name(TYPE_DUMMY_DEV);
+    Object *obj = object_new(TYPE_DUMMY_DEV);
+    ObjectProperty *prop;
+
+    /* Inherited, class and instance properties */
+    g_assert(object_class_property_find(klass, "type"));
+    g_assert(object_property_find(obj, "type"));
+    g_assert(object_property_find(obj, "bus"));
+    g_assert(!object_class_property_find(klass, "late"));
+
+    /* Added after the class was initialized */
+    prop = object_class_property_add(klass, "late", "int",
+                                     NULL, NULL, NULL, NULL);
+    g_assert(object_class_property_find(klass, "late") == prop);
+    g_assert(object_property_find(obj, "late") == prop);
+    g_assert(!object_property_find(obj, "missing"));
+
+    object_unref(obj);
+}
+
 static void test_qom_partial_path(void)
 {
     Object *root  = object_get_objects_root();
@@ -666,6 +688,8 @@ int main(int argc, char **argv)
     g_test_add_func("/qom/proplist/iterator", test_dummy_iterator);
     g_test_add_func("/qom/proplist/class_iterator", test_dummy_class_iterator);
     g_test_add_func("/qom/proplist/delchild", test_dummy_delchild);
+    g_test_add_func("/qom/proplist/late_class_prop",
+                    test_dummy_late_class_prop);
     g_test_add_func("/qom/resolve/partial", test_qom_partial_path);
 
     return g_test_run();
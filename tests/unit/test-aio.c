@@ -368,6 +368,52 @@ static void test_wait_event_notifier_noflush(void)
     event_notifier_cleanup(&data.e);
 }
 
+#ifndef _WIN32
+typedef struct {
+    int fd;
+    int n;
+} PartialReadTestData;
+
+/* Consume a single byte per call, leaving the rest pending */
+static void partial_read_cb(void *opaque)
+{
+    PartialReadTestData *data = opaque;
+    char c;
+
+    g_assert_cmpint(read(data->fd, &c, 1), ==, 1);
+    data->n++;
+}
+
+/*
+ * File descriptor monitoring must be level-triggered: the handler is called
+ * again as long as data is pending, even if no new data arrives.
+ */
+static void test_fd_handler_partial_read(void)
+{
+    PartialReadTestData data = { .n = 0 };
+    int fds[2];
+
+    g_assert(g_unix_open_pipe(fds, FD_CLOEXEC, NULL));
+    g_assert(g_unix_set_fd_nonblocking(fds[0], true, NULL));
+    data.fd = fds[0];
+    aio_set_fd_handler(ctx, fds[0], partial_read_cb, NULL, NULL, NULL, &data);
+
+    g_assert_cmpint(write(fds[1], "abc", 3), ==, 3);
+    g_assert(aio_poll(ctx, true));
+    g_assert_cmpint(data.n, ==, 1);
+    g_assert(aio_poll(ctx, true));
+    g_assert_cmpint(data.n, ==, 2);
+    g_assert(aio_poll(ctx, true));
+    g_assert_cmpint(data.n, ==, 3);
+    g_assert(!aio_poll(ctx, false));
+    g_assert_cmpint(data.n, ==, 3);
+
+    aio_set_fd_handler(ctx, fds[0], NULL, NULL, NULL, NULL, NULL);
+    close(fds[0]);
+    close(fds[1]);
+}
+#endif
+
 static void test_timer_schedule(void)
 {
     TimerTestData data = { .n = 0, .ctx = ctx, .ns = SCALE_MS * 750LL,
@@ -847,6 +893,9 @@ int main(int argc, char **argv)
     g_test_add_func("/aio/event/wait/no-flush-cb",  test_wait_event_notifier_noflush);
     g_test_add_func("/aio/event/flush",             test_flush_event_notifier);
     g_test_add_func("/aio/timer/schedule",          test_timer_schedule);
+#ifndef _WIN32
+    g_test_add_func("/aio/fd/partial-read",         test_fd_handler_partial_read);
+#endif
 
     g_test_add_func("/aio/coroutine/queue-chaining", test_queue_chaining);
     g_test_add_func("/aio/coroutine/worker-thread-co-enter", test_worker_thread_co_enter);
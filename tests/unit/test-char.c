@@ -1325,6 +1325,60 @@ static void char_file_test_internal(Chardev *ext_chr, const char *filepath)
     g_free(out);
 }
 
+#ifndef _WIN32
+static void char_file_async_test(void)
+{
+    char *tmp_path = g_dir_make_tmp("qemu-test-char.XXXXXX", NULL);
+    char *out = g_build_filename(tmp_path, "out", NULL);
+    char *old = g_strdup_printf("%s.1", out);
+    ChardevFile file = { .out = out,
+                         .has_async = true, .async = true,
+                         .has_max_size = true, .max_size = 4 };
+    ChardevBackend backend = { .type = CHARDEV_BACKEND_KIND_FILE,
+                               .u.file.data = &file };
+    char *contents = NULL;
+    gsize length = 0;
+    Chardev *chr;
+    int ret;
+
+    chr = qemu_chardev_new(NULL, TYPE_CHARDEV_FILE, &backend,
+                           NULL, &error_abort);
+    ret = qemu_chr_write_all(chr, (uint8_t *)"hello!", 6);
+    g_assert_cmpint(ret, ==, 6);
+
+    /* Wait for the thread, the next write goes over max-size */
+    while (length != 6) {
+        g_free(contents);
+        g_usleep(1000);
+        g_assert(g_file_get_contents(out, &contents, &length, NULL));
+    }
+    g_free(contents);
+
+    ret = qemu_chr_write_all(chr, (uint8_t *)"world!", 6);
+    g_assert_cmpint(ret, ==, 6);
+
+    /* Finalizing writes what is left */
+    object_unparent(OBJECT(chr));
+
+    g_assert(g_file_get_contents(out, &contents, &length, NULL));
+    g_assert_cmpint(length, ==, 6);
+    g_assert(strncmp(contents, "world!", 6) == 0);
+    g_free(contents);
+
+    g_assert(g_file_get_contents(old, &contents, &length, NULL));
+    g_assert_cmpint(length, ==, 6);
+    g_assert(strncmp(contents, "hello!", 6) == 0);
+    g_free(contents);
+
+    g_unlink(out);
+    g_unlink(old);
+    g_rmdir(tmp_path);
+    g_free(tmp_path);
+    g_free(out);
+    g_free(old);
+}
+#endif
+
 static void char_file_test(void)
 {
     char_file_test_internal(NULL, NULL);
@@ -1497,6 +1551,7 @@ int main(int argc, char **argv)
     g_test_add_func("/char/file", char_file_test);
 #ifndef _WIN32
     g_test_add_func("/char/file-fifo", char_file_fifo_test);
+    g_test_add_func("/char/file-async", char_file_async_test);
 #endif
 
 #define SOCKET_SERVER_TEST(name, addr)                                  \
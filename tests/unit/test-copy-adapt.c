@@ -0,0 +1,166 @@
+/*
+ * Adaptive chunk size and parallelism for block jobs copying data
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/units.h"
+#include "qemu/timer.h"
+#include "block/copy-adapt.h"
+
+/* Latencies on either side of the 50 ms target of block/copy-adapt.c */
+#define HIGH_LATENCY_NS (100 * SCALE_MS)
+#define MID_LATENCY_NS  (20 * SCALE_MS)
+#define LOW_LATENCY_NS  (1 * SCALE_MS)
+
+#define WINDOW_NS       (100 * SCALE_MS)
+
+/*
+ * Complete @requests requests of @bytes each in a window of @duration
+ * nanoseconds starting at *@now, and return what the last one returned.
+ */
+static bool run_window(CopyAdapt *a, int64_t *now, int requests,
+                       uint64_t bytes, int64_t latency_ns, int64_t duration)
+{
+    bool changed;
+
+    for (int i = 0; i < requests - 1; i++) {
+        changed = copy_adapt_account_at(a, bytes, latency_ns, *now);
+        g_assert_false(changed);
+    }
+    *now += duration;
+    return copy_adapt_account_at(a, bytes, latency_ns, *now);
+}
+
+static void test_init(void)
+{
+    CopyAdapt a;
+
+    copy_adapt_init(&a, 64 * KiB, 1 * MiB, 8);
+    g_assert_cmpint(a.chunk, ==, 1 * MiB);
+    g_assert_cmpint(a.workers, ==, 8);
+
+    /* The maximum is rounded down to a multiple of the minimum... */
+    copy_adapt_init(&a, 64 * KiB, 1 * MiB + 4 * KiB, 8);
+    g_assert_cmpint(a.max_chunk, ==, 1 * MiB);
+    g_assert_cmpint(a.chunk, ==, 1 * MiB);
+
+    /* ... but never below it */
+    copy_adapt_init(&a, 64 * KiB, 4 * KiB, 1);
+    g_assert_cmpint(a.max_chunk, ==, 64 * KiB);
+    g_assert_cmpint(a.chunk, ==, 64 * KiB);
+}
+
+static void test_chunk(void)
+{
+    CopyAdapt a;
+    int64_t now;
+    int64_t chunk;
+
+    copy_adapt_init(&a, 64 * KiB, 1 * MiB, 8);
+    now = a.window_start_ns;
+
+    /* Back off while requests are too slow, down to the minimum */
+    for (chunk = 512 * KiB; chunk >= 64 * KiB; chunk /= 2) {
+        g_assert_true(run_window(&a, &now, 4, 64 * KiB, HIGH_LATENCY_NS,
+                                 WINDOW_NS));
+        g_assert_cmpint(a.chunk, ==, chunk);
+    }
+    run_window(&a, &now, 4, 64 * KiB, HIGH_LATENCY_NS, WINDOW_NS);
+    g_assert_cmpint(a.chunk, ==, 64 * KiB);
+
+    /* Ramp up again when they complete well within the target */
+    for (chunk = 128 * KiB; chunk <= 1 * MiB; chunk *= 2) {
+        g_assert_true(run_window(&a, &now, 4, 64 * KiB, LOW_LATENCY_NS,
+                                 WINDOW_NS));
+        g_assert_cmpint(a.chunk, ==, chunk);
+    }
+    run_window(&a, &now, 4, 64 * KiB, LOW_LATENCY_NS, WINDOW_NS);
+    g_assert_cmpint(a.chunk, ==, 1 * MiB);
+
+    /* Latency close to the target leaves the chunk size alone */
+    run_window(&a, &now, 4, 64 * KiB, MID_LATENCY_NS, WINDOW_NS);
+    g_assert_cmpint(a.chunk, ==, 1 * MiB);
+}
+
+static void test_window(void)
+{
+    CopyAdapt a;
+    int64_t now;
+
+    copy_adapt_init(&a, 64 * KiB, 1 * MiB, 8);
+    now = a.window_start_ns;
+
+    /* Too few requests to draw conclusions */
+    g_assert_false(run_window(&a, &now, 3, 64 * KiB, HIGH_LATENCY_NS,
+                              WINDOW_NS));
+    g_assert_cmpint(a.chunk, ==, 1 * MiB);
+    g_assert_cmpint(a.workers, ==, 8);
+
+    /* A window with idle time in it is dropped */
+    g_assert_false(run_window(&a, &now, 16, 64 * KiB, HIGH_LATENCY_NS,
+                              20 * WINDOW_NS));
+    g_assert_cmpint(a.chunk, ==, 1 * MiB);
+    g_assert_cmpint(a.workers, ==, 8);
+
+    /* The window is not over yet */
+    g_assert_false(run_window(&a, &now, 16, 64 * KiB, HIGH_LATENCY_NS,
+                              WINDOW_NS / 2));
+    g_assert_cmpint(a.chunk, ==, 1 * MiB);
+
+    /* Now it is, with all the requests of both halves */
+    g_assert_true(run_window(&a, &now, 1, 64 * KiB, HIGH_LATENCY_NS,
+                             WINDOW_NS / 2));
+    g_assert_cmpint(a.chunk, ==, 512 * KiB);
+}
+
+static void test_workers(void)
+{
+    static const int steps[] = { 6, 5, 4, 3, 2, 1, 2, 3 };
+    CopyAdapt a;
+    int64_t now;
+    int i;
+
+    copy_adapt_init(&a, 64 * KiB, 1 * MiB, 8);
+    now = a.window_start_ns;
+
+    /*
+     * With a constant throughput, keep using fewer workers until there
+     * is only one left, then turn around.
+     */
+    for (i = 0; i < ARRAY_SIZE(steps); i++) {
+        g_assert_true(run_window(&a, &now, 4, 1 * MiB, MID_LATENCY_NS,
+                                 WINDOW_NS));
+        g_assert_cmpint(a.workers, ==, steps[i]);
+        g_assert_cmpint(a.chunk, ==, 1 * MiB);
+    }
+
+    /* A drop in throughput reverses the direction */
+    g_assert_true(run_window(&a, &now, 4, 512 * KiB, MID_LATENCY_NS,
+                             WINDOW_NS));
+    g_assert_cmpint(a.workers, ==, 2);
+
+    /* A small drop does not */
+    g_assert_true(run_window(&a, &now, 4, 480 * KiB, MID_LATENCY_NS,
+                             WINDOW_NS));
+    g_assert_cmpint(a.workers, ==, 1);
+
+    /* Never more than the maximum */
+    for (i = 0; i < 32; i++) {
+        run_window(&a, &now, 4, 1 * MiB, MID_LATENCY_NS, WINDOW_NS);
+        g_assert_cmpint(a.workers, >=, 1);
+        g_assert_cmpint(a.workers, <=, 8);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_func("/copy-adapt/init", test_init);
+    g_test_add_func("/copy-adapt/chunk", test_chunk);
+    g_test_add_func("/copy-adapt/window", test_window);
+    g_test_add_func("/copy-adapt/workers", test_workers);
+    return g_test_run();
+}
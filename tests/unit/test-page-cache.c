@@ -0,0 +1,116 @@
+/*
+ * XBZRLE page cache unit tests.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+#include "qemu/osdep.h"
+#include "qapi/error.h"
+#include "../migration/page_cache.h"
+
+#define TEST_PAGE_SIZE 4096
+#define TEST_CACHE_PAGES 64
+
+static void fill_page(uint8_t *page, uint64_t addr)
+{
+    memset(page, (uint8_t)(addr / TEST_PAGE_SIZE), TEST_PAGE_SIZE);
+}
+
+static void test_insert_lookup(void)
+{
+    PageCache *cache = cache_init(TEST_CACHE_PAGES * TEST_PAGE_SIZE,
+                                  TEST_PAGE_SIZE, &error_abort);
+    uint8_t page[TEST_PAGE_SIZE];
+    uint64_t addr;
+
+    /* as many pages as the cache can hold, they must all fit */
+    for (addr = 0; addr < TEST_CACHE_PAGES * TEST_PAGE_SIZE;
+         addr += TEST_PAGE_SIZE) {
+        fill_page(page, addr);
+        g_assert_cmpint(cache_insert(cache, addr, page, 1), ==, 0);
+    }
+
+    for (addr = 0; addr < TEST_CACHE_PAGES * TEST_PAGE_SIZE;
+         addr += TEST_PAGE_SIZE) {
+        fill_page(page, addr);
+        g_assert(cache_is_cached(cache, addr, 1));
+        g_assert(!memcmp(get_cached_data(cache, addr), page, TEST_PAGE_SIZE));
+    }
+
+    g_assert(!cache_is_cached(cache, addr, 1));
+    g_assert_null(get_cached_data(cache, addr));
+
+    cache_fini(cache);
+}
+
+static void test_replacement(void)
+{
+    PageCache *cache = cache_init(TEST_CACHE_PAGES * TEST_PAGE_SIZE,
+                                  TEST_PAGE_SIZE, &error_abort);
+    uint64_t conflict = TEST_CACHE_PAGES * TEST_PAGE_SIZE;
+    uint8_t page[TEST_PAGE_SIZE];
+    uint64_t addr;
+
+    for (addr = 0; addr < TEST_CACHE_PAGES * TEST_PAGE_SIZE;
+         addr += TEST_PAGE_SIZE) {
+        fill_page(page, addr);
+        g_assert_cmpint(cache_insert(cache, addr, page, 1), ==, 0);
+    }
+
+    /* fresh pages are not evicted */
+    fill_page(page, conflict);
+    g_assert_cmpint(cache_insert(cache, conflict, page, 2), ==, -1);
+    g_assert(!cache_is_cached(cache, conflict, 2));
+
+    /* page 0 is the least recently used of its set once the others are hit */
+    for (addr = TEST_PAGE_SIZE; addr < TEST_CACHE_PAGES * TEST_PAGE_SIZE;
+         addr += TEST_PAGE_SIZE) {
+        g_assert(get_cached_data(cache, addr));
+    }
+    g_assert_cmpint(cache_insert(cache, conflict, page, 10), ==, 0);
+    g_assert(cache_is_cached(cache, conflict, 10));
+    g_assert(!cache_is_cached(cache, 0, 10));
+    for (addr = TEST_PAGE_SIZE; addr < TEST_CACHE_PAGES * TEST_PAGE_SIZE;
+         addr += TEST_PAGE_SIZE) {
+        g_assert(cache_is_cached(cache, addr, 10));
+    }
+
+    cache_fini(cache);
+}
+
+static void test_partitions(void)
+{
+    PageCache *cache;
+    Error *err = NULL;
+    uint8_t page[TEST_PAGE_SIZE];
+    uint64_t addr;
+
+    g_assert_null(cache_init_partitioned(4 * TEST_PAGE_SIZE, TEST_PAGE_SIZE,
+                                         8, &err));
+    error_free_or_abort(&err);
+
+    cache = cache_init_partitioned(TEST_CACHE_PAGES * TEST_PAGE_SIZE,
+                                   TEST_PAGE_SIZE, 3, &error_abort);
+    for (addr = 0; addr < 16 * TEST_PAGE_SIZE; addr += TEST_PAGE_SIZE) {
+        fill_page(page, addr);
+        cache_lock(cache, addr);
+        g_assert_cmpint(cache_insert(cache, addr, page, 1), ==, 0);
+        cache_unlock(cache, addr);
+    }
+    for (addr = 0; addr < 16 * TEST_PAGE_SIZE; addr += TEST_PAGE_SIZE) {
+        fill_page(page, addr);
+        cache_lock(cache, addr);
+        g_assert(!memcmp(get_cached_data(cache, addr), page, TEST_PAGE_SIZE));
+        cache_unlock(cache, addr);
+    }
+    cache_fini(cache);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_func("/page-cache/insert-lookup", test_insert_lookup);
+    g_test_add_func("/page-cache/replacement", test_replacement);
+    g_test_add_func("/page-cache/partitions", test_partitions);
+    return g_test_run();
+}
@@ -114,6 +114,15 @@ static void check_n(size_t expected)
     qht_statistics_destroy(&stats);
 }
 
+static void check_resized(void)
+{
+    struct qht_stats stats;
+
+    qht_statistics_init(&ht, &stats);
+    g_assert_cmpuint(stats.resizes, >, 0);
+    qht_statistics_destroy(&stats);
+}
+
 static void iter_check(unsigned int count)
 {
     unsigned int curr = 0;
@@ -199,6 +208,9 @@ static void qht_do_test(unsigned int mode, size_t init_entries)
     check(0, N, true);
     check_n(N);
     check(-N, -1, false);
+    if (mode & QHT_MODE_AUTO_RESIZE) {
+        check_resized();
+    }
     iter_check(N);
 
     rm(101, 102);
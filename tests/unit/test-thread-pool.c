@@ -230,6 +230,25 @@ static void test_cancel_async(void)
     do_test_cancel(false);
 }
 
+static void test_generic_wait(void)
+{
+    ThreadPool *pool = thread_pool_new();
+    WorkerTestData data[100];
+    int i;
+
+    thread_pool_set_max_threads(pool, 4);
+    for (i = 0; i < ARRAY_SIZE(data); i++) {
+        data[i].n = 0;
+        thread_pool_submit_work(pool, worker_cb, &data[i], NULL);
+    }
+    thread_pool_wait(pool);
+
+    for (i = 0; i < ARRAY_SIZE(data); i++) {
+        g_assert_cmpint(data[i].n, ==, 1);
+    }
+    thread_pool_free(pool);
+}
+
 int main(int argc, char **argv)
 {
     qemu_init_main_loop(&error_abort);
@@ -242,6 +261,7 @@ int main(int argc, char **argv)
     g_test_add_func("/thread-pool/submit-many", test_submit_many);
     g_test_add_func("/thread-pool/cancel", test_cancel);
     g_test_add_func("/thread-pool/cancel-async", test_cancel_async);
+    g_test_add_func("/thread-pool/generic/wait", test_generic_wait);
 
     return g_test_run();
 }
@@ -173,6 +173,70 @@ static void test_encode_decode(void)
     }
 }
 
+/*
+ * Build a page that differs from @old in runs of random length and
+ * position, so that runs start and end both inside and across the
+ * 64-byte blocks of the SIMD encoders.
+ */
+static void fill_runs(uint8_t *old, uint8_t *new, int len, int max_run)
+{
+    bool same = g_test_rand_bit();
+    int i = 0;
+
+    for (int j = 0; j < len; j++) {
+        old[j] = g_test_rand_int();
+    }
+    memcpy(new, old, len);
+    while (i < len) {
+        int run = MIN(g_test_rand_int_range(1, max_run + 1), len - i);
+
+        if (!same) {
+            for (int j = i; j < i + run; j++) {
+                new[j] = old[j] ^ g_test_rand_int_range(1, 256);
+            }
+        }
+        i += run;
+        same = !same;
+    }
+}
+
+static void encode_compare_generic(int max_run, int dlen)
+{
+    uint8_t *old = g_malloc(XBZRLE_PAGE_SIZE);
+    uint8_t *new = g_malloc(XBZRLE_PAGE_SIZE);
+    uint8_t *dst = g_malloc(XBZRLE_PAGE_SIZE);
+    uint8_t *ref = g_malloc(XBZRLE_PAGE_SIZE);
+    /* the generic encoder needs a length that is a multiple of a long */
+    int slen = g_test_rand_int_range(1, XBZRLE_PAGE_SIZE / 8 + 1) * 8;
+    int rc, ref_rc;
+
+    fill_runs(old, new, slen, max_run);
+    rc = xbzrle_encode_buffer(old, new, slen, dst, dlen);
+    ref_rc = xbzrle_encode_buffer_generic(old, new, slen, ref, dlen);
+    g_assert_cmpint(rc, ==, ref_rc);
+    if (rc > 0) {
+        g_assert(memcmp(dst, ref, rc) == 0);
+    }
+
+    g_free(old);
+    g_free(new);
+    g_free(dst);
+    g_free(ref);
+}
+
+static void test_encode_generic(void)
+{
+    int i;
+
+    for (i = 0; i < 2000; i++) {
+        encode_compare_generic(8, XBZRLE_PAGE_SIZE);
+        encode_compare_generic(100, XBZRLE_PAGE_SIZE);
+        encode_compare_generic(1000, XBZRLE_PAGE_SIZE);
+        /* both encoders must also agree on when the output overflows */
+        encode_compare_generic(8, g_test_rand_int_range(1, XBZRLE_PAGE_SIZE));
+    }
+}
+
 int main(int argc, char **argv)
 {
     g_test_init(&argc, &argv, NULL);
@@ -185,6 +249,7 @@ int main(int argc, char **argv)
     g_test_add_func("/xbzrle/encode_decode_overflow",
                     test_encode_decode_overflow);
     g_test_add_func("/xbzrle/encode_decode", test_encode_decode);
+    g_test_add_func("/xbzrle/encode_generic", test_encode_generic);
 
     return g_test_run();
 }
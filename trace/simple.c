@@ -25,17 +25,22 @@
 #define HEADER_MAGIC 0xf2b177cb0aa429b4ULL
 
 /** Trace file version number, bump if format changes */
-#define HEADER_VERSION 4
+#define HEADER_VERSION 5
 
-/** Records were dropped event ID */
-#define DROPPED_EVENT_ID (~(uint64_t)0 - 1)
+/** Event mapping record event ID */
+#define MAPPING_EVENT_ID (~(uint32_t)0)
 
-/** Trace record is valid */
-#define TRACE_RECORD_VALID ((uint64_t)1 << 63)
+/** Records were dropped event ID */
+#define DROPPED_EVENT_ID (~(uint32_t)0 - 1)
 
 /*
- * Trace records are written out by a dedicated thread.  The thread waits for
- * records to become available, writes them out, and then waits again.
+ * Every thread that traces has its own ring buffer, so recording an event
+ * needs no atomic read-modify-write and does not bounce cache lines between
+ * threads.  A dedicated thread waits for records to become available, merges
+ * the records of all threads in timestamp order, writes them out, and then
+ * waits again.  Records that are still being written when the writeout
+ * thread scans the buffers are written out in its next pass, so the order
+ * is only exact within a pass.
  */
 static GMutex trace_lock;
 static GCond trace_available_cond;
@@ -45,27 +50,51 @@ static bool trace_available;
 static bool trace_writeout_enabled;
 
 enum {
-    TRACE_BUF_LEN = 4096 * 64,
+    /* Per thread, must be a power of two */
+    TRACE_BUF_LEN = 4096 * 16,
     TRACE_BUF_FLUSH_THRESHOLD = TRACE_BUF_LEN / 4,
 };
 
-uint8_t trace_buf[TRACE_BUF_LEN];
-static volatile gint trace_idx;
-static unsigned int writeout_idx;
-static volatile gint dropped_events;
+/* Write out the records of threads that rarely trace at least this often */
+#define TRACE_WRITEOUT_PERIOD G_TIME_SPAN_SECOND
+
+typedef struct TraceThreadBuffer {
+    struct TraceThreadBuffer *next;
+    /* Written by the owning thread, read by the writeout thread */
+    unsigned int head;
+    bool exited;
+    /* Written by the writeout thread, read by the owning thread */
+    unsigned int tail;
+    /* Incremented by the owning thread, cleared by the writeout thread */
+    int dropped;
+    /* Only accessed by the owning thread and its signal handlers */
+    bool in_record;
+    /* Only accessed by the writeout thread */
+    unsigned int writeout_head;
+    uint8_t data[TRACE_BUF_LEN];
+} TraceThreadBuffer;
+
+/* Threads push their buffer here; only the writeout thread removes them */
+static TraceThreadBuffer *trace_buffers;
+
+/*
+ * A record is written without ever yielding, so there is no need for the
+ * coroutine-safe TLS accessors here.
+ */
+static __thread TraceThreadBuffer *trace_thread_buf;
+
+static void trace_thread_exit(gpointer opaque);
+static GPrivate trace_thread_key = G_PRIVATE_INIT(trace_thread_exit);
+
 static uint32_t trace_pid;
 static FILE *trace_fp;
 static char *trace_file_name;
 
-#define TRACE_RECORD_TYPE_MAPPING 0
-#define TRACE_RECORD_TYPE_EVENT   1
-
 /* * Trace buffer entry */
 typedef struct {
-    uint64_t event; /* event ID value */
     uint64_t timestamp_ns;
+    uint32_t event; /* event ID value */
     uint32_t length;   /*    in bytes */
-    uint32_t pid;
     uint64_t arguments[];
 } TraceRecord;
 
@@ -73,56 +102,58 @@ typedef struct {
     uint64_t header_event_id; /* HEADER_EVENT_ID */
     uint64_t header_magic;    /* HEADER_MAGIC    */
     uint64_t header_version;  /* HEADER_VERSION  */
+    uint64_t pid;
 } TraceLogHeader;
 
 
-static void read_from_buffer(unsigned int idx, void *dataptr, size_t size);
-static unsigned int write_to_buffer(unsigned int idx, void *dataptr, size_t size);
+static void read_from_buffer(TraceThreadBuffer *buf, unsigned int idx,
+                             void *dataptr, size_t size);
+static unsigned int write_to_buffer(TraceThreadBuffer *buf, unsigned int idx,
+                                    const void *dataptr, size_t size);
 
-static void clear_buffer_range(unsigned int idx, size_t len)
+static void trace_thread_exit(gpointer opaque)
 {
-    uint32_t num = 0;
-    while (num < len) {
-        if (idx >= TRACE_BUF_LEN) {
-            idx = idx % TRACE_BUF_LEN;
-        }
-        trace_buf[idx++] = 0;
-        num++;
-    }
+    TraceThreadBuffer *buf = opaque;
+
+    /* The writeout thread frees the buffer once it is empty */
+    trace_thread_buf = NULL;
+    qatomic_store_release(&buf->exited, true);
 }
-/**
- * Read a trace record from the trace buffer
- *
- * @idx         Trace buffer index
- * @record      Trace record to fill
- *
- * Returns false if the record is not valid.
- */
-static bool get_trace_record(unsigned int idx, TraceRecord **recordptr)
+
+static TraceThreadBuffer *trace_thread_buffer_new(void)
 {
-    uint64_t event_flag = 0;
-    TraceRecord record;
-    /* read the event flag to see if its a valid record */
-    read_from_buffer(idx, &record, sizeof(event_flag));
+    TraceThreadBuffer *buf, *next;
 
-    if (!(record.event & TRACE_RECORD_VALID)) {
-        return false;
+    /* don't use g_malloc, can deadlock when traced */
+    buf = calloc(1, sizeof(*buf));
+    if (!buf) {
+        return NULL;
     }
 
-    smp_rmb(); /* read memory barrier before accessing record */
-    /* read the record header to know record length */
-    read_from_buffer(idx, &record, sizeof(TraceRecord));
-    *recordptr = malloc(record.length); /* don't use g_malloc, can deadlock when traced */
-    /* make a copy of record to avoid being overwritten */
-    read_from_buffer(idx, *recordptr, record.length);
-    smp_rmb(); /* memory barrier before clearing valid flag */
-    (*recordptr)->event &= ~TRACE_RECORD_VALID;
-    /* clear the trace buffer range for consumed record otherwise any byte
-     * with its MSB set may be considered as a valid event id when the writer
-     * thread crosses this range of buffer again.
-     */
-    clear_buffer_range(idx, record.length);
-    return true;
+    do {
+        next = qatomic_read(&trace_buffers);
+        buf->next = next;
+    } while (qatomic_cmpxchg(&trace_buffers, next, buf) != next);
+
+    g_private_set(&trace_thread_key, buf);
+    trace_thread_buf = buf;
+    return buf;
+}
+
+/* Only called by the writeout thread, for an exited thread's empty buffer */
+static void trace_thread_buffer_free(TraceThreadBuffer *buf)
+{
+    TraceThreadBuffer *prev;
+
+    if (qatomic_cmpxchg(&trace_buffers, buf, buf->next) != buf) {
+        /* Threads only push at the head, the rest of the list is stable */
+        prev = qatomic_read(&trace_buffers);
+        while (prev->next != buf) {
+            prev = prev->next;
+        }
+        prev->next = buf->next;
+    }
+    free(buf); /* don't use g_free, can deadlock when traced */
 }
 
 /**
@@ -145,52 +176,113 @@ static void flush_trace_file(bool wait)
 
 static void wait_for_trace_records_available(void)
 {
+    gint64 deadline = g_get_monotonic_time() + TRACE_WRITEOUT_PERIOD;
+
     g_mutex_lock(&trace_lock);
     while (!(trace_available && trace_writeout_enabled)) {
         g_cond_signal(&trace_empty_cond);
-        g_cond_wait(&trace_available_cond, &trace_lock);
+        if (!g_cond_wait_until(&trace_available_cond, &trace_lock,
+                               deadline)) {
+            trace_available = true;
+            deadline = g_get_monotonic_time() + TRACE_WRITEOUT_PERIOD;
+        }
     }
     trace_available = false;
     g_mutex_unlock(&trace_lock);
 }
 
-static gpointer writeout_thread(gpointer opaque)
+static void write_dropped_record(int dropped_count)
 {
-    TraceRecord *recordptr;
     union {
         TraceRecord rec;
         uint8_t bytes[sizeof(TraceRecord) + sizeof(uint64_t)];
     } dropped;
-    unsigned int idx = 0;
-    int dropped_count;
     size_t unused __attribute__ ((unused));
-    uint64_t type = TRACE_RECORD_TYPE_EVENT;
 
-    for (;;) {
-        wait_for_trace_records_available();
+    dropped.rec.timestamp_ns = get_clock();
+    dropped.rec.event = DROPPED_EVENT_ID;
+    dropped.rec.length = sizeof(dropped);
+    dropped.rec.arguments[0] = dropped_count;
+    unused = fwrite(&dropped, sizeof(dropped), 1, trace_fp);
+}
 
-        if (g_atomic_int_get(&dropped_events)) {
-            dropped.rec.event = DROPPED_EVENT_ID;
-            dropped.rec.timestamp_ns = get_clock();
-            dropped.rec.length = sizeof(TraceRecord) + sizeof(uint64_t);
-            dropped.rec.pid = trace_pid;
-            do {
-                dropped_count = g_atomic_int_get(&dropped_events);
-            } while (!g_atomic_int_compare_and_exchange(&dropped_events,
-                                                        dropped_count, 0));
-            dropped.rec.arguments[0] = dropped_count;
-            unused = fwrite(&type, sizeof(type), 1, trace_fp);
-            unused = fwrite(&dropped.rec, dropped.rec.length, 1, trace_fp);
+/* Write the record at the tail of @buf and consume it */
+static void write_record(TraceThreadBuffer *buf)
+{
+    unsigned int idx = buf->tail & (TRACE_BUF_LEN - 1);
+    size_t unused __attribute__ ((unused));
+    TraceRecord record;
+    uint32_t len;
+
+    read_from_buffer(buf, buf->tail, &record, sizeof(record));
+
+    /* The record may wrap around the end of the ring */
+    len = MIN(record.length, TRACE_BUF_LEN - idx);
+    unused = fwrite(&buf->data[idx], len, 1, trace_fp);
+    if (len < record.length) {
+        unused = fwrite(buf->data, record.length - len, 1, trace_fp);
+    }
+
+    /* Let the owning thread reuse the space */
+    qatomic_store_release(&buf->tail, buf->tail + record.length);
+}
+
+static void writeout_records(void)
+{
+    TraceThreadBuffer *buf, *oldest;
+    uint64_t timestamp_ns, oldest_ns;
+    int dropped_count;
+
+    /* Only write out the records that are complete now */
+    for (buf = qatomic_read(&trace_buffers); buf; buf = buf->next) {
+        buf->writeout_head = qatomic_load_acquire(&buf->head);
+
+        dropped_count = qatomic_xchg(&buf->dropped, 0);
+        if (dropped_count) {
+            write_dropped_record(dropped_count);
         }
+    }
 
-        while (get_trace_record(idx, &recordptr)) {
-            unused = fwrite(&type, sizeof(type), 1, trace_fp);
-            unused = fwrite(recordptr, recordptr->length, 1, trace_fp);
-            writeout_idx += recordptr->length;
-            free(recordptr); /* don't use g_free, can deadlock when traced */
-            idx = writeout_idx % TRACE_BUF_LEN;
+    /* Each buffer is sorted already, merge them */
+    for (;;) {
+        oldest = NULL;
+        oldest_ns = UINT64_MAX;
+        for (buf = qatomic_read(&trace_buffers); buf; buf = buf->next) {
+            if (buf->tail == buf->writeout_head) {
+                continue;
+            }
+            read_from_buffer(buf, buf->tail, &timestamp_ns,
+                             sizeof(timestamp_ns));
+            if (!oldest || timestamp_ns < oldest_ns) {
+                oldest = buf;
+                oldest_ns = timestamp_ns;
+            }
+        }
+        if (!oldest) {
+            break;
         }
+        write_record(oldest);
+    }
+
+    /* Free the buffers of the threads that have exited */
+    buf = qatomic_read(&trace_buffers);
+    while (buf) {
+        TraceThreadBuffer *next = buf->next;
+
+        if (qatomic_load_acquire(&buf->exited) &&
+            buf->tail == qatomic_read(&buf->head) &&
+            !qatomic_read(&buf->dropped)) {
+            trace_thread_buffer_free(buf);
+        }
+        buf = next;
+    }
+}
 
+static gpointer writeout_thread(gpointer opaque)
+{
+    for (;;) {
+        wait_for_trace_records_available();
+        writeout_records();
         fflush(trace_fp);
     }
     return NULL;
@@ -198,98 +290,107 @@ static gpointer writeout_thread(gpointer opaque)
 
 void trace_record_write_u64(TraceBufferRecord *rec, uint64_t val)
 {
-    rec->rec_off = write_to_buffer(rec->rec_off, &val, sizeof(uint64_t));
+    rec->rec_off = write_to_buffer(rec->buf, rec->rec_off,
+                                   &val, sizeof(uint64_t));
 }
 
 void trace_record_write_str(TraceBufferRecord *rec, const char *s, uint32_t slen)
 {
     /* Write string length first */
-    rec->rec_off = write_to_buffer(rec->rec_off, &slen, sizeof(slen));
+    rec->rec_off = write_to_buffer(rec->buf, rec->rec_off,
+                                   &slen, sizeof(slen));
     /* Write actual string now */
-    rec->rec_off = write_to_buffer(rec->rec_off, (void*)s, slen);
+    rec->rec_off = write_to_buffer(rec->buf, rec->rec_off, s, slen);
 }
 
 int trace_record_start(TraceBufferRecord *rec, uint32_t event, size_t datasize)
 {
-    unsigned int idx, rec_off, old_idx, new_idx;
-    uint32_t rec_len = sizeof(TraceRecord) + datasize;
-    uint64_t event_u64 = event;
-    uint64_t timestamp_ns = get_clock();
-
-    do {
-        old_idx = g_atomic_int_get(&trace_idx);
-        smp_rmb();
-        new_idx = old_idx + rec_len;
-
-        if (new_idx - writeout_idx > TRACE_BUF_LEN) {
-            /* Trace Buffer Full, Event dropped ! */
-            g_atomic_int_inc(&dropped_events);
-            return -ENOSPC;
+    TraceThreadBuffer *buf = trace_thread_buf;
+    TraceRecord record = {
+        .event = event,
+        .length = sizeof(TraceRecord) + datasize,
+    };
+
+    if (unlikely(!buf)) {
+        buf = trace_thread_buffer_new();
+        if (!buf) {
+            return -ENOMEM;
         }
-    } while (!g_atomic_int_compare_and_exchange(&trace_idx, old_idx, new_idx));
+    }
+
+    /*
+     * Test and set in one go, so that a signal handler that interrupts us
+     * cannot also see the flag clear and claim the same space.
+     */
+    if (unlikely(qatomic_xchg(&buf->in_record, true))) {
+        /* A signal handler traced while this thread was writing a record */
+        qatomic_inc(&buf->dropped);
+        return -EBUSY;
+    }
 
-    idx = old_idx % TRACE_BUF_LEN;
+    if (buf->head + record.length - qatomic_load_acquire(&buf->tail) >
+        TRACE_BUF_LEN) {
+        /* Trace Buffer Full, Event dropped ! */
+        qatomic_inc(&buf->dropped);
+        qatomic_set(&buf->in_record, false);
+        return -ENOSPC;
+    }
 
-    rec_off = idx;
-    rec_off = write_to_buffer(rec_off, &event_u64, sizeof(event_u64));
-    rec_off = write_to_buffer(rec_off, &timestamp_ns, sizeof(timestamp_ns));
-    rec_off = write_to_buffer(rec_off, &rec_len, sizeof(rec_len));
-    rec_off = write_to_buffer(rec_off, &trace_pid, sizeof(trace_pid));
+    record.timestamp_ns = get_clock();
 
-    rec->tbuf_idx = idx;
-    rec->rec_off  = (idx + sizeof(TraceRecord)) % TRACE_BUF_LEN;
+    rec->buf = buf;
+    rec->rec_off = write_to_buffer(buf, buf->head, &record, sizeof(record));
     return 0;
 }
 
-static void read_from_buffer(unsigned int idx, void *dataptr, size_t size)
+static void read_from_buffer(TraceThreadBuffer *buf, unsigned int idx,
+                             void *dataptr, size_t size)
 {
     uint8_t *data_ptr = dataptr;
     uint32_t x = 0;
     while (x < size) {
-        if (idx >= TRACE_BUF_LEN) {
-            idx = idx % TRACE_BUF_LEN;
-        }
-        data_ptr[x++] = trace_buf[idx++];
+        data_ptr[x++] = buf->data[idx++ & (TRACE_BUF_LEN - 1)];
     }
 }
 
-static unsigned int write_to_buffer(unsigned int idx, void *dataptr, size_t size)
+static unsigned int write_to_buffer(TraceThreadBuffer *buf, unsigned int idx,
+                                    const void *dataptr, size_t size)
 {
-    uint8_t *data_ptr = dataptr;
+    const uint8_t *data_ptr = dataptr;
     uint32_t x = 0;
     while (x < size) {
-        if (idx >= TRACE_BUF_LEN) {
-            idx = idx % TRACE_BUF_LEN;
-        }
-        trace_buf[idx++] = data_ptr[x++];
+        buf->data[idx++ & (TRACE_BUF_LEN - 1)] = data_ptr[x++];
     }
     return idx; /* most callers wants to know where to write next */
 }
 
 void trace_record_finish(TraceBufferRecord *rec)
 {
-    TraceRecord record;
-    read_from_buffer(rec->tbuf_idx, &record, sizeof(TraceRecord));
-    smp_wmb(); /* write barrier before marking as valid */
-    record.event |= TRACE_RECORD_VALID;
-    write_to_buffer(rec->tbuf_idx, &record, sizeof(TraceRecord));
+    TraceThreadBuffer *buf = rec->buf;
+
+    /* Publish the record to the writeout thread */
+    qatomic_store_release(&buf->head, rec->rec_off);
+    qatomic_set(&buf->in_record, false);
 
-    if (((unsigned int)g_atomic_int_get(&trace_idx) - writeout_idx)
-        > TRACE_BUF_FLUSH_THRESHOLD) {
+    if (rec->rec_off - qatomic_read(&buf->tail) > TRACE_BUF_FLUSH_THRESHOLD) {
         flush_trace_file(false);
     }
 }
 
 static int st_write_event_mapping(TraceEventIter *iter)
 {
-    uint64_t type = TRACE_RECORD_TYPE_MAPPING;
     TraceEvent *ev;
 
     while ((ev = trace_event_iter_next(iter)) != NULL) {
-        uint64_t id = trace_event_get_id(ev);
+        uint32_t id = trace_event_get_id(ev);
         const char *name = trace_event_get_name(ev);
         uint32_t len = strlen(name);
-        if (fwrite(&type, sizeof(type), 1, trace_fp) != 1 ||
+        TraceRecord record = {
+            .event = MAPPING_EVENT_ID,
+            .length = sizeof(record) + sizeof(id) + sizeof(len) + len,
+        };
+
+        if (fwrite(&record, sizeof(record), 1, trace_fp) != 1 ||
             fwrite(&id, sizeof(id), 1, trace_fp) != 1 ||
             fwrite(&len, sizeof(len), 1, trace_fp) != 1 ||
             fwrite(name, len, 1, trace_fp) != 1) {
@@ -320,11 +421,12 @@ bool st_set_trace_file_enabled(bool enable)
     flush_trace_file(true);
 
     if (enable) {
-        static const TraceLogHeader header = {
+        const TraceLogHeader header = {
             .header_event_id = HEADER_EVENT_ID,
             .header_magic = HEADER_MAGIC,
             /* Older log readers will check for version at next location */
             .header_version = HEADER_VERSION,
+            .pid = trace_pid,
         };
 
         trace_fp = fopen(trace_file_name, "wb");
@@ -36,6 +36,8 @@ bool console_gl_check_format(DisplayChangeListener *dcl,
     switch (format) {
     case PIXMAN_BE_b8g8r8x8:
     case PIXMAN_BE_b8g8r8a8:
+    case PIXMAN_BE_r8g8b8x8:
+    case PIXMAN_BE_r8g8b8a8:
     case PIXMAN_r5g6b5:
         return true;
     default:
@@ -64,6 +66,12 @@ void surface_gl_create_texture(QemuGLShader *gls,
         surface->glformat = GL_RGBA;
         surface->gltype = GL_UNSIGNED_BYTE;
         break;
+    case PIXMAN_BE_r8g8b8x8:
+    case PIXMAN_BE_r8g8b8a8:
+        /* Byte order matches GL_RGBA, upload without conversion */
+        surface->glformat = GL_RGBA;
+        surface->gltype = GL_UNSIGNED_BYTE;
+        break;
     case PIXMAN_r5g6b5:
         surface->glformat = GL_RGB;
         surface->gltype = GL_UNSIGNED_SHORT_5_6_5;
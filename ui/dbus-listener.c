@@ -23,6 +23,7 @@
  */
 #include "qemu/osdep.h"
 #include "qemu/error-report.h"
+#include "qemu/memfd.h"
 #include "qapi/error.h"
 #include "sysemu/sysemu.h"
 #include "dbus.h"
@@ -74,6 +75,14 @@ struct _DBusDisplayListener {
     bool ds_mapped;
     bool can_share_map;
 
+#ifdef G_OS_UNIX
+    QemuDBusDisplay1ListenerUnixMap *unix_map_proxy;
+    /* Shared copy of the surface, see dbus_scanout_map() */
+    void *map;
+    size_t map_size;
+    int map_fd;
+#endif
+
 #ifdef WIN32
     QemuDBusDisplay1ListenerWin32Map *map_proxy;
     QemuDBusDisplay1ListenerWin32D3d11 *d3d11_proxy;
@@ -305,6 +314,104 @@ static void dbus_scanout_dmabuf(DisplayChangeListener *dcl,
 #endif /* GBM */
 #endif /* OPENGL */
 
+#ifdef G_OS_UNIX
+/*
+ * Surfaces are not allocated in shared memory, so share a copy of the
+ * surface instead, and only copy the damaged regions to it afterwards.
+ * That is a single copy of the damage, instead of sending it through the
+ * D-Bus socket.
+ */
+static bool dbus_scanout_map(DBusDisplayListener *ddl)
+{
+    g_autoptr(GError) err = NULL;
+    g_autoptr(GUnixFDList) fd_list = NULL;
+    Error *local_err = NULL;
+    size_t size;
+
+    if (ddl->ds_share == SHARE_KIND_MAPPED) {
+        return true;
+    }
+
+    if (!ddl->can_share_map) {
+        return false;
+    }
+
+    size = surface_stride(ddl->ds) * surface_height(ddl->ds);
+    if (size != ddl->map_size) {
+        if (ddl->map) {
+            qemu_memfd_free(ddl->map, ddl->map_size, ddl->map_fd);
+            ddl->map = NULL;
+            ddl->map_size = 0;
+        }
+        ddl->map = qemu_memfd_alloc("qemu-dbus-display", size,
+                                    F_SEAL_GROW | F_SEAL_SHRINK | F_SEAL_SEAL,
+                                    &ddl->map_fd, &local_err);
+        if (!ddl->map) {
+            g_debug("Failed to allocate the shared map: %s",
+                    error_get_pretty(local_err));
+            error_free(local_err);
+            ddl->can_share_map = false;
+            return false;
+        }
+        ddl->map_size = size;
+    }
+    memcpy(ddl->map, surface_data(ddl->ds), size);
+
+    fd_list = g_unix_fd_list_new();
+    if (g_unix_fd_list_append(fd_list, ddl->map_fd, &err) != 0) {
+        g_debug("Failed to setup the shared map fdlist: %s", err->message);
+        ddl->can_share_map = false;
+        return false;
+    }
+
+    ddl_discard_pending_messages(ddl);
+
+    if (!qemu_dbus_display1_listener_unix_map_call_scanout_map_sync(
+            ddl->unix_map_proxy,
+            g_variant_new_handle(0),
+            0,
+            surface_width(ddl->ds),
+            surface_height(ddl->ds),
+            surface_stride(ddl->ds),
+            surface_format(ddl->ds),
+            G_DBUS_CALL_FLAGS_NONE,
+            DBUS_DEFAULT_TIMEOUT,
+            fd_list,
+            NULL,
+            NULL,
+            &err)) {
+        g_debug("Failed to call ScanoutMap: %s", err->message);
+        ddl->can_share_map = false;
+        return false;
+    }
+
+    ddl->ds_share = SHARE_KIND_MAPPED;
+
+    return true;
+}
+
+static void dbus_update_map(DBusDisplayListener *ddl,
+                            int x, int y, int w, int h)
+{
+    int bpp = DIV_ROUND_UP(PIXMAN_FORMAT_BPP(surface_format(ddl->ds)), 8);
+    int stride = surface_stride(ddl->ds);
+    uint8_t *src = surface_data(ddl->ds);
+    uint8_t *dst = ddl->map;
+    int i;
+
+    for (i = y; i < y + h; i++) {
+        memcpy(dst + i * stride + x * bpp, src + i * stride + x * bpp,
+               w * bpp);
+    }
+
+    qemu_dbus_display1_listener_unix_map_call_update_map(
+        ddl->unix_map_proxy,
+        x, y, w, h,
+        G_DBUS_CALL_FLAGS_NONE,
+        DBUS_DEFAULT_TIMEOUT, NULL, NULL, NULL);
+}
+#endif
+
 #ifdef WIN32
 static bool dbus_scanout_map(DBusDisplayListener *ddl)
 {
@@ -681,6 +788,11 @@ static void dbus_gfx_update(DisplayChangeListener *dcl,
             DBUS_DEFAULT_TIMEOUT, NULL, NULL, NULL);
         return;
     }
+#elif defined(G_OS_UNIX)
+    if (dbus_scanout_map(ddl)) {
+        dbus_update_map(ddl, x, y, w, h);
+        return;
+    }
 #endif
 
     if (x == 0 && y == 0 && w == surface_width(ddl->ds) && h == surface_height(ddl->ds)) {
@@ -797,6 +909,13 @@ dbus_display_listener_dispose(GObject *object)
     g_clear_object(&ddl->conn);
     g_clear_pointer(&ddl->bus_name, g_free);
     g_clear_object(&ddl->proxy);
+#ifdef G_OS_UNIX
+    g_clear_object(&ddl->unix_map_proxy);
+    if (ddl->map) {
+        qemu_memfd_free(ddl->map, ddl->map_size, ddl->map_fd);
+        ddl->map = NULL;
+    }
+#endif
 #ifdef WIN32
     g_clear_object(&ddl->map_proxy);
     g_clear_object(&ddl->d3d11_proxy);
@@ -856,7 +975,6 @@ dbus_display_listener_get_console(DBusDisplayListener *ddl)
     return ddl->console;
 }
 
-#ifdef WIN32
 static bool
 dbus_display_listener_implements(DBusDisplayListener *ddl, const char *iface)
 {
@@ -871,6 +989,8 @@ dbus_display_listener_implements(DBusDisplayListener *ddl, const char *iface)
     return implements;
 }
 
+#ifdef WIN32
+
 static bool
 dbus_display_listener_setup_peer_process(DBusDisplayListener *ddl)
 {
@@ -976,6 +1096,32 @@ dbus_display_listener_setup_shared_map(DBusDisplayListener *ddl)
         return;
     }
 
+    ddl->can_share_map = true;
+#elif defined(G_OS_UNIX)
+    g_autoptr(GError) err = NULL;
+
+    if (!dbus_display_listener_implements(ddl, "org.qemu.Display1.Listener.Unix.Map")) {
+        return;
+    }
+
+    if (!(g_dbus_connection_get_capabilities(ddl->conn) &
+          G_DBUS_CAPABILITY_FLAGS_UNIX_FD_PASSING) ||
+        !qemu_memfd_alloc_check()) {
+        return;
+    }
+
+    ddl->unix_map_proxy =
+        qemu_dbus_display1_listener_unix_map_proxy_new_sync(ddl->conn,
+            G_DBUS_PROXY_FLAGS_DO_NOT_AUTO_START,
+            NULL,
+            "/org/qemu/Display1/Listener",
+            NULL,
+            &err);
+    if (!ddl->unix_map_proxy) {
+        g_debug("Failed to setup Unix map proxy: %s", err->message);
+        return;
+    }
+
     ddl->can_share_map = true;
 #endif
 }
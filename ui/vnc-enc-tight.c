@@ -1422,6 +1422,13 @@ static int send_sub_rect_nojpeg(VncState *vs, int x, int y, int w, int h,
 }
 
 #ifdef CONFIG_VNC_JPEG
+/* The JPEG quality asked by the client, lowered if it can't keep up */
+static int tight_jpeg_quality(VncState *vs)
+{
+    return tight_conf[MAX(vs->tight->quality - vs->quality_drop, 0)]
+        .jpeg_quality;
+}
+
 static int send_sub_rect_jpeg(VncState *vs, int x, int y, int w, int h,
                               int bg, int fg, int colors,
                               VncPalette *palette, bool force)
@@ -1431,9 +1438,7 @@ static int send_sub_rect_jpeg(VncState *vs, int x, int y, int w, int h,
     if (colors == 0) {
         if (force || (tight_jpeg_conf[vs->tight->quality].jpeg_full &&
                       tight_detect_smooth_image(vs, w, h))) {
-            int quality = tight_conf[vs->tight->quality].jpeg_quality;
-
-            ret = send_jpeg_rect(vs, x, y, w, h, quality);
+            ret = send_jpeg_rect(vs, x, y, w, h, tight_jpeg_quality(vs));
         } else {
             ret = send_full_color_rect(vs, x, y, w, h);
         }
@@ -1445,9 +1450,7 @@ static int send_sub_rect_jpeg(VncState *vs, int x, int y, int w, int h,
         if (force || (colors > 96 &&
                       tight_jpeg_conf[vs->tight->quality].jpeg_idx &&
                       tight_detect_smooth_image(vs, w, h))) {
-            int quality = tight_conf[vs->tight->quality].jpeg_quality;
-
-            ret = send_jpeg_rect(vs, x, y, w, h, quality);
+            ret = send_jpeg_rect(vs, x, y, w, h, tight_jpeg_quality(vs));
         } else {
             ret = send_palette_rect(vs, x, y, w, h, palette);
         }
@@ -1141,6 +1141,32 @@ static bool vnc_should_update(VncState *vs)
     return false;
 }
 
+/* Lowest JPEG quality level reached because of a slow client */
+#define VNC_QUALITY_DROP_MAX 6
+
+/*
+ * Adapt the lossy encodings to the network: lower the JPEG quality
+ * quickly when updates pile up in the output buffer, and raise it again
+ * slowly once the client has received everything.
+ */
+static void vnc_adapt_quality(VncState *vs, bool congested)
+{
+    int drop = vs->quality_drop;
+
+    if (vs->vd->non_adaptive) {
+        return;
+    }
+    if (congested) {
+        drop = MIN(drop + 1, VNC_QUALITY_DROP_MAX);
+    } else if (drop && buffer_empty(&vs->output)) {
+        drop--;
+    }
+    if (drop != vs->quality_drop) {
+        trace_vnc_client_quality_drop(vs, vs->ioc, drop);
+        vs->quality_drop = drop;
+    }
+}
+
 static int vnc_update_client(VncState *vs, int has_dirty)
 {
     VncDisplay *vd = vs->vd;
@@ -1156,12 +1182,16 @@ static int vnc_update_client(VncState *vs, int has_dirty)
 
     vs->has_dirty += has_dirty;
     if (!vnc_should_update(vs)) {
+        if (vs->has_dirty && vs->output.offset >= vs->throttle_output_offset) {
+            vnc_adapt_quality(vs, true);
+        }
         return 0;
     }
 
     if (!vs->has_dirty && vs->update != VNC_STATE_UPDATE_FORCE) {
         return 0;
     }
+    vnc_adapt_quality(vs, false);
 
     /*
      * Send screen updates to the vnc client using the server
@@ -3109,7 +3139,7 @@ static int vnc_refresh_server_surface(VncDisplay *vd)
     int has_dirty = 0;
     pixman_image_t *tmpbuf = NULL;
     unsigned long offset;
-    int x;
+    int x, x2, xend, run_bytes;
     uint8_t *guest_ptr, *server_ptr;
 
     struct timeval tv = { 0, 0 };
@@ -3153,7 +3183,7 @@ static int vnc_refresh_server_surface(VncDisplay *vd)
         y = offset / VNC_DIRTY_BPL(&vd->guest);
         x = offset % VNC_DIRTY_BPL(&vd->guest);
 
-        server_ptr = server_row0 + y * server_stride + x * cmp_bytes;
+        server_ptr = server_row0 + y * server_stride;
 
         if (vd->guest.format != VNC_SERVER_FB_FORMAT) {
             qemu_pixman_linebuf_fill(tmpbuf, vd->guest.fb, width, 0, y);
@@ -3161,30 +3191,45 @@ static int vnc_refresh_server_surface(VncDisplay *vd)
         } else {
             guest_ptr = guest_row0 + y * guest_stride;
         }
-        guest_ptr += x * cmp_bytes;
 
-        for (; x < DIV_ROUND_UP(width, VNC_DIRTY_PIXELS_PER_BIT);
-             x++, guest_ptr += cmp_bytes, server_ptr += cmp_bytes) {
-            int _cmp_bytes = cmp_bytes;
-            if (!test_and_clear_bit(x, vd->guest.dirty[y])) {
-                continue;
-            }
-            if ((x + 1) * cmp_bytes > line_bytes) {
-                _cmp_bytes = line_bytes - x * cmp_bytes;
-            }
-            assert(_cmp_bytes >= 0);
-            if (memcmp(server_ptr, guest_ptr, _cmp_bytes) == 0) {
+        /*
+         * Guests often redraw areas that did not change, so compare each
+         * run of dirty bits at once first, which is much faster than one
+         * memcmp() per bit when the run is unchanged.
+         */
+        xend = DIV_ROUND_UP(width, VNC_DIRTY_PIXELS_PER_BIT);
+        while ((x = find_next_bit(vd->guest.dirty[y], xend, x)) < xend) {
+            x2 = find_next_zero_bit(vd->guest.dirty[y], xend, x);
+            bitmap_clear(vd->guest.dirty[y], x, x2 - x);
+            run_bytes = MIN(x2 * cmp_bytes, line_bytes) - x * cmp_bytes;
+            if (run_bytes <= 0 ||
+                memcmp(server_ptr + x * cmp_bytes, guest_ptr + x * cmp_bytes,
+                       run_bytes) == 0) {
+                x = x2;
                 continue;
             }
-            memcpy(server_ptr, guest_ptr, _cmp_bytes);
-            if (!vd->non_adaptive) {
-                vnc_rect_updated(vd, x * VNC_DIRTY_PIXELS_PER_BIT,
-                                 y, &tv);
-            }
-            QTAILQ_FOREACH(vs, &vd->clients, next) {
-                set_bit(x, vs->dirty[y]);
+
+            for (; x < x2; x++) {
+                int _cmp_bytes = cmp_bytes;
+                uint8_t *sp = server_ptr + x * cmp_bytes;
+                uint8_t *gp = guest_ptr + x * cmp_bytes;
+
+                if ((x + 1) * cmp_bytes > line_bytes) {
+                    _cmp_bytes = line_bytes - x * cmp_bytes;
+                }
+                if (_cmp_bytes <= 0 || memcmp(sp, gp, _cmp_bytes) == 0) {
+                    continue;
+                }
+                memcpy(sp, gp, _cmp_bytes);
+                if (!vd->non_adaptive) {
+                    vnc_rect_updated(vd, x * VNC_DIRTY_PIXELS_PER_BIT,
+                                     y, &tv);
+                }
+                QTAILQ_FOREACH(vs, &vd->clients, next) {
+                    set_bit(x, vs->dirty[y]);
+                }
+                has_dirty++;
             }
-            has_dirty++;
         }
 
         y++;
@@ -158,6 +158,8 @@ struct VncDisplay
     int ledstate;
     QKbdState *kbd;
     QemuMutex mutex;
+    /* Worker threads reading the server surface, protected by mutex */
+    int encoders;
 
     int cursor_msize;
     uint8_t *cursor_mask;
@@ -249,6 +251,8 @@ struct VncRectEntry
 struct VncJob
 {
     VncState *vs;
+    /* Picked up by a worker thread */
+    bool running;
 
     QLIST_HEAD(, VncRectEntry) rectangles;
     QTAILQ_ENTRY(VncJob) next;
@@ -278,6 +282,8 @@ struct VncState
     VncStateUpdate update; /* Most recent pending request from client */
     VncStateUpdate job_update; /* Currently processed by job thread */
     int has_dirty;
+    /* Steps of JPEG quality given up while the client can't keep up */
+    int quality_drop;
     uint32_t features;
     int absolute;
     int last_x;
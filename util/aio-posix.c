@@ -16,6 +16,7 @@
 #include "qemu/osdep.h"
 #include "block/block.h"
 #include "block/thread-pool.h"
+#include "qemu/counters.h"
 #include "qemu/main-loop.h"
 #include "qemu/rcu.h"
 #include "qemu/rcu_queue.h"
@@ -27,6 +28,9 @@
 /* Stop userspace polling on a handler if it isn't active for some time */
 #define POLL_IDLE_INTERVAL_NS (7 * NANOSECONDS_PER_SECOND)
 
+/* Window over which the time spent polling is compared with poll_budget */
+#define POLL_BUDGET_WINDOW_NS (100 * SCALE_MS)
+
 bool aio_poll_disabled(AioContext *ctx)
 {
     return qatomic_read(&ctx->poll_disable_cnt);
@@ -508,6 +512,50 @@ static bool remove_idle_poll_handlers(AioContext *ctx,
     return progress;
 }
 
+/*
+ * Adapt the polling time of @node after its event arrived @block_ns after
+ * aio_poll() started waiting, or after waiting @block_ns without an event.
+ */
+static void adjust_polling_time(AioContext *ctx, AioHandler *node,
+                                int64_t block_ns)
+{
+    if (block_ns <= node->poll_ns) {
+        /* This is the sweet spot, no adjustment needed */
+    } else if (block_ns > ctx->poll_max_ns) {
+        /* We'd have to poll for too long, poll less */
+        int64_t old = node->poll_ns;
+
+        if (ctx->poll_shrink) {
+            node->poll_ns /= ctx->poll_shrink;
+        } else {
+            node->poll_ns = 0;
+        }
+
+        trace_poll_shrink(ctx, node, old, node->poll_ns);
+    } else if (node->poll_ns < ctx->poll_max_ns &&
+               block_ns < ctx->poll_max_ns) {
+        /* There is room to grow, poll longer */
+        int64_t old = node->poll_ns;
+        int64_t grow = ctx->poll_grow;
+
+        if (grow == 0) {
+            grow = 2;
+        }
+
+        if (node->poll_ns) {
+            node->poll_ns *= grow;
+        } else {
+            node->poll_ns = 4000; /* start polling at 4 microseconds */
+        }
+
+        if (node->poll_ns > ctx->poll_max_ns) {
+            node->poll_ns = ctx->poll_max_ns;
+        }
+
+        trace_poll_grow(ctx, node, old, node->poll_ns);
+    }
+}
+
 /* run_poll_handlers:
  * @ctx: the AioContext
  * @ready_list: the list to place ready handlers on
@@ -548,6 +596,8 @@ static bool run_poll_handlers(AioContext *ctx, AioHandlerList *ready_list,
         assert(!(max_ns && progress));
     } while (elapsed_time < max_ns && !ctx->fdmon_ops->need_wait(ctx));
 
+    ctx->poll_budget_used_ns += elapsed_time;
+
     if (remove_idle_poll_handlers(ctx, ready_list,
                                   start_time + elapsed_time)) {
         *timeout = 0;
@@ -565,6 +615,28 @@ static bool run_poll_handlers(AioContext *ctx, AioHandlerList *ready_list,
     return progress;
 }
 
+/*
+ * Returns how long polling may still run in the current budget window, or
+ * INT64_MAX if the AioContext has no polling budget.
+ */
+static int64_t poll_budget_left(AioContext *ctx)
+{
+    int64_t now, allowed;
+
+    if (!ctx->poll_budget) {
+        return INT64_MAX;
+    }
+
+    now = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    if (now - ctx->poll_budget_start_ns >= POLL_BUDGET_WINDOW_NS) {
+        ctx->poll_budget_start_ns = now;
+        ctx->poll_budget_used_ns = 0;
+    }
+
+    allowed = POLL_BUDGET_WINDOW_NS / 100 * ctx->poll_budget;
+    return MAX(allowed - ctx->poll_budget_used_ns, 0);
+}
+
 /* try_poll_mode:
  * @ctx: the AioContext
  * @ready_list: list to add handlers that need to be run
@@ -578,13 +650,27 @@ static bool run_poll_handlers(AioContext *ctx, AioHandlerList *ready_list,
 static bool try_poll_mode(AioContext *ctx, AioHandlerList *ready_list,
                           int64_t *timeout)
 {
-    int64_t max_ns;
+    AioHandler *node;
+    int64_t max_ns = 0;
 
     if (QLIST_EMPTY_RCU(&ctx->poll_aio_handlers)) {
         return false;
     }
 
-    max_ns = qemu_soonest_timeout(*timeout, ctx->poll_ns);
+    /*
+     * Poll as long as the handler that needs it most, so that handlers
+     * whose events do not come in time to be polled do not keep the
+     * thread busy for the others.
+     */
+    QLIST_FOREACH(node, &ctx->poll_aio_handlers, node_poll) {
+        max_ns = MAX(max_ns, node->poll_ns);
+    }
+    max_ns = MIN(max_ns, ctx->poll_max_ns);
+    if (max_ns) {
+        max_ns = MIN(max_ns, poll_budget_left(ctx));
+    }
+
+    max_ns = qemu_soonest_timeout(*timeout, max_ns);
     if (max_ns && !ctx->fdmon_ops->need_wait(ctx)) {
         /*
          * Enable poll mode. It pairs with the poll_set_started() in
@@ -599,6 +685,9 @@ static bool try_poll_mode(AioContext *ctx, AioHandlerList *ready_list,
     return false;
 }
 
+QEMU_COUNTER_DEFINE(aio_poll_hits, "aio-poll-hits")
+QEMU_COUNTER_DEFINE(aio_sleeps, "aio-sleeps")
+
 bool aio_poll(AioContext *ctx, bool blocking)
 {
     AioHandlerList ready_list = QLIST_HEAD_INITIALIZER(ready_list);
@@ -628,6 +717,9 @@ bool aio_poll(AioContext *ctx, bool blocking)
     timeout = blocking ? aio_compute_timeout(ctx) : 0;
     progress = try_poll_mode(ctx, &ready_list, &timeout);
     assert(!(timeout && progress));
+    if (progress) {
+        qemu_counter_inc(&aio_poll_hits);
+    }
 
     /*
      * aio_notify can avoid the expensive event_notifier_set if
@@ -667,6 +759,9 @@ bool aio_poll(AioContext *ctx, bool blocking)
             progress = true;
         }
 
+        if (timeout) {
+            qemu_counter_inc(&aio_sleeps);
+        }
         ctx->fdmon_ops->wait(ctx, &ready_list, timeout);
     }
 
@@ -681,41 +776,18 @@ bool aio_poll(AioContext *ctx, bool blocking)
     /* Adjust polling time */
     if (ctx->poll_max_ns) {
         int64_t block_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME) - start;
+        AioHandler *node;
 
-        if (block_ns <= ctx->poll_ns) {
-            /* This is the sweet spot, no adjustment needed */
-        } else if (block_ns > ctx->poll_max_ns) {
-            /* We'd have to poll for too long, poll less */
-            int64_t old = ctx->poll_ns;
-
-            if (ctx->poll_shrink) {
-                ctx->poll_ns /= ctx->poll_shrink;
-            } else {
-                ctx->poll_ns = 0;
-            }
-
-            trace_poll_shrink(ctx, old, ctx->poll_ns);
-        } else if (ctx->poll_ns < ctx->poll_max_ns &&
-                   block_ns < ctx->poll_max_ns) {
-            /* There is room to grow, poll longer */
-            int64_t old = ctx->poll_ns;
-            int64_t grow = ctx->poll_grow;
-
-            if (grow == 0) {
-                grow = 2;
-            }
-
-            if (ctx->poll_ns) {
-                ctx->poll_ns *= grow;
-            } else {
-                ctx->poll_ns = 4000; /* start polling at 4 microseconds */
-            }
-
-            if (ctx->poll_ns > ctx->poll_max_ns) {
-                ctx->poll_ns = ctx->poll_max_ns;
+        /*
+         * Handlers without an event only learn that theirs is at least
+         * block_ns away, which is only enough to shrink their polling time.
+         * This is how idle handlers stop extending the polling of busy ones.
+         */
+        QLIST_FOREACH(node, &ctx->poll_aio_handlers, node_poll) {
+            if (QLIST_IS_INSERTED(node, node_ready) ||
+                block_ns > ctx->poll_max_ns) {
+                adjust_polling_time(ctx, node, block_ns);
             }
-
-            trace_poll_grow(ctx, old, ctx->poll_ns);
         }
     }
 
@@ -764,26 +836,34 @@ void aio_context_use_g_source(AioContext *ctx)
 }
 
 void aio_context_set_poll_params(AioContext *ctx, int64_t max_ns,
-                                 int64_t grow, int64_t shrink, Error **errp)
+                                 int64_t grow, int64_t shrink,
+                                 int64_t budget, Error **errp)
 {
+    if (budget > 100) {
+        error_setg(errp, "poll budget must be a percentage");
+        return;
+    }
+
     /* No thread synchronization here, it doesn't matter if an incorrect value
      * is used once.
      */
     ctx->poll_max_ns = max_ns;
-    ctx->poll_ns = 0;
     ctx->poll_grow = grow;
     ctx->poll_shrink = shrink;
+    ctx->poll_budget = budget;
 
     aio_notify(ctx);
 }
 
-void aio_context_set_aio_params(AioContext *ctx, int64_t max_batch)
+void aio_context_set_aio_params(AioContext *ctx, int64_t max_batch,
+                                int64_t sqpoll_idle)
 {
     /*
      * No thread synchronization here, it doesn't matter if an incorrect value
      * is used once.
      */
     ctx->aio_max_batch = max_batch;
+    ctx->aio_sqpoll_idle = sqpoll_idle;
 
     aio_notify(ctx);
 }
@@ -29,6 +29,7 @@
 #include "block/thread-pool.h"
 #include "block/graph-lock.h"
 #include "qemu/main-loop.h"
+#include "qemu/bql-profile.h"
 #include "qemu/atomic.h"
 #include "qemu/rcu_queue.h"
 #include "block/raw-aio.h"
@@ -168,7 +169,18 @@ void aio_bh_call(QEMUBH *bh)
         reentrancy_guard->engaged_in_io = true;
     }
 
-    bh->cb(bh->opaque);
+    if (bql_profile_is_enabled()) {
+        int64_t start = bql_profile_begin();
+        /* cb may free the bh */
+        const char *name = bh->name;
+
+        bh->cb(bh->opaque);
+        if (start) {
+            bql_profile_end(BQL_PROFILE_BH, name ?: "unnamed", start);
+        }
+    } else {
+        bh->cb(bh->opaque);
+    }
 
     if (reentrancy_guard) {
         reentrancy_guard->engaged_in_io = last_engaged_in_io;
@@ -368,7 +380,7 @@ aio_ctx_finalize(GSource     *source)
     QEMUBH *bh;
     unsigned flags;
 
-    thread_pool_free(ctx->thread_pool);
+    thread_pool_free_aio(ctx->thread_pool);
 
 #ifdef CONFIG_LINUX_AIO
     if (ctx->linux_aio) {
@@ -384,6 +396,16 @@ aio_ctx_finalize(GSource     *source)
         luring_cleanup(ctx->linux_io_uring);
         ctx->linux_io_uring = NULL;
     }
+    if (ctx->linux_io_uring_iopoll) {
+        luring_detach_aio_context(ctx->linux_io_uring_iopoll, ctx);
+        luring_cleanup(ctx->linux_io_uring_iopoll);
+        ctx->linux_io_uring_iopoll = NULL;
+    }
+    if (ctx->linux_io_uring_cmd) {
+        luring_detach_aio_context(ctx->linux_io_uring_cmd, ctx);
+        luring_cleanup(ctx->linux_io_uring_cmd);
+        ctx->linux_io_uring_cmd = NULL;
+    }
 #endif
 
     assert(QSLIST_EMPTY(&ctx->scheduled_coroutines));
@@ -434,10 +456,10 @@ GSource *aio_get_g_source(AioContext *ctx)
     return &ctx->source;
 }
 
-ThreadPool *aio_get_thread_pool(AioContext *ctx)
+ThreadPoolAio *aio_get_thread_pool(AioContext *ctx)
 {
     if (!ctx->thread_pool) {
-        ctx->thread_pool = thread_pool_new(ctx);
+        ctx->thread_pool = thread_pool_new_aio(ctx);
     }
     return ctx->thread_pool;
 }
@@ -468,7 +490,8 @@ LuringState *aio_setup_linux_io_uring(AioContext *ctx, Error **errp)
         return ctx->linux_io_uring;
     }
 
-    ctx->linux_io_uring = luring_init(errp);
+    ctx->linux_io_uring = luring_init(ctx->aio_sqpoll_idle, false, false,
+                                      errp);
     if (!ctx->linux_io_uring) {
         return NULL;
     }
@@ -482,6 +505,49 @@ LuringState *aio_get_linux_io_uring(AioContext *ctx)
     assert(ctx->linux_io_uring);
     return ctx->linux_io_uring;
 }
+
+LuringState *aio_setup_linux_io_uring_iopoll(AioContext *ctx, Error **errp)
+{
+    if (ctx->linux_io_uring_iopoll) {
+        return ctx->linux_io_uring_iopoll;
+    }
+
+    ctx->linux_io_uring_iopoll = luring_init(0, true, false, errp);
+    if (!ctx->linux_io_uring_iopoll) {
+        return NULL;
+    }
+
+    luring_attach_aio_context(ctx->linux_io_uring_iopoll, ctx);
+    return ctx->linux_io_uring_iopoll;
+}
+
+LuringState *aio_get_linux_io_uring_iopoll(AioContext *ctx)
+{
+    assert(ctx->linux_io_uring_iopoll);
+    return ctx->linux_io_uring_iopoll;
+}
+
+LuringState *aio_setup_linux_io_uring_cmd(AioContext *ctx, Error **errp)
+{
+    if (ctx->linux_io_uring_cmd) {
+        return ctx->linux_io_uring_cmd;
+    }
+
+    ctx->linux_io_uring_cmd = luring_init(ctx->aio_sqpoll_idle, false, true,
+                                          errp);
+    if (!ctx->linux_io_uring_cmd) {
+        return NULL;
+    }
+
+    luring_attach_aio_context(ctx->linux_io_uring_cmd, ctx);
+    return ctx->linux_io_uring_cmd;
+}
+
+LuringState *aio_get_linux_io_uring_cmd(AioContext *ctx)
+{
+    assert(ctx->linux_io_uring_cmd);
+    return ctx->linux_io_uring_cmd;
+}
 #endif
 
 void aio_notify(AioContext *ctx)
@@ -602,16 +668,18 @@ AioContext *aio_context_new(Error **errp)
 
 #ifdef CONFIG_LINUX_IO_URING
     ctx->linux_io_uring = NULL;
+    ctx->linux_io_uring_iopoll = NULL;
+    ctx->linux_io_uring_cmd = NULL;
 #endif
 
     ctx->thread_pool = NULL;
     qemu_rec_mutex_init(&ctx->lock);
     timerlistgroup_init(&ctx->tlg, aio_timerlist_notify, ctx);
 
-    ctx->poll_ns = 0;
     ctx->poll_max_ns = 0;
     ctx->poll_grow = 0;
     ctx->poll_shrink = 0;
+    ctx->poll_budget = 0;
 
     ctx->aio_max_batch = 0;
 
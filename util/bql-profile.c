@@ -0,0 +1,172 @@
+/*
+ * Big QEMU Lock hold-time profiling
+ *
+ * Copyright (c) 2024 The QEMU Project Developers
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/bql-profile.h"
+#include "qemu/main-loop.h"
+#include "qemu/timer.h"
+#include "trace.h"
+
+static const char *const bql_profile_kind_names[] = {
+    [BQL_PROFILE_LOCK] = "lock",
+    [BQL_PROFILE_MMIO] = "mmio",
+    [BQL_PROFILE_TIMER] = "timer",
+    [BQL_PROFILE_BH] = "bh",
+};
+
+bool bql_profile_enabled;
+
+/*
+ * Everything below is protected by the BQL itself.  Only one thread can
+ * hold it at a time, so the current hold needs no per-thread state.
+ */
+static GHashTable *entries;
+
+static struct {
+    /* 0 if the current hold is not being timed */
+    int64_t start;
+    int64_t wait_ns;
+    BQLProfileKind kind;
+    const char *name;
+    int line;
+} hold;
+
+static guint bql_profile_entry_hash(gconstpointer p)
+{
+    const BQLProfileEntry *e = p;
+
+    return g_str_hash(e->name) ^ (e->line << 2) ^ e->kind;
+}
+
+static gboolean bql_profile_entry_equal(gconstpointer ap, gconstpointer bp)
+{
+    const BQLProfileEntry *a = ap;
+    const BQLProfileEntry *b = bp;
+
+    return a->kind == b->kind && a->line == b->line &&
+        !strcmp(a->name, b->name);
+}
+
+static void bql_profile_entry_free(gpointer p)
+{
+    BQLProfileEntry *e = p;
+
+    g_free((char *)e->name);
+    g_free(e);
+}
+
+static BQLProfileEntry *bql_profile_entry_get(BQLProfileKind kind,
+                                              const char *name, int line)
+{
+    BQLProfileEntry key = { .kind = kind, .name = name, .line = line };
+    BQLProfileEntry *e;
+
+    if (!entries) {
+        entries = g_hash_table_new_full(bql_profile_entry_hash,
+                                        bql_profile_entry_equal,
+                                        NULL, bql_profile_entry_free);
+    }
+
+    e = g_hash_table_lookup(entries, &key);
+    if (!e) {
+        e = g_new0(BQLProfileEntry, 1);
+        e->kind = kind;
+        e->name = g_strdup(name);
+        e->line = line;
+        g_hash_table_add(entries, e);
+    }
+    return e;
+}
+
+static void bql_profile_record(BQLProfileKind kind, const char *name,
+                               int line, uint64_t hold_ns, uint64_t wait_ns)
+{
+    BQLProfileEntry *e = bql_profile_entry_get(kind, name, line);
+
+    e->count++;
+    e->hold_ns += hold_ns;
+    e->hold_max_ns = MAX(e->hold_max_ns, hold_ns);
+    e->wait_ns += wait_ns;
+    trace_bql_profile_hold(bql_profile_kind_names[kind], name, line,
+                           hold_ns, wait_ns);
+}
+
+void bql_profile_enable(void)
+{
+    assert(bql_locked());
+    qatomic_set(&bql_profile_enabled, true);
+}
+
+void bql_profile_disable(void)
+{
+    assert(bql_locked());
+    qatomic_set(&bql_profile_enabled, false);
+    hold.start = 0;
+}
+
+void bql_profile_reset(void)
+{
+    assert(bql_locked());
+    if (entries) {
+        g_hash_table_remove_all(entries);
+    }
+}
+
+void bql_profile_foreach(void (*fn)(const BQLProfileEntry *e, void *opaque),
+                         void *opaque)
+{
+    GHashTableIter iter;
+    gpointer e;
+
+    assert(bql_locked());
+    if (!entries) {
+        return;
+    }
+    g_hash_table_iter_init(&iter, entries);
+    while (g_hash_table_iter_next(&iter, &e, NULL)) {
+        fn(e, opaque);
+    }
+}
+
+void bql_profile_acquired(const char *file, int line, int64_t wait_ns)
+{
+    hold.start = get_clock();
+    hold.wait_ns = wait_ns;
+    hold.kind = BQL_PROFILE_LOCK;
+    hold.name = file;
+    hold.line = line;
+}
+
+void bql_profile_released(void)
+{
+    if (!hold.start) {
+        /* Profiling was enabled while the BQL was held */
+        return;
+    }
+    bql_profile_record(hold.kind, hold.name, hold.line,
+                       get_clock() - hold.start, hold.wait_ns);
+    hold.start = 0;
+}
+
+void bql_profile_set_holder(BQLProfileKind kind, const char *name)
+{
+    hold.kind = kind;
+    hold.name = name;
+    hold.line = 0;
+}
+
+int64_t bql_profile_begin(void)
+{
+    return bql_locked() ? get_clock() : 0;
+}
+
+void bql_profile_end(BQLProfileKind kind, const char *name, int64_t start)
+{
+    bql_profile_record(kind, name, 0, get_clock() - start, 0);
+}
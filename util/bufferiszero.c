@@ -264,6 +264,63 @@ static bool select_accel_fn(const void *buf, size_t len)
     return buffer_zero_int(buf, len);
 }
 
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+
+/*
+ * Advanced SIMD is architecturally mandatory for aarch64, so unlike x86
+ * there is nothing to probe: use it whenever the buffer is large enough.
+ * Like the x86 functions above, this requires len >= 64.
+ */
+static bool buffer_zero_neon(const void *buf, size_t len)
+{
+    uint32x4_t t = vld1q_u32(buf);
+    const uint32x4_t *p = (uint32x4_t *)(((uintptr_t)buf + 5 * 16) & -16);
+    const uint32x4_t *e = (uint32x4_t *)(((uintptr_t)buf + len) & -16);
+
+    /* Loop over 16-byte aligned blocks of 64.  */
+    while (likely(p <= e)) {
+        __builtin_prefetch(p);
+        if (unlikely(vmaxvq_u32(t) != 0)) {
+            return false;
+        }
+        t = vorrq_u32(vorrq_u32(p[-4], p[-3]), vorrq_u32(p[-2], p[-1]));
+        p += 4;
+    }
+
+    /* Finish the aligned tail.  */
+    t = vorrq_u32(t, e[-3]);
+    t = vorrq_u32(t, e[-2]);
+    t = vorrq_u32(t, e[-1]);
+
+    /* Finish the unaligned tail.  */
+    t = vorrq_u32(t, vld1q_u32(buf + len - 16));
+
+    return vmaxvq_u32(t) == 0;
+}
+
+static unsigned length_to_accel = 64;
+static bool (*buffer_accel)(const void *, size_t) = buffer_zero_neon;
+
+bool test_buffer_is_zero_next_accel(void)
+{
+    /* The only other implementation to test is the integer one.  */
+    if (buffer_accel == buffer_zero_int) {
+        return false;
+    }
+    length_to_accel = 0;
+    buffer_accel = buffer_zero_int;
+    return true;
+}
+
+static bool select_accel_fn(const void *buf, size_t len)
+{
+    if (likely(len >= length_to_accel)) {
+        return buffer_accel(buf, len);
+    }
+    return buffer_zero_int(buf, len);
+}
+
 #else
 #define select_accel_fn  buffer_zero_int
 bool test_buffer_is_zero_next_accel(void)
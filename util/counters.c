@@ -0,0 +1,117 @@
+/*
+ * Low-overhead event counters for QEMU internals
+ *
+ * Copyright (c) 2024 The QEMU Project Developers
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/counters.h"
+#include "qemu/coroutine-tls.h"
+#include "qemu/lockable.h"
+#include "qemu/notify.h"
+#include "qemu/queue.h"
+#include "qemu/thread.h"
+
+#define QEMU_COUNTERS_MAX 64
+
+/* The copies of the counters that belong to one thread */
+typedef struct QemuCounterThread {
+    Stat64 values[QEMU_COUNTERS_MAX];
+    Notifier exit;
+    QLIST_ENTRY(QemuCounterThread) next;
+} QemuCounterThread;
+
+/* Only modified before main() runs */
+static QemuCounter *counters[QEMU_COUNTERS_MAX];
+static unsigned int n_counters;
+
+/* Protects threads and exited */
+static QemuMutex counters_lock;
+static QLIST_HEAD(, QemuCounterThread) threads =
+    QLIST_HEAD_INITIALIZER(threads);
+static uint64_t exited[QEMU_COUNTERS_MAX];
+
+QEMU_DEFINE_STATIC_CO_TLS(QemuCounterThread *, my_counters)
+
+static void __attribute__((constructor)) qemu_counters_init(void)
+{
+    qemu_mutex_init(&counters_lock);
+}
+
+void qemu_counter_register(QemuCounter *c)
+{
+    assert(n_counters < QEMU_COUNTERS_MAX);
+    c->index = n_counters;
+    counters[n_counters++] = c;
+}
+
+static void qemu_counter_thread_exit(Notifier *n, void *data)
+{
+    QemuCounterThread *t = container_of(n, QemuCounterThread, exit);
+    unsigned int i;
+
+    WITH_QEMU_LOCK_GUARD(&counters_lock) {
+        for (i = 0; i < n_counters; i++) {
+            exited[i] += stat64_get(&t->values[i]);
+        }
+        QLIST_REMOVE(t, next);
+    }
+
+    set_my_counters(NULL);
+    g_free(t);
+}
+
+static QemuCounterThread *qemu_counter_thread_new(void)
+{
+    QemuCounterThread *t = g_new0(QemuCounterThread, 1);
+
+    t->exit.notify = qemu_counter_thread_exit;
+    qemu_thread_atexit_add(&t->exit);
+
+    WITH_QEMU_LOCK_GUARD(&counters_lock) {
+        QLIST_INSERT_HEAD(&threads, t, next);
+    }
+
+    set_my_counters(t);
+    return t;
+}
+
+void qemu_counter_add(QemuCounter *c, uint64_t n)
+{
+    QemuCounterThread *t = get_my_counters();
+
+    if (unlikely(!t)) {
+        t = qemu_counter_thread_new();
+    }
+    stat64_add(&t->values[c->index], n);
+}
+
+uint64_t qemu_counter_get(QemuCounter *c)
+{
+    QemuCounterThread *t;
+    uint64_t value;
+
+    if (c->stat) {
+        return stat64_get(c->stat);
+    }
+
+    QEMU_LOCK_GUARD(&counters_lock);
+    value = exited[c->index];
+    QLIST_FOREACH(t, &threads, next) {
+        value += stat64_get(&t->values[c->index]);
+    }
+    return value;
+}
+
+void qemu_counters_foreach(void (*fn)(QemuCounter *c, void *opaque),
+                           void *opaque)
+{
+    unsigned int i;
+
+    for (i = 0; i < n_counters; i++) {
+        fn(counters[i], opaque);
+    }
+}
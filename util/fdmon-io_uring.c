@@ -25,14 +25,19 @@
  *
  * File descriptor monitoring is implemented using the following operations:
  *
- * 1. IORING_OP_POLL_ADD - adds a file descriptor to be monitored.
+ * 1. IORING_OP_POLL_ADD - adds a file descriptor to be monitored.  The poll
+ *    is one-shot and re-armed after each event.  Multishot polls are
+ *    edge-triggered, and a handler that leaves data pending would never
+ *    be called again.
  * 2. IORING_OP_POLL_REMOVE - removes a file descriptor being monitored.  When
  *    the poll mask changes for a file descriptor it is first removed and then
  *    re-added with the new poll mask, so this operation is also used as part
  *    of modifying an existing monitored file descriptor.
  * 3. IORING_OP_TIMEOUT - added every time a blocking syscall is made to wait
  *    for events.  This operation self-cancels if another event completes
- *    before the timeout.
+ *    before the timeout.  Kernels with IORING_FEAT_EXT_ARG take the timeout
+ *    as an argument of io_uring_enter(2) instead, which saves the sqe and
+ *    its cqe.
  *
  * io_uring calls the submission queue the "sq ring" and the completion queue
  * the "cq ring".  Ring entries are called "sqe" and "cqe", respectively.
@@ -272,20 +277,52 @@ static int process_cq_ring(AioContext *ctx, AioHandlerList *ready_list)
     return num_ready;
 }
 
+#ifdef CONFIG_LINUX_IO_URING_EXT_ARG
+/* Submit and wait with a timeout passed to io_uring_enter(2) */
+static void submit_and_wait_timeout(AioContext *ctx, unsigned wait_nr,
+                                    int64_t ns)
+{
+    struct io_uring_cqe *cqe;
+    struct __kernel_timespec ts = {
+        .tv_sec = ns / NANOSECONDS_PER_SECOND,
+        .tv_nsec = ns % NANOSECONDS_PER_SECOND,
+    };
+    int ret;
+
+    do {
+        ret = io_uring_submit_and_wait_timeout(&ctx->fdmon_io_uring, &cqe,
+                                               wait_nr, &ts, NULL);
+    } while (ret == -EINTR);
+
+    assert(ret >= 0 || ret == -ETIME);
+}
+#endif
+
 static int fdmon_io_uring_wait(AioContext *ctx, AioHandlerList *ready_list,
                                int64_t timeout)
 {
     unsigned wait_nr = 1; /* block until at least one cqe is ready */
     int ret;
 
+    fill_sq_ring(ctx);
+
     if (timeout == 0) {
         wait_nr = 0; /* non-blocking */
     } else if (timeout > 0) {
+#ifdef CONFIG_LINUX_IO_URING_EXT_ARG
+        /*
+         * Without IORING_FEAT_EXT_ARG liburing would add a timeout sqe with
+         * its own user_data, so only use the timeout argument when the
+         * kernel has it.
+         */
+        if (ctx->fdmon_io_uring.features & IORING_FEAT_EXT_ARG) {
+            submit_and_wait_timeout(ctx, wait_nr, timeout);
+            return process_cq_ring(ctx, ready_list);
+        }
+#endif
         add_timeout_sqe(ctx, timeout);
     }
 
-    fill_sq_ring(ctx);
-
     do {
         ret = io_uring_submit_and_wait(&ctx->fdmon_io_uring, wait_nr);
     } while (ret == -EINTR);
@@ -14,6 +14,10 @@
 #include "qemu/host-utils.h"
 #include "trace.h"
 #include "crypto/hash.h"
+#ifdef CONFIG_AVX2_OPT
+#include <immintrin.h>
+#include "host/cpuinfo.h"
+#endif
 
 /* HBitmaps provides an array of bits.  The bits are stored as usual in an
  * array of unsigned longs, but HBitmap is also optimized to provide fast
@@ -101,6 +105,199 @@ struct HBitmap {
     uint64_t sizes[HBITMAP_LEVELS];
 };
 
+/*
+ * Kernels for the loops that go over a whole level: merging two bitmaps,
+ * counting the set bits and looking for a word that is not all ones.
+ *
+ * x86 hosts select versions that use POPCNT and AVX2 at startup.  This
+ * matters even for the simple loops, because the baseline ISA has no
+ * popcount instruction and ctpopl() would become a library call.  Other
+ * hosts have a popcount instruction that the compiler already uses, and
+ * the loops are simple enough for it to vectorize.
+ */
+static uint64_t hb_or_count_int(unsigned long *dst, const unsigned long *a,
+                                const unsigned long *b, size_t n)
+{
+    uint64_t count = 0;
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        dst[i] = a[i] | b[i];
+        count += ctpopl(dst[i]);
+    }
+    return count;
+}
+
+static uint64_t hb_count_int(const unsigned long *p, size_t n)
+{
+    uint64_t count = 0;
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        count += ctpopl(p[i]);
+    }
+    return count;
+}
+
+/* Return the index of the first word in [pos, n) with a zero bit, or n */
+static size_t hb_find_not_ones_int(const unsigned long *p, size_t pos,
+                                   size_t n)
+{
+    while (pos < n && p[pos] == (unsigned long)-1) {
+        pos++;
+    }
+    return pos;
+}
+
+#ifdef CONFIG_AVX2_OPT
+static uint64_t __attribute__((target("popcnt")))
+hb_or_count_popcnt(unsigned long *dst, const unsigned long *a,
+                   const unsigned long *b, size_t n)
+{
+    uint64_t count = 0;
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        dst[i] = a[i] | b[i];
+        count += ctpopl(dst[i]);
+    }
+    return count;
+}
+
+static uint64_t __attribute__((target("popcnt")))
+hb_count_popcnt(const unsigned long *p, size_t n)
+{
+    uint64_t count = 0;
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        count += ctpopl(p[i]);
+    }
+    return count;
+}
+
+#define HB_AVX2_WORDS (sizeof(__m256i) / sizeof(unsigned long))
+
+/*
+ * Count the bits of each byte with a nibble lookup table, then add the
+ * bytes of each 64-bit lane.
+ */
+static inline __m256i __attribute__((target("avx2")))
+hb_popcnt_avx2(__m256i v)
+{
+    const __m256i lut = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3,
+                                         1, 2, 2, 3, 2, 3, 3, 4,
+                                         0, 1, 1, 2, 1, 2, 2, 3,
+                                         1, 2, 2, 3, 2, 3, 3, 4);
+    const __m256i nibble = _mm256_set1_epi8(0x0f);
+    __m256i lo = _mm256_and_si256(v, nibble);
+    __m256i hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), nibble);
+    __m256i bytes = _mm256_add_epi8(_mm256_shuffle_epi8(lut, lo),
+                                    _mm256_shuffle_epi8(lut, hi));
+
+    return _mm256_sad_epu8(bytes, _mm256_setzero_si256());
+}
+
+static inline uint64_t __attribute__((target("avx2")))
+hb_sum_avx2(__m256i acc)
+{
+    uint64_t lanes[4];
+
+    _mm256_storeu_si256((__m256i *)lanes, acc);
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3];
+}
+
+static uint64_t __attribute__((target("avx2,popcnt")))
+hb_or_count_avx2(unsigned long *dst, const unsigned long *a,
+                 const unsigned long *b, size_t n)
+{
+    __m256i acc = _mm256_setzero_si256();
+    size_t i;
+
+    for (i = 0; i + HB_AVX2_WORDS <= n; i += HB_AVX2_WORDS) {
+        __m256i v = _mm256_or_si256(_mm256_loadu_si256((const __m256i *)(a + i)),
+                                    _mm256_loadu_si256((const __m256i *)(b + i)));
+
+        _mm256_storeu_si256((__m256i *)(dst + i), v);
+        acc = _mm256_add_epi64(acc, hb_popcnt_avx2(v));
+    }
+    return hb_sum_avx2(acc) + hb_or_count_popcnt(dst + i, a + i, b + i, n - i);
+}
+
+static uint64_t __attribute__((target("avx2,popcnt")))
+hb_count_avx2(const unsigned long *p, size_t n)
+{
+    __m256i acc = _mm256_setzero_si256();
+    size_t i;
+
+    for (i = 0; i + HB_AVX2_WORDS <= n; i += HB_AVX2_WORDS) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(p + i));
+
+        acc = _mm256_add_epi64(acc, hb_popcnt_avx2(v));
+    }
+    return hb_sum_avx2(acc) + hb_count_popcnt(p + i, n - i);
+}
+
+static size_t __attribute__((target("avx2")))
+hb_find_not_ones_avx2(const unsigned long *p, size_t pos, size_t n)
+{
+    const __m256i ones = _mm256_set1_epi8(-1);
+
+    for (; pos + HB_AVX2_WORDS <= n; pos += HB_AVX2_WORDS) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(p + pos));
+
+        if (!_mm256_testc_si256(v, ones)) {
+            break;
+        }
+    }
+    return hb_find_not_ones_int(p, pos, n);
+}
+#endif /* CONFIG_AVX2_OPT */
+
+static uint64_t (*hb_or_count)(unsigned long *dst, const unsigned long *a,
+                               const unsigned long *b, size_t n) =
+    hb_or_count_int;
+static uint64_t (*hb_count)(const unsigned long *p, size_t n) = hb_count_int;
+static size_t (*hb_find_not_ones)(const unsigned long *p, size_t pos,
+                                  size_t n) = hb_find_not_ones_int;
+
+#ifdef CONFIG_AVX2_OPT
+static void __attribute__((constructor)) init_accel(void)
+{
+    unsigned info = cpuinfo_init();
+
+    if (info & CPUINFO_POPCNT) {
+        hb_or_count = hb_or_count_popcnt;
+        hb_count = hb_count_popcnt;
+    }
+    if (info & CPUINFO_AVX2) {
+        hb_find_not_ones = hb_find_not_ones_avx2;
+        if (info & CPUINFO_POPCNT) {
+            hb_or_count = hb_or_count_avx2;
+            hb_count = hb_count_avx2;
+        }
+    }
+}
+#endif /* CONFIG_AVX2_OPT */
+
+/* Count the set bits in the last level, ignoring those past hb->size */
+static uint64_t hb_count_all(const HBitmap *hb)
+{
+    const unsigned long *last_lev = hb->levels[HBITMAP_LEVELS - 1];
+    size_t n = hb->sizes[HBITMAP_LEVELS - 1];
+    int bit = hb->size & (BITS_PER_LONG - 1);
+    unsigned long cur;
+
+    if (!hb->size) {
+        return 0;
+    }
+    cur = last_lev[n - 1];
+    if (bit) {
+        cur &= (1UL << bit) - 1;
+    }
+    return hb_count(last_lev, n - 1) + ctpopl(cur);
+}
+
 /* Advance hbi to the next nonzero word and return it.  hbi->pos
  * is updated.  Returns zero if we reach the end of the bitmap.
  */
@@ -245,10 +442,7 @@ int64_t hbitmap_next_zero(const HBitmap *hb, int64_t start, int64_t count)
     assert((start >> hb->granularity) < hb->size);
 
     if (cur == (unsigned long)-1) {
-        do {
-            pos++;
-        } while (pos < sz && last_lev[pos] == (unsigned long)-1);
-
+        pos = hb_find_not_ones(last_lev, pos + 1, sz);
         if (pos >= sz) {
             return -1;
         }
@@ -682,6 +876,11 @@ void hbitmap_serialize_part(const HBitmap *hb, uint8_t *buf,
     serialization_chunk(hb, start, count, &cur, &el_count);
     end = cur + el_count;
 
+    if (!HOST_BIG_ENDIAN) {
+        memcpy(buf, cur, el_count * sizeof(unsigned long));
+        return;
+    }
+
     while (cur != end) {
         unsigned long el =
             (BITS_PER_LONG == 32 ? cpu_to_le32(*cur) : cpu_to_le64(*cur));
@@ -705,17 +904,21 @@ void hbitmap_deserialize_part(HBitmap *hb, uint8_t *buf,
     serialization_chunk(hb, start, count, &cur, &el_count);
     end = cur + el_count;
 
-    while (cur != end) {
-        memcpy(cur, buf, sizeof(*cur));
+    if (!HOST_BIG_ENDIAN) {
+        memcpy(cur, buf, el_count * sizeof(unsigned long));
+    } else {
+        while (cur != end) {
+            memcpy(cur, buf, sizeof(*cur));
 
-        if (BITS_PER_LONG == 32) {
-            le32_to_cpus((uint32_t *)cur);
-        } else {
-            le64_to_cpus((uint64_t *)cur);
-        }
+            if (BITS_PER_LONG == 32) {
+                le32_to_cpus((uint32_t *)cur);
+            } else {
+                le64_to_cpus((uint64_t *)cur);
+            }
 
-        buf += sizeof(unsigned long);
-        cur++;
+            buf += sizeof(unsigned long);
+            cur++;
+        }
     }
     if (finish) {
         hbitmap_deserialize_finish(hb);
@@ -778,7 +981,7 @@ void hbitmap_deserialize_finish(HBitmap *bitmap)
     }
 
     bitmap->levels[0][0] |= 1UL << (BITS_PER_LONG - 1);
-    bitmap->count = hb_count_between(bitmap, 0, bitmap->size - 1);
+    bitmap->count = hb_count_all(bitmap);
 }
 
 void hbitmap_free(HBitmap *hb)
@@ -900,8 +1103,10 @@ static void hbitmap_sparse_merge(HBitmap *dst, const HBitmap *src)
  */
 void hbitmap_merge(const HBitmap *a, const HBitmap *b, HBitmap *result)
 {
-    int i;
-    uint64_t j;
+    const unsigned long *a_lev, *b_lev;
+    unsigned long *r_lev, last;
+    int i, bit;
+    uint64_t j, n;
 
     assert(a->orig_size == result->orig_size);
     assert(b->orig_size == result->orig_size);
@@ -934,14 +1139,25 @@ void hbitmap_merge(const HBitmap *a, const HBitmap *b, HBitmap *result)
      * by using hbitmap_iter_next, but this is suboptimal for dense maps.
      */
     assert(a->size == b->size);
-    for (i = HBITMAP_LEVELS - 1; i >= 0; i--) {
+    for (i = HBITMAP_LEVELS - 2; i >= 0; i--) {
         for (j = 0; j < a->sizes[i]; j++) {
             result->levels[i][j] = a->levels[i][j] | b->levels[i][j];
         }
     }
 
-    /* Recompute the dirty count */
-    result->count = hb_count_between(result, 0, result->size - 1);
+    /* Merge the last level and recompute the dirty count in the same pass */
+    n = a->sizes[HBITMAP_LEVELS - 1];
+    bit = a->size & (BITS_PER_LONG - 1);
+    a_lev = a->levels[HBITMAP_LEVELS - 1];
+    b_lev = b->levels[HBITMAP_LEVELS - 1];
+    r_lev = result->levels[HBITMAP_LEVELS - 1];
+    result->count = hb_or_count(r_lev, a_lev, b_lev, n - 1);
+    r_lev[n - 1] = a_lev[n - 1] | b_lev[n - 1];
+    last = r_lev[n - 1];
+    if (bit) {
+        last &= (1UL << bit) - 1;
+    }
+    result->count += ctpopl(last);
 }
 
 char *hbitmap_sha256(const HBitmap *bitmap, Error **errp)
@@ -26,6 +26,14 @@ size_t iov_from_buf_full(const struct iovec *iov, unsigned int iov_cnt,
 {
     size_t done;
     unsigned int i;
+
+    /* Fast path for the common case of a request within the first element */
+    if (likely(iov_cnt && offset < iov[0].iov_len &&
+               bytes <= iov[0].iov_len - offset)) {
+        memcpy(iov[0].iov_base + offset, buf, bytes);
+        return bytes;
+    }
+
     for (i = 0, done = 0; (offset || done < bytes) && i < iov_cnt; i++) {
         if (offset < iov[i].iov_len) {
             size_t len = MIN(iov[i].iov_len - offset, bytes - done);
@@ -45,6 +53,13 @@ size_t iov_to_buf_full(const struct iovec *iov, const unsigned int iov_cnt,
 {
     size_t done;
     unsigned int i;
+
+    if (likely(iov_cnt && offset < iov[0].iov_len &&
+               bytes <= iov[0].iov_len - offset)) {
+        memcpy(buf, iov[0].iov_base + offset, bytes);
+        return bytes;
+    }
+
     for (i = 0, done = 0; (offset || done < bytes) && i < iov_cnt; i++) {
         if (offset < iov[i].iov_len) {
             size_t len = MIN(iov[i].iov_len - offset, bytes - done);
@@ -64,6 +79,13 @@ size_t iov_memset(const struct iovec *iov, const unsigned int iov_cnt,
 {
     size_t done;
     unsigned int i;
+
+    if (likely(iov_cnt && offset < iov[0].iov_len &&
+               bytes <= iov[0].iov_len - offset)) {
+        memset(iov[0].iov_base + offset, fillc, bytes);
+        return bytes;
+    }
+
     for (i = 0, done = 0; (offset || done < bytes) && i < iov_cnt; i++) {
         if (offset < iov[i].iov_len) {
             size_t len = MIN(iov[i].iov_len - offset, bytes - done);
@@ -327,6 +349,13 @@ size_t qemu_iovec_concat_iov(QEMUIOVector *dst,
         return 0;
     }
     assert(dst->nalloc != -1);
+
+    /* Grow dst once rather than for each element */
+    if (dst->niov + src_cnt > dst->nalloc) {
+        dst->nalloc = MAX(dst->niov + src_cnt, 2 * dst->nalloc + 1);
+        dst->iov = g_renew(struct iovec, dst->iov, dst->nalloc);
+    }
+
     for (i = 0, done = 0; done < sbytes && i < src_cnt; i++) {
         if (soffset < src_iov[i].iov_len) {
             size_t len = MIN(src_iov[i].iov_len - soffset, sbytes - done);
@@ -0,0 +1,235 @@
+/*
+ * Sampling lock profiler
+ *
+ * Copyright (c) 2024 The QEMU Project Developers
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ *
+ * QSP (qsp.c) times every acquisition and keeps per-thread, per-object
+ * entries, which is thorough but too expensive to leave on in production.
+ * This profiler takes one acquisition of QemuMutexes and of the BQL every
+ * "period" in each thread instead.  Acquisitions that are not sampled only
+ * pay for decrementing a thread-local counter; sampled ones record how long
+ * the thread waited for the lock and, when it is released, how long it was
+ * held.  Samples are aggregated by call site, which is the file:line that
+ * the locking macros pass down.
+ *
+ * Recursive mutexes, trylock and condition variables are not sampled.  The
+ * profiler and QSP swap the same function pointers, so at most one of them
+ * is enabled at a time.
+ */
+#include "qemu/osdep.h"
+#include "qemu/coroutine-tls.h"
+#include "qemu/host-utils.h"
+#include "qemu/lock-sample.h"
+#include "qemu/qsp.h"
+#include "qemu/thread.h"
+#include "qemu/timer.h"
+
+typedef struct LockSampleKey {
+    const char *file;
+    int line;
+    LockSampleType type;
+} LockSampleKey;
+
+/* Protects sites and the statistics of every site */
+static QemuSpin sites_lock;
+/* Sites are never freed, so that held mutexes can keep pointing to them */
+static GHashTable *sites;
+
+static unsigned int sample_period = 1000;
+
+/* Acquisitions left before this thread takes the next sample */
+QEMU_DEFINE_STATIC_CO_TLS(unsigned int, countdown)
+
+static guint lock_sample_key_hash(gconstpointer p)
+{
+    const LockSampleKey *k = p;
+
+    /* Like QSP, do not hash the file name; the pointer is good enough */
+    return g_direct_hash(k->file) ^ (k->line << 1) ^ k->type;
+}
+
+static gboolean lock_sample_key_equal(gconstpointer ap, gconstpointer bp)
+{
+    const LockSampleKey *a = ap;
+    const LockSampleKey *b = bp;
+
+    return a->line == b->line && a->type == b->type &&
+        (a->file == b->file || !strcmp(a->file, b->file));
+}
+
+static void __attribute__((constructor)) lock_sample_init(void)
+{
+    qemu_spin_init(&sites_lock);
+    sites = g_hash_table_new(lock_sample_key_hash, lock_sample_key_equal);
+}
+
+static unsigned int lock_sample_bucket(uint64_t ns)
+{
+    return ns ? MIN(64 - clz64(ns), LOCK_SAMPLE_BUCKETS - 1) : 0;
+}
+
+/* Called with sites_lock held */
+static LockSampleSite *lock_sample_site_get(const char *file, int line,
+                                            LockSampleType type)
+{
+    LockSampleKey key = { .file = file, .line = line, .type = type };
+    LockSampleSite *site = g_hash_table_lookup(sites, &key);
+
+    if (!site) {
+        LockSampleKey *k = g_new(LockSampleKey, 1);
+
+        *k = key;
+        site = g_new0(LockSampleSite, 1);
+        site->file = file;
+        site->line = line;
+        site->type = type;
+        g_hash_table_insert(sites, k, site);
+    }
+    return site;
+}
+
+static inline bool lock_sample_skip(void)
+{
+    unsigned int n = get_countdown();
+
+    if (likely(n)) {
+        set_countdown(n - 1);
+        return true;
+    }
+    set_countdown(qatomic_read(&sample_period) - 1);
+    return false;
+}
+
+static void lock_sample_acquire(QemuMutex *mutex, const char *file, int line,
+                                LockSampleType type)
+{
+    LockSampleSite *site;
+    int64_t t0, t1;
+    uint64_t ns;
+
+    t0 = get_clock();
+    qemu_mutex_lock_impl(mutex, file, line);
+    t1 = get_clock();
+    ns = t1 - t0;
+
+    qemu_spin_lock(&sites_lock);
+    site = lock_sample_site_get(file, line, type);
+    site->samples++;
+    site->wait_ns += ns;
+    site->wait_max_ns = MAX(site->wait_max_ns, ns);
+    site->wait_hist[lock_sample_bucket(ns)]++;
+    qemu_spin_unlock(&sites_lock);
+
+    mutex->sample = site;
+    mutex->sample_start = t1;
+}
+
+static void lock_sample_mutex_lock(QemuMutex *mutex, const char *file,
+                                   int line)
+{
+    if (lock_sample_skip()) {
+        qemu_mutex_lock_impl(mutex, file, line);
+    } else {
+        lock_sample_acquire(mutex, file, line, LOCK_SAMPLE_MUTEX);
+    }
+}
+
+static void lock_sample_bql_lock(QemuMutex *mutex, const char *file, int line)
+{
+    if (lock_sample_skip()) {
+        qemu_mutex_lock_impl(mutex, file, line);
+    } else {
+        lock_sample_acquire(mutex, file, line, LOCK_SAMPLE_BQL);
+    }
+}
+
+void lock_sample_release(QemuMutex *mutex)
+{
+    LockSampleSite *site = mutex->sample;
+    uint64_t ns = get_clock() - mutex->sample_start;
+
+    mutex->sample = NULL;
+
+    qemu_spin_lock(&sites_lock);
+    site->hold_ns += ns;
+    site->hold_max_ns = MAX(site->hold_max_ns, ns);
+    site->hold_hist[lock_sample_bucket(ns)]++;
+    qemu_spin_unlock(&sites_lock);
+}
+
+bool lock_sample_enable(unsigned int period)
+{
+    assert(period);
+    if (qsp_is_enabled()) {
+        return false;
+    }
+    qatomic_set(&sample_period, period);
+    qatomic_set(&qemu_mutex_lock_func, lock_sample_mutex_lock);
+    qatomic_set(&bql_mutex_lock_func, lock_sample_bql_lock);
+    return true;
+}
+
+void lock_sample_disable(void)
+{
+    if (lock_sample_is_enabled()) {
+        qatomic_set(&qemu_mutex_lock_func, qemu_mutex_lock_impl);
+        qatomic_set(&bql_mutex_lock_func, qemu_mutex_lock_impl);
+    }
+}
+
+bool lock_sample_is_enabled(void)
+{
+    return qatomic_read(&qemu_mutex_lock_func) == lock_sample_mutex_lock;
+}
+
+unsigned int lock_sample_get_period(void)
+{
+    return qatomic_read(&sample_period);
+}
+
+static void lock_sample_site_reset(gpointer key, gpointer value,
+                                   gpointer user_data)
+{
+    LockSampleSite *site = value;
+
+    memset(&site->samples, 0,
+           sizeof(*site) - offsetof(LockSampleSite, samples));
+}
+
+void lock_sample_reset(void)
+{
+    qemu_spin_lock(&sites_lock);
+    g_hash_table_foreach(sites, lock_sample_site_reset, NULL);
+    qemu_spin_unlock(&sites_lock);
+}
+
+static void lock_sample_site_copy(gpointer key, gpointer value,
+                                  gpointer user_data)
+{
+    LockSampleSite *site = value;
+    GArray *copies = user_data;
+
+    if (site->samples) {
+        g_array_append_val(copies, *site);
+    }
+}
+
+void lock_sample_foreach(void (*fn)(const LockSampleSite *site, void *opaque),
+                         void *opaque)
+{
+    g_autoptr(GArray) copies = g_array_new(false, false,
+                                           sizeof(LockSampleSite));
+    guint i;
+
+    /* Do not call out with the spinlock held */
+    qemu_spin_lock(&sites_lock);
+    g_hash_table_foreach(sites, lock_sample_site_copy, copies);
+    qemu_spin_unlock(&sites_lock);
+
+    for (i = 0; i < copies->len; i++) {
+        fn(&g_array_index(copies, LockSampleSite, i), opaque);
+    }
+}
@@ -120,14 +120,30 @@ static const QemuModinfo module_info_stub[] = { {
 static const QemuModinfo *module_info = module_info_stub;
 static const char *module_arch;
 
+/*
+ * Maps the QOM types provided by the modules of this arch to their module,
+ * so that looking up a type does not walk every type of every module.
+ * Built on first use.
+ */
+static GHashTable *module_qom_types;
+/* Value in module_qom_types of types provided by several modules */
+static const QemuModinfo module_qom_ambiguous;
+
+static void module_qom_types_invalidate(void)
+{
+    g_clear_pointer(&module_qom_types, g_hash_table_unref);
+}
+
 void module_init_info(const QemuModinfo *info)
 {
     module_info = info;
+    module_qom_types_invalidate();
 }
 
 void module_allow_arch(const char *arch)
 {
     module_arch = arch;
+    module_qom_types_invalidate();
 }
 
 static bool module_check_arch(const QemuModinfo *modinfo)
@@ -316,18 +332,16 @@ out:
 
 static bool module_loaded_qom_all;
 
-int module_load_qom(const char *type, Error **errp)
+static GHashTable *module_qom_types_get(void)
 {
     const QemuModinfo *modinfo;
     const char **sl;
-    int rv = 0;
 
-    if (!type) {
-        error_setg(errp, "%s", "type is NULL");
-        return -1;
+    if (module_qom_types) {
+        return module_qom_types;
     }
 
-    trace_module_lookup_object_type(type);
+    module_qom_types = g_hash_table_new(g_str_hash, g_str_equal);
     for (modinfo = module_info; modinfo->name != NULL; modinfo++) {
         if (!modinfo->objs) {
             continue;
@@ -336,19 +350,36 @@ int module_load_qom(const char *type, Error **errp)
             continue;
         }
         for (sl = modinfo->objs; *sl != NULL; sl++) {
-            if (strcmp(type, *sl) == 0) {
-                if (rv > 0) {
-                    error_setg(errp, "multiple modules providing '%s'", type);
-                    return -1;
-                }
-                rv = module_load("", modinfo->name, errp);
-                if (rv < 0) {
-                    return rv;
-                }
-            }
+            const QemuModinfo *old = g_hash_table_lookup(module_qom_types,
+                                                         *sl);
+
+            g_hash_table_insert(module_qom_types, (gpointer)*sl,
+                                (gpointer)(old && old != modinfo ?
+                                           &module_qom_ambiguous : modinfo));
         }
     }
-    return rv;
+    return module_qom_types;
+}
+
+int module_load_qom(const char *type, Error **errp)
+{
+    const QemuModinfo *modinfo;
+
+    if (!type) {
+        error_setg(errp, "%s", "type is NULL");
+        return -1;
+    }
+
+    trace_module_lookup_object_type(type);
+    modinfo = g_hash_table_lookup(module_qom_types_get(), type);
+    if (!modinfo) {
+        return 0;
+    }
+    if (modinfo == &module_qom_ambiguous) {
+        error_setg(errp, "multiple modules providing '%s'", type);
+        return -1;
+    }
+    return module_load("", modinfo->name, errp);
 }
 
 void module_load_qom_all(void)
@@ -504,7 +504,7 @@ static int touch_all_pages(char *area, size_t hpagesize, size_t numpages,
     if (async) {
         /*
          * async requests currently require the BQL. Add it to the list and kick
-         * preallocation off during qemu_finish_async_prealloc_mem().
+         * preallocation off during qemu_start_async_prealloc_mem().
          */
         assert(bql_locked());
         QLIST_INSERT_HEAD(&memset_contexts, context, next);
@@ -528,15 +528,13 @@ static int touch_all_pages(char *area, size_t hpagesize, size_t numpages,
     return ret;
 }
 
-bool qemu_finish_async_prealloc_mem(Error **errp)
+void qemu_start_async_prealloc_mem(void)
 {
-    int ret = 0, tmp;
-    MemsetContext *context, *next_context;
+    MemsetContext *context;
 
-    /* Waiting for preallocation requires the BQL. */
     assert(bql_locked());
     if (QLIST_EMPTY(&memset_contexts)) {
-        return true;
+        return;
     }
 
     qemu_mutex_lock(&page_mutex);
@@ -545,6 +543,20 @@ bool qemu_finish_async_prealloc_mem(Error **errp)
     }
     qemu_cond_broadcast(&page_cond);
     qemu_mutex_unlock(&page_mutex);
+}
+
+bool qemu_finish_async_prealloc_mem(Error **errp)
+{
+    int ret = 0, tmp;
+    MemsetContext *context, *next_context;
+
+    /* Waiting for preallocation requires the BQL. */
+    assert(bql_locked());
+    if (QLIST_EMPTY(&memset_contexts)) {
+        return true;
+    }
+
+    qemu_start_async_prealloc_mem();
 
     QLIST_FOREACH_SAFE(context, &memset_contexts, next, next_context) {
         QLIST_REMOVE(context, next);
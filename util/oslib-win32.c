@@ -278,6 +278,11 @@ bool qemu_prealloc_mem(int fd, char *area, size_t sz, int max_threads,
     return true;
 }
 
+void qemu_start_async_prealloc_mem(void)
+{
+    /* async prealloc not supported, there is nothing to start */
+}
+
 bool qemu_finish_async_prealloc_mem(Error **errp)
 {
     /* async prealloc not supported, there is nothing to finish */
@@ -37,6 +37,14 @@ enum {
  * batches whereas the maximum size of the global pool is controlled by the
  * qemu_coroutine_inc_pool_size() API.
  *
+ * Deleting a coroutine unmaps its stack, so a workload whose number of
+ * coroutines in flight oscillates around the size of the global pool keeps
+ * mapping and unmapping stacks.  The global pool therefore grows by one batch
+ * beyond its configured size whenever a batch would be thrown away after
+ * a thread found the pool empty since the last overflow, and shrinks back by
+ * one batch whenever it overflows with no such shortage in between.  The
+ * growth is bounded by the host limit given by get_global_pool_hard_max_size().
+ *
  * .-----------------------------------.
  * | Batch 1 | Batch 2 | Batch 3 | ... | global_pool
  * `-----------------------------------'
@@ -63,6 +71,10 @@ static QemuMutex global_pool_lock; /* protects the following variables */
 static CoroutinePool global_pool = QSLIST_HEAD_INITIALIZER(global_pool);
 static unsigned int global_pool_size;
 static unsigned int global_pool_max_size = COROUTINE_POOL_BATCH_MAX_SIZE;
+/* Size above global_pool_max_size adapted to the load */
+static unsigned int global_pool_extra_size;
+/* Whether a refill found the global pool empty since the last overflow */
+static bool global_pool_shortage;
 
 QEMU_DEFINE_STATIC_CO_TLS(CoroutinePool, local_pool);
 QEMU_DEFINE_STATIC_CO_TLS(Notifier, local_pool_cleanup_notifier);
@@ -144,6 +156,8 @@ static void coroutine_pool_refill_local(void)
         if (batch) {
             QSLIST_REMOVE_HEAD(&global_pool, next);
             global_pool_size -= batch->size;
+        } else {
+            global_pool_shortage = true;
         }
     }
 
@@ -157,16 +171,35 @@ static void coroutine_pool_refill_local(void)
 static void coroutine_pool_put_global(CoroutinePoolBatch *batch)
 {
     WITH_QEMU_LOCK_GUARD(&global_pool_lock) {
-        unsigned int max = MIN(global_pool_max_size,
+        unsigned int max = MIN(global_pool_max_size + global_pool_extra_size,
                                global_pool_hard_max_size);
 
-        if (global_pool_size < max) {
-            QSLIST_INSERT_HEAD(&global_pool, batch, next);
-
-            /* Overshooting the max pool size is allowed */
-            global_pool_size += batch->size;
-            return;
+        if (global_pool_size >= max) {
+            bool grow = global_pool_shortage &&
+                        max < global_pool_hard_max_size;
+
+            /*
+             * Coroutines are being both created and deleted, keep one more
+             * batch around.  Otherwise the extra size is not needed anymore.
+             */
+            global_pool_shortage = false;
+            if (grow) {
+                global_pool_extra_size += COROUTINE_POOL_BATCH_MAX_SIZE;
+            } else if (global_pool_extra_size) {
+                global_pool_extra_size -= COROUTINE_POOL_BATCH_MAX_SIZE;
+            }
+            trace_qemu_coroutine_pool_resize(global_pool_max_size,
+                                             global_pool_extra_size);
+            if (!grow) {
+                break;
+            }
         }
+
+        QSLIST_INSERT_HEAD(&global_pool, batch, next);
+
+        /* Overshooting the max pool size is allowed */
+        global_pool_size += batch->size;
+        return;
     }
 
     /* The global pool was full, so throw away this batch */
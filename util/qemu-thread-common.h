@@ -14,6 +14,7 @@
 #define QEMU_THREAD_COMMON_H
 
 #include "qemu/thread.h"
+#include "qemu/lock-sample.h"
 #include "trace.h"
 
 static inline void qemu_mutex_post_init(QemuMutex *mutex)
@@ -22,6 +23,7 @@ static inline void qemu_mutex_post_init(QemuMutex *mutex)
     mutex->file = NULL;
     mutex->line = 0;
 #endif
+    mutex->sample = NULL;
     mutex->initialized = true;
 }
 
@@ -48,6 +50,9 @@ static inline void qemu_mutex_pre_unlock(QemuMutex *mutex,
     mutex->file = NULL;
     mutex->line = 0;
 #endif
+    if (unlikely(mutex->sample)) {
+        lock_sample_release(mutex);
+    }
     trace_qemu_mutex_unlock(mutex, file, line);
 }
 
@@ -24,6 +24,7 @@
 
 #include "qemu/osdep.h"
 #include "qemu/main-loop.h"
+#include "qemu/bql-profile.h"
 #include "qemu/timer.h"
 #include "qemu/lockable.h"
 #include "sysemu/cpu-timers.h"
@@ -66,6 +67,16 @@ static QEMUClock qemu_clocks[QEMU_CLOCK_MAX];
 struct QEMUTimerList {
     QEMUClock *clock;
     QemuMutex active_timers_lock;
+    /*
+     * Pending timers, in a binary min-heap ordered by expire time and,
+     * for timers that expire at the same time, by the order in which
+     * they were armed.  active_timers is the root of the heap, or NULL
+     * if there are no pending timers, and can be read without the lock.
+     */
+    QEMUTimer **heap;
+    size_t heap_len;
+    size_t heap_size;
+    uint64_t next_seq;
     QEMUTimer *active_timers;
     QLIST_ENTRY(QEMUTimerList) list;
     QEMUTimerListNotifyCB *notify_cb;
@@ -117,6 +128,7 @@ void timerlist_free(QEMUTimerList *timer_list)
         QLIST_REMOVE(timer_list, list);
     }
     qemu_mutex_destroy(&timer_list->active_timers_lock);
+    g_free(timer_list->heap);
     g_free(timer_list);
 }
 
@@ -242,6 +254,38 @@ int64_t timerlist_deadline_ns(QEMUTimerList *timer_list)
     return delta;
 }
 
+/* Return true if @a fires before @b */
+static bool timer_before(QEMUTimer *a, QEMUTimer *b)
+{
+    return a->expire_time < b->expire_time ||
+           (a->expire_time == b->expire_time && a->seq < b->seq);
+}
+
+/*
+ * Find the first timer in the subtree rooted at @i that has no attributes
+ * outside @attr_mask, if it fires before @best.  A subtree whose root does
+ * not fire before @best can be skipped altogether.
+ */
+static QEMUTimer *timerlist_first_matching(QEMUTimerList *timer_list,
+                                           size_t i, int attr_mask,
+                                           QEMUTimer *best)
+{
+    QEMUTimer *ts;
+
+    if (i >= timer_list->heap_len) {
+        return best;
+    }
+    ts = timer_list->heap[i];
+    if (best && !timer_before(ts, best)) {
+        return best;
+    }
+    if (!(ts->attributes & ~attr_mask)) {
+        return ts;
+    }
+    best = timerlist_first_matching(timer_list, 2 * i + 1, attr_mask, best);
+    return timerlist_first_matching(timer_list, 2 * i + 2, attr_mask, best);
+}
+
 /* Calculate the soonest deadline across all timerlists attached
  * to the clock. This is used for the icount timeout so we
  * ignore whether or not the clock should be used in deadline
@@ -265,11 +309,8 @@ int64_t qemu_clock_deadline_ns_all(QEMUClockType type, int attr_mask)
             continue;
         }
         qemu_mutex_lock(&timer_list->active_timers_lock);
-        ts = timer_list->active_timers;
         /* Skip all external timers */
-        while (ts && (ts->attributes & ~attr_mask)) {
-            ts = ts->next;
-        }
+        ts = timerlist_first_matching(timer_list, 0, attr_mask, NULL);
         if (!ts) {
             qemu_mutex_unlock(&timer_list->active_timers_lock);
             continue;
@@ -378,43 +419,98 @@ void timer_deinit(QEMUTimer *ts)
     ts->timer_list = NULL;
 }
 
-static void timer_del_locked(QEMUTimerList *timer_list, QEMUTimer *ts)
+static void timerlist_heap_set(QEMUTimerList *timer_list, size_t i,
+                               QEMUTimer *ts)
 {
-    QEMUTimer **pt, *t;
+    timer_list->heap[i] = ts;
+    ts->heap_index = i;
+}
 
-    ts->expire_time = -1;
-    pt = &timer_list->active_timers;
-    for(;;) {
-        t = *pt;
-        if (!t)
-            break;
-        if (t == ts) {
-            qatomic_set(pt, t->next);
+static void timerlist_heap_up(QEMUTimerList *timer_list, size_t i)
+{
+    QEMUTimer *ts = timer_list->heap[i];
+
+    while (i > 0) {
+        size_t parent = (i - 1) / 2;
+
+        if (!timer_before(ts, timer_list->heap[parent])) {
             break;
         }
-        pt = &t->next;
+        timerlist_heap_set(timer_list, i, timer_list->heap[parent]);
+        i = parent;
     }
+    timerlist_heap_set(timer_list, i, ts);
 }
 
-static bool timer_mod_ns_locked(QEMUTimerList *timer_list,
-                                QEMUTimer *ts, int64_t expire_time)
+static void timerlist_heap_down(QEMUTimerList *timer_list, size_t i)
 {
-    QEMUTimer **pt, *t;
+    QEMUTimer *ts = timer_list->heap[i];
 
-    /* add the timer in the sorted list */
-    pt = &timer_list->active_timers;
     for (;;) {
-        t = *pt;
-        if (!timer_expired_ns(t, expire_time)) {
+        size_t child = 2 * i + 1;
+
+        if (child >= timer_list->heap_len) {
+            break;
+        }
+        if (child + 1 < timer_list->heap_len &&
+            timer_before(timer_list->heap[child + 1],
+                         timer_list->heap[child])) {
+            child++;
+        }
+        if (!timer_before(timer_list->heap[child], ts)) {
             break;
         }
-        pt = &t->next;
+        timerlist_heap_set(timer_list, i, timer_list->heap[child]);
+        i = child;
     }
+    timerlist_heap_set(timer_list, i, ts);
+}
+
+static void timerlist_update_head(QEMUTimerList *timer_list)
+{
+    qatomic_set(&timer_list->active_timers,
+                timer_list->heap_len ? timer_list->heap[0] : NULL);
+}
+
+static void timer_del_locked(QEMUTimerList *timer_list, QEMUTimer *ts)
+{
+    size_t i = ts->heap_index;
+    QEMUTimer *last;
+
+    if (ts->expire_time == -1) {
+        return;
+    }
+    ts->expire_time = -1;
+
+    last = timer_list->heap[--timer_list->heap_len];
+    if (last != ts) {
+        timerlist_heap_set(timer_list, i, last);
+        if (i > 0 && timer_before(last, timer_list->heap[(i - 1) / 2])) {
+            timerlist_heap_up(timer_list, i);
+        } else {
+            timerlist_heap_down(timer_list, i);
+        }
+    }
+    timerlist_update_head(timer_list);
+}
+
+static bool timer_mod_ns_locked(QEMUTimerList *timer_list,
+                                QEMUTimer *ts, int64_t expire_time)
+{
+    if (timer_list->heap_len == timer_list->heap_size) {
+        timer_list->heap_size = MAX(timer_list->heap_size * 2, 16);
+        timer_list->heap = g_renew(QEMUTimer *, timer_list->heap,
+                                   timer_list->heap_size);
+    }
+
+    /* add the timer at the bottom of the heap and move it up */
     ts->expire_time = MAX(expire_time, 0);
-    ts->next = *pt;
-    qatomic_set(pt, ts);
+    ts->seq = timer_list->next_seq++;
+    timerlist_heap_set(timer_list, timer_list->heap_len++, ts);
+    timerlist_heap_up(timer_list, ts->heap_index);
+    timerlist_update_head(timer_list);
 
-    return pt == &timer_list->active_timers;
+    return ts->heap_index == 0;
 }
 
 static void timerlist_rearm(QEMUTimerList *timer_list)
@@ -498,6 +594,19 @@ bool timer_expired(QEMUTimer *timer_head, int64_t current_time)
     return timer_expired_ns(timer_head, current_time * timer_head->scale);
 }
 
+static void timer_run_profiled(QEMUTimerCB *cb, void *opaque)
+{
+    int64_t start = bql_profile_begin();
+    char name[32];
+
+    cb(opaque);
+    if (start) {
+        /* Timers have no name, report the callback for gdb or addr2line */
+        snprintf(name, sizeof(name), "%p", cb);
+        bql_profile_end(BQL_PROFILE_TIMER, name, start);
+    }
+}
+
 bool timerlist_run_timers(QEMUTimerList *timer_list)
 {
     QEMUTimer *ts;
@@ -565,15 +674,17 @@ bool timerlist_run_timers(QEMUTimerList *timer_list)
         }
 
         /* remove timer from the list before calling the callback */
-        timer_list->active_timers = ts->next;
-        ts->next = NULL;
-        ts->expire_time = -1;
+        timer_del_locked(timer_list, ts);
         cb = ts->cb;
         opaque = ts->opaque;
 
         /* run the callback (the timer list can be modified) */
         qemu_mutex_unlock(&timer_list->active_timers_lock);
-        cb(opaque);
+        if (bql_profile_is_enabled()) {
+            timer_run_profiled(cb, opaque);
+        } else {
+            cb(opaque);
+        }
         qemu_mutex_lock(&timer_list->active_timers_lock);
 
         progress = true;
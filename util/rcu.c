@@ -32,6 +32,8 @@
 #include "qemu/thread.h"
 #include "qemu/main-loop.h"
 #include "qemu/lockable.h"
+#include "qemu/timer.h"
+#include "trace.h"
 #if defined(CONFIG_MALLOC_TRIM)
 #include <malloc.h>
 #endif
@@ -47,6 +49,7 @@ unsigned long rcu_gp_ctr = RCU_GP_LOCKED;
 
 QemuEvent rcu_gp_event;
 static int in_drain_call_rcu;
+static bool rcu_expedited;
 static QemuMutex rcu_registry_lock;
 static QemuMutex rcu_sync_lock;
 
@@ -106,7 +109,8 @@ static void wait_for_readers(void)
                  * get some extra futex wakeups.
                  */
                 qatomic_set(&index->waiting, false);
-            } else if (qatomic_read(&in_drain_call_rcu)) {
+            } else if (qatomic_read(&in_drain_call_rcu) ||
+                       qatomic_read(&rcu_expedited)) {
                 notifier_list_notify(&index->force_rcu, NULL);
             }
         }
@@ -176,6 +180,12 @@ void synchronize_rcu(void)
 
 #define RCU_CALL_MIN_SIZE        30
 
+/*
+ * Backlog of callbacks above which readers are asked to leave their
+ * critical sections, as done by drain_call_rcu(), to shorten grace periods.
+ */
+#define RCU_CALL_EXPEDITE_SIZE   1000
+
 /* Multi-producer, single-consumer queue based on urcu/static/wfqueue.h
  * from liburcu.  Note that head is only used by the consumer.
  */
@@ -252,6 +262,19 @@ retry:
     return node;
 }
 
+/*
+ * Callbacks whose grace period has elapsed are handed by call_rcu_thread
+ * to rcu_reclaim_thread, which runs them under the BQL.  This way, the
+ * grace period for the next batch elapses while the callbacks of the
+ * previous one are running.
+ */
+static QemuCond rcu_reclaim_cond;
+static QemuMutex rcu_reclaim_lock; /* protects the following two variables */
+static struct rcu_head *rcu_reclaim_head;
+static struct rcu_head **rcu_reclaim_tail = &rcu_reclaim_head;
+/* Number of callbacks handed to rcu_reclaim_thread and not done yet */
+static int rcu_reclaim_count;
+
 static void *call_rcu_thread(void *opaque)
 {
     struct rcu_head *node;
@@ -259,14 +282,19 @@ static void *call_rcu_thread(void *opaque)
     rcu_register_thread();
 
     for (;;) {
+        struct rcu_head *first, **last = &first;
         int tries = 0;
         int n = qatomic_read(&rcu_call_count);
+        int backlog;
+        int64_t start;
 
-        /* Heuristically wait for a decent number of callbacks to pile up.
+        /* Heuristically wait for a decent number of callbacks to pile up,
+         * unless somebody is waiting for them in drain_call_rcu().
          * Fetch rcu_call_count now, we only must process elements that were
          * added before synchronize_rcu() starts.
          */
-        while (n == 0 || (n < RCU_CALL_MIN_SIZE && ++tries <= 5)) {
+        while (n == 0 || (n < RCU_CALL_MIN_SIZE && ++tries <= 5 &&
+                          !qatomic_read(&in_drain_call_rcu))) {
             g_usleep(10000);
             if (n == 0) {
                 qemu_event_reset(&rcu_call_ready_event);
@@ -282,25 +310,72 @@ static void *call_rcu_thread(void *opaque)
         }
 
         qatomic_sub(&rcu_call_count, n);
+        backlog = n + qatomic_read(&rcu_call_count) +
+                  qatomic_read(&rcu_reclaim_count);
+        qatomic_set(&rcu_expedited, backlog >= RCU_CALL_EXPEDITE_SIZE);
+
+        start = get_clock();
         synchronize_rcu();
-        bql_lock();
+        trace_call_rcu_grace_period(n, backlog, get_clock() - start);
+
+        qatomic_add(&rcu_reclaim_count, n);
         while (n > 0) {
             node = try_dequeue();
             while (!node) {
-                bql_unlock();
                 qemu_event_reset(&rcu_call_ready_event);
                 node = try_dequeue();
                 if (!node) {
                     qemu_event_wait(&rcu_call_ready_event);
                     node = try_dequeue();
                 }
-                bql_lock();
             }
 
             n--;
+            /* node->next is not used by the queue anymore */
+            *last = node;
+            last = &node->next;
+        }
+        *last = NULL;
+
+        WITH_QEMU_LOCK_GUARD(&rcu_reclaim_lock) {
+            *rcu_reclaim_tail = first;
+            rcu_reclaim_tail = last;
+            qemu_cond_signal(&rcu_reclaim_cond);
+        }
+    }
+    abort();
+}
+
+static void *rcu_reclaim_thread(void *opaque)
+{
+    struct rcu_head *node, *next;
+    int n;
+
+    rcu_register_thread();
+
+    for (;;) {
+        WITH_QEMU_LOCK_GUARD(&rcu_reclaim_lock) {
+            while (!rcu_reclaim_head) {
+                qemu_cond_wait(&rcu_reclaim_cond, &rcu_reclaim_lock);
+            }
+            node = rcu_reclaim_head;
+            rcu_reclaim_head = NULL;
+            rcu_reclaim_tail = &rcu_reclaim_head;
+        }
+
+        n = 0;
+        bql_lock();
+        while (node) {
+            /* the callback is likely to free node */
+            next = node->next;
             node->func(node);
+            node = next;
+            n++;
         }
         bql_unlock();
+
+        qatomic_sub(&rcu_reclaim_count, n);
+        trace_call_rcu_reclaim(n);
     }
     abort();
 }
@@ -409,11 +484,16 @@ static void rcu_init_complete(void)
 
     qemu_event_init(&rcu_call_ready_event, false);
 
-    /* The caller is assumed to have BQL, so the call_rcu thread
-     * must have been quiescent even after forking, just recreate it.
+    qemu_mutex_init(&rcu_reclaim_lock);
+    qemu_cond_init(&rcu_reclaim_cond);
+
+    /* The caller is assumed to have BQL, so the call_rcu threads
+     * must have been quiescent even after forking, just recreate them.
      */
     qemu_thread_create(&thread, "call_rcu", call_rcu_thread,
                        NULL, QEMU_THREAD_DETACHED);
+    qemu_thread_create(&thread, "rcu_reclaim", rcu_reclaim_thread,
+                       NULL, QEMU_THREAD_DETACHED);
 
     rcu_register_thread();
 }
@@ -439,6 +519,7 @@ static void rcu_init_lock(void)
 
     qemu_mutex_lock(&rcu_sync_lock);
     qemu_mutex_lock(&rcu_registry_lock);
+    qemu_mutex_lock(&rcu_reclaim_lock);
 }
 
 static void rcu_init_unlock(void)
@@ -447,6 +528,7 @@ static void rcu_init_unlock(void)
         return;
     }
 
+    qemu_mutex_unlock(&rcu_reclaim_lock);
     qemu_mutex_unlock(&rcu_registry_lock);
     qemu_mutex_unlock(&rcu_sync_lock);
 }
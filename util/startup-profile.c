@@ -0,0 +1,123 @@
+/*
+ * Startup time profiling
+ *
+ * Copyright (c) 2024 The QEMU Project Developers
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/startup-profile.h"
+#include "qemu/timer.h"
+
+bool startup_profile_active;
+
+static GArray *entries;
+/* Wall-clock time of process start, and end of the last phase */
+static int64_t process_start_ns;
+static StartupProfileTime last_phase;
+
+static int64_t get_cpu_time_ns(void)
+{
+#ifdef CLOCK_PROCESS_CPUTIME_ID
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts) == 0) {
+        return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+    }
+#endif
+    return 0;
+}
+
+static void __attribute__((constructor)) startup_profile_init(void)
+{
+    /* As good an approximation of exec() as we can get */
+    process_start_ns = get_clock();
+}
+
+StartupProfileTime startup_profile_now(void)
+{
+    return (StartupProfileTime) {
+        .wall_ns = get_clock(),
+        .cpu_ns = get_cpu_time_ns(),
+    };
+}
+
+void startup_profile_start(void)
+{
+    entries = g_array_new(false, false, sizeof(StartupProfileSpan));
+    last_phase = (StartupProfileTime) {
+        .wall_ns = process_start_ns,
+        .cpu_ns = 0,
+    };
+    startup_profile_active = true;
+}
+
+static void startup_profile_add(StartupProfileSpanKind kind, const char *name,
+                                StartupProfileTime start,
+                                StartupProfileTime end)
+{
+    StartupProfileSpan e = {
+        .kind = kind,
+        .name = g_strdup(name),
+        .end_ns = end.wall_ns - process_start_ns,
+        .wall_ns = end.wall_ns - start.wall_ns,
+        .cpu_ns = end.cpu_ns - start.cpu_ns,
+    };
+
+    g_array_append_val(entries, e);
+}
+
+void startup_profile_phase(const char *name)
+{
+    StartupProfileTime now;
+
+    if (!startup_profile_active) {
+        return;
+    }
+    now = startup_profile_now();
+    startup_profile_add(STARTUP_PROFILE_PHASE, name, last_phase, now);
+    last_phase = now;
+}
+
+void startup_profile_realized(const char *name, StartupProfileTime start)
+{
+    if (startup_profile_active) {
+        startup_profile_add(STARTUP_PROFILE_REALIZE, name, start,
+                            startup_profile_now());
+    }
+}
+
+void startup_profile_finish(void)
+{
+    startup_profile_active = false;
+}
+
+void startup_profile_foreach(void (*fn)(const StartupProfileSpan *e,
+                                        void *opaque),
+                             void *opaque)
+{
+    guint i;
+
+    for (i = 0; entries && i < entries->len; i++) {
+        fn(&g_array_index(entries, StartupProfileSpan, i), opaque);
+    }
+}
+
+static void startup_profile_print_entry(const StartupProfileSpan *e,
+                                        void *opaque)
+{
+    fprintf(stderr, "%10.3f %10.3f %10.3f  %s%s\n",
+            e->end_ns / (double)SCALE_MS, e->wall_ns / (double)SCALE_MS,
+            e->cpu_ns / (double)SCALE_MS,
+            e->kind == STARTUP_PROFILE_REALIZE ? "  realize " : "",
+            e->name);
+}
+
+void startup_profile_print(void)
+{
+    fprintf(stderr, "%10s %10s %10s  %s\n", "end-ms", "wall-ms", "cpu-ms",
+            "phase");
+    startup_profile_foreach(startup_profile_print_entry, NULL);
+}
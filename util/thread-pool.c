@@ -15,6 +15,7 @@
  * GNU GPL, version 2 or (at your option) any later version.
  */
 #include "qemu/osdep.h"
+#include "qemu/counters.h"
 #include "qemu/defer-call.h"
 #include "qemu/queue.h"
 #include "qemu/thread.h"
@@ -22,10 +23,12 @@
 #include "trace.h"
 #include "block/thread-pool.h"
 #include "qemu/main-loop.h"
+#include "qemu/lockable.h"
 
-static void do_spawn_thread(ThreadPool *pool);
+static void do_spawn_thread(ThreadPoolAio *pool);
 
-typedef struct ThreadPoolElement ThreadPoolElement;
+typedef struct ThreadPoolElementAio ThreadPoolElementAio;
+typedef struct ThreadPoolQueue ThreadPoolQueue;
 
 enum ThreadState {
     THREAD_QUEUED,
@@ -33,27 +36,41 @@ enum ThreadState {
     THREAD_DONE,
 };
 
-struct ThreadPoolElement {
+struct ThreadPoolElementAio {
     BlockAIOCB common;
-    ThreadPool *pool;
+    ThreadPoolAio *pool;
+    ThreadPoolQueue *queue;
     ThreadPoolFunc *func;
     void *arg;
 
-    /* Moving state out of THREAD_QUEUED is protected by lock.  After
+    /* Moving state out of THREAD_QUEUED is protected by queue->lock.  After
      * that, only the worker thread can write to it.  Reads and writes
      * of state and ret are ordered with memory barriers.
      */
     enum ThreadState state;
     int ret;
 
-    /* Access to this list is protected by lock.  */
-    QTAILQ_ENTRY(ThreadPoolElement) reqs;
+    /* Access to this list is protected by queue->lock.  */
+    QTAILQ_ENTRY(ThreadPoolElementAio) reqs;
 
     /* This list is only written by the thread pool's mother thread.  */
-    QLIST_ENTRY(ThreadPoolElement) all;
+    QLIST_ENTRY(ThreadPoolElementAio) all;
 };
 
-struct ThreadPool {
+/*
+ * Requests are spread over several queues so that the submitting thread and
+ * the workers do not all serialize on a single lock.  Each worker takes
+ * requests from its own queue first and steals from the others when it is
+ * empty.
+ */
+#define THREAD_POOL_QUEUES 8
+
+struct ThreadPoolQueue {
+    QemuMutex lock;
+    QTAILQ_HEAD(, ThreadPoolElementAio) request_list;
+};
+
+struct ThreadPoolAio {
     AioContext *ctx;
     QEMUBH *completion_bh;
     QemuMutex lock;
@@ -61,65 +78,122 @@ struct ThreadPool {
     QemuCond request_cond;
     QEMUBH *new_thread_bh;
 
+    ThreadPoolQueue queues[THREAD_POOL_QUEUES];
+    /* Number of queued requests in all queues, accessed with atomics */
+    int queued;
+
     /* The following variables are only accessed from one AioContext. */
-    QLIST_HEAD(, ThreadPoolElement) head;
+    QLIST_HEAD(, ThreadPoolElementAio) head;
+    unsigned next_queue;
 
-    /* The following variables are protected by lock.  */
-    QTAILQ_HEAD(, ThreadPoolElement) request_list;
+    /*
+     * The following variables are protected by lock.  cur_threads,
+     * idle_threads and max_threads are also read with atomics without
+     * the lock as a hint.
+     */
     int cur_threads;
     int idle_threads;
     int new_threads;     /* backlog of threads we need to create */
     int pending_threads; /* threads created but not running yet */
     int min_threads;
     int max_threads;
+    unsigned next_home_queue;
 };
 
+/* Take the first queued request, starting from queue @home */
+static ThreadPoolElementAio *thread_pool_take(ThreadPoolAio *pool,
+                                              unsigned home)
+{
+    int i;
+
+    if (!qatomic_read(&pool->queued)) {
+        return NULL;
+    }
+
+    for (i = 0; i < THREAD_POOL_QUEUES; i++) {
+        ThreadPoolQueue *q = &pool->queues[(home + i) % THREAD_POOL_QUEUES];
+        ThreadPoolElementAio *req;
+
+        WITH_QEMU_LOCK_GUARD(&q->lock) {
+            req = QTAILQ_FIRST(&q->request_list);
+            if (req) {
+                QTAILQ_REMOVE(&q->request_list, req, reqs);
+                qatomic_dec(&pool->queued);
+                req->state = THREAD_ACTIVE;
+                return req;
+            }
+        }
+    }
+    return NULL;
+}
+
 static void *worker_thread(void *opaque)
 {
-    ThreadPool *pool = opaque;
+    ThreadPoolAio *pool = opaque;
+    ThreadPoolElementAio *req;
+    unsigned home;
 
     qemu_mutex_lock(&pool->lock);
     pool->pending_threads--;
+    home = pool->next_home_queue++ % THREAD_POOL_QUEUES;
     do_spawn_thread(pool);
 
     while (pool->cur_threads <= pool->max_threads) {
-        ThreadPoolElement *req;
-        int ret;
-
-        if (QTAILQ_EMPTY(&pool->request_list)) {
-            pool->idle_threads++;
-            ret = qemu_cond_timedwait(&pool->request_cond, &pool->lock, 10000);
-            pool->idle_threads--;
-            if (ret == 0 &&
-                QTAILQ_EMPTY(&pool->request_list) &&
-                pool->cur_threads > pool->min_threads) {
-                /* Timed out + no work to do + no need for warm threads = exit.  */
-                break;
-            }
+        req = thread_pool_take(pool, home);
+        if (!req) {
+            bool timed_out = false;
+
+            qatomic_set(&pool->idle_threads, pool->idle_threads + 1);
             /*
-             * Even if there was some work to do, check if there aren't
-             * too many worker threads before picking it up.
+             * Write idle_threads before reading queued.  Pairs with
+             * smp_mb() in thread_pool_submit_aio().
              */
-            continue;
+            smp_mb();
+            req = thread_pool_take(pool, home);
+            if (!req) {
+                timed_out = !qemu_cond_timedwait(&pool->request_cond,
+                                                 &pool->lock, 10000);
+            }
+            qatomic_set(&pool->idle_threads, pool->idle_threads - 1);
+
+            if (!req) {
+                if (timed_out &&
+                    !qatomic_read(&pool->queued) &&
+                    pool->cur_threads > pool->min_threads) {
+                    /*
+                     * Timed out + no work to do + no need for warm
+                     * threads = exit.
+                     */
+                    break;
+                }
+                /*
+                 * Even if there was some work to do, check if there aren't
+                 * too many worker threads before picking it up.
+                 */
+                continue;
+            }
         }
-
-        req = QTAILQ_FIRST(&pool->request_list);
-        QTAILQ_REMOVE(&pool->request_list, req, reqs);
-        req->state = THREAD_ACTIVE;
         qemu_mutex_unlock(&pool->lock);
 
-        ret = req->func(req->arg);
+        /* Run requests without going through pool->lock while there are any */
+        do {
+            req->ret = req->func(req->arg);
+            /* Write ret before state.  */
+            smp_wmb();
+            req->state = THREAD_DONE;
+
+            qemu_bh_schedule(pool->completion_bh);
 
-        req->ret = ret;
-        /* Write ret before state.  */
-        smp_wmb();
-        req->state = THREAD_DONE;
+            if (qatomic_read(&pool->cur_threads) >
+                qatomic_read(&pool->max_threads)) {
+                break;
+            }
+        } while ((req = thread_pool_take(pool, home)));
 
-        qemu_bh_schedule(pool->completion_bh);
         qemu_mutex_lock(&pool->lock);
     }
 
-    pool->cur_threads--;
+    qatomic_set(&pool->cur_threads, pool->cur_threads - 1);
     qemu_cond_signal(&pool->worker_stopped);
 
     /*
@@ -131,7 +205,7 @@ static void *worker_thread(void *opaque)
     return NULL;
 }
 
-static void do_spawn_thread(ThreadPool *pool)
+static void do_spawn_thread(ThreadPoolAio *pool)
 {
     QemuThread t;
 
@@ -148,16 +222,16 @@ static void do_spawn_thread(ThreadPool *pool)
 
 static void spawn_thread_bh_fn(void *opaque)
 {
-    ThreadPool *pool = opaque;
+    ThreadPoolAio *pool = opaque;
 
     qemu_mutex_lock(&pool->lock);
     do_spawn_thread(pool);
     qemu_mutex_unlock(&pool->lock);
 }
 
-static void spawn_thread(ThreadPool *pool)
+static void spawn_thread(ThreadPoolAio *pool)
 {
-    pool->cur_threads++;
+    qatomic_set(&pool->cur_threads, pool->cur_threads + 1);
     pool->new_threads++;
     /* If there are threads being created, they will spawn new workers, so
      * we don't spend time creating many threads in a loop holding a mutex or
@@ -171,10 +245,14 @@ static void spawn_thread(ThreadPool *pool)
     }
 }
 
+/* The difference is the number of requests in flight */
+QEMU_COUNTER_DEFINE(thread_pool_submitted, "thread-pool-submitted")
+QEMU_COUNTER_DEFINE(thread_pool_completed, "thread-pool-completed")
+
 static void thread_pool_completion_bh(void *opaque)
 {
-    ThreadPool *pool = opaque;
-    ThreadPoolElement *elem, *next;
+    ThreadPoolAio *pool = opaque;
+    ThreadPoolElementAio *elem, *next;
 
     defer_call_begin(); /* cb() may use defer_call() to coalesce work */
 
@@ -187,6 +265,7 @@ restart:
         trace_thread_pool_complete(pool, elem, elem->common.opaque,
                                    elem->ret);
         QLIST_REMOVE(elem, all);
+        qemu_counter_inc(&thread_pool_completed);
 
         if (elem->common.cb) {
             /* Read state before ret.  */
@@ -217,14 +296,15 @@ restart:
 
 static void thread_pool_cancel(BlockAIOCB *acb)
 {
-    ThreadPoolElement *elem = (ThreadPoolElement *)acb;
-    ThreadPool *pool = elem->pool;
+    ThreadPoolElementAio *elem = (ThreadPoolElementAio *)acb;
+    ThreadPoolAio *pool = elem->pool;
 
     trace_thread_pool_cancel(elem, elem->common.opaque);
 
-    QEMU_LOCK_GUARD(&pool->lock);
+    QEMU_LOCK_GUARD(&elem->queue->lock);
     if (elem->state == THREAD_QUEUED) {
-        QTAILQ_REMOVE(&pool->request_list, elem, reqs);
+        QTAILQ_REMOVE(&elem->queue->request_list, elem, reqs);
+        qatomic_dec(&pool->queued);
         qemu_bh_schedule(pool->completion_bh);
 
         elem->state = THREAD_DONE;
@@ -234,16 +314,17 @@ static void thread_pool_cancel(BlockAIOCB *acb)
 }
 
 static const AIOCBInfo thread_pool_aiocb_info = {
-    .aiocb_size         = sizeof(ThreadPoolElement),
+    .aiocb_size         = sizeof(ThreadPoolElementAio),
     .cancel_async       = thread_pool_cancel,
 };
 
 BlockAIOCB *thread_pool_submit_aio(ThreadPoolFunc *func, void *arg,
                                    BlockCompletionFunc *cb, void *opaque)
 {
-    ThreadPoolElement *req;
+    ThreadPoolElementAio *req;
+    ThreadPoolQueue *q;
     AioContext *ctx = qemu_get_current_aio_context();
-    ThreadPool *pool = aio_get_thread_pool(ctx);
+    ThreadPoolAio *pool = aio_get_thread_pool(ctx);
 
     /* Assert that the thread submitting work is the same running the pool */
     assert(pool->ctx == qemu_get_current_aio_context());
@@ -253,18 +334,40 @@ BlockAIOCB *thread_pool_submit_aio(ThreadPoolFunc *func, void *arg,
     req->arg = arg;
     req->state = THREAD_QUEUED;
     req->pool = pool;
+    q = &pool->queues[pool->next_queue++ % THREAD_POOL_QUEUES];
+    req->queue = q;
 
     QLIST_INSERT_HEAD(&pool->head, req, all);
 
     trace_thread_pool_submit(pool, req, arg);
+    qemu_counter_inc(&thread_pool_submitted);
 
-    qemu_mutex_lock(&pool->lock);
-    if (pool->idle_threads == 0 && pool->cur_threads < pool->max_threads) {
-        spawn_thread(pool);
+    qatomic_inc(&pool->queued);
+    WITH_QEMU_LOCK_GUARD(&q->lock) {
+        QTAILQ_INSERT_TAIL(&q->request_list, req, reqs);
+    }
+
+    /*
+     * Write queued before reading idle_threads.  Pairs with smp_mb() in
+     * worker_thread().  Busy workers pick up the request when they finish
+     * their current one, only take pool->lock to wake up an idle worker or
+     * to start a new one.
+     */
+    smp_mb();
+    if (qatomic_read(&pool->idle_threads)) {
+        WITH_QEMU_LOCK_GUARD(&pool->lock) {
+            qemu_cond_signal(&pool->request_cond);
+        }
+    } else if (qatomic_read(&pool->cur_threads) <
+               qatomic_read(&pool->max_threads)) {
+        WITH_QEMU_LOCK_GUARD(&pool->lock) {
+            if (pool->idle_threads == 0 &&
+                pool->cur_threads < pool->max_threads) {
+                spawn_thread(pool);
+            }
+            qemu_cond_signal(&pool->request_cond);
+        }
     }
-    QTAILQ_INSERT_TAIL(&pool->request_list, req, reqs);
-    qemu_mutex_unlock(&pool->lock);
-    qemu_cond_signal(&pool->request_cond);
     return &req->common;
 }
 
@@ -295,12 +398,12 @@ void thread_pool_submit(ThreadPoolFunc *func, void *arg)
     thread_pool_submit_aio(func, arg, NULL, NULL);
 }
 
-void thread_pool_update_params(ThreadPool *pool, AioContext *ctx)
+void thread_pool_update_params(ThreadPoolAio *pool, AioContext *ctx)
 {
     qemu_mutex_lock(&pool->lock);
 
     pool->min_threads = ctx->thread_pool_min;
-    pool->max_threads = ctx->thread_pool_max;
+    qatomic_set(&pool->max_threads, ctx->thread_pool_max);
 
     /*
      * We either have to:
@@ -322,7 +425,7 @@ void thread_pool_update_params(ThreadPool *pool, AioContext *ctx)
     qemu_mutex_unlock(&pool->lock);
 }
 
-static void thread_pool_init_one(ThreadPool *pool, AioContext *ctx)
+static void thread_pool_init_one(ThreadPoolAio *pool, AioContext *ctx)
 {
     if (!ctx) {
         ctx = qemu_get_aio_context();
@@ -337,19 +440,22 @@ static void thread_pool_init_one(ThreadPool *pool, AioContext *ctx)
     pool->new_thread_bh = aio_bh_new(ctx, spawn_thread_bh_fn, pool);
 
     QLIST_INIT(&pool->head);
-    QTAILQ_INIT(&pool->request_list);
+    for (int i = 0; i < THREAD_POOL_QUEUES; i++) {
+        qemu_mutex_init(&pool->queues[i].lock);
+        QTAILQ_INIT(&pool->queues[i].request_list);
+    }
 
     thread_pool_update_params(pool, ctx);
 }
 
-ThreadPool *thread_pool_new(AioContext *ctx)
+ThreadPoolAio *thread_pool_new_aio(AioContext *ctx)
 {
-    ThreadPool *pool = g_new(ThreadPool, 1);
+    ThreadPoolAio *pool = g_new(ThreadPoolAio, 1);
     thread_pool_init_one(pool, ctx);
     return pool;
 }
 
-void thread_pool_free(ThreadPool *pool)
+void thread_pool_free_aio(ThreadPoolAio *pool)
 {
     if (!pool) {
         return;
@@ -361,11 +467,11 @@ void thread_pool_free(ThreadPool *pool)
 
     /* Stop new threads from spawning */
     qemu_bh_delete(pool->new_thread_bh);
-    pool->cur_threads -= pool->new_threads;
+    qatomic_set(&pool->cur_threads, pool->cur_threads - pool->new_threads);
     pool->new_threads = 0;
 
     /* Wait for worker threads to terminate */
-    pool->max_threads = 0;
+    qatomic_set(&pool->max_threads, 0);
     qemu_cond_broadcast(&pool->request_cond);
     while (pool->cur_threads > 0) {
         qemu_cond_wait(&pool->worker_stopped, &pool->lock);
@@ -374,8 +480,134 @@ void thread_pool_free(ThreadPool *pool)
     qemu_mutex_unlock(&pool->lock);
 
     qemu_bh_delete(pool->completion_bh);
+    for (int i = 0; i < THREAD_POOL_QUEUES; i++) {
+        qemu_mutex_destroy(&pool->queues[i].lock);
+    }
     qemu_cond_destroy(&pool->request_cond);
     qemu_cond_destroy(&pool->worker_stopped);
     qemu_mutex_destroy(&pool->lock);
     g_free(pool);
 }
+
+struct ThreadPool {
+    GThreadPool *t;
+    size_t cur_work;
+    QemuMutex cur_work_lock;
+    QemuCond all_finished_cond;
+};
+
+typedef struct {
+    ThreadPoolFunc *func;
+    void *opaque;
+    GDestroyNotify opaque_destroy;
+} ThreadPoolElement;
+
+static void thread_pool_func(gpointer data, gpointer user_data)
+{
+    ThreadPool *pool = user_data;
+    g_autofree ThreadPoolElement *el = data;
+
+    el->func(el->opaque);
+
+    if (el->opaque_destroy) {
+        el->opaque_destroy(el->opaque);
+    }
+
+    QEMU_LOCK_GUARD(&pool->cur_work_lock);
+
+    assert(pool->cur_work > 0);
+    pool->cur_work--;
+
+    if (pool->cur_work == 0) {
+        qemu_cond_signal(&pool->all_finished_cond);
+    }
+}
+
+ThreadPool *thread_pool_new(void)
+{
+    ThreadPool *pool = g_new(ThreadPool, 1);
+
+    pool->cur_work = 0;
+    qemu_mutex_init(&pool->cur_work_lock);
+    qemu_cond_init(&pool->all_finished_cond);
+
+    pool->t = g_thread_pool_new(thread_pool_func, pool, 0, TRUE, NULL);
+    /*
+     * g_thread_pool_new() can only return errors if initial thread(s)
+     * creation fails but we ask for 0 initial threads above.
+     */
+    assert(pool->t);
+
+    return pool;
+}
+
+void thread_pool_free(ThreadPool *pool)
+{
+    if (!pool) {
+        return;
+    }
+
+    /*
+     * With _wait = TRUE this effectively waits for all
+     * previously submitted work to complete first.
+     */
+    g_thread_pool_free(pool->t, FALSE, TRUE);
+
+    qemu_cond_destroy(&pool->all_finished_cond);
+    qemu_mutex_destroy(&pool->cur_work_lock);
+
+    g_free(pool);
+}
+
+void thread_pool_submit_work(ThreadPool *pool, ThreadPoolFunc *func,
+                             void *opaque, GDestroyNotify opaque_destroy)
+{
+    ThreadPoolElement *el = g_new(ThreadPoolElement, 1);
+
+    el->func = func;
+    el->opaque = opaque;
+    el->opaque_destroy = opaque_destroy;
+
+    WITH_QEMU_LOCK_GUARD(&pool->cur_work_lock) {
+        pool->cur_work++;
+    }
+
+    /*
+     * Ignore the return value since this function can only return errors
+     * if creation of an additional thread fails but even in this case the
+     * provided work is still getting queued (just for the existing threads).
+     */
+    g_thread_pool_push(pool->t, el, NULL);
+}
+
+void thread_pool_submit_immediate(ThreadPool *pool, ThreadPoolFunc *func,
+                                  void *opaque, GDestroyNotify opaque_destroy)
+{
+    thread_pool_submit_work(pool, func, opaque, opaque_destroy);
+    thread_pool_adjust_max_threads_to_work(pool);
+}
+
+void thread_pool_wait(ThreadPool *pool)
+{
+    QEMU_LOCK_GUARD(&pool->cur_work_lock);
+
+    while (pool->cur_work > 0) {
+        qemu_cond_wait(&pool->all_finished_cond,
+                       &pool->cur_work_lock);
+    }
+}
+
+bool thread_pool_set_max_threads(ThreadPool *pool,
+                                 int max_threads)
+{
+    assert(max_threads > 0);
+
+    return g_thread_pool_set_max_threads(pool->t, max_threads, NULL);
+}
+
+bool thread_pool_adjust_max_threads_to_work(ThreadPool *pool)
+{
+    QEMU_LOCK_GUARD(&pool->cur_work_lock);
+
+    return thread_pool_set_max_threads(pool, pool->cur_work);
+}
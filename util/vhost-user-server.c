@@ -44,6 +44,12 @@
  * dev->broken flag. Both vu_client_trip() and kick fd processing stop when
  * the dev->broken flag is set.
  *
+ * The kick fds can instead be handled in one AioContext per virtqueue, given
+ * by vhost_user_server_set_vq_aio_contexts(). libvhost-user is not
+ * thread-safe, so each virtqueue has a lock that is held while it is
+ * processed, and vu_client_trip() takes all of them while it handles a
+ * message.
+ *
  * It is possible to switch AioContexts using
  * vhost_user_server_detach_aio_context() and
  * vhost_user_server_attach_aio_context(). They stop monitoring fds in the old
@@ -95,6 +101,42 @@ bool vhost_user_server_has_in_flight(VuServer *server)
     return qatomic_load_acquire(&server->in_flight) > 0;
 }
 
+void vhost_user_server_lock_vq(VuServer *server, int idx)
+{
+    if (server->vq_threads) {
+        qemu_rec_mutex_lock(&server->vq_threads[idx].lock);
+    }
+}
+
+void vhost_user_server_unlock_vq(VuServer *server, int idx)
+{
+    if (server->vq_threads) {
+        qemu_rec_mutex_unlock(&server->vq_threads[idx].lock);
+    }
+}
+
+static void vu_lock_vqs(VuServer *server)
+{
+    if (server->vqs_locked) {
+        return;
+    }
+    for (int i = 0; i < server->max_queues; i++) {
+        vhost_user_server_lock_vq(server, i);
+    }
+    server->vqs_locked = true;
+}
+
+static void vu_unlock_vqs(VuServer *server)
+{
+    if (!server->vqs_locked) {
+        return;
+    }
+    server->vqs_locked = false;
+    for (int i = server->max_queues - 1; i >= 0; i--) {
+        vhost_user_server_unlock_vq(server, i);
+    }
+}
+
 static bool coroutine_fn
 vu_message_read(VuDev *vu_dev, int conn_fd, VhostUserMsg *vmsg)
 {
@@ -187,6 +229,8 @@ vu_message_read(VuDev *vu_dev, int conn_fd, VhostUserMsg *vmsg)
         }
     }
 
+    /* Keep the virtqueues still until vu_dispatch() has handled vmsg */
+    vu_lock_vqs(server);
     return true;
 
 fail:
@@ -208,8 +252,10 @@ static coroutine_fn void vu_client_trip(void *opaque)
         }
         /* vu_dispatch() returns false if server->ctx went away */
         if (!vu_dispatch(vu_dev) && server->ctx) {
+            vu_unlock_vqs(server);
             break;
         }
+        vu_unlock_vqs(server);
     }
 
     if (vhost_user_server_has_in_flight(server)) {
@@ -220,7 +266,9 @@ static coroutine_fn void vu_client_trip(void *opaque)
     }
     assert(!vhost_user_server_has_in_flight(server));
 
+    vu_lock_vqs(server);
     vu_deinit(vu_dev);
+    vu_unlock_vqs(server);
 
     /* vu_deinit() should have called remove_watch() */
     assert(QTAILQ_EMPTY(&server->vu_fd_watches));
@@ -249,17 +297,34 @@ static void kick_handler(void *opaque)
 {
     VuFdWatch *vu_fd_watch = opaque;
     VuDev *vu_dev = vu_fd_watch->vu_dev;
+    VuServer *server = container_of(vu_dev, VuServer, vu_dev);
+    /* Kick fds are the only watches, pvt is the virtqueue index */
+    int idx = (intptr_t)vu_fd_watch->pvt;
 
-    vu_fd_watch->cb(vu_dev, 0, vu_fd_watch->pvt);
+    vhost_user_server_lock_vq(server, idx);
+    /* The watch may have been removed while another thread held the lock */
+    if (vu_fd_watch->cb) {
+        vu_fd_watch->cb(vu_dev, 0, vu_fd_watch->pvt);
+    }
+    vhost_user_server_unlock_vq(server, idx);
 
     /* Stop vu_client_trip() if an error occurred in vu_fd_watch->cb() */
     if (vu_dev->broken) {
-        VuServer *server = container_of(vu_dev, VuServer, vu_dev);
-
         qio_channel_shutdown(server->ioc, QIO_CHANNEL_SHUTDOWN_BOTH, NULL);
     }
 }
 
+/* The AioContext in which @vu_fd_watch is handled */
+static AioContext *vu_fd_watch_ctx(VuServer *server, VuFdWatch *vu_fd_watch)
+{
+    if (server->vq_threads) {
+        VuVirtqThread *t = container_of(vu_fd_watch, VuVirtqThread, watch);
+
+        return server->vq_ctx[t - server->vq_threads];
+    }
+    return server->ctx;
+}
+
 static VuFdWatch *find_vu_fd_watch(VuServer *server, int fd)
 {
 
@@ -285,17 +350,25 @@ set_watch(VuDev *vu_dev, int fd, int vu_evt,
     VuFdWatch *vu_fd_watch = find_vu_fd_watch(server, fd);
 
     if (!vu_fd_watch) {
-        vu_fd_watch = g_new0(VuFdWatch, 1);
+        if (server->vq_threads) {
+            int idx = (intptr_t)pvt;
+
+            assert(idx >= 0 && idx < server->max_queues);
+            vu_fd_watch = &server->vq_threads[idx].watch;
+            assert(!vu_fd_watch->cb);
+        } else {
+            vu_fd_watch = g_new0(VuFdWatch, 1);
+        }
 
         QTAILQ_INSERT_TAIL(&server->vu_fd_watches, vu_fd_watch, next);
 
         vu_fd_watch->fd = fd;
         vu_fd_watch->cb = cb;
-        qemu_socket_set_nonblock(fd);
-        aio_set_fd_handler(server->ctx, fd, kick_handler,
-                           NULL, NULL, NULL, vu_fd_watch);
         vu_fd_watch->vu_dev = vu_dev;
         vu_fd_watch->pvt = pvt;
+        qemu_socket_set_nonblock(fd);
+        aio_set_fd_handler(vu_fd_watch_ctx(server, vu_fd_watch), fd,
+                           kick_handler, NULL, NULL, NULL, vu_fd_watch);
     }
 }
 
@@ -313,10 +386,17 @@ static void remove_watch(VuDev *vu_dev, int fd)
     if (!vu_fd_watch) {
         return;
     }
-    aio_set_fd_handler(server->ctx, fd, NULL, NULL, NULL, NULL, NULL);
+    aio_set_fd_handler(vu_fd_watch_ctx(server, vu_fd_watch), fd,
+                       NULL, NULL, NULL, NULL, NULL);
 
     QTAILQ_REMOVE(&server->vu_fd_watches, vu_fd_watch, next);
-    g_free(vu_fd_watch);
+    if (server->vq_threads) {
+        /* kick_handler() may still be waiting for the lock, don't free */
+        vu_fd_watch->cb = NULL;
+        vu_fd_watch->fd = -1;
+    } else {
+        g_free(vu_fd_watch);
+    }
 }
 
 
@@ -373,7 +453,8 @@ void vhost_user_server_stop(VuServer *server)
         VuFdWatch *vu_fd_watch;
 
         QTAILQ_FOREACH(vu_fd_watch, &server->vu_fd_watches, next) {
-            aio_set_fd_handler(server->ctx, vu_fd_watch->fd,
+            aio_set_fd_handler(vu_fd_watch_ctx(server, vu_fd_watch),
+                               vu_fd_watch->fd,
                                NULL, NULL, NULL, NULL, vu_fd_watch);
         }
 
@@ -386,6 +467,31 @@ void vhost_user_server_stop(VuServer *server)
         qio_net_listener_disconnect(server->listener);
         object_unref(OBJECT(server->listener));
     }
+
+    if (server->vq_threads) {
+        for (int i = 0; i < server->max_queues; i++) {
+            qemu_rec_mutex_destroy(&server->vq_threads[i].lock);
+        }
+        g_free(server->vq_threads);
+        server->vq_threads = NULL;
+    }
+}
+
+/*
+ * Handle the kick fd of virtqueue i in @vq_ctx[i], which must stay valid
+ * until vhost_user_server_stop().  Must be called before a client connects.
+ */
+void vhost_user_server_set_vq_aio_contexts(VuServer *server,
+                                           AioContext **vq_ctx)
+{
+    assert(!server->sioc && !server->vq_threads);
+
+    server->vq_ctx = vq_ctx;
+    server->vq_threads = g_new0(VuVirtqThread, server->max_queues);
+    for (int i = 0; i < server->max_queues; i++) {
+        server->vq_threads[i].watch.fd = -1;
+        qemu_rec_mutex_init(&server->vq_threads[i].lock);
+    }
 }
 
 /*
@@ -412,7 +518,8 @@ void vhost_user_server_attach_aio_context(VuServer *server, AioContext *ctx)
     }
 
     QTAILQ_FOREACH(vu_fd_watch, &server->vu_fd_watches, next) {
-        aio_set_fd_handler(ctx, vu_fd_watch->fd, kick_handler, NULL,
+        aio_set_fd_handler(vu_fd_watch_ctx(server, vu_fd_watch),
+                           vu_fd_watch->fd, kick_handler, NULL,
                            NULL, NULL, vu_fd_watch);
     }
 
@@ -444,7 +551,8 @@ void vhost_user_server_detach_aio_context(VuServer *server)
         VuFdWatch *vu_fd_watch;
 
         QTAILQ_FOREACH(vu_fd_watch, &server->vu_fd_watches, next) {
-            aio_set_fd_handler(server->ctx, vu_fd_watch->fd,
+            aio_set_fd_handler(vu_fd_watch_ctx(server, vu_fd_watch),
+                               vu_fd_watch->fd,
                                NULL, NULL, NULL, NULL, vu_fd_watch);
         }
     }